@@ -331,6 +331,7 @@ rm -rf %{buildroot}
 %{_mandir}/man3/val_add_valpolicy.3.gz
 %{_mandir}/man3/val_context_setqflags.3.gz
 %{_mandir}/man3/val_does_not_exist.3.gz
+%{_mandir}/man3/val_isstale.3.gz
 %{_mandir}/man3/val_free_response.3.gz
 %{_mandir}/man3/val_freeaddrinfo.3.gz
 
@@ -0,0 +1,259 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ *
+ * Counts the heap allocations made by val_resolve_and_check().  Each
+ * name is resolved three times: once with an empty cache, once more
+ * when the answer is cached in the context, and once from a fresh
+ * context, which can only find the answer in the process-wide cache.
+ *
+ * On glibc the allocator entry points are wrapped so that every call,
+ * from libval, libsres or the crypto library, is counted.  Elsewhere
+ * only timings are reported.
+ */
+
+#include "validator/validator-config.h"
+#include <validator/validator.h>
+#include <validator/resolver.h>
+
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#endif
+
+#define	NAME	"alloc_bench"
+#define	VERS	"version: 1.0"
+#define	DTVERS	"DNSSEC-Tools Version: 1.8"
+
+#define BENCH_DEFAULT_COUNT   1000
+
+#ifdef __GLIBC__
+#define BENCH_COUNT_ALLOCS 1
+
+extern void    *__libc_malloc(size_t);
+extern void    *__libc_calloc(size_t, size_t);
+extern void    *__libc_realloc(void *, size_t);
+extern void     __libc_free(void *);
+
+static volatile int counting = 0;
+static unsigned long alloc_calls = 0;
+static unsigned long free_calls = 0;
+static unsigned long alloc_bytes = 0;
+
+void *
+malloc(size_t size)
+{
+    if (counting) {
+        __sync_fetch_and_add(&alloc_calls, 1);
+        __sync_fetch_and_add(&alloc_bytes, size);
+    }
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    if (counting) {
+        __sync_fetch_and_add(&alloc_calls, 1);
+        __sync_fetch_and_add(&alloc_bytes, nmemb * size);
+    }
+    return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    if (counting) {
+        __sync_fetch_and_add(&alloc_calls, 1);
+        __sync_fetch_and_add(&alloc_bytes, size);
+    }
+    return __libc_realloc(ptr, size);
+}
+
+void
+free(void *ptr)
+{
+    if (counting && ptr)
+        __sync_fetch_and_add(&free_calls, 1);
+    __libc_free(ptr);
+}
+#endif
+
+void
+usage(char *progname)
+{
+    fprintf(stderr,
+            "Usage: %s [options] domain\n"
+            "Resolves <n>.domain for n = 0 .. count-1 three times: cold,\n"
+            "cached in the context, and from a fresh context.\n",
+            progname);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr,
+            "\t-h               display usage and exit\n"
+            "\t-n <count>       number of names (default %d)\n"
+            "\t-t <type>        record type (default A)\n"
+            "\t-v <file>        dnsval.conf file\n"
+            "\t-r <file>        resolv.conf file\n"
+            "\t-i <file>        root.hints file\n"
+            "\t-o <debug-level>:<dest-type>[:<dest-options>]\n"
+            "\t                 log target, see dt-validate(1)\n"
+            "\t-V               display version and exit\n",
+            BENCH_DEFAULT_COUNT);
+}
+
+void
+version(void)
+{
+    fprintf(stderr, "%s: %s\n", NAME, VERS);
+    fprintf(stderr, "%s\n", DTVERS);
+}
+
+static double
+elapsed(struct timeval *start)
+{
+    struct timeval  now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) +
+        (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static void
+run_pass(val_context_t *context, const char *label, char **names,
+         int count, int type_h)
+{
+    struct val_result_chain *results;
+    struct timeval  start;
+    double          t;
+    int             i, failed = 0;
+
+#ifdef BENCH_COUNT_ALLOCS
+    alloc_calls = free_calls = alloc_bytes = 0;
+    counting = 1;
+#endif
+    gettimeofday(&start, NULL);
+    for (i = 0; i < count; i++) {
+        results = NULL;
+        if (VAL_NO_ERROR != val_resolve_and_check(context, names[i], ns_c_in,
+                                                  type_h, 0, &results))
+            ++failed;
+        val_free_result_chain(results);
+    }
+    t = elapsed(&start);
+#ifdef BENCH_COUNT_ALLOCS
+    counting = 0;
+#endif
+
+    printf("%-6s %d names, %d failed, %.1f us/validation", label, count,
+           failed, t * 1000000.0 / count);
+#ifdef BENCH_COUNT_ALLOCS
+    printf(", %.1f allocs/validation (%.0f bytes), %.1f frees/validation",
+           (double) alloc_calls / count, (double) alloc_bytes / count,
+           (double) free_calls / count);
+#endif
+    printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    val_context_t  *context = NULL, *fresh = NULL;
+    char           *dnsval_conf = NULL, *resolv_conf = NULL, *root_hints = NULL;
+    char          **names;
+    const char     *domain;
+    int             count = BENCH_DEFAULT_COUNT;
+    int             type_h = ns_t_a;
+    int             i, rc, success;
+
+    while (1) {
+        int c = getopt(argc, argv, "hn:t:v:r:i:o:V");
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'h':
+            usage(argv[0]);
+            return -1;
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 't':
+            type_h = res_nametotype(optarg, &success);
+            if (!success) {
+                fprintf(stderr, "Unrecognized type %s\n", optarg);
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'v':
+            dnsval_conf = optarg;
+            break;
+        case 'r':
+            resolv_conf = optarg;
+            break;
+        case 'i':
+            root_hints = optarg;
+            break;
+        case 'o':
+            if (NULL == val_log_add_optarg(optarg, 1)) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'V':
+            version();
+            return 0;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (optind >= argc || count <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    domain = argv[optind];
+
+    names = (char **) calloc(count, sizeof(char *));
+    if (names == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        names[i] = (char *) malloc(strlen(domain) + 16);
+        if (names[i] == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            return -1;
+        }
+        sprintf(names[i], "%d.%s", i, domain);
+    }
+
+    if (VAL_NO_ERROR != (rc = val_create_context_with_conf(NULL, dnsval_conf,
+                                                           resolv_conf,
+                                                           root_hints,
+                                                           &context))) {
+        fprintf(stderr, "Cannot create context: %s\n", p_val_err(rc));
+        return -1;
+    }
+
+    /* a labelled context is never the shared default context */
+    if (VAL_NO_ERROR != (rc = val_create_context_with_conf(NAME, dnsval_conf,
+                                                           resolv_conf,
+                                                           root_hints,
+                                                           &fresh))) {
+        fprintf(stderr, "Cannot create context: %s\n", p_val_err(rc));
+        val_free_context(context);
+        return -1;
+    }
+
+    run_pass(context, "cold:", names, count, type_h);
+    run_pass(context, "cached:", names, count, type_h);
+    run_pass(fresh, "shared:", names, count, type_h);
+
+    val_free_context(fresh);
+    val_free_context(context);
+    for (i = 0; i < count; i++)
+        free(names[i]);
+    free(names);
+    return 0;
+}
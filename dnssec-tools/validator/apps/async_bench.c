@@ -0,0 +1,310 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ *
+ * Measures the throughput of the asynchronous validator API, submitting
+ * requests either one at a time with val_async_submit() or in batches
+ * with val_async_submit_batch(), and driving them either from the
+ * application's own loop or with the libval async runtime.
+ */
+
+#include "validator/validator-config.h"
+#include <validator/validator.h>
+#include <validator/resolver.h>
+
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#define	NAME	"async_bench"
+#define	VERS	"version: 1.0"
+#define	DTVERS	"DNSSEC-Tools Version: 1.8"
+
+#define BENCH_DEFAULT_COUNT   10000
+#define BENCH_DEFAULT_BATCH   1000
+
+#define BENCH_LOOP      0       /* val_async_check_wait() loop */
+#define BENCH_RT_INLINE 1       /* runtime, callbacks on runtime thread */
+#define BENCH_RT_NOTIFY 2       /* runtime, callbacks from dispatch */
+
+struct bench_stats {
+    int             completed;
+    int             failed;
+    int             canceled;
+#ifndef VAL_NO_THREADS
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+#endif
+};
+
+void
+usage(char *progname)
+{
+    fprintf(stderr,
+            "Usage: %s [options] domain\n"
+            "Resolves <n>.domain for n = 0 .. count-1.\n",
+            progname);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr,
+            "\t-h               display usage and exit\n"
+            "\t-n <count>       number of requests (default %d)\n"
+            "\t-b <batch>       requests per val_async_submit_batch() call;\n"
+            "\t                 0 submits one at a time (default %d)\n"
+            "\t-t <type>        record type (default A)\n"
+            "\t-R <mode>        drive requests with the async runtime;\n"
+            "\t                 mode is 'inline' or 'notify'\n"
+            "\t-v <file>        dnsval.conf file\n"
+            "\t-r <file>        resolv.conf file\n"
+            "\t-i <file>        root.hints file\n"
+            "\t-o <debug-level>:<dest-type>[:<dest-options>]\n"
+            "\t                 log target, see dt-validate(1)\n"
+            "\t-V               display version and exit\n",
+            BENCH_DEFAULT_COUNT, BENCH_DEFAULT_BATCH);
+}
+
+void
+version(void)
+{
+    fprintf(stderr, "%s: %s\n", NAME, VERS);
+    fprintf(stderr, "%s\n", DTVERS);
+}
+
+static int
+bench_callback(val_async_status *as, int event, val_context_t *ctx,
+               void *cb_data, val_cb_params_t *cbp)
+{
+    struct bench_stats *stats = (struct bench_stats *) cb_data;
+
+#ifndef VAL_NO_THREADS
+    pthread_mutex_lock(&stats->lock);
+#endif
+    if (VAL_AS_EVENT_CANCELED == event)
+        ++stats->canceled;
+    else if (cbp->retval != VAL_NO_ERROR)
+        ++stats->failed;
+    ++stats->completed;
+#ifndef VAL_NO_THREADS
+    pthread_cond_signal(&stats->cond);
+    pthread_mutex_unlock(&stats->lock);
+#endif
+
+    if (cbp->results) {
+        val_free_result_chain(cbp->results);
+        cbp->results = NULL;
+    }
+    if (cbp->answers) {
+        val_free_answer_chain(cbp->answers);
+        cbp->answers = NULL;
+    }
+    return 0;
+}
+
+static double
+elapsed(struct timeval *start)
+{
+    struct timeval  now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) +
+        (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    val_context_t  *context = NULL;
+    val_async_request_t *reqs = NULL;
+    val_async_status *as;
+    struct bench_stats stats;
+    struct timeval  start, tv;
+    char           *dnsval_conf = NULL, *resolv_conf = NULL, *root_hints = NULL;
+    char          **names;
+    const char     *domain;
+    int             count = BENCH_DEFAULT_COUNT;
+    int             batch = BENCH_DEFAULT_BATCH;
+    int             type_h = ns_t_a;
+    int             mode = BENCH_LOOP;
+    int             i, j, n, rc, success, submitted = 0;
+    double          submit_time, total_time;
+
+    while (1) {
+        int c = getopt(argc, argv, "hn:b:t:R:v:r:i:o:V");
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'h':
+            usage(argv[0]);
+            return -1;
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'b':
+            batch = atoi(optarg);
+            break;
+        case 't':
+            type_h = res_nametotype(optarg, &success);
+            if (!success) {
+                fprintf(stderr, "Unrecognized type %s\n", optarg);
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'R':
+            if (strcmp(optarg, "inline") == 0)
+                mode = BENCH_RT_INLINE;
+            else if (strcmp(optarg, "notify") == 0)
+                mode = BENCH_RT_NOTIFY;
+            else {
+                fprintf(stderr, "Unrecognized runtime mode %s\n", optarg);
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'v':
+            dnsval_conf = optarg;
+            break;
+        case 'r':
+            resolv_conf = optarg;
+            break;
+        case 'i':
+            root_hints = optarg;
+            break;
+        case 'o':
+            if (NULL == val_log_add_optarg(optarg, 1)) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'V':
+            version();
+            return 0;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (optind >= argc || count <= 0 || batch < 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    domain = argv[optind];
+
+    names = (char **) calloc(count, sizeof(char *));
+    reqs = (val_async_request_t *) calloc(batch ? batch : 1,
+                                          sizeof(val_async_request_t));
+    if (names == NULL || reqs == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        names[i] = (char *) malloc(strlen(domain) + 16);
+        if (names[i] == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            return -1;
+        }
+        sprintf(names[i], "%d.%s", i, domain);
+    }
+
+    if (VAL_NO_ERROR != (rc = val_create_context_with_conf(NULL, dnsval_conf,
+                                                           resolv_conf,
+                                                           root_hints,
+                                                           &context))) {
+        fprintf(stderr, "Cannot create context: %s\n", p_val_err(rc));
+        return -1;
+    }
+
+    memset(&stats, 0, sizeof(stats));
+#ifndef VAL_NO_THREADS
+    pthread_mutex_init(&stats.lock, NULL);
+    pthread_cond_init(&stats.cond, NULL);
+#endif
+    if (mode != BENCH_LOOP &&
+        VAL_NO_ERROR != (rc = val_async_runtime_start(context,
+                                   mode == BENCH_RT_NOTIFY ? VAL_RT_NOTIFY : 0,
+                                   NULL, NULL))) {
+        fprintf(stderr, "Cannot start async runtime: %s\n", p_val_err(rc));
+        return -1;
+    }
+
+    gettimeofday(&start, NULL);
+
+    for (i = 0; i < count; i += n) {
+        if (batch == 0) {
+            n = 1;
+            rc = val_async_submit(context, names[i], ns_c_in, type_h, 0,
+                                  &bench_callback, &stats, &as);
+            if (rc == VAL_NO_ERROR && as)
+                ++submitted;
+            continue;
+        }
+        n = (count - i < batch) ? count - i : batch;
+        for (j = 0; j < n; j++) {
+            reqs[j].name = names[i + j];
+            reqs[j].class_h = ns_c_in;
+            reqs[j].type_h = type_h;
+            reqs[j].flags = 0;
+            reqs[j].callback = &bench_callback;
+            reqs[j].cb_data = &stats;
+        }
+        if (VAL_NO_ERROR != val_async_submit_batch(context, reqs, n))
+            continue;
+        for (j = 0; j < n; j++) {
+            if (reqs[j].as)
+                ++submitted;
+        }
+    }
+    submit_time = elapsed(&start);
+
+    if (mode == BENCH_LOOP) {
+        while (stats.completed < submitted) {
+            tv.tv_sec = 0;
+            tv.tv_usec = 100000;
+            if (val_async_check_wait(context, NULL, NULL, &tv, 0) <= 0 &&
+                stats.completed < submitted) {
+                /* nothing pending; some completed without callbacks */
+                break;
+            }
+        }
+    } else if (mode == BENCH_RT_NOTIFY) {
+        int             fd = val_async_runtime_fd(context);
+        fd_set          fds;
+
+        while (stats.completed < submitted) {
+            FD_ZERO(&fds);
+            FD_SET(fd, &fds);
+            if (select(fd + 1, &fds, NULL, NULL, NULL) > 0)
+                val_async_runtime_dispatch(context);
+        }
+    }
+#ifndef VAL_NO_THREADS
+    else {
+        pthread_mutex_lock(&stats.lock);
+        while (stats.completed < submitted)
+            pthread_cond_wait(&stats.cond, &stats.lock);
+        pthread_mutex_unlock(&stats.lock);
+    }
+#endif
+    total_time = elapsed(&start);
+
+    if (mode != BENCH_LOOP)
+        val_async_runtime_stop(context);
+
+    printf("requests:   %d submitted, %d completed, %d failed\n",
+           submitted, stats.completed, stats.failed);
+    printf("submit:     %.3f s (%.1f us/request)\n", submit_time,
+           submitted ? submit_time * 1000000.0 / submitted : 0.0);
+    printf("total:      %.3f s (%.0f requests/s)\n", total_time,
+           total_time > 0 ? stats.completed / total_time : 0.0);
+
+    val_free_context(context);
+    for (i = 0; i < count; i++)
+        free(names[i]);
+    free(names);
+    free(reqs);
+    return 0;
+}
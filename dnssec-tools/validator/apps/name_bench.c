@@ -0,0 +1,236 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ *
+ * Times the case-insensitive name kernels at every level this CPU
+ * supports, over random mixed-case names of typical lengths: equal
+ * names under namecmp(), canonical ordering of sibling names that
+ * differ only in their first label, hashing and lower-casing.  Before
+ * timing, every level is checked to give the same results as the
+ * scalar code.
+ */
+
+#include "validator/validator-config.h"
+#include <validator/validator.h>
+#include <validator/resolver.h>
+
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#endif
+
+#define	NAME	"name_bench"
+#define	VERS	"version: 1.0"
+#define	DTVERS	"DNSSEC-Tools Version: 1.8"
+
+#define BENCH_DEFAULT_COUNT   1000000
+#define BENCH_NAMES           64
+
+static const int bench_lengths[] = { 16, 32, 64, 128, 253 };
+static const char *level_names[] = { "scalar", "sse2", "avx2" };
+
+void
+usage(char *progname)
+{
+    fprintf(stderr, "Usage: %s [options]\n", progname);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr,
+            "\t-h               display usage and exit\n"
+            "\t-n <count>       operations per measurement (default %d)\n"
+            "\t-V               display version and exit\n",
+            BENCH_DEFAULT_COUNT);
+}
+
+void
+version(void)
+{
+    fprintf(stderr, "%s: %s\n", NAME, VERS);
+    fprintf(stderr, "%s\n", DTVERS);
+}
+
+static double
+elapsed(struct timeval *start)
+{
+    struct timeval  now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) +
+        (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+/*
+ * A random wire-format name of exactly len bytes, labels of 3 to 15
+ * characters
+ */
+static void
+random_name(u_char *name_n, int len)
+{
+    static const char chars[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-";
+    int             off = 0, left, l, i;
+
+    while ((left = len - 1 - off) > 0) {
+        l = 3 + rand() % 13;
+        if (l + 1 > left || left - (l + 1) < 4)
+            l = left - 1;
+        name_n[off++] = (u_char) l;
+        for (i = 0; i < l; i++)
+            name_n[off++] = chars[rand() % (sizeof(chars) - 1)];
+    }
+    name_n[off] = 0;
+}
+
+/*
+ * The same name with the case of every letter flipped at random
+ */
+static void
+recase_name(u_char *dst, const u_char *src, int len)
+{
+    int             i;
+
+    for (i = 0; i < len; i++) {
+        dst[i] = src[i];
+        if (isalpha(src[i]) && (rand() & 1))
+            dst[i] ^= 0x20;
+    }
+}
+
+static int
+sign(int v)
+{
+    return (v > 0) - (v < 0);
+}
+
+/*
+ * Compare every level against the scalar code, returning the number
+ * of disagreements
+ */
+static int
+check(int best)
+{
+    u_char          a[NS_MAXCDNAME], b[NS_MAXCDNAME];
+    u_char          la[NS_MAXCDNAME], lb[NS_MAXCDNAME];
+    u_int32_t       h;
+    int             len, cmp, eq, i, j, lvl, bad = 0;
+
+    for (i = 0; i < 20000; i++) {
+        len = 1 + rand() % NS_MAXCDNAME;
+        for (j = 0; j < len; j++)
+            a[j] = (u_char) rand();
+        recase_name(b, a, len);
+        if (rand() & 1)
+            b[rand() % len] = (u_char) rand();
+
+        res_name_simd(RES_NAME_SCALAR);
+        res_name_lower(la, a, len);
+        h = res_name_hash(a, len, i);
+        cmp = sign(res_name_casecmp(a, b, len));
+        eq = res_name_caseeq(a, b, len);
+        if (h != res_name_hash(la, len, i) ||
+            (eq && h != res_name_hash(b, len, i)))
+            bad++;
+
+        for (lvl = RES_NAME_SCALAR + 1; lvl <= best; lvl++) {
+            res_name_simd(lvl);
+            res_name_lower(lb, a, len);
+            if (memcmp(la, lb, len) ||
+                h != res_name_hash(a, len, i) ||
+                cmp != sign(res_name_casecmp(a, b, len)) ||
+                eq != res_name_caseeq(a, b, len))
+                bad++;
+        }
+    }
+    return bad;
+}
+
+int
+main(int argc, char *argv[])
+{
+    u_char          names[BENCH_NAMES][NS_MAXCDNAME];
+    u_char          others[BENCH_NAMES][NS_MAXCDNAME];
+    u_char          siblings[BENCH_NAMES][NS_MAXCDNAME];
+    u_char          buf[NS_MAXCDNAME];
+    struct timeval  start;
+    volatile u_int32_t sink = 0;
+    double          t;
+    long            count = BENCH_DEFAULT_COUNT, i;
+    int             best, lvl, l, len, bad;
+
+    while (1) {
+        int c = getopt(argc, argv, "hn:V");
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'h':
+            usage(argv[0]);
+            return -1;
+        case 'n':
+            count = atol(optarg);
+            break;
+        case 'V':
+            version();
+            return 0;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (count <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    srand(1);
+    best = res_name_simd(-1);
+    bad = check(best);
+    printf("best level: %s, %d disagreements with scalar\n",
+           level_names[best], bad);
+
+    printf("%-7s %5s %12s %12s %12s %12s  (ns/op)\n", "level", "len",
+           "namecmp-eq", "namecmp-ord", "hash", "lower");
+
+    for (l = 0; l < (int) (sizeof(bench_lengths) / sizeof(int)); l++) {
+        len = bench_lengths[l];
+        for (i = 0; i < BENCH_NAMES; i++) {
+            random_name(names[i], len);
+            recase_name(others[i], names[i], len);
+            recase_name(siblings[i], names[i], len);
+            siblings[i][1] ^= 1;
+        }
+
+        for (lvl = RES_NAME_SCALAR; lvl <= best; lvl++) {
+            res_name_simd(lvl);
+            printf("%-7s %5d", level_names[lvl], len);
+
+            gettimeofday(&start, NULL);
+            for (i = 0; i < count; i++)
+                sink += namecmp(names[i % BENCH_NAMES],
+                                others[i % BENCH_NAMES]);
+            t = elapsed(&start);
+            printf(" %12.1f", t * 1000000000.0 / count);
+
+            gettimeofday(&start, NULL);
+            for (i = 0; i < count; i++)
+                sink += namecmp(names[i % BENCH_NAMES],
+                                siblings[i % BENCH_NAMES]);
+            t = elapsed(&start);
+            printf(" %12.1f", t * 1000000000.0 / count);
+
+            gettimeofday(&start, NULL);
+            for (i = 0; i < count; i++)
+                sink += res_name_hash(names[i % BENCH_NAMES], len, 0);
+            t = elapsed(&start);
+            printf(" %12.1f", t * 1000000000.0 / count);
+
+            gettimeofday(&start, NULL);
+            for (i = 0; i < count; i++) {
+                res_name_lower(buf, names[i % BENCH_NAMES], len);
+                sink += buf[len - 2];
+            }
+            t = elapsed(&start);
+            printf(" %12.1f\n", t * 1000000000.0 / count);
+        }
+    }
+
+    return bad ? 1 : 0;
+}
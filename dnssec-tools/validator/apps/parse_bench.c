@@ -0,0 +1,472 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ *
+ * Measures how fast captured responses are turned into rrsets.  The
+ * per-RR path that digest_response() used to take (extract_from_rr(),
+ * decompress() and a linear find_rr_set() for every record) is timed
+ * against the single-pass message index, and the rrsets both produce
+ * are compared.
+ *
+ * Captures hold one response after another, each preceded by its
+ * length in two bytes of network order, as on a DNS TCP stream.  They
+ * can be written with -w, which queries a name server for the names
+ * given on the command line.
+ */
+
+#include "validator-internal.h"
+
+#include "val_support.h"
+#include "val_msg.h"
+
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#endif
+
+#define	NAME	"parse_bench"
+#define	VERS	"version: 1.0"
+#define	DTVERS	"DNSSEC-Tools Version: 1.8"
+
+#define BENCH_DEFAULT_PASSES  1000
+#define BENCH_DEFAULT_SERVER  "127.0.0.1"
+
+struct captured {
+    u_char         *msg;
+    size_t          len;
+};
+
+void
+usage(char *progname)
+{
+    fprintf(stderr,
+            "Usage: %s [options] capture-file ...\n"
+            "       %s -w capture-file [-s server] name[/type] ...\n"
+            "Times rrset construction from captured responses, or\n"
+            "captures the responses to the given queries.\n",
+            progname, progname);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr,
+            "\t-h               display usage and exit\n"
+            "\t-n <passes>      passes over the captures (default %d)\n"
+            "\t-w <file>        append responses to <file>\n"
+            "\t-s <server>      name server to query (default %s)\n"
+            "\t-V               display version and exit\n",
+            BENCH_DEFAULT_PASSES, BENCH_DEFAULT_SERVER);
+}
+
+void
+version(void)
+{
+    fprintf(stderr, "%s: %s\n", NAME, VERS);
+    fprintf(stderr, "%s\n", DTVERS);
+}
+
+static double
+elapsed(struct timeval *start)
+{
+    struct timeval  now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) +
+        (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static int
+capture(const char *file, const char *server, char **queries, int count)
+{
+    struct name_server *ns, *respondent = NULL;
+    u_char         *response;
+    size_t          response_len;
+    u_char          frame[2];
+    char            name[NS_MAXDNAME];
+    char           *slash;
+    int             i, type_h, success, failed = 0;
+    FILE           *fp;
+
+    ns = parse_name_server(server, NULL,
+                           SR_QUERY_RECURSE | SR_QUERY_SET_DO);
+    if (ns == NULL) {
+        fprintf(stderr, "Bad name server %s\n", server);
+        return -1;
+    }
+    if (NULL == (fp = fopen(file, "ab"))) {
+        fprintf(stderr, "Cannot open %s: %s\n", file, strerror(errno));
+        free_name_server(&ns);
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        strncpy(name, queries[i], sizeof(name) - 1);
+        name[sizeof(name) - 1] = '\0';
+        type_h = ns_t_a;
+        if (NULL != (slash = strchr(name, '/'))) {
+            *slash++ = '\0';
+            type_h = res_nametotype(slash, &success);
+            if (!success) {
+                fprintf(stderr, "Unrecognized type %s\n", slash);
+                ++failed;
+                continue;
+            }
+        }
+
+        response = NULL;
+        response_len = 0;
+        if (SR_UNSET != get(name, type_h, ns_c_in, ns, &respondent,
+                            &response, &response_len) ||
+            response == NULL || response_len > 0xffff) {
+            fprintf(stderr, "No response for %s\n", queries[i]);
+            ++failed;
+        } else {
+            frame[0] = (u_char) (response_len >> 8);
+            frame[1] = (u_char) (response_len & 0xff);
+            if (fwrite(frame, 1, 2, fp) != 2 ||
+                fwrite(response, 1, response_len, fp) != response_len) {
+                fprintf(stderr, "Cannot write %s\n", file);
+                ++failed;
+            }
+        }
+        if (response)
+            FREE(response);
+        if (respondent)
+            free_name_server(&respondent);
+    }
+
+    fclose(fp);
+    free_name_server(&ns);
+    printf("captured %d of %d responses in %s\n", count - failed, count,
+           file);
+    return failed ? -1 : 0;
+}
+
+/*
+ * Read every response in file onto the end of caps
+ */
+static int
+load(const char *file, struct captured **caps, int *count, int *alloced)
+{
+    u_char          frame[2];
+    size_t          len;
+    u_char         *msg;
+    FILE           *fp;
+
+    if (NULL == (fp = fopen(file, "rb"))) {
+        fprintf(stderr, "Cannot open %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    while (fread(frame, 1, 2, fp) == 2) {
+        len = (frame[0] << 8) | frame[1];
+        if (len < sizeof(HEADER) || NULL == (msg = (u_char *) malloc(len)) ||
+            fread(msg, 1, len, fp) != len) {
+            fprintf(stderr, "Truncated capture %s\n", file);
+            fclose(fp);
+            return -1;
+        }
+        if (*count == *alloced) {
+            *alloced = *alloced ? 2 * *alloced : 64;
+            *caps = (struct captured *)
+                realloc(*caps, *alloced * sizeof(struct captured));
+            if (*caps == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                fclose(fp);
+                return -1;
+            }
+        }
+        (*caps)[*count].msg = msg;
+        (*caps)[*count].len = len;
+        ++(*count);
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+static int
+first_rr(struct captured *cap, size_t *offset, int *answer, int *authority,
+         int *additional)
+{
+    HEADER         *header = (HEADER *) cap->msg;
+    const u_char   *qname = cap->msg + sizeof(HEADER);
+
+    *answer = ntohs(header->ancount);
+    *authority = ntohs(header->nscount);
+    *additional = ntohs(header->arcount);
+    if (ntohs(header->qdcount) != 1 ||
+        ns_name_skip(&qname, cap->msg + cap->len) < 0)
+        return -1;
+    *offset = (qname - cap->msg) + sizeof(u_int32_t);
+    return (*offset <= cap->len) ? 0 : -1;
+}
+
+static int
+section_of(int i, int answer, int authority)
+{
+    if (i < answer)
+        return VAL_FROM_ANSWER;
+    if (i < answer + authority)
+        return VAL_FROM_AUTHORITY;
+    return VAL_FROM_ADDITIONAL;
+}
+
+static int
+add_rdata(struct rrset_rec *rr_set, u_int16_t type_h, u_char *rdata,
+          size_t rdata_len_h)
+{
+    if (rr_set == NULL)
+        return VAL_OUT_OF_MEMORY;
+    if (type_h == ns_t_rrsig)
+        return add_as_sig(rr_set, rdata_len_h, rdata);
+    return add_to_set(rr_set, rdata_len_h, rdata);
+}
+
+/*
+ * One list per section, the way digest_response() keeps them apart
+ */
+static int
+parse_per_rr(struct captured *cap, struct rrset_rec **lists)
+{
+    u_char         *end = cap->msg + cap->len;
+    u_char          name_n[NS_MAXCDNAME];
+    u_int16_t       type_h, set_type_h, class_h;
+    u_int32_t       ttl_h;
+    size_t          offset, rdata_len_h, rdata_index;
+    u_char         *rdata;
+    int             answer, authority, additional;
+    int             i, section, ret_val;
+
+    if (first_rr(cap, &offset, &answer, &authority, &additional) < 0)
+        return VAL_BAD_ARGUMENT;
+
+    for (i = 0; i < answer + authority + additional; i++) {
+        if (VAL_NO_ERROR !=
+            (ret_val = extract_from_rr(cap->msg, &offset, end, name_n,
+                                       &type_h, &set_type_h, &class_h,
+                                       &ttl_h, &rdata_len_h, &rdata_index)))
+            return ret_val;
+        rdata = NULL;
+        if (VAL_NO_ERROR !=
+            (ret_val = decompress(&rdata, cap->msg, rdata_index, end,
+                                  type_h, &rdata_len_h))) {
+            FREE(rdata);
+            return ret_val;
+        }
+        section = section_of(i, answer, authority);
+        ret_val = add_rdata(find_rr_set(NULL, &lists[section - 1], name_n,
+                                        type_h, set_type_h, class_h, ttl_h,
+                                        cap->msg, rdata, section, 0, 0,
+                                        NULL),
+                            type_h, rdata, rdata_len_h);
+        FREE(rdata);
+        if (ret_val != VAL_NO_ERROR)
+            return ret_val;
+    }
+    return VAL_NO_ERROR;
+}
+
+static int
+parse_indexed(struct captured *cap, struct rrset_rec **lists)
+{
+    struct msg_index mi;
+    u_char          name_n[NS_MAXCDNAME];
+    size_t          offset, rdata_len_h;
+    u_char         *rdata;
+    int             answer, authority, additional;
+    int             i, section, copied, ret_val = VAL_NO_ERROR;
+
+    if (first_rr(cap, &offset, &answer, &authority, &additional) < 0)
+        return VAL_BAD_ARGUMENT;
+
+    if (VAL_NO_ERROR !=
+        (ret_val = msg_index(&mi, cap->msg, cap->len, offset,
+                             answer + authority + additional)))
+        return ret_val;
+
+    for (i = 0; i < mi.mi_count; i++) {
+        copied = 0;
+        if (VAL_NO_ERROR != (ret_val = msg_owner(&mi, i, name_n)) ||
+            VAL_NO_ERROR != (ret_val = msg_rdata(&mi, i, &rdata,
+                                                 &rdata_len_h, &copied))) {
+            if (copied)
+                FREE(rdata);
+            break;
+        }
+        section = section_of(i, answer, authority);
+        ret_val = add_rdata(msg_find_rr_set(&mi, i, NULL,
+                                            &lists[section - 1], name_n,
+                                            cap->msg, rdata, section, 0, 0,
+                                            NULL),
+                            mi.mi_rrs[i].mr_type_h, rdata, rdata_len_h);
+        if (copied)
+            FREE(rdata);
+        if (ret_val != VAL_NO_ERROR)
+            break;
+    }
+
+    msg_index_free(&mi);
+    return ret_val;
+}
+
+static int
+same_rrs(struct rrset_rr *a, struct rrset_rr *b)
+{
+    for (; a && b; a = a->rr_next, b = b->rr_next) {
+        if (a->rr_rdata_length != b->rr_rdata_length ||
+            memcmp(a->rr_rdata, b->rr_rdata, a->rr_rdata_length))
+            return 0;
+    }
+    return a == b;
+}
+
+static int
+same_rrsets(struct rrset_rec *a, struct rrset_rec *b)
+{
+    for (; a && b; a = a->rrs_next, b = b->rrs_next) {
+        if (namecmp(a->rrs_name_n, b->rrs_name_n) ||
+            a->rrs_type_h != b->rrs_type_h ||
+            a->rrs_class_h != b->rrs_class_h ||
+            a->rrs_ttl_h != b->rrs_ttl_h ||
+            !same_rrs(a->rrs_data, b->rrs_data) ||
+            !same_rrs(a->rrs_sig, b->rrs_sig))
+            return 0;
+    }
+    return a == b;
+}
+
+static void
+free_lists(struct rrset_rec **lists)
+{
+    int             s;
+
+    for (s = 0; s < 3; s++)
+        res_sq_free_rrset_recs(&lists[s]);
+}
+
+static void
+run_pass(const char *label, int (*parse) (struct captured *,
+                                          struct rrset_rec **),
+         struct captured *caps, int count, int passes, size_t bytes,
+         unsigned long rrs)
+{
+    struct rrset_rec *lists[3] = { NULL, NULL, NULL };
+    struct timeval  start;
+    double          t;
+    int             i, p;
+
+    gettimeofday(&start, NULL);
+    for (p = 0; p < passes; p++) {
+        for (i = 0; i < count; i++) {
+            parse(&caps[i], lists);
+            free_lists(lists);
+        }
+    }
+    t = elapsed(&start);
+
+    printf("%-9s %.2f us/response, %.1f ns/RR, %.1f MB/s, "
+           "%.0f responses/s\n", label,
+           t * 1000000.0 / ((double) passes * count),
+           t * 1000000000.0 / ((double) passes * rrs),
+           (double) passes * bytes / t / 1000000.0,
+           (double) passes * count / t);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct rrset_rec *old_lists[3] = { NULL, NULL, NULL };
+    struct rrset_rec *new_lists[3] = { NULL, NULL, NULL };
+    struct captured *caps = NULL;
+    const char     *server = BENCH_DEFAULT_SERVER;
+    const char     *outfile = NULL;
+    int             passes = BENCH_DEFAULT_PASSES;
+    int             count = 0, alloced = 0, usable = 0;
+    int             answer, authority, additional;
+    unsigned long   rrs = 0;
+    size_t          bytes = 0, offset;
+    int             i, s, rc_old, rc_new, mismatched = 0;
+
+    while (1) {
+        int c = getopt(argc, argv, "hn:w:s:V");
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'h':
+            usage(argv[0]);
+            return -1;
+        case 'n':
+            passes = atoi(optarg);
+            break;
+        case 'w':
+            outfile = optarg;
+            break;
+        case 's':
+            server = optarg;
+            break;
+        case 'V':
+            version();
+            return 0;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (optind >= argc || passes <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (outfile)
+        return capture(outfile, server, &argv[optind], argc - optind);
+
+    for (i = optind; i < argc; i++) {
+        if (load(argv[i], &caps, &count, &alloced) < 0)
+            return -1;
+    }
+
+    /*
+     * Keep the responses both parsers accept, and check that they
+     * build the same rrsets from them.  The index checks more than the
+     * per-RR path does, so only what it accepts is given to the latter.
+     */
+    for (i = 0; i < count; i++) {
+        rc_new = parse_indexed(&caps[i], new_lists);
+        rc_old = (rc_new == VAL_NO_ERROR) ?
+            parse_per_rr(&caps[i], old_lists) : rc_new;
+        if (rc_old != rc_new) {
+            ++mismatched;
+            free(caps[i].msg);
+        } else if (rc_old == VAL_NO_ERROR) {
+            for (s = 0; s < 3; s++) {
+                if (!same_rrsets(old_lists[s], new_lists[s]))
+                    break;
+            }
+            if (s < 3)
+                ++mismatched;
+            first_rr(&caps[i], &offset, &answer, &authority, &additional);
+            rrs += answer + authority + additional;
+            bytes += caps[i].len;
+            caps[usable++] = caps[i];
+        } else {
+            free(caps[i].msg);
+        }
+        free_lists(old_lists);
+        free_lists(new_lists);
+    }
+
+    printf("%d responses (%d skipped), %lu RRs, %lu bytes, %d passes",
+           usable, count - usable, rrs, (unsigned long) bytes, passes);
+    if (mismatched)
+        printf(", %d PARSED DIFFERENTLY", mismatched);
+    printf("\n");
+
+    if (usable > 0 && rrs > 0) {
+        run_pass("per-RR:", parse_per_rr, caps, usable, passes, bytes, rrs);
+        run_pass("indexed:", parse_indexed, caps, usable, passes, bytes, rrs);
+    }
+
+    for (i = 0; i < usable; i++)
+        free(caps[i].msg);
+    free(caps);
+    return mismatched ? 1 : 0;
+}
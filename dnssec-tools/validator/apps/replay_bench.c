@@ -0,0 +1,568 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ *
+ * Replays a query mix against signed zones served from this process,
+ * so that validation can be measured without a network or any outside
+ * server.  The zones are loaded from zone files, or generated and
+ * signed at startup, and served on an unprivileged port of a loopback
+ * address; the validator is pointed at them through its own
+ * root.hints, an empty resolv.conf and a dnsval.conf that holds the
+ * trust anchors and the dns-port.
+ *
+ * Each pass reports the request rate, the latency percentiles, and the
+ * CPU time, heap allocations and upstream queries per validation.  The
+ * "cold" pass flushes every cache before each request; the "warm" pass
+ * keeps them.
+ */
+
+#include "validator/validator-config.h"
+#include <validator/validator.h>
+#include <validator/resolver.h>
+
+#include <time.h>
+#include <sys/resource.h>
+
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#endif
+
+#include "replay_bench.h"
+
+#define	NAME	"replay_bench"
+#define	VERS	"version: 1.0"
+#define	DTVERS	"DNSSEC-Tools Version: 1.8"
+
+#define BENCH_DEFAULT_COUNT   10000
+#define BENCH_DEFAULT_ZONES   10
+#define BENCH_DEFAULT_HOSTS   100
+#define BENCH_DEFAULT_BITS    2048
+#define BENCH_DEFAULT_ADDR    "127.0.0.1"
+#define BENCH_DEFAULT_PORT    5300
+#define BENCH_MAX_ZONE_FILES  64
+#define BENCH_MAX_STATUS      256
+
+#ifdef __GLIBC__
+#define BENCH_COUNT_ALLOCS 1
+
+extern void    *__libc_malloc(size_t);
+extern void    *__libc_calloc(size_t, size_t);
+extern void    *__libc_realloc(void *, size_t);
+extern void     __libc_free(void *);
+
+/*
+ * Only the replaying thread counts, so that the responder's own
+ * allocations are left out
+ */
+static __thread int counting = 0;
+static unsigned long alloc_calls = 0;
+static unsigned long alloc_bytes = 0;
+
+void *
+malloc(size_t size)
+{
+    if (counting) {
+        alloc_calls++;
+        alloc_bytes += size;
+    }
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    if (counting) {
+        alloc_calls++;
+        alloc_bytes += nmemb * size;
+    }
+    return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    if (counting) {
+        alloc_calls++;
+        alloc_bytes += size;
+    }
+    return __libc_realloc(ptr, size);
+}
+
+void
+free(void *ptr)
+{
+    __libc_free(ptr);
+}
+#endif
+
+void
+usage(char *progname)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "Replays a query mix against signed zones served from this "
+            "process.\n", progname);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr,
+            "\t-h               display usage and exit\n"
+            "\t-z <file>        load a zone file (may be repeated); zones\n"
+            "\t                 without a DNSKEY are signed with -A/-b/-3;\n"
+            "\t                 by default a tree of zones is generated\n"
+            "\t-O <origin>      origin of relative names in the zone files\n"
+            "\t                 that follow (default the root)\n"
+            "\t-Z <zones>       number of generated zones (default %d)\n"
+            "\t-H <hosts>       hosts per generated zone (default %d)\n"
+            "\t-A <algorithm>   8 (RSASHA256, default) or 13 "
+            "(ECDSAP256SHA256)\n"
+            "\t-b <bits>        RSA key size (default %d)\n"
+            "\t-3               use NSEC3 in the zones signed here\n"
+            "\t-a <address>     address to serve on (default %s)\n"
+            "\t-P <port>        port to serve on (default %d)\n"
+            "\t-q <file>        query mix, one \"name [type]\" per line;\n"
+            "\t                 by default every rrset in the zones plus a\n"
+            "\t                 missing name and type in each zone\n"
+            "\t-n <count>       requests per pass (default %d)\n"
+            "\t-p <pass>        run only the cold or the warm pass\n"
+            "\t-I               ignore signature validity periods\n"
+            "\t-k               keep the generated configuration files\n"
+            "\t-o <debug-level>:<dest-type>[:<dest-options>]\n"
+            "\t                 log target, see dt-validate(1)\n"
+            "\t-V               display version and exit\n",
+            BENCH_DEFAULT_ZONES, BENCH_DEFAULT_HOSTS, BENCH_DEFAULT_BITS,
+            BENCH_DEFAULT_ADDR, BENCH_DEFAULT_PORT, BENCH_DEFAULT_COUNT);
+}
+
+void
+version(void)
+{
+    fprintf(stderr, "%s: %s\n", NAME, VERS);
+    fprintf(stderr, "%s\n", DTVERS);
+}
+
+static double
+cpu_seconds(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+#endif
+    {
+        /* includes the responder */
+        struct rusage   ru;
+
+        getrusage(RUSAGE_SELF, &ru);
+        return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+            (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.0;
+    }
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double          x = *(const double *) a, y = *(const double *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Nearest-rank percentile of sorted samples
+ */
+static double
+percentile(const double *sorted, int count, int pct)
+{
+    int             rank = (pct * count + 99) / 100;
+
+    if (rank < 1)
+        rank = 1;
+    return sorted[rank - 1];
+}
+
+/*
+ * Read a query mix: one name per line, optionally followed by a type
+ */
+static int
+read_mix(const char *file, struct rb_query **mix, int *count)
+{
+    FILE           *fp;
+    char            line[1024], name[NS_MAXDNAME], type[32];
+    int             alloc = 0, n, success, type_h;
+    int             lineno = 0;
+
+    *mix = NULL;
+    *count = 0;
+    if (NULL == (fp = fopen(file, "r"))) {
+        fprintf(stderr, "Cannot open %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+        n = sscanf(line, "%1024s %31s", name, type);
+        if (n < 1 || name[0] == '#' || name[0] == ';')
+            continue;
+        type_h = ns_t_a;
+        if (n == 2) {
+            type_h = res_nametotype(type, &success);
+            if (!success) {
+                fprintf(stderr, "%s:%d: unrecognized type %s\n", file,
+                        lineno, type);
+                fclose(fp);
+                return -1;
+            }
+        }
+        if (*count >= alloc) {
+            struct rb_query *m;
+
+            alloc = alloc ? alloc * 2 : 1024;
+            m = (struct rb_query *) realloc(*mix,
+                                            alloc * sizeof(struct rb_query));
+            if (m == NULL) {
+                fclose(fp);
+                return -1;
+            }
+            *mix = m;
+        }
+        if (NULL == ((*mix)[*count].rq_name = strdup(name))) {
+            fclose(fp);
+            return -1;
+        }
+        (*mix)[(*count)++].rq_type_h = type_h;
+    }
+    fclose(fp);
+    if (*count == 0) {
+        fprintf(stderr, "%s: no queries\n", file);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Write root.hints, resolv.conf and dnsval.conf for the responder at
+ * addr into dir
+ */
+static int
+write_config(const char *dir, const char *addr, int port, int ignore_time,
+             char *dnsval_conf, char *resolv_conf, char *root_hints)
+{
+    FILE           *fp;
+    int             anchors;
+
+    snprintf(root_hints, PATH_MAX, "%s/root.hints", dir);
+    snprintf(resolv_conf, PATH_MAX, "%s/resolv.conf", dir);
+    snprintf(dnsval_conf, PATH_MAX, "%s/dnsval.conf", dir);
+
+    if (NULL == (fp = fopen(root_hints, "w")))
+        return -1;
+    fprintf(fp, ".\t3600000\tIN\tNS\tns.\n"
+            "ns.\t3600000\tIN\tA\t%s\n", addr);
+    fclose(fp);
+
+    /* no name servers: the validator resolves from the root hints */
+    if (NULL == (fp = fopen(resolv_conf, "w")))
+        return -1;
+    fclose(fp);
+
+    if (NULL == (fp = fopen(dnsval_conf, "w")))
+        return -1;
+    /* the root hints point at addr, dns-port makes that addr:port */
+    fprintf(fp, "global-options\n"
+            "    edns0-size 4096\n"
+            "    env-policy disable\n"
+            "    app-policy disable\n"
+            "    dns-port %d\n"
+            ";\n"
+            ": trust-anchor\n", port);
+    anchors = rb_write_anchors(fp);
+    fprintf(fp, ";\n"
+            ": zone-security-expectation\n"
+            "    . validate\n"
+            ";\n");
+    if (ignore_time)
+        fprintf(fp, ": clock-skew\n"
+                "    . -1\n"
+                ";\n");
+    fclose(fp);
+
+    if (anchors == 0) {
+        fprintf(stderr, "No secure entry point keys to use as trust "
+                "anchors\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void
+remove_config(const char *dir, const char *dnsval_conf,
+              const char *resolv_conf, const char *root_hints)
+{
+    unlink(dnsval_conf);
+    unlink(resolv_conf);
+    unlink(root_hints);
+    rmdir(dir);
+}
+
+struct status_count {
+    val_status_t    sc_status;
+    int             sc_count;
+};
+
+static void
+run_pass(const char *label, int cold, struct rb_query *mix, int mix_count,
+         int count, const char *dnsval_conf, const char *resolv_conf,
+         const char *root_hints)
+{
+    val_context_t  *context = NULL;
+    struct val_result_chain *results, *res;
+    struct status_count status[BENCH_MAX_STATUS];
+    struct timeval  start, end;
+    double         *lat, total = 0, cpu = 0, t;
+    unsigned long   queries = 0, q;
+    int             i, j, nstatus = 0, failed = 0, rc;
+
+    lat = (double *) malloc(count * sizeof(double));
+    if (lat == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return;
+    }
+    memset(status, 0, sizeof(status));
+
+#ifdef BENCH_COUNT_ALLOCS
+    alloc_calls = alloc_bytes = 0;
+#endif
+    for (i = 0; i < count; i++) {
+        struct rb_query *rq = &mix[i % mix_count];
+
+        if (context == NULL || cold) {
+            /* flushing and setting up again is not timed */
+            if (context) {
+                val_free_context(context);
+                val_free_validator_state();
+            }
+            rc = val_create_context_with_conf(NAME, (char *) dnsval_conf,
+                                              (char *) resolv_conf,
+                                              (char *) root_hints, &context);
+            if (VAL_NO_ERROR != rc) {
+                fprintf(stderr, "Cannot create context: %s\n",
+                        p_val_err(rc));
+                free(lat);
+                return;
+            }
+        }
+
+        results = NULL;
+        q = rb_server_queries();
+        t = cpu_seconds();
+#ifdef BENCH_COUNT_ALLOCS
+        counting = 1;
+#endif
+        gettimeofday(&start, NULL);
+        rc = val_resolve_and_check(context, rq->rq_name, ns_c_in,
+                                   rq->rq_type_h, 0, &results);
+        gettimeofday(&end, NULL);
+#ifdef BENCH_COUNT_ALLOCS
+        counting = 0;
+#endif
+        cpu += cpu_seconds() - t;
+        queries += rb_server_queries() - q;
+        lat[i] = (end.tv_sec - start.tv_sec) +
+            (end.tv_usec - start.tv_usec) / 1000000.0;
+        total += lat[i];
+
+        if (VAL_NO_ERROR != rc)
+            failed++;
+        for (res = results; res; res = res->val_rc_next) {
+            for (j = 0; j < nstatus; j++) {
+                if (status[j].sc_status == res->val_rc_status)
+                    break;
+            }
+            if (j == nstatus && nstatus < BENCH_MAX_STATUS)
+                status[nstatus++].sc_status = res->val_rc_status;
+            if (j < nstatus)
+                status[j].sc_count++;
+        }
+        val_free_result_chain(results);
+    }
+    val_free_context(context);
+
+    qsort(lat, count, sizeof(double), cmp_double);
+    printf("%-6s %d requests, %d failed, %.0f requests/s\n", label, count,
+           failed, total > 0 ? count / total : 0.0);
+    printf("       latency us: p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n",
+           percentile(lat, count, 50) * 1000000.0,
+           percentile(lat, count, 90) * 1000000.0,
+           percentile(lat, count, 99) * 1000000.0,
+           lat[count - 1] * 1000000.0);
+    printf("       per validation: %.1f us CPU", cpu * 1000000.0 / count);
+#ifdef BENCH_COUNT_ALLOCS
+    printf(", %.1f allocs (%.0f bytes)", (double) alloc_calls / count,
+           (double) alloc_bytes / count);
+#endif
+    printf(", %.2f upstream queries\n", (double) queries / count);
+    printf("       status:");
+    for (j = 0; j < nstatus; j++)
+        printf(" %s %d", p_val_status(status[j].sc_status),
+               status[j].sc_count);
+    printf("\n");
+    free(lat);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char           *zone_files[BENCH_MAX_ZONE_FILES];
+    char           *zone_origins[BENCH_MAX_ZONE_FILES];
+    char            dir[] = "/tmp/replay_bench.XXXXXX";
+    char            dnsval_conf[PATH_MAX], resolv_conf[PATH_MAX];
+    char            root_hints[PATH_MAX];
+    struct rb_query *mix = NULL;
+    const char     *addr = BENCH_DEFAULT_ADDR;
+    const char     *mix_file = NULL, *pass = NULL;
+    char           *origin = NULL;
+    int             nzone_files = 0, zones = BENCH_DEFAULT_ZONES;
+    int             hosts = BENCH_DEFAULT_HOSTS, bits = BENCH_DEFAULT_BITS;
+    int             alg = 8, nsec3 = 0, ignore_time = 0, keep = 0;
+    int             count = BENCH_DEFAULT_COUNT, mix_count = 0;
+    int             port = BENCH_DEFAULT_PORT;
+    int             i, rc = -1;
+
+    while (1) {
+        int c = getopt(argc, argv, "hz:O:Z:H:A:b:3a:P:q:n:p:Iko:V");
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'h':
+            usage(argv[0]);
+            return -1;
+        case 'z':
+            if (nzone_files >= BENCH_MAX_ZONE_FILES) {
+                fprintf(stderr, "Too many zone files\n");
+                return -1;
+            }
+            zone_origins[nzone_files] = origin;
+            zone_files[nzone_files++] = optarg;
+            break;
+        case 'O':
+            origin = optarg;
+            break;
+        case 'Z':
+            zones = atoi(optarg);
+            break;
+        case 'H':
+            hosts = atoi(optarg);
+            break;
+        case 'A':
+            alg = atoi(optarg);
+            if (alg != 8 && alg != 13) {
+                fprintf(stderr, "Unsupported algorithm %s\n", optarg);
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'b':
+            bits = atoi(optarg);
+            break;
+        case '3':
+            nsec3 = 1;
+            break;
+        case 'a':
+            addr = optarg;
+            break;
+        case 'P':
+            port = atoi(optarg);
+            if (port < 1 || port > 65535) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'q':
+            mix_file = optarg;
+            break;
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'p':
+            pass = optarg;
+            if (strcmp(pass, "cold") && strcmp(pass, "warm")) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'I':
+            ignore_time = 1;
+            break;
+        case 'k':
+            keep = 1;
+            break;
+        case 'o':
+            if (NULL == val_log_add_optarg(optarg, 1)) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'V':
+            version();
+            return 0;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (optind < argc || count <= 0 || zones < 0 || hosts < 1 ||
+        hosts > 65536) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    for (i = 0; i < nzone_files; i++) {
+        if (rb_load_zone(zone_files[i], zone_origins[i], alg, bits,
+                         nsec3) != 0)
+            goto done;
+    }
+    if (nzone_files == 0 &&
+        rb_make_zones(zones, hosts, alg, bits, nsec3, addr) != 0) {
+        fprintf(stderr, "Cannot generate the zones\n");
+        goto done;
+    }
+
+    if (mix_file ? read_mix(mix_file, &mix, &mix_count) :
+        rb_query_mix(&mix, &mix_count)) {
+        fprintf(stderr, "Cannot set up the query mix\n");
+        goto done;
+    }
+
+    if (NULL == mkdtemp(dir)) {
+        fprintf(stderr, "Cannot create %s: %s\n", dir, strerror(errno));
+        goto done;
+    }
+    if (write_config(dir, addr, port, ignore_time, dnsval_conf,
+                     resolv_conf, root_hints) != 0) {
+        fprintf(stderr, "Cannot write the configuration in %s\n", dir);
+        goto cleanup;
+    }
+    if (rb_server_start(addr, port) != 0)
+        goto cleanup;
+
+    printf("%d queries in the mix; configuration in %s\n", mix_count, dir);
+    if (pass == NULL || !strcmp(pass, "cold"))
+        run_pass("cold:", 1, mix, mix_count, count, dnsval_conf,
+                 resolv_conf, root_hints);
+    if (pass == NULL || !strcmp(pass, "warm"))
+        run_pass("warm:", 0, mix, mix_count, count, dnsval_conf,
+                 resolv_conf, root_hints);
+    rc = 0;
+
+    rb_server_stop();
+  cleanup:
+    if (!keep)
+        remove_config(dir, dnsval_conf, resolv_conf, root_hints);
+  done:
+    val_free_validator_state();
+    for (i = 0; i < mix_count; i++)
+        free(mix[i].rq_name);
+    free(mix);
+    rb_free_zones();
+    return rc;
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+#ifndef REPLAY_BENCH_H
+#define REPLAY_BENCH_H
+
+/*
+ * One request of the query mix
+ */
+struct rb_query {
+    char           *rq_name;
+    int             rq_type_h;
+};
+
+/*
+ * Zones (replay_server.c).  Zones are either loaded from zone files,
+ * which are signed with a new key of algorithm alg if they have no
+ * DNSKEY, or generated and signed by rb_make_zones(); the two can be
+ * mixed.  addr is the address that the generated NS records point at.
+ */
+int             rb_load_zone(const char *file, const char *origin, int alg,
+                             int bits, int nsec3);
+int             rb_make_zones(int zones, int hosts, int alg, int bits,
+                              int nsec3, const char *addr);
+int             rb_write_anchors(FILE *fp);
+int             rb_query_mix(struct rb_query **mix, int *count);
+void            rb_free_zones(void);
+
+/*
+ * The responder (replay_server.c), serving the zones on port of addr
+ */
+int             rb_server_start(const char *addr, int port);
+void            rb_server_stop(void);
+unsigned long   rb_server_queries(void);
+
+#endif
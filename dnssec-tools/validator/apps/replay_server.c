@@ -0,0 +1,2111 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ *
+ * The authoritative stand-in used by replay_bench.  Zones are loaded
+ * from zone files (and signed here if they are not signed already),
+ * or generated and signed here, and served over UDP and TCP from a
+ * thread of the benchmark process.
+ *
+ * The server answers for all of its zones at once, the way a single
+ * lab server would: a query goes to the deepest zone that contains
+ * the name (the parent for DS), and referrals are only given for
+ * delegations to zones that were not loaded.  Answers carry the
+ * RRSIGs and the NSEC or NSEC3 proofs that the validator needs.
+ * Wildcards are expanded; DNAME is not.
+ */
+
+#include "validator/validator-config.h"
+#include <validator/validator.h>
+#include <validator/resolver.h>
+
+#include <time.h>
+
+#include <openssl/evp.h>
+#include <openssl/bn.h>
+#include <openssl/rsa.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/objects.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include "val_zonefile.h"
+#include "replay_bench.h"
+
+#define RB_MIN_BUCKETS      256
+#define RB_MAX_RDATA        65535
+#define RB_MAX_MSG          65535
+#define RB_MAX_CLIENTS      16
+#define RB_NSEC3_HASH_LEN   20          /* SHA-1 */
+#define RB_TTL              3600
+#define RB_SIG_VALIDITY     (30 * 24 * 3600)
+
+#define RB_T_NSEC3PARAM     51
+#define RB_T_CDS            59
+#define RB_T_CDNSKEY        60
+
+#define RB_ALG_ECDSAP256    13
+
+/*
+ * Zone data
+ */
+struct rb_rr {
+    struct rb_rr   *rr_next;
+    u_int16_t       rr_len;
+    u_char          rr_rdata[1];        /* rr_len bytes */
+};
+
+struct rb_rrset {
+    u_int16_t       rs_type_h;
+    u_int32_t       rs_ttl;
+    struct rb_rr   *rs_data;            /* NULL if only RRSIGs were seen */
+    struct rb_rr   *rs_sigs;            /* RRSIGs covering rs_type_h */
+    struct rb_rrset *rs_next;
+};
+
+/*
+ * One owner name.  Names that only exist as ancestors of other names
+ * (empty non-terminals) have no rrsets.
+ */
+struct rb_node {
+    u_char         *nd_name_n;          /* lower case */
+    struct rb_rrset *nd_rrsets;
+    struct rb_node *nd_next;            /* hash bucket chain */
+};
+
+struct rb_table {
+    struct rb_node **tb_buckets;
+    size_t          tb_size;
+    size_t          tb_count;
+};
+
+struct rb_nsec3 {
+    u_char          n3_hash[RB_NSEC3_HASH_LEN];
+    struct rb_node *n3_node;
+};
+
+struct rb_zone {
+    u_char         *zn_apex_n;
+    struct rb_zone *zn_parent;          /* closest enclosing zone, if any */
+    struct rb_table zn_names;
+    struct rb_table zn_hashed;          /* owners of NSEC3 records */
+    struct rb_node **zn_nsec;           /* owners of NSEC records, sorted */
+    size_t          zn_nsec_count;
+    struct rb_nsec3 *zn_nsec3;          /* NSEC3 records, sorted by hash */
+    size_t          zn_nsec3_count;
+    u_int16_t       zn_n3_iterations;
+    u_char          zn_n3_salt[256];
+    u_char          zn_n3_salt_len;
+    int             zn_anchor;          /* signed here, needs an anchor */
+    struct rb_zone *zn_next;
+};
+
+static struct rb_zone *rb_zones = NULL;
+
+/*
+ * A zone signing key
+ */
+struct rb_key {
+    EVP_PKEY       *k_pkey;
+    int             k_alg;
+    u_int16_t       k_tag;
+    u_char          k_rdata[1024];      /* DNSKEY rdata */
+    size_t          k_rdata_len;
+};
+
+/*
+ * ------------------------------------------------------------------
+ * names and tables
+ * ------------------------------------------------------------------
+ */
+
+static void
+rb_name_lower(u_char *name_n)
+{
+    u_char          len;
+    int             i;
+
+    while ((len = *name_n++) != 0) {
+        for (i = 0; i < len; i++, name_n++)
+            *name_n = (u_char) tolower(*name_n);
+    }
+}
+
+static int
+rb_name_eq(const u_char *a, const u_char *b)
+{
+    size_t          len = wire_name_length(a);
+
+    return len == wire_name_length(b) && !memcmp(a, b, len);
+}
+
+static int
+rb_name_labels(const u_char *name_n)
+{
+    int             labels = 0;
+
+    for (; *name_n; name_n += *name_n + 1)
+        labels++;
+    return labels;
+}
+
+/*
+ * The ancestor of name_n (or name_n itself) with the given number of
+ * labels
+ */
+static const u_char *
+rb_name_suffix(const u_char *name_n, int labels)
+{
+    int             skip = rb_name_labels(name_n) - labels;
+
+    for (; skip > 0; skip--)
+        name_n += *name_n + 1;
+    return name_n;
+}
+
+/*
+ * Is name_n at or below zone_n?  Both are lower case.
+ */
+static int
+rb_name_in(const u_char *name_n, const u_char *zone_n)
+{
+    int             nl = rb_name_labels(name_n);
+    int             zl = rb_name_labels(zone_n);
+
+    if (nl < zl)
+        return 0;
+    return rb_name_eq(rb_name_suffix(name_n, zl), zone_n);
+}
+
+static u_int32_t
+rb_name_hash(const u_char *name_n)
+{
+    u_int32_t       h = 2166136261U;
+
+    for (; *name_n; name_n++)
+        h = (h ^ *name_n) * 16777619U;
+    return h;
+}
+
+static struct rb_node *
+rb_find(struct rb_table *tb, const u_char *name_n)
+{
+    struct rb_node *nd;
+
+    if (tb->tb_size == 0)
+        return NULL;
+    for (nd = tb->tb_buckets[rb_name_hash(name_n) & (tb->tb_size - 1)];
+         nd; nd = nd->nd_next) {
+        if (rb_name_eq(nd->nd_name_n, name_n))
+            return nd;
+    }
+    return NULL;
+}
+
+static int
+rb_grow(struct rb_table *tb)
+{
+    struct rb_node **buckets, *nd, *next;
+    size_t          size, i;
+
+    size = tb->tb_size ? tb->tb_size * 2 : RB_MIN_BUCKETS;
+    buckets = (struct rb_node **) calloc(size, sizeof(struct rb_node *));
+    if (buckets == NULL)
+        return -1;
+    for (i = 0; i < tb->tb_size; i++) {
+        for (nd = tb->tb_buckets[i]; nd; nd = next) {
+            next = nd->nd_next;
+            nd->nd_next = buckets[rb_name_hash(nd->nd_name_n) & (size - 1)];
+            buckets[rb_name_hash(nd->nd_name_n) & (size - 1)] = nd;
+        }
+    }
+    free(tb->tb_buckets);
+    tb->tb_buckets = buckets;
+    tb->tb_size = size;
+    return 0;
+}
+
+static struct rb_node *
+rb_insert(struct rb_table *tb, const u_char *name_n)
+{
+    struct rb_node *nd;
+    size_t          len = wire_name_length(name_n);
+    u_int32_t       h;
+
+    if (NULL != (nd = rb_find(tb, name_n)))
+        return nd;
+    if (tb->tb_count >= tb->tb_size && rb_grow(tb) != 0)
+        return NULL;
+    nd = (struct rb_node *) calloc(1, sizeof(struct rb_node));
+    if (nd == NULL || NULL == (nd->nd_name_n = (u_char *) malloc(len))) {
+        free(nd);
+        return NULL;
+    }
+    memcpy(nd->nd_name_n, name_n, len);
+    h = rb_name_hash(name_n) & (tb->tb_size - 1);
+    nd->nd_next = tb->tb_buckets[h];
+    tb->tb_buckets[h] = nd;
+    tb->tb_count++;
+    return nd;
+}
+
+/*
+ * Add a name to the zone, along with any ancestors (up to the apex)
+ * that are not there yet
+ */
+static struct rb_node *
+rb_add_node(struct rb_zone *zn, const u_char *name_n)
+{
+    struct rb_node *nd;
+    int             labels, apex_labels, l;
+
+    if (NULL != (nd = rb_find(&zn->zn_names, name_n)))
+        return nd;
+    labels = rb_name_labels(name_n);
+    apex_labels = rb_name_labels(zn->zn_apex_n);
+    for (l = apex_labels; l < labels; l++) {
+        if (NULL == rb_insert(&zn->zn_names, rb_name_suffix(name_n, l)))
+            return NULL;
+    }
+    return rb_insert(&zn->zn_names, name_n);
+}
+
+static struct rb_rrset *
+rb_rrset(struct rb_node *nd, u_int16_t type_h)
+{
+    struct rb_rrset *rs;
+
+    for (rs = nd ? nd->nd_rrsets : NULL; rs; rs = rs->rs_next) {
+        if (rs->rs_type_h == type_h)
+            return rs;
+    }
+    return NULL;
+}
+
+/*
+ * The rrset of the given type at nd, if it has any data
+ */
+static struct rb_rrset *
+rb_data(struct rb_node *nd, u_int16_t type_h)
+{
+    struct rb_rrset *rs = rb_rrset(nd, type_h);
+
+    return (rs && rs->rs_data) ? rs : NULL;
+}
+
+static int
+rb_has_data(struct rb_node *nd)
+{
+    struct rb_rrset *rs;
+
+    for (rs = nd->nd_rrsets; rs; rs = rs->rs_next) {
+        if (rs->rs_data)
+            return 1;
+    }
+    return 0;
+}
+
+static int
+rb_append(struct rb_rr **list, const u_char *rdata, size_t len)
+{
+    struct rb_rr   *rr, **tail;
+
+    for (tail = list; *tail; tail = &(*tail)->rr_next) {
+        /* drop duplicates */
+        if ((*tail)->rr_len == len && !memcmp((*tail)->rr_rdata, rdata, len))
+            return 0;
+    }
+    rr = (struct rb_rr *) malloc(sizeof(struct rb_rr) + len);
+    if (rr == NULL)
+        return -1;
+    rr->rr_next = NULL;
+    rr->rr_len = (u_int16_t) len;
+    memcpy(rr->rr_rdata, rdata, len);
+    *tail = rr;
+    return 0;
+}
+
+/*
+ * Add a record to the zone.  RRSIGs are kept with the rrset that they
+ * cover, and NSEC3 records in their own table.
+ */
+static int
+rb_add_rr(struct rb_zone *zn, const u_char *owner_n, u_int16_t type_h,
+          u_int32_t ttl, const u_char *rdata, size_t len)
+{
+    struct rb_node *nd;
+    struct rb_rrset *rs;
+    u_int16_t       covered_h = type_h;
+    u_char          name_n[NS_MAXCDNAME];
+
+    memcpy(name_n, owner_n, wire_name_length(owner_n));
+    rb_name_lower(name_n);
+    if (!rb_name_in(name_n, zn->zn_apex_n))
+        return -1;
+
+    if (type_h == ns_t_rrsig) {
+        if (len < 18)
+            return -1;
+        covered_h = (rdata[0] << 8) | rdata[1];
+    }
+    if (covered_h == ns_t_nsec3)
+        nd = rb_insert(&zn->zn_hashed, name_n);
+    else
+        nd = rb_add_node(zn, name_n);
+    if (nd == NULL)
+        return -1;
+
+    if (NULL == (rs = rb_rrset(nd, covered_h))) {
+        rs = (struct rb_rrset *) calloc(1, sizeof(struct rb_rrset));
+        if (rs == NULL)
+            return -1;
+        rs->rs_type_h = covered_h;
+        rs->rs_ttl = ttl;
+        rs->rs_next = nd->nd_rrsets;
+        nd->nd_rrsets = rs;
+    }
+    if (type_h == ns_t_rrsig)
+        return rb_append(&rs->rs_sigs, rdata, len);
+    if (rs->rs_data == NULL || ttl < rs->rs_ttl)
+        rs->rs_ttl = ttl;
+    return rb_append(&rs->rs_data, rdata, len);
+}
+
+static struct rb_zone *
+rb_zone_new(const u_char *apex_n)
+{
+    struct rb_zone *zn;
+    size_t          len = wire_name_length(apex_n);
+
+    zn = (struct rb_zone *) calloc(1, sizeof(struct rb_zone));
+    if (zn == NULL || NULL == (zn->zn_apex_n = (u_char *) malloc(len))) {
+        free(zn);
+        return NULL;
+    }
+    memcpy(zn->zn_apex_n, apex_n, len);
+    rb_name_lower(zn->zn_apex_n);
+    if (NULL == rb_add_node(zn, zn->zn_apex_n)) {
+        free(zn->zn_apex_n);
+        free(zn);
+        return NULL;
+    }
+    zn->zn_next = rb_zones;
+    rb_zones = zn;
+    return zn;
+}
+
+static void
+rb_free_list(struct rb_rr *rr)
+{
+    struct rb_rr   *next;
+
+    for (; rr; rr = next) {
+        next = rr->rr_next;
+        free(rr);
+    }
+}
+
+static void
+rb_free_table(struct rb_table *tb)
+{
+    struct rb_node *nd, *next;
+    struct rb_rrset *rs, *rs_next;
+    size_t          i;
+
+    for (i = 0; i < tb->tb_size; i++) {
+        for (nd = tb->tb_buckets[i]; nd; nd = next) {
+            next = nd->nd_next;
+            for (rs = nd->nd_rrsets; rs; rs = rs_next) {
+                rs_next = rs->rs_next;
+                rb_free_list(rs->rs_data);
+                rb_free_list(rs->rs_sigs);
+                free(rs);
+            }
+            free(nd->nd_name_n);
+            free(nd);
+        }
+    }
+    free(tb->tb_buckets);
+}
+
+void
+rb_free_zones(void)
+{
+    struct rb_zone *zn;
+
+    while (NULL != (zn = rb_zones)) {
+        rb_zones = zn->zn_next;
+        rb_free_table(&zn->zn_names);
+        rb_free_table(&zn->zn_hashed);
+        free(zn->zn_nsec);
+        free(zn->zn_nsec3);
+        free(zn->zn_apex_n);
+        free(zn);
+    }
+}
+
+/*
+ * Is nd below a delegation point of its zone?  Such names are glue,
+ * and are neither signed nor part of the NSEC chain.
+ */
+static int
+rb_occluded(struct rb_zone *zn, struct rb_node *nd)
+{
+    int             labels = rb_name_labels(nd->nd_name_n);
+    int             l;
+
+    for (l = rb_name_labels(zn->zn_apex_n) + 1; l < labels; l++) {
+        if (rb_data(rb_find(&zn->zn_names,
+                            rb_name_suffix(nd->nd_name_n, l)), ns_t_ns))
+            return 1;
+    }
+    return 0;
+}
+
+static int
+rb_is_cut(struct rb_zone *zn, struct rb_node *nd)
+{
+    return !rb_name_eq(nd->nd_name_n, zn->zn_apex_n) &&
+        rb_data(nd, ns_t_ns) != NULL;
+}
+
+/*
+ * ------------------------------------------------------------------
+ * encodings
+ * ------------------------------------------------------------------
+ */
+
+static const char b32hex[] = "0123456789abcdefghijklmnopqrstuv";
+
+static size_t
+rb_b32hex_encode(const u_char *in, size_t len, char *out)
+{
+    size_t          i, o = 0;
+    u_int32_t       buf = 0;
+    int             bits = 0;
+
+    for (i = 0; i < len; i++) {
+        buf = (buf << 8) | in[i];
+        bits += 8;
+        while (bits >= 5) {
+            out[o++] = b32hex[(buf >> (bits - 5)) & 0x1f];
+            bits -= 5;
+        }
+    }
+    if (bits > 0)
+        out[o++] = b32hex[(buf << (5 - bits)) & 0x1f];
+    out[o] = '\0';
+    return o;
+}
+
+static int
+rb_b32hex_decode(const char *in, size_t inlen, u_char *out, size_t max)
+{
+    u_int32_t       buf = 0;
+    int             bits = 0, v;
+    size_t          i, o = 0;
+
+    for (i = 0; i < inlen; i++) {
+        int             c = tolower((unsigned char) in[i]);
+
+        if (c >= '0' && c <= '9')
+            v = c - '0';
+        else if (c >= 'a' && c <= 'v')
+            v = c - 'a' + 10;
+        else
+            return -1;
+        buf = (buf << 5) | v;
+        bits += 5;
+        if (bits >= 8) {
+            if (o >= max)
+                return -1;
+            out[o++] = (u_char) (buf >> (bits - 8));
+            bits -= 8;
+        }
+    }
+    return (int) o;
+}
+
+/*
+ * The NSEC3 hash of name_n with the zone's parameters
+ */
+static int
+rb_nsec3_hash(struct rb_zone *zn, const u_char *name_n, u_char *hash)
+{
+    u_char          buf[NS_MAXCDNAME + 256];
+    unsigned int    len;
+    size_t          name_len = wire_name_length(name_n);
+    int             i;
+
+    memcpy(buf, name_n, name_len);
+    rb_name_lower(buf);
+    memcpy(buf + name_len, zn->zn_n3_salt, zn->zn_n3_salt_len);
+    if (!EVP_Digest(buf, name_len + zn->zn_n3_salt_len, hash, &len,
+                    EVP_sha1(), NULL))
+        return -1;
+    for (i = 0; i < zn->zn_n3_iterations; i++) {
+        memcpy(buf, hash, RB_NSEC3_HASH_LEN);
+        memcpy(buf + RB_NSEC3_HASH_LEN, zn->zn_n3_salt, zn->zn_n3_salt_len);
+        if (!EVP_Digest(buf, RB_NSEC3_HASH_LEN + zn->zn_n3_salt_len, hash,
+                        &len, EVP_sha1(), NULL))
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * ------------------------------------------------------------------
+ * indexes, built once a zone is complete
+ * ------------------------------------------------------------------
+ */
+
+static int
+rb_nsec_cmp(const void *a, const void *b)
+{
+    return namecmp((*(struct rb_node * const *) a)->nd_name_n,
+                   (*(struct rb_node * const *) b)->nd_name_n);
+}
+
+static int
+rb_nsec3_cmp(const void *a, const void *b)
+{
+    return memcmp(((const struct rb_nsec3 *) a)->n3_hash,
+                  ((const struct rb_nsec3 *) b)->n3_hash, RB_NSEC3_HASH_LEN);
+}
+
+static int
+rb_zone_finish(struct rb_zone *zn)
+{
+    struct rb_node *nd;
+    struct rb_rrset *rs;
+    size_t          i, n;
+
+    free(zn->zn_nsec);
+    free(zn->zn_nsec3);
+    zn->zn_nsec = NULL;
+    zn->zn_nsec3 = NULL;
+    zn->zn_nsec_count = zn->zn_nsec3_count = 0;
+
+    n = 0;
+    for (i = 0; i < zn->zn_names.tb_size; i++) {
+        for (nd = zn->zn_names.tb_buckets[i]; nd; nd = nd->nd_next)
+            if (rb_data(nd, ns_t_nsec))
+                n++;
+    }
+    if (n > 0) {
+        zn->zn_nsec = (struct rb_node **) malloc(n * sizeof(struct rb_node *));
+        if (zn->zn_nsec == NULL)
+            return -1;
+        for (i = 0; i < zn->zn_names.tb_size; i++) {
+            for (nd = zn->zn_names.tb_buckets[i]; nd; nd = nd->nd_next)
+                if (rb_data(nd, ns_t_nsec))
+                    zn->zn_nsec[zn->zn_nsec_count++] = nd;
+        }
+        qsort(zn->zn_nsec, n, sizeof(struct rb_node *), rb_nsec_cmp);
+    }
+
+    /* NSEC3 parameters */
+    rs = rb_data(rb_find(&zn->zn_names, zn->zn_apex_n), RB_T_NSEC3PARAM);
+    if (rs && rs->rs_data->rr_len >= 5 &&
+        rs->rs_data->rr_len >= 5 + rs->rs_data->rr_rdata[4]) {
+        zn->zn_n3_iterations =
+            (rs->rs_data->rr_rdata[2] << 8) | rs->rs_data->rr_rdata[3];
+        zn->zn_n3_salt_len = rs->rs_data->rr_rdata[4];
+        memcpy(zn->zn_n3_salt, &rs->rs_data->rr_rdata[5],
+               zn->zn_n3_salt_len);
+    }
+
+    if (zn->zn_hashed.tb_count > 0) {
+        zn->zn_nsec3 = (struct rb_nsec3 *)
+            malloc(zn->zn_hashed.tb_count * sizeof(struct rb_nsec3));
+        if (zn->zn_nsec3 == NULL)
+            return -1;
+        for (i = 0; i < zn->zn_hashed.tb_size; i++) {
+            for (nd = zn->zn_hashed.tb_buckets[i]; nd; nd = nd->nd_next) {
+                struct rb_nsec3 *n3 = &zn->zn_nsec3[zn->zn_nsec3_count];
+
+                if (!rb_data(nd, ns_t_nsec3) ||
+                    rb_b32hex_decode((const char *) nd->nd_name_n + 1,
+                                     nd->nd_name_n[0], n3->n3_hash,
+                                     RB_NSEC3_HASH_LEN) != RB_NSEC3_HASH_LEN)
+                    continue;
+                n3->n3_node = nd;
+                zn->zn_nsec3_count++;
+            }
+        }
+        qsort(zn->zn_nsec3, zn->zn_nsec3_count, sizeof(struct rb_nsec3),
+              rb_nsec3_cmp);
+    }
+    return 0;
+}
+
+/*
+ * The NSEC owner at or before name_n in canonical order
+ */
+static struct rb_node *
+rb_nsec_covering(struct rb_zone *zn, const u_char *name_n)
+{
+    size_t          lo = 0, hi = zn->zn_nsec_count;
+
+    if (zn->zn_nsec_count == 0)
+        return NULL;
+    while (hi - lo > 1) {
+        size_t          mid = (lo + hi) / 2;
+
+        if (namecmp(zn->zn_nsec[mid]->nd_name_n, name_n) <= 0)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    if (namecmp(zn->zn_nsec[lo]->nd_name_n, name_n) > 0)
+        return zn->zn_nsec[zn->zn_nsec_count - 1];
+    return zn->zn_nsec[lo];
+}
+
+/*
+ * The NSEC3 record that matches or covers the hash of name_n
+ */
+static struct rb_node *
+rb_nsec3_covering(struct rb_zone *zn, const u_char *name_n)
+{
+    u_char          hash[EVP_MAX_MD_SIZE];
+    size_t          lo = 0, hi = zn->zn_nsec3_count;
+
+    if (zn->zn_nsec3_count == 0 || rb_nsec3_hash(zn, name_n, hash) != 0)
+        return NULL;
+    while (hi - lo > 1) {
+        size_t          mid = (lo + hi) / 2;
+
+        if (memcmp(zn->zn_nsec3[mid].n3_hash, hash, RB_NSEC3_HASH_LEN) <= 0)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    if (memcmp(zn->zn_nsec3[lo].n3_hash, hash, RB_NSEC3_HASH_LEN) > 0)
+        return zn->zn_nsec3[zn->zn_nsec3_count - 1].n3_node;
+    return zn->zn_nsec3[lo].n3_node;
+}
+
+/*
+ * Link each zone to the closest zone above it
+ */
+static void
+rb_link_zones(void)
+{
+    struct rb_zone *zn, *other;
+
+    for (zn = rb_zones; zn; zn = zn->zn_next) {
+        zn->zn_parent = NULL;
+        for (other = rb_zones; other; other = other->zn_next) {
+            if (other == zn ||
+                rb_name_labels(other->zn_apex_n) >=
+                rb_name_labels(zn->zn_apex_n) ||
+                !rb_name_in(zn->zn_apex_n, other->zn_apex_n))
+                continue;
+            if (zn->zn_parent == NULL ||
+                rb_name_labels(other->zn_apex_n) >
+                rb_name_labels(zn->zn_parent->zn_apex_n))
+                zn->zn_parent = other;
+        }
+    }
+}
+
+/*
+ * ------------------------------------------------------------------
+ * rdata
+ * ------------------------------------------------------------------
+ */
+
+static int
+rb_put(u_char *rdata, size_t *len, const void *data, size_t n)
+{
+    if (*len + n > RB_MAX_RDATA)
+        return -1;
+    memcpy(rdata + *len, data, n);
+    *len += n;
+    return 0;
+}
+
+static int
+rb_put_int(u_char *rdata, size_t *len, u_int32_t v, int width)
+{
+    u_char          b[4];
+    int             i;
+
+    for (i = width - 1; i >= 0; i--, v >>= 8)
+        b[i] = (u_char) (v & 0xff);
+    return rb_put(rdata, len, b, width);
+}
+
+/*
+ * An NSEC/NSEC3 type bitmap from a list of types
+ */
+static int
+rb_put_bitmap(u_char *rdata, size_t *len, const u_int16_t *types, int ntypes)
+{
+    u_char          bitmap[256][32];
+    int             used[256], window, i, last;
+
+    memset(bitmap, 0, sizeof(bitmap));
+    memset(used, 0, sizeof(used));
+    for (i = 0; i < ntypes; i++) {
+        window = types[i] >> 8;
+        bitmap[window][(types[i] & 0xff) / 8] |= 0x80 >> (types[i] % 8);
+        if ((types[i] & 0xff) / 8 + 1 > used[window])
+            used[window] = (types[i] & 0xff) / 8 + 1;
+    }
+    for (window = 0; window < 256; window++) {
+        if (used[window] == 0)
+            continue;
+        last = used[window];
+        if (rb_put_int(rdata, len, window, 1) != 0 ||
+            rb_put_int(rdata, len, last, 1) != 0 ||
+            rb_put(rdata, len, bitmap[window], last) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * ------------------------------------------------------------------
+ * signing
+ * ------------------------------------------------------------------
+ */
+
+static u_int16_t
+rb_key_tag(const u_char *rdata, size_t len)
+{
+    u_int32_t       ac = 0;
+    size_t          i;
+
+    for (i = 0; i < len; i++)
+        ac += (i & 1) ? rdata[i] : rdata[i] << 8;
+    ac += (ac >> 16) & 0xffff;
+    return (u_int16_t) (ac & 0xffff);
+}
+
+static void
+rb_key_free(struct rb_key *key)
+{
+    if (key) {
+        EVP_PKEY_free(key->k_pkey);
+        free(key);
+    }
+}
+
+/*
+ * Generate a combined signing key (flags 257) for RSASHA256 or
+ * ECDSAP256SHA256
+ */
+static struct rb_key *
+rb_key_new(int alg, int bits)
+{
+    struct rb_key  *key;
+    EVP_PKEY_CTX   *ctx;
+    size_t          len = 0;
+
+    key = (struct rb_key *) calloc(1, sizeof(struct rb_key));
+    if (key == NULL)
+        return NULL;
+    key->k_alg = alg;
+
+    ctx = EVP_PKEY_CTX_new_id(alg == RB_ALG_ECDSAP256 ?
+                              EVP_PKEY_EC : EVP_PKEY_RSA, NULL);
+    if (ctx == NULL || EVP_PKEY_keygen_init(ctx) <= 0 ||
+        (alg == RB_ALG_ECDSAP256 ?
+         EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx,
+                                                NID_X9_62_prime256v1) :
+         EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, bits)) <= 0 ||
+        EVP_PKEY_keygen(ctx, &key->k_pkey) <= 0) {
+        EVP_PKEY_CTX_free(ctx);
+        rb_key_free(key);
+        return NULL;
+    }
+    EVP_PKEY_CTX_free(ctx);
+
+    rb_put_int(key->k_rdata, &len, 257, 2);
+    rb_put_int(key->k_rdata, &len, 3, 1);
+    rb_put_int(key->k_rdata, &len, alg, 1);
+    if (alg == RB_ALG_ECDSAP256) {
+        const EC_KEY   *ec = EVP_PKEY_get0_EC_KEY(key->k_pkey);
+        u_char          point[65];
+
+        if (ec == NULL ||
+            EC_POINT_point2oct(EC_KEY_get0_group(ec),
+                               EC_KEY_get0_public_key(ec),
+                               POINT_CONVERSION_UNCOMPRESSED, point,
+                               sizeof(point), NULL) != sizeof(point)) {
+            rb_key_free(key);
+            return NULL;
+        }
+        rb_put(key->k_rdata, &len, point + 1, 64);
+    } else {
+        const RSA      *rsa = EVP_PKEY_get0_RSA(key->k_pkey);
+        const BIGNUM   *n, *e;
+
+        if (rsa == NULL) {
+            rb_key_free(key);
+            return NULL;
+        }
+        RSA_get0_key(rsa, &n, &e, NULL);
+        rb_put_int(key->k_rdata, &len, BN_num_bytes(e), 1);
+        len += BN_bn2bin(e, key->k_rdata + len);
+        len += BN_bn2bin(n, key->k_rdata + len);
+    }
+    key->k_rdata_len = len;
+    key->k_tag = rb_key_tag(key->k_rdata, len);
+    return key;
+}
+
+static int
+rb_sign_data(struct rb_key *key, const u_char *data, size_t len,
+             u_char *sig, size_t *sig_len)
+{
+    EVP_MD_CTX     *md;
+    u_char          der[1024];
+    size_t          der_len = sizeof(der);
+    int             ok;
+
+    md = EVP_MD_CTX_new();
+    ok = md != NULL &&
+        EVP_DigestSignInit(md, NULL, EVP_sha256(), NULL, key->k_pkey) > 0 &&
+        EVP_DigestSignUpdate(md, data, len) > 0 &&
+        EVP_DigestSignFinal(md, der, &der_len) > 0;
+    EVP_MD_CTX_free(md);
+    if (!ok)
+        return -1;
+
+    if (key->k_alg == RB_ALG_ECDSAP256) {
+        /* DER to r || s */
+        const u_char   *cp = der;
+        ECDSA_SIG      *es = d2i_ECDSA_SIG(NULL, &cp, der_len);
+        const BIGNUM   *r, *s;
+
+        if (es == NULL)
+            return -1;
+        ECDSA_SIG_get0(es, &r, &s);
+        BN_bn2binpad(r, sig, 32);
+        BN_bn2binpad(s, sig + 32, 32);
+        ECDSA_SIG_free(es);
+        *sig_len = 64;
+    } else {
+        memcpy(sig, der, der_len);
+        *sig_len = der_len;
+    }
+    return 0;
+}
+
+static int
+rb_rr_cmp(const void *a, const void *b)
+{
+    const struct rb_rr *x = *(struct rb_rr * const *) a;
+    const struct rb_rr *y = *(struct rb_rr * const *) b;
+    int             rc;
+
+    rc = memcmp(x->rr_rdata, y->rr_rdata,
+                x->rr_len < y->rr_len ? x->rr_len : y->rr_len);
+    return rc ? rc : (int) x->rr_len - (int) y->rr_len;
+}
+
+/*
+ * Sign one rrset (RFC 4034, section 3.1.8.1)
+ */
+static int
+rb_sign_rrset(struct rb_zone *zn, const u_char *owner_n, struct rb_rrset *rs,
+              struct rb_key *key, u_int32_t now)
+{
+    struct rb_rr   *rr, **sorted;
+    u_char         *data, sig[1024];
+    size_t          owner_len = wire_name_length(owner_n);
+    size_t          len = 0, hdr_len, sig_len, n = 0, i;
+    int             labels = rb_name_labels(owner_n);
+    int             rc;
+
+    if (owner_n[0] == 1 && owner_n[1] == '*')
+        labels--;
+
+    for (rr = rs->rs_data; rr; rr = rr->rr_next)
+        len += owner_len + 10 + rr->rr_len, n++;
+    len += 18 + wire_name_length(zn->zn_apex_n) + sizeof(sig);
+
+    data = (u_char *) malloc(len);
+    sorted = (struct rb_rr **) malloc(n * sizeof(struct rb_rr *));
+    if (data == NULL || sorted == NULL) {
+        free(data);
+        free(sorted);
+        return -1;
+    }
+    for (i = 0, rr = rs->rs_data; rr; rr = rr->rr_next)
+        sorted[i++] = rr;
+    qsort(sorted, n, sizeof(struct rb_rr *), rb_rr_cmp);
+
+    len = 0;
+    rb_put_int(data, &len, rs->rs_type_h, 2);
+    rb_put_int(data, &len, key->k_alg, 1);
+    rb_put_int(data, &len, labels, 1);
+    rb_put_int(data, &len, rs->rs_ttl, 4);
+    rb_put_int(data, &len, now + RB_SIG_VALIDITY, 4);
+    rb_put_int(data, &len, now - 3600, 4);
+    rb_put_int(data, &len, key->k_tag, 2);
+    rb_put(data, &len, zn->zn_apex_n, wire_name_length(zn->zn_apex_n));
+    hdr_len = len;
+    for (i = 0; i < n; i++) {
+        rb_put(data, &len, owner_n, owner_len);
+        rb_put_int(data, &len, rs->rs_type_h, 2);
+        rb_put_int(data, &len, ns_c_in, 2);
+        rb_put_int(data, &len, rs->rs_ttl, 4);
+        rb_put_int(data, &len, sorted[i]->rr_len, 2);
+        rb_put(data, &len, sorted[i]->rr_rdata, sorted[i]->rr_len);
+    }
+
+    rc = rb_sign_data(key, data, len, sig, &sig_len);
+    if (rc == 0) {
+        memcpy(data + hdr_len, sig, sig_len);
+        rc = rb_append(&rs->rs_sigs, data, hdr_len + sig_len);
+    }
+    free(sorted);
+    free(data);
+    return rc;
+}
+
+/*
+ * The types present at a name, for its NSEC or NSEC3 record
+ */
+static int
+rb_node_types(struct rb_zone *zn, struct rb_node *nd, u_int16_t *types,
+              int nsec3)
+{
+    struct rb_rrset *rs;
+    int             n = 0, signed_data = 0;
+
+    for (rs = nd->nd_rrsets; rs; rs = rs->rs_next) {
+        if (!rs->rs_data)
+            continue;
+        types[n++] = rs->rs_type_h;
+        if (!(rs->rs_type_h == ns_t_ns && rb_is_cut(zn, nd)))
+            signed_data = 1;
+    }
+    if (!nsec3)
+        types[n++] = ns_t_nsec;
+    if (!nsec3 || signed_data)
+        types[n++] = ns_t_rrsig;
+    return n;
+}
+
+/*
+ * Add the DNSKEY, the NSEC or NSEC3 chain and the RRSIGs to a zone
+ */
+static int
+rb_sign_zone(struct rb_zone *zn, struct rb_key *key, int nsec3)
+{
+    struct rb_node *nd, **names;
+    struct rb_rrset *rs;
+    struct rb_nsec3 *hashes;
+    u_char          rdata[RB_MAX_RDATA], owner_n[NS_MAXCDNAME];
+    u_int16_t       types[64];
+    char            label[64];
+    size_t          n = 0, i, len;
+    int             ntypes;
+    u_int32_t       now = (u_int32_t) time(NULL);
+
+    if (rb_add_rr(zn, zn->zn_apex_n, ns_t_dnskey, RB_TTL, key->k_rdata,
+                  key->k_rdata_len) != 0)
+        return -1;
+    if (nsec3) {
+        static const u_char param[] = { 1, 0, 0, 0, 0 };
+
+        if (rb_add_rr(zn, zn->zn_apex_n, RB_T_NSEC3PARAM, 0, param,
+                      sizeof(param)) != 0)
+            return -1;
+    }
+
+    /* authoritative names, in canonical order */
+    names = (struct rb_node **) malloc(zn->zn_names.tb_count *
+                                       sizeof(struct rb_node *));
+    if (names == NULL)
+        return -1;
+    for (i = 0; i < zn->zn_names.tb_size; i++) {
+        for (nd = zn->zn_names.tb_buckets[i]; nd; nd = nd->nd_next) {
+            if (rb_occluded(zn, nd) || (!nsec3 && !rb_has_data(nd)))
+                continue;
+            names[n++] = nd;
+        }
+    }
+    qsort(names, n, sizeof(struct rb_node *), rb_nsec_cmp);
+
+    if (!nsec3) {
+        for (i = 0; i < n; i++) {
+            nd = names[(i + 1) % n];
+            len = 0;
+            rb_put(rdata, &len, nd->nd_name_n, wire_name_length(nd->nd_name_n));
+            ntypes = rb_node_types(zn, names[i], types, 0);
+            if (rb_put_bitmap(rdata, &len, types, ntypes) != 0 ||
+                rb_add_rr(zn, names[i]->nd_name_n, ns_t_nsec, RB_TTL,
+                          rdata, len) != 0) {
+                free(names);
+                return -1;
+            }
+        }
+    } else {
+        if (rb_zone_finish(zn) != 0 ||
+            NULL == (hashes = (struct rb_nsec3 *)
+                     malloc(n * sizeof(struct rb_nsec3)))) {
+            free(names);
+            return -1;
+        }
+        for (i = 0; i < n; i++) {
+            rb_nsec3_hash(zn, names[i]->nd_name_n, hashes[i].n3_hash);
+            hashes[i].n3_node = names[i];
+        }
+        qsort(hashes, n, sizeof(struct rb_nsec3), rb_nsec3_cmp);
+        for (i = 0; i < n; i++) {
+            static const u_char head[] = { 1, 0, 0, 0, 0, RB_NSEC3_HASH_LEN };
+
+            len = 0;
+            rb_put(rdata, &len, head, sizeof(head));
+            rb_put(rdata, &len, hashes[(i + 1) % n].n3_hash,
+                   RB_NSEC3_HASH_LEN);
+            ntypes = rb_node_types(zn, hashes[i].n3_node, types, 1);
+            rb_put_bitmap(rdata, &len, types, ntypes);
+
+            owner_n[0] = (u_char) rb_b32hex_encode(hashes[i].n3_hash,
+                                                   RB_NSEC3_HASH_LEN, label);
+            memcpy(owner_n + 1, label, owner_n[0]);
+            memcpy(owner_n + 1 + owner_n[0], zn->zn_apex_n,
+                   wire_name_length(zn->zn_apex_n));
+            if (rb_add_rr(zn, owner_n, ns_t_nsec3, RB_TTL, rdata, len) != 0) {
+                free(hashes);
+                free(names);
+                return -1;
+            }
+        }
+        free(hashes);
+    }
+
+    /* sign everything but delegation NS rrsets */
+    for (i = 0; i < n; i++) {
+        for (rs = names[i]->nd_rrsets; rs; rs = rs->rs_next) {
+            if (!rs->rs_data ||
+                (rs->rs_type_h == ns_t_ns && rb_is_cut(zn, names[i])))
+                continue;
+            if (rb_sign_rrset(zn, names[i]->nd_name_n, rs, key, now) != 0) {
+                free(names);
+                return -1;
+            }
+        }
+    }
+    free(names);
+    for (i = 0; i < zn->zn_hashed.tb_size; i++) {
+        for (nd = zn->zn_hashed.tb_buckets[i]; nd; nd = nd->nd_next) {
+            if (NULL != (rs = rb_data(nd, ns_t_nsec3)) &&
+                rb_sign_rrset(zn, nd->nd_name_n, rs, key, now) != 0)
+                return -1;
+        }
+    }
+    return rb_zone_finish(zn);
+}
+
+/*
+ * The SHA-256 DS rdata for a DNSKEY
+ */
+static int
+rb_make_ds(const u_char *owner_n, const u_char *dnskey, size_t dnskey_len,
+           u_char *rdata, size_t *len)
+{
+    u_char          buf[NS_MAXCDNAME + 1024];
+    u_char          digest[EVP_MAX_MD_SIZE];
+    unsigned int    digest_len;
+    size_t          owner_len = wire_name_length(owner_n);
+
+    if (dnskey_len < 4 || dnskey_len > 1024)
+        return -1;
+    memcpy(buf, owner_n, owner_len);
+    rb_name_lower(buf);
+    memcpy(buf + owner_len, dnskey, dnskey_len);
+    if (!EVP_Digest(buf, owner_len + dnskey_len, digest, &digest_len,
+                    EVP_sha256(), NULL))
+        return -1;
+    *len = 0;
+    rb_put_int(rdata, len, rb_key_tag(dnskey, dnskey_len), 2);
+    rb_put_int(rdata, len, dnskey[3], 1);
+    rb_put_int(rdata, len, 2, 1);
+    return rb_put(rdata, len, digest, digest_len);
+}
+
+static int
+rb_add_text(struct rb_zone *zn, const char *owner, u_int16_t type_h,
+            const u_char *rdata, size_t len)
+{
+    u_char          owner_n[NS_MAXCDNAME];
+
+    if (ns_name_pton(owner, owner_n, sizeof(owner_n)) == -1)
+        return -1;
+    return rb_add_rr(zn, owner_n, type_h, RB_TTL, rdata, len);
+}
+
+static int
+rb_add_name_rdata(struct rb_zone *zn, const char *owner, u_int16_t type_h,
+                  const char *target)
+{
+    u_char          target_n[NS_MAXCDNAME];
+
+    if (ns_name_pton(target, target_n, sizeof(target_n)) == -1)
+        return -1;
+    return rb_add_text(zn, owner, type_h, target_n,
+                       wire_name_length(target_n));
+}
+
+/*
+ * The SOA, NS and name server address of a generated zone
+ */
+static int
+rb_add_apex(struct rb_zone *zn, const char *apex, const u_char *addr)
+{
+    u_char          rdata[2 * NS_MAXCDNAME + 20];
+    char            ns[NS_MAXDNAME], mbox[NS_MAXDNAME];
+    size_t          len = 0, l;
+
+    snprintf(ns, sizeof(ns), "ns.%s", strcmp(apex, ".") ? apex : "");
+    snprintf(mbox, sizeof(mbox), "hostmaster.%s",
+             strcmp(apex, ".") ? apex : "");
+    if (ns_name_pton(ns, rdata, sizeof(rdata)) == -1)
+        return -1;
+    len = wire_name_length(rdata);
+    if (ns_name_pton(mbox, rdata + len, sizeof(rdata) - len) == -1)
+        return -1;
+    len += wire_name_length(rdata + len);
+    rb_put_int(rdata, &len, 1, 4);
+    for (l = 0; l < 4; l++)
+        rb_put_int(rdata, &len, l == 3 ? 604800 : RB_TTL, 4);
+    if (rb_add_text(zn, apex, ns_t_soa, rdata, len) != 0 ||
+        rb_add_name_rdata(zn, apex, ns_t_ns, ns) != 0 ||
+        rb_add_text(zn, ns, ns_t_a, addr, 4) != 0)
+        return -1;
+    return 0;
+}
+
+/*
+ * Delegate child from parent: NS, glue and DS
+ */
+static int
+rb_delegate(struct rb_zone *parent, struct rb_zone *child, const char *apex,
+            const u_char *addr)
+{
+    struct rb_rrset *rs;
+    struct rb_rr   *rr;
+    u_char          rdata[256];
+    char            ns[NS_MAXDNAME];
+    size_t          len;
+
+    snprintf(ns, sizeof(ns), "ns.%s", apex);
+    if (rb_add_name_rdata(parent, apex, ns_t_ns, ns) != 0 ||
+        rb_add_text(parent, ns, ns_t_a, addr, 4) != 0)
+        return -1;
+    rs = rb_data(rb_find(&child->zn_names, child->zn_apex_n), ns_t_dnskey);
+    for (rr = rs ? rs->rs_data : NULL; rr; rr = rr->rr_next) {
+        if (rb_make_ds(child->zn_apex_n, rr->rr_rdata, rr->rr_len, rdata,
+                       &len) != 0 ||
+            rb_add_text(parent, apex, ns_t_ds, rdata, len) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Generate a signed tree: the root, "bench." and zones z0.bench. ..
+ * each with hosts h0 .. and a www CNAME.  All name servers are at addr.
+ */
+int
+rb_make_zones(int zones, int hosts, int alg, int bits, int nsec3,
+              const char *addr)
+{
+    struct rb_zone *root, *tld, *zn;
+    struct rb_key  *key;
+    u_char          addr_n[4], a[4], apex_n[NS_MAXCDNAME];
+    char            apex[NS_MAXDNAME];
+    char            owner[NS_MAXDNAME + 16];    /* "h<n>." or "www." + apex */
+    int             i, j;
+
+    if (inet_pton(AF_INET, addr, addr_n) != 1) {
+        fprintf(stderr, "Bad address %s\n", addr);
+        return -1;
+    }
+
+    ns_name_pton(".", apex_n, sizeof(apex_n));
+    root = rb_zone_new(apex_n);
+    ns_name_pton("bench.", apex_n, sizeof(apex_n));
+    tld = rb_zone_new(apex_n);
+    if (root == NULL || tld == NULL ||
+        rb_add_apex(root, ".", addr_n) != 0 ||
+        rb_add_apex(tld, "bench.", addr_n) != 0)
+        return -1;
+
+    for (i = 0; i < zones; i++) {
+        snprintf(apex, sizeof(apex), "z%d.bench.", i);
+        ns_name_pton(apex, apex_n, sizeof(apex_n));
+        if (NULL == (zn = rb_zone_new(apex_n)) ||
+            rb_add_apex(zn, apex, addr_n) != 0)
+            return -1;
+        for (j = 0; j < hosts; j++) {
+            snprintf(owner, sizeof(owner), "h%d.%s", j, apex);
+            a[0] = 198;
+            a[1] = 18;
+            a[2] = (u_char) (j >> 8);
+            a[3] = (u_char) j;
+            if (rb_add_text(zn, owner, ns_t_a, a, 4) != 0)
+                return -1;
+        }
+        snprintf(owner, sizeof(owner), "www.%s", apex);
+        snprintf(apex, sizeof(apex), "h0.z%d.bench.", i);
+        if (rb_add_name_rdata(zn, owner, ns_t_cname, apex) != 0)
+            return -1;
+        snprintf(apex, sizeof(apex), "z%d.bench.", i);
+
+        if (NULL == (key = rb_key_new(alg, bits))) {
+            fprintf(stderr, "Cannot generate a key for algorithm %d\n", alg);
+            return -1;
+        }
+        if (rb_sign_zone(zn, key, nsec3) != 0 ||
+            rb_delegate(tld, zn, apex, addr_n) != 0) {
+            rb_key_free(key);
+            return -1;
+        }
+        rb_key_free(key);
+    }
+
+    if (NULL == (key = rb_key_new(alg, bits)))
+        return -1;
+    if (rb_sign_zone(tld, key, nsec3) != 0 ||
+        rb_delegate(root, tld, "bench.", addr_n) != 0) {
+        rb_key_free(key);
+        return -1;
+    }
+    rb_key_free(key);
+
+    if (NULL == (key = rb_key_new(alg, bits)))
+        return -1;
+    if (rb_sign_zone(root, key, nsec3) != 0) {
+        rb_key_free(key);
+        return -1;
+    }
+    rb_key_free(key);
+    return 0;
+}
+
+/*
+ * ------------------------------------------------------------------
+ * zone files
+ * ------------------------------------------------------------------
+ */
+
+struct rb_load_state {
+    struct rb_zone *zone;
+    int             no_soa;
+    int             skipped;
+};
+
+/*
+ * Add a record read from a zone file.  The first record must be the
+ * SOA, whose owner names the zone.
+ */
+static int
+rb_load_rr(void *cb_data, const u_char *owner_n, u_int16_t type_h,
+           u_int16_t class_h, u_int32_t ttl_h, const u_char *rdata,
+           size_t rdata_len)
+{
+    struct rb_load_state *ls = (struct rb_load_state *) cb_data;
+    u_char          name_n[NS_MAXCDNAME];
+
+    if (class_h != ns_c_in) {
+        ls->skipped++;
+        return VAL_NO_ERROR;
+    }
+    if (ls->zone == NULL) {
+        if (type_h != ns_t_soa) {
+            ls->no_soa = 1;
+            return VAL_CONF_PARSE_ERROR;
+        }
+        if (NULL == (ls->zone = rb_zone_new(owner_n)))
+            return VAL_OUT_OF_MEMORY;
+    }
+
+    memcpy(name_n, owner_n, wire_name_length(owner_n));
+    if (rb_add_rr(ls->zone, name_n, type_h, ttl_h, rdata, rdata_len) != 0) {
+        /* out of zone data is left out */
+        ls->skipped++;
+    }
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Load a zone from a zone file, with the reader that libval uses for
+ * zone-mirror.  The zone is named by the owner of its SOA record,
+ * which must come first.  Relative names before any $ORIGIN are
+ * relative to origin, or to the root if origin is NULL.  A zone with
+ * no DNSKEY, such as the ones in testing/, is signed here with a new
+ * key of the given algorithm and size.
+ */
+int
+rb_load_zone(const char *file, const char *origin, int alg, int bits,
+             int nsec3)
+{
+    struct rb_load_state ls;
+    struct rb_key  *key;
+    u_char          origin_n[NS_MAXCDNAME];
+    int             unknown = 0, line = 0, rc;
+
+    memset(&ls, 0, sizeof(ls));
+    if (ns_name_pton(origin ? origin : ".", origin_n,
+                     sizeof(origin_n)) == -1) {
+        fprintf(stderr, "Bad origin %s\n", origin);
+        return -1;
+    }
+
+    rc = read_zone_file(NULL, file, origin_n, rb_load_rr, &ls, &unknown,
+                        &line);
+    if (rc != VAL_NO_ERROR) {
+        if (ls.no_soa)
+            fprintf(stderr, "%s:%d: zone file must start with the SOA\n",
+                    file, line);
+        else if (rc == VAL_CONF_PARSE_ERROR)
+            fprintf(stderr, "%s:%d: parse error\n", file, line);
+        else
+            fprintf(stderr, "Cannot load %s: %s\n", file, p_val_err(rc));
+        return -1;
+    }
+    if (ls.zone == NULL) {
+        fprintf(stderr, "%s: no SOA record\n", file);
+        return -1;
+    }
+    if (ls.skipped + unknown)
+        fprintf(stderr, "%s: %d records of unsupported types or classes, "
+                "or outside the zone, were left out\n", file,
+                ls.skipped + unknown);
+
+    if (rb_data(rb_find(&ls.zone->zn_names, ls.zone->zn_apex_n),
+                ns_t_dnskey) != NULL)
+        return rb_zone_finish(ls.zone);
+
+    if (NULL == (key = rb_key_new(alg, bits))) {
+        fprintf(stderr, "Cannot generate a key for algorithm %d\n", alg);
+        return -1;
+    }
+    rc = rb_sign_zone(ls.zone, key, nsec3);
+    rb_key_free(key);
+    if (rc != 0) {
+        fprintf(stderr, "%s: cannot sign the zone\n", file);
+        return -1;
+    }
+    /* no parent here has a DS for the new key */
+    ls.zone->zn_anchor = 1;
+    return 0;
+}
+
+/*
+ * Write a DS trust anchor, in dnsval.conf syntax, for each secure entry
+ * point key of each zone that has no parent zone here or that was
+ * signed when it was loaded
+ */
+int
+rb_write_anchors(FILE *fp)
+{
+    struct rb_zone *zn;
+    struct rb_rrset *rs;
+    struct rb_rr   *rr;
+    u_char          rdata[256];
+    char            apex[NS_MAXDNAME];
+    size_t          len, i;
+    int             count = 0;
+
+    rb_link_zones();
+    for (zn = rb_zones; zn; zn = zn->zn_next) {
+        if (zn->zn_parent && !zn->zn_anchor)
+            continue;
+        rs = rb_data(rb_find(&zn->zn_names, zn->zn_apex_n), ns_t_dnskey);
+        for (rr = rs ? rs->rs_data : NULL; rr; rr = rr->rr_next) {
+            /* SEP keys that are not revoked */
+            if (rr->rr_len < 4 || !(rr->rr_rdata[1] & 0x01) ||
+                (rr->rr_rdata[1] & 0x80) ||
+                rb_make_ds(zn->zn_apex_n, rr->rr_rdata, rr->rr_len, rdata,
+                           &len) != 0)
+                continue;
+            ns_name_ntop(zn->zn_apex_n, apex, sizeof(apex));
+            fprintf(fp, "    %s DS %d %d %d ", apex,
+                    (rdata[0] << 8) | rdata[1], rdata[2], rdata[3]);
+            for (i = 4; i < len; i++)
+                fprintf(fp, "%02X", rdata[i]);
+            fprintf(fp, "\n");
+            count++;
+        }
+    }
+    return count;
+}
+
+static int
+rb_mix_add(struct rb_query **mix, int *count, int *alloc,
+           const u_char *name_n, const char *prefix, int type_h)
+{
+    char            name[NS_MAXDNAME];
+    size_t          plen = prefix ? strlen(prefix) : 0;
+
+    if (*count >= *alloc) {
+        int             n = *alloc ? *alloc * 2 : 1024;
+        struct rb_query *m;
+
+        m = (struct rb_query *) realloc(*mix, n * sizeof(struct rb_query));
+        if (m == NULL)
+            return -1;
+        *mix = m;
+        *alloc = n;
+    }
+    if (prefix)
+        memcpy(name, prefix, plen);
+    if (ns_name_ntop(name_n, name + plen, sizeof(name) - plen) == -1)
+        return -1;
+    if (prefix && !strcmp(name + plen, "."))
+        name[plen] = '\0';
+    if (NULL == ((*mix)[*count].rq_name = strdup(name)))
+        return -1;
+    (*mix)[*count].rq_type_h = type_h;
+    (*count)++;
+    return 0;
+}
+
+/*
+ * A query mix covering the zones: every authoritative rrset (DNSSEC
+ * records aside), and in each zone a name that does not exist and a
+ * type that does not exist at the apex
+ */
+int
+rb_query_mix(struct rb_query **mix, int *count)
+{
+    struct rb_zone *zn;
+    struct rb_node *nd;
+    struct rb_rrset *rs;
+    size_t          i;
+    int             alloc = 0, z = 0;
+    char            prefix[32];
+
+    *mix = NULL;
+    *count = 0;
+    for (zn = rb_zones; zn; zn = zn->zn_next, z++) {
+        for (i = 0; i < zn->zn_names.tb_size; i++) {
+            for (nd = zn->zn_names.tb_buckets[i]; nd; nd = nd->nd_next) {
+                if (rb_occluded(zn, nd) || rb_is_cut(zn, nd))
+                    continue;
+                for (rs = nd->nd_rrsets; rs; rs = rs->rs_next) {
+                    if (!rs->rs_data || rs->rs_type_h == ns_t_rrsig ||
+                        rs->rs_type_h == ns_t_nsec ||
+                        rs->rs_type_h == ns_t_nsec3 ||
+                        rs->rs_type_h == RB_T_NSEC3PARAM ||
+                        rs->rs_type_h == ns_t_dnskey ||
+                        rs->rs_type_h == ns_t_ds)
+                        continue;
+                    if (rb_mix_add(mix, count, &alloc, nd->nd_name_n, NULL,
+                                   rs->rs_type_h) != 0)
+                        return -1;
+                }
+            }
+        }
+        snprintf(prefix, sizeof(prefix), "nonexistent-%d.", z);
+        nd = rb_find(&zn->zn_names, zn->zn_apex_n);
+        if (rb_mix_add(mix, count, &alloc, zn->zn_apex_n, prefix,
+                       ns_t_a) != 0 ||
+            rb_mix_add(mix, count, &alloc, zn->zn_apex_n, NULL,
+                       rb_data(nd, ns_t_txt) ? ns_t_hinfo : ns_t_txt) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * ------------------------------------------------------------------
+ * answering queries
+ * ------------------------------------------------------------------
+ */
+
+struct rb_msg {
+    u_char         *m_buf;
+    size_t          m_len;
+    size_t          m_max;
+    int             m_overflow;
+    const u_char   *m_qname_n;          /* lower case */
+    int             m_dnssec;
+    u_int16_t       m_count[3];         /* answer, authority, additional */
+};
+
+#define RB_AN   0
+#define RB_NS   1
+#define RB_AR   2
+
+static void
+rb_msg_put(struct rb_msg *m, const void *data, size_t len)
+{
+    if (m->m_overflow || m->m_len + len > m->m_max) {
+        m->m_overflow = 1;
+        return;
+    }
+    memcpy(m->m_buf + m->m_len, data, len);
+    m->m_len += len;
+}
+
+static void
+rb_msg_int(struct rb_msg *m, u_int32_t v, int width)
+{
+    u_char          b[4];
+    size_t          len = 0;
+
+    rb_put_int(b, &len, v, width);
+    rb_msg_put(m, b, width);
+}
+
+static void
+rb_msg_rr(struct rb_msg *m, int section, const u_char *owner_n,
+          u_int16_t type_h, u_int32_t ttl, const u_char *rdata, size_t len)
+{
+    static const u_char qname_ptr[] = { 0xc0, 0x0c };
+
+    if (rb_name_eq(owner_n, m->m_qname_n))
+        rb_msg_put(m, qname_ptr, sizeof(qname_ptr));
+    else
+        rb_msg_put(m, owner_n, wire_name_length(owner_n));
+    rb_msg_int(m, type_h, 2);
+    rb_msg_int(m, ns_c_in, 2);
+    rb_msg_int(m, ttl, 4);
+    rb_msg_int(m, (u_int32_t) len, 2);
+    rb_msg_put(m, rdata, len);
+    m->m_count[section]++;
+}
+
+static void
+rb_msg_rrset(struct rb_msg *m, int section, const u_char *owner_n,
+             struct rb_rrset *rs)
+{
+    struct rb_rr   *rr;
+
+    if (rs == NULL)
+        return;
+    for (rr = rs->rs_data; rr; rr = rr->rr_next)
+        rb_msg_rr(m, section, owner_n, rs->rs_type_h, rs->rs_ttl,
+                  rr->rr_rdata, rr->rr_len);
+    if (m->m_dnssec) {
+        for (rr = rs->rs_sigs; rr; rr = rr->rr_next)
+            rb_msg_rr(m, section, owner_n, ns_t_rrsig, rs->rs_ttl,
+                      rr->rr_rdata, rr->rr_len);
+    }
+}
+
+/*
+ * Add the NSEC or NSEC3 records of a proof to the authority section,
+ * once each
+ */
+static void
+rb_msg_proof(struct rb_msg *m, struct rb_node **added, int *nadded,
+             struct rb_node *nd, u_int16_t type_h)
+{
+    int             i;
+
+    if (!m->m_dnssec || nd == NULL)
+        return;
+    for (i = 0; i < *nadded; i++) {
+        if (added[i] == nd)
+            return;
+    }
+    added[(*nadded)++] = nd;
+    rb_msg_rrset(m, RB_NS, nd->nd_name_n, rb_data(nd, type_h));
+}
+
+static void
+rb_msg_soa(struct rb_msg *m, struct rb_zone *zn)
+{
+    rb_msg_rrset(m, RB_NS, zn->zn_apex_n,
+                 rb_data(rb_find(&zn->zn_names, zn->zn_apex_n), ns_t_soa));
+}
+
+/*
+ * The proof for a name with no data of the requested type
+ */
+static void
+rb_nodata(struct rb_msg *m, struct rb_zone *zn, struct rb_node *nd,
+          const u_char *name_n)
+{
+    struct rb_node *added[3];
+    int             nadded = 0;
+
+    rb_msg_soa(m, zn);
+    if (zn->zn_nsec3_count)
+        rb_msg_proof(m, added, &nadded, rb_nsec3_covering(zn, name_n),
+                     ns_t_nsec3);
+    else if (rb_data(nd, ns_t_nsec))
+        rb_msg_proof(m, added, &nadded, nd, ns_t_nsec);
+    else
+        rb_msg_proof(m, added, &nadded, rb_nsec_covering(zn, name_n),
+                     ns_t_nsec);
+}
+
+static void
+rb_referral(struct rb_msg *m, struct rb_zone *zn, struct rb_node *cut)
+{
+    struct rb_rrset *ns = rb_data(cut, ns_t_ns), *ds;
+    struct rb_node *added[1], *glue;
+    struct rb_rrset *a;
+    struct rb_rr   *rr, *addr;
+    u_char          target_n[NS_MAXCDNAME];
+    int             nadded = 0;
+
+    rb_msg_rrset(m, RB_NS, cut->nd_name_n, ns);
+    if (NULL != (ds = rb_data(cut, ns_t_ds)))
+        rb_msg_rrset(m, RB_NS, cut->nd_name_n, ds);
+    else if (zn->zn_nsec3_count)
+        rb_msg_proof(m, added, &nadded,
+                     rb_nsec3_covering(zn, cut->nd_name_n), ns_t_nsec3);
+    else
+        rb_msg_proof(m, added, &nadded, cut, ns_t_nsec);
+
+    /* glue */
+    for (rr = ns->rs_data; rr; rr = rr->rr_next) {
+        memcpy(target_n, rr->rr_rdata, wire_name_length(rr->rr_rdata));
+        rb_name_lower(target_n);
+        if (NULL == (glue = rb_find(&zn->zn_names, target_n)))
+            continue;
+        if (NULL != (a = rb_data(glue, ns_t_a))) {
+            for (addr = a->rs_data; addr; addr = addr->rr_next)
+                rb_msg_rr(m, RB_AR, glue->nd_name_n, ns_t_a, a->rs_ttl,
+                          addr->rr_rdata, addr->rr_len);
+        }
+        if (NULL != (a = rb_data(glue, ns_t_aaaa))) {
+            for (addr = a->rs_data; addr; addr = addr->rr_next)
+                rb_msg_rr(m, RB_AR, glue->nd_name_n, ns_t_aaaa, a->rs_ttl,
+                          addr->rr_rdata, addr->rr_len);
+        }
+    }
+}
+
+/*
+ * Fill in the sections of the response to (qname_n, type_h); returns
+ * the rcode, and sets *aa for authoritative answers
+ */
+static int
+rb_lookup(struct rb_msg *m, const u_char *qname_n, u_int16_t type_h, int *aa)
+{
+    struct rb_zone *zn, *best = NULL;
+    struct rb_node *nd, *ce = NULL, *wild;
+    struct rb_node *added[3];
+    struct rb_rrset *rs;
+    u_char          wild_n[NS_MAXCDNAME];
+    const u_char   *next_closer = qname_n;
+    int             labels, apex_labels, l, nadded = 0;
+
+    for (zn = rb_zones; zn; zn = zn->zn_next) {
+        if (rb_name_in(qname_n, zn->zn_apex_n) &&
+            (best == NULL || rb_name_labels(zn->zn_apex_n) >
+             rb_name_labels(best->zn_apex_n)))
+            best = zn;
+    }
+    if (best == NULL)
+        return ns_r_refused;
+    zn = best;
+    if (type_h == ns_t_ds && zn->zn_parent &&
+        rb_name_eq(qname_n, zn->zn_apex_n))
+        zn = zn->zn_parent;
+    *aa = 1;
+
+    /* delegations to zones that are not here */
+    labels = rb_name_labels(qname_n);
+    apex_labels = rb_name_labels(zn->zn_apex_n);
+    for (l = apex_labels + 1; l <= labels; l++) {
+        nd = rb_find(&zn->zn_names, rb_name_suffix(qname_n, l));
+        if (nd == NULL)
+            break;
+        if (rb_data(nd, ns_t_ns)) {
+            if (l == labels && type_h == ns_t_ds)
+                break;
+            *aa = 0;
+            rb_referral(m, zn, nd);
+            return ns_r_noerror;
+        }
+    }
+
+    nd = rb_find(&zn->zn_names, qname_n);
+    if (nd && rb_has_data(nd)) {
+        if (NULL != (rs = rb_data(nd, type_h)) ||
+            NULL != (rs = rb_data(nd, ns_t_cname))) {
+            rb_msg_rrset(m, RB_AN, qname_n, rs);
+            return ns_r_noerror;
+        }
+        rb_nodata(m, zn, nd, qname_n);
+        return ns_r_noerror;
+    }
+    if (nd) {
+        /* empty non-terminal */
+        rb_nodata(m, zn, nd, qname_n);
+        return ns_r_noerror;
+    }
+
+    /* the closest encloser, and the next closer name */
+    for (l = labels - 1; l >= apex_labels; l--) {
+        if (NULL != (ce = rb_find(&zn->zn_names,
+                                  rb_name_suffix(qname_n, l)))) {
+            next_closer = rb_name_suffix(qname_n, l + 1);
+            break;
+        }
+    }
+    if (ce == NULL)
+        return ns_r_refused;
+    wild_n[0] = 1;
+    wild_n[1] = '*';
+    memcpy(wild_n + 2, ce->nd_name_n, wire_name_length(ce->nd_name_n));
+    wild = rb_find(&zn->zn_names, wild_n);
+
+    if (wild && rb_has_data(wild)) {
+        if (NULL != (rs = rb_data(wild, type_h)) ||
+            NULL != (rs = rb_data(wild, ns_t_cname))) {
+            rb_msg_rrset(m, RB_AN, qname_n, rs);
+            if (zn->zn_nsec3_count)
+                rb_msg_proof(m, added, &nadded,
+                             rb_nsec3_covering(zn, next_closer), ns_t_nsec3);
+            else
+                rb_msg_proof(m, added, &nadded,
+                             rb_nsec_covering(zn, qname_n), ns_t_nsec);
+            return ns_r_noerror;
+        }
+        rb_msg_soa(m, zn);
+        if (zn->zn_nsec3_count) {
+            rb_msg_proof(m, added, &nadded,
+                         rb_nsec3_covering(zn, ce->nd_name_n), ns_t_nsec3);
+            rb_msg_proof(m, added, &nadded,
+                         rb_nsec3_covering(zn, next_closer), ns_t_nsec3);
+            rb_msg_proof(m, added, &nadded,
+                         rb_nsec3_covering(zn, wild_n), ns_t_nsec3);
+        } else {
+            rb_msg_proof(m, added, &nadded,
+                         rb_nsec_covering(zn, qname_n), ns_t_nsec);
+            rb_msg_proof(m, added, &nadded, wild, ns_t_nsec);
+        }
+        return ns_r_noerror;
+    }
+
+    rb_msg_soa(m, zn);
+    if (zn->zn_nsec3_count) {
+        rb_msg_proof(m, added, &nadded,
+                     rb_nsec3_covering(zn, ce->nd_name_n), ns_t_nsec3);
+        rb_msg_proof(m, added, &nadded,
+                     rb_nsec3_covering(zn, next_closer), ns_t_nsec3);
+        rb_msg_proof(m, added, &nadded,
+                     rb_nsec3_covering(zn, wild_n), ns_t_nsec3);
+    } else {
+        rb_msg_proof(m, added, &nadded,
+                     rb_nsec_covering(zn, qname_n), ns_t_nsec);
+        rb_msg_proof(m, added, &nadded,
+                     rb_nsec_covering(zn, wild_n), ns_t_nsec);
+    }
+    return ns_r_nxdomain;
+}
+
+/*
+ * Build the response to one query.  tcp is set for queries that came
+ * over TCP; UDP responses that do not fit are truncated.  Returns the
+ * length of the response, or 0 to drop the query.
+ */
+static size_t
+rb_answer(const u_char *query, size_t qlen, u_char *resp, int tcp)
+{
+    struct rb_msg   m;
+    u_char          qname_n[NS_MAXCDNAME];
+    const u_char   *cp, *end = query + qlen;
+    u_int16_t       type_h, class_h, flags, count, edns_size = 0;
+    size_t          qname_len, question_len, max;
+    int             i, rcode, aa = 0, has_edns = 0, dnssec = 0;
+
+    if (qlen < NS_HFIXEDSZ + 5 || (query[2] & 0x80))
+        return 0;
+
+    /* the question */
+    cp = query + NS_HFIXEDSZ;
+    for (qname_len = 0; cp + qname_len < end && cp[qname_len];
+         qname_len += cp[qname_len] + 1) {
+        if ((cp[qname_len] & 0xc0) || qname_len > NS_MAXCDNAME)
+            return 0;
+    }
+    qname_len++;
+    if (qname_len > NS_MAXCDNAME || cp + qname_len + 4 > end)
+        return 0;
+    memcpy(qname_n, cp, qname_len);
+    rb_name_lower(qname_n);
+    cp += qname_len;
+    type_h = (cp[0] << 8) | cp[1];
+    class_h = (cp[2] << 8) | cp[3];
+    cp += 4;
+    question_len = cp - (query + NS_HFIXEDSZ);
+
+    /* EDNS0 */
+    count = ((query[6] << 8) | query[7]) + ((query[8] << 8) | query[9]) +
+        ((query[10] << 8) | query[11]);
+    for (i = 0; i < count && cp < end; i++) {
+        u_int16_t       rtype, rdlen;
+        const u_char   *rr = cp;
+
+        while (cp < end && *cp && !(*cp & 0xc0))
+            cp += *cp + 1;
+        cp += (cp < end && (*cp & 0xc0)) ? 2 : 1;
+        if (cp + 10 > end)
+            break;
+        rtype = (cp[0] << 8) | cp[1];
+        rdlen = (cp[8] << 8) | cp[9];
+        if (rtype == ns_t_opt && rr[0] == 0) {
+            has_edns = 1;
+            edns_size = (cp[2] << 8) | cp[3];
+            dnssec = (cp[6] & 0x80) != 0;
+        }
+        cp += 10 + rdlen;
+    }
+
+    max = tcp ? RB_MAX_MSG : (has_edns && edns_size > 512 ? edns_size : 512);
+    if (max > RB_MAX_MSG)
+        max = RB_MAX_MSG;
+
+    memset(&m, 0, sizeof(m));
+    m.m_buf = resp;
+    m.m_max = max - (has_edns ? 11 : 0);
+    m.m_qname_n = qname_n;
+    m.m_dnssec = dnssec;
+
+    memcpy(resp, query, 2);
+    m.m_len = NS_HFIXEDSZ;
+    rb_msg_put(&m, query + NS_HFIXEDSZ, question_len);
+
+    if (((query[2] >> 3) & 0x0f) != ns_o_query ||
+        ((query[4] << 8) | query[5]) != 1)
+        rcode = ns_r_notimpl;
+    else if (class_h != ns_c_in)
+        rcode = ns_r_refused;
+    else
+        rcode = rb_lookup(&m, qname_n, type_h, &aa);
+
+    flags = 0x8000 | (query[2] & 0x01) << 8;   /* QR, RD */
+    if (aa)
+        flags |= 0x0400;
+    if (m.m_overflow) {
+        /* truncated: the question alone */
+        flags |= 0x0200;
+        m.m_overflow = 0;
+        m.m_len = NS_HFIXEDSZ + question_len;
+        memset(m.m_count, 0, sizeof(m.m_count));
+    }
+    flags |= rcode & 0x0f;
+
+    if (has_edns) {
+        m.m_max = max;
+        rb_msg_put(&m, "", 1);
+        rb_msg_int(&m, ns_t_opt, 2);
+        rb_msg_int(&m, 4096, 2);
+        rb_msg_int(&m, dnssec ? 0x8000 : 0, 4);
+        rb_msg_int(&m, 0, 2);
+        m.m_count[RB_AR]++;
+    }
+
+    resp[2] = (u_char) (flags >> 8);
+    resp[3] = (u_char) flags;
+    resp[4] = 0;
+    resp[5] = 1;
+    for (i = 0; i < 3; i++) {
+        resp[6 + 2 * i] = (u_char) (m.m_count[i] >> 8);
+        resp[7 + 2 * i] = (u_char) m.m_count[i];
+    }
+    return m.m_len;
+}
+
+/*
+ * ------------------------------------------------------------------
+ * the server thread
+ * ------------------------------------------------------------------
+ */
+
+static int      rb_udp = -1;
+static int      rb_tcp = -1;
+static int      rb_clients[RB_MAX_CLIENTS];
+static volatile int rb_stop = 0;
+static volatile unsigned long rb_queries = 0;
+#ifdef HAVE_PTHREAD_H
+static pthread_t rb_thread;
+#endif
+static u_char   rb_query_buf[RB_MAX_MSG];
+static u_char   rb_resp_buf[RB_MAX_MSG + 2];
+
+static int
+rb_read_full(int fd, u_char *buf, size_t len)
+{
+    ssize_t         n;
+    size_t          got = 0;
+
+    while (got < len) {
+        n = recv(fd, buf + got, len - got, 0);
+        if (n <= 0)
+            return -1;
+        got += n;
+    }
+    return 0;
+}
+
+static void
+rb_serve_tcp(int i)
+{
+    u_char          len_n[2];
+    size_t          len;
+
+    if (rb_read_full(rb_clients[i], len_n, 2) != 0 ||
+        rb_read_full(rb_clients[i], rb_query_buf,
+                     (len_n[0] << 8) | len_n[1]) != 0) {
+        close(rb_clients[i]);
+        rb_clients[i] = -1;
+        return;
+    }
+    rb_queries++;
+    len = rb_answer(rb_query_buf, (len_n[0] << 8) | len_n[1],
+                    rb_resp_buf + 2, 1);
+    if (len == 0)
+        return;
+    rb_resp_buf[0] = (u_char) (len >> 8);
+    rb_resp_buf[1] = (u_char) len;
+    if (send(rb_clients[i], rb_resp_buf, len + 2, 0) != (ssize_t) len + 2) {
+        close(rb_clients[i]);
+        rb_clients[i] = -1;
+    }
+}
+
+static void    *
+rb_serve(void *arg)
+{
+    struct sockaddr_storage from;
+    socklen_t       from_len;
+    struct timeval  tv;
+    fd_set          fds;
+    ssize_t         n;
+    size_t          len;
+    int             i, max_fd, fd;
+
+    (void) arg;
+    while (!rb_stop) {
+        FD_ZERO(&fds);
+        FD_SET(rb_udp, &fds);
+        FD_SET(rb_tcp, &fds);
+        max_fd = rb_udp > rb_tcp ? rb_udp : rb_tcp;
+        for (i = 0; i < RB_MAX_CLIENTS; i++) {
+            if (rb_clients[i] >= 0) {
+                FD_SET(rb_clients[i], &fds);
+                if (rb_clients[i] > max_fd)
+                    max_fd = rb_clients[i];
+            }
+        }
+        tv.tv_sec = 0;
+        tv.tv_usec = 100000;
+        if (select(max_fd + 1, &fds, NULL, NULL, &tv) <= 0)
+            continue;
+
+        if (FD_ISSET(rb_udp, &fds)) {
+            from_len = sizeof(from);
+            n = recvfrom(rb_udp, rb_query_buf, sizeof(rb_query_buf), 0,
+                         (struct sockaddr *) &from, &from_len);
+            if (n > 0) {
+                rb_queries++;
+                len = rb_answer(rb_query_buf, n, rb_resp_buf, 0);
+                if (len > 0)
+                    sendto(rb_udp, rb_resp_buf, len, 0,
+                           (struct sockaddr *) &from, from_len);
+            }
+        }
+        if (FD_ISSET(rb_tcp, &fds) &&
+            (fd = accept(rb_tcp, NULL, NULL)) >= 0) {
+            for (i = 0; i < RB_MAX_CLIENTS && rb_clients[i] >= 0; i++);
+            if (i < RB_MAX_CLIENTS)
+                rb_clients[i] = fd;
+            else
+                close(fd);
+        }
+        for (i = 0; i < RB_MAX_CLIENTS; i++) {
+            if (rb_clients[i] >= 0 && FD_ISSET(rb_clients[i], &fds))
+                rb_serve_tcp(i);
+        }
+    }
+    return NULL;
+}
+
+static int
+rb_socket(const char *addr, int port, int type)
+{
+    struct sockaddr_in sin;
+    int             fd, on = 1;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons((u_int16_t) port);
+    if (inet_pton(AF_INET, addr, &sin.sin_addr) != 1) {
+        fprintf(stderr, "Bad address %s\n", addr);
+        return -1;
+    }
+    if ((fd = socket(AF_INET, type, 0)) < 0)
+        return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *) &on, sizeof(on));
+    if (bind(fd, (struct sockaddr *) &sin, sizeof(sin)) != 0 ||
+        (type == SOCK_STREAM && listen(fd, RB_MAX_CLIENTS) != 0)) {
+        fprintf(stderr, "Cannot bind %s port %d: %s\n", addr, port,
+                strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int
+rb_server_start(const char *addr, int port)
+{
+#ifdef HAVE_PTHREAD_H
+    int             i;
+
+    rb_link_zones();
+    for (i = 0; i < RB_MAX_CLIENTS; i++)
+        rb_clients[i] = -1;
+    if ((rb_udp = rb_socket(addr, port, SOCK_DGRAM)) < 0)
+        return -1;
+    if ((rb_tcp = rb_socket(addr, port, SOCK_STREAM)) < 0) {
+        close(rb_udp);
+        return -1;
+    }
+    rb_stop = 0;
+    if (pthread_create(&rb_thread, NULL, rb_serve, NULL) != 0) {
+        close(rb_udp);
+        close(rb_tcp);
+        return -1;
+    }
+    return 0;
+#else
+    fprintf(stderr, "The responder needs threads\n");
+    return -1;
+#endif
+}
+
+void
+rb_server_stop(void)
+{
+#ifdef HAVE_PTHREAD_H
+    int             i;
+
+    rb_stop = 1;
+    pthread_join(rb_thread, NULL);
+    for (i = 0; i < RB_MAX_CLIENTS; i++) {
+        if (rb_clients[i] >= 0)
+            close(rb_clients[i]);
+    }
+    close(rb_udp);
+    close(rb_tcp);
+#endif
+}
+
+unsigned long
+rb_server_queries(void)
+{
+    return rb_queries;
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ *
+ * Prints the events in validation traces (the trace option in
+ * dnsval.conf) one per line.  Traces are read from files, from the
+ * standard input, or, with -l, from validators that connect to a unix
+ * socket.
+ */
+
+#include "validator/validator-config.h"
+#include <validator/validator.h>
+#include <validator/resolver.h>
+#include <validator/val_trace.h>
+
+#include <sys/un.h>
+
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#endif
+
+#define	NAME	"trace_dump"
+#define	VERS	"version: 1.0"
+#define	DTVERS	"DNSSEC-Tools Version: 1.8"
+
+void
+usage(char *progname)
+{
+    fprintf(stderr,
+            "Usage: %s [options] [trace-file ...]\n"
+            "       %s -l socket-path\n"
+            "Prints validation trace events, from the given files,\n"
+            "the standard input, or validators connecting to a unix socket.\n",
+            progname, progname);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr,
+            "\t-h               display usage and exit\n"
+            "\t-l <path>        listen on unix socket <path>\n"
+            "\t-V               display version and exit\n");
+}
+
+void
+version(void)
+{
+    fprintf(stderr, "%s: %s\n", NAME, VERS);
+    fprintf(stderr, "%s\n", DTVERS);
+}
+
+static void
+print_event(struct val_trace_event *ev)
+{
+    char            name_p[NS_MAXDNAME];
+    char            server[INET6_ADDRSTRLEN + 1];
+
+    if (ns_name_ntop(ev->te_name_n, name_p, sizeof(name_p)) == -1)
+        strcpy(name_p, "unknown/error");
+
+    printf("%lu.%06lu %-8s %6u %s %s %s",
+           (unsigned long) ev->te_time.tv_sec,
+           (unsigned long) ev->te_time.tv_usec,
+           p_trace_event(ev->te_event), ev->te_id, name_p,
+           p_class(ev->te_class), p_type(ev->te_type));
+
+    server[0] = '\0';
+    if (ev->te_server.ss_family != 0)
+        val_get_ns_string((struct sockaddr *) &ev->te_server,
+                          server, sizeof(server));
+
+    switch (ev->te_event) {
+    case VAL_TRACE_QUERY:
+        printf(" server=%s", server[0] ? server : "-");
+        break;
+    case VAL_TRACE_RESPONSE:
+        printf(" server=%s rcode=%u len=%u", server[0] ? server : "-",
+               ev->te_rcode, ev->te_msglen);
+        break;
+    case VAL_TRACE_RRSIG:
+        printf(" alg=%u tag=%u %s", ev->te_algorithm, ev->te_keytag,
+               p_ac_status(ev->te_status));
+        break;
+    case VAL_TRACE_LINK:
+        printf(" %s", p_ac_status(ev->te_status));
+        break;
+    case VAL_TRACE_RESULT:
+        printf(" %s", p_val_status(ev->te_status));
+        break;
+    }
+    printf("\n");
+}
+
+/*
+ * Print a whole trace, returning 0 if it was read to the end
+ */
+static int
+dump(val_trace_reader_t *reader, const char *what)
+{
+    struct val_trace_event ev;
+    int             ret;
+
+    while ((ret = val_trace_read(reader, &ev)) == 1)
+        print_event(&ev);
+    fflush(stdout);
+    if (ret < 0) {
+        fprintf(stderr, "%s: trace damaged or unreadable\n", what);
+        return 1;
+    }
+    return 0;
+}
+
+static int
+listen_on(const char *path)
+{
+    struct sockaddr_un sun;
+    val_trace_reader_t *reader;
+    int             s, fd;
+
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+        fprintf(stderr, "%s: path too long\n", path);
+        return 1;
+    }
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+    unlink(path);
+    if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+        bind(s, (struct sockaddr *) &sun, sizeof(sun)) == -1 ||
+        listen(s, 5) == -1) {
+        perror(path);
+        return 1;
+    }
+
+    /*
+     * One validator at a time; the others wait in the backlog
+     */
+    for (;;) {
+        if ((fd = accept(s, NULL, NULL)) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("accept");
+            return 1;
+        }
+        if ((reader = val_trace_reader_fdopen(fd)) != NULL) {
+            dump(reader, path);
+            val_trace_reader_close(reader);
+        }
+        close(fd);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    val_trace_reader_t *reader;
+    char           *listen_path = NULL;
+    int             i, bad = 0;
+
+    while (1) {
+        int c = getopt(argc, argv, "hl:V");
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'h':
+            usage(argv[0]);
+            return -1;
+        case 'l':
+            listen_path = optarg;
+            break;
+        case 'V':
+            version();
+            return 0;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (listen_path)
+        return listen_on(listen_path);
+
+    if (optind == argc) {
+        if ((reader = val_trace_reader_fdopen(0)) == NULL)
+            return 1;
+        bad = dump(reader, "stdin");
+        val_trace_reader_close(reader);
+        return bad;
+    }
+
+    for (i = optind; i < argc; i++) {
+        if ((reader = val_trace_reader_open(argv[i])) == NULL) {
+            perror(argv[i]);
+            bad = 1;
+            continue;
+        }
+        bad |= dump(reader, argv[i]);
+        val_trace_reader_close(reader);
+    }
+    return bad;
+}
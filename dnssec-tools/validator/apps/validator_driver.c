@@ -29,6 +29,8 @@
 
 #define BUFLEN 16000
 
+#define LOAD_DEFAULT_DURATION 10
+
 int             MAX_RESPCOUNT = 10;
 int             MAX_RESPSIZE = 8192;
 
@@ -57,6 +59,10 @@ static struct option prog_options[] = {
     {"root-hints", 1, 0, 'i'},
     {"wait", 1, 0, 'w'},
     {"inflight", 1, 0, 'I'},
+    {"spans", 0, 0, 'P'},
+    {"load", 1, 0, 'L'},
+    {"qps", 1, 0, 'q'},
+    {"duration", 1, 0, 'D'},
     {"Version", 1, 0, 'V'},
     {0, 0, 0, 0}
 };
@@ -139,7 +145,7 @@ check_results(val_context_t * context, const char *desc, char * name,
     if (result_array[0]) {
         for (res = results; res; res = res->val_rc_next) {
             for (i = 0; result_array[i] != 0; i++) {
-                if (res->val_rc_status != result_array[i])
+                if (VAL_BASE_STATUS(res->val_rc_status) != result_array[i])
                     continue;
                 /* Mark this as done */
                 if (trusted_only && !val_istrusted(res->val_rc_status))
@@ -285,6 +291,9 @@ usage(char *progname)
     printf("        -I, --inflight=<number> Maximum number of simultaneous queries\n");
     printf("        -m, --multi-thread=<number> Maximum number of simultaneous threads\n");
     printf("        -w, --wait=<secs> Run tests in a loop, sleeping for specifed seconds between runs\n");
+    printf("        -L, --load=<file>      Generate load from the queries (name [type] [class]) in a file\n");
+    printf("        -q, --qps=<number>     Target requests per second for -L (default as fast as possible)\n");
+    printf("        -D, --duration=<secs>  Length of the -L run (default %d)\n", LOAD_DEFAULT_DURATION);
     printf("        -l, --label=<label-string> Specifies the policy to use during validation\n");
     printf("        -o, --output=<debug-level>:<dest-type>[:<dest-options>]\n");
     printf("              <debug-level> is 1-7, corresponding to syslog levels ALERT-DEBUG\n");
@@ -294,6 +303,7 @@ usage(char *progname)
     printf("                  net[:<host-name>:<host-port>] (127.0.0.1:1053\n");
     printf("                  syslog[:facility] (0-23 (default 1 USER))\n");
     printf("        -n, --no-dnssec        Don't do DNSSEC, just DNS\n");
+    printf("        -P, --spans            Print the latency span of each request (JSON) on stderr\n");
     printf("        -V, --Version          Display version and exit\n");
     printf("Advanced Options:\n");
     printf("\nThe DOMAIN_NAME parameter is not required for the -h option.\n");
@@ -302,6 +312,23 @@ usage(char *progname)
     /* *INDENT-ON* */
 }
 
+/*
+ * Span callback: one line of JSON per request
+ */
+static void
+print_span(val_context_t *ctx, const struct val_span *span, void *cb_data)
+{
+    size_t          len;
+    char           *buf;
+
+    len = val_span_json(span, NULL, 0);
+    if (NULL == (buf = (char *) malloc(len + 1)))
+        return;
+    val_span_json(span, buf, len + 1);
+    fprintf((FILE *) cb_data, "%s\n", buf);
+    free(buf);
+}
+
 void
 version(void)
 {
@@ -709,7 +736,7 @@ main(int argc, char *argv[])
     // Parse the command line for a query and resolve+validate it
     int             c;
     char           *domain_name = NULL;
-    const char     *args = "c:dF:hi:I:l:m:nw:o:pr:S:st:T:v:V";
+    const char     *args = "c:dD:F:hi:I:l:L:m:nw:o:pPq:r:S:st:T:v:V";
     int            class_h = ns_c_in;
     int            type_h = ns_t_a;
     int             success = 0;
@@ -718,6 +745,10 @@ main(int argc, char *argv[])
     int             num_threads = 0;
     int             max_in_flight = 1;
     int             daemon = 0;
+    int             spans = 0;
+    char           *load_file = NULL;
+    int             qps = 0;
+    int             duration = LOAD_DEFAULT_DURATION;
     //u_int32_t       flags = VAL_QUERY_AC_DETAIL|VAL_QUERY_NO_EDNS0_FALLBACK|VAL_QUERY_SKIP_CACHE;
     u_int32_t       flags = VAL_QUERY_AC_DETAIL;
     u_int32_t       nodnssec_flag = 0;
@@ -798,6 +829,22 @@ main(int argc, char *argv[])
             nodnssec_flag = 1;
             break;
 
+        case 'P':
+            spans = 1;
+            break;
+
+        case 'L':
+            load_file = optarg;
+            break;
+
+        case 'q':
+            qps = strtol(optarg, &nextarg, 10);
+            break;
+
+        case 'D':
+            duration = strtol(optarg, &nextarg, 10);
+            break;
+
         case 'c':
             // optarg is a global variable.  See man page for getopt_long(3).
             class_h = res_nametoclass(optarg, &success);
@@ -906,6 +953,17 @@ main(int argc, char *argv[])
                               VAL_QUERY_DONT_VALIDATE);
     }
 
+    /* spans would slow down a load run; -P is ignored there */
+    if (spans && !load_file)
+        val_context_set_span_cb(context, print_span, stderr);
+
+    if (load_file) {
+        /* the authentication chain is not printed in load mode */
+        rc = load_test(context, load_file, flags & ~VAL_QUERY_AC_DETAIL,
+                       qps, duration, max_in_flight, num_threads);
+        goto done;
+    }
+
     // optind is a global variable.  See man page for getopt_long(3)
     if (optind >= argc) {
         if (!selftest && (tcs == -1)) {
@@ -17,6 +17,9 @@ int self_test(val_context_t *context, int tcs, int tce, u_int32_t flags,
               const char *tests, const char *suites, int doprint,
               int max_in_flight);
 
+int load_test(val_context_t *context, const char *file, u_int32_t flags,
+              int qps, int duration, int max_in_flight, int num_threads);
+
 int check_results(val_context_t * context, const char *desc, char * name,
                   const u_int16_t class_h, const u_int16_t type_h,
                   const int *result_ar, struct val_result_chain *results,
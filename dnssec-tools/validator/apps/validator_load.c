@@ -0,0 +1,642 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+
+/*
+ * Load generator for dt-validate
+ *
+ * Replays the queries in a file, round robin, for a fixed time, either
+ * as fast as the allowed concurrency permits or at a target rate.
+ * Requests are driven with val_async_submit(), or with
+ * val_resolve_and_check() from a number of threads.  The report gives
+ * the throughput, latency percentiles, the cache hit ratio and a count
+ * of results by validation status.  The cache figures are taken from
+ * the change in the library's statistics over the run; a request
+ * counts as a cache hit if it sent no query.
+ *
+ * example query file:
+ *
+ * # name [type] [class]
+ * www.dnssec-tools.org
+ * dnssec-tools.org MX
+ * dnssec-tools.org DNSKEY IN
+ */
+
+#include "validator/validator-config.h"
+#include <validator/validator.h>
+#include <validator/resolver.h>
+#include "validator_driver.h"
+
+#define LOAD_MAX_ERRORS  32
+
+typedef struct loadquery_st {
+    char               *qn; /* name */
+    int                 qc; /* class */
+    int                 qt; /* type */
+} loadquery;
+
+/*
+ * What one thread (or the async loop) saw
+ */
+typedef struct loadstats_st {
+    u_int32_t          *lat;        /* microseconds */
+    int                 nlat;
+    int                 alat;
+    int                 submitted;
+    int                 completed;
+    int                 no_result;
+    int                 status[256];            /* by val_status_t */
+    int                 err[LOAD_MAX_ERRORS];   /* by retval */
+    int                 err_count[LOAD_MAX_ERRORS];
+    int                 nerr;
+} loadstats;
+
+/*
+ * The shared schedule: which query is next, and when it is due
+ */
+typedef struct loadplan_st {
+    val_context_t      *ctx;
+    loadquery          *queries;
+    int                 count;
+    u_int32_t           flags;
+    int                 qps;        /* 0: as fast as possible */
+    int                 next;
+    struct timeval      start;
+    struct timeval      end;
+#if defined(HAVE_PTHREAD_H) && !defined(VAL_NO_THREADS)
+    pthread_mutex_t     lock;
+#endif
+} loadplan;
+
+#ifndef VAL_NO_ASYNC
+typedef struct load_cbd_st {
+    loadstats          *ls;
+    int                *in_flight;
+    struct timeval      due;
+} load_cbd;
+#endif
+
+static void
+free_queries(loadquery *queries, int count)
+{
+    int             i;
+
+    for (i = 0; i < count; i++)
+        free(queries[i].qn);
+    free(queries);
+}
+
+/*
+ * Read "name [type] [class]" lines; '#' starts a comment.  The fields
+ * are taken by position, since some mnemonics (e.g. ANY) are both a
+ * type and a class.
+ */
+static int
+read_load_file(const char *file, loadquery **queries, int *count)
+{
+    FILE           *fp;
+    char            line[1024], *tok[4], *cp, *last;
+    int             ntok, alloc = 0, lineno = 0, i, success, val;
+    loadquery      *q;
+
+    *queries = NULL;
+    *count = 0;
+    if (NULL == (fp = fopen(file, "r"))) {
+        fprintf(stderr, "Cannot open %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        ++lineno;
+        if (NULL != (cp = strchr(line, '#')))
+            *cp = '\0';
+        ntok = 0;
+        for (cp = strtok_r(line, " \t\r\n", &last); cp && ntok < 4;
+             cp = strtok_r(NULL, " \t\r\n", &last))
+            tok[ntok++] = cp;
+        if (ntok == 0)
+            continue;
+        if (ntok > 3) {
+            fprintf(stderr, "%s:%d: too many fields\n", file, lineno);
+            goto err;
+        }
+
+        if (*count >= alloc) {
+            alloc = alloc ? alloc * 2 : 256;
+            q = (loadquery *) realloc(*queries, alloc * sizeof(loadquery));
+            if (q == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                goto err;
+            }
+            *queries = q;
+        }
+        q = &(*queries)[*count];
+        q->qc = ns_c_in;
+        q->qt = ns_t_a;
+        if (ntok > 1) {
+            val = res_nametotype(tok[1], &success);
+            if (!success) {
+                fprintf(stderr, "%s:%d: unrecognized type %s\n",
+                        file, lineno, tok[1]);
+                goto err;
+            }
+            q->qt = val;
+        }
+        if (ntok > 2) {
+            val = res_nametoclass(tok[2], &success);
+            if (!success) {
+                fprintf(stderr, "%s:%d: unrecognized class %s\n",
+                        file, lineno, tok[2]);
+                goto err;
+            }
+            q->qc = val;
+        }
+        if (NULL == (q->qn = strdup(tok[0]))) {
+            fprintf(stderr, "Out of memory\n");
+            goto err;
+        }
+        ++(*count);
+    }
+    fclose(fp);
+
+    if (*count == 0) {
+        fprintf(stderr, "%s: no queries\n", file);
+        return -1;
+    }
+    return 0;
+
+  err:
+    fclose(fp);
+    free_queries(*queries, *count);
+    *queries = NULL;
+    *count = 0;
+    return -1;
+}
+
+/*
+ * The next request, and the time it is due.  Returns -1 once the
+ * duration is over.
+ */
+static int
+next_request(loadplan *lp, struct timeval *due)
+{
+    struct timeval  now, offset;
+    long long       us;
+    int             n;
+
+#if defined(HAVE_PTHREAD_H) && !defined(VAL_NO_THREADS)
+    pthread_mutex_lock(&lp->lock);
+#endif
+    n = lp->next++;
+#if defined(HAVE_PTHREAD_H) && !defined(VAL_NO_THREADS)
+    pthread_mutex_unlock(&lp->lock);
+#endif
+
+    gettimeofday(&now, NULL);
+    if (lp->qps > 0) {
+        /* computed from the start, so that rounding does not add up */
+        us = (long long) n * 1000000 / lp->qps;
+        offset.tv_sec = (long) (us / 1000000);
+        offset.tv_usec = (long) (us % 1000000);
+        timeradd(&lp->start, &offset, due);
+    } else
+        *due = now;
+
+    if (!timercmp(due, &lp->end, <))
+        return -1;
+    return n % lp->count;
+}
+
+static void
+record_latency(loadstats *ls, struct timeval *due)
+{
+    struct timeval  now, lat;
+    u_int32_t      *l;
+    int             alloc;
+
+    gettimeofday(&now, NULL);
+    if (timercmp(&now, due, <))
+        timerclear(&lat);
+    else
+        timersub(&now, due, &lat);
+
+    if (ls->nlat >= ls->alat) {
+        alloc = ls->alat ? ls->alat * 2 : 4096;
+        l = (u_int32_t *) realloc(ls->lat, alloc * sizeof(u_int32_t));
+        if (l == NULL)
+            return;
+        ls->lat = l;
+        ls->alat = alloc;
+    }
+    ls->lat[ls->nlat++] = (u_int32_t) (lat.tv_sec * 1000000 + lat.tv_usec);
+}
+
+static void
+record_error(loadstats *ls, int retval)
+{
+    int             i;
+
+    for (i = 0; i < ls->nerr; i++) {
+        if (ls->err[i] == retval)
+            break;
+    }
+    if (i == ls->nerr) {
+        if (ls->nerr == LOAD_MAX_ERRORS)
+            return;
+        ls->err[ls->nerr] = retval;
+        ls->err_count[ls->nerr++] = 0;
+    }
+    ++ls->err_count[i];
+}
+
+static void
+record_results(loadstats *ls, int retval, struct val_result_chain *results)
+{
+    struct val_result_chain *res;
+
+    ++ls->completed;
+    if (retval != VAL_NO_ERROR) {
+        record_error(ls, retval);
+        return;
+    }
+    if (results == NULL)
+        ++ls->no_result;
+    for (res = results; res; res = res->val_rc_next)
+        ++ls->status[res->val_rc_status];
+}
+
+/*
+ * Wait until the request is due
+ */
+static void
+wait_until(struct timeval *due)
+{
+    struct timeval  now, tv;
+
+    gettimeofday(&now, NULL);
+    if (!timercmp(&now, due, <))
+        return;
+    timersub(due, &now, &tv);
+    select(0, NULL, NULL, NULL, &tv);
+}
+
+/*
+ * Synchronous requests, one at a time; run by each load thread
+ */
+static void
+run_load_sync(loadplan *lp, loadstats *ls)
+{
+    struct val_result_chain *results;
+    struct timeval  due;
+    loadquery      *q;
+    int             n, rc;
+
+    while ((n = next_request(lp, &due)) >= 0) {
+        q = &lp->queries[n];
+        wait_until(&due);
+        results = NULL;
+        ++ls->submitted;
+        rc = val_resolve_and_check(lp->ctx, q->qn, q->qc, q->qt, lp->flags,
+                                   &results);
+        record_latency(ls, &due);
+        record_results(ls, rc, results);
+        val_free_result_chain(results);
+    }
+}
+
+#if defined(HAVE_PTHREAD_H) && !defined(VAL_NO_THREADS)
+typedef struct loadthread_st {
+    loadplan           *lp;
+    loadstats           ls;
+} loadthread;
+
+static void *
+load_thread(void *param)
+{
+    loadthread     *lt = (loadthread *) param;
+
+    run_load_sync(lt->lp, &lt->ls);
+    return NULL;
+}
+#endif
+
+#ifndef VAL_NO_ASYNC
+static int
+load_async_callback(val_async_status *as, int event, val_context_t *ctx,
+                    void *cb_data, val_cb_params_t *cbp)
+{
+    load_cbd       *cbd = (load_cbd *) cb_data;
+
+    if (cbd == NULL || cbp == NULL)
+        return VAL_BAD_ARGUMENT;
+
+    --(*cbd->in_flight);
+    record_latency(cbd->ls, &cbd->due);
+    record_results(cbd->ls, cbp->retval, cbp->results);
+
+    val_free_result_chain(cbp->results);
+    cbp->results = NULL;
+    if (cbp->answers) {
+        val_free_answer_chain(cbp->answers);
+        cbp->answers = NULL;
+    }
+    free(cbd);
+
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Keep up to max_in_flight requests outstanding, submitting each one
+ * when it is due
+ */
+static void
+run_load_async(loadplan *lp, loadstats *ls, int max_in_flight)
+{
+    val_async_status *as;
+    struct timeval  now, tv, due;
+    load_cbd       *cbd;
+    loadquery      *q;
+    int             n = 0, in_flight = 0, rc;
+    int             have_next = 0, sending = 1;
+
+    while (sending || in_flight) {
+        gettimeofday(&now, NULL);
+
+        /** submit whatever is due */
+        while (sending && in_flight < max_in_flight) {
+            if (!have_next) {
+                if ((n = next_request(lp, &due)) < 0) {
+                    sending = 0;
+                    break;
+                }
+                have_next = 1;
+            }
+            if (timercmp(&now, &due, <))
+                break;
+            have_next = 0;
+
+            q = &lp->queries[n];
+            ++ls->submitted;
+            cbd = (load_cbd *) malloc(sizeof(load_cbd));
+            if (cbd == NULL) {
+                record_latency(ls, &due);
+                record_results(ls, VAL_OUT_OF_MEMORY, NULL);
+                continue;
+            }
+            cbd->ls = ls;
+            cbd->in_flight = &in_flight;
+            cbd->due = due;
+            ++in_flight;
+            rc = val_async_submit(lp->ctx, q->qn, q->qc, q->qt, lp->flags,
+                                  &load_async_callback, cbd, &as);
+            if (rc != VAL_NO_ERROR || as == NULL) {
+                --in_flight;
+                free(cbd);
+                record_latency(ls, &due);
+                record_results(ls, rc != VAL_NO_ERROR ? rc :
+                               VAL_INTERNAL_ERROR, NULL);
+            }
+        }
+        if (!sending && in_flight == 0)
+            break;
+
+        /** wait for answers, or until the next request is due */
+        tv.tv_sec = 0;
+        tv.tv_usec = 100000;
+        if (have_next && in_flight < max_in_flight) {
+            gettimeofday(&now, NULL);
+            if (!timercmp(&now, &due, <))
+                timerclear(&tv);
+            else {
+                timersub(&due, &now, &tv);
+                if (tv.tv_sec > 0 || tv.tv_usec > 100000) {
+                    tv.tv_sec = 0;
+                    tv.tv_usec = 100000;
+                }
+            }
+        }
+        if (in_flight == 0) {
+            select(0, NULL, NULL, NULL, &tv);
+            continue;
+        }
+        rc = val_async_check_wait(lp->ctx, NULL, NULL, &tv, 0);
+        if (rc < 0 || (rc == 0 && in_flight)) {
+            /* requests that will never complete */
+            fprintf(stderr, "%d requests lost: %s\n", in_flight,
+                    rc < 0 ? p_val_err(rc) : "no longer pending");
+            while (in_flight) {
+                record_results(ls, rc < 0 ? rc : VAL_INTERNAL_ERROR, NULL);
+                --in_flight;
+            }
+        }
+    }
+}
+#endif /* ndef VAL_NO_ASYNC */
+
+static void
+merge_stats(loadstats *to, loadstats *from)
+{
+    u_int32_t      *l;
+    int             i;
+
+    if (from->nlat) {
+        l = (u_int32_t *) realloc(to->lat, (to->nlat + from->nlat) *
+                                  sizeof(u_int32_t));
+        if (l != NULL) {
+            memcpy(l + to->nlat, from->lat, from->nlat * sizeof(u_int32_t));
+            to->lat = l;
+            to->nlat += from->nlat;
+            to->alat = to->nlat;
+        }
+    }
+    to->submitted += from->submitted;
+    to->completed += from->completed;
+    to->no_result += from->no_result;
+    for (i = 0; i < 256; i++)
+        to->status[i] += from->status[i];
+    for (i = 0; i < from->nerr; i++) {
+        int             j;
+
+        for (j = 0; j < from->err_count[i]; j++)
+            record_error(to, from->err[i]);
+    }
+    free(from->lat);
+    from->lat = NULL;
+}
+
+static int
+cmp_u32(const void *a, const void *b)
+{
+    u_int32_t       x = *(const u_int32_t *) a, y = *(const u_int32_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Nearest-rank percentile, in milliseconds; pct is in tenths
+ */
+static double
+percentile(loadstats *ls, int pct)
+{
+    long            rank = ((long) pct * ls->nlat + 999) / 1000;
+
+    if (ls->nlat == 0)
+        return 0.0;
+    if (rank < 1)
+        rank = 1;
+    return ls->lat[rank - 1] / 1000.0;
+}
+
+static void
+print_report(loadstats *ls, double elapsed, int qps, int duration,
+             struct res_stats *before, struct res_stats *after)
+{
+    u_int64_t       cached, hits, misses, queries;
+    int             i;
+
+    printf("Requests: %d completed of %d sent in %.2f s, %.1f requests/s",
+           ls->completed, ls->submitted, elapsed,
+           elapsed > 0 ? ls->completed / elapsed : 0.0);
+    if (qps > 0)
+        printf(" (target %d/s, offered %.1f/s)", qps,
+               (double) ls->submitted / duration);
+    printf("\n");
+
+    qsort(ls->lat, ls->nlat, sizeof(u_int32_t), cmp_u32);
+    printf("Latency (ms): min %.3f, p50 %.3f, p90 %.3f, p99 %.3f, "
+           "p99.9 %.3f, max %.3f\n",
+           ls->nlat ? ls->lat[0] / 1000.0 : 0.0, percentile(ls, 500),
+           percentile(ls, 900), percentile(ls, 990), percentile(ls, 999),
+           ls->nlat ? ls->lat[ls->nlat - 1] / 1000.0 : 0.0);
+
+    hits = after->rs_counter[RES_STAT_CACHE_HITS] -
+        before->rs_counter[RES_STAT_CACHE_HITS] +
+        after->rs_counter[RES_STAT_CACHE_SHARED_HITS] -
+        before->rs_counter[RES_STAT_CACHE_SHARED_HITS];
+    misses = after->rs_counter[RES_STAT_CACHE_MISSES] -
+        before->rs_counter[RES_STAT_CACHE_MISSES];
+    queries = after->rs_counter[RES_STAT_UDP_QUERIES] -
+        before->rs_counter[RES_STAT_UDP_QUERIES] +
+        after->rs_counter[RES_STAT_TCP_QUERIES] -
+        before->rs_counter[RES_STAT_TCP_QUERIES];
+    cached = after->rs_counter[RES_STAT_REQUESTS_CACHED] -
+        before->rs_counter[RES_STAT_REQUESTS_CACHED];
+    printf("Cache: %llu requests answered from cache (%.1f%% hit ratio), "
+           "%.2f upstream queries/request\n", (unsigned long long) cached,
+           ls->completed ? 100.0 * cached / ls->completed : 0.0,
+           ls->completed ? (double) queries / ls->completed : 0.0);
+    printf("RRset cache: %llu hits, %llu misses\n",
+           (unsigned long long) hits, (unsigned long long) misses);
+
+    printf("Results by status (one per result chain entry):\n");
+    for (i = 0; i < 256; i++) {
+        if (ls->status[i])
+            printf("    %-32s %d\n", p_val_status((val_status_t) i),
+                   ls->status[i]);
+    }
+    if (ls->no_result)
+        printf("    %-32s %d\n", "(no result)", ls->no_result);
+    if (ls->nerr) {
+        printf("Errors:\n");
+        for (i = 0; i < ls->nerr; i++)
+            printf("    %-32s %d\n", p_val_err(ls->err[i]),
+                   ls->err_count[i]);
+    }
+}
+
+/*
+ * Run the queries in file against context for duration seconds.
+ * With num_threads > 0, each thread calls val_resolve_and_check();
+ * otherwise up to max_in_flight requests are kept outstanding with
+ * val_async_submit().  With qps > 0, requests are sent at that rate,
+ * and latencies are measured from the time each request was due, so
+ * that falling behind the target rate shows up in the percentiles.
+ */
+int
+load_test(val_context_t *context, const char *file, u_int32_t flags,
+          int qps, int duration, int max_in_flight, int num_threads)
+{
+    loadplan        plan;
+    loadstats       stats;
+    struct res_stats before, after;
+    struct timeval  now, offset;
+    double          elapsed;
+    int             rc = -1;
+
+    if (NULL == file || duration <= 0 || qps < 0)
+        return -1;
+
+    memset(&plan, 0, sizeof(plan));
+    memset(&stats, 0, sizeof(stats));
+    if (0 != read_load_file(file, &plan.queries, &plan.count))
+        return -1;
+    plan.ctx = context;
+    plan.flags = flags;
+    plan.qps = qps;
+    if (max_in_flight < 1)
+        max_in_flight = 1;
+#if defined(HAVE_PTHREAD_H) && !defined(VAL_NO_THREADS)
+    pthread_mutex_init(&plan.lock, NULL);
+#endif
+
+    val_get_stats(&before);
+    gettimeofday(&plan.start, NULL);
+    offset.tv_sec = duration;
+    offset.tv_usec = 0;
+    timeradd(&plan.start, &offset, &plan.end);
+
+    if (num_threads > 0) {
+#if defined(HAVE_PTHREAD_H) && !defined(VAL_NO_THREADS)
+        loadthread     *lt;
+        pthread_t      *tids;
+        int             i, started = 0;
+
+        lt = (loadthread *) calloc(num_threads, sizeof(loadthread));
+        tids = (pthread_t *) calloc(num_threads, sizeof(pthread_t));
+        if (lt == NULL || tids == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            free(lt);
+            free(tids);
+            goto done;
+        }
+        for (i = 0; i < num_threads; i++) {
+            lt[i].lp = &plan;
+            if (0 != pthread_create(&tids[i], NULL, load_thread, &lt[i]))
+                break;
+            ++started;
+        }
+        for (i = 0; i < started; i++) {
+            pthread_join(tids[i], NULL);
+            merge_stats(&stats, &lt[i].ls);
+        }
+        free(lt);
+        free(tids);
+#else
+        fprintf(stderr, "Thread support not available\n");
+        goto done;
+#endif
+    } else {
+#ifndef VAL_NO_ASYNC
+        run_load_async(&plan, &stats, max_in_flight);
+#else
+        run_load_sync(&plan, &stats);
+#endif
+    }
+
+    gettimeofday(&now, NULL);
+    val_get_stats(&after);
+    timersub(&now, &plan.start, &offset);
+    elapsed = offset.tv_sec + offset.tv_usec / 1000000.0;
+
+    print_report(&stats, elapsed, qps, duration, &before, &after);
+    rc = (stats.nerr > 0);
+
+  done:
+#if defined(HAVE_PTHREAD_H) && !defined(VAL_NO_THREADS)
+    pthread_mutex_destroy(&plan.lock);
+#endif
+    free(stats.lat);
+    free_queries(plan.queries, plan.count);
+    return rc;
+}
@@ -24,11 +24,20 @@ extern          "C" {
 #define VAL_LOG_OPTIONS LOG_PID
 #define VALIDATOR_LOG_PORT 1053
 #define VALIDATOR_LOG_SERVER "127.0.0.1"
+#define VAL_LOG_ASYNC_SLOTS 1024        /* default async log ring size */
+#define VAL_LOG_ASYNC_MAX_SLOTS 65536
 #define VAL_DEFAULT_RESOLV_CONF "/etc/resolv.conf"
 #define VAL_CONTEXT_LABEL "VAL_CONTEXT_LABEL"
 #define VAL_LOG_TARGET "VAL_LOG_TARGET"
 #define QUERY_BAD_CACHE_THRESHOLD 5
 #define QUERY_BAD_CACHE_TTL 60
+#define QUERY_PREFETCH_MAX_PENDING 64   /* queued background refreshes */
+#define QUERY_CHAIN_PREFETCH_DEPTH 8     /* max ancestors fetched ahead */
+#define QUERY_MIRROR_MAX_REFERRALS 16    /* max local zone copy hops per query */
+#define VAL_STALE_TTL 30                /* ttl of stale answers, RFC 8767 */
+#define VAL_STALE_MAX_ENTRIES 4096      /* stale answers kept per context */
+#define SERVER_CAP_CACHE_TTL 900        /* remember edns0/tcp behavior */
+#define SERVER_BAD_CACHE_TTL 60         /* remember lame/unreachable servers */
 #define MAX_ALIAS_CHAIN_LENGTH 10       /* max length of cname/dname chain */
 #define MAX_GLUE_FETCH_DEPTH 10         /* max length of glue dependency chain */
 #define IPADDR_STRING_MAX 128
@@ -44,6 +53,26 @@ extern          "C" {
 #define LOG_DEBUG VAL_LOG_DEBUG 
 #endif
 
+/*
+ * USDT probes (provider "dnsval") for perf, bpftrace and SystemTap;
+ * see apps/bpftrace/README.  A probe is a single nop until a tracer
+ * attaches to it, but its arguments are still computed, so keep them
+ * cheap.
+ */
+#if defined(HAVE_SYS_SDT_H) && !defined(VAL_NO_USDT)
+#include <sys/sdt.h>
+#define VAL_PROBE2(name, a, b) DTRACE_PROBE2(dnsval, name, a, b)
+#define VAL_PROBE3(name, a, b, c) DTRACE_PROBE3(dnsval, name, a, b, c)
+#define VAL_PROBE4(name, a, b, c, d) DTRACE_PROBE4(dnsval, name, a, b, c, d)
+#define VAL_PROBE5(name, a, b, c, d, e) \
+    DTRACE_PROBE5(dnsval, name, a, b, c, d, e)
+#else
+#define VAL_PROBE2(name, a, b)
+#define VAL_PROBE3(name, a, b, c)
+#define VAL_PROBE4(name, a, b, c, d)
+#define VAL_PROBE5(name, a, b, c, d, e)
+#endif
+
 /*
  * Query states 
  *
@@ -109,6 +138,7 @@ extern          "C" {
 
 #define SIGNBY              18
 #define ENVELOPE            10
+#define RRSIGALGO            2
 #define RRSIGLABEL           3
 #define TTL                  4
 #define VAL_CTX_IDLEN       20
@@ -210,15 +240,19 @@ extern          "C" {
         ((type == ns_t_rrsig || type == ns_t_dnskey || type == ns_t_ds))
 #endif
 
+    /*
+     * Names held as u_char * in the structures below are
+     * interned, see val_names.c
+     */
     struct query_list {
-        u_char        ql_name_n[NS_MAXCDNAME];
-        u_char        ql_zone_n[NS_MAXCDNAME];
+        u_char       *ql_name_n;
+        u_char       *ql_zone_n;
         u_int16_t     ql_type_h;
         struct query_list *ql_next;
     };
 
     struct qname_chain {
-        u_char        qnc_name_n[NS_MAXCDNAME];
+        u_char       *qnc_name_n;
         struct qname_chain *qnc_next;
     };
 
@@ -234,6 +268,24 @@ extern          "C" {
         struct rrset_rec *learned_zones;
     };
 
+#define VAL_STALE_BUCKETS 256
+
+    /*
+     * Last trusted answer for a query, kept around
+     * for serve-stale
+     */
+    struct val_stale_answer {
+        u_char          sa_name_n[NS_MAXCDNAME];
+        u_int16_t       sa_type_h;
+        u_int16_t       sa_class_h;
+        u_int32_t       sa_flags;
+        u_int32_t       sa_ttl_x;
+        struct val_result_chain *sa_results;
+        struct val_stale_answer *sa_next;
+        struct val_stale_answer *sa_older;  /* by time stored, for */
+        struct val_stale_answer *sa_newer;  /*   eviction */
+    };
+
     struct val_query_chain {
         /*
          * The refcount is to ensure that
@@ -241,8 +293,8 @@ extern          "C" {
          * they are still being accessed by some thread 
          */
         int             qc_refcount;
-        u_char          qc_name_n[NS_MAXCDNAME];
-        u_char          qc_original_name[NS_MAXCDNAME];
+        u_char         *qc_name_n;
+        u_char         *qc_original_name;
         u_int16_t       qc_type_h;
         u_int16_t       qc_class_h;
 
@@ -259,6 +311,11 @@ extern          "C" {
         unsigned long qc_respondent_server_options;
         int    qc_trans_id;             //  synchronous queries only
         long   qc_last_sent;            //  last time the query was sent
+        long   qc_created;              //  time this cache entry was added
+        u_int32_t qc_hits;              //  cache hits, for prefetch
+        int    qc_prefetch;             //  background refresh scheduled
+        size_t qc_chain_prefetched;     //  zonecut length chain was fetched for
+        u_int32_t qc_trace_id;          //  id in the validation trace
         struct expected_arrival *qc_ea; // asynchronous queries only
 
         struct val_digested_auth_chain *qc_ans;
@@ -309,6 +366,8 @@ extern          "C" {
         struct policy_overrides *next;
     };
 
+    struct val_log_ring;
+
     struct val_log {
         val_log_logger_t logf;  /* log function ptr */
         u_char   level;  /* 0 - 9, corresponds w/sylog severities */
@@ -334,12 +393,34 @@ extern          "C" {
             struct {
                 void           *my_ptr;
             } user;
+            struct {
+                struct val_log_ring *ring;
+            } async;
         } opt;
         struct val_log *next;
     };
 
+    /*
+     * Highest level accepted by any log target, default or per-context.
+     * It is only ever raised, when a target is added, so a stale read
+     * costs at most a call to val_log() that has nothing to do.
+     */
+    extern int      val_log_max_level;
+
+    /*
+     * Use VAL_LOG() rather than val_log() on hot paths: a message no
+     * target would accept costs one compare, and none of its arguments
+     * are evaluated.  Wrap code that only builds log arguments (name
+     * and hex strings) in VAL_LOG_ENABLED().
+     */
+#define VAL_LOG_ENABLED(level)  ((level) <= val_log_max_level)
+#define VAL_LOG(ctx, level, ...) do {                   \
+        if (VAL_LOG_ENABLED(level))                     \
+            val_log((ctx), (level), __VA_ARGS__);       \
+    } while (0)
+
     struct zone_ns_map_t {
-        u_char        zone_n[NS_MAXCDNAME];
+        u_char       *zone_n;
         struct name_server *nslist;
         struct zone_ns_map_t *next;
     };
@@ -369,6 +450,9 @@ extern          "C" {
 #endif
 
         u_int32_t       ctx_flags;
+
+        /* frees in progress; see val_prefetch_hold() */
+        int             prefetch_hold;
 #endif
 
         char  id[VAL_CTX_IDLEN];
@@ -410,9 +494,23 @@ extern          "C" {
         /* Query cache */
         struct val_query_chain *q_list;
 
+        /* previously trusted answers, for serve-stale */
+        struct val_stale_answer *stale_table[VAL_STALE_BUCKETS];
+        struct val_stale_answer *stale_newest;
+        struct val_stale_answer *stale_oldest;
+        int                     stale_count;
+
+        /* local copies of zones, see val_mirror.c */
+        struct zone_mirror *zone_mirrors;
+
 #ifndef VAL_NO_ASYNC
         /* in flight async queries */
         val_async_status       *as_list;
+        int                     as_queued;  /* batch requests not yet started */
+        int                     as_active;  /* started and not yet done */
+        val_async_status       *as_queue_head; /* queued requests, oldest */
+        val_async_status       *as_queue_tail; /*   first */
+        struct val_async_runtime *as_runtime; /* see val_runtime.c */
 #endif
 
         /* default flags that the context applies automatically */
@@ -421,6 +519,10 @@ extern          "C" {
         /* flags that get applied to the query by application preferences */
         u_int32_t def_uflags;
 
+        /* per-request spans, see val_span.c */
+        val_span_cb span_cb;
+        void       *span_cb_data;
+
 #ifdef HAVE_PTHREAD_H 
         pthread_mutex_t ref_lock;
 #endif
@@ -434,6 +536,28 @@ extern          "C" {
 
 #define CTX_PROCESS_ALL_THREADS             0x00000001
 
+    /*
+     * Per-resolution arena, see libval/val_arena.c
+     */
+#define VAL_ARENA_INLINE_SIZE               1024
+
+    union val_arena_align {
+        struct val_arena *va_owner;
+        void           *va_p;
+        double          va_d;
+        long double     va_ld;
+    };
+
+    struct val_arena {
+        u_char         *va_block;   /* block allocations come from */
+        size_t          va_size;
+        size_t          va_used;
+        struct val_arena_chunk *va_chunks;  /* heap chunks */
+        struct val_arena *va_keep;  /* for arena_malloc_keep(), if scratch */
+        union val_arena_align va_inline[VAL_ARENA_INLINE_SIZE /
+                                        sizeof(union val_arena_align)];
+    };
+
 
 #ifndef VAL_NO_ASYNC
     struct val_async_status_s {
@@ -444,12 +568,16 @@ extern          "C" {
 #endif
 
         unsigned char                 val_as_inflight;
+        struct timeval                val_as_start;
+        struct val_span               *val_as_span;
         struct queries_for_query      *val_as_top_q;
         struct queries_for_query      *val_as_queries;
+        struct val_arena              val_as_arena;
 
         char                          *val_as_name;
         int                           val_as_class;
         int                           val_as_type;
+        u_int32_t                     val_as_qflags;
 
         int                           val_as_retval;
         struct val_result_chain       *val_as_results;
@@ -459,6 +587,9 @@ extern          "C" {
         void                          *val_as_cb_user_ctx;
 
         struct val_async_status_s     *val_as_next;
+        /* in the context's queue while VAL_AS_QUEUED */
+        struct val_async_status_s     *val_as_qprev;
+        struct val_async_status_s     *val_as_qnext;
     };
 #endif
 
@@ -490,6 +621,10 @@ extern          "C" {
         u_char *rrs_zonecut_n;
         u_char rrs_cred;       /* SR_CRED_... */
         u_char rrs_ans_kind;   /* SR_ANS_... */
+        int    rrs_refcount;   /* cache + views holding a cached rrset */
+        struct rrset_rec *rrs_shared;   /* cached rrset a view borrows from */
+        size_t rrs_cache_bytes;         /* bytes charged to the cache */
+        u_char rrs_cache_ref;           /* used since the CLOCK hand passed */
         struct rrset_rec *rrs_next;
     };
 
@@ -511,6 +646,7 @@ extern          "C" {
 
     struct queries_for_query {
         u_int32_t qfq_flags;
+        int qfq_sent;           /* sent by this request */
         struct val_query_chain *qfq_query;
         struct queries_for_query *qfq_next;
     };
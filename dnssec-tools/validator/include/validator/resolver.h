@@ -162,10 +162,14 @@ struct name_server {
 #define SR_QUERY_NOREC              0x00000010
 #define SR_QUERY_IPV4_ONLY          0x00000020
 #define SR_QUERY_IPV6_ONLY          0x00000040
+#define SR_QUERY_USE_TCP            0x00000080 /* start with, or used, tcp */
 #define SR_QUERY_VALIDATING_STUB_FLAGS  (SR_QUERY_SET_DO | SR_QUERY_SET_CD) 
 #define SR_QUERY_DEFAULT                (SR_QUERY_RECURSE) 
 
 
+struct res_inflight;
+struct res_inflight_waiter;
+
 struct expected_arrival {
     SOCKET          ea_socket;
     char           *ea_name;
@@ -181,6 +185,10 @@ struct expected_arrival {
     int             ea_remaining_attempts;
     struct timeval  ea_next_try;
     struct timeval  ea_cancel_time;
+    struct timeval  ea_sent;        /* when the last attempt was sent */
+    int             ea_timer_index; /* slot in io manager timer heap, or -1 */
+    struct res_inflight *ea_inflight; /* in-flight entry led by this list */
+    struct res_inflight_waiter *ea_waiter; /* entry this list is joined to */
     struct expected_arrival *ea_next;
 };
 
@@ -204,6 +212,7 @@ int             response_recv(int *trans_id,
 int             res_response_checks(u_char ** answer, size_t * answer_length,
                                     struct name_server **respondent);
 void            res_cancel(int *transaction_id);
+void            res_io_cancel_all(void);
 int             res_nsfallback(int transaction_id,
                                struct timeval *closest_event,
                                struct name_server *server);
@@ -247,6 +256,66 @@ int             labelcmp(const u_char * name1, const u_char * name2,
                         size_t label_cnt);
 int             namecmp(const u_char * name1, const u_char * name2);
 
+/*
+ * Case-insensitive name kernels, see res_name_simd()
+ */
+#define RES_NAME_SCALAR 0
+#define RES_NAME_SSE2   1
+#define RES_NAME_AVX2   2
+int             res_name_simd(int level);
+void            res_name_lower(u_char * dst, const u_char * src,
+                               size_t len);
+int             res_name_caseeq(const u_char * a, const u_char * b,
+                                size_t len);
+int             res_name_casecmp(const u_char * a, const u_char * b,
+                                 size_t len);
+u_int32_t       res_name_hash(const u_char * p, size_t len,
+                              u_int32_t seed);
+
+/*
+ * Runtime statistics kept by libsres and libval, see res_stats_get()
+ * and val_get_stats()
+ */
+#define RES_STAT_UDP_QUERIES        0   /* queries sent over UDP */
+#define RES_STAT_TCP_QUERIES        1   /* queries sent over TCP */
+#define RES_STAT_RETRANSMITS        2   /* queries sent again, same address */
+#define RES_STAT_TCP_FALLBACKS      3   /* truncated answers, retried over TCP */
+#define RES_STAT_TIMEOUTS           4   /* server addresses given up on */
+#define RES_STAT_SEND_ERRORS        5   /* queries that could not be sent */
+#define RES_STAT_RESPONSES          6   /* responses received */
+#define RES_STAT_MISMATCHED         7   /* responses dropped, wrong id/question */
+#define RES_STAT_CACHE_HITS         8   /* answers found in the rrset cache */
+#define RES_STAT_CACHE_SHARED_HITS  9   /* answers found in the shared cache */
+#define RES_STAT_CACHE_MISSES       10  /* answers not cached */
+#define RES_STAT_CACHE_EVICTIONS    11  /* rrsets evicted by max-cache-size */
+#define RES_STAT_CACHE_EXPIRED      12  /* expired rrsets dropped */
+#define RES_STAT_SIG_VERIFIED       13  /* RRSIGs verified */
+#define RES_STAT_SIG_FAILED         14  /* RRSIGs that did not verify */
+#define RES_STAT_DS_DIGESTS         15  /* DNSKEYs compared with a DS digest */
+#define RES_STAT_REQUESTS           16  /* validation requests */
+#define RES_STAT_RESULTS_VALIDATED  17  /* results that were validated */
+#define RES_STAT_RESULTS_TRUSTED    18  /* trusted, but not validated */
+#define RES_STAT_RESULTS_UNTRUSTED  19  /* bogus or indeterminate results */
+#define RES_STAT_REQUESTS_CACHED    20  /* requests that sent no query */
+#define RES_STAT_COUNTERS           21
+
+#define RES_HIST_RESPONSE           0   /* name server response times */
+#define RES_HIST_VERIFY             1   /* RRSIG verification times */
+#define RES_HIST_REQUEST            2   /* validation request times */
+#define RES_HIST_COUNT              3
+#define RES_HIST_BUCKETS            24  /* bucket i: up to 2^i microseconds */
+
+struct res_stats {
+    u_int64_t       rs_counter[RES_STAT_COUNTERS];
+    u_int64_t       rs_hist[RES_HIST_COUNT][RES_HIST_BUCKETS];
+    u_int64_t       rs_hist_sum[RES_HIST_COUNT];        /* microseconds */
+};
+
+void            res_stats_add(int counter, u_int64_t n);
+void            res_stats_time(int hist, struct timeval *start);
+void            res_stats_get(struct res_stats *stats);
+#define res_stats_inc(counter) res_stats_add((counter), 1)
+
     int             res_map_srio_to_sr(int val);
 
 unsigned short       res_nametoclass(const char *buf, int *successp);
@@ -11,6 +11,10 @@ extern          "C" {
 #endif
 
 #define VAL_FLAG_CHAIN_COMPLETE 0x80
+/* answer was served from expired (stale) cache data, see RFC 8767 */
+#define VAL_FLAG_STALE 0x40
+/* the status with VAL_FLAG_STALE removed, for comparing against VAL_... */
+#define VAL_BASE_STATUS(st)                ((val_status_t)((st) & ~VAL_FLAG_STALE))
 #define VAL_MASKED_FLAG_CHAIN_COMPLETE 0x7f
 #define SET_CHAIN_COMPLETE(status)         (status |= VAL_FLAG_CHAIN_COMPLETE)
 #define SET_MASKED_STATUS(st, new_val)     (st = (st & VAL_FLAG_CHAIN_COMPLETE) | new_val)
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+#ifndef VAL_TRACE_H
+#define VAL_TRACE_H
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/nameser.h>
+
+#ifdef __cplusplus
+extern          "C" {
+#endif
+
+/*
+ * The trace stream written when the "trace" option is set in
+ * dnsval.conf.  The stream starts with an 8-byte header: the magic
+ * "VTRC", a 16-bit version and the 16-bit header length.  Each event
+ * follows as a 16-bit length and that many bytes; all integers are in
+ * network byte order.  Readers skip events they do not know.
+ */
+#define VAL_TRACE_MAGIC         "VTRC"
+#define VAL_TRACE_VERSION       1
+#define VAL_TRACE_MAX_EVENT     1024
+
+/*
+ * Event types
+ */
+#define VAL_TRACE_QUERY         1       /* query sent */
+#define VAL_TRACE_RESPONSE      2       /* response received */
+#define VAL_TRACE_RRSIG         3       /* RRSIG checked */
+#define VAL_TRACE_LINK          4       /* chain of trust link checked */
+#define VAL_TRACE_RESULT        5       /* final result for a request */
+
+struct val_trace_event {
+    int             te_event;
+    struct timeval  te_time;
+    /*
+     * Identifies the query (and the query chain entry caching its
+     * answer): a response, and the RRSIGs and links of its rrsets,
+     * carry the id of the query that was sent.
+     */
+    u_int32_t       te_id;
+    u_int16_t       te_type;    /* query type, or type covered */
+    u_int16_t       te_class;
+    /*
+     * val_astatus_t for RRSIG and LINK events, val_status_t for
+     * RESULT events
+     */
+    u_int16_t       te_status;
+    u_int8_t        te_rcode;   /* RESPONSE */
+    u_int8_t        te_algorithm;       /* RRSIG */
+    u_int16_t       te_keytag;  /* RRSIG */
+    u_int16_t       te_msglen;  /* RESPONSE */
+    /* the name server, for QUERY and RESPONSE; ss_family 0 if none */
+    struct sockaddr_storage te_server;
+    u_char          te_name_n[NS_MAXCDNAME];
+};
+
+typedef struct val_trace_reader val_trace_reader_t;
+
+val_trace_reader_t *val_trace_reader_open(const char *path);
+val_trace_reader_t *val_trace_reader_fdopen(int fd);
+int             val_trace_read(val_trace_reader_t *reader,
+                               struct val_trace_event *ev);
+void            val_trace_reader_close(val_trace_reader_t *reader);
+const char     *p_trace_event(int event);
+
+#ifdef __cplusplus
+}                               /* extern C */
+#endif
+#endif                          /* VAL_TRACE_H */
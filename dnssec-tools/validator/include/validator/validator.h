@@ -61,6 +61,7 @@ struct timeval;
 #define VAL_QUERY_SKIP_RESOLVER     0x00000040
 #define VAL_QUERY_MARK_FOR_DELETION 0x00000080
 #define VAL_QUERY_IGNORE_SKEW       0x00000100
+#define VAL_QUERY_PREFETCH          0x00000200
 
 /*
  * Flags in this bit mask MUST match if they
@@ -120,6 +121,7 @@ typedef struct val_policy_handle val_policy_handle_t;
 struct val_log;
 typedef struct val_log val_log_t;
 struct queries_for_query;
+struct res_stats;
 
 
 /* validator context options */
@@ -135,6 +137,16 @@ typedef struct val_global_opt {
     int proto;
     int timeout;
     int retry;
+    int prefetch;
+    int prefetch_hits;
+    long serve_stale;
+    long serve_stale_timeout;
+    int async_window;
+    long max_cache_size;
+    char *shared_cache;
+    long shared_cache_size;
+    char *trace;
+    int dns_port;
 } val_global_opt_t;
 
 /*
@@ -165,6 +177,7 @@ typedef struct val_context_opt {
 #define POL_CLOCK_SKEW_STR "clock-skew"
 #define POL_PROV_INSEC_STR "provably-insecure-status"
 #define POL_ZONE_SE_STR "zone-security-expectation"
+#define POL_ZONE_MIRROR_STR "zone-mirror"
 #define POL_DLV_TRUST_POINTS_STR  "dlv-trust-points"
 #define POL_NSEC3_MAX_ITER_STR "nsec3-max-iter"
 #define GOPT_TRUST_OOB_STR "trust-oob-answers"
@@ -178,6 +191,16 @@ typedef struct val_context_opt {
 #define GOPT_PROTO "proto"
 #define GOPT_TIMEOUT "timeout"
 #define GOPT_RETRY "retry"
+#define GOPT_PREFETCH "prefetch"
+#define GOPT_PREFETCH_HITS "prefetch-hits"
+#define GOPT_SERVE_STALE "serve-stale"
+#define GOPT_SERVE_STALE_TIMEOUT "serve-stale-timeout"
+#define GOPT_ASYNC_WINDOW "async-window"
+#define GOPT_MAX_CACHE_SIZE "max-cache-size"
+#define GOPT_SHARED_CACHE "shared-cache"
+#define GOPT_SHARED_CACHE_SIZE "shared-cache-size"
+#define GOPT_TRACE "trace"
+#define GOPT_DNS_PORT "dns-port"
 /* 
  * The following policies are deprecated. 
  * They are defined here for backwards compatibility
@@ -202,6 +225,14 @@ typedef struct val_context_opt {
 
 #define VAL_POL_GOPT_MAXREFRESH 60
 
+#define VAL_POL_GOPT_PREFETCH_HITS 3
+
+#define VAL_POL_GOPT_STALE_TIMEOUT 1800 /* msec, RFC 8767 */
+
+#define VAL_POL_GOPT_ASYNC_WINDOW 256  /* batch requests in flight */
+
+#define VAL_POL_GOPT_SHARED_CACHE_SIZE (8 * 1024 * 1024)
+
 #define VAL_POL_GOPT_PROTO_ANY 0 
 #define VAL_POL_GOPT_PROTO_IPV4 1 
 #define VAL_POL_GOPT_PROTO_IPV6 2 
@@ -368,6 +399,7 @@ typedef struct val_context_opt {
     val_log_t      *val_log_add_optarg_to_list(val_log_t **list_head,
                                         const char *args, int use_stderr);
     val_log_t      *val_log_add_optarg(const char *args, int use_stderr);
+    unsigned long   val_log_async_dropped(val_log_t *logp);
 
     int             val_log_debug_level(void);
     void            val_log_set_debug_level(int);
@@ -393,6 +425,7 @@ typedef struct val_context_opt {
 #define VAL_AS_DONE                  0x01000000 /* have results/answers */
 #define VAL_AS_CALLBACK_CALLED       0x02000000 /* called user callbacks */
 #define VAL_AS_INFLIGHT              0x04000000 /* called user callbacks */
+#define VAL_AS_QUEUED                0x08000000 /* waiting for a free slot */
 
     /*
      * asynchronous events
@@ -422,6 +455,22 @@ typedef struct val_context_opt {
                                      int type_h, unsigned int flags,
                                      val_async_event_cb callback, void *cb_data,
                                      val_async_status **async_status);
+
+    /** one request in a val_async_submit_batch() call */
+    typedef struct val_async_request_s {
+        const char         *name;
+        int                 class_h;
+        int                 type_h;
+        unsigned int        flags;
+        val_async_event_cb  callback;
+        void               *cb_data;
+        val_async_status   *as;         /* set by val_async_submit_batch */
+        int                 retval;     /* set by val_async_submit_batch */
+    } val_async_request_t;
+
+    int             val_async_submit_batch(val_context_t * ctx,
+                                           val_async_request_t *reqs,
+                                           size_t count);
     int             val_async_check_wait(val_context_t *context,
                                          fd_set *pending_desc, int *nfds,
                                          struct timeval *tv, unsigned int flags);
@@ -445,6 +494,25 @@ typedef struct val_context_opt {
     int             val_async_cancel_all(val_context_t *context, unsigned int flags);
     unsigned int    val_async_getflags(val_async_status *as);
 
+    /*
+     * async runtime: an internal thread that drives pending requests
+     */
+#define VAL_RT_NOTIFY                  0x00000001 /* defer callbacks until
+                                                     val_async_runtime_dispatch */
+
+    typedef void    (*val_async_task_fn)(void *task_data);
+    typedef void    (*val_async_executor_fn)(val_async_task_fn task,
+                                             void *task_data,
+                                             void *exec_data);
+
+    int             val_async_runtime_start(val_context_t *context,
+                                            unsigned int flags,
+                                            val_async_executor_fn executor,
+                                            void *exec_data);
+    int             val_async_runtime_stop(val_context_t *context);
+    int             val_async_runtime_fd(val_context_t *context);
+    int             val_async_runtime_dispatch(val_context_t *context);
+
     /*
      * backwards compatibility
      */
@@ -466,6 +534,7 @@ typedef struct val_context_opt {
     int             val_istrusted(val_status_t val_status);
     int             val_isvalidated(val_status_t val_status);
     int             val_does_not_exist(val_status_t status); 
+    int             val_isstale(val_status_t val_status);
     void            val_free_result_chain(struct val_result_chain
                                           *results);
     int             val_resolve_and_check(val_context_t * context,
@@ -502,6 +571,66 @@ typedef struct val_context_opt {
     int             val_context_store_ns_for_zone(val_context_t *context, 
                                                   char * zone, char *resp_server,
                                                   int recursive);
+
+    /*
+     * Per-request latency spans, see val_context_set_span_cb().
+     * Phases may nest (VAL_SPAN_CHAIN includes VAL_SPAN_VERIFY, which
+     * includes VAL_SPAN_RRSIG), so their times do not add up to the
+     * time of the request.  Times are in microseconds, since the
+     * epoch for points in time.
+     */
+#define VAL_SPAN_ASK_CACHE              0   /* looking in the caches */
+#define VAL_SPAN_ASK_RESOLVER           1   /* sending, reading responses */
+#define VAL_SPAN_FIX_GLUE               2   /* chasing name server glue */
+#define VAL_SPAN_WAIT                   3   /* waiting for responses */
+#define VAL_SPAN_CHAIN                  4   /* building the chain of trust */
+#define VAL_SPAN_VERIFY                 5   /* checking links in the chain */
+#define VAL_SPAN_PROVE_NONEXISTENCE     6   /* checking NSEC/NSEC3 proofs */
+#define VAL_SPAN_RRSIG                  7   /* RRSIG crypto */
+#define VAL_SPAN_NSEC3_HASH             8   /* NSEC3 name hashing */
+#define VAL_SPAN_PHASES                 9
+
+#define VAL_SPAN_Q_CACHED               0x01    /* answered from the cache */
+#define VAL_SPAN_Q_ANSWERED             0x02
+#define VAL_SPAN_Q_ERROR                0x04
+
+    /** a query made on behalf of the request */
+    struct val_span_query {
+        unsigned char  *sq_name_n;
+        unsigned short  sq_type_h;
+        unsigned short  sq_class_h;
+        unsigned int    sq_flags;       /* VAL_SPAN_Q_* */
+        unsigned int    sq_sends;       /* including after referrals */
+        unsigned long long sq_sent;     /* first sent, or 0 */
+        unsigned long long sq_done;     /* first answered or failed, or 0 */
+        struct val_span_query *sq_next;
+    };
+
+    struct val_span {
+        unsigned int    vs_trace_id;    /* id in the validation trace, or 0 */
+        char           *vs_name;
+        int             vs_class_h;
+        int             vs_type_h;
+        int             vs_retval;
+        int             vs_results;     /* number of results */
+        val_status_t    vs_status;      /* status of the first result */
+        unsigned long long vs_start;
+        unsigned long long vs_end;
+        unsigned int    vs_phase_count[VAL_SPAN_PHASES];
+        unsigned long long vs_phase_usec[VAL_SPAN_PHASES];
+        struct val_span_query *vs_queries;  /* in the order first made */
+    };
+
+    typedef void    (*val_span_cb) (val_context_t *ctx,
+                                    const struct val_span *span,
+                                    void *cb_data);
+
+    int             val_context_set_span_cb(val_context_t *context,
+                                            val_span_cb cb, void *cb_data);
+    const char     *p_span_phase(int phase);
+    size_t          val_span_json(const struct val_span *span, char *buf,
+                                  size_t buflen);
+
     /*
      * from val_policy.h 
      */
@@ -517,6 +646,11 @@ typedef struct val_context_opt {
     int             val_remove_valpolicy(val_context_t *context, 
                                       val_policy_handle_t *pol);
     struct name_server *val_get_nameservers(val_context_t *ctx);
+    /*
+     * runtime statistics, struct res_stats is in validator/resolver.h
+     */
+    int             val_get_stats(struct res_stats *stats);
+    size_t          val_stats_prometheus(char *buf, size_t buflen);
     /*
      * from val_x_query.c 
      */
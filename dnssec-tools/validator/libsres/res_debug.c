@@ -614,6 +614,8 @@ p_option(P_OPTION_ARG_TYPE option)
         return "recurs";
     case SR_QUERY_DEBUG:
         return "debug";
+    case SR_QUERY_USE_TCP:
+        return "tcp";
         /*
          * XXX nonreentrant 
          */
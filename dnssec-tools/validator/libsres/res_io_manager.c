@@ -21,6 +21,10 @@
 #include "res_mkquery.h"
 #include "res_io_manager.h"
 
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
 #ifndef TRUE
 #define TRUE 1
 #endif
@@ -76,6 +80,234 @@ static int      next_transaction = 0;
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
+/*
+ * Retransmit/cancel deadlines for every expected arrival that is
+ * registered in the transactions[] table are kept in a binary min-heap
+ * ordered by the earliest of ea_next_try and ea_cancel_time. This lets
+ * res_io_check() touch only the expired entries on each pass, and the
+ * next wakeup is simply the top of the heap.
+ *
+ * Entries with no remaining attempts stay in the heap (they can be revived
+ * by an EDNS0 fallback) but sort last, since they have no deadline.
+ *
+ * The heap is protected by the same mutex as transactions[]. Expected
+ * arrivals that are driven directly by the async API are never added
+ * to the heap (ea_timer_index stays at -1).
+ */
+#define TIMER_HEAP_INITIAL_SIZE 64
+static struct expected_arrival **timer_heap = NULL;
+static int      timer_heap_count = 0;
+static int      timer_heap_size = 0;
+/* scratch space for the entries expired in one pass of _expire_timers() */
+static struct expected_arrival **timer_expired = NULL;
+static int      timer_expired_size = 0;
+
+/*
+ * Identical queries (same question, flags and EDNS0 options, sent to the
+ * same list of servers) that are started while an earlier one is still
+ * outstanding are coalesced: the later list is "joined" to the earlier
+ * one, does not send anything itself, and receives a copy of the
+ * earlier list's response. This holds across threads, contexts and
+ * the sync/async interfaces, since all of them go through this file.
+ *
+ * The leader never touches the joined lists directly. Instead, each
+ * joined list has a waiter with a small mailbox, filled in by the leader
+ * under inflight_mutex and emptied by the joined list's owner the next
+ * time it looks at its list. The waiters of one leader share a wakeup
+ * descriptor, which the leader makes readable once it has filled all
+ * their mailboxes, so that their owners wake up from select() only when
+ * there is something for them.
+ */
+#define INFLIGHT_WAITING    0
+#define INFLIGHT_ANSWERED   1
+#define INFLIGHT_FAILED     2
+#define INFLIGHT_ORPHANED   3
+
+struct res_inflight_waiter {
+    struct res_inflight *w_inflight;    /* NULL once detached from leader */
+    int             w_state;            /* INFLIGHT_... */
+    int             w_index;            /* position of answering ea in list */
+    int             w_which_address;
+    int             w_using_stream;
+    u_char         *w_response;
+    size_t          w_response_length;
+    struct res_inflight_wake *w_wake;   /* shared with the leader */
+    struct res_inflight_waiter *w_next;
+};
+
+/*
+ * An eventfd where available, else a pipe.  Created when the first list
+ * joins a leader; freed when the leader and all its waiters let go.
+ */
+struct res_inflight_wake {
+    int             wk_fd_r;
+    int             wk_fd_w;
+    int             wk_nfds;            /* counted in _open_sockets */
+    int             wk_refs;
+    int             wk_signalled;
+};
+
+struct res_inflight {
+    struct expected_arrival *if_leader;
+    u_char         *if_key;             /* see _inflight_key() */
+    size_t          if_key_length;
+    int             if_closed;          /* leader's query has changed */
+    unsigned int    if_bucket;
+    struct res_inflight_wake *if_wake;  /* NULL until a list joins */
+    struct res_inflight_waiter *if_waiters;
+    struct res_inflight *if_next;
+};
+
+#define INFLIGHT_BUCKETS 64
+#define INFLIGHT_PARK_TIME 3600 /* seconds; leader normally ends it first */
+static struct res_inflight *inflight_table[INFLIGHT_BUCKETS];
+#ifndef VAL_NO_THREADS
+static pthread_mutex_t inflight_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void     _inflight_release(struct expected_arrival *head);
+static void     _inflight_close(struct res_inflight *inf);
+static void     _inflight_collect(struct expected_arrival *head);
+static int      _clone_respondent(struct expected_arrival *ea,
+                                  struct name_server **respondent);
+
+static void
+_ea_deadline(struct expected_arrival *ea, struct timeval *deadline)
+{
+    if (ea->ea_remaining_attempts == -1) {
+        deadline->tv_sec = LONG_MAX;
+        deadline->tv_usec = 0;
+    } else if (timercmp(&ea->ea_cancel_time, &ea->ea_next_try, <))
+        memcpy(deadline, &ea->ea_cancel_time, sizeof(struct timeval));
+    else
+        memcpy(deadline, &ea->ea_next_try, sizeof(struct timeval));
+}
+
+static int
+_timer_heap_less(int i, int j)
+{
+    struct timeval  a, b;
+
+    _ea_deadline(timer_heap[i], &a);
+    _ea_deadline(timer_heap[j], &b);
+    return timercmp(&a, &b, <);
+}
+
+static void
+_timer_heap_swap(int i, int j)
+{
+    struct expected_arrival *t = timer_heap[i];
+
+    timer_heap[i] = timer_heap[j];
+    timer_heap[j] = t;
+    timer_heap[i]->ea_timer_index = i;
+    timer_heap[j]->ea_timer_index = j;
+}
+
+static void
+_timer_heap_sift_up(int i)
+{
+    int             parent;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (!_timer_heap_less(i, parent))
+            break;
+        _timer_heap_swap(i, parent);
+        i = parent;
+    }
+}
+
+static void
+_timer_heap_sift_down(int i)
+{
+    int             l, r, smallest;
+
+    for (;;) {
+        l = 2 * i + 1;
+        r = l + 1;
+        smallest = i;
+        if (l < timer_heap_count && _timer_heap_less(l, smallest))
+            smallest = l;
+        if (r < timer_heap_count && _timer_heap_less(r, smallest))
+            smallest = r;
+        if (smallest == i)
+            break;
+        _timer_heap_swap(i, smallest);
+        i = smallest;
+    }
+}
+
+/** assumes caller has mutex lock */
+static void
+_timer_heap_remove(struct expected_arrival *ea)
+{
+    int             i = ea->ea_timer_index;
+
+    if (i < 0 || i >= timer_heap_count || timer_heap[i] != ea)
+        return;
+
+    ea->ea_timer_index = -1;
+    --timer_heap_count;
+    if (i == timer_heap_count)
+        return;
+
+    timer_heap[i] = timer_heap[timer_heap_count];
+    timer_heap[i]->ea_timer_index = i;
+    _timer_heap_sift_up(i);
+    _timer_heap_sift_down(timer_heap[i]->ea_timer_index);
+}
+
+/** assumes caller has mutex lock */
+static int
+_timer_heap_insert(struct expected_arrival *ea)
+{
+    if (ea->ea_timer_index >= 0)
+        return SR_IO_UNSET;
+
+    if (timer_heap_count == timer_heap_size) {
+        struct expected_arrival **bigger;
+        int new_size = timer_heap_size ?
+            timer_heap_size * 2 : TIMER_HEAP_INITIAL_SIZE;
+
+        bigger = (struct expected_arrival **)
+            MALLOC(new_size * sizeof(struct expected_arrival *));
+        if (bigger == NULL)
+            return SR_IO_MEMORY_ERROR;
+        if (timer_heap) {
+            memcpy(bigger, timer_heap,
+                   timer_heap_count * sizeof(struct expected_arrival *));
+            FREE(timer_heap);
+        }
+        timer_heap = bigger;
+        timer_heap_size = new_size;
+    }
+
+    ea->ea_timer_index = timer_heap_count;
+    timer_heap[timer_heap_count++] = ea;
+    _timer_heap_sift_up(ea->ea_timer_index);
+
+    return SR_IO_UNSET;
+}
+
+/*
+ * Called whenever the retry/cancel times or remaining attempts of an
+ * expected arrival change. This is a no-op for entries that are not
+ * scheduled in the heap. Assumes caller has mutex lock for scheduled
+ * entries.
+ */
+static void
+res_io_timer_update(struct expected_arrival *ea)
+{
+    int             i = ea->ea_timer_index;
+
+    if (i < 0)
+        return;
+
+    _timer_heap_sift_up(i);
+    _timer_heap_sift_down(ea->ea_timer_index);
+}
+
 /*
  * Find a port in the range 1024 - 65535 
  */
@@ -243,6 +475,8 @@ res_free_ea_list(struct expected_arrival *head)
     struct expected_arrival *ea;
 
     res_log(NULL, LOG_DEBUG, "libsres: ""ea %p free list", head);
+    if (head && (head->ea_inflight || head->ea_waiter))
+        _inflight_release(head);
     while (head) {
         ea = head;
         head = head->ea_next;
@@ -264,6 +498,7 @@ set_alarms(struct expected_arrival *ea, long next, long cancel)
     ea->ea_next_try.tv_sec += next;
     ea->ea_cancel_time.tv_sec = ea->ea_next_try.tv_sec + cancel;
     ea->ea_cancel_time.tv_usec = ea->ea_next_try.tv_usec;
+    res_io_timer_update(ea);
 }
 
 static struct expected_arrival *
@@ -282,6 +517,7 @@ res_ea_init(const char *name, const u_int16_t type_h, const u_int16_t class_h,
 
     memset(temp, 0x0, sizeof(struct expected_arrival));
     temp->ea_socket = INVALID_SOCKET;
+    temp->ea_timer_index = -1;
     temp->ea_name = strdup(name);
     if (temp->ea_name == NULL) {
         FREE(temp);
@@ -291,7 +527,7 @@ res_ea_init(const char *name, const u_int16_t type_h, const u_int16_t class_h,
     temp->ea_class_h = class_h;
     temp->ea_ns = ns;
     temp->ea_which_address = 0;
-    temp->ea_using_stream = FALSE;
+    temp->ea_using_stream = (ns->ns_options & SR_QUERY_USE_TCP) ? TRUE : FALSE;
     temp->ea_signed = signed_query;
     temp->ea_signed_length = signed_length;
     temp->ea_response = NULL;
@@ -322,6 +558,7 @@ res_io_retry_source(struct expected_arrival *ea)
 
     /* bump retry time to current time */
     gettimeofday(&ea->ea_next_try, NULL);
+    res_io_timer_update(ea);
 }
 
 /*
@@ -343,6 +580,7 @@ res_io_reset_source(struct expected_arrival *ea)
 
     /* bump cancel time to current time */
     gettimeofday(&ea->ea_cancel_time, NULL);
+    res_io_timer_update(ea);
 }
 
 /*
@@ -367,6 +605,7 @@ res_io_cancel_source(struct expected_arrival *ea)
 
     /* no more retries */
     ea->ea_remaining_attempts = -1;
+    res_io_timer_update(ea);
 }
 
 void
@@ -524,9 +763,18 @@ res_io_send(struct expected_arrival *shipit)
                 "Closing socket %d, sending %d bytes failed (rc %d)",
                 shipit->ea_socket, shipit->ea_signed_length, bytes_sent);
         res_io_reset_source(shipit);
+        res_stats_inc(RES_STAT_SEND_ERRORS);
         return SR_IO_SOCKET_ERROR;
     }
 
+    gettimeofday(&shipit->ea_sent, NULL);
+    VAL_PROBE4(query_send, shipit, shipit->ea_name, shipit->ea_type_h,
+               shipit->ea_using_stream);
+    res_stats_inc(shipit->ea_using_stream ?
+                  RES_STAT_TCP_QUERIES : RES_STAT_UDP_QUERIES);
+    if (shipit->ea_remaining_attempts <= shipit->ea_ns->ns_retry)
+        res_stats_inc(RES_STAT_RETRANSMITS);
+
     //delay = shipit->ea_ns->ns_retrans
     //    << (shipit->ea_ns->ns_retry + 1 - shipit->ea_remaining_attempts--);
     delay = shipit->ea_ns->ns_retrans;
@@ -585,6 +833,7 @@ _reset_timeouts(struct expected_arrival *temp)
                         offset, t);
                 t->ea_next_try.tv_sec -= offset;
                 t->ea_cancel_time.tv_sec -= offset;
+                res_io_timer_update(t);
             } 
         }
     }
@@ -683,6 +932,9 @@ res_nsfallback_ea(struct expected_arrival *ea, struct timeval *closest_event,
     temp->ea_signed = NULL;
     temp->ea_signed_length = 0;
 
+    if (temp->ea_inflight)
+        _inflight_close(temp->ea_inflight);
+
     if (res_create_query_payload(temp->ea_ns,
                 temp->ea_name, temp->ea_class_h, temp->ea_type_h,
                 &temp->ea_signed,
@@ -707,6 +959,512 @@ res_nsfallback_ea(struct expected_arrival *ea, struct timeval *closest_event,
     return 1;
 }
 
+/*
+ * Create the wakeup descriptor for a leader's waiters. Returns NULL if
+ * that would go over the descriptor limit, or if the descriptor could
+ * not be used with select().
+ *
+ * assumes caller has inflight_mutex lock
+ */
+static struct res_inflight_wake *
+_inflight_wake_new(void)
+{
+    struct res_inflight_wake *wk;
+    int             fds[2];
+
+#ifdef WIN32
+    return NULL;
+#else
+    if (0 == _max_fd)
+        _max_fd = _init_max_fd();
+    if (_open_sockets + 2 > _max_fd)
+        return NULL;
+
+    wk = (struct res_inflight_wake *) MALLOC(sizeof(struct res_inflight_wake));
+    if (wk == NULL)
+        return NULL;
+    memset(wk, 0, sizeof(struct res_inflight_wake));
+
+#ifdef HAVE_SYS_EVENTFD_H
+    wk->wk_fd_r = wk->wk_fd_w = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wk->wk_fd_r != -1)
+        wk->wk_nfds = 1;
+    else
+#endif
+    if (pipe(fds) == 0) {
+        fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        wk->wk_fd_r = fds[0];
+        wk->wk_fd_w = fds[1];
+        wk->wk_nfds = 2;
+    } else {
+        FREE(wk);
+        return NULL;
+    }
+
+    if (wk->wk_fd_r >= FD_SETSIZE) {
+        close(wk->wk_fd_r);
+        if (wk->wk_fd_w != wk->wk_fd_r)
+            close(wk->wk_fd_w);
+        FREE(wk);
+        return NULL;
+    }
+    _open_sockets += wk->wk_nfds;
+    return wk;
+#endif
+}
+
+/*
+ * Wake up the owners of all the waiters sharing wk. The descriptor stays
+ * readable until the last of them lets go of it.
+ *
+ * assumes caller has inflight_mutex lock
+ */
+static void
+_inflight_wake_signal(struct res_inflight_wake *wk)
+{
+    u_int64_t       one = 1;
+    ssize_t         n;
+
+    if (wk == NULL || wk->wk_signalled)
+        return;
+    wk->wk_signalled = 1;
+    if (wk->wk_fd_w == wk->wk_fd_r)
+        n = write(wk->wk_fd_w, &one, sizeof(one));
+    else
+        n = write(wk->wk_fd_w, "x", 1);
+    if (n <= 0)
+        res_log(NULL, LOG_DEBUG, "libsres: ""inflight notify failed");
+}
+
+/*
+ * assumes caller has inflight_mutex lock
+ */
+static void
+_inflight_wake_release(struct res_inflight_wake *wk)
+{
+    if (wk == NULL || --wk->wk_refs > 0)
+        return;
+    close(wk->wk_fd_r);
+    if (wk->wk_fd_w != wk->wk_fd_r)
+        close(wk->wk_fd_w);
+    _open_sockets -= wk->wk_nfds;
+    FREE(wk);
+}
+
+/*
+ * Free a waiter that is no longer reachable from its leader.
+ *
+ * assumes caller has inflight_mutex lock
+ */
+static void
+_inflight_waiter_free(struct res_inflight_waiter *w)
+{
+    _inflight_wake_release(w->w_wake);
+    if (w->w_response)
+        FREE(w->w_response);
+    FREE(w);
+}
+
+/*
+ * Build the key that identical lists share: for each ea, the query
+ * without its id, the transport and the server addresses.
+ */
+static u_char *
+_inflight_key(struct expected_arrival *head, size_t *key_length)
+{
+    struct expected_arrival *ea;
+    u_char         *key, *cp;
+    size_t          len = 0;
+    int             i;
+
+    for (ea = head; ea; ea = ea->ea_next) {
+        if (ea->ea_signed_length <= sizeof(u_int16_t))
+            return NULL;
+        len += ea->ea_signed_length + 3 +
+            ea->ea_ns->ns_number_of_addresses *
+            sizeof(struct sockaddr_storage);
+    }
+
+    key = (u_char *) MALLOC(len);
+    if (key == NULL)
+        return NULL;
+
+    cp = key;
+    for (ea = head; ea; ea = ea->ea_next) {
+        /* two byte length in place of the query id */
+        *cp++ = (ea->ea_signed_length >> 8) & 0xff;
+        *cp++ = ea->ea_signed_length & 0xff;
+        memcpy(cp, ea->ea_signed + sizeof(u_int16_t),
+               ea->ea_signed_length - sizeof(u_int16_t));
+        cp += ea->ea_signed_length - sizeof(u_int16_t);
+        *cp++ = ea->ea_using_stream ? 1 : 0;
+        *cp++ = ea->ea_which_address & 0xff;
+        *cp++ = ea->ea_ns->ns_number_of_addresses & 0xff;
+        for (i = 0; i < ea->ea_ns->ns_number_of_addresses; i++) {
+            memcpy(cp, ea->ea_ns->ns_address[i],
+                   sizeof(struct sockaddr_storage));
+            cp += sizeof(struct sockaddr_storage);
+        }
+    }
+
+    *key_length = len;
+    return key;
+}
+
+static unsigned int
+_inflight_bucket(const u_char *key, size_t key_length)
+{
+    unsigned int    h = 0;
+    size_t          i;
+
+    for (i = 0; i < key_length; i++)
+        h = h * 31 + key[i];
+
+    return h % INFLIGHT_BUCKETS;
+}
+
+/*
+ * Join a newly created list to an identical outstanding list, or
+ * register it as the one that others may join. Must be called before
+ * anything in the list has been sent.
+ *
+ * Returns 1 if the list was joined to another, 0 otherwise.
+ */
+static int
+res_io_coalesce(struct expected_arrival *head)
+{
+    struct res_inflight *inf;
+    struct res_inflight_waiter *w;
+    struct expected_arrival *ea;
+    u_char         *key;
+    size_t          key_length = 0;
+    unsigned int    bucket;
+
+    if (head == NULL || head->ea_inflight || head->ea_waiter)
+        return 0;
+
+    key = _inflight_key(head, &key_length);
+    if (key == NULL)
+        return 0;
+    bucket = _inflight_bucket(key, key_length);
+
+    pthread_mutex_lock(&inflight_mutex);
+
+    for (inf = inflight_table[bucket]; inf; inf = inf->if_next) {
+        if (!inf->if_closed && inf->if_key_length == key_length &&
+            !memcmp(inf->if_key, key, key_length))
+            break;
+    }
+
+    if (inf == NULL) {
+        /*
+         * nothing to join; let others join us
+         */
+        inf = (struct res_inflight *) MALLOC(sizeof(struct res_inflight));
+        if (inf != NULL) {
+            inf->if_leader = head;
+            inf->if_key = key;
+            inf->if_key_length = key_length;
+            inf->if_closed = 0;
+            inf->if_bucket = bucket;
+            inf->if_wake = NULL;
+            inf->if_waiters = NULL;
+            inf->if_next = inflight_table[bucket];
+            inflight_table[bucket] = inf;
+            for (ea = head; ea; ea = ea->ea_next)
+                ea->ea_inflight = inf;
+        } else
+            FREE(key);
+        pthread_mutex_unlock(&inflight_mutex);
+        return 0;
+    }
+    FREE(key);
+
+    w = (struct res_inflight_waiter *)
+        MALLOC(sizeof(struct res_inflight_waiter));
+    if (w == NULL) {
+        pthread_mutex_unlock(&inflight_mutex);
+        return 0;
+    }
+    memset(w, 0, sizeof(struct res_inflight_waiter));
+    if (inf->if_wake == NULL) {
+        if (NULL == (inf->if_wake = _inflight_wake_new())) {
+            /*
+             * without a way to wake up the joined list, don't coalesce 
+             */
+            pthread_mutex_unlock(&inflight_mutex);
+            FREE(w);
+            return 0;
+        }
+        inf->if_wake->wk_refs = 1;      /* the leader's */
+    }
+    w->w_wake = inf->if_wake;
+    ++w->w_wake->wk_refs;
+    w->w_inflight = inf;
+    w->w_state = INFLIGHT_WAITING;
+    w->w_next = inf->if_waiters;
+    inf->if_waiters = w;
+    head->ea_waiter = w;
+
+    res_log(NULL, LOG_DEBUG, "libsres: ""ea %p joined in-flight ea %p",
+            head, inf->if_leader);
+
+    pthread_mutex_unlock(&inflight_mutex);
+
+    /*
+     * Park the list: nothing is sent or timed out until the leader has
+     * answered, given up or gone away.
+     */
+    for (ea = head; ea; ea = ea->ea_next)
+        set_alarms(ea, INFLIGHT_PARK_TIME, 0);
+
+    return 1;
+}
+
+/*
+ * Let a parked list send its own queries, staggered as when it was
+ * created.
+ */
+static void
+_inflight_unpark(struct expected_arrival *head)
+{
+    struct expected_arrival *ea;
+    long            delay = 0;
+
+    for (ea = head; ea; ea = ea->ea_next) {
+        if (ea->ea_remaining_attempts == -1)
+            continue;
+        set_alarms(ea, delay, res_get_timeout(ea->ea_ns));
+        delay += LIBSRES_NS_STAGGER;
+    }
+}
+
+/*
+ * The query sent by a leader list has changed (e.g. EDNS0 fallback), so
+ * new lists should no longer join it.
+ */
+static void
+_inflight_close(struct res_inflight *inf)
+{
+    pthread_mutex_lock(&inflight_mutex);
+    inf->if_closed = 1;
+    pthread_mutex_unlock(&inflight_mutex);
+}
+
+/*
+ * Remove the in-flight entry for a leader list from the table.
+ *
+ * assumes caller has inflight_mutex lock
+ */
+static void
+_inflight_unlink(struct res_inflight *inf)
+{
+    struct res_inflight **prev;
+    struct expected_arrival *ea;
+
+    for (prev = &inflight_table[inf->if_bucket]; *prev;
+         prev = &(*prev)->if_next) {
+        if (*prev == inf) {
+            *prev = inf->if_next;
+            break;
+        }
+    }
+    for (ea = inf->if_leader; ea; ea = ea->ea_next)
+        ea->ea_inflight = NULL;
+    _inflight_wake_release(inf->if_wake);
+    FREE(inf->if_key);
+    FREE(inf);
+}
+
+/*
+ * Hand a copy of the leader's response to every joined list.
+ * answered is the ea in the leader list that holds the response.
+ */
+static void
+_inflight_distribute(struct expected_arrival *head,
+                     struct expected_arrival *answered)
+{
+    struct res_inflight *inf;
+    struct res_inflight_waiter *w;
+    struct expected_arrival *ea;
+    int             index = 0;
+
+    for (ea = head; ea && ea != answered; ea = ea->ea_next)
+        ++index;
+
+    pthread_mutex_lock(&inflight_mutex);
+    inf = head->ea_inflight;
+    if (inf == NULL) {
+        pthread_mutex_unlock(&inflight_mutex);
+        return;
+    }
+
+    for (w = inf->if_waiters; w; w = w->w_next) {
+        w->w_inflight = NULL;
+        w->w_response = (u_char *) MALLOC(answered->ea_response_length);
+        if (w->w_response == NULL) {
+            /* let this one fend for itself */
+            w->w_state = INFLIGHT_ORPHANED;
+        } else {
+            memcpy(w->w_response, answered->ea_response,
+                   answered->ea_response_length);
+            w->w_response_length = answered->ea_response_length;
+            w->w_index = index;
+            w->w_which_address = answered->ea_which_address;
+            w->w_using_stream = answered->ea_using_stream;
+            w->w_state = INFLIGHT_ANSWERED;
+        }
+    }
+    _inflight_wake_signal(inf->if_wake);
+    if (inf->if_waiters)
+        res_log(NULL, LOG_DEBUG, "libsres: ""ea %p shared response", head);
+    _inflight_unlink(inf);
+
+    pthread_mutex_unlock(&inflight_mutex);
+}
+
+/*
+ * A list that is leading or is joined to an in-flight query is going away.
+ */
+static void
+_inflight_release(struct expected_arrival *head)
+{
+    struct res_inflight *inf;
+    struct res_inflight_waiter *w, **prev;
+    int             finished;
+
+    pthread_mutex_lock(&inflight_mutex);
+
+    if ((inf = head->ea_inflight) != NULL) {
+        /*
+         * If the leader ran out of attempts, so would have everyone
+         * waiting on it. Otherwise it was abandoned, and the joined
+         * lists must send their own queries.
+         */
+        finished = res_io_are_all_finished(head);
+        for (w = inf->if_waiters; w; w = w->w_next) {
+            w->w_inflight = NULL;
+            w->w_state = finished ? INFLIGHT_FAILED : INFLIGHT_ORPHANED;
+        }
+        _inflight_wake_signal(inf->if_wake);
+        _inflight_unlink(inf);
+    }
+
+    if ((w = head->ea_waiter) != NULL) {
+        if (w->w_inflight) {
+            for (prev = &w->w_inflight->if_waiters; *prev;
+                 prev = &(*prev)->w_next) {
+                if (*prev == w) {
+                    *prev = w->w_next;
+                    break;
+                }
+            }
+        }
+        _inflight_waiter_free(w);
+        head->ea_waiter = NULL;
+    }
+
+    pthread_mutex_unlock(&inflight_mutex);
+}
+
+/*
+ * Apply whatever the leader has left in this list's mailbox. Only the
+ * owner of the list may call this; for lists in transactions[] the
+ * caller must also hold the mutex lock.
+ */
+static void
+_inflight_collect(struct expected_arrival *head)
+{
+    struct res_inflight_waiter *w;
+    struct expected_arrival *ea;
+    int             i;
+
+    if (head == NULL || head->ea_waiter == NULL)
+        return;
+
+    pthread_mutex_lock(&inflight_mutex);
+    w = head->ea_waiter;
+    if (w->w_state == INFLIGHT_WAITING) {
+        pthread_mutex_unlock(&inflight_mutex);
+        return;
+    }
+    head->ea_waiter = NULL;
+    _inflight_wake_release(w->w_wake);
+    w->w_wake = NULL;
+    pthread_mutex_unlock(&inflight_mutex);
+
+    switch (w->w_state) {
+    case INFLIGHT_ANSWERED:
+        for (ea = head, i = 0; ea && i < w->w_index; ea = ea->ea_next)
+            ++i;
+        if (ea && ea->ea_response == NULL &&
+            w->w_which_address < ea->ea_ns->ns_number_of_addresses) {
+            res_log(NULL, LOG_DEBUG, "libsres: ""ea %p got shared response",
+                    ea);
+            ea->ea_response = w->w_response;
+            ea->ea_response_length = w->w_response_length;
+            ea->ea_which_address = w->w_which_address;
+            ea->ea_using_stream = w->w_using_stream;
+            w->w_response = NULL;
+            break;
+        }
+        /* couldn't use the response, send our own query */
+        _inflight_unpark(head);
+        break;
+
+    case INFLIGHT_FAILED:
+        res_log(NULL, LOG_DEBUG, "libsres: ""ea %p shared query failed", head);
+        res_io_cancel_all_remaining_attempts(head);
+        break;
+
+    default:
+        res_log(NULL, LOG_DEBUG, "libsres: ""ea %p sending own query", head);
+        _inflight_unpark(head);
+        break;
+    }
+
+    if (w->w_response)
+        FREE(w->w_response);
+    FREE(w);
+}
+
+/*
+ * Returns TRUE if there is something in this list's mailbox.
+ */
+static int
+_inflight_ready(struct expected_arrival *head)
+{
+    int             ready;
+
+    if (head == NULL || head->ea_waiter == NULL)
+        return FALSE;
+
+    pthread_mutex_lock(&inflight_mutex);
+    ready = (head->ea_waiter->w_state != INFLIGHT_WAITING);
+    pthread_mutex_unlock(&inflight_mutex);
+
+    return ready;
+}
+
+int
+res_io_coalesce_tid(int tid)
+{
+    int             ret_val = 0;
+
+    if ((tid < 0) || (tid >= MAX_TRANSACTIONS))
+        return 0;
+
+    pthread_mutex_lock(&mutex);
+    if (transactions[tid])
+        ret_val = res_io_coalesce(transactions[tid]);
+    pthread_mutex_unlock(&mutex);
+
+    return ret_val;
+}
+
 static void
 res_io_next_address(struct expected_arrival *ea,
                     const char *more_prefix, const char *no_more_str)
@@ -746,6 +1504,65 @@ res_io_next_address(struct expected_arrival *ea,
     }
     res_print_ea(ea);
 }
+
+/*
+ * Check a single expected arrival for sends, resends, timeouts and
+ * cancellations. now must be set. net_change is optional and is
+ * adjusted (not reset) by the change in the number of open sockets.
+ */
+static void
+_check_one_ea(struct expected_arrival *ea, struct timeval *next_evt,
+              struct timeval *now, int *net_change)
+{
+    /*
+     * check for timeouts. If there is another address, move to it
+     */
+    if ( LTEQ(ea->ea_cancel_time, (*now)) ||
+         ((0 == ea->ea_remaining_attempts) && LTEQ(ea->ea_next_try, (*now)))) {
+        if (net_change && ea->ea_socket != INVALID_SOCKET)
+            --(*net_change);
+        res_stats_inc(RES_STAT_TIMEOUTS);
+        if (1 != res_nsfallback_ea(ea, next_evt, NULL))
+            res_io_next_address(ea, "TIMEOUTS", "TIMEOUT - CANCELING");
+    }
+
+    /*
+     * send next try. on error, if there is another address, move to it
+     */
+    else if (LTEQ(ea->ea_next_try, (*now))) {
+        int needed_new_socket = (ea->ea_socket == INVALID_SOCKET);
+        int rc;
+        res_log(NULL, LOG_DEBUG, "libsres: "" retry");
+        while (ea->ea_remaining_attempts != -1) {
+            rc = res_io_send(ea);
+            if (rc == SR_IO_SOCKET_ERROR) {
+                res_io_next_address(ea, "ERROR",
+                                    "CANCELING DUE TO SENDING ERROR");
+            }
+            else if (rc == SR_IO_TOO_MANY_TRANS) {
+                /*
+                 * wait a little for a socket to be released, rather
+                 * than have every caller retry right away; the cancel
+                 * time is left alone.
+                 */
+                struct timeval wait = { 0, SR_IO_NOFILE_WAIT_USEC };
+                timeradd(now, &wait, &ea->ea_next_try);
+                if (timercmp(&ea->ea_next_try, &ea->ea_cancel_time, >))
+                    ea->ea_next_try = ea->ea_cancel_time;
+                res_io_timer_update(ea);
+                break;
+            }
+            else {
+                if (needed_new_socket) {
+                    if (net_change && ea->ea_socket != INVALID_SOCKET)
+                        ++(*net_change);
+                }
+                break; /* from while remaining attempts */
+            }
+        } /* while */
+    }
+}
+
 /*
  * net_change : optional pointer for returning the net change in the
  *              number of open/active sockets.
@@ -778,6 +1595,8 @@ res_io_check_ea_list(struct expected_arrival *ea, struct timeval *next_evt,
         res_log(NULL, LOG_DEBUG, "libsres: ""  Initial next event %ld.%ld",
                 next_evt->tv_sec, next_evt->tv_usec);
 
+    _inflight_collect(ea);
+
     for ( ; ea; ea = ea->ea_next ) {
         if (ea->ea_remaining_attempts == -1) {
             res_log(NULL, LOG_DEBUG, "libsres: "
@@ -791,37 +1610,7 @@ res_io_check_ea_list(struct expected_arrival *ea, struct timeval *next_evt,
         else
             ++no_sock;
 
-        /*
-         * check for timeouts. If there is another address, move to it
-         */
-        if ( LTEQ(ea->ea_cancel_time, (*now)) ||
-             ((0 == ea->ea_remaining_attempts) && LTEQ(ea->ea_next_try, (*now)))) {
-            if (net_change && ea->ea_socket != INVALID_SOCKET)
-                --(*net_change);
-            if (1 != res_nsfallback_ea(ea, next_evt, NULL))
-                res_io_next_address(ea, "TIMEOUTS", "TIMEOUT - CANCELING");
-        }
-
-        /*
-         * send next try. on error, if there is another address, move to it
-         */
-        else if (LTEQ(ea->ea_next_try, (*now))) {
-            int needed_new_socket = (ea->ea_socket == INVALID_SOCKET);
-            res_log(NULL, LOG_DEBUG, "libsres: "" retry");
-            while (ea->ea_remaining_attempts != -1) {
-                if (res_io_send(ea) == SR_IO_SOCKET_ERROR) {
-                    res_io_next_address(ea, "ERROR",
-                                        "CANCELING DUE TO SENDING ERROR");
-                }
-                else {
-                    if (needed_new_socket) {
-                        if (net_change && ea->ea_socket != INVALID_SOCKET)
-                            ++(*net_change);
-                    }
-                    break; /* from while remaining attempts */
-                }
-            } /* while */
-        }
+        _check_one_ea(ea, next_evt, now, net_change);
 
         /*
          * update next event
@@ -837,9 +1626,8 @@ res_io_check_ea_list(struct expected_arrival *ea, struct timeval *next_evt,
         }
     }
     if (next_evt) {
-        struct timeval  now,when;
-        gettimeofday(&now, NULL);
-        timersub(next_evt, &now, &when);
+        struct timeval  when;
+        timersub(next_evt, now, &when);
         if (when.tv_sec < 0) {
             when.tv_sec = when.tv_usec = 0;
         }
@@ -911,17 +1699,86 @@ res_io_check_one_tid(int tid, struct timeval *next_evt, struct timeval *now)
     return ret_val;
 }
 
+/*
+ * Run the checks for every scheduled expected arrival whose deadline has
+ * passed. Only the expired entries are visited; all of them are taken
+ * off the heap before any is processed, so that an entry which cannot
+ * make progress (e.g. too many open sockets) and goes back with the
+ * same deadline is not picked up again in this pass.
+ *
+ * assumes caller has mutex lock
+ */
+static void
+_expire_timers(struct timeval *next_evt, struct timeval *now)
+{
+    struct timeval  deadline;
+    struct expected_arrival *ea;
+    int             i, count;
+
+    if (timer_heap_count == 0)
+        return;
+
+    if (timer_expired_size < timer_heap_size) {
+        struct expected_arrival **bigger;
+
+        bigger = (struct expected_arrival **)
+            MALLOC(timer_heap_size * sizeof(struct expected_arrival *));
+        if (bigger == NULL) {
+            /*
+             * No room to take them all off first: handle the expired
+             * entries one at a time.  Each entry is visited at most
+             * once, and the pass ends at the first one that goes back
+             * still expired, since it would only come up again.
+             */
+            res_log(NULL, LOG_WARNING, "libsres: "
+                    "out of memory, checking expired timers one by one");
+            for (count = timer_heap_count; count > 0; count--) {
+                ea = timer_heap[0];
+                _ea_deadline(ea, &deadline);
+                if (!LTEQ(deadline, (*now)))
+                    break;
+                _timer_heap_remove(ea);
+                _check_one_ea(ea, next_evt, now, NULL);
+                _timer_heap_insert(ea);
+                _ea_deadline(ea, &deadline);
+                if (LTEQ(deadline, (*now)))
+                    break;
+            }
+            return;
+        }
+        if (timer_expired)
+            FREE(timer_expired);
+        timer_expired = bigger;
+        timer_expired_size = timer_heap_size;
+    }
+
+    count = 0;
+    while (timer_heap_count > 0) {
+        _ea_deadline(timer_heap[0], &deadline);
+        if (!LTEQ(deadline, (*now)))
+            break;
+        timer_expired[count++] = timer_heap[0];
+        _timer_heap_remove(timer_heap[0]);
+    }
+
+    /* re-inserting never needs more room than the entries just removed */
+    for (i = 0; i < count; i++) {
+        _check_one_ea(timer_expired[i], next_evt, now, NULL);
+        _timer_heap_insert(timer_expired[i]);
+    }
+}
+
 /*
  * for backwards compatability, this checks all transactions.
- * I'd like to have it call res_io_check_one_tid, but that'd
- * involve a mutex lock/unlock for each active transaction, which
- * seems wasteful...
+ * Only queries whose retry or cancel time has passed are visited;
+ * the next event is read off the top of the timer heap.
  */
 int
 res_io_check(int transaction_id, struct timeval *next_evt)
 {
-    int             i, ret_val;
+    int             ret_val;
     struct timeval  tv;
+    struct expected_arrival *ea;
 
     if ((NULL == next_evt) || (transaction_id < 0) ||
         (transaction_id >= MAX_TRANSACTIONS))
@@ -939,13 +1796,21 @@ res_io_check(int transaction_id, struct timeval *next_evt)
 
     pthread_mutex_lock(&mutex);
 
-    /** check all except specified transaction_id, ignore return */
-    for (i = 0; i < MAX_TRANSACTIONS; i++)
-        if ((i != transaction_id) && transactions[i])
-            _check_one_tid(i, next_evt, &tv);
+    _expire_timers(next_evt, &tv);
 
     /** check for remaining attempts for specified transaction */
-    ret_val = _check_one_tid(transaction_id, next_evt, &tv);
+    for (ea = transactions[transaction_id]; ea; ea = ea->ea_next) {
+        if (ea->ea_remaining_attempts != -1) {
+            ret_val = 1;
+            break;
+        }
+    }
+
+    if (timer_heap_count > 0 &&
+        timer_heap[0]->ea_remaining_attempts != -1) {
+        _ea_deadline(timer_heap[0], &tv);
+        UPDATE(next_evt, tv);
+    }
 
     pthread_mutex_unlock(&mutex);
 
@@ -989,6 +1854,19 @@ res_io_queue_ea(int *transaction_id, struct expected_arrival *new_ea)
         next_transaction = (try_index + 1) % MAX_TRANSACTIONS;
     }
 
+    /*
+     * Schedule the retry/cancel times for the new arrivals
+     */
+    for (temp = new_ea; temp; temp = temp->ea_next) {
+        if (_timer_heap_insert(temp) != SR_IO_UNSET) {
+            struct expected_arrival *undo;
+            for (undo = new_ea; undo != temp; undo = undo->ea_next)
+                _timer_heap_remove(undo);
+            pthread_mutex_unlock(&mutex);
+            return SR_IO_MEMORY_ERROR;
+        }
+    }
+
     /*
      * Register this request 
      */
@@ -1066,6 +1944,20 @@ res_io_select_info(struct expected_arrival *ea_list, int *nfds,
     else
         res_log(NULL, LOG_DEBUG, "libsres: "" ea %p select info",
                 ea_list);
+
+    /*
+     * A list joined to an in-flight query has no sockets of its own;
+     * wait for the leader to tell us something happened.
+     */
+    if (ea_list && ea_list->ea_waiter) {
+        int             fd = ea_list->ea_waiter->w_wake->wk_fd_r;
+
+        if (read_descriptors)
+            FD_SET(fd, read_descriptors);
+        if (nfds && (fd >= *nfds))
+            *nfds = fd + 1;
+    }
+
     /*
      * Find all sockets in use for a particular transaction chain of
      * expected arrivals
@@ -1225,6 +2117,12 @@ _clone_respondent(struct expected_arrival *ea,
                sizeof(struct sockaddr_storage));
     }
 
+    /** let the caller know that this server had to be reached over tcp */
+    if (ea->ea_using_stream)
+        (*respondent)->ns_options |= SR_QUERY_USE_TCP;
+    else
+        (*respondent)->ns_options &= ~SR_QUERY_USE_TCP;
+
     return SR_UNSET;
 }
 
@@ -1238,6 +2136,8 @@ res_io_get_a_response(struct expected_arrival *ea_list, u_char ** answer,
     struct expected_arrival *orig = ea_list;
     res_log(NULL,LOG_DEBUG,"libsres: "" checking for response for ea %p list",
             ea_list);
+
+    _inflight_collect(ea_list);
     for( ; ea_list; ea_list = ea_list->ea_next) {
 
         if (ea_list->ea_remaining_attempts != -1)
@@ -1286,6 +2186,9 @@ res_io_get_a_response(struct expected_arrival *ea_list, u_char ** answer,
             if (SR_UNSET != retval)
                 return retval;
 
+            if (orig->ea_inflight)
+                _inflight_distribute(orig, ea_list);
+
             ea_list->ea_response = NULL;
             ea_list->ea_response_length = 0;
             return SR_IO_GOT_ANSWER;
@@ -1385,6 +2288,8 @@ res_io_read_tcp(struct expected_arrival *arrival)
         res_io_reset_source(arrival);
         return SR_IO_SOCKET_ERROR;
     }
+    VAL_PROBE5(query_receive, arrival, arrival->ea_name, arrival->ea_type_h,
+               1, len_h);
     return SR_IO_UNSET;
 }
 
@@ -1464,6 +2369,8 @@ res_io_read_udp(struct expected_arrival *arrival)
 
     /* ret_val is greater than zero here */
     arrival->ea_response_length = ret_val;
+    VAL_PROBE5(query_receive, arrival, arrival->ea_name, arrival->ea_type_h,
+               0, arrival->ea_response_length);
     return SR_IO_UNSET;
 
   error:
@@ -1612,8 +2519,11 @@ res_io_read(fd_set * read_descriptors, struct expected_arrival *ea_list)
                 FREE(arrival->ea_response);
                 arrival->ea_response = NULL;
                 arrival->ea_response_length = 0;
+                res_stats_inc(RES_STAT_MISMATCHED);
                 continue;
             }
+            res_stats_inc(RES_STAT_RESPONSES);
+            res_stats_time(RES_HIST_RESPONSE, &arrival->ea_sent);
 
             /*
              * See if the message was truncated
@@ -1621,8 +2531,10 @@ res_io_read(fd_set * read_descriptors, struct expected_arrival *ea_list)
              * reinitialize source (just like we're beginning UDP)
              */
             if (!arrival->ea_using_stream
-                && ((HEADER *) arrival->ea_response)->tc)
+                && ((HEADER *) arrival->ea_response)->tc) {
+                res_stats_inc(RES_STAT_TCP_FALLBACKS);
                 res_switch_to_tcp(arrival);
+            }
         }
     }
     res_log(NULL,LOG_DEBUG,"libsres: ""   handled %d", handled);
@@ -1647,6 +2559,12 @@ res_io_accept(int transaction_id, fd_set *pending_desc,
 
     res_log(NULL, LOG_DEBUG, "libsres: ""Calling io_accept");
 
+    if (transaction_id >= 0 && transaction_id < MAX_TRANSACTIONS) {
+        pthread_mutex_lock(&mutex);
+        _inflight_collect(transactions[transaction_id]);
+        pthread_mutex_unlock(&mutex);
+    }
+
     /*
      * See what needs to be sent.  A return code of 0 means that there
      * is nothing more to be sent and there is also nothing to wait for.
@@ -1731,7 +2649,7 @@ res_io_accept(int transaction_id, fd_set *pending_desc,
 void
 res_cancel(int *transaction_id)
 {
-    struct expected_arrival *ea;
+    struct expected_arrival *ea, *t;
 
     if ((NULL == transaction_id) || (*transaction_id == -1))
         return;
@@ -1741,6 +2659,8 @@ res_cancel(int *transaction_id)
     pthread_mutex_lock(&mutex);
     ea = transactions[*transaction_id];
     transactions[*transaction_id] = NULL;
+    for (t = ea; t; t = t->ea_next)
+        _timer_heap_remove(t);
     pthread_mutex_unlock(&mutex);
 
     res_free_ea_list(ea);
@@ -1756,6 +2676,20 @@ res_io_cancel_all(void)
         j = i;
         res_cancel(&j);
     }
+
+    /* nothing is scheduled any more; release the timer heap */
+    pthread_mutex_lock(&mutex);
+    if (timer_heap_count == 0) {
+        if (timer_heap)
+            FREE(timer_heap);
+        timer_heap = NULL;
+        timer_heap_size = 0;
+    }
+    if (timer_expired)
+        FREE(timer_expired);
+    timer_expired = NULL;
+    timer_expired_size = 0;
+    pthread_mutex_unlock(&mutex);
 }
 
 void
@@ -1908,6 +2842,7 @@ res_async_query_send(const char *name, const u_int16_t type_h,
         res_async_query_create(name, type_h, class_h, pref_ns, 0);
 
     if (NULL != head) {
+        res_io_coalesce(head);
         ret_val = res_io_check_ea_list(head,NULL,NULL,NULL,NULL);
         res_log(NULL,LOG_DEBUG, "libsres: "" res_io_check_ea_list returned %d",
                 ret_val);
@@ -2001,6 +2936,8 @@ res_async_query_handle(struct expected_arrival *ea, int *handled, fd_set *fds)
     if (!ea || !handled || !fds)
         return SR_INTERNAL_ERROR;
 
+    _inflight_collect(ea);
+
     /*
      * React to any active desciptors and see if we got a response, or
      * if we at least still have an open socket (i.e. potential response).
@@ -2013,7 +2950,7 @@ res_async_query_handle(struct expected_arrival *ea, int *handled, fd_set *fds)
             ret_val = SR_UNSET;
             break;
         }
-        else if (ea->ea_socket != INVALID_SOCKET)
+        else if (ea->ea_socket != INVALID_SOCKET || ea->ea_waiter)
             ret_val = SR_NO_ANSWER_YET;
     }
 
@@ -2047,6 +2984,9 @@ res_async_ea_isset(struct expected_arrival *ea, fd_set *fds)
     if (NULL == ea || NULL == fds)
         return 0;
 
+    if (_inflight_ready(ea))
+        return 1;
+
     for (; ea; ea = ea->ea_next) {
         if (ea->ea_socket != INVALID_SOCKET &&
                 FD_ISSET(ea->ea_socket, fds))
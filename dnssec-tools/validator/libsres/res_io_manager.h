@@ -32,6 +32,7 @@
  * If getrlimit fails, we need some reasonable default.
  */
 #define SR_IO_NOFILE_RESERVED       10
+#define SR_IO_NOFILE_WAIT_USEC      100000 /* retry delay when out of sockets */
 #define SR_IO_NOFILE_UNKNOWN_SIZE  256
 
 /*
@@ -58,6 +59,22 @@ int             res_io_queue_ea(int *transaction_id,
                                 struct expected_arrival *new_ea);
 
 
+/*
+ * res_io_coalesce_tid
+ *
+ *   Joins a newly queued transaction to an identical query that is
+ *   already outstanding, so that it shares that query's response
+ *   instead of sending its own. Must be called before the transaction
+ *   is first checked.
+ *
+ * Return values
+ *
+ * 1                    The transaction was joined to another query
+ * 0                    The transaction will send its own queries
+ */
+int             res_io_coalesce_tid(int transaction_id);
+
+
 /*
  * res_io_accept
  * 
@@ -217,7 +234,8 @@ void            res_cancel(int *transaction_id);
 /*
  * res_io_cancel_all
  * 
- * Cancels all outstanding requests remaining for all transactions.
+ * Cancels all outstanding requests remaining for all transactions,
+ * and releases the memory used to schedule them.
  */
 void            res_io_cancel_all(void);
 
@@ -0,0 +1,298 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * Case-insensitive kernels over the bytes of wire-format names:
+ * lower-case copy, equality, canonical (memcmp on lower-cased bytes)
+ * ordering and hashing.  Only ASCII A-Z are folded, as RFC 4343
+ * requires.
+ *
+ * On x86 the kernels are vectorized with SSE2 and AVX2; the widest
+ * set the CPU supports is picked the first time a kernel is used.
+ * Elsewhere, or when built with VAL_NO_SIMD, portable scalar code is
+ * used.  All implementations return identical results, including the
+ * hash, so names hashed by different processes on the same machine
+ * agree.
+ */
+#include "validator-internal.h"
+
+#if !defined(VAL_NO_SIMD) && defined(__GNUC__) && \
+    (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define RES_NAME_HAVE_SSE2 1
+#include <emmintrin.h>
+#if (__GNUC__ >= 5) || defined(__clang__)
+#define RES_NAME_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+#define RES_NAME_FOLD(c) \
+    ((u_char) ((c) | ((((unsigned) (c) - 'A') < 26) << 5)))
+
+#define RES_NAME_K1     0x9E3779B97F4A7C15ULL
+#define RES_NAME_K2     0xC2B2AE3D27D4EB4FULL
+
+struct res_name_ops {
+    int             level;
+    void            (*lower) (u_char *, const u_char *, size_t);
+    size_t          (*mismatch) (const u_char *, const u_char *, size_t);
+};
+
+/*
+ * Scalar kernels
+ */
+
+static void
+_lower_scalar(u_char *dst, const u_char *src, size_t len)
+{
+    size_t          i;
+
+    for (i = 0; i < len; i++)
+        dst[i] = RES_NAME_FOLD(src[i]);
+}
+
+/*
+ * Index of the first byte that differs ignoring case, or len
+ */
+static size_t
+_mismatch_scalar(const u_char *a, const u_char *b, size_t len)
+{
+    size_t          i;
+
+    for (i = 0; i < len; i++) {
+        if (a[i] != b[i] && RES_NAME_FOLD(a[i]) != RES_NAME_FOLD(b[i]))
+            break;
+    }
+    return i;
+}
+
+#ifdef RES_NAME_HAVE_SSE2
+
+/*
+ * 'A'..'Z' become -128..-103 once shifted down by 'A' + 128, so one
+ * signed compare finds them
+ */
+static __inline__ __m128i
+_fold_sse2(__m128i x)
+{
+    __m128i         upper;
+
+    upper = _mm_cmplt_epi8(_mm_sub_epi8(x, _mm_set1_epi8((char) ('A' + 128))),
+                           _mm_set1_epi8((char) (-128 + 26)));
+    return _mm_or_si128(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+static void
+_lower_sse2(u_char *dst, const u_char *src, size_t len)
+{
+    size_t          i = 0;
+
+    for (; i + 16 <= len; i += 16)
+        _mm_storeu_si128((__m128i *) (dst + i),
+                         _fold_sse2(_mm_loadu_si128((const __m128i *)
+                                                    (src + i))));
+    _lower_scalar(dst + i, src + i, len - i);
+}
+
+static size_t
+_mismatch_sse2(const u_char *a, const u_char *b, size_t len)
+{
+    size_t          i = 0;
+    unsigned int    eq;
+
+    for (; i + 16 <= len; i += 16) {
+        eq = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                 _fold_sse2(_mm_loadu_si128((const __m128i *) (a + i))),
+                 _fold_sse2(_mm_loadu_si128((const __m128i *) (b + i)))));
+        if (eq != 0xffff)
+            return i + __builtin_ctz(~eq);
+    }
+    return i + _mismatch_scalar(a + i, b + i, len - i);
+}
+
+#endif /* RES_NAME_HAVE_SSE2 */
+
+#ifdef RES_NAME_HAVE_AVX2
+
+__attribute__ ((target("avx2")))
+static __inline__ __m256i
+_fold_avx2(__m256i x)
+{
+    __m256i         upper;
+
+    upper = _mm256_cmpgt_epi8(_mm256_set1_epi8((char) (-128 + 26)),
+                              _mm256_sub_epi8(x, _mm256_set1_epi8((char)
+                                                                  ('A' + 128))));
+    return _mm256_or_si256(x, _mm256_and_si256(upper,
+                                               _mm256_set1_epi8(0x20)));
+}
+
+__attribute__ ((target("avx2")))
+static void
+_lower_avx2(u_char *dst, const u_char *src, size_t len)
+{
+    size_t          i = 0;
+
+    for (; i + 32 <= len; i += 32)
+        _mm256_storeu_si256((__m256i *) (dst + i),
+                            _fold_avx2(_mm256_loadu_si256((const __m256i *)
+                                                          (src + i))));
+    /* the tail runs legacy SSE code; avoid the AVX transition stall */
+    _mm256_zeroupper();
+    _lower_sse2(dst + i, src + i, len - i);
+}
+
+__attribute__ ((target("avx2")))
+static size_t
+_mismatch_avx2(const u_char *a, const u_char *b, size_t len)
+{
+    size_t          i = 0;
+    unsigned int    eq;
+
+    for (; i + 32 <= len; i += 32) {
+        eq = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+                 _fold_avx2(_mm256_loadu_si256((const __m256i *) (a + i))),
+                 _fold_avx2(_mm256_loadu_si256((const __m256i *) (b + i)))));
+        if (eq != 0xffffffffU) {
+            _mm256_zeroupper();
+            return i + __builtin_ctz(~eq);
+        }
+    }
+    _mm256_zeroupper();
+    return i + _mismatch_sse2(a + i, b + i, len - i);
+}
+
+#endif /* RES_NAME_HAVE_AVX2 */
+
+static const struct res_name_ops name_ops_table[] = {
+    {RES_NAME_SCALAR, _lower_scalar, _mismatch_scalar},
+#ifdef RES_NAME_HAVE_SSE2
+    {RES_NAME_SSE2, _lower_sse2, _mismatch_sse2},
+#endif
+#ifdef RES_NAME_HAVE_AVX2
+    {RES_NAME_AVX2, _lower_avx2, _mismatch_avx2},
+#endif
+};
+
+#define RES_NAME_NOPS \
+    ((int) (sizeof(name_ops_table) / sizeof(name_ops_table[0])))
+
+/*
+ * Set once, on first use or by res_name_simd().  Every entry of the
+ * table gives the same results, so racing first users are harmless.
+ */
+static const struct res_name_ops *name_ops = NULL;
+
+static int
+_res_name_best(void)
+{
+    int             best = 0;
+
+#ifdef RES_NAME_HAVE_SSE2
+    best = 1;
+#endif
+#ifdef RES_NAME_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        best = 2;
+#endif
+    return best;
+}
+
+static const struct res_name_ops *
+_res_name_ops(void)
+{
+    if (name_ops == NULL)
+        name_ops = &name_ops_table[_res_name_best()];
+    return name_ops;
+}
+
+/*
+ * Select the kernels to use: RES_NAME_SCALAR, RES_NAME_SSE2 or
+ * RES_NAME_AVX2, limited to what this build and CPU support.  A level
+ * of -1 only queries.  Returns the level in effect.
+ */
+int
+res_name_simd(int level)
+{
+    int             best;
+
+    if (level >= 0) {
+        best = _res_name_best();
+        while (best > 0 && name_ops_table[best].level > level)
+            best--;
+        name_ops = &name_ops_table[best];
+    }
+    return _res_name_ops()->level;
+}
+
+/*
+ * Copy len bytes from src to dst, lower-casing A-Z.  dst may be src.
+ */
+void
+res_name_lower(u_char *dst, const u_char *src, size_t len)
+{
+    _res_name_ops()->lower(dst, src, len);
+}
+
+/*
+ * Return 1 if the len bytes at a and b are equal ignoring case
+ */
+int
+res_name_caseeq(const u_char *a, const u_char *b, size_t len)
+{
+    if (a == b)
+        return 1;
+    return _res_name_ops()->mismatch(a, b, len) == len;
+}
+
+/*
+ * memcmp() of the lower-cased bytes
+ */
+int
+res_name_casecmp(const u_char *a, const u_char *b, size_t len)
+{
+    size_t          i;
+
+    if (a == b)
+        return 0;
+    i = _res_name_ops()->mismatch(a, b, len);
+    if (i == len)
+        return 0;
+    return (int) RES_NAME_FOLD(a[i]) - (int) RES_NAME_FOLD(b[i]);
+}
+
+/*
+ * Hash of the lower-cased bytes.  The bytes are folded in blocks and
+ * mixed eight at a time; seed lets callers chain several calls.
+ */
+u_int32_t
+res_name_hash(const u_char *p, size_t len, u_int32_t seed)
+{
+    const struct res_name_ops *ops = _res_name_ops();
+    u_char          buf[64];
+    u_int64_t       h, w;
+    size_t          n, i;
+
+    h = ((u_int64_t) seed << 32 | seed) ^ (len * RES_NAME_K1);
+    while (len > 0) {
+        n = (len < sizeof(buf)) ? len : sizeof(buf);
+        ops->lower(buf, p, n);
+        /* zero-pad the last word of the block */
+        for (i = n; i % 8; i++)
+            buf[i] = 0;
+        for (i = 0; i < n; i += 8) {
+            memcpy(&w, &buf[i], sizeof(w));
+            h = (h ^ w) * RES_NAME_K2;
+            h ^= h >> 31;
+        }
+        p += n;
+        len -= n;
+    }
+    h ^= h >> 33;
+    h *= RES_NAME_K1;
+    h ^= h >> 29;
+    return (u_int32_t) (h ^ (h >> 32));
+}
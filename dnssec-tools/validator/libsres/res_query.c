@@ -288,6 +288,8 @@ query_send(const char *name,
     if (SR_UNSET != ret_val)
         return ret_val;
 
+    res_io_coalesce_tid(*trans_id);
+
     timerclear(&dummy);
     gettimeofday(&now, NULL);
     res_io_check_one_tid(*trans_id, &dummy, NULL);
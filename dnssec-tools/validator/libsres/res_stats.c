@@ -0,0 +1,182 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * Runtime statistics for libsres and libval: the counters and latency
+ * histograms listed in resolver.h.
+ *
+ * Each thread updates a block of its own, so recording a value takes
+ * no lock and no atomic read-modify-write; the only shared step is
+ * linking a new thread's block into the list of blocks, once.
+ * res_stats_get() adds up all the blocks.  When a thread exits, its
+ * counts are folded into a block kept for threads that are gone.
+ *
+ * Histogram bucket i counts latencies of up to 2^i microseconds, the
+ * last bucket also takes anything slower.
+ */
+#include "validator-internal.h"
+
+struct res_stats_block {
+    struct res_stats sb_stats;
+    struct res_stats_block *sb_next;
+};
+
+#ifndef VAL_NO_THREADS
+
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t stats_key;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static int      stats_key_ok = 0;
+static struct res_stats_block *stats_blocks = NULL;
+static struct res_stats stats_retired;
+
+/*
+ * Only the owning thread writes a block; snapshots may read it at
+ * any time, so single loads and stores must not tear
+ */
+#ifdef __ATOMIC_RELAXED
+#define STATS_LOAD(p)       __atomic_load_n((p), __ATOMIC_RELAXED)
+#define STATS_STORE(p, v)   __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#else
+#define STATS_LOAD(p)       (*(volatile u_int64_t *) (p))
+#define STATS_STORE(p, v)   (*(volatile u_int64_t *) (p) = (v))
+#endif
+
+static void
+_stats_sum(struct res_stats *total, struct res_stats *s)
+{
+    int             i, j;
+
+    for (i = 0; i < RES_STAT_COUNTERS; i++)
+        total->rs_counter[i] += STATS_LOAD(&s->rs_counter[i]);
+    for (i = 0; i < RES_HIST_COUNT; i++) {
+        for (j = 0; j < RES_HIST_BUCKETS; j++)
+            total->rs_hist[i][j] += STATS_LOAD(&s->rs_hist[i][j]);
+        total->rs_hist_sum[i] += STATS_LOAD(&s->rs_hist_sum[i]);
+    }
+}
+
+static void
+_stats_thread_exit(void *arg)
+{
+    struct res_stats_block *block = (struct res_stats_block *) arg;
+    struct res_stats_block **link;
+
+    pthread_mutex_lock(&stats_mutex);
+    for (link = &stats_blocks; *link; link = &(*link)->sb_next) {
+        if (*link == block) {
+            *link = block->sb_next;
+            break;
+        }
+    }
+    _stats_sum(&stats_retired, &block->sb_stats);
+    pthread_mutex_unlock(&stats_mutex);
+    FREE(block);
+}
+
+static void
+_stats_key_init(void)
+{
+    stats_key_ok = (0 == pthread_key_create(&stats_key, _stats_thread_exit));
+}
+
+static struct res_stats *
+_stats_mine(void)
+{
+    struct res_stats_block *block;
+
+    pthread_once(&stats_once, _stats_key_init);
+    if (!stats_key_ok)
+        return NULL;
+    block = (struct res_stats_block *) pthread_getspecific(stats_key);
+    if (block == NULL) {
+        block = (struct res_stats_block *)
+            MALLOC(sizeof(struct res_stats_block));
+        if (block == NULL)
+            return NULL;
+        memset(block, 0, sizeof(struct res_stats_block));
+        if (0 != pthread_setspecific(stats_key, block)) {
+            FREE(block);
+            return NULL;
+        }
+        pthread_mutex_lock(&stats_mutex);
+        block->sb_next = stats_blocks;
+        stats_blocks = block;
+        pthread_mutex_unlock(&stats_mutex);
+    }
+    return &block->sb_stats;
+}
+
+#else
+
+static struct res_stats stats_all;
+
+#define STATS_LOAD(p)       (*(p))
+#define STATS_STORE(p, v)   (*(p) = (v))
+#define _stats_mine()       (&stats_all)
+
+#endif
+
+void
+res_stats_add(int counter, u_int64_t n)
+{
+    struct res_stats *s;
+
+    if (counter < 0 || counter >= RES_STAT_COUNTERS ||
+        NULL == (s = _stats_mine()))
+        return;
+    STATS_STORE(&s->rs_counter[counter], s->rs_counter[counter] + n);
+}
+
+/*
+ * Record the time since start in a histogram
+ */
+void
+res_stats_time(int hist, struct timeval *start)
+{
+    struct res_stats *s;
+    struct timeval  now;
+    long long       usec;
+    int             b;
+
+    if (hist < 0 || hist >= RES_HIST_COUNT || start == NULL ||
+        NULL == (s = _stats_mine()))
+        return;
+
+    gettimeofday(&now, NULL);
+    usec = (long long) (now.tv_sec - start->tv_sec) * 1000000 +
+        (now.tv_usec - start->tv_usec);
+    if (usec < 0)
+        usec = 0;
+    for (b = 0; b < RES_HIST_BUCKETS - 1 && usec > (1LL << b); b++);
+
+    STATS_STORE(&s->rs_hist[hist][b], s->rs_hist[hist][b] + 1);
+    STATS_STORE(&s->rs_hist_sum[hist], s->rs_hist_sum[hist] + usec);
+}
+
+/*
+ * A snapshot of the statistics of all threads, past and present
+ */
+void
+res_stats_get(struct res_stats *stats)
+{
+    if (stats == NULL)
+        return;
+    memset(stats, 0, sizeof(struct res_stats));
+
+#ifndef VAL_NO_THREADS
+    {
+        struct res_stats_block *block;
+
+        pthread_mutex_lock(&stats_mutex);
+        _stats_sum(stats, &stats_retired);
+        for (block = stats_blocks; block; block = block->sb_next)
+            _stats_sum(stats, &block->sb_stats);
+        pthread_mutex_unlock(&stats_mutex);
+    }
+#else
+    memcpy(stats, &stats_all, sizeof(struct res_stats));
+#endif
+}
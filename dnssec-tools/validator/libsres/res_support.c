@@ -432,9 +432,6 @@ int
 label_bytes_cmp(const u_char * field1, size_t length1, 
                 const u_char * field2, size_t length2)
 {
-    u_char        buffer1[NS_MAXCDNAME];
-    u_char        buffer2[NS_MAXCDNAME];
-    size_t        i;
     size_t        min_len;
     int           ret_val;
 
@@ -448,22 +445,9 @@ label_bytes_cmp(const u_char * field1, size_t length1,
     min_len = (length1 < length2) ? length1 : length2;
 
     /*
-     * Compare this label's first min_len bytes 
+     * Compare this label's first min_len bytes, in lower case 
      */
-    /*
-     * Convert to lower case first 
-     */
-    memcpy(buffer1, field1, min_len);
-    for (i = 0; i < min_len; i++)
-        if (isupper(buffer1[i]))
-            buffer1[i] = tolower(buffer1[i]);
-
-    memcpy(buffer2, field2, min_len);
-    for (i = 0; i < min_len; i++)
-        if (isupper(buffer2[i]))
-            buffer2[i] = tolower(buffer2[i]);
-
-    ret_val = memcmp(buffer1, buffer2, min_len);
+    ret_val = res_name_casecmp(field1, field2, min_len);
 
     /*
      * If they differ, propgate that 
@@ -576,6 +560,12 @@ namecmp(const u_char * name1, const u_char * name2)
     for (; name2[index2]; index2 += (int) name2[index2] + 1)
         labels2++;
 
+    /*
+     * equal names need no label by label comparison 
+     */
+    if (index1 == index2 && res_name_caseeq(name1, name2, index1 + 1))
+        return 0;
+
     index1 = 0;
     index2 = 0;
 
@@ -0,0 +1,239 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * Per-resolution arenas.  Structures that only live as long as one
+ * resolution request (the query list for the request, the working
+ * result list, proof lists, glue dependency buckets, signature
+ * buffers, the trust point and zone cut names used while walking the
+ * chain of trust) are bump-allocated from the arena bound to that
+ * request and released in one go when the request finishes.  Anything that outlives
+ * the request -- cached rrsets, authentication chains, and the result
+ * chain handed back to the caller -- is still allocated on the heap.
+ *
+ * Each thread has a current arena, set with arena_enter() for as long
+ * as it works on a request.  arena_malloc() allocates from it, or from
+ * the heap when no arena is current.  arena_free() may be called on
+ * either kind of block; memory that belongs to an arena is reclaimed by
+ * arena_release() instead.
+ *
+ * An asynchronous request is worked on in several passes.  Each pass
+ * runs in a scratch arena that is released when the pass ends, so that
+ * the temporaries of one pass do not pile up in the request's arena
+ * until it completes.  The few structures that must last from one pass
+ * to the next (the query list) are allocated with arena_malloc_keep(),
+ * which takes them from the arena the scratch arena was set up for.
+ */
+#include "validator-internal.h"
+
+#include "val_arena.h"
+
+#define ARENA_CHUNK_SIZE    4096
+
+#define ARENA_ROUND(n) \
+    (((n) + sizeof(union val_arena_align) - 1) & \
+     ~(sizeof(union val_arena_align) - 1))
+
+struct val_arena_chunk {
+    struct val_arena_chunk *vc_next;
+    union val_arena_align vc_data[1];
+};
+
+#ifndef VAL_NO_THREADS
+static pthread_key_t arena_key;
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+static int      arena_key_ok = 0;
+
+static void
+_arena_key_init(void)
+{
+    arena_key_ok = (0 == pthread_key_create(&arena_key, NULL));
+}
+
+static struct val_arena *
+_arena_current(void)
+{
+    pthread_once(&arena_once, _arena_key_init);
+    return arena_key_ok ?
+        (struct val_arena *) pthread_getspecific(arena_key) : NULL;
+}
+
+static void
+_arena_set_current(struct val_arena *arena)
+{
+    pthread_once(&arena_once, _arena_key_init);
+    if (arena_key_ok)
+        pthread_setspecific(arena_key, arena);
+}
+#else
+static struct val_arena *arena_current = NULL;
+
+#define _arena_current()            (arena_current)
+#define _arena_set_current(arena)   (arena_current = (arena))
+#endif
+
+/*
+ * A zeroed arena is ready for use; this is just a convenience for
+ * arenas that are not allocated with calloc()
+ */
+void
+arena_init(struct val_arena *arena)
+{
+    if (arena)
+        memset(arena, 0, sizeof(struct val_arena));
+}
+
+/*
+ * Set up a scratch arena whose arena_malloc_keep() allocations come
+ * from keep
+ */
+void
+arena_init_scratch(struct val_arena *scratch, struct val_arena *keep)
+{
+    if (scratch) {
+        arena_init(scratch);
+        scratch->va_keep = keep;
+    }
+}
+
+/*
+ * Free all memory allocated from the arena.  The arena can be used
+ * again afterwards, and a scratch arena stays one.
+ */
+void
+arena_release(struct val_arena *arena)
+{
+    struct val_arena_chunk *chunk;
+
+    if (arena == NULL)
+        return;
+
+    while (arena->va_chunks) {
+        chunk = arena->va_chunks;
+        arena->va_chunks = chunk->vc_next;
+        FREE(chunk);
+    }
+    arena->va_block = NULL;
+    arena->va_size = 0;
+    arena->va_used = 0;
+}
+
+/*
+ * Carve size bytes out of the arena, adding a chunk if the current
+ * block is full.  Space left over in the old block is not reused.
+ */
+static void *
+_arena_bump(struct val_arena *arena, size_t size)
+{
+    struct val_arena_chunk *chunk;
+    size_t          csize;
+    u_char         *p;
+
+    size = ARENA_ROUND(size);
+
+    if (arena->va_block == NULL) {
+        arena->va_block = (u_char *) arena->va_inline;
+        arena->va_size = sizeof(arena->va_inline);
+        arena->va_used = 0;
+    }
+
+    if (arena->va_used + size > arena->va_size) {
+        csize = (size > ARENA_CHUNK_SIZE) ? size : ARENA_CHUNK_SIZE;
+        chunk = (struct val_arena_chunk *)
+            MALLOC(offsetof(struct val_arena_chunk, vc_data) + csize);
+        if (chunk == NULL)
+            return NULL;
+        chunk->vc_next = arena->va_chunks;
+        arena->va_chunks = chunk;
+        arena->va_block = (u_char *) chunk->vc_data;
+        arena->va_size = csize;
+        arena->va_used = 0;
+    }
+
+    p = arena->va_block + arena->va_used;
+    arena->va_used += size;
+    return p;
+}
+
+/*
+ * Make arena the current arena for this thread.  Returns the arena
+ * that was current before, which must be passed to arena_leave().
+ * arena may be NULL to make allocations go to the heap.
+ */
+struct val_arena *
+arena_enter(struct val_arena *arena)
+{
+    struct val_arena *prev = _arena_current();
+
+    _arena_set_current(arena);
+    return prev;
+}
+
+void
+arena_leave(struct val_arena *prev)
+{
+    _arena_set_current(prev);
+}
+
+/*
+ * Allocate size bytes from the current arena, or from the heap if there
+ * is none.  Each block is preceded by the arena it came from so that
+ * arena_free() can tell the two apart.
+ */
+void *
+arena_malloc(size_t size)
+{
+    struct val_arena *arena = _arena_current();
+    union val_arena_align *hdr;
+
+    if (arena)
+        hdr = (union val_arena_align *)
+            _arena_bump(arena, sizeof(union val_arena_align) + size);
+    else
+        hdr = (union val_arena_align *)
+            MALLOC(sizeof(union val_arena_align) + size);
+    if (hdr == NULL)
+        return NULL;
+
+    hdr->va_owner = arena;
+    return hdr + 1;
+}
+
+/*
+ * Allocate size bytes that must outlive the current arena if it is a
+ * scratch arena, from the arena it keeps such blocks in.  Otherwise
+ * this is arena_malloc().
+ */
+void *
+arena_malloc_keep(size_t size)
+{
+    struct val_arena *arena = _arena_current();
+    void           *p;
+
+    if (arena == NULL || arena->va_keep == NULL)
+        return arena_malloc(size);
+
+    _arena_set_current(arena->va_keep);
+    p = arena_malloc(size);
+    _arena_set_current(arena);
+    return p;
+}
+
+/*
+ * Free a block from arena_malloc().  Blocks that came from an arena are
+ * left for arena_release().
+ */
+void
+arena_free(void *ptr)
+{
+    union val_arena_align *hdr;
+
+    if (ptr == NULL)
+        return;
+
+    hdr = (union val_arena_align *) ptr - 1;
+    if (hdr->va_owner == NULL)
+        FREE(hdr);
+}
@@ -0,0 +1,18 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+#ifndef VAL_ARENA_H
+#define VAL_ARENA_H
+
+void            arena_init(struct val_arena *arena);
+void            arena_init_scratch(struct val_arena *scratch,
+                                   struct val_arena *keep);
+void            arena_release(struct val_arena *arena);
+struct val_arena *arena_enter(struct val_arena *arena);
+void            arena_leave(struct val_arena *prev);
+void           *arena_malloc(size_t size);
+void           *arena_malloc_keep(size_t size);
+void            arena_free(void *ptr);
+
+#endif
@@ -13,6 +13,11 @@
 #include "val_context.h"
 #include "val_assertion.h"
 #include "val_parse.h"
+#include "val_runtime.h"
+#include "val_names.h"
+#include "val_arena.h"
+#include "val_trace.h"
+#include "val_span.h"
 
 extern void res_print_ea(struct expected_arrival *ea);
 extern const char *p_query_status(int err);
@@ -30,11 +35,11 @@ extern const char *p_query_status(int err);
         size_t len1 = wire_name_length(label1);\
         size_t len2 = wire_name_length(label2);\
         u_char *catlabel;\
-        catlabel = (u_char *) MALLOC ((len1+len2-1) * sizeof (u_char));\
+        catlabel = (u_char *) arena_malloc((len1+len2-1) * sizeof (u_char));\
         if (catlabel != NULL) {\
             memcpy(catlabel, label1, len1);\
             memcpy(catlabel+len1-1, label2, len2);\
-            FREE(label2);\
+            arena_free(label2);\
             label2 = catlabel;\
         }\
     }\
@@ -88,6 +93,12 @@ extern const char *p_query_status(int err);
        ((queryflag & VAL_QFLAGS_CACHE_PREF_MASK) == (cacheflag & queryflag & VAL_QFLAGS_CACHE_PREF_MASK)))))
 
 
+static void _prefetch_check(val_context_t * context,
+                            struct val_query_chain *q, long now);
+#ifndef VAL_NO_THREADS
+static int _prefetch_schedule(val_context_t *context,
+                              struct val_query_chain *q);
+#endif
 static int _ask_cache_one(val_context_t * context,
                           struct queries_for_query **queries,
                           struct queries_for_query *next_q, int *data_received,
@@ -116,7 +127,7 @@ _free_w_results(struct val_internal_result *w_results)
      */
     while (w_res) {
         w_results = w_res->val_rc_next;
-        FREE(w_res);
+        arena_free(w_res);
         w_res = w_results;
     }
 }
@@ -199,7 +210,7 @@ val_free_authentication_chain_structure(struct val_authentication_chain *trust)
     if (NULL != trust->val_ac_trust) {
         // this ptr should be copied somewhere and cleared by the
         // caller to avoid this message.
-        val_log(NULL,LOG_WARNING,
+        VAL_LOG(NULL,LOG_WARNING,
                 "ac_trust not cleared in free_authentication_chain_structure");
     }
     FREE(trust);
@@ -220,7 +231,7 @@ val_free_result_chain(struct val_result_chain *results)
     if (NULL == results)
         return;
 
-    val_log(NULL, LOG_DEBUG, "rc %p free", results);
+    VAL_LOG(NULL, LOG_DEBUG, "rc %p free", results);
 
     while (NULL != (prev = results)) {
         results = results->val_rc_next;
@@ -286,8 +297,7 @@ init_query_chain_node(struct val_query_chain *q)
     if (q == NULL)
         return;
 
-    memcpy(q->qc_name_n, q->qc_original_name, 
-            wire_name_length(q->qc_original_name));
+    q->qc_name_n = name_ref(q->qc_original_name);
     q->qc_state = Q_INIT;
     q->qc_ttl_x = 0; 
     q->qc_bad = 0;
@@ -301,15 +311,22 @@ init_query_chain_node(struct val_query_chain *q)
     q->qc_ea = NULL;
     q->qc_ans = NULL;
     q->qc_proof = NULL;
+    q->qc_hits = 0;
+    q->qc_prefetch = 0;
+    q->qc_chain_prefetched = 0;
+    q->qc_trace_id = val_trace_next_id();
 }
 
 static void 
 _release_query_chain_structure(struct val_query_chain *queries)
 {
-    val_log(NULL, LOG_DEBUG, "qc %p release", queries);
+    VAL_LOG(NULL, LOG_DEBUG, "qc %p release", queries);
 
     val_res_cancel(queries);
 
+    name_release(queries->qc_name_n);
+    queries->qc_name_n = NULL;
+
     if (queries->qc_zonecut_n != NULL) {
         FREE(queries->qc_zonecut_n);
         queries->qc_zonecut_n = NULL;
@@ -353,8 +370,9 @@ free_query_chain_structure(struct val_query_chain *queries)
     if (NULL == queries)
        return;
 
-    val_log(NULL, LOG_DEBUG, "qc %p free", queries);
+    VAL_LOG(NULL, LOG_DEBUG, "qc %p free", queries);
     _release_query_chain_structure(queries);
+    name_release(queries->qc_original_name);
     FREE(queries);
 }
 
@@ -381,7 +399,7 @@ clear_query_chain_structure(struct val_query_chain *query)
 
 /*
  * Add {domain_name, type, class} to the list of queries currently active
- * for validating a response. 
+ * for validating a response. name_n must be an interned name.
  *
  * Returns:
  * VAL_NO_ERROR                 Operation succeeded
@@ -426,9 +444,10 @@ add_to_query_chain(val_context_t *context, u_char * name_n,
          */
         if (temp->qc_flags & VAL_QUERY_MARK_FOR_DELETION) {
             if (temp->qc_refcount == 0) {
-                if (-1 == ns_name_ntop(temp->qc_original_name, name_p, sizeof(name_p)))
+                if (VAL_LOG_ENABLED(LOG_INFO) &&
+                    -1 == ns_name_ntop(temp->qc_original_name, name_p, sizeof(name_p)))
                     snprintf(name_p, sizeof(name_p), "unknown/error");
-                val_log(context, LOG_INFO, "add_to_qfq_chain(): Deleting expired cache data: {%s %s(%d) %s(%d)}", 
+                VAL_LOG(context, LOG_INFO, "add_to_qfq_chain(): Deleting expired cache data: {%s %s(%d) %s(%d)}", 
                         name_p, p_class(temp->qc_class_h),
                         temp->qc_class_h, p_type(temp->qc_type_h),
                         temp->qc_type_h);
@@ -450,7 +469,7 @@ add_to_query_chain(val_context_t *context, u_char * name_n,
         if ((temp->qc_type_h == type_h)
             && (temp->qc_class_h == class_h)
             && (QUERY_FLAGS_MATCHING(temp->qc_flags, flags))
-            && (namecmp(temp->qc_original_name, name_n) == 0)) {
+            && (temp->qc_original_name == name_n)) {
 
             /* Invoke bad-cache logic only if validation is requested */
             if (temp->qc_bad > 0 && 
@@ -471,7 +490,8 @@ add_to_query_chain(val_context_t *context, u_char * name_n,
                 } 
             }
 
-            if (-1 == ns_name_ntop(temp->qc_original_name, name_p, sizeof(name_p)))
+            if (VAL_LOG_ENABLED(LOG_DEBUG) &&
+                -1 == ns_name_ntop(temp->qc_original_name, name_p, sizeof(name_p)))
                 snprintf(name_p, sizeof(name_p), "unknown/error");
 
             if (temp->qc_state >= Q_ANSWERED && 
@@ -488,7 +508,7 @@ add_to_query_chain(val_context_t *context, u_char * name_n,
                     context->g_opt->max_refresh < (tv.tv_sec - temp->qc_last_sent)))) { 
 
                 /* Remove this data at the next safe opportunity */ 
-                val_log(context, LOG_DEBUG,
+                VAL_LOG(context, LOG_DEBUG,
                         "ask_cache(): Forcing expiry of {%s %s(%d) %s(%d)}, flags=%x, now=%ld exp=%ld",
                         name_p, p_class(temp->qc_class_h),
                         temp->qc_class_h, p_type(temp->qc_type_h),
@@ -501,12 +521,14 @@ add_to_query_chain(val_context_t *context, u_char * name_n,
                 temp->qc_flags |= VAL_QUERY_MARK_FOR_DELETION;
 
             } else {
-                val_log(context, LOG_DEBUG, 
+                VAL_LOG(context, LOG_DEBUG, 
                         "add_to_qfq_chain(): Found query in cache: {%s %s(%d) %s(%d)}, state: %d, flags = %x exp in: %ld", 
                         name_p, p_class(temp->qc_class_h),
                         temp->qc_class_h, p_type(temp->qc_type_h),
                         temp->qc_type_h, temp->qc_state, temp->qc_flags,
                         temp->qc_ttl_x > tv.tv_sec ? (temp->qc_ttl_x - tv.tv_sec) : -1);
+                temp->qc_hits++;
+                _prefetch_check(context, temp, tv.tv_sec);
                 /* return this cached record */
                 *added_q = temp;
                 return VAL_NO_ERROR;
@@ -522,11 +544,12 @@ add_to_query_chain(val_context_t *context, u_char * name_n,
         return VAL_OUT_OF_MEMORY;
 
     temp->qc_refcount = 0;
-    memcpy(temp->qc_original_name, name_n, wire_name_length(name_n));
+    temp->qc_original_name = name_ref(name_n);
     temp->qc_type_h = type_h;
     temp->qc_class_h = class_h;
     temp->qc_flags = flags | sticky_flags;
     temp->qc_last_sent = -1;
+    temp->qc_created = tv.tv_sec;
 
     init_query_chain_node(temp);
     
@@ -550,7 +573,7 @@ remove_and_free_query_chain(val_context_t *context,
     if ((NULL == context) || (added_q == NULL))
         return VAL_BAD_ARGUMENT;
 
-    val_log(context, LOG_DEBUG, "qc %p remove/free", added_q);
+    VAL_LOG(context, LOG_DEBUG, "qc %p remove/free", added_q);
 
     ASSERT_HAVE_AC_LOCK(context);
 
@@ -591,6 +614,9 @@ free_authentication_chain_structure(struct val_digested_auth_chain *assertions)
         res_sq_free_rrset_recs(&(assertions->val_ac_rrset.ac_data));
 }
 
+/*
+ * name_n must be an interned name
+ */
 static struct queries_for_query * 
 check_in_qfq_chain(val_context_t *context, struct queries_for_query **queries, 
                  u_char * name_n, const u_int16_t type_h, const u_int16_t class_h, 
@@ -607,7 +633,7 @@ check_in_qfq_chain(val_context_t *context, struct queries_for_query **queries,
         if ((temp->qfq_query->qc_type_h == type_h)
             && (temp->qfq_query->qc_class_h == class_h)
             && (QUERY_FLAGS_MATCHING(temp->qfq_flags, flags))
-            && (namecmp(temp->qfq_query->qc_original_name, name_n) == 0)) {
+            && (temp->qfq_query->qc_original_name == name_n)) {
 #ifdef LIBVAL_DLV
             if (type_h == ns_t_dlv) {
                 int matches = 0;
@@ -617,9 +643,10 @@ check_in_qfq_chain(val_context_t *context, struct queries_for_query **queries,
                     matches) {
 
                     char name_p[NS_MAXDNAME];
-                    if (-1 == ns_name_ntop(name_n, name_p, sizeof(name_p)))
+                    if (VAL_LOG_ENABLED(LOG_DEBUG) &&
+                        -1 == ns_name_ntop(name_n, name_p, sizeof(name_p)))
                         snprintf(name_p, sizeof(name_p), "unknown/error");
-                    val_log(context, LOG_DEBUG, 
+                    VAL_LOG(context, LOG_DEBUG, 
                             "add_to_query_chain(): Found matching proof of non-existence for {%s %s(%d) %s(%d)} through ANC",
                             name_p, p_class(class_h), class_h, p_type(type_h),
                             type_h);
@@ -670,6 +697,7 @@ add_to_qfq_chain(val_context_t *context, struct queries_for_query **queries,
     struct queries_for_query *new_qfq = NULL;
     /* use only those flags that affect caching */
     struct val_query_chain *added_q = NULL;
+    u_char *iname;
     int retval;
     
     /*
@@ -680,21 +708,27 @@ add_to_qfq_chain(val_context_t *context, struct queries_for_query **queries,
 
     *added_qfq = NULL;
 
+    /* interned names can be compared by address */
+    if (NULL == (iname = name_intern(name_n)))
+        return wire_name_length(name_n) ? VAL_OUT_OF_MEMORY : VAL_BAD_ARGUMENT;
+
     /*
      * Check if query already exists 
      */
-    new_qfq = check_in_qfq_chain(context, queries, name_n, type_h, class_h, flags); 
+    new_qfq = check_in_qfq_chain(context, queries, iname, type_h, class_h, flags); 
     if (new_qfq == NULL) {
         /*
          * Add to the cache and to the qfq chain 
          */
-        if (VAL_NO_ERROR !=
-                (retval =
-                    add_to_query_chain(context, name_n, type_h, class_h,
-                                    flags, &added_q)))
+        retval = add_to_query_chain(context, iname, type_h, class_h,
+                                    flags, &added_q);
+        name_release(iname);
+        if (VAL_NO_ERROR != retval)
             return retval;
 
-        new_qfq = (struct queries_for_query *) MALLOC (sizeof(struct queries_for_query));
+        /* the query list lasts until the request completes */
+        new_qfq = (struct queries_for_query *)
+            arena_malloc_keep(sizeof(struct queries_for_query));
         if (new_qfq == NULL) {
             return VAL_OUT_OF_MEMORY;
         }
@@ -702,9 +736,11 @@ add_to_qfq_chain(val_context_t *context, struct queries_for_query **queries,
         added_q->qc_refcount++;
         new_qfq->qfq_query = added_q;
         new_qfq->qfq_flags = flags;
+        new_qfq->qfq_sent = 0;
         new_qfq->qfq_next = *queries;
         *queries = new_qfq;
-    } 
+    } else
+        name_release(iname);
     
     *added_qfq = new_qfq;
        
@@ -749,7 +785,7 @@ free_qfq_chain(val_context_t *context, struct queries_for_query *queries)
         queries->qfq_query->qc_refcount--;
     }
 
-    FREE(queries);
+    arena_free(queries);
     /* 
      * The val_query_chain that this qfq element points to 
      * is part of the context cache and will be freed when the
@@ -812,16 +848,16 @@ find_dlv_trust_point(val_context_t * ctx, u_char * zone_n,
                 if (!tp)
                     continue;
                 len = wire_name_length(tp);
-                *dlv_tp = (u_char *) MALLOC(len * sizeof(u_char));
+                *dlv_tp = (u_char *) arena_malloc(len * sizeof(u_char));
                 if (*dlv_tp == NULL)
                     return VAL_OUT_OF_MEMORY;
                 memcpy(*dlv_tp, tp, len);
     
                 len = wire_name_length(zp);
                 *dlv_target =
-                    (u_char *) MALLOC(len * sizeof(u_char));
+                    (u_char *) arena_malloc(len * sizeof(u_char));
                 if (*dlv_target == NULL) {
-                    FREE(*dlv_tp);
+                    arena_free(*dlv_tp);
                     *dlv_tp = NULL;
                     return VAL_OUT_OF_MEMORY;
                 }
@@ -843,7 +879,9 @@ find_dlv_trust_point(val_context_t * ctx, u_char * zone_n,
     return VAL_NO_ERROR;
 }
 
-/* replace s in name_n with d */
+/* 
+ * replace s in name_n with d; *new_name is allocated with arena_malloc() 
+ */
 int 
 replace_name_in_name(u_char *name_n,
                      u_char *s,
@@ -871,7 +909,7 @@ replace_name_in_name(u_char *name_n,
     *p = '\0'; /* temporarily */
 
     if (name_n && d) {
-        *new_name = (u_char *) MALLOC ((len1+len2-1) * sizeof (u_char));
+        *new_name = (u_char *) arena_malloc((len1+len2-1) * sizeof (u_char));
         if (*new_name == NULL) {
             return VAL_OUT_OF_MEMORY;
         }
@@ -973,6 +1011,11 @@ done:
     return retval;
 }
 
+/*
+ * Find the closest trust anchor at or above zone_n.  The name returned
+ * in *matched_zone is allocated with arena_malloc() and must be
+ * released with arena_free().
+ */
 int
 find_trust_point(val_context_t * ctx, u_char * zone_n, 
                  u_char ** matched_zone, u_int32_t *ttl_x)
@@ -1023,7 +1066,7 @@ find_trust_point(val_context_t * ctx, u_char * zone_n,
                 len = wire_name_length(zp);
                 /** We have hope */
                 *matched_zone =
-                   (u_char *) MALLOC( len * sizeof(u_char));
+                   (u_char *) arena_malloc( len * sizeof(u_char));
                 if (*matched_zone == NULL) {
                     return VAL_OUT_OF_MEMORY;
                 }
@@ -1073,7 +1116,7 @@ is_trusted_key(val_context_t * ctx, u_char * zone_n, struct rrset_rr *key,
 
     RETRIEVE_POLICY(ctx, P_TRUST_ANCHOR, ta_pol);
     if (ta_pol == NULL) {
-        val_log(ctx, LOG_INFO, "is_trusted_key(): No trust anchor policy available"); 
+        VAL_LOG(ctx, LOG_INFO, "is_trusted_key(): No trust anchor policy available"); 
         *status = VAL_AC_NO_LINK;
         return VAL_NO_ERROR;
     }
@@ -1104,7 +1147,7 @@ is_trusted_key(val_context_t * ctx, u_char * zone_n, struct rrset_rr *key,
                  */
                 if (VAL_NO_ERROR != val_parse_dnskey_rdata(curkey->rr_rdata,
                                        curkey->rr_rdata_length, &dnskey)) {
-                    val_log(ctx, LOG_INFO, "is_trusted_key(): could not parse DNSKEY");
+                    VAL_LOG(ctx, LOG_INFO, "is_trusted_key(): could not parse DNSKEY");
                     continue;
                 }
 
@@ -1122,12 +1165,13 @@ is_trusted_key(val_context_t * ctx, u_char * zone_n, struct rrset_rr *key,
                                                zp, curkey, &tmp_status))) {
 
                         char            name_p[NS_MAXDNAME];
-                        if (-1 == ns_name_ntop(zp, name_p, sizeof(name_p)))
+                        if (VAL_LOG_ENABLED(LOG_DEBUG) &&
+                            -1 == ns_name_ntop(zp, name_p, sizeof(name_p)))
                             snprintf(name_p, sizeof(name_p), "unknown/error");
                         curkey->rr_status = VAL_AC_TRUST_POINT;
                         if (ta_cur->exp_ttl > 0)
                             *ttl_x = ta_cur->exp_ttl;
-                        val_log(ctx, LOG_DEBUG, "is_trusted_key(): key %s is trusted", name_p);
+                        VAL_LOG(ctx, LOG_DEBUG, "is_trusted_key(): key %s is trusted", name_p);
                         found = 1;
                     } 
                 }
@@ -1146,7 +1190,7 @@ is_trusted_key(val_context_t * ctx, u_char * zone_n, struct rrset_rr *key,
             return VAL_NO_ERROR;
         }
 
-        val_log(ctx, LOG_INFO,
+        VAL_LOG(ctx, LOG_INFO,
                 "is_trusted_key(): Existing trust anchor did not match at this level: %s", zp);
         if (ctx->g_opt && ctx->g_opt->closest_ta_only) {
 #ifdef LIBVAL_DLV
@@ -1196,7 +1240,7 @@ is_trusted_key(val_context_t * ctx, u_char * zone_n, struct rrset_rr *key,
     }
 #endif
     
-    val_log(ctx, LOG_INFO,
+    VAL_LOG(ctx, LOG_INFO,
             "is_trusted_key(): Cannot find a good trust anchor for the chain of trust above %s",
             zp);
     *status = VAL_AC_NO_LINK;
@@ -1475,6 +1519,84 @@ add_to_authentication_chain(struct val_digested_auth_chain **assertions,
     return VAL_NO_ERROR;
 }
 
+/*
+ * Like add_to_authentication_chain(), but takes over the rrsets in
+ * *rrsets instead of copying them; *rrsets is left empty on success.
+ * Views of cached rrsets stay views, but their headers are moved to
+ * the heap since the query chain outlives the current arena; see
+ * unshare_assertion() for when they are copied.
+ */
+static int
+move_to_authentication_chain(struct val_digested_auth_chain **assertions,
+                             struct val_query_chain *matched_q,
+                             struct rrset_rec **rrsets)
+{
+    struct val_digested_auth_chain *new_as, *first_as, *last_as;
+    struct rrset_rec *next_rr, *view, **link;
+    struct val_arena *prev;
+
+    if (NULL == assertions || matched_q == NULL || rrsets == NULL)
+        return VAL_BAD_ARGUMENT;
+
+    for (link = rrsets; *link; link = &(*link)->rrs_next) {
+        if ((*link)->rrs_shared == NULL)
+            continue;
+        prev = arena_enter(NULL);
+        view = view_rrset_rec((*link)->rrs_shared, (*link)->rrs_ttl_h);
+        arena_leave(prev);
+        if (view == NULL)
+            return VAL_OUT_OF_MEMORY;
+        view->rrs_next = (*link)->rrs_next;
+        (*link)->rrs_next = NULL;
+        res_sq_free_rrset_recs(link);
+        *link = view;
+    }
+
+    first_as = NULL;
+    last_as = NULL;
+
+    while (NULL != (next_rr = *rrsets)) {
+
+        new_as = (struct val_digested_auth_chain *)
+            MALLOC(sizeof(struct val_digested_auth_chain));
+        if (new_as == NULL) {
+            if (first_as) {
+                last_as->val_ac_rrset.val_ac_next = NULL;
+                free_authentication_chain(first_as);
+            }
+            return VAL_OUT_OF_MEMORY;
+        }
+
+        *rrsets = next_rr->rrs_next;
+        next_rr->rrs_next = NULL;
+        /* as for a copy */
+        next_rr->rrs_cred = SR_CRED_UNSET;
+        next_rr->rrs_ans_kind = SR_ANS_UNSET;
+
+        new_as->val_ac_rrset.ac_data = next_rr;
+        new_as->val_ac_rrset.val_ac_rrset_next = NULL;
+        new_as->val_ac_rrset.val_ac_next = NULL;
+        new_as->val_ac_status = VAL_AC_INIT;
+        new_as->val_ac_query = matched_q;
+
+        SET_MIN_TTL(matched_q->qc_ttl_x, next_rr->rrs_ttl_x);
+
+        if (last_as != NULL) {
+            last_as->val_ac_rrset.val_ac_rrset_next = new_as;
+            last_as->val_ac_rrset.val_ac_next = new_as;
+        } else {
+            first_as = new_as;
+        }
+        last_as = new_as;
+    }
+    if (first_as) {
+        last_as->val_ac_rrset.val_ac_next = *assertions;
+        *assertions = first_as;
+    }
+
+    return VAL_NO_ERROR;
+}
+
 /*
  * Free up the authentication chain.
  */
@@ -1536,6 +1658,9 @@ build_pending_query(val_context_t *context,
      */
     ttl_x = 0;
     if (as->val_ac_rrset.ac_data->rrs_type_h == ns_t_dnskey) {
+        /* trusted keys are marked as such */
+        if (VAL_NO_ERROR != (retval = unshare_assertion(as)))
+            return retval;
         if (VAL_NO_ERROR !=
             (retval =
              is_trusted_key(context, as->val_ac_rrset.ac_data->rrs_name_n,
@@ -1611,6 +1736,9 @@ build_pending_query(val_context_t *context,
     }
 #endif
     
+    if (VAL_NO_ERROR != (retval = unshare_assertion(as)))
+        return retval;
+
     cur_rr = as->val_ac_rrset.ac_data->rrs_sig;
     while (cur_rr) {
         /*
@@ -1842,9 +1970,9 @@ assimilate_answers(val_context_t * context,
 
         if (VAL_NO_ERROR !=
             (retval =
-             add_to_authentication_chain(&assertions,
-                                         matched_q,
-                                         response->di_answers)))
+             move_to_authentication_chain(&assertions,
+                                          matched_q,
+                                          &response->di_answers)))
             return retval;
         /*
          * Link the assertion to the query
@@ -1866,7 +1994,8 @@ assimilate_answers(val_context_t * context,
 
         if (VAL_NO_ERROR !=
             (retval =
-             add_to_authentication_chain(&assertions, matched_q, response->di_proofs)))
+             move_to_authentication_chain(&assertions, matched_q,
+                                          &response->di_proofs)))
             return retval;
 
         /*
@@ -2032,10 +2161,10 @@ get_ac_trust(val_context_t *context,
             has_tp = 1;
         }
         if (dlv_tp != NULL) {
-            FREE(dlv_tp);
+            arena_free(dlv_tp);
         }
         if (dlv_target != NULL) {
-            FREE(dlv_target);
+            arena_free(dlv_target);
         }
         if (has_tp == 0) {
             return NULL;
@@ -2054,7 +2183,7 @@ get_ac_trust(val_context_t *context,
             return NULL; 
         } 
         SET_MIN_TTL(next_as->val_ac_query->qc_ttl_x, ttl_x);
-        FREE(curzone_n);
+        arena_free(curzone_n);
     }
     /*
      * Then look for  {zonecut, DNSKEY/DS, type} 
@@ -2294,7 +2423,7 @@ transform_outstanding_results(val_context_t *context,
         if (!w_res->val_rc_consumed) {
 
             if (w_res->val_rc_is_proof && !val_istrusted(proof_status)) {
-                val_log(context, LOG_INFO, 
+                VAL_LOG(context, LOG_INFO, 
                         "transform_outstanding_results(): Discarding untrusted proof of non-existence");
             } else if (VAL_NO_ERROR !=
                 (retval =
@@ -2371,7 +2500,7 @@ prove_nsec_span(val_context_t *ctx, struct nsecprooflist *nlist,
             nsec_bit_field = wire_name_length(nxtname);
 
             if (nsec_bit_field > n->the_set->rrs_data->rr_rdata_length) {
-                val_log(ctx, LOG_INFO, "prove_nsec_span(): Bad NSEC offset");
+                VAL_LOG(ctx, LOG_INFO, "prove_nsec_span(): Bad NSEC offset");
                 continue;
             }
             
@@ -2383,7 +2512,7 @@ prove_nsec_span(val_context_t *ctx, struct nsecprooflist *nlist,
             if (qtype_h == ns_t_ds && 
                 !(is_type_set((&(n->the_set->rrs_data->
                                 rr_rdata[nsec_bit_field])), offset, ns_t_ns))) {
-                val_log(ctx, LOG_INFO, 
+                VAL_LOG(ctx, LOG_INFO, 
                         "prove_nsec_span(): NSEC error - NS must be set for DS type non-existence");
                 continue;
             
@@ -2395,7 +2524,7 @@ prove_nsec_span(val_context_t *ctx, struct nsecprooflist *nlist,
             if (qtype_h == ns_t_ds &&
                 (is_type_set((&(n->the_set->rrs_data->
                                 rr_rdata[nsec_bit_field])), offset, ns_t_soa))) {
-                val_log(ctx, LOG_INFO, 
+                VAL_LOG(ctx, LOG_INFO, 
                         "prove_nsec_span(): NSEC error - SOA bit must not be set for DS type non-existence");
                 continue;
             }
@@ -2403,19 +2532,19 @@ prove_nsec_span(val_context_t *ctx, struct nsecprooflist *nlist,
             if (is_type_set((&(n->the_set->rrs_data->
                             rr_rdata[nsec_bit_field])), offset, qtype_h)) { 
                 // Type exists at NSEC record
-                val_log(ctx, LOG_INFO, "prove_nsec_span(): NSEC error - type exists at wildcard");
+                VAL_LOG(ctx, LOG_INFO, "prove_nsec_span(): NSEC error - type exists at wildcard");
                 continue;
             }
             if (is_type_set((&(n->the_set->rrs_data->
                       rr_rdata[nsec_bit_field])), offset, ns_t_cname)) { 
                 // CNAME exists at NSEC record, but was not checked
-                val_log(ctx, LOG_INFO, "prove_nsec_span(): NSEC error - CNAME exists at wildcard");
+                VAL_LOG(ctx, LOG_INFO, "prove_nsec_span(): NSEC error - CNAME exists at wildcard");
                 continue;
             }
             if (is_type_set((&(n->the_set->rrs_data->
                       rr_rdata[nsec_bit_field])), offset, ns_t_dname)) {
                 //DNAME exists at NSEC record, but was not checked 
-                val_log(ctx, LOG_INFO, "prove_nsec_span(): NSEC error - DNAME exists at wildcard");
+                VAL_LOG(ctx, LOG_INFO, "prove_nsec_span(): NSEC error - DNAME exists at wildcard");
                 continue;
             }
 
@@ -2469,7 +2598,7 @@ prove_nsec_span(val_context_t *ctx, struct nsecprooflist *nlist,
 
     /* Check for wildcard proof */
     if (NS_MAXCDNAME < wire_name_length(ce) + 2) {
-        val_log(ctx, LOG_INFO,
+        VAL_LOG(ctx, LOG_INFO,
                 "prove_nsec_span(): NSEC3 Error - label length with wildcard exceeds bounds");
         return;
     }
@@ -2564,7 +2693,7 @@ nsec_proof_chk(val_context_t * ctx, struct val_internal_result *w_results,
         if (namecmp(soa_name_n, closest_zc))
             continue;
 
-        n = (struct nsecprooflist *) MALLOC (sizeof(struct nsecprooflist));
+        n = (struct nsecprooflist *) arena_malloc(sizeof(struct nsecprooflist));
         if (n == NULL) {
             retval = VAL_OUT_OF_MEMORY;
             goto err;
@@ -2580,10 +2709,10 @@ nsec_proof_chk(val_context_t * ctx, struct val_internal_result *w_results,
 
 
     if (!span) {
-        val_log(ctx, LOG_INFO, "nsec_proof_chk() : Incomplete Proof - Proof does not cover span");
+        VAL_LOG(ctx, LOG_INFO, "nsec_proof_chk() : Incomplete Proof - Proof does not cover span");
         *status = VAL_INCOMPLETE_PROOF;
     } else if (!wcard) {
-        val_log(ctx, LOG_INFO, "nsec_proof_chk(): Incomplete Proof - Cannot prove wildcard non-existence");
+        VAL_LOG(ctx, LOG_INFO, "nsec_proof_chk(): Incomplete Proof - Cannot prove wildcard non-existence");
         *status = VAL_INCOMPLETE_PROOF;
     } else if (notype) {
         *status = VAL_NONEXISTENT_TYPE;
@@ -2634,7 +2763,7 @@ nsec_proof_chk(val_context_t * ctx, struct val_internal_result *w_results,
     while (nlist) {
         n = nlist;
         nlist = n->next;
-        FREE(n);
+        arena_free(n);
     }
     return retval;
 }
@@ -2652,6 +2781,7 @@ compute_nsec3_hash(val_context_t * ctx, u_char * qname_n,
     char            name_p[NS_MAXDNAME];
     size_t          hashlen;
     u_char         *hash;
+    struct timeval  hash_start;
 
     if (alg != ALG_NSEC3_HASH_SHA1)
         return NULL;
@@ -2712,9 +2842,11 @@ compute_nsec3_hash(val_context_t * ctx, u_char * qname_n,
         }
     }
 
-    if (NULL ==
-        nsec3_sha_hash_compute(qname_n, salt, (size_t)saltlen, 
-                               (size_t)iter, &hash, &hashlen))
+    SPAN_BEGIN(&hash_start);
+    nsec3_sha_hash_compute(qname_n, salt, (size_t)saltlen, 
+                           (size_t)iter, &hash, &hashlen);
+    SPAN_END(VAL_SPAN_NSEC3_HASH, &hash_start);
+    if (hash == NULL)
         return NULL;
 
     base32hex_encode(hash, hashlen, b32_hash, b32_hashlen);
@@ -2773,7 +2905,7 @@ prove_nsec3_span(val_context_t *ctx, struct nsec3prooflist *nlist,
             if (NULL == compute_nsec3_hash(ctx, cp, soa_name_n, n->nd.alg,
                                    n->nd.iterations, n->nd.saltlen, n->nd.salt,
                                    &hashlen, &hash, ttl_x)) {
-                val_log(ctx, LOG_INFO, "prove_nsec3_span(): NSEC3 error - Cannot compute hash with given params");
+                VAL_LOG(ctx, LOG_INFO, "prove_nsec3_span(): NSEC3 error - Cannot compute hash with given params");
                 continue;
             }
 
@@ -2800,7 +2932,7 @@ prove_nsec3_span(val_context_t *ctx, struct nsec3prooflist *nlist,
                                 !(is_type_set((&(n->the_set->rrs_data->
                                 rr_rdata[n->nd.bit_field])), nsec3_bm_len, ns_t_ns))) {
 
-                           val_log(ctx, LOG_INFO, 
+                           VAL_LOG(ctx, LOG_INFO, 
                                    "prove_nsec3_span(): NSEC3 error - NS must be set for DS type non-existence");
                            FREE(hash);
                            continue;
@@ -2812,7 +2944,7 @@ prove_nsec3_span(val_context_t *ctx, struct nsec3prooflist *nlist,
                        if (qtype_h == ns_t_ds &&
                                is_type_set((&(n->the_set->rrs_data->
                                 rr_rdata[n->nd.bit_field])), nsec3_bm_len, ns_t_soa)) {
-                           val_log(ctx, LOG_INFO, 
+                           VAL_LOG(ctx, LOG_INFO, 
                                    "prove_nsec3_span(): NSEC3 error - SOA bit must not be set for DS type non-existence");
                            FREE(hash);
                            continue;
@@ -2820,21 +2952,21 @@ prove_nsec3_span(val_context_t *ctx, struct nsec3prooflist *nlist,
                        if (is_type_set((&(n->the_set->rrs_data->
                             rr_rdata[n->nd.bit_field])), nsec3_bm_len, qtype_h)) { 
                             /* type exists */
-                           val_log(ctx, LOG_INFO, 
+                           VAL_LOG(ctx, LOG_INFO, 
                                     "prove_nsec3_span(): NSEC3 error - Type exists at NSEC3 record");
                            FREE(hash);
                            continue;
                        } else if (is_type_set((&(n->the_set->rrs_data->
                            rr_rdata[n->nd.bit_field])), nsec3_bm_len, ns_t_cname)) {
                            /* CNAME exists */
-                           val_log(ctx, LOG_INFO, 
+                           VAL_LOG(ctx, LOG_INFO, 
                                     "prove_nsec3_span(): NSEC3 error - CNAME exists at NSEC3 record, but was not checked");
                            FREE(hash);
                            continue;
                        } else if (is_type_set((&(n->the_set->rrs_data->
                               rr_rdata[n->nd.bit_field])), nsec3_bm_len, ns_t_dname)) {
                            /* DNAME exists */
-                           val_log(ctx, LOG_INFO, 
+                           VAL_LOG(ctx, LOG_INFO, 
                                     "prove_nsec3_span(): NSEC3 error - DNAME exists at NSEC3 record, but was not checked");
                            FREE(hash);
                            continue;
@@ -2898,7 +3030,7 @@ prove_nsec3_span(val_context_t *ctx, struct nsec3prooflist *nlist,
         if (NULL == compute_nsec3_hash(ctx, s_cp, soa_name_n, n->nd.alg,
                                    n->nd.iterations, n->nd.saltlen, n->nd.salt,
                                    &hashlen, &hash, ttl_x)) {
-           val_log(ctx, LOG_INFO, "prove_nsec3_span(): NSEC3 error - Cannot compute hash with given params");
+           VAL_LOG(ctx, LOG_INFO, "prove_nsec3_span(): NSEC3 error - Cannot compute hash with given params");
            return;
         }
 
@@ -2930,7 +3062,7 @@ prove_nsec3_span(val_context_t *ctx, struct nsec3prooflist *nlist,
 
     /* last iteration: look for wildcard proof */
     if (NS_MAXCDNAME < wire_name_length(cp) + 2) {
-        val_log(ctx, LOG_INFO,
+        VAL_LOG(ctx, LOG_INFO,
                 "prove_nsec3_span(): NSEC3 Error - label length with wildcard exceeds bounds");
         return;
     }
@@ -2949,7 +3081,7 @@ prove_nsec3_span(val_context_t *ctx, struct nsec3prooflist *nlist,
         if (NULL == compute_nsec3_hash(ctx, wc_n, soa_name_n, n->nd.alg,
                                    n->nd.iterations, n->nd.saltlen, n->nd.salt,
                                    &hashlen, &hash, ttl_x)) {
-           val_log(ctx, LOG_INFO, "prove_nsec3_span(): NSEC3 error - Cannot compute hash with given params");
+           VAL_LOG(ctx, LOG_INFO, "prove_nsec3_span(): NSEC3 error - Cannot compute hash with given params");
            return;
         }
 
@@ -3043,7 +3175,7 @@ nsec3_proof_chk(val_context_t * ctx, struct val_internal_result *w_results,
         if (namecmp(soa_name_n, closest_zc))
             continue;
 
-        n = (struct nsec3prooflist *) MALLOC (sizeof(struct nsec3prooflist));
+        n = (struct nsec3prooflist *) arena_malloc(sizeof(struct nsec3prooflist));
         if (n == NULL) {
             retval = VAL_OUT_OF_MEMORY;
             goto err;
@@ -3052,8 +3184,8 @@ nsec3_proof_chk(val_context_t * ctx, struct val_internal_result *w_results,
                                           rr_rdata,
                                           the_set->rrs_data->
                                           rr_rdata_length, &(n->nd))) {
-            FREE(n);
-            val_log(ctx, LOG_INFO, "nsec3_proof_chk(): Cannot parse NSEC3 rdata");
+            arena_free(n);
+            VAL_LOG(ctx, LOG_INFO, "nsec3_proof_chk(): Cannot parse NSEC3 rdata");
             continue; 
         }
         n->nsec3_hashlen = the_set->rrs_name_n[0]; 
@@ -3074,15 +3206,15 @@ nsec3_proof_chk(val_context_t * ctx, struct val_internal_result *w_results,
 
     /* sometimes we may only have a hint, if we don't then there needs to be a cpe */
     if (!ce_wcard && !cpe) {
-        val_log(ctx, LOG_INFO, "nsec3_proof_chk(): NSEC3 error - CPE was not found");
+        VAL_LOG(ctx, LOG_INFO, "nsec3_proof_chk(): NSEC3 error - CPE was not found");
         *status = VAL_INCOMPLETE_PROOF;
     } else if (!ncn) {
-        val_log(ctx, LOG_INFO, "nsec3_proof_chk(): NSEC3 error - NCN was not found");
+        VAL_LOG(ctx, LOG_INFO, "nsec3_proof_chk(): NSEC3 error - NCN was not found");
         *status = VAL_INCOMPLETE_PROOF;
     } else if (optout) {
         GET_HEADER_STATUS_CODE(qc_proof, *status);
     } else if (!wcp) {
-        val_log(ctx, LOG_INFO, "nsec3_proof_chk(): Incomplete Proof - Cannot prove wildcard non-existence");
+        VAL_LOG(ctx, LOG_INFO, "nsec3_proof_chk(): Incomplete Proof - Cannot prove wildcard non-existence");
         *status = VAL_INCOMPLETE_PROOF;
     } else if (notype) {
         *status = VAL_NONEXISTENT_TYPE;
@@ -3144,7 +3276,7 @@ nsec3_proof_chk(val_context_t * ctx, struct val_internal_result *w_results,
         n = nlist;
         nlist = n->next;
         FREE(n->nd.nexthash);
-        FREE(n);
+        arena_free(n);
     }
     return retval;
 
@@ -3205,7 +3337,7 @@ check_anc_proof(val_context_t *context,
         if (the_set->rrs_type_h == ns_t_nsec) {
             nsec = 1;
             /* save proof to nsecprooflist */
-            n = (struct nsecprooflist *) MALLOC (sizeof(struct nsecprooflist));
+            n = (struct nsecprooflist *) arena_malloc(sizeof(struct nsecprooflist));
             if (n == NULL) {
                 retval = VAL_OUT_OF_MEMORY;
                 goto err;
@@ -3219,7 +3351,7 @@ check_anc_proof(val_context_t *context,
         else if (the_set->rrs_type_h == ns_t_nsec3) {
             nsec3 = 1;
             /* save proof to nsec3prooflist */
-            n3 = (struct nsec3prooflist *) MALLOC (sizeof(struct nsec3prooflist));
+            n3 = (struct nsec3prooflist *) arena_malloc(sizeof(struct nsec3prooflist));
             if (n3 == NULL) {
                 retval = VAL_OUT_OF_MEMORY;
                 goto err;
@@ -3228,8 +3360,8 @@ check_anc_proof(val_context_t *context,
                                           rr_rdata,
                                           the_set->rrs_data->
                                           rr_rdata_length, &(n3->nd))) {
-                FREE(n3);
-                val_log(context, LOG_INFO, "check_anc_proof(): Cannot parse NSEC3 rdata");
+                arena_free(n3);
+                VAL_LOG(context, LOG_INFO, "check_anc_proof(): Cannot parse NSEC3 rdata");
                 continue; 
             }
             n3->nsec3_hashlen = the_set->rrs_name_n[0]; 
@@ -3275,7 +3407,7 @@ err:
     while (nseclist) {
         n = nseclist;
         nseclist = n->next;
-        FREE(n);
+        arena_free(n);
     }
 
 #ifdef LIBVAL_NSEC3
@@ -3283,7 +3415,7 @@ err:
         n3 = nsec3list;
         nsec3list = n3->next;
         FREE(n3->nd.nexthash);
-        FREE(n3);
+        arena_free(n3);
     }
 #endif
 
@@ -3327,9 +3459,10 @@ prove_nonexistence(val_context_t * ctx,
         *soa_ttl_x = 0;
     }
 
-    if (-1 == ns_name_ntop(qname_n, name_p, sizeof(name_p)))
+    if (VAL_LOG_ENABLED(LOG_DEBUG) &&
+        -1 == ns_name_ntop(qname_n, name_p, sizeof(name_p)))
         snprintf(name_p, sizeof(name_p), "unknown/error");
-    val_log(ctx, LOG_DEBUG, "prove_nonexistence(): proving non-existence for {%s, %s(%d), %s(%d)}",
+    VAL_LOG(ctx, LOG_DEBUG, "prove_nonexistence(): proving non-existence for {%s, %s(%d), %s(%d)}",
             name_p, p_class(qc_class_h), qc_class_h, p_type(qtype_h), qtype_h);
 
     /*
@@ -3393,7 +3526,7 @@ prove_nonexistence(val_context_t * ctx,
             if ((!the_set->rrs_sig) ||
                 the_set->rrs_sig->rr_rdata_length < SIGNBY) {
 
-                val_log(ctx, LOG_INFO, "prove_nonexistence(): Bogus Proof - Cannot identify signer for NSEC proof record");
+                VAL_LOG(ctx, LOG_INFO, "prove_nonexistence(): Bogus Proof - Cannot identify signer for NSEC proof record");
                 continue;
             }
             soa_name_n =  &the_set->rrs_sig->rr_rdata[SIGNBY];
@@ -3409,7 +3542,7 @@ prove_nonexistence(val_context_t * ctx,
             if ((!the_set->rrs_sig) ||
                 the_set->rrs_sig->rr_rdata_length < SIGNBY) {
 
-                val_log(ctx, LOG_INFO, "prove_nonexistence(): Bogus Proof - Cannot identify signer for NSEC3 proof record");
+                VAL_LOG(ctx, LOG_INFO, "prove_nonexistence(): Bogus Proof - Cannot identify signer for NSEC3 proof record");
                 continue;
             }
             soa_name_n = &the_set->rrs_sig->rr_rdata[SIGNBY];
@@ -3436,6 +3569,7 @@ prove_nonexistence(val_context_t * ctx,
         if (retval != VAL_NO_ERROR)
             goto err;
 
+        SPAN_END(VAL_SPAN_PROVE_NONEXISTENCE, &now);
         return VAL_NO_ERROR;
     }
 
@@ -3468,14 +3602,15 @@ prove_nonexistence(val_context_t * ctx,
     } 
 #endif
     else {
-        val_log(ctx, LOG_INFO, 
+        VAL_LOG(ctx, LOG_INFO, 
                 "prove_nonexistence(): Bogus Proof - No valid proof of non-existence records");
         *status = VAL_INCOMPLETE_PROOF;
     }
 
-    val_log(ctx, LOG_DEBUG, 
+    VAL_LOG(ctx, LOG_DEBUG, 
             "prove_nonexistence(): Setting proof status for {%s, %s(%d), %s(%d)} to: %s", name_p, p_class(qc_class_h), qc_class_h, p_type(qtype_h), qtype_h, p_val_status(*status));
 
+    SPAN_END(VAL_SPAN_PROVE_NONEXISTENCE, &now);
     return VAL_NO_ERROR;
 
   err:
@@ -3488,6 +3623,7 @@ prove_nonexistence(val_context_t * ctx,
         val_free_result_chain(*proof_res);
         *proof_res = NULL;
     }
+    SPAN_END(VAL_SPAN_PROVE_NONEXISTENCE, &now);
     return retval;
 }
 
@@ -3612,7 +3748,7 @@ find_next_zonecut(val_context_t * context, struct queries_for_query **queries,
         /* zonecut has to be within the query */
         if (namename(qname_n, zonecut_name_n) != NULL) {
             int len = wire_name_length(zonecut_name_n);
-            *name_n = (u_char *) MALLOC(len * sizeof(u_char));
+            *name_n = (u_char *) arena_malloc(len * sizeof(u_char));
             if (*name_n == NULL) {
                 return VAL_OUT_OF_MEMORY;
             }
@@ -3674,7 +3810,7 @@ prove_existence(val_context_t * context,
                             rr_rdata[nsec_bit_field])),
                             the_set->rrs_data->rr_rdata_length -
                             nsec_bit_field, qtype_h)) {
-                    val_log(context, LOG_INFO,
+                    VAL_LOG(context, LOG_INFO,
                             "prove_existence(): Wildcard expansion: Type exists at NSEC record");
                     *status = VAL_SUCCESS;
                     break;
@@ -3694,7 +3830,7 @@ prove_existence(val_context_t * context,
                                       rr_rdata,
                                       the_set->rrs_data->
                                       rr_rdata_length, &nd)) {
-                val_log(context, LOG_INFO, "prove_existence(): Cannot parse NSEC3 rdata");
+                VAL_LOG(context, LOG_INFO, "prove_existence(): Cannot parse NSEC3 rdata");
                 *status = VAL_BOGUS_PROOF;
                 return VAL_NO_ERROR;
             }
@@ -3706,7 +3842,7 @@ prove_existence(val_context_t * context,
                 compute_nsec3_hash(context, cp, soa_name_n, nd.alg,
                                    nd.iterations, nd.saltlen, nd.salt,
                                    &hashlen, &hash, ttl_x)) {
-                val_log(context, LOG_INFO,
+                VAL_LOG(context, LOG_INFO,
                         "prove_existence(): Cannot compute NSEC3 hash with given params");
                 *status = VAL_BOGUS_PROOF;
                 FREE(nd.nexthash);
@@ -3726,7 +3862,7 @@ prove_existence(val_context_t * context,
                 if (is_type_set
                     ((&(the_set->rrs_data->
                         rr_rdata[nd.bit_field])), nsec3_bm_len, qtype_h)) {
-                    val_log(context, LOG_INFO,
+                    VAL_LOG(context, LOG_INFO,
                             "prove_existence(): Wildcard expansion: Type exists at NSEC3 record");
                     *status = VAL_SUCCESS;
                     FREE(nd.nexthash);
@@ -3879,18 +4015,18 @@ verify_provably_insecure(val_context_t * context,
      * PI check
      */
     if (flags & VAL_QUERY_SEC_LEAF) {
-        val_log(context, LOG_INFO, "verify_provably_insecure(): No PI zone above %s", name_p);
+        VAL_LOG(context, LOG_INFO, "verify_provably_insecure(): No PI zone above %s", name_p);
         goto err;
     }
 
-    val_log(context, LOG_INFO, "verify_provably_insecure(): Checking PI status for %s", name_p);
+    VAL_LOG(context, LOG_INFO, "verify_provably_insecure(): Checking PI status for %s", name_p);
 
     if (known_zonecut_n == NULL) {
         /* 
          * In cases where the zonecut does not exist simply start with the qname 
          */
         size_t len = wire_name_length(q_name_n);
-        q_zonecut_n = (u_char *) MALLOC (len * sizeof (u_char));
+        q_zonecut_n = (u_char *) arena_malloc(len * sizeof (u_char));
         if (q_zonecut_n == NULL) {
             retval = VAL_OUT_OF_MEMORY;
             goto err;
@@ -3900,7 +4036,7 @@ verify_provably_insecure(val_context_t * context,
     } else {
         /* copy the known zonecut into our zonecut variable */
         size_t zclen = wire_name_length(known_zonecut_n);
-        q_zonecut_n = (u_char *) MALLOC (zclen * sizeof(u_char));
+        q_zonecut_n = (u_char *) arena_malloc(zclen * sizeof(u_char));
         if (q_zonecut_n == NULL) {
             retval = VAL_OUT_OF_MEMORY;
             goto err;
@@ -3916,7 +4052,7 @@ verify_provably_insecure(val_context_t * context,
         size_t len;
         if (VAL_NO_ERROR != (find_dlv_trust_point(context, q_name_n, 
                                               &dlv_tp, &dlv_target, ttl_x))) {
-            val_log(context, LOG_INFO, "verify_provably_insecure(): Cannot find trust anchor for %s", name_p);
+            VAL_LOG(context, LOG_INFO, "verify_provably_insecure(): Cannot find trust anchor for %s", name_p);
             goto err;
         }
         if (dlv_tp == NULL || dlv_target == NULL) { 
@@ -3924,7 +4060,7 @@ verify_provably_insecure(val_context_t * context,
         }
 
         len = wire_name_length(dlv_tp);
-        curzone_n = (u_char *) MALLOC (len * sizeof(u_char));
+        curzone_n = (u_char *) arena_malloc(len * sizeof(u_char));
         if (curzone_n == NULL) {
             retval = VAL_OUT_OF_MEMORY;
             goto err;
@@ -3937,12 +4073,12 @@ verify_provably_insecure(val_context_t * context,
     {
         if (VAL_NO_ERROR != (find_trust_point(context, q_name_n, 
                                           &curzone_n, ttl_x))) {
-            val_log(context, LOG_INFO, "verify_provably_insecure(): Cannot find trust anchor for %s", name_p);
+            VAL_LOG(context, LOG_INFO, "verify_provably_insecure(): Cannot find trust anchor for %s", name_p);
             goto err;
         }
         if (curzone_n == NULL) {
             /* no trust anchor defined */
-            val_log(context, LOG_INFO, "verify_provably_insecure(): Cannot find trust anchor for %s", name_p);
+            VAL_LOG(context, LOG_INFO, "verify_provably_insecure(): Cannot find trust anchor for %s", name_p);
             goto err;
         }
         q = namename(q_labels, curzone_n);
@@ -3956,7 +4092,7 @@ verify_provably_insecure(val_context_t * context,
          * this is a problem: means that trust point was 
          * not contained within name 
          */
-        val_log(context, LOG_INFO, 
+        VAL_LOG(context, LOG_INFO, 
                 "verify_provably_insecure(): trust point %s not in name, cannot do a top-down provably-insecure test", tempname_p);
         goto err;
     }
@@ -3966,7 +4102,7 @@ verify_provably_insecure(val_context_t * context,
          * if the query zonecut is the same as the 
          * trust point, return
          */
-        val_log(context, LOG_INFO, 
+        VAL_LOG(context, LOG_INFO, 
                 "verify_provably_insecure(): trust point %s exists; so this zone cannot be provably insecure",
                 tempname_p);
         goto err;
@@ -3986,7 +4122,7 @@ verify_provably_insecure(val_context_t * context,
              *  removing the topmost label should still give us a valid 
              *  trust anchor for the name
              */
-            val_log(context, LOG_INFO,
+            VAL_LOG(context, LOG_INFO,
                     "verify_provably_insecure(): trust point does not exist; but we expected it to be there",
                     tempname_p);
             goto err;
@@ -4003,7 +4139,7 @@ verify_provably_insecure(val_context_t * context,
 
         if (nxt_qname == NULL) {
             size_t len = wire_name_length(curzone_n);
-            nxt_qname = (u_char *) MALLOC (len * sizeof (u_char));
+            nxt_qname = (u_char *) arena_malloc(len * sizeof (u_char));
             if (nxt_qname == NULL) {
                 retval = VAL_OUT_OF_MEMORY;
                 goto err;
@@ -4028,11 +4164,11 @@ verify_provably_insecure(val_context_t * context,
             /* find next zone cut going down from the trust anchor */
             if (VAL_NO_ERROR != find_next_zonecut(context, queries,
                         nxt_qname, q_type_h, flags, done, &zonecut_n)) {
-                val_log(context, LOG_INFO, "verify_provably_insecure(): Cannot find zone cut for %s", tempname_p);
+                VAL_LOG(context, LOG_INFO, "verify_provably_insecure(): Cannot find zone cut for %s", tempname_p);
                 goto err;
             } else if (*done == 0) {
                 /* Need more data */
-                val_log(context, LOG_INFO, "verify_provably_insecure(): Finding zonecut data for %s", tempname_p);
+                VAL_LOG(context, LOG_INFO, "verify_provably_insecure(): Finding zonecut data for %s", tempname_p);
                 goto donefornow;
             }
         }
@@ -4054,7 +4190,7 @@ verify_provably_insecure(val_context_t * context,
              * try using nxt_qname as the last resort 
              */
             len = wire_name_length(nxt_qname);
-            zonecut_n = (u_char *) MALLOC (len * sizeof (u_char));
+            zonecut_n = (u_char *) arena_malloc(len * sizeof (u_char));
             if (zonecut_n == NULL) {
                 retval = VAL_OUT_OF_MEMORY;
                 goto err;
@@ -4064,7 +4200,7 @@ verify_provably_insecure(val_context_t * context,
         } else if (!namecmp(zonecut_n, curzone_n)) {
 
             /* if the zonecut is same as before, try again with the next name */
-            FREE(zonecut_n);
+            arena_free(zonecut_n);
             zonecut_n = NULL;
             continue;
         }
@@ -4074,7 +4210,7 @@ verify_provably_insecure(val_context_t * context,
 
         /* if older zonecut is more specific than the new one bail out */
         if (namename(curzone_n, zonecut_n) != NULL) {
-            val_log(context, LOG_INFO, 
+            VAL_LOG(context, LOG_INFO, 
                     "verify_provably_insecure(): Older zonecut is more specific than the current one: %s",
                     tempname_p);
             goto err;
@@ -4086,7 +4222,7 @@ verify_provably_insecure(val_context_t * context,
                                     ns_t_ds, 
                                     flags|VAL_QUERY_SEC_LEAF|VAL_QUERY_AC_DETAIL, 
                                     queries, &results, done))) {
-            val_log(context, LOG_INFO, 
+            VAL_LOG(context, LOG_INFO, 
                     "verify_provably_insecure(): Cannot chase DS record for %s", tempname_p);
             goto err;
         }
@@ -4098,13 +4234,13 @@ verify_provably_insecure(val_context_t * context,
 
         /* if done,  inspect the results */
         if (results == NULL) {
-            val_log(context, LOG_INFO, "verify_provably_insecure(): Cannot chase DS record for %s", tempname_p);
+            VAL_LOG(context, LOG_INFO, "verify_provably_insecure(): Cannot chase DS record for %s", tempname_p);
             goto err;
         }
 
         /* If result is not trustworthy, not provably insecure */
         if (!val_istrusted(results->val_rc_status)) {
-            val_log(context, LOG_INFO, "verify_provably_insecure(): DS record for %s did not validate successfully", tempname_p);
+            VAL_LOG(context, LOG_INFO, "verify_provably_insecure(): DS record for %s did not validate successfully", tempname_p);
             goto err; 
         }
 
@@ -4112,31 +4248,34 @@ verify_provably_insecure(val_context_t * context,
          * if non-existent set as provably insecure and break 
          * It's got to be a missing type, nothing else will do 
          */
-        if (results->val_rc_status == VAL_NONEXISTENT_TYPE ||
-            results->val_rc_status == VAL_NONEXISTENT_TYPE_NOCHAIN) {
+        if (VAL_BASE_STATUS(results->val_rc_status) == VAL_NONEXISTENT_TYPE ||
+            VAL_BASE_STATUS(results->val_rc_status) ==
+                VAL_NONEXISTENT_TYPE_NOCHAIN) {
             /* 
              * Check that curzone_n matches the zonecut seen in the proof RRSIG 
              */ 
             if (verify_zonecut_in_rrsig(results, curzone_n)) {
-                val_log(context, LOG_INFO, "verify_provably_insecure(): %s is provably insecure", name_p);
+                VAL_LOG(context, LOG_INFO, "verify_provably_insecure(): %s is provably insecure", name_p);
                 *is_pinsecure = 1;
             }
-        } else if (results->val_rc_status == VAL_NONEXISTENT_NAME ||
-                   results->val_rc_status == VAL_NONEXISTENT_NAME_NOCHAIN) {
+        } else if (VAL_BASE_STATUS(results->val_rc_status) ==
+                       VAL_NONEXISTENT_NAME ||
+                   VAL_BASE_STATUS(results->val_rc_status) ==
+                       VAL_NONEXISTENT_NAME_NOCHAIN) {
             /*
              * Delegation does not exist. 
              * Retry with next zonecut
              */
-            FREE(zonecut_n);
+            arena_free(zonecut_n);
             zonecut_n = NULL;
             continue;
-        } else if (results->val_rc_status == VAL_SUCCESS) {
+        } else if (VAL_BASE_STATUS(results->val_rc_status) == VAL_SUCCESS) {
             /* 
              * If this is not a proof, check that curzone_n matches 
              * the zonecut in the RRSIG for the DS
              */
             if (!verify_zonecut_in_rrsig(results, curzone_n)) {
-                val_log(context, LOG_NOTICE, 
+                VAL_LOG(context, LOG_NOTICE, 
                         "verify_provably_insecure(): Inconsistent zonecut for DS at %s", tempname_p);
                 goto err; 
             }
@@ -4162,9 +4301,9 @@ verify_provably_insecure(val_context_t * context,
                     rr = rr->rr_next;
                 }
                 if (*is_pinsecure) {
-                    val_log(context, LOG_INFO,
+                    VAL_LOG(context, LOG_INFO,
                             "verify_provably_insecure(): Unknown DS alg for %s", name_p);
-                    val_log(context, LOG_INFO, 
+                    VAL_LOG(context, LOG_INFO, 
                             "verify_provably_insecure(): %s is provably insecure", name_p);
                 }
             }
@@ -4182,16 +4321,16 @@ verify_provably_insecure(val_context_t * context,
                             replace_name_in_name(zonecut_n, dlv_tp, dlv_target, &last_name))) {
                         goto err;
                     }
-                    FREE(dlv_target);
-                    FREE(dlv_tp);
+                    arena_free(dlv_target);
+                    arena_free(dlv_tp);
                     dlv_target = NULL;
                     dlv_tp = NULL;
 
                     /* continue with this name */
                     if (zonecut_n)
-                        FREE(zonecut_n);
+                        arena_free(zonecut_n);
                     zonecut_n = last_name;
-                    FREE(nxt_qname);
+                    arena_free(nxt_qname);
                     nxt_qname = NULL;
                 } else {
                     goto donefornow;
@@ -4203,7 +4342,7 @@ verify_provably_insecure(val_context_t * context,
 
         /* look for next (more specific) zonecut */ 
         if (curzone_n) {
-            FREE(curzone_n);
+            arena_free(curzone_n);
         }
         curzone_n = zonecut_n;
         zonecut_n = NULL;
@@ -4214,27 +4353,27 @@ verify_provably_insecure(val_context_t * context,
     }
     
 err:
-    val_log(context, LOG_INFO,
+    VAL_LOG(context, LOG_INFO,
             "verify_provably_insecure(): Cannot show that %s is provably insecure.", name_p);
 
 donefornow:
     if (q_zonecut_n)
-        FREE(q_zonecut_n);
+        arena_free(q_zonecut_n);
     if (zonecut_n)
-        FREE(zonecut_n);
+        arena_free(zonecut_n);
     if (curzone_n)
-        FREE(curzone_n);
+        arena_free(curzone_n);
     if (results != NULL) {
         val_free_result_chain(results);
         results = NULL;
     }
     if (nxt_qname) 
-        FREE(nxt_qname);
+        arena_free(nxt_qname);
 #ifdef LIBVAL_DLV
     if (dlv_tp) 
-        FREE(dlv_tp);
+        arena_free(dlv_tp);
     if (dlv_target) 
-        FREE(dlv_target);
+        arena_free(dlv_target);
 #endif
     
     return retval;
@@ -4288,11 +4427,11 @@ is_pu_trusted(val_context_t *ctx, u_char *name_n, u_int32_t *ttl_x)
                     *ttl_x = pu_cur->exp_ttl;
 
                 if (pol->trusted == ZONE_PU_UNTRUSTED) {
-                    val_log(ctx, LOG_INFO, "is_pu_trusted(): zone %s provable insecure status is not trusted",
+                    VAL_LOG(ctx, LOG_INFO, "is_pu_trusted(): zone %s provable insecure status is not trusted",
                             name_p);
                     return 0;
                 } else { 
-                    val_log(ctx, LOG_INFO, "is_pu_trusted(): zone %s provably insecure status is trusted", name_p);
+                    VAL_LOG(ctx, LOG_INFO, "is_pu_trusted(): zone %s provably insecure status is trusted", name_p);
                     return 1;
                 }
             }
@@ -4319,6 +4458,7 @@ try_verify_assertion(val_context_t * context,
     struct queries_for_query *pc = NULL;
     struct queries_for_query *added_q = NULL;
     struct val_digested_auth_chain *the_trust = NULL;
+    struct timeval  verify_start;
 
     /*
      * Sanity check 
@@ -4386,6 +4526,10 @@ try_verify_assertion(val_context_t * context,
                     /*
                      * store the RRSIG in the assertion 
                      */
+                    if (VAL_NO_ERROR != (retval = unshare_assertion(next_as)) ||
+                        VAL_NO_ERROR != (retval = unshare_assertion(pending_as)))
+                        return retval;
+                    pending_rrset = pending_as->val_ac_rrset.ac_data;
                     next_as->val_ac_rrset.ac_data->rrs_sig = pending_rrset->rrs_sig;
                     pending_rrset->rrs_sig = NULL;
                     next_as->val_ac_status = VAL_AC_WAIT_FOR_TRUST;
@@ -4479,7 +4623,7 @@ try_verify_assertion(val_context_t * context,
         if (-1 == ns_name_ntop(next_as->val_ac_rrset.ac_data->rrs_name_n, 
                                name_p, sizeof(name_p)))
             snprintf(name_p, sizeof(name_p), "unknown/error");
-        val_log(context, LOG_INFO, 
+        VAL_LOG(context, LOG_INFO, 
                 "try_verify_assertion(): verifying next assertion: {%s, %s(%d), %s(%d)}",
                 name_p, 
                 p_class(next_as->val_ac_rrset.ac_data->rrs_class_h),
@@ -4493,7 +4637,16 @@ try_verify_assertion(val_context_t * context,
             the_trust = get_ac_trust(context, next_as, queries, flags, 0); 
         }
 
+        SPAN_BEGIN(&verify_start);
         verify_next_assertion(context, next_as, the_trust, flags);
+        SPAN_END(VAL_SPAN_VERIFY, &verify_start);
+        if (val_trace_enabled)
+            val_trace_link(next_as->val_ac_query ?
+                               next_as->val_ac_query->qc_trace_id : 0,
+                           next_as->val_ac_rrset.ac_data->rrs_name_n,
+                           next_as->val_ac_rrset.ac_data->rrs_type_h,
+                           next_as->val_ac_rrset.ac_data->rrs_class_h,
+                           next_as->val_ac_status);
         /* 
          * Set the TTL to the minimum of the authentication 
          * chain element and the trust element
@@ -4618,7 +4771,7 @@ set_dlv_branchoff(val_context_t *context,
 
     if (VAL_NO_ERROR != (retval = 
                 find_dlv_trust_point(context, name_n, &dlv_tp, &dlv_target, &ttl_x))) {
-        val_log(context, LOG_INFO, "set_dlv_branchoff(): Cannot find DLV trust point for %s", name_p);
+        VAL_LOG(context, LOG_INFO, "set_dlv_branchoff(): Cannot find DLV trust point for %s", name_p);
         goto done;
     }
     SET_MIN_TTL(*q_ttl_x, ttl_x);
@@ -4669,7 +4822,7 @@ set_dlv_branchoff(val_context_t *context,
         namename(tp, last_name) && 
         (tzonestatus != VAL_AC_WAIT_FOR_TRUST)) { 
 
-        val_log(context, LOG_INFO, "set_dlv_branchoff(): Zone security expectation overrides DLV %s", name_p);
+        VAL_LOG(context, LOG_INFO, "set_dlv_branchoff(): Zone security expectation overrides DLV %s", name_p);
         goto done;
     }
 
@@ -4729,13 +4882,13 @@ set_dlv_branchoff(val_context_t *context,
 
 done:
     if (dlv_name)
-        FREE(dlv_name);
+        arena_free(dlv_name);
     if (dlv_tp)
-        FREE(dlv_tp);
+        arena_free(dlv_tp);
     if (dlv_target)
-        FREE(dlv_target);
+        arena_free(dlv_target);
     if (last_name)
-        FREE(last_name);
+        arena_free(last_name);
 
     return retval;
 }
@@ -4781,13 +4934,13 @@ int switch_to_root(val_context_t * context,
          * we were already recursing or
          * the query was in use by some other thread
          */
-        val_log(context, LOG_DEBUG, 
+        VAL_LOG(context, LOG_DEBUG, 
                 "switch_to_root(): Ignored - no root.hints configured or already doing recursion");
         return VAL_NO_ERROR;
     } 
 
     if (!clear_query_chain_structure(matched_q)) {
-        val_log(context, LOG_DEBUG, 
+        VAL_LOG(context, LOG_DEBUG, 
                 "switch_to_root(): Ignored - query is in use");
         return VAL_NO_ERROR;
     }
@@ -4802,7 +4955,7 @@ int switch_to_root(val_context_t * context,
      * in relation to this query; e.g. queries for DNSKEYs, DS etc 
      */
     matched_qfq->qfq_flags |= VAL_QUERY_IS_ITERATING;
-    val_log(context, LOG_INFO,
+    VAL_LOG(context, LOG_INFO,
             "switch_to_root(): Re-initiating query from root for {%s %s %s}",
             name_p,
             p_class(matched_q->qc_class_h),
@@ -4884,7 +5037,7 @@ restart_query:
              * Add this result to the list 
              */
             res = (struct val_internal_result *)
-                MALLOC(sizeof(struct val_internal_result));
+                arena_malloc(sizeof(struct val_internal_result));
             if (res == NULL) {
                 /*
                  * free the result list 
@@ -4945,7 +5098,7 @@ restart_query:
              */
             if ((next_as->val_ac_rrset.ac_data != NULL) &&
                 (next_as == as_trust)) {
-                val_log(context, LOG_INFO, 
+                VAL_LOG(context, LOG_INFO, 
                         "verify_and_validate(): trying to verify PNE \
                         for {%s %s %s}; but trust points backward",
                         name_p, 
@@ -4985,7 +5138,7 @@ restart_query:
 
                     if (ds_proof == NULL) {
                         res->val_rc_status = VAL_INDETERMINATE;
-                        val_log(context, LOG_INFO, 
+                        VAL_LOG(context, LOG_INFO, 
                             "verify_and_validate(): trust point "
                             "for {%s %s %s} contains an empty proof of non-existence",
                             name_p, 
@@ -5031,7 +5184,7 @@ restart_query:
                         SET_MIN_TTL(next_as->val_ac_query->qc_ttl_x, ttl_x);
                         ttl_x = 0;
                         if (is_pinsecure) {
-                            val_log(context, LOG_INFO, 
+                            VAL_LOG(context, LOG_INFO, 
                                     "verify_and_validate(): Setting authentication chain status for {%s %s(%d) %s(%d)} to Provably Insecure",
                                     name_p, 
                                     p_class(next_as->val_ac_rrset.ac_data->rrs_class_h),
@@ -5046,7 +5199,7 @@ restart_query:
                                 res->val_rc_status = VAL_PINSECURE_UNTRUSTED;
                             SET_MIN_TTL(next_as->val_ac_query->qc_ttl_x, ttl_x);
                         } else {
-                            val_log(context, LOG_INFO, 
+                            VAL_LOG(context, LOG_INFO, 
                                     "verify_and_validate(): Setting authentication chain status for {%s %s(%d) %s(%d)} to Bogus",
                                     name_p, 
                                     p_class(next_as->val_ac_rrset.ac_data->rrs_class_h),
@@ -5068,7 +5221,7 @@ restart_query:
                     /* did not process the final state for this authentication chain before */
 
                     if (next_as->val_ac_status == VAL_AC_IGNORE_VALIDATION) {
-                        val_log(context, LOG_INFO, 
+                        VAL_LOG(context, LOG_INFO, 
                                 "verify_and_validate(): Setting authentication chain status for {%s %s(%d) %s(%d)} to Ignore Validation",
                                 name_p, 
                                 p_class(next_as->val_ac_rrset.ac_data->rrs_class_h),
@@ -5077,7 +5230,7 @@ restart_query:
                                 next_as->val_ac_rrset.ac_data->rrs_type_h);
                         res->val_rc_status = VAL_IGNORE_VALIDATION;
                     } else if (next_as->val_ac_status == VAL_AC_TRUST) {
-                        val_log(context, LOG_INFO, 
+                        VAL_LOG(context, LOG_INFO, 
                                 "verify_and_validate(): Ending authentication chain at {%s %s(%d) %s(%d)}",
                                 name_p, 
                                 p_class(next_as->val_ac_rrset.ac_data->rrs_class_h),
@@ -5087,7 +5240,7 @@ restart_query:
                         SET_CHAIN_COMPLETE(res->val_rc_status);
                     } else if (next_as->val_ac_status ==
                                VAL_AC_UNTRUSTED_ZONE) {
-                        val_log(context, LOG_INFO, 
+                        VAL_LOG(context, LOG_INFO, 
                                 "verify_and_validate(): Setting authentication chain status for {%s %s(%d) %s(%d)} to Untrusted Zone",
                                 name_p, 
                                 p_class(next_as->val_ac_rrset.ac_data->rrs_class_h),
@@ -5098,7 +5251,7 @@ restart_query:
                     } else if (next_as->val_ac_status ==
                                VAL_AC_PINSECURE) {
                         ttl_x = 0;
-                        val_log(context, LOG_INFO, 
+                        VAL_LOG(context, LOG_INFO, 
                                 "verify_and_validate(): Setting authentication chain status for {%s %s(%d) %s(%d)} to Provably Insecure",
                                 name_p, 
                                 p_class(next_as->val_ac_rrset.ac_data->rrs_class_h),
@@ -5112,7 +5265,7 @@ restart_query:
                             res->val_rc_status = VAL_PINSECURE_UNTRUSTED;
                         SET_MIN_TTL(next_as->val_ac_query->qc_ttl_x, ttl_x);
                     } else if (next_as->val_ac_status == VAL_AC_BARE_RRSIG) {
-                        val_log(context, LOG_INFO, 
+                        VAL_LOG(context, LOG_INFO, 
                                 "verify_and_validate(): Setting authentication chain status for {%s %s(%d) %s(%d)} to Bare RRSIG",
                                 name_p, 
                                 p_class(next_as->val_ac_rrset.ac_data->rrs_class_h),
@@ -5125,7 +5278,7 @@ restart_query:
                         /*
                          * No trust
                          */
-                        val_log(context, LOG_INFO, 
+                        VAL_LOG(context, LOG_INFO, 
                                 "verify_and_validate(): Marking authentication chain status for {%s %s(%d) %s(%d)} to indicate no trust",
                                 name_p, 
                                 p_class(next_as->val_ac_rrset.ac_data->rrs_class_h),
@@ -5136,7 +5289,7 @@ restart_query:
                     }
                 } else {
                     /* already processed the final state for this authentication chain */
-                    val_log(context, LOG_INFO, 
+                    VAL_LOG(context, LOG_INFO, 
                             "verify_and_validate(): Assertion end state for {%s %s(%d) %s(%d)} already set to %s",
                             name_p, 
                             p_class(next_as->val_ac_rrset.ac_data->rrs_class_h),
@@ -5171,7 +5324,7 @@ restart_query:
                     SET_MIN_TTL(next_as->val_ac_query->qc_ttl_x, ttl_x);
                     ttl_x = 0;
                     if (is_pinsecure) {
-                        val_log(context, LOG_INFO, 
+                        VAL_LOG(context, LOG_INFO, 
                                 "verify_and_validate(): Setting authentication chain status for {%s %s(%d) %s(%d)} to Provably Insecure",
                                 name_p, 
                                 p_class(next_as->val_ac_rrset.ac_data->rrs_class_h),
@@ -5187,7 +5340,7 @@ restart_query:
                         SET_MIN_TTL(next_as->val_ac_query->qc_ttl_x, ttl_x);
                     } else {
                         if (next_as->val_ac_status <= VAL_AC_LAST_ERROR) {
-                            val_log(context, LOG_INFO, 
+                            VAL_LOG(context, LOG_INFO, 
                                     "verify_and_validate(): Setting authentication chain status for {%s %s(%d) %s(%d)} to Indeterminate",
                                     name_p, 
                                     p_class(next_as->val_ac_rrset.ac_data->rrs_class_h),
@@ -5196,7 +5349,7 @@ restart_query:
                                     next_as->val_ac_rrset.ac_data->rrs_type_h);
                             res->val_rc_status = VAL_INDETERMINATE;
                         } else if (next_as->val_ac_status <= VAL_AC_LAST_BAD) {
-                            val_log(context, LOG_INFO, 
+                            VAL_LOG(context, LOG_INFO, 
                                     "verify_and_validate(): Marking authentication chain status for {%s %s(%d) %s(%d)} as bad",
                                     name_p, 
                                     p_class(next_as->val_ac_rrset.ac_data->rrs_class_h),
@@ -5205,7 +5358,7 @@ restart_query:
                                     next_as->val_ac_rrset.ac_data->rrs_type_h);
                             res->val_rc_status = VAL_DNS_ERROR;
                         } else if (next_as->val_ac_status <= VAL_AC_LAST_FAILURE) {
-                            val_log(context, LOG_INFO, 
+                            VAL_LOG(context, LOG_INFO, 
                                     "verify_and_validate(): Setting authentication chain status for {%s %s(%d) %s(%d)} to Bogus",
                                     name_p,
                                     p_class(next_as->val_ac_rrset.ac_data->rrs_class_h), 
@@ -5263,7 +5416,7 @@ restart_query:
             if (do_dlv) {
                 struct queries_for_query *added_q;
 
-                val_log(context, LOG_INFO,
+                VAL_LOG(context, LOG_INFO,
                         "verify_and_validate(): Attempting DLV validation");
 
                 top_q->qc_flags |= VAL_QUERY_USING_DLV; 
@@ -5316,7 +5469,7 @@ ask_cache(val_context_t * context,
         data_missing == NULL)
         return VAL_BAD_ARGUMENT;
 
-    val_log(NULL, LOG_DEBUG, __FUNCTION__);
+    VAL_LOG(NULL, LOG_DEBUG, __FUNCTION__);
 
     if (*data_missing == 0)
         return VAL_NO_ERROR;
@@ -5353,7 +5506,7 @@ ask_resolver(val_context_t * context,
     struct queries_for_query *next_q;
     int             retval = VAL_NO_ERROR, sent = 0;
 
-    val_log(NULL, LOG_DEBUG, __FUNCTION__);
+    VAL_LOG(NULL, LOG_DEBUG, __FUNCTION__);
 
     if ((context == NULL) || (queries == NULL) || (data_received == NULL) ||
         (data_missing == NULL)) 
@@ -5397,7 +5550,7 @@ _ask_cache_one(val_context_t * context, struct queries_for_query **queries,
     char                name_p[NS_MAXDNAME];
     int                 retval;
 
-    val_log(NULL, LOG_DEBUG, __FUNCTION__);
+    VAL_LOG(NULL, LOG_DEBUG, __FUNCTION__);
 
     if (next_q->qfq_query->qc_state < Q_ANSWERED)
         *data_missing = 1;
@@ -5414,7 +5567,7 @@ _ask_cache_one(val_context_t * context, struct queries_for_query **queries,
         (next_q->qfq_query->qc_flags & VAL_QUERY_NEEDS_REFRESH)) {
 
         /* don't look at the cache for this query */
-        val_log(context, LOG_DEBUG,
+        VAL_LOG(context, LOG_DEBUG,
                 "ask_cache(): skipping cache {%s %s(%d) %s(%d)}, flags=%x",
                 name_p, p_class(next_q->qfq_query->qc_class_h),
                 next_q->qfq_query->qc_class_h,
@@ -5423,7 +5576,7 @@ _ask_cache_one(val_context_t * context, struct queries_for_query **queries,
         return VAL_NO_ERROR;
     }
 
-    val_log(context, LOG_DEBUG,
+    VAL_LOG(context, LOG_DEBUG,
             "ask_cache(): looking for {%s %s(%d) %s(%d)}, flags=%x", name_p,
             p_class(next_q->qfq_query->qc_class_h),
             next_q->qfq_query->qc_class_h, p_type(next_q->qfq_query->qc_type_h),
@@ -5447,7 +5600,7 @@ _ask_cache_one(val_context_t * context, struct queries_for_query **queries,
 
     if (next_q->qfq_query->qc_state == Q_ANSWERED) {
 
-        val_log(context, LOG_INFO,
+        VAL_LOG(context, LOG_INFO,
                 "ask_cache(): found matching ack/nack response for {%s %s(%d) %s(%d)}, flags=%x, exp=%ld",
                 name_p, p_class(next_q->qfq_query->qc_class_h),
                 next_q->qfq_query->qc_class_h,
@@ -5484,7 +5637,7 @@ _ask_cache_one(val_context_t * context, struct queries_for_query **queries,
         if (VAL_NO_ERROR != (retval = assimilate_answers(context, queries,
                                                          response, next_q))) {
             free_domain_info_ptrs(response);
-            FREE(response);
+            arena_free(response);
             return retval;
         }
     } else if (next_q->qfq_query->qc_state < Q_ERROR_BASE) {
@@ -5496,7 +5649,7 @@ _ask_cache_one(val_context_t * context, struct queries_for_query **queries,
             ALLOCATE_REFERRAL_BLOCK(next_q->qfq_query->qc_referral);
             if (next_q->qfq_query->qc_referral == NULL) {
                 free_domain_info_ptrs(response);
-                FREE(response);
+                arena_free(response);
                 return VAL_OUT_OF_MEMORY;
             }
         }
@@ -5514,12 +5667,20 @@ _ask_cache_one(val_context_t * context, struct queries_for_query **queries,
         }
         response->di_qnames = NULL;
 
-        /* Consume answers */
+        /*
+         * Consume answers; the referral outlives this lookup, so it
+         * needs its own copy of anything shared with the cache
+         */
+        if (VAL_NO_ERROR != (retval = unshare_rrset_recs(&response->di_answers))) {
+            free_domain_info_ptrs(response);
+            arena_free(response);
+            return retval;
+        }
         merge_rrset_recs(&next_q->qfq_query->qc_referral->answers,
                          response->di_answers);
         response->di_answers = NULL;
     } else {
-        val_log(context, LOG_INFO,
+        VAL_LOG(context, LOG_INFO,
                 "ask_cache(): received error response for {%s %s(%d) %s(%d)}, flags=%x: %d",
                 name_p, p_class(next_q->qfq_query->qc_class_h),
                 next_q->qfq_query->qc_class_h,
@@ -5530,7 +5691,10 @@ _ask_cache_one(val_context_t * context, struct queries_for_query **queries,
     }
 
     free_domain_info_ptrs(response);
-    FREE(response);
+    arena_free(response);
+
+    if (val_span_enabled && next_q->qfq_query->qc_state >= Q_ANSWERED)
+        val_span_query(next_q->qfq_query, VAL_SPAN_QUERY_CACHED);
 
     if (next_q->qfq_query->qc_state > Q_SENT)
         *data_received = 1;
@@ -5544,25 +5708,51 @@ _ask_cache_one(val_context_t * context, struct queries_for_query **queries,
     return VAL_NO_ERROR;
 }
 
+/*
+ * Try to answer a query from a local zone mirror.  Answers are
+ * assimilated the same way as responses from the network.
+ */
+static int
+_resolver_mirror_one(val_context_t * context, struct queries_for_query **queries,
+                     struct queries_for_query *query, int *answered)
+{
+    struct domain_info *response = NULL;
+    int                 retval;
+
+    retval = val_resquery_mirror(context, query, &response, queries, answered);
+    if (retval != VAL_NO_ERROR)
+        return retval;
+
+    if ((query->qfq_query->qc_state == Q_ANSWERED) && (response != NULL))
+        retval = assimilate_answers(context, queries, response, query);
+
+    if (response != NULL) {
+        free_domain_info_ptrs(response);
+        arena_free(response);
+    }
+    return retval;
+}
+
 static int
 _resolver_submit_one(val_context_t * context, struct queries_for_query **queries,
                      struct queries_for_query *query)
 {
     int   retval = VAL_NO_ERROR;
     char  name_p[NS_MAXDNAME];
+    int   hops, answered;
 
     if ((context == NULL) || (queries == NULL) || (query == NULL) ||
         (query->qfq_query->qc_state != Q_INIT))
         return VAL_BAD_ARGUMENT;
 
-    val_log(NULL, LOG_DEBUG, __FUNCTION__);
+    VAL_LOG(NULL, LOG_DEBUG, __FUNCTION__);
 
     if (-1 == ns_name_ntop(query->qfq_query->qc_name_n, name_p,
                            sizeof(name_p)))
         snprintf(name_p, sizeof(name_p), "unknown/error");
 
     if (query->qfq_query->qc_flags & VAL_QUERY_SKIP_RESOLVER) {
-        val_log(context, LOG_INFO,
+        VAL_LOG(context, LOG_INFO,
                 "_resolver_submit_one(): skipping query {%s %s(%d) %s(%d)}, flags=%x%s",
                 name_p, p_class(query->qfq_query->qc_class_h),
                 query->qfq_query->qc_class_h,
@@ -5572,7 +5762,7 @@ _resolver_submit_one(val_context_t * context, struct queries_for_query **queries
         return VAL_NO_ERROR;
     }
 
-    val_log(context, LOG_INFO,
+    VAL_LOG(context, LOG_INFO,
             "_resolver_submit_one(): sending query for {%s %s(%d) %s(%d)}, flags=%x%s",
             name_p, p_class(query->qfq_query->qc_class_h),
             query->qfq_query->qc_class_h, p_type(query->qfq_query->qc_type_h),
@@ -5583,6 +5773,19 @@ _resolver_submit_one(val_context_t * context, struct queries_for_query **queries
     if (VAL_NO_ERROR != retval)
         return retval;
 
+    /* 
+     * A local zone copy may answer the query outright or refer
+     * us further down the tree 
+     */
+    for (hops = 0; hops < QUERY_MIRROR_MAX_REFERRALS &&
+                   query->qfq_query->qc_state == Q_INIT; hops++) {
+        retval = _resolver_mirror_one(context, queries, query, &answered);
+        if (VAL_NO_ERROR != retval)
+            return retval;
+        if (!answered)
+            break;
+    }
+
     /* find_nslist_for_query() could have modified the state */
     if (query->qfq_query->qc_state == Q_INIT) {
 #ifndef VAL_NO_ASYNC
@@ -5591,8 +5794,12 @@ _resolver_submit_one(val_context_t * context, struct queries_for_query **queries
         else
 #endif
             retval = val_resquery_send(context, query);
-        if (retval == VAL_NO_ERROR)
+        if (retval == VAL_NO_ERROR) {
             query->qfq_query->qc_state = Q_SENT;
+            query->qfq_sent = 1;
+            if (val_span_enabled)
+                val_span_query(query->qfq_query, VAL_SPAN_QUERY_SENT);
+        }
     }
 
     return retval;
@@ -5610,7 +5817,7 @@ _resolver_submit(val_context_t * context, struct queries_for_query **queries,
         (data_missing == NULL))
         return VAL_BAD_ARGUMENT;
 
-    val_log(NULL, LOG_DEBUG, __FUNCTION__);
+    VAL_LOG(NULL, LOG_DEBUG, __FUNCTION__);
 
     /** nothing to do if no data missing */
     if (*data_missing == 0)
@@ -5638,6 +5845,8 @@ _resolver_submit(val_context_t * context, struct queries_for_query **queries,
             break;
         if (next_q->qfq_query->qc_state == Q_SENT)
             ++(*sent);
+        else if (next_q->qfq_query->qc_state > Q_SENT)
+            *data_received = 1;
     }
 
     /* if no data needed, tell caller no data is missing */
@@ -5656,7 +5865,7 @@ _resolver_rcv_one(val_context_t * context, struct queries_for_query **queries,
     char                      name_p[NS_MAXDNAME];
     int                       retval;
 
-    val_log(NULL, LOG_DEBUG, __FUNCTION__);
+    VAL_LOG(NULL, LOG_DEBUG, __FUNCTION__);
 
     /** only care about quereies that were just sent */
     if (next_q->qfq_query->qc_state != Q_SENT)
@@ -5674,11 +5883,14 @@ _resolver_rcv_one(val_context_t * context, struct queries_for_query **queries,
     if (retval != VAL_NO_ERROR)
         return retval;
 
+    if (val_span_enabled && next_q->qfq_query->qc_state >= Q_ANSWERED)
+        val_span_query(next_q->qfq_query, VAL_SPAN_QUERY_DONE);
+
     if ((next_q->qfq_query->qc_state == Q_ANSWERED) && (response != NULL)) {
         if (-1 == ns_name_ntop(next_q->qfq_query->qc_name_n, name_p,
                                sizeof(name_p)))
             snprintf(name_p, sizeof(name_p), "unknown/error");
-        val_log(context, LOG_INFO,
+        VAL_LOG(context, LOG_INFO,
                 "_resolver_rcv_one(): found matching ack/nack response for {%s %s(%d) %s(%d)}, flags=%x",
                 name_p, p_class(next_q->qfq_query->qc_class_h),
                 next_q->qfq_query->qc_class_h,
@@ -5688,14 +5900,14 @@ _resolver_rcv_one(val_context_t * context, struct queries_for_query **queries,
             (retval = assimilate_answers(context, queries, response,
                                          next_q))) {
             free_domain_info_ptrs(response);
-            FREE(response);
+            arena_free(response);
             return retval;
         }
     } else if (next_q->qfq_query->qc_state > Q_ERROR_BASE) {
         if (-1 == ns_name_ntop(next_q->qfq_query->qc_name_n, name_p,
                                sizeof(name_p)))
             snprintf(name_p, sizeof(name_p), "unknown/error");
-        val_log(context, LOG_INFO,
+        VAL_LOG(context, LOG_INFO,
                 "_resolver_rcv_one(): received error response for {%s %s(%d) %s(%d)}, flags=%x: %d",
                 name_p, p_class(next_q->qfq_query->qc_class_h),
                 next_q->qfq_query->qc_class_h,
@@ -5707,7 +5919,7 @@ _resolver_rcv_one(val_context_t * context, struct queries_for_query **queries,
 
     if (response != NULL) {
         free_domain_info_ptrs(response);
-        FREE(response);
+        arena_free(response);
     }
 
     if (next_q->qfq_query->qc_state > Q_SENT)
@@ -5747,7 +5959,7 @@ check_proof_sanity(val_context_t * context,
             if (as->val_ac_rrset.ac_data->rrs_type_h == ns_t_soa) {
                 if (!namecmp(as->val_ac_rrset.ac_data->rrs_name_n,
                              top_q->qc_name_n)) {
-                    val_log(context, LOG_INFO,
+                    VAL_LOG(context, LOG_INFO,
                             "check_proof_sanity(): Bogus Response - Proof of non-existence for DS received from child");
                     status = VAL_BOGUS_PROOF;
                 }
@@ -5869,7 +6081,7 @@ check_wildcard_sanity(val_context_t * context,
                      */
                     top_q->qc_flags |= VAL_QUERY_NEEDS_REFRESH;
                 } else {
-                    val_log(context, LOG_INFO,
+                    VAL_LOG(context, LOG_INFO,
                             "check_wildcard_sanity(): Could not prove non-existence of name that was wildcard expanded");
                     target_res->val_rc_status = VAL_BOGUS;
                 }
@@ -5877,7 +6089,7 @@ check_wildcard_sanity(val_context_t * context,
                 /*
                  * Can't prove wildcard 
                  */
-                val_log(context, LOG_INFO,
+                VAL_LOG(context, LOG_INFO,
                             "check_wildcard_sanity(): Missing data for proving non-existence of name that was wildcard expanded");
                 target_res->val_rc_status = VAL_INDETERMINATE;
             }
@@ -5931,7 +6143,7 @@ check_alias_sanity(val_context_t * context,
             register_query(&ql, qname_n, top_q->qc_type_h,
                            top_q->qc_zonecut_n)) {
             loop = 1;
-            val_log(context, LOG_INFO, "check_alias_sanity(): Loop in alias chain detected");
+            VAL_LOG(context, LOG_INFO, "check_alias_sanity(): Loop in alias chain detected");
             if (new_res) {
                 new_res->val_rc_status = VAL_BOGUS;
             }
@@ -6180,7 +6392,7 @@ perform_sanity_checks(val_context_t * context,
              * bail out early -- mark all answers as bogus - 
              * all answers are related in the proof 
              */
-            val_log(context, LOG_INFO, "perform_sanity_checks(): Not all proofs were validated");
+            VAL_LOG(context, LOG_INFO, "perform_sanity_checks(): Not all proofs were validated");
             for (res = w_results; res; res = res->val_rc_next)
                 res->val_rc_status = VAL_BOGUS_PROOF;
         } else {
@@ -6216,6 +6428,126 @@ perform_sanity_checks(val_context_t * context,
     return VAL_NO_ERROR;
 }
 
+/*
+ * Identify the zone that the answer to q comes from: either the
+ * zonecut learned while resolving it or the signer of the first RRSIG
+ */
+static u_char *
+_chain_zonecut(struct val_query_chain *q)
+{
+    struct val_digested_auth_chain *as;
+    struct rrset_rr *sig;
+
+    if (q->qc_zonecut_n)
+        return q->qc_zonecut_n;
+
+    for (as = q->qc_ans ? q->qc_ans : q->qc_proof; as;
+         as = as->val_ac_rrset.val_ac_rrset_next) {
+        if (as->val_ac_rrset.ac_data == NULL)
+            continue;
+        for (sig = as->val_ac_rrset.ac_data->rrs_sig; sig;
+             sig = sig->rr_next) {
+            if (sig->rr_rdata && sig->rr_rdata_length > SIGNBY &&
+                wire_name_length(&sig->rr_rdata[SIGNBY]) <=
+                    sig->rr_rdata_length - SIGNBY)
+                return &sig->rr_rdata[SIGNBY];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Issue the DNSKEY and DS queries for every ancestor of the zone
+ * that answers top_q, up to its trust point, instead of waiting for
+ * each link in the chain of trust to be discovered in turn. The
+ * queries carry the same flags that build_pending_query() will use
+ * later on, so they are found in the query cache when it asks.
+ * Names between the zonecut and the trust point that are not zone
+ * cuts only cost an extra NODATA answer each, sent in parallel.
+ */
+static int
+prefetch_trust_chain(val_context_t *context,
+                     struct queries_for_query **queries,
+                     struct val_query_chain *top_q)
+{
+    u_char *zonecut_n;
+    u_char *tp_n = NULL;
+    u_char *name_n;
+    u_int16_t tzonestatus;
+    u_int32_t ttl_x = 0;
+    size_t zc_len, tp_len;
+    struct queries_for_query *added_q;
+    char name_p[NS_MAXDNAME];
+    char tp_p[NS_MAXDNAME];
+    int depth;
+    int retval;
+
+    if (top_q->qc_flags & (VAL_QUERY_DONT_VALIDATE | VAL_QUERY_USING_DLV))
+        return VAL_NO_ERROR;
+
+    if (NULL == (zonecut_n = _chain_zonecut(top_q)))
+        return VAL_NO_ERROR;
+
+    /* only redo this if we have been referred further down */
+    zc_len = wire_name_length(zonecut_n);
+    if (zc_len <= top_q->qc_chain_prefetched)
+        return VAL_NO_ERROR;
+    top_q->qc_chain_prefetched = zc_len;
+
+    if (VAL_NO_ERROR != (retval = 
+        get_zse(context, zonecut_n, top_q->qc_flags, 
+                &tzonestatus, NULL, &ttl_x)))
+        return retval;
+    if (tzonestatus != VAL_AC_WAIT_FOR_TRUST)
+        return VAL_NO_ERROR;
+
+    if (VAL_NO_ERROR != (retval = 
+        find_trust_point(context, zonecut_n, &tp_n, &ttl_x)))
+        return retval;
+    if (tp_n == NULL)
+        return VAL_NO_ERROR;
+    tp_len = wire_name_length(tp_n);
+
+    /* don't speculate on long runs of names that may not be zones */
+    for (depth = 0, name_n = zonecut_n; 
+         wire_name_length(name_n) > tp_len;
+         name_n += name_n[0] + 1)
+        depth++;
+
+    if (-1 == ns_name_ntop(zonecut_n, name_p, sizeof(name_p)))
+        snprintf(name_p, sizeof(name_p), "unknown/error");
+    if (-1 == ns_name_ntop(tp_n, tp_p, sizeof(tp_p)))
+        snprintf(tp_p, sizeof(tp_p), "unknown/error");
+    VAL_LOG(context, LOG_DEBUG, 
+            "prefetch_trust_chain(): Fetching chain of trust for %s up to %s", 
+            name_p, tp_p);
+
+    name_n = zonecut_n;
+    while (1) {
+        if (VAL_NO_ERROR != (retval = 
+                add_to_qfq_chain(context, queries, name_n, ns_t_dnskey,
+                                 top_q->qc_class_h, top_q->qc_flags, 
+                                 &added_q)))
+            break;
+        if (wire_name_length(name_n) <= tp_len)
+            break;
+        if (VAL_NO_ERROR != (retval = 
+                add_to_qfq_chain(context, queries, name_n, ns_t_ds,
+                                 top_q->qc_class_h, top_q->qc_flags, 
+                                 &added_q)))
+            break;
+        if (depth > QUERY_CHAIN_PREFETCH_DEPTH) {
+            /* only the zonecut and the trust point */
+            name_n = tp_n;
+        } else {
+            name_n += name_n[0] + 1;
+        }
+    }
+
+    arena_free(tp_n);
+    return retval;
+}
+
 static int 
 construct_authentication_chain(val_context_t * context,
                                struct queries_for_query *top_qfq,
@@ -6262,7 +6594,18 @@ construct_authentication_chain(val_context_t * context,
         *done = 1;
         return VAL_NO_ERROR;
 
-    } else if (top_q->qc_state > Q_SENT) {
+    }
+    
+    /*
+     * Once we know where the answer comes from, go after 
+     * the rest of the chain of trust in parallel
+     */
+    if (VAL_NO_ERROR != 
+            (retval = prefetch_trust_chain(context, queries, top_q))) {
+        return retval;
+    }
+
+    if (top_q->qc_state > Q_SENT) {
 
         /*
          * validate what ever is possible. 
@@ -6353,7 +6696,7 @@ int try_chase_query(val_context_t * context,
     if (context == NULL || queries == NULL || results == NULL || done == NULL)
         return VAL_BAD_ARGUMENT;
 
-    val_log(NULL, LOG_DEBUG, __FUNCTION__);
+    VAL_LOG(NULL, LOG_DEBUG, __FUNCTION__);
 
     if (VAL_NO_ERROR !=
         (retval =
@@ -6389,123 +6732,660 @@ int try_chase_query(val_context_t * context,
 }
 
 /*
- * Look inside the cache, ask the resolver for missing data.
- * Then try and validate what ever is possible.
- * Return when we are ready with some useful answer (error condition is 
- * a useful answer)
+ * Serve-stale (RFC 8767) support.
+ *
+ * The last trusted answer for each query is kept in the context's
+ * stale_table.  If upstream resolution for the same query fails, or has
+ * not completed within serve-stale-timeout milliseconds, a copy of that
+ * answer is returned with VAL_FLAG_STALE set in its status, as long as it
+ * expired less than serve-stale seconds ago.  Resolution is then left to
+ * continue in the background.
  */
-int
-val_resolve_and_check(val_context_t * ctx,
-                      const char * domain_name,
-                      int class_h,
-                      int type_h,
-                      u_int32_t flags,
-                      struct val_result_chain **results)
+static struct val_rr_rec *
+clone_val_rr_list(struct val_rr_rec *o_rr)
 {
+    struct val_rr_rec *c_rr, *n_rr, *head_rr;
+    size_t siz = 0;
+    u_char *buf;
 
-    int             retval;
-    struct queries_for_query *top_q = NULL;
-    struct queries_for_query *added_q = NULL;
-    struct val_internal_result *w_results = NULL;
-    struct queries_for_query *queries = NULL;
-    int done = 0;
-    int data_received;
-    int data_missing;
-    val_context_t  *context = NULL;
-    u_char domain_name_n[NS_MAXCDNAME];
-    u_int16_t q_class, q_type;
-    
-    if ((results == NULL) || (domain_name == NULL))
-        return VAL_BAD_ARGUMENT;
+    if (NULL == o_rr)
+        return NULL;
 
-    val_log(NULL, LOG_DEBUG, __FUNCTION__);
-    /* 
-     * Sanity check the values of class and type 
-     * Should not be larger than sizeof u_int16_t
-     */
-    if (class_h < 0 || type_h < 0 || 
-        type_h > ns_t_max || class_h > ns_c_max) {
-        return VAL_BAD_ARGUMENT;
-    } 
-    q_class = (u_int16_t) class_h;
-    q_type = (u_int16_t) type_h;
+    for (c_rr = o_rr; c_rr; c_rr = c_rr->rr_next)
+        siz += c_rr->rr_rdata_length + sizeof(struct val_rr_rec);
 
-    if ((retval = ns_name_pton(domain_name, 
-                        domain_name_n, sizeof(domain_name_n))) == -1) {
-        val_log(ctx, LOG_INFO, "val_resolve_and_check(): Cannot parse name %s",
-                domain_name);
-        return VAL_BAD_ARGUMENT;
-    }
-    
-    /*
-     * refresh context config, or create a new context if one does not exist 
-     */
-    context = val_create_or_refresh_context(ctx); /* does CTX_LOCK_POL_SH */
-    if (context == NULL)
-        return VAL_INTERNAL_ERROR;
-  
-    CTX_LOCK_ACACHE(context);
-   
-    if (VAL_NO_ERROR != (retval =
-                add_to_qfq_chain(context, &queries, domain_name_n, q_type, q_class, 
-                    (flags | context->def_cflags | context->def_uflags) & VAL_QFLAGS_USERMASK, 
-                    &added_q))) {
-        goto err;
+    /* same single-block layout as copy_rr_rec_list() */
+    buf = (u_char *) MALLOC (siz * sizeof(u_char));
+    if (NULL == buf)
+        return NULL;
+
+    head_rr = (struct val_rr_rec *)buf;
+    for (c_rr = o_rr; c_rr; c_rr = c_rr->rr_next) {
+        n_rr = (struct val_rr_rec *)buf;
+        n_rr->rr_rdata = buf+sizeof(struct val_rr_rec);
+        memcpy(n_rr->rr_rdata, c_rr->rr_rdata, c_rr->rr_rdata_length);
+        n_rr->rr_rdata_length = c_rr->rr_rdata_length;
+        n_rr->rr_status = c_rr->rr_status;
+        if (c_rr->rr_next) {
+            buf += sizeof(struct val_rr_rec) + n_rr->rr_rdata_length;
+            n_rr->rr_next = (struct val_rr_rec *)buf;
+        } else {
+            n_rr->rr_next = NULL;
+        }
     }
-    top_q = added_q;
 
-    /* XXX if this query is already active we should wait till it finishes */
-        
-    data_missing = 1;
-    data_received = 0;
-    while (!done) {
-        struct queries_for_query *last_q;
-        fd_set pending_desc;
-        struct timeval closest_event;
-    
-        val_log(NULL,LOG_DEBUG,"libsres: ");
-        val_log(NULL,LOG_DEBUG,"libsres: ""val_resolve_and_check !done");
-        FD_ZERO(&pending_desc);
-        timerclear(&closest_event);
+    return head_rr;
+}
 
-        /*
-         * keep track of the last entry added to the query chain 
-         */
-        last_q = queries;
+static struct val_rrset_rec *
+clone_val_rrset_rec(struct val_rrset_rec *o_rrset)
+{
+    struct val_rrset_rec *n_rrset;
 
-        /*
-         * Data might already be present in the cache 
-         */
-        /*
-         * XXX by-pass this functionality through flags if needed 
-         */
-        if (VAL_NO_ERROR !=
-            (retval = ask_cache(context, &queries, &data_received, &data_missing)))
+    n_rrset = (struct val_rrset_rec *) MALLOC(sizeof(struct val_rrset_rec));
+    if (n_rrset == NULL)
+        return NULL;
+    memcpy(n_rrset, o_rrset, sizeof(struct val_rrset_rec));
+    n_rrset->val_rrset_server = NULL;
+    n_rrset->val_rrset_data = NULL;
+    n_rrset->val_rrset_sig = NULL;
+
+    if ((o_rrset->val_rrset_server &&
+         NULL == (n_rrset->val_rrset_server = (struct sockaddr *)
+                        MALLOC(sizeof(struct sockaddr_storage)))) ||
+        (o_rrset->val_rrset_data &&
+         NULL == (n_rrset->val_rrset_data =
+                        clone_val_rr_list(o_rrset->val_rrset_data))) ||
+        (o_rrset->val_rrset_sig &&
+         NULL == (n_rrset->val_rrset_sig =
+                        clone_val_rr_list(o_rrset->val_rrset_sig)))) {
+        free_val_rrset(n_rrset);
+        return NULL;
+    }
+    if (n_rrset->val_rrset_server)
+        memcpy(n_rrset->val_rrset_server, o_rrset->val_rrset_server,
+               sizeof(struct sockaddr_storage));
+
+    return n_rrset;
+}
+
+static void
+free_val_ac_chain(struct val_authentication_chain *ac)
+{
+    struct val_authentication_chain *trust;
+
+    while (NULL != (trust = ac)) {
+        ac = trust->val_ac_trust;
+        trust->val_ac_trust = NULL;
+        val_free_authentication_chain_structure(trust);
+    }
+}
+
+static int
+clone_val_ac_chain(struct val_authentication_chain *o_ac,
+                   struct val_authentication_chain **n_chain)
+{
+    struct val_authentication_chain *n_ac, *prev_ac = NULL;
+
+    *n_chain = NULL;
+    for (; o_ac; o_ac = o_ac->val_ac_trust) {
+        n_ac = (struct val_authentication_chain *)
+            MALLOC(sizeof(struct val_authentication_chain));
+        if (n_ac == NULL)
+            goto err;
+        n_ac->val_ac_status = o_ac->val_ac_status;
+        n_ac->val_ac_trust = NULL;
+        n_ac->val_ac_rrset = NULL;
+        if (o_ac->val_ac_rrset &&
+            NULL == (n_ac->val_ac_rrset =
+                        clone_val_rrset_rec(o_ac->val_ac_rrset))) {
+            FREE(n_ac);
+            goto err;
+        }
+        if (prev_ac)
+            prev_ac->val_ac_trust = n_ac;
+        else
+            *n_chain = n_ac;
+        prev_ac = n_ac;
+    }
+    return VAL_NO_ERROR;
+
+  err:
+    free_val_ac_chain(*n_chain);
+    *n_chain = NULL;
+    return VAL_OUT_OF_MEMORY;
+}
+
+/*
+ * Make a deep copy of a result chain
+ */
+static int
+clone_result_chain(struct val_result_chain *o_res,
+                   struct val_result_chain **n_results)
+{
+    struct val_result_chain *n_res, *prev_res = NULL;
+    int i;
+
+    *n_results = NULL;
+    for (; o_res; o_res = o_res->val_rc_next) {
+        n_res = (struct val_result_chain *)
+            MALLOC(sizeof(struct val_result_chain));
+        if (n_res == NULL)
+            goto err;
+        memset(n_res, 0, sizeof(struct val_result_chain));
+        n_res->val_rc_status = o_res->val_rc_status;
+        if (prev_res)
+            prev_res->val_rc_next = n_res;
+        else
+            *n_results = n_res;
+        prev_res = n_res;
+
+        if (o_res->val_rc_alias &&
+            NULL == (n_res->val_rc_alias = strdup(o_res->val_rc_alias)))
+            goto err;
+
+        if (o_res->val_rc_answer) {
+            if (VAL_NO_ERROR != clone_val_ac_chain(o_res->val_rc_answer,
+                                                   &n_res->val_rc_answer))
+                goto err;
+            /* val_rc_rrset points into the answer chain */
+            if (o_res->val_rc_rrset)
+                n_res->val_rc_rrset = n_res->val_rc_answer->val_ac_rrset;
+        } else if (o_res->val_rc_rrset &&
+                   NULL == (n_res->val_rc_rrset =
+                                clone_val_rrset_rec(o_res->val_rc_rrset))) {
+            goto err;
+        }
+
+        for (i = 0; i < o_res->val_rc_proof_count && i < MAX_PROOFS; i++) {
+            if (VAL_NO_ERROR != clone_val_ac_chain(o_res->val_rc_proofs[i],
+                                                   &n_res->val_rc_proofs[i]))
+                goto err;
+            n_res->val_rc_proof_count++;
+        }
+    }
+    return VAL_NO_ERROR;
+
+  err:
+    val_free_result_chain(*n_results);
+    *n_results = NULL;
+    return VAL_OUT_OF_MEMORY;
+}
+
+static void
+free_stale_answer(struct val_stale_answer *sa)
+{
+    val_free_result_chain(sa->sa_results);
+    FREE(sa);
+}
+
+void
+free_stale_answers(val_context_t *context)
+{
+    struct val_stale_answer *sa;
+    int i;
+
+    if (context == NULL)
+        return;
+
+    for (i = 0; i < VAL_STALE_BUCKETS; i++) {
+        while (NULL != (sa = context->stale_table[i])) {
+            context->stale_table[i] = sa->sa_next;
+            free_stale_answer(sa);
+        }
+    }
+    context->stale_newest = NULL;
+    context->stale_oldest = NULL;
+    context->stale_count = 0;
+}
+
+static struct val_stale_answer **
+_stale_bucket(val_context_t *context, u_char *name_n, u_int16_t type_h)
+{
+    return &context->stale_table[res_name_hash(name_n,
+                                               wire_name_length(name_n),
+                                               type_h) % VAL_STALE_BUCKETS];
+}
+
+static void
+_stale_age_unlink(val_context_t *context, struct val_stale_answer *sa)
+{
+    if (sa->sa_newer)
+        sa->sa_newer->sa_older = sa->sa_older;
+    else
+        context->stale_newest = sa->sa_older;
+    if (sa->sa_older)
+        sa->sa_older->sa_newer = sa->sa_newer;
+    else
+        context->stale_oldest = sa->sa_newer;
+}
+
+static void
+_stale_age_link(val_context_t *context, struct val_stale_answer *sa)
+{
+    sa->sa_newer = NULL;
+    sa->sa_older = context->stale_newest;
+    if (context->stale_newest)
+        context->stale_newest->sa_newer = sa;
+    else
+        context->stale_oldest = sa;
+    context->stale_newest = sa;
+}
+
+/*
+ * Remove the entry at *sap from its bucket and free it.
+ * Caller must have CTX_LOCK_ACACHE.
+ */
+static void
+_stale_drop(val_context_t *context, struct val_stale_answer **sap)
+{
+    struct val_stale_answer *sa = *sap;
+
+    *sap = sa->sa_next;
+    _stale_age_unlink(context, sa);
+    context->stale_count--;
+    free_stale_answer(sa);
+}
+
+/*
+ * Find the stale answer entry for a query, dropping any entries
+ * in the same bucket that are too old to be served along the way.
+ * Caller must have CTX_LOCK_ACACHE.
+ */
+static struct val_stale_answer *
+_stale_find(val_context_t *context, u_char *name_n, u_int16_t type_h,
+            u_int16_t class_h, u_int32_t flags, long now)
+{
+    struct val_stale_answer *sa, **sap, *found = NULL;
+    long max_stale = context->g_opt ? context->g_opt->serve_stale : 0;
+
+    flags &= VAL_QFLAGS_CACHE_MASK & ~VAL_QUERY_PREFETCH;
+
+    sap = _stale_bucket(context, name_n, type_h);
+    while (NULL != (sa = *sap)) {
+        if (now - (long) sa->sa_ttl_x > max_stale) {
+            _stale_drop(context, sap);
+            continue;
+        }
+        if (found == NULL &&
+            sa->sa_type_h == type_h && sa->sa_class_h == class_h &&
+            sa->sa_flags == flags && namecmp(sa->sa_name_n, name_n) == 0)
+            found = sa;
+        sap = &sa->sa_next;
+    }
+    return found;
+}
+
+/*
+ * Find an expired answer that may be served for a query.
+ * Caller must have CTX_LOCK_ACACHE.
+ */
+static struct val_stale_answer *
+_stale_lookup(val_context_t *context, u_char *name_n, u_int16_t type_h,
+              u_int16_t class_h, u_int32_t flags, long now)
+{
+    struct val_stale_answer *sa;
+
+    sa = _stale_find(context, name_n, type_h, class_h, flags, now);
+    if (sa == NULL || now < (long) sa->sa_ttl_x)
+        return NULL;
+    return sa;
+}
+
+/*
+ * Drop the entry that was stored longest ago.
+ * Caller must have CTX_LOCK_ACACHE.
+ */
+static void
+_stale_evict(val_context_t *context)
+{
+    struct val_stale_answer *sa = context->stale_oldest, **sap;
+
+    sap = _stale_bucket(context, sa->sa_name_n, sa->sa_type_h);
+    while (*sap != sa)
+        sap = &(*sap)->sa_next;
+    _stale_drop(context, sap);
+}
+
+/*
+ * Remember a trusted answer so that it can be served
+ * if later attempts to refresh it fail.
+ */
+static void
+_stale_store(val_context_t *context, struct val_query_chain *q,
+             u_int32_t flags, struct val_result_chain *results)
+{
+    struct val_stale_answer *sa, **bucket;
+    struct val_result_chain *res;
+    struct timeval now;
+
+    if (results == NULL || q->qc_ttl_x == 0)
+        return;
+    for (res = results; res; res = res->val_rc_next) {
+        if (!val_istrusted(res->val_rc_status) ||
+            val_isstale(res->val_rc_status))
+            return;
+    }
+
+    gettimeofday(&now, NULL);
+    sa = _stale_find(context, q->qc_original_name, q->qc_type_h,
+                     q->qc_class_h, flags, now.tv_sec);
+    if (sa != NULL) {
+        if (sa->sa_ttl_x == q->qc_ttl_x)
+            return; /* already have this answer */
+        val_free_result_chain(sa->sa_results);
+        sa->sa_results = NULL;
+        _stale_age_unlink(context, sa);
+        _stale_age_link(context, sa);
+    } else {
+        if (context->stale_count >= VAL_STALE_MAX_ENTRIES)
+            _stale_evict(context);
+        sa = (struct val_stale_answer *)
+            MALLOC(sizeof(struct val_stale_answer));
+        if (sa == NULL)
+            return;
+        memcpy(sa->sa_name_n, q->qc_original_name,
+               wire_name_length(q->qc_original_name));
+        sa->sa_type_h = q->qc_type_h;
+        sa->sa_class_h = q->qc_class_h;
+        sa->sa_flags = flags & VAL_QFLAGS_CACHE_MASK & ~VAL_QUERY_PREFETCH;
+        sa->sa_results = NULL;
+        bucket = _stale_bucket(context, q->qc_original_name, q->qc_type_h);
+        sa->sa_next = *bucket;
+        *bucket = sa;
+        _stale_age_link(context, sa);
+        context->stale_count++;
+    }
+
+    sa->sa_ttl_x = q->qc_ttl_x;
+    if (VAL_NO_ERROR != clone_result_chain(results, &sa->sa_results))
+        sa->sa_ttl_x = 0; /* dropped at the next lookup */
+}
+
+static void
+_stale_set_ttl(struct val_authentication_chain *ac)
+{
+    for (; ac; ac = ac->val_ac_trust) {
+        if (ac->val_ac_rrset)
+            ac->val_ac_rrset->val_rrset_ttl = VAL_STALE_TTL;
+    }
+}
+
+/*
+ * Return a copy of an expired answer in place of the current results
+ * and keep refreshing the query in the background.
+ */
+static int
+_stale_serve(val_context_t *context, struct val_query_chain *q,
+             struct val_stale_answer *sa, struct val_result_chain **results)
+{
+    struct val_result_chain *res;
+    char name_p[NS_MAXDNAME];
+    int retval, i;
+
+    if (VAL_NO_ERROR != (retval = clone_result_chain(sa->sa_results, &res)))
+        return retval;
+
+    val_free_result_chain(*results);
+    *results = res;
+    for (; res; res = res->val_rc_next) {
+        res->val_rc_status |= VAL_FLAG_STALE;
+        if (res->val_rc_answer)
+            _stale_set_ttl(res->val_rc_answer);
+        else if (res->val_rc_rrset)
+            res->val_rc_rrset->val_rrset_ttl = VAL_STALE_TTL;
+        for (i = 0; i < res->val_rc_proof_count; i++)
+            _stale_set_ttl(res->val_rc_proofs[i]);
+    }
+
+    if (-1 == ns_name_ntop(sa->sa_name_n, name_p, sizeof(name_p)))
+        snprintf(name_p, sizeof(name_p), "unknown/error");
+    VAL_LOG(context, LOG_NOTICE,
+            "serve-stale: answering {%s %s(%d) %s(%d)} from data that expired %lds ago",
+            name_p, p_class(sa->sa_class_h), sa->sa_class_h,
+            p_type(sa->sa_type_h), sa->sa_type_h,
+            (long) time(NULL) - (long) sa->sa_ttl_x);
+
+#ifndef VAL_NO_THREADS
+    /*
+     * Hand the refresh over to the prefetch thread; the query
+     * that we have in flight is retired once we are done with it.
+     */
+    if (!q->qc_prefetch && _prefetch_schedule(context, q)) {
+        q->qc_prefetch = 1;
+        q->qc_flags |= VAL_QUERY_MARK_FOR_DELETION;
+    }
+#endif
+
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Did resolution fail in a way that serve-stale can paper over?
+ */
+static int
+_results_failed(struct val_result_chain *results)
+{
+    struct val_result_chain *res;
+    int failed = (results == NULL);
+
+    for (res = results; res; res = res->val_rc_next) {
+        if (val_istrusted(res->val_rc_status))
+            return 0;
+        if (res->val_rc_status == VAL_DNS_ERROR)
+            failed = 1;
+    }
+    return failed;
+}
+
+/*
+ * Count the results of a request and record how long it took
+ */
+static void
+stats_results(struct queries_for_query *queries,
+              struct val_result_chain *results, struct timeval *start)
+{
+    /* a request that sent no query was answered from the caches */
+    if (results) {
+        for (; queries && !queries->qfq_sent; queries = queries->qfq_next)
+            ;
+        if (queries == NULL)
+            res_stats_inc(RES_STAT_REQUESTS_CACHED);
+    }
+    for (; results; results = results->val_rc_next) {
+        if (val_isvalidated(results->val_rc_status))
+            res_stats_inc(RES_STAT_RESULTS_VALIDATED);
+        else if (val_istrusted(results->val_rc_status))
+            res_stats_inc(RES_STAT_RESULTS_TRUSTED);
+        else
+            res_stats_inc(RES_STAT_RESULTS_UNTRUSTED);
+    }
+    res_stats_time(RES_HIST_REQUEST, start);
+}
+
+/*
+ * Record the final status of each result in the validation trace
+ */
+static void
+trace_results(struct queries_for_query *top_q,
+              struct val_result_chain *results)
+{
+    struct val_query_chain *q;
+
+    if (top_q == NULL)
+        return;
+    q = top_q->qfq_query;
+    for (; results; results = results->val_rc_next)
+        val_trace_result(q->qc_trace_id, q->qc_original_name,
+                         q->qc_type_h, q->qc_class_h,
+                         results->val_rc_status);
+}
+
+/*
+ * Worker for val_resolve_and_check(); internal_flags are
+ * library-only query flags that are not masked out with the
+ * user-supplied ones.
+ */
+static int
+_resolve_and_check(val_context_t * ctx,
+                   const char * domain_name,
+                   int class_h,
+                   int type_h,
+                   u_int32_t flags,
+                   u_int32_t internal_flags,
+                   struct val_result_chain **results)
+{
+
+    int             retval;
+    struct queries_for_query *top_q = NULL;
+    struct queries_for_query *added_q = NULL;
+    struct val_internal_result *w_results = NULL;
+    struct queries_for_query *queries = NULL;
+    int done = 0;
+    int data_received;
+    int data_missing;
+    val_context_t  *context = NULL;
+    u_char domain_name_n[NS_MAXCDNAME];
+    u_int16_t q_class, q_type;
+    u_int32_t qflags;
+    struct val_stale_answer *stale;
+    struct timeval stale_deadline;
+    int serve_stale = 0;
+    int served_stale = 0;
+    struct val_arena arena;
+    struct val_arena *prev_arena;
+    struct timeval start;
+    struct timeval phase;
+    struct val_span *span = NULL;
+    struct val_span *prev_span;
+    
+    if ((results == NULL) || (domain_name == NULL))
+        return VAL_BAD_ARGUMENT;
+
+    VAL_LOG(NULL, LOG_DEBUG, __FUNCTION__);
+    /* 
+     * Sanity check the values of class and type 
+     * Should not be larger than sizeof u_int16_t
+     */
+    if (class_h < 0 || type_h < 0 || 
+        type_h > ns_t_max || class_h > ns_c_max) {
+        return VAL_BAD_ARGUMENT;
+    } 
+    q_class = (u_int16_t) class_h;
+    q_type = (u_int16_t) type_h;
+
+    if ((retval = ns_name_pton(domain_name, 
+                        domain_name_n, sizeof(domain_name_n))) == -1) {
+        VAL_LOG(ctx, LOG_INFO, "val_resolve_and_check(): Cannot parse name %s",
+                domain_name);
+        return VAL_BAD_ARGUMENT;
+    }
+    
+    /*
+     * refresh context config, or create a new context if one does not exist 
+     */
+    context = val_create_or_refresh_context(ctx); /* does CTX_LOCK_POL_SH */
+    if (context == NULL)
+        return VAL_INTERNAL_ERROR;
+
+    gettimeofday(&start, NULL);
+    res_stats_inc(RES_STAT_REQUESTS);
+
+    /* temporaries for this request come from its own arena */
+    arena_init(&arena);
+    prev_arena = arena_enter(&arena);
+  
+    CTX_LOCK_ACACHE(context);
+
+    if (val_span_enabled)
+        span = val_span_new(context, domain_name, class_h, type_h, &start);
+    prev_span = val_span_enter(span);
+   
+    qflags = ((flags | context->def_cflags | context->def_uflags) & VAL_QFLAGS_USERMASK) |
+             internal_flags;
+    if (VAL_NO_ERROR != (retval =
+                add_to_qfq_chain(context, &queries, domain_name_n, q_type, q_class, 
+                    qflags, &added_q))) {
+        goto err;
+    }
+    top_q = added_q;
+    if (span)
+        span->vs_trace_id = top_q->qfq_query->qc_trace_id;
+
+    /* background refreshes never fall back to stale data */
+    if (context->g_opt && context->g_opt->serve_stale > 0 &&
+        !(qflags & VAL_QUERY_PREFETCH)) {
+        serve_stale = 1;
+        gettimeofday(&stale_deadline, NULL);
+        stale_deadline.tv_sec += context->g_opt->serve_stale_timeout / 1000;
+        stale_deadline.tv_usec +=
+            (context->g_opt->serve_stale_timeout % 1000) * 1000;
+        if (stale_deadline.tv_usec >= 1000000) {
+            stale_deadline.tv_sec++;
+            stale_deadline.tv_usec -= 1000000;
+        }
+    }
+
+    /* XXX if this query is already active we should wait till it finishes */
+        
+    data_missing = 1;
+    data_received = 0;
+    while (!done) {
+        struct queries_for_query *last_q;
+        fd_set pending_desc;
+        struct timeval closest_event;
+    
+        VAL_LOG(NULL,LOG_DEBUG,"libsres: ");
+        VAL_LOG(NULL,LOG_DEBUG,"libsres: ""val_resolve_and_check !done");
+        FD_ZERO(&pending_desc);
+        timerclear(&closest_event);
+
+        /*
+         * keep track of the last entry added to the query chain 
+         */
+        last_q = queries;
+
+        /*
+         * Data might already be present in the cache 
+         */
+        /*
+         * XXX by-pass this functionality through flags if needed 
+         */
+        SPAN_BEGIN(&phase);
+        retval = ask_cache(context, &queries, &data_received, &data_missing);
+        SPAN_END(VAL_SPAN_ASK_CACHE, &phase);
+        if (VAL_NO_ERROR != retval)
             goto err;
 
         /*
          * Send un-sent queries 
          */
-        if (VAL_NO_ERROR !=
-            (retval = ask_resolver(context, &queries, &pending_desc, 
-                                   &closest_event, &data_received, 
-                                   &data_missing)))
+        SPAN_BEGIN(&phase);
+        retval = ask_resolver(context, &queries, &pending_desc, 
+                              &closest_event, &data_received, 
+                              &data_missing);
+        SPAN_END(VAL_SPAN_ASK_RESOLVER, &phase);
+        if (VAL_NO_ERROR != retval)
             goto err;
 
 
-        if (VAL_NO_ERROR !=
-            (retval = fix_glue(context, &queries, &data_missing)))
+        SPAN_BEGIN(&phase);
+        retval = fix_glue(context, &queries, &data_missing);
+        SPAN_END(VAL_SPAN_FIX_GLUE, &phase);
+        if (VAL_NO_ERROR != retval)
             goto err;
         
         if (data_received || !data_missing) {
 
-            if (VAL_NO_ERROR != (retval = 
-                    construct_authentication_chain(context, 
-                                                   top_q, 
-                                                   &queries,
-                                                   &w_results,
-                                                   results, 
-                                                   &done)))
+            SPAN_BEGIN(&phase);
+            retval = construct_authentication_chain(context, 
+                                                    top_q, 
+                                                    &queries,
+                                                    &w_results,
+                                                    results, 
+                                                    &done);
+            SPAN_END(VAL_SPAN_CHAIN, &phase);
+            if (VAL_NO_ERROR != retval)
                 goto err;
 
             data_missing = 1;
@@ -6527,12 +7407,35 @@ val_resolve_and_check(val_context_t * ctx,
         /* We are either done or we are waiting for some data */
         if (!done) {
 
+            /* 
+             * Don't keep the caller waiting past the serve-stale timeout
+             * if we have an expired answer to fall back to
+             */
+            if (serve_stale &&
+                NULL != (stale = _stale_lookup(context, domain_name_n, q_type,
+                                               q_class, qflags, time(NULL)))) {
+                struct timeval now;
+
+                gettimeofday(&now, NULL);
+                if (!timercmp(&now, &stale_deadline, <)) {
+                    if (VAL_NO_ERROR != (retval =
+                            _stale_serve(context, top_q->qfq_query,
+                                         stale, results)))
+                        goto err;
+                    served_stale = 1;
+                    break;
+                }
+                if (!timerisset(&closest_event) ||
+                    timercmp(&stale_deadline, &closest_event, <))
+                    closest_event = stale_deadline;
+            }
+
             /* Release the lock, let some other thread get some time slice to run */
 #if 0
 #ifndef VAL_NO_THREADS
             struct timeval temp_t;
             gettimeofday(&temp_t, NULL);
-            val_log(context, LOG_DEBUG, 
+            VAL_LOG(context, LOG_DEBUG, 
                     "zzzzzzzzzz pselect(): (Thread %u) Waiting for %d seconds", 
                     (unsigned int)pthread_self(),
                     (closest_event.tv_sec >temp_t.tv_sec)? 
@@ -6543,38 +7446,403 @@ val_resolve_and_check(val_context_t * ctx,
             CTX_UNLOCK_ACACHE(context);
                 
             /* wait for some data to become available */
+            SPAN_BEGIN(&phase);
             wait_for_res_data(&pending_desc, &closest_event);
+            SPAN_END(VAL_SPAN_WAIT, &phase);
 
             /* Re-acquire the lock */
             CTX_LOCK_ACACHE(context);
 
 
-#if 0
-#ifndef VAL_NO_THREADS
-            val_log(context, LOG_DEBUG, 
-                    "zzzzzzzzzzzzz pselect(): (Thread %u) Woke up", 
-                    (unsigned int)pthread_self());
-#endif
-#endif
-        }
+#if 0
+#ifndef VAL_NO_THREADS
+            VAL_LOG(context, LOG_DEBUG, 
+                    "zzzzzzzzzzzzz pselect(): (Thread %u) Woke up", 
+                    (unsigned int)pthread_self());
+#endif
+#endif
+        }
+    }
+
+    retval = VAL_NO_ERROR;
+
+    if (!served_stale && context->g_opt && context->g_opt->serve_stale > 0) {
+        if (serve_stale && _results_failed(*results) &&
+            NULL != (stale = _stale_lookup(context, domain_name_n, q_type,
+                                           q_class, qflags, time(NULL)))) {
+            retval = _stale_serve(context, top_q->qfq_query, stale, results);
+        } else {
+            _stale_store(context, top_q->qfq_query, qflags, *results);
+        }
+    }
+
+    if (*results) {
+        val_log_authentication_chain(context, LOG_NOTICE, 
+            domain_name, class_h, type_h, *results);
+        if (val_trace_enabled)
+            trace_results(top_q, *results);
+    }
+
+  err:
+    stats_results(queries, retval == VAL_NO_ERROR ? *results : NULL, &start);
+    CTX_UNLOCK_ACACHE(context);
+
+    val_span_leave(prev_span);
+    if (span)
+        val_span_done(span, retval,
+                      retval == VAL_NO_ERROR ? *results : NULL);
+    CTX_UNLOCK_POL(context);
+
+    _free_w_results(w_results);
+    w_results = NULL;
+    free_qfq_chain(context, queries);
+
+    arena_leave(prev_arena);
+    arena_release(&arena);
+
+    return retval;
+}
+
+/*
+ * Look inside the cache, ask the resolver for missing data.
+ * Then try and validate what ever is possible.
+ * Return when we are ready with some useful answer (error condition is 
+ * a useful answer)
+ */
+int
+val_resolve_and_check(val_context_t * ctx,
+                      const char * domain_name,
+                      int class_h,
+                      int type_h,
+                      u_int32_t flags,
+                      struct val_result_chain **results)
+{
+    int             retval;
+
+    VAL_PROBE4(request_start, domain_name, class_h, type_h, flags);
+    retval = _resolve_and_check(ctx, domain_name, class_h, type_h,
+                                flags, 0, results);
+    VAL_PROBE5(request_done, domain_name, class_h, type_h, retval,
+               (retval == VAL_NO_ERROR && results && *results) ?
+               (int) (*results)->val_rc_status : -1);
+    return retval;
+}
+
+#ifndef VAL_NO_THREADS
+/*
+ * Prefetch (refresh-ahead) of popular cache entries.
+ *
+ * Once an answered entry in a context's query cache has been hit
+ * prefetch_hits times and has passed the configured percentage of its
+ * lifetime, a request to re-resolve it is handed to a background
+ * thread.  The refresh runs with VAL_QUERY_PREFETCH set, so it never
+ * matches (or hides) the entry that callers are still being served
+ * from, and with VAL_QUERY_SKIP_ANS_CACHE, so the answer is fetched and
+ * validated afresh.  When it succeeds the shared rrset cache holds the
+ * new data and the old entries are retired; the next lookup rebuilds
+ * them from the rrset cache without going to the network.
+ */
+struct prefetch_request {
+    val_context_t  *pf_ctx;
+    u_char          pf_name_n[NS_MAXCDNAME];
+    u_int16_t       pf_type_h;
+    u_int16_t       pf_class_h;
+    u_int32_t       pf_flags;
+    struct prefetch_request *pf_next;
+};
+
+static pthread_mutex_t prefetch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+static struct prefetch_request *prefetch_queue = NULL;
+static val_context_t *prefetch_active = NULL;
+static int prefetch_pending = 0;
+static pthread_t prefetch_tid;
+static int prefetch_started = 0;
+static int prefetch_stopping = 0;
+static int prefetch_atfork_set = 0;
+
+static void
+_prefetch_one(struct prefetch_request *req)
+{
+    val_context_t *context = req->pf_ctx;
+    struct val_result_chain *results = NULL;
+    struct val_query_chain *q;
+    char name_p[NS_MAXDNAME];
+    int refreshed = 0;
+    int retval;
+
+    if (-1 == ns_name_ntop(req->pf_name_n, name_p, sizeof(name_p)))
+        strcpy(name_p, "?");
+    else {
+        VAL_LOG(context, LOG_INFO, "prefetch: refreshing {%s %s(%d) %s(%d)}",
+                name_p, p_class(req->pf_class_h), req->pf_class_h,
+                p_type(req->pf_type_h), req->pf_type_h);
+
+        retval = _resolve_and_check(context, name_p, req->pf_class_h,
+                                    req->pf_type_h,
+                                    req->pf_flags | VAL_QUERY_SKIP_ANS_CACHE,
+                                    VAL_QUERY_PREFETCH, &results);
+        if (retval == VAL_NO_ERROR && results != NULL &&
+            val_istrusted(results->val_rc_status))
+            refreshed = 1;
+        val_free_result_chain(results);
+    }
+
+    /*
+     * The refresh entry itself is never reused; if the refresh worked,
+     * retire the entries callers were served from as well, otherwise
+     * let a later hit on them try again
+     */
+    CTX_LOCK_ACACHE(context);
+    for (q = context->q_list; q; q = q->qc_next) {
+        if (q->qc_type_h != req->pf_type_h ||
+            q->qc_class_h != req->pf_class_h ||
+            namecmp(q->qc_original_name, req->pf_name_n) != 0)
+            continue;
+        if ((q->qc_flags & VAL_QUERY_PREFETCH) || refreshed)
+            q->qc_flags |= VAL_QUERY_MARK_FOR_DELETION;
+        else
+            q->qc_prefetch = 0;
+    }
+    CTX_UNLOCK_ACACHE(context);
+
+    VAL_LOG(context, LOG_INFO, "prefetch: {%s %s(%d) %s(%d)} %s",
+            name_p, p_class(req->pf_class_h), req->pf_class_h,
+            p_type(req->pf_type_h), req->pf_type_h,
+            refreshed ? "refreshed" : "not refreshed");
+}
+
+/*
+ * Take the oldest queued request whose context is not being freed.
+ * NOTE: This assumes that the caller has the prefetch_mutex lock.
+ */
+static struct prefetch_request *
+_prefetch_next(void)
+{
+    struct prefetch_request **prev, *req;
+
+    for (prev = &prefetch_queue; *prev; prev = &(*prev)->pf_next) {
+        req = *prev;
+        if (req->pf_ctx->prefetch_hold == 0) {
+            *prev = req->pf_next;
+            --prefetch_pending;
+            return req;
+        }
+    }
+    return NULL;
+}
+
+static void *
+_prefetch_thread(void *arg)
+{
+    struct prefetch_request *req;
+
+    pthread_mutex_lock(&prefetch_mutex);
+    while (!prefetch_stopping) {
+        req = _prefetch_next();
+        if (req == NULL) {
+            pthread_cond_wait(&prefetch_cond, &prefetch_mutex);
+            continue;
+        }
+        prefetch_active = req->pf_ctx;
+        pthread_mutex_unlock(&prefetch_mutex);
+
+        _prefetch_one(req);
+        FREE(req);
+
+        pthread_mutex_lock(&prefetch_mutex);
+        prefetch_active = NULL;
+        pthread_cond_broadcast(&prefetch_cond);
+    }
+    pthread_mutex_unlock(&prefetch_mutex);
+
+    return NULL;
+}
+
+/*
+ * The prefetch thread does not survive fork(); hold prefetch_mutex
+ * across it so that the child gets a consistent queue, and let the
+ * child start its own thread the next time a refresh is scheduled.
+ */
+static void
+_prefetch_prefork(void)
+{
+    pthread_mutex_lock(&prefetch_mutex);
+}
+
+static void
+_prefetch_postfork_parent(void)
+{
+    pthread_mutex_unlock(&prefetch_mutex);
+}
+
+static void
+_prefetch_postfork_child(void)
+{
+    pthread_mutex_init(&prefetch_mutex, NULL);
+    pthread_cond_init(&prefetch_cond, NULL);
+    prefetch_active = NULL;
+    prefetch_started = 0;
+    prefetch_stopping = 0;
+}
+
+/*
+ * Queue a background refresh for the given cache entry.
+ * Returns 1 if the request was queued, 0 otherwise.
+ */
+static int
+_prefetch_schedule(val_context_t *context, struct val_query_chain *q)
+{
+    struct prefetch_request *req, **tail;
+    int queued = 0;
+
+    req = (struct prefetch_request *) MALLOC(sizeof(struct prefetch_request));
+    if (req == NULL)
+        return 0;
+    req->pf_ctx = context;
+    memcpy(req->pf_name_n, q->qc_original_name,
+           wire_name_length(q->qc_original_name));
+    req->pf_type_h = q->qc_type_h;
+    req->pf_class_h = q->qc_class_h;
+    /* the refresh is always driven synchronously by the prefetch thread */
+    req->pf_flags = q->qc_flags & VAL_QFLAGS_USERMASK &
+                    ~(VAL_QUERY_ASYNC | VAL_QUERY_SKIP_CACHE);
+    req->pf_next = NULL;
+
+    pthread_mutex_lock(&prefetch_mutex);
+    if (!prefetch_atfork_set) {
+        if (0 == pthread_atfork(_prefetch_prefork,
+                                _prefetch_postfork_parent,
+                                _prefetch_postfork_child))
+            prefetch_atfork_set = 1;
+    }
+    if (!prefetch_started && !prefetch_stopping &&
+        0 == pthread_create(&prefetch_tid, NULL, _prefetch_thread, NULL)) {
+        prefetch_started = 1;
+    }
+    if (prefetch_started &&
+        prefetch_pending < QUERY_PREFETCH_MAX_PENDING) {
+        for (tail = &prefetch_queue; *tail; tail = &(*tail)->pf_next)
+            ;
+        *tail = req;
+        ++prefetch_pending;
+        queued = 1;
+        pthread_cond_broadcast(&prefetch_cond);
+    }
+    pthread_mutex_unlock(&prefetch_mutex);
+
+    if (!queued)
+        FREE(req);
+    return queued;
+}
+
+/*
+ * Keep the prefetch thread off a context that may be about to be
+ * freed: no new refresh is started for it, and one that is currently
+ * running is waited for.  Must be followed by val_prefetch_release()
+ * if the context stays, or val_prefetch_forget() if it goes.
+ */
+void
+val_prefetch_hold(val_context_t *context)
+{
+    pthread_mutex_lock(&prefetch_mutex);
+    ++context->prefetch_hold;
+    while (prefetch_active == context)
+        pthread_cond_wait(&prefetch_cond, &prefetch_mutex);
+    pthread_mutex_unlock(&prefetch_mutex);
+}
+
+/*
+ * The context is still in use; let its queued refreshes run.
+ */
+void
+val_prefetch_release(val_context_t *context)
+{
+    pthread_mutex_lock(&prefetch_mutex);
+    --context->prefetch_hold;
+    pthread_cond_broadcast(&prefetch_cond);
+    pthread_mutex_unlock(&prefetch_mutex);
+}
+
+/*
+ * Drop any pending refreshes for a held context that is going away.
+ */
+void
+val_prefetch_forget(val_context_t *context)
+{
+    struct prefetch_request **prev, *req;
+
+    pthread_mutex_lock(&prefetch_mutex);
+    prev = &prefetch_queue;
+    while (*prev) {
+        req = *prev;
+        if (req->pf_ctx == context) {
+            *prev = req->pf_next;
+            --prefetch_pending;
+            FREE(req);
+        } else
+            prev = &req->pf_next;
     }
+    --context->prefetch_hold;
+    pthread_mutex_unlock(&prefetch_mutex);
+}
 
-    retval = VAL_NO_ERROR;
+/*
+ * Stop the prefetch thread, if one is running, and wait for it to
+ * exit.  Refreshes still queued stay queued until their context is
+ * freed or the thread is started again.
+ */
+void
+val_prefetch_stop(void)
+{
+    pthread_t       tid;
 
-    if (*results) {
-        val_log_authentication_chain(context, LOG_NOTICE, 
-            domain_name, class_h, type_h, *results);
+    pthread_mutex_lock(&prefetch_mutex);
+    if (!prefetch_started) {
+        pthread_mutex_unlock(&prefetch_mutex);
+        return;
     }
+    prefetch_stopping = 1;
+    tid = prefetch_tid;
+    pthread_cond_broadcast(&prefetch_cond);
+    pthread_mutex_unlock(&prefetch_mutex);
 
-  err:
-    CTX_UNLOCK_ACACHE(context);
-    CTX_UNLOCK_POL(context);
+    pthread_join(tid, NULL);
 
-    _free_w_results(w_results);
-    w_results = NULL;
-    free_qfq_chain(context, queries);
+    pthread_mutex_lock(&prefetch_mutex);
+    prefetch_started = 0;
+    prefetch_stopping = 0;
+    pthread_mutex_unlock(&prefetch_mutex);
+}
+#endif /* VAL_NO_THREADS */
 
-    return retval;
+/*
+ * Check if a cache entry that has just been hit is due for a
+ * background refresh.
+ */
+static void
+_prefetch_check(val_context_t * context, struct val_query_chain *q,
+                long now)
+{
+#ifndef VAL_NO_THREADS
+    val_global_opt_t *g_opt = context->g_opt;
+    long lifetime;
+
+    if (g_opt == NULL || g_opt->prefetch <= 0 ||
+        q->qc_prefetch || q->qc_bad ||
+        q->qc_state != Q_ANSWERED ||
+        (q->qc_flags & (VAL_QUERY_PREFETCH | VAL_QUERY_SKIP_RESOLVER)) ||
+        q->qc_hits < (u_int32_t) g_opt->prefetch_hits)
+        return;
+
+    lifetime = (long) q->qc_ttl_x - q->qc_created;
+    if (lifetime <= 0 ||
+        now - q->qc_created < lifetime * g_opt->prefetch / 100)
+        return;
+
+    if (_prefetch_schedule(context, q))
+        q->qc_prefetch = 1;
+#endif
 }
 
 /*
@@ -6594,7 +7862,7 @@ int
 val_istrusted(val_status_t val_status)
 {
     
-    switch (val_status) {
+    switch (val_status & ~VAL_FLAG_STALE) {
     case VAL_SUCCESS:
     case VAL_NONEXISTENT_NAME:
     case VAL_NONEXISTENT_TYPE:
@@ -6629,7 +7897,7 @@ val_istrusted(val_status_t val_status)
 int
 val_isvalidated(val_status_t val_status)
 {
-    switch (val_status) {
+    switch (val_status & ~VAL_FLAG_STALE) {
     case VAL_SUCCESS:
     case VAL_NONEXISTENT_NAME:
     case VAL_NONEXISTENT_TYPE:
@@ -6644,6 +7912,7 @@ val_isvalidated(val_status_t val_status)
 int
 val_does_not_exist(val_status_t status) 
 {
+    status &= ~VAL_FLAG_STALE;
     if ((status == VAL_NONEXISTENT_TYPE) ||
         (status == VAL_NONEXISTENT_NAME) ||
         (status == VAL_NONEXISTENT_NAME_NOCHAIN) ||
@@ -6655,6 +7924,26 @@ val_does_not_exist(val_status_t status)
     return 0;
 }
 
+/*
+ * Function: val_isstale
+ *
+ * Purpose:   Tells whether the given validation status code belongs to an
+ *            answer that was served from expired cache data because fresh
+ *            data could not be obtained in time (see serve-stale in
+ *            dnsval.conf).  The rest of the status is unaffected.
+ *
+ * Parameter: val_status -- a validation status code returned by the validator
+ *
+ * Returns:   1 if the answer was served stale
+ *            0 otherwise
+ *
+ */
+int
+val_isstale(val_status_t val_status)
+{
+    return (val_status & VAL_FLAG_STALE) ? 1 : 0;
+}
+
 /*****************************************************************************
  *
  *
@@ -6663,6 +7952,41 @@ val_does_not_exist(val_status_t status)
  *
  ****************************************************************************/
 #ifndef VAL_NO_ASYNC
+/*
+ * Put a batch request at the end of the context's queue of requests
+ * waiting to be started, or take it off the queue.
+ * caller must have CTX_LOCK_ACACHE.
+ */
+static void
+_async_queue_add(val_context_t *context, val_async_status *as)
+{
+    as->val_as_flags |= VAL_AS_QUEUED;
+    as->val_as_qnext = NULL;
+    as->val_as_qprev = context->as_queue_tail;
+    if (context->as_queue_tail)
+        context->as_queue_tail->val_as_qnext = as;
+    else
+        context->as_queue_head = as;
+    context->as_queue_tail = as;
+    ++context->as_queued;
+}
+
+static void
+_async_queue_remove(val_context_t *context, val_async_status *as)
+{
+    if (as->val_as_qprev)
+        as->val_as_qprev->val_as_qnext = as->val_as_qnext;
+    else
+        context->as_queue_head = as->val_as_qnext;
+    if (as->val_as_qnext)
+        as->val_as_qnext->val_as_qprev = as->val_as_qprev;
+    else
+        context->as_queue_tail = as->val_as_qprev;
+    as->val_as_qprev = as->val_as_qnext = NULL;
+    as->val_as_flags &= ~VAL_AS_QUEUED;
+    --context->as_queued;
+}
+
 /*
  * remove asynchronous status from context async queries list.
  * caller must have CTX_LOCK_ACACHE.
@@ -6696,6 +8020,10 @@ _context_as_remove(val_context_t *context, val_async_status *as)
     } /* as->val_as_ctx */
 
     if (curr) {
+        if (curr->val_as_flags & VAL_AS_QUEUED)
+            _async_queue_remove(context, curr);
+        else if (!(curr->val_as_flags & VAL_AS_DONE))
+            --context->as_active;
         curr->val_as_next = NULL;
         curr->val_as_ctx = NULL;
     }
@@ -6707,11 +8035,16 @@ _async_status_free(val_async_status **as)
     if (NULL == as || NULL == *as)
         return VAL_BAD_ARGUMENT;
 
-    val_log((*as)->val_as_ctx, LOG_DEBUG, "as %p releasing", (*as));
+    VAL_LOG((*as)->val_as_ctx, LOG_DEBUG, "as %p releasing", (*as));
 
     /* remove all pending queries from context list */
     free_qfq_chain((*as)->val_as_ctx, (*as)->val_as_queries);
     (*as)->val_as_queries = NULL;
+    arena_release(&(*as)->val_as_arena);
+
+    /* spans of cancelled requests are dropped */
+    val_span_free((*as)->val_as_span);
+    (*as)->val_as_span = NULL;
 
     if ((*as)->val_as_results) {
         val_free_result_chain((*as)->val_as_results);
@@ -6808,12 +8141,21 @@ _handle_completed(val_context_t *context)
     pthread_t                   self = pthread_self();
 #endif
     val_async_status           *as, *next, *last = NULL, *completed = NULL;
+#ifndef VAL_NO_THREADS
+    struct val_async_runtime   *rt;
+#endif
 
     if ((NULL == context) || (NULL == context->as_list))
         return;
 
     CTX_LOCK_ACACHE(context);
 
+#ifndef VAL_NO_THREADS
+    /* held until the callbacks below have been handed over */
+    if (NULL != (rt = context->as_runtime))
+        val_runtime_hold(rt);
+#endif
+
     /** find any completed requests and deal with them. */
     for (as = context->as_list; as; as = next) {
 
@@ -6830,7 +8172,7 @@ _handle_completed(val_context_t *context)
         }
 
         /** remove from context */
-        val_log(context, LOG_DEBUG, "as %p completed", as);
+        VAL_LOG(context, LOG_DEBUG, "as %p completed", as);
         if (context->as_list == as)
             context->as_list = as->val_as_next;
         else
@@ -6849,35 +8191,53 @@ _handle_completed(val_context_t *context)
     while (completed) {
         as = completed;
         completed = completed->val_as_next;
-        _call_callbacks(VAL_AS_EVENT_COMPLETED, as);
-        as->val_as_ctx = NULL; /* we've already removed ourselves */
-        _async_status_free(&as); /* no ctx, so no lock needed */
-        CTX_UNLOCK_POL(context);
+        as->val_as_next = NULL;
+#ifndef VAL_NO_THREADS
+        /* the runtime may run the callback somewhere else */
+        if (rt && val_runtime_deliver(rt, as))
+            continue;
+#endif
+        val_async_deliver(as);
     }
+
+#ifndef VAL_NO_THREADS
+    if (rt)
+        val_runtime_release(context, rt);
+#endif
 }
 
 /*
- * Look inside the cache, ask the resolver for missing data.
+ * Call the callback for a request that has been removed from its
+ * context, then release the request and the policy lock it held.
  */
-int
-val_async_submit(val_context_t * ctx,  const char * domain_name, int class_h,
-                 int type_h, u_int32_t flags, val_async_event_cb callback,
-                 void *cb_data, val_async_status **async_status)
+void
+val_async_deliver(val_async_status *as)
 {
+    val_context_t *context = as->val_as_ctx;
 
-    int             retval;
-    struct queries_for_query *added_q = NULL;
-    val_async_status         *as;
-    val_context_t            *context;
-    int data_received = 0;
-    int data_missing = 1, more_data;
-    u_char domain_name_n[NS_MAXCDNAME];
-    u_int32_t tflags = 0;
+    if (as->val_as_span) {
+        val_span_done(as->val_as_span, as->val_as_retval,
+                      as->val_as_results);
+        as->val_as_span = NULL;
+    }
+    _call_callbacks(VAL_AS_EVENT_COMPLETED, as);
+    as->val_as_ctx = NULL; /* we've already removed ourselves */
+    _async_status_free(&as); /* no ctx, so no lock needed */
+    CTX_UNLOCK_POL(context);
+}
 
-    if ((domain_name == NULL) || (async_status == NULL))
-        return VAL_BAD_ARGUMENT;
+/*
+ * Allocate the status for a new async request
+ */
+static int
+_async_status_new(const char *domain_name, int class_h, int type_h,
+                  u_int32_t flags, val_async_event_cb callback,
+                  void *cb_data, u_char *domain_name_n,
+                  val_async_status **async_status)
+{
+    val_async_status *as;
 
-    val_log(NULL, LOG_DEBUG, __FUNCTION__);
+    *async_status = NULL;
 
     /*
      * Sanity check the values of class and type
@@ -6888,9 +8248,8 @@ val_async_submit(val_context_t * ctx,  const char * domain_name, int class_h,
         return VAL_BAD_ARGUMENT;
     }
 
-    if ((retval = ns_name_pton(domain_name, domain_name_n,
-                               NS_MAXCDNAME)) == -1) {
-        val_log(ctx, LOG_INFO, "val_resolve_and_check(): Cannot parse name %s",
+    if (ns_name_pton(domain_name, domain_name_n, NS_MAXCDNAME) == -1) {
+        VAL_LOG(NULL, LOG_INFO, "val_async_submit(): Cannot parse name %s",
                 domain_name);
         return VAL_BAD_ARGUMENT;
     }
@@ -6899,7 +8258,7 @@ val_async_submit(val_context_t * ctx,  const char * domain_name, int class_h,
     if (NULL == as)
         return VAL_OUT_OF_MEMORY;
 
-    val_log(NULL, LOG_DEBUG, "as %p allocated for {%s %s(%d) %s(%d)}", as,
+    VAL_LOG(NULL, LOG_DEBUG, "as %p allocated for {%s %s(%d) %s(%d)}", as,
             domain_name, p_class(class_h), class_h, p_type(type_h), type_h);
 
     as->val_as_name = strdup(domain_name);
@@ -6911,41 +8270,69 @@ val_async_submit(val_context_t * ctx,  const char * domain_name, int class_h,
 #ifndef VAL_NO_THREADS
     as->val_as_tid = pthread_self();
 #endif
+    gettimeofday(&as->val_as_start, NULL);
+    res_stats_inc(RES_STAT_REQUESTS);
     as->val_as_result_cb = callback;
     as->val_as_cb_user_ctx = cb_data;
     as->val_as_class = (u_int16_t) class_h;
     as->val_as_type = (u_int16_t) type_h;
+    as->val_as_qflags = flags;
 
-    /*
-     * get context, if needed
-     */
-    context = val_create_or_refresh_context(ctx); /* does CTX_LOCK_POL_SH */
-    if (NULL == context) {
-        _async_status_free(&as); /* no context, so no lock needed */
-        return VAL_INTERNAL_ERROR;
-    }
+    *async_status = as;
+    return VAL_NO_ERROR;
+}
 
-    as->val_as_ctx = context;
+/*
+ * Look inside the cache for the request, and send the initial query
+ * if the answer isn't there.
+ * NOTE: caller must hold the context async cache lock
+ */
+static int
+_async_start(val_context_t *context, val_async_status *as,
+             u_char *domain_name_n, struct queries_for_query **added)
+{
+    int             retval;
+    struct queries_for_query *added_q = NULL;
+    int data_received = 0;
+    int data_missing = 1, more_data;
+    u_int32_t tflags = 0;
+    struct val_arena scratch, *prev_arena;
+    struct val_span *prev_span;
+    struct timeval phase;
 
-    tflags = VAL_QFLAGS_USERMASK & (flags | VAL_QUERY_ASYNC | 
-                context->def_cflags | context->def_uflags);
+    ASSERT_HAVE_AC_LOCK(context);
 
-    CTX_LOCK_ACACHE(context);
+    /* the first pass; see _async_check_one() */
+    arena_init_scratch(&scratch, &as->val_as_arena);
+    prev_arena = arena_enter(&scratch);
+    if (val_span_enabled && as->val_as_span == NULL)
+        as->val_as_span = val_span_new(context, as->val_as_name,
+                                       as->val_as_class, as->val_as_type,
+                                       &as->val_as_start);
+    prev_span = val_span_enter(as->val_as_span);
+
+    tflags = VAL_QFLAGS_USERMASK & (as->val_as_qflags | VAL_QUERY_ASYNC | 
+                context->def_cflags | context->def_uflags);
 
     retval = add_to_qfq_chain(context, &as->val_as_queries,
                               domain_name_n, as->val_as_type,
                               as->val_as_class,
                               tflags,
                               &added_q);
+    *added = added_q;
     if (VAL_NO_ERROR == retval) {
         as->val_as_top_q = added_q;
+        if (as->val_as_span)
+            as->val_as_span->vs_trace_id = added_q->qfq_query->qc_trace_id;
 
         /*
          * Data might already be present in the cache
          */
         /** cache skip/by-pass check is performed lower down */
+        SPAN_BEGIN(&phase);
         retval = _ask_cache_one(context, &as->val_as_queries, added_q,
                                 &data_received, &data_missing, &more_data);
+        SPAN_END(VAL_SPAN_ASK_CACHE, &phase);
         // xxx-rks did we get answer? if so, return results?
         if (VAL_NO_ERROR == retval) {
 
@@ -6954,16 +8341,18 @@ val_async_submit(val_context_t * ctx,  const char * domain_name, int class_h,
                 struct val_internal_result *w_results = NULL;
                 int                         done = 0;
 
-                val_log(context, LOG_WARNING, "*** ! data_missing in submit");
+                VAL_LOG(context, LOG_WARNING, "*** ! data_missing in submit");
 #if 1
+                SPAN_BEGIN(&phase);
                 retval = construct_authentication_chain(context, added_q,
                                                         &as->val_as_queries,
                                                         &w_results,
                                                         &as->val_as_results,
                                                         &done);
+                SPAN_END(VAL_SPAN_CHAIN, &phase);
                 if (done) {
                     as->val_as_flags |= VAL_AS_DONE;
-                    val_log(context, LOG_DEBUG, "as %p ! val_async_submit/DONE",
+                    VAL_LOG(context, LOG_DEBUG, "as %p ! val_async_submit/DONE",
                             as);
                 } else {
                     val_free_result_chain(as->val_as_results);
@@ -6984,8 +8373,10 @@ val_async_submit(val_context_t * ctx,  const char * domain_name, int class_h,
     if ((VAL_NO_ERROR == retval) &&
         (added_q->qfq_query->qc_state == Q_INIT)) {
 
+        SPAN_BEGIN(&phase);
         retval = _resolver_submit_one(context, &as->val_as_queries,
                                       added_q);
+        SPAN_END(VAL_SPAN_ASK_RESOLVER, &phase);
         /*
          * SK: 
          * Commented this block out to fix an issue that I was
@@ -7004,16 +8395,69 @@ val_async_submit(val_context_t * ctx,  const char * domain_name, int class_h,
         }
     }
 
+    val_span_leave(prev_span);
+    arena_leave(prev_arena);
+    arena_release(&scratch);
+    return retval;
+}
+
+/*
+ * Look inside the cache, ask the resolver for missing data.
+ */
+int
+val_async_submit(val_context_t * ctx,  const char * domain_name, int class_h,
+                 int type_h, u_int32_t flags, val_async_event_cb callback,
+                 void *cb_data, val_async_status **async_status)
+{
+
+    int             retval;
+    struct queries_for_query *added_q = NULL;
+    val_async_status         *as;
+    val_context_t            *context;
+    u_char domain_name_n[NS_MAXCDNAME];
+
+    if ((domain_name == NULL) || (async_status == NULL))
+        return VAL_BAD_ARGUMENT;
+
+    VAL_LOG(NULL, LOG_DEBUG, __FUNCTION__);
+
+    if (VAL_NO_ERROR != (retval = _async_status_new(domain_name, class_h,
+                                                    type_h, flags, callback,
+                                                    cb_data, domain_name_n,
+                                                    &as)))
+        return retval;
+
+    /*
+     * get context, if needed
+     */
+    context = val_create_or_refresh_context(ctx); /* does CTX_LOCK_POL_SH */
+    if (NULL == context) {
+        _async_status_free(&as); /* no context, so no lock needed */
+        return VAL_INTERNAL_ERROR;
+    }
+
+    as->val_as_ctx = context;
+
+    CTX_LOCK_ACACHE(context);
+
+    retval = _async_start(context, as, domain_name_n, &added_q);
+
     if ((VAL_NO_ERROR != retval) && (NULL != added_q))
         _async_status_free(&as);
     else {
         ASSERT_HAVE_AC_LOCK(context);
 
         /* put in context async queries list */
-        val_log(context,
+        VAL_LOG(context,
                 LOG_DEBUG, "adding %s to context as_list", as->val_as_name);
         as->val_as_next = context->as_list;
         context->as_list = as;
+        if (!(as->val_as_flags & VAL_AS_DONE))
+            ++context->as_active;
+#ifndef VAL_NO_THREADS
+        if (context->as_runtime)
+            val_runtime_kick(context->as_runtime);
+#endif
     }
 
     CTX_UNLOCK_ACACHE(context);
@@ -7023,6 +8467,161 @@ val_async_submit(val_context_t * ctx,  const char * domain_name, int class_h,
     return retval;
 }
 
+/*
+ * Function: val_async_submit_batch
+ *
+ * Purpose: submit many async requests at once
+ *
+ * The context is refreshed and locked once for the whole batch. At most
+ * async-window requests (see dnsval.conf) are started right away; the
+ * rest are marked VAL_AS_QUEUED and are started by val_async_check_wait()
+ * as earlier requests complete. Queued requests can be cancelled like
+ * any other request.
+ *
+ * Parameters: ctx -- context to use, or NULL for the default context
+ *             reqs -- array of requests. On return, each element's as
+ *                     holds the status for that request (NULL if it
+ *                     could not be submitted) and retval its VAL_* result.
+ *             count -- number of elements in reqs
+ *
+ * Returns: VAL_NO_ERROR if the batch was processed (check the retval
+ *          of each request), or a VAL_* error if none could be submitted.
+ */
+int
+val_async_submit_batch(val_context_t * ctx, val_async_request_t *reqs,
+                       size_t count)
+{
+    val_context_t            *context;
+    val_async_status         *as, *head = NULL, **tail = &head;
+    struct queries_for_query *added_q;
+    u_char                    domain_name_n[NS_MAXCDNAME];
+    int                       window, listed = 0;
+    size_t                    i;
+
+    if ((reqs == NULL) || (count == 0))
+        return VAL_BAD_ARGUMENT;
+
+    VAL_LOG(NULL, LOG_DEBUG, __FUNCTION__);
+
+    context = val_create_or_refresh_context(ctx); /* does CTX_LOCK_POL_SH */
+    if (NULL == context)
+        return VAL_INTERNAL_ERROR;
+
+    window = context->g_opt ? context->g_opt->async_window :
+                              VAL_POL_GOPT_ASYNC_WINDOW;
+
+    CTX_LOCK_ACACHE(context);
+
+    for (i = 0; i < count; i++) {
+        reqs[i].as = NULL;
+        if (reqs[i].name == NULL) {
+            reqs[i].retval = VAL_BAD_ARGUMENT;
+            continue;
+        }
+        reqs[i].retval = _async_status_new(reqs[i].name, reqs[i].class_h,
+                                           reqs[i].type_h, reqs[i].flags,
+                                           reqs[i].callback, reqs[i].cb_data,
+                                           domain_name_n, &as);
+        if (VAL_NO_ERROR != reqs[i].retval)
+            continue;
+        as->val_as_ctx = context;
+
+        if (window == 0 || context->as_active < window) {
+            added_q = NULL;
+            reqs[i].retval = _async_start(context, as, domain_name_n,
+                                          &added_q);
+            if ((VAL_NO_ERROR != reqs[i].retval) && (NULL != added_q)) {
+                _async_status_free(&as);
+                continue;
+            }
+            if (!(as->val_as_flags & VAL_AS_DONE))
+                ++context->as_active;
+        } else {
+            _async_queue_add(context, as);
+        }
+
+        /*
+         * every request in the context list holds a policy lock,
+         * released when it completes or is cancelled
+         */
+        if (listed++)
+            CTX_LOCK_POL_SH(context);
+        *tail = as;
+        tail = &as->val_as_next;
+        reqs[i].as = as;
+    }
+
+    /*
+     * queued requests are started in the order of the context's queue,
+     * so the batch can go at the front of the list
+     */
+    *tail = context->as_list;
+    context->as_list = head;
+#ifndef VAL_NO_THREADS
+    if (head && context->as_runtime)
+        val_runtime_kick(context->as_runtime);
+#endif
+
+    VAL_LOG(context, LOG_DEBUG,
+            "val_async_submit_batch(): %d of %lu requests added, %d queued",
+            listed, (u_long) count, context->as_queued);
+
+    CTX_UNLOCK_ACACHE(context);
+
+    if (listed == 0) {
+        CTX_UNLOCK_POL(context);
+        return reqs[0].retval;
+    }
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Start queued batch requests while there is room in the async window
+ * NOTE: caller must hold the context async cache lock
+ */
+static void
+_async_start_queued(val_context_t *context)
+{
+#ifndef VAL_NO_THREADS
+    pthread_t                   self = pthread_self();
+#endif
+    val_async_status           *as, *next;
+    struct queries_for_query   *added_q;
+    u_char                      domain_name_n[NS_MAXCDNAME];
+    int                         window, retval;
+
+    if (context->as_queued == 0)
+        return;
+
+    window = context->g_opt ? context->g_opt->async_window :
+                              VAL_POL_GOPT_ASYNC_WINDOW;
+
+    for (as = context->as_queue_head;
+         as && (window == 0 || context->as_active < window); as = next) {
+
+        next = as->val_as_qnext;
+#ifndef VAL_NO_THREADS
+        if (! (context->ctx_flags & CTX_PROCESS_ALL_THREADS) &&
+            ! pthread_equal(self, as->val_as_tid))
+            continue;
+#endif
+
+        _async_queue_remove(context, as);
+
+        added_q = NULL;
+        if (ns_name_pton(as->val_as_name, domain_name_n, NS_MAXCDNAME) == -1)
+            retval = VAL_BAD_ARGUMENT;
+        else
+            retval = _async_start(context, as, domain_name_n, &added_q);
+        if (VAL_NO_ERROR != retval) {
+            /* report the failure through the callback */
+            as->val_as_retval = retval;
+            as->val_as_flags |= VAL_AS_DONE;
+        }
+        if (!(as->val_as_flags & VAL_AS_DONE))
+            ++context->as_active;
+    }
+}
 
 /*
  * Look inside the cache, ask the resolver for missing data.
@@ -7037,6 +8636,9 @@ _async_check_one(val_async_status *as, fd_set *pending_desc,
     struct timeval             closest_event, now;
     int retval, data_received, data_missing, done, checked = 0, as_remain;
     struct expected_arrival   *ea;
+    struct val_arena           scratch, *prev_arena;
+    struct val_span           *prev_span;
+    struct timeval             phase;
 #ifndef VAL_NO_THREADS
     pthread_t                   self = pthread_self();
 #endif
@@ -7050,15 +8652,24 @@ _async_check_one(val_async_status *as, fd_set *pending_desc,
 #ifndef VAL_NO_THREADS
     if (! (context->ctx_flags & CTX_PROCESS_ALL_THREADS) &&
         ! pthread_equal(self, as->val_as_tid)) {
-        val_log(context,LOG_DEBUG, "as %p tid %d _async_check_one skiping tid",
+        VAL_LOG(context,LOG_DEBUG, "as %p tid %d _async_check_one skiping tid",
                 as, as->val_as_tid);
         return VAL_NO_ERROR;
     }
 
-    val_log(context,LOG_DEBUG,"as %p tid %d _async_check_one / start rem %d", as,
+    VAL_LOG(context,LOG_DEBUG,"as %p tid %d _async_check_one / start rem %d", as,
             as->val_as_tid, remaining ? *remaining : 0);
 #endif
 
+    /*
+     * Temporaries (working results, parsed responses, glue buckets)
+     * only last for this pass; the query list goes to the request's
+     * arena
+     */
+    arena_init_scratch(&scratch, &as->val_as_arena);
+    prev_arena = arena_enter(&scratch);
+    prev_span = val_span_enter(as->val_as_span);
+
     do { 
     done = 0;
     initial_q = qfq = as->val_as_queries;
@@ -7071,8 +8682,10 @@ _async_check_one(val_async_status *as, fd_set *pending_desc,
      * check for answers in the cache
      */
     if (!(as->val_as_flags & VAL_AS_IGNORE_CACHE)) {
+        SPAN_BEGIN(&phase);
         retval = ask_cache(context, &as->val_as_queries,
                            &data_received, &data_missing);
+        SPAN_END(VAL_SPAN_ASK_CACHE, &phase);
         if (VAL_NO_ERROR != retval)
             goto done;
     }
@@ -7082,11 +8695,12 @@ _async_check_one(val_async_status *as, fd_set *pending_desc,
      */
     timerclear(&closest_event);
     gettimeofday(&now, NULL);
+    SPAN_BEGIN(&phase);
     for (; qfq; qfq = qfq->qfq_next) {
         int qfq_remain = 0;
 
         if (NULL == qfq->qfq_query->qc_ea) { // completed or cancelled query
-            val_log(context,LOG_DEBUG+1, "skipping query : %s(0x%x)",
+            VAL_LOG(context,LOG_DEBUG+1, "skipping query : %s(0x%x)",
                     p_query_status(qfq->qfq_query->qc_state),
                     qfq->qfq_query->qc_state);
             continue;
@@ -7103,14 +8717,14 @@ _async_check_one(val_async_status *as, fd_set *pending_desc,
                                           &now, NULL, &qfq_remain);
 
         if (retval < 0)
-            val_log(context, LOG_DEBUG,"  qfq %p: BAD RC %d", qfq->qfq_query,
+            VAL_LOG(context, LOG_DEBUG,"  qfq %p: BAD RC %d", qfq->qfq_query,
                     retval);
         if(NULL == qfq->qfq_query->qc_ea ||
            res_io_are_all_finished(qfq->qfq_query->qc_ea)) {
-            val_log(context, LOG_DEBUG,"  qfq %p: FINISHED ea %p/%p",
+            VAL_LOG(context, LOG_DEBUG,"  qfq %p: FINISHED ea %p/%p",
                     qfq->qfq_query, ea, qfq->qfq_query->qc_ea);
             if (retval < 0) {
-                val_log(context, LOG_DEBUG,
+                VAL_LOG(context, LOG_DEBUG,
                         "  CANCELING qfq %p: rc %d and all_finished",
                         qfq->qfq_query, retval);
                 val_res_cancel(qfq->qfq_query);
@@ -7135,21 +8749,26 @@ _async_check_one(val_async_status *as, fd_set *pending_desc,
         if (sent)
             ++as_remain;
     }
+    SPAN_END(VAL_SPAN_ASK_RESOLVER, &phase);
 
-    if (VAL_NO_ERROR !=
-        (retval = fix_glue(context, &as->val_as_queries, &data_missing)))
+    SPAN_BEGIN(&phase);
+    retval = fix_glue(context, &as->val_as_queries, &data_missing);
+    SPAN_END(VAL_SPAN_FIX_GLUE, &phase);
+    if (VAL_NO_ERROR != retval)
         goto done;
 
     if (data_received || !data_missing) {
         struct val_internal_result *w_results = NULL;
 
+        SPAN_BEGIN(&phase);
         retval = construct_authentication_chain(context, as->val_as_top_q,
                                                 &as->val_as_queries,
                                                 &w_results, &as->val_as_results,
                                                 &done);
+        SPAN_END(VAL_SPAN_CHAIN, &phase);
         if (done) {
             as->val_as_flags |= VAL_AS_DONE;
-            val_log(context, LOG_DEBUG, "as %p _async_check_one/DONE", as);
+            VAL_LOG(context, LOG_DEBUG, "as %p _async_check_one/DONE", as);
         } else {
             val_free_result_chain(as->val_as_results);
             as->val_as_results = NULL;
@@ -7164,6 +8783,7 @@ _async_check_one(val_async_status *as, fd_set *pending_desc,
         data_missing = 1;
         data_received = 0;
     }
+    arena_release(&scratch);
 
     /* check if more queries have been added */
     } while (!done && initial_q != as->val_as_queries);
@@ -7172,15 +8792,25 @@ _async_check_one(val_async_status *as, fd_set *pending_desc,
         val_log_authentication_chain(context, LOG_NOTICE,
                                      as->val_as_name, as->val_as_class,
                                      as->val_as_type, as->val_as_results);
+        if (val_trace_enabled)
+            trace_results(as->val_as_top_q, as->val_as_results);
+        stats_results(as->val_as_queries, as->val_as_results,
+                      &as->val_as_start);
         free_qfq_chain(context, as->val_as_queries);
         as->val_as_queries = NULL;
+        as->val_as_top_q = NULL;
+        arena_release(&as->val_as_arena);
     }
 
   done:
+    val_span_leave(prev_span);
+    arena_leave(prev_arena);
+    arena_release(&scratch);
+
     if (remaining)
         *remaining += as_remain ? as_remain : checked;
 
-    val_log(context,LOG_DEBUG,"as %p _async_check_one return %d, rem %d, chk %d",
+    VAL_LOG(context,LOG_DEBUG,"as %p _async_check_one return %d, rem %d, chk %d",
             as, retval, remaining ? *remaining : -1, checked);
     return retval;
 }
@@ -7226,13 +8856,13 @@ val_async_select(val_context_t *context, fd_set *pending_desc, int *nfds,
 
     /** convert absolute time to relative timeout */
     if (timeout) {
-        val_log(context, LOG_DEBUG,
+        VAL_LOG(context, LOG_DEBUG,
                 "val_async_select: Waiting for %ld.%ld seconds", 
                 timeout->tv_sec, timeout->tv_usec);
     }
     local_nfds = *nfds;
     waiting = select(*nfds, pending_desc, NULL, NULL, timeout);
-    val_log(context, LOG_DEBUG, "val_async_select: %d FDs ready (max %d)",
+    VAL_LOG(context, LOG_DEBUG, "val_async_select: %d FDs ready (max %d)",
             waiting, local_nfds);
     return waiting;
 }
@@ -7288,7 +8918,7 @@ val_async_check_wait(val_context_t *ctx, fd_set *pending_desc,
         goto done;
     }
 
-    val_log(context, LOG_DEBUG, "val_async_check_wait tv %ld.%ld"
+    VAL_LOG(context, LOG_DEBUG, "val_async_check_wait tv %ld.%ld"
 #if !defined(VAL_NO_THREADS) && defined(CTX_LOCK_COUNTS)
             ", lock counts: pol %ld / ac %ld"
 #endif
@@ -7307,6 +8937,13 @@ val_async_check_wait(val_context_t *ctx, fd_set *pending_desc,
     /** handle any completed requests */
     _handle_completed(context);
 
+    /** make room for queued batch requests */
+    if (context->as_queued) {
+        CTX_LOCK_ACACHE(context);
+        _async_start_queued(context);
+        CTX_UNLOCK_ACACHE(context);
+    }
+
     /** might not be anything left to check now */
     if (NULL == context->as_list) {
         retval = VAL_NO_ERROR;
@@ -7341,13 +8978,18 @@ val_async_check_wait(val_context_t *ctx, fd_set *pending_desc,
             continue;
 #endif
 
+        if (as->val_as_flags & VAL_AS_QUEUED)
+            continue;
+
         if (as->val_as_flags & VAL_AS_DONE)
             ++completed;
         else {
             /* ignore errors, keep trying other requests */
             _async_check_one(as, pending_desc, nfds, &count, flags);
-            if (as->val_as_flags & VAL_AS_DONE)
+            if (as->val_as_flags & VAL_AS_DONE) {
                 ++completed;
+                --context->as_active;
+            }
         }
     }
 
@@ -7356,7 +8998,8 @@ val_async_check_wait(val_context_t *ctx, fd_set *pending_desc,
     if (completed)
         _handle_completed(context);
 
-    retval = count;
+    /** queued requests are still pending */
+    retval = count + context->as_queued;
 
 done:
     CTX_UNLOCK_POL(context);
@@ -7390,7 +9033,7 @@ _async_cancel_one(val_context_t *context, val_async_status *as, u_int flags)
     /** call callback if done */
     _call_callbacks(VAL_AS_EVENT_CANCELED, as);
 
-    val_log(context, LOG_DEBUG, "as %p cancelled", as);
+    VAL_LOG(context, LOG_DEBUG, "as %p cancelled", as);
 
     if (! (flags & VAL_AS_CANCEL_CTX_REMOVED))
         _context_as_remove(context, as);
@@ -7452,6 +9095,10 @@ val_async_cancel_all(val_context_t *context, unsigned int flags)
     }
 
     context->as_list = NULL;
+    context->as_queued = 0;
+    context->as_active = 0;
+    context->as_queue_head = NULL;
+    context->as_queue_tail = NULL;
 
     CTX_UNLOCK_ACACHE(context);
 
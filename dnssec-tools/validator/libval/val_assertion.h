@@ -31,6 +31,7 @@ int             free_qfq_chain(val_context_t *context, struct queries_for_query
 void            free_authentication_chain(struct val_digested_auth_chain
                                           *assertions);
 void            free_query_chain_structure(struct val_query_chain *queries);
+void            free_stale_answers(val_context_t *context);
 int             get_zse(val_context_t * ctx, u_char * name_n, 
                         u_int32_t flags, u_int16_t *status, u_char ** match_ptr, u_int32_t *ttl_x);
 int             find_trust_point(val_context_t * ctx, u_char * zone_n, 
@@ -51,8 +52,16 @@ int             try_chase_query(val_context_t * context,
                                 struct val_result_chain **results,
                                 int *done);
 
+#ifndef VAL_NO_THREADS
+void            val_prefetch_hold(val_context_t *context);
+void            val_prefetch_release(val_context_t *context);
+void            val_prefetch_forget(val_context_t *context);
+void            val_prefetch_stop(void);
+#endif
+
 #ifndef VAL_NO_ASYNC
 int             val_async_status_free(val_async_status *as);
+void            val_async_deliver(val_async_status *as);
 #endif
 
 #endif
@@ -29,13 +29,53 @@
 #include "val_support.h"
 #include "val_resquery.h"
 #include "val_cache.h"
+#include "val_shmcache.h"
+#include "val_names.h"
+#include "val_arena.h"
 
 /*
  * we have caches for DNSKEY, DS, NS/glue, answers, and proofs
  * XXX negative cache functionality is currently unimplemented
  */
-static struct rrset_rec *unchecked_hints = NULL;
-static struct rrset_rec *unchecked_answers = NULL;
+struct cache_store {
+    struct rrset_rec *cs_head;
+    struct rrset_rec **cs_tail;     /* link where new rrsets are added */
+    struct rrset_rec **cs_hand;     /* CLOCK hand: link to next candidate */
+    size_t          cs_bytes;       /* sum of rrs_cache_bytes */
+    size_t          cs_count;
+    const char     *cs_name;
+};
+
+static struct cache_store unchecked_hints = {
+    NULL, &unchecked_hints.cs_head, &unchecked_hints.cs_head, 0, 0, "Hints"
+};
+static struct cache_store unchecked_answers = {
+    NULL, &unchecked_answers.cs_head, &unchecked_answers.cs_head, 0, 0, "Answer"
+};
+
+/*
+ * Size limit.  Every cached rrset is charged the memory it holds, and
+ * once the two caches together go over max-cache-size, rrsets are
+ * evicted by a CLOCK hand that gives rrsets used since it last passed
+ * a second chance.  A new rrset that would cost an eviction is only
+ * admitted if it has been looked up more often than the victim
+ * (TinyLFU), so a scan of names that are asked for once cannot flush
+ * the working set.  Lookup frequencies are estimated with a small
+ * count-min sketch whose counters are halved every CACHE_SKETCH_RESET
+ * lookups, so that old popularity fades.
+ * Expired rrsets are dropped every CACHE_REAP_INTERVAL seconds.
+ */
+static size_t cache_max_bytes = 0;      /* 0 means no limit */
+
+#define CACHE_SKETCH_ROWS   4
+#define CACHE_SKETCH_WIDTH  4096        /* a power of two */
+#define CACHE_SKETCH_MAX    15
+#define CACHE_SKETCH_RESET  (10 * CACHE_SKETCH_WIDTH)
+
+static u_char cache_sketch[CACHE_SKETCH_ROWS][CACHE_SKETCH_WIDTH];
+static u_int32_t cache_sketch_adds = 0;
+
+#define CACHE_REAP_INTERVAL 60
 
 #ifndef VAL_NO_THREADS
 
@@ -47,6 +87,16 @@ static pthread_rwlock_t ns_rwlock;
 static int ns_rwlock_init = 0;
 static pthread_rwlock_t ans_rwlock;
 static int ans_rwlock_init = 0;
+static pthread_rwlock_t cap_rwlock;
+static int cap_rwlock_init = 0;
+
+/*
+ * protects the sketch and rrs_cache_ref, which lookups update
+ * while holding their cache's lock shared
+ */
+static pthread_mutex_t freq_lock = PTHREAD_MUTEX_INITIALIZER;
+#define FREQ_LOCK()     pthread_mutex_lock(&freq_lock)
+#define FREQ_UNLOCK()   pthread_mutex_unlock(&freq_lock)
 
 #define VAL_CACHE_LOCK_INIT(lk, initvar) \
     ((initvar != 0) || \
@@ -68,39 +118,849 @@ static int ns_rwlock = -1;
 static int ns_rwlock_init = -1;
 static int ans_rwlock = -1;
 static int ans_rwlock_init = -1;
+static int cap_rwlock = -1;
+static int cap_rwlock_init = -1;
 
 #define VAL_CACHE_LOCK_INIT(lk, initvar)
 #define VAL_CACHE_LOCK_SH(lk)
 #define VAL_CACHE_LOCK_EX(lk)
 #define VAL_CACHE_UNLOCK(lk)
+#define FREQ_LOCK()
+#define FREQ_UNLOCK()
 
 #endif
 
+/*
+ * rrsets are stored, evicted and reaped with both caches locked,
+ * since an eviction may come from either of them
+ */
+#define CACHE_LOCK_STORES() do { \
+    VAL_CACHE_LOCK_INIT(&ns_rwlock, ns_rwlock_init); \
+    VAL_CACHE_LOCK_EX(&ns_rwlock); \
+    VAL_CACHE_LOCK_INIT(&ans_rwlock, ans_rwlock_init); \
+    VAL_CACHE_LOCK_EX(&ans_rwlock); \
+} while (0)
+
+#define CACHE_UNLOCK_STORES() do { \
+    VAL_CACHE_UNLOCK(&ans_rwlock); \
+    VAL_CACHE_UNLOCK(&ns_rwlock); \
+} while (0)
+
+#define CACHE_BYTES() (unchecked_hints.cs_bytes + unchecked_answers.cs_bytes)
+
+/*
+ * Per-server capabilities, keyed by server address. This lets
+ * what we learn about EDNS0 and tcp support, or about lame and
+ * unreachable servers, survive across queries.
+ * Lameness is a property of the server for one zone, so it is
+ * kept as a list of the zones that the server was found lame for.
+ */
+struct server_lameness {
+    u_char         *sl_zone_n;
+    u_int32_t       sl_ttl_x;
+    struct server_lameness *sl_next;
+};
+
+struct server_capability {
+    struct sockaddr_storage sc_addr;
+    int             sc_edns0_size;  /* last working edns0 size, -1 if unknown */
+    u_int32_t       sc_flags;       /* SERVER_CAP_... */
+    u_int32_t       sc_cap_ttl_x;   /* expiry of edns0/tcp information */
+    u_int32_t       sc_bad_ttl_x;   /* expiry of unreachable status */
+    struct server_lameness *sc_lame;
+    struct server_capability *sc_next;
+};
+
+#define SERVER_CAP_BUCKETS 256
+static struct server_capability *server_caps[SERVER_CAP_BUCKETS];
+
+/*
+ * Index over the hints cache: a trie keyed on the reversed labels
+ * of the owner name, so that the closest enclosing zone cut for a
+ * query and the glue for its name servers can be found in
+ * O(labels) instead of by walking all of unchecked_hints.
+ * The index only points into unchecked_hints and is protected by
+ * ns_rwlock along with it.
+ */
+struct hint_ref {
+    struct rrset_rec *hr_rrset;
+    struct hint_ref *hr_next;
+};
+
+struct hint_node {
+    u_char          hn_label[NS_MAXLABEL + 1];    /* lower-cased */
+    struct hint_ref *hn_rrsets;         /* rrsets owned by this name */
+    struct hint_node **hn_children;     /* open-addressed hash table */
+    size_t          hn_nchildren;
+    size_t          hn_size;
+};
+
+#define HINT_NODE_MIN_CHILDREN 4
+
+static struct hint_node hint_root;
+
 #define IN_BAILIWICK(name, q) \
     ((q) &&\
      (q->qc_zonecut_n? (NULL != namename(name, q->qc_zonecut_n)) :\
       (NULL != namename(q->qc_name_n, name))))
 
+static int
+hint_label_eq(const u_char *a, const u_char *b)
+{
+    return a[0] == b[0] && res_name_caseeq(&a[1], &b[1], a[0]);
+}
+
+static size_t
+hint_label_hash(const u_char *label)
+{
+    return res_name_hash(&label[1], label[0], 0);
+}
+
+static struct hint_node *
+hint_child(struct hint_node *node, const u_char *label)
+{
+    size_t i, mask;
+    struct hint_node *c;
+
+    if (node->hn_children == NULL)
+        return NULL;
+    mask = node->hn_size - 1;
+    for (i = hint_label_hash(label) & mask;
+         NULL != (c = node->hn_children[i]); i = (i + 1) & mask) {
+        if (hint_label_eq(c->hn_label, label))
+            return c;
+    }
+    return NULL;
+}
+
+static int
+hint_child_insert(struct hint_node *node, struct hint_node *child)
+{
+    struct hint_node **old = node->hn_children;
+    size_t old_size = node->hn_size;
+    size_t i, mask;
+
+    /* keep the table at most half full */
+    if (2 * (node->hn_nchildren + 1) > node->hn_size) {
+        size_t new_size = old_size ? 2 * old_size : HINT_NODE_MIN_CHILDREN;
+
+        node->hn_children = (struct hint_node **)
+            MALLOC(new_size * sizeof(struct hint_node *));
+        if (node->hn_children == NULL) {
+            node->hn_children = old;
+            return VAL_OUT_OF_MEMORY;
+        }
+        memset(node->hn_children, 0, new_size * sizeof(struct hint_node *));
+        node->hn_size = new_size;
+        node->hn_nchildren = 0;
+        for (i = 0; i < old_size; i++) {
+            if (old[i])
+                hint_child_insert(node, old[i]);
+        }
+        if (old)
+            FREE(old);
+    }
+
+    mask = node->hn_size - 1;
+    for (i = hint_label_hash(child->hn_label) & mask;
+         node->hn_children[i] != NULL; i = (i + 1) & mask)
+        ;
+    node->hn_children[i] = child;
+    node->hn_nchildren++;
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Take child out of node's table.  Entries further along the probe
+ * sequence are put back so that lookups still find them; the table is
+ * released once it is empty.
+ */
+static void
+hint_child_remove(struct hint_node *node, struct hint_node *child)
+{
+    struct hint_node *c;
+    size_t i, mask;
+
+    if (node->hn_children == NULL)
+        return;
+    mask = node->hn_size - 1;
+    for (i = hint_label_hash(child->hn_label) & mask;
+         node->hn_children[i] != child; i = (i + 1) & mask) {
+        if (node->hn_children[i] == NULL)
+            return;
+    }
+    node->hn_children[i] = NULL;
+    node->hn_nchildren--;
+
+    if (node->hn_nchildren == 0) {
+        FREE(node->hn_children);
+        node->hn_children = NULL;
+        node->hn_size = 0;
+        return;
+    }
+
+    for (i = (i + 1) & mask; NULL != (c = node->hn_children[i]);
+         i = (i + 1) & mask) {
+        node->hn_children[i] = NULL;
+        node->hn_nchildren--;
+        hint_child_insert(node, c);
+    }
+}
+
+/*
+ * Split name_n into labels; labels[0] is the leftmost label.
+ * Returns the number of labels, or -1 if there are too many.
+ */
+static int
+hint_split_labels(const u_char *name_n, const u_char **labels)
+{
+    int n = 0;
+    size_t off = 0;
+
+    while (name_n[off]) {
+        if (n == NS_MAXCDNAME / 2)
+            return -1;
+        labels[n++] = &name_n[off];
+        off += name_n[off] + 1;
+    }
+    return n;
+}
+
+/*
+ * Find the node for name_n; create it (and its ancestors) if asked to.
+ */
+static struct hint_node *
+hint_find_node(const u_char *name_n, int create)
+{
+    const u_char *labels[NS_MAXCDNAME / 2];
+    struct hint_node *node, *child;
+    int n;
+
+    if (-1 == (n = hint_split_labels(name_n, labels)))
+        return NULL;
+
+    node = &hint_root;
+    while (n-- > 0) {
+        child = hint_child(node, labels[n]);
+        if (child == NULL) {
+            if (!create)
+                return NULL;
+            child = (struct hint_node *) MALLOC(sizeof(struct hint_node));
+            if (child == NULL)
+                return NULL;
+            memset(child, 0, sizeof(struct hint_node));
+            memcpy(child->hn_label, labels[n], labels[n][0] + 1);
+            if (VAL_NO_ERROR != hint_child_insert(node, child)) {
+                FREE(child);
+                return NULL;
+            }
+        }
+        node = child;
+    }
+    return node;
+}
+
+/*
+ * Add a new hints cache entry to the index
+ */
+static void
+hint_index_add(struct rrset_rec *rrset)
+{
+    struct hint_node *node;
+    struct hint_ref *ref, **tail;
+
+    if (NULL == (node = hint_find_node(rrset->rrs_name_n, 1)))
+        return;
+    ref = (struct hint_ref *) MALLOC(sizeof(struct hint_ref));
+    if (ref == NULL)
+        return;
+    ref->hr_rrset = rrset;
+    ref->hr_next = NULL;
+    /* preserve cache order */
+    for (tail = &node->hn_rrsets; *tail; tail = &(*tail)->hr_next)
+        ;
+    *tail = ref;
+}
+
+/*
+ * Point the index at a hints cache entry that replaced another one
+ */
+static void
+hint_index_replace(struct rrset_rec *old, struct rrset_rec *rrset)
+{
+    struct hint_node *node;
+    struct hint_ref *ref;
+
+    if (NULL == (node = hint_find_node(old->rrs_name_n, 0)))
+        return;
+    for (ref = node->hn_rrsets; ref; ref = ref->hr_next) {
+        if (ref->hr_rrset == old) {
+            ref->hr_rrset = rrset;
+            return;
+        }
+    }
+}
+
+/*
+ * Remove a hints cache entry from the index, along with any nodes
+ * that are left with neither rrsets nor children, so that the index
+ * does not outgrow the cache it points into.
+ */
+static void
+hint_index_remove(struct rrset_rec *rrset)
+{
+    const u_char *labels[NS_MAXCDNAME / 2];
+    struct hint_node *path[NS_MAXCDNAME / 2 + 1];
+    struct hint_node *node;
+    struct hint_ref **prev, *ref;
+    int n, depth;
+
+    if (-1 == (n = hint_split_labels(rrset->rrs_name_n, labels)))
+        return;
+
+    path[0] = node = &hint_root;
+    for (depth = 0; depth < n; depth++) {
+        node = hint_child(node, labels[n - depth - 1]);
+        if (node == NULL)
+            return;
+        path[depth + 1] = node;
+    }
+
+    for (prev = &node->hn_rrsets; NULL != (ref = *prev);
+         prev = &ref->hr_next) {
+        if (ref->hr_rrset == rrset) {
+            *prev = ref->hr_next;
+            FREE(ref);
+            break;
+        }
+    }
+
+    for (; depth > 0; depth--) {
+        node = path[depth];
+        if (node->hn_rrsets != NULL || node->hn_nchildren != 0)
+            break;
+        hint_child_remove(path[depth - 1], node);
+        FREE(node);
+    }
+}
+
+static void
+hint_free_node(struct hint_node *node)
+{
+    struct hint_ref *ref;
+    size_t i;
+
+    while (NULL != (ref = node->hn_rrsets)) {
+        node->hn_rrsets = ref->hr_next;
+        FREE(ref);
+    }
+    for (i = 0; i < node->hn_size; i++) {
+        if (node->hn_children[i]) {
+            hint_free_node(node->hn_children[i]);
+            FREE(node->hn_children[i]);
+        }
+    }
+    if (node->hn_children)
+        FREE(node->hn_children);
+    node->hn_children = NULL;
+    node->hn_size = 0;
+    node->hn_nchildren = 0;
+}
+
+/*
+ * Remember an rrset for hint_collect_zone(), skipping duplicates
+ */
+static int
+hint_collect_add(struct rrset_rec ***set, size_t *count, size_t *size,
+                 struct rrset_rec *rrset)
+{
+    struct rrset_rec **n_set;
+    size_t i;
+
+    for (i = 0; i < *count; i++) {
+        if ((*set)[i] == rrset)
+            return VAL_NO_ERROR;
+    }
+    if (*count == *size) {
+        n_set = (struct rrset_rec **)
+            MALLOC(2 * (*size) * sizeof(struct rrset_rec *));
+        if (n_set == NULL)
+            return VAL_OUT_OF_MEMORY;
+        memcpy(n_set, *set, (*count) * sizeof(struct rrset_rec *));
+        FREE(*set);
+        *set = n_set;
+        *size *= 2;
+    }
+    (*set)[(*count)++] = rrset;
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Build a short list with the NS rrsets for the zone at node and the
+ * address records for the name servers that they list; this is all
+ * that bootstrap_referral() needs from the hints cache.  The list
+ * consists of shallow copies that share data with the cache, so it must
+ * be released with FREE() only, and only while ns_rwlock is still held.
+ */
+static struct rrset_rec *
+hint_collect_zone(struct hint_node *node)
+{
+    struct rrset_rec **set, *list;
+    struct hint_ref *ref;
+    struct hint_node *ns_node;
+    struct rrset_rr *ns_rr;
+    size_t count = 0, size = 8, i, n_ns;
+
+    set = (struct rrset_rec **) MALLOC(size * sizeof(struct rrset_rec *));
+    if (set == NULL)
+        return NULL;
+
+    for (ref = node->hn_rrsets; ref; ref = ref->hr_next) {
+        if (ref->hr_rrset->rrs_type_h == ns_t_ns &&
+            VAL_NO_ERROR != hint_collect_add(&set, &count, &size,
+                                             ref->hr_rrset))
+            goto err;
+    }
+    n_ns = count;
+    for (i = 0; i < n_ns; i++) {
+        for (ns_rr = set[i]->rrs_data; ns_rr; ns_rr = ns_rr->rr_next) {
+            if (wire_name_length(ns_rr->rr_rdata) > NS_MAXCDNAME ||
+                NULL == (ns_node = hint_find_node(ns_rr->rr_rdata, 0)))
+                continue;
+            for (ref = ns_node->hn_rrsets; ref; ref = ref->hr_next) {
+                if ((ref->hr_rrset->rrs_type_h == ns_t_a ||
+                     ref->hr_rrset->rrs_type_h == ns_t_aaaa) &&
+                    VAL_NO_ERROR != hint_collect_add(&set, &count, &size,
+                                                     ref->hr_rrset))
+                    goto err;
+            }
+        }
+    }
+
+    if (count == 0) {
+        FREE(set);
+        return NULL;
+    }
+    list = (struct rrset_rec *) MALLOC(count * sizeof(struct rrset_rec));
+    if (list == NULL)
+        goto err;
+    for (i = 0; i < count; i++) {
+        memcpy(&list[i], set[i], sizeof(struct rrset_rec));
+        list[i].rrs_next = (i + 1 < count) ? &list[i + 1] : NULL;
+    }
+    FREE(set);
+    return list;
+
+  err:
+    FREE(set);
+    return NULL;
+}
+
+/*
+ * Hash of the key that lookup frequencies are counted under
+ */
+static u_int32_t
+cache_key(const u_char *name_n, u_int16_t type_h)
+{
+    return res_name_hash(name_n, wire_name_length(name_n), type_h);
+}
+
+/*
+ * Row i of the sketch is indexed by h + i * h2, h2 odd.
+ * Both routines must be called with freq_lock held.
+ */
+static void
+cache_sketch_add(u_int32_t h)
+{
+    u_int32_t h2 = ((h >> 16) | (h << 16)) | 1;
+    u_char *c;
+    size_t i, j;
+
+    for (i = 0; i < CACHE_SKETCH_ROWS; i++) {
+        c = &cache_sketch[i][(h + i * h2) & (CACHE_SKETCH_WIDTH - 1)];
+        if (*c < CACHE_SKETCH_MAX)
+            (*c)++;
+    }
+    if (++cache_sketch_adds >= CACHE_SKETCH_RESET) {
+        for (i = 0; i < CACHE_SKETCH_ROWS; i++)
+            for (j = 0; j < CACHE_SKETCH_WIDTH; j++)
+                cache_sketch[i][j] >>= 1;
+        cache_sketch_adds /= 2;
+    }
+}
+
+static int
+cache_sketch_estimate(u_int32_t h)
+{
+    u_int32_t h2 = ((h >> 16) | (h << 16)) | 1;
+    int est = CACHE_SKETCH_MAX;
+    size_t i;
+
+    for (i = 0; i < CACHE_SKETCH_ROWS; i++) {
+        u_char c = cache_sketch[i][(h + i * h2) & (CACHE_SKETCH_WIDTH - 1)];
+        if (c < est)
+            est = c;
+    }
+    return est;
+}
+
+/*
+ * Count a lookup of {name_n, type_h}, and mark the rrset that
+ * answered it, if any, as recently used.  The caller must hold
+ * the lock of the cache that rrset is in.
+ */
+static void
+cache_touch(const u_char *name_n, u_int16_t type_h, struct rrset_rec *rrset)
+{
+    u_int32_t h = cache_key(name_n, type_h);
+
+    FREQ_LOCK();
+    cache_sketch_add(h);
+    if (rrset)
+        rrset->rrs_cache_ref = 1;
+    FREQ_UNLOCK();
+}
+
+/*
+ * Memory held by an rrset, as charged against max-cache-size
+ */
+static size_t
+cache_rrset_bytes(struct rrset_rec *rrset)
+{
+    size_t bytes = sizeof(struct rrset_rec);
+    struct rrset_rr *rr;
+
+    if (rrset->rrs_name_n)
+        bytes += wire_name_length(rrset->rrs_name_n);
+    if (rrset->rrs_zonecut_n)
+        bytes += wire_name_length(rrset->rrs_zonecut_n);
+    if (rrset->rrs_server)
+        bytes += sizeof(struct sockaddr_storage);
+    for (rr = rrset->rrs_data; rr; rr = rr->rr_next)
+        bytes += sizeof(struct rrset_rr) + rr->rr_rdata_length;
+    for (rr = rrset->rrs_sig; rr; rr = rr->rr_next)
+        bytes += sizeof(struct rrset_rr) + rr->rr_rdata_length;
+    return bytes;
+}
+
+/*
+ * Take the rrset at *link out of its cache and drop the cache's
+ * reference to it; if it is still being viewed, it is freed along
+ * with its last view.
+ */
+static void
+cache_unlink(struct cache_store *store, struct rrset_rec **link)
+{
+    struct rrset_rec *rrset = *link;
+
+    *link = rrset->rrs_next;
+    if (store->cs_tail == &rrset->rrs_next)
+        store->cs_tail = link;
+    if (store->cs_hand == &rrset->rrs_next)
+        store->cs_hand = link;
+    if (store == &unchecked_hints)
+        hint_index_remove(rrset);
+    store->cs_bytes -= rrset->rrs_cache_bytes;
+    store->cs_count--;
+
+    rrset->rrs_next = NULL;
+    release_rrset_rec(rrset);
+}
+
+/*
+ * Advance the CLOCK hand of a cache to the next rrset that can be
+ * evicted: an expired one, or one not used since the hand last
+ * passed it.  Returns the link to that rrset, or NULL if the cache
+ * is empty.
+ */
+static struct rrset_rec **
+cache_clock_victim(struct cache_store *store, long now)
+{
+    struct rrset_rec **link = store->cs_hand;
+
+    if (store->cs_head == NULL)
+        return NULL;
+
+    /* at most two sweeps, since the first one clears every mark */
+    for (;;) {
+        if (*link == NULL)
+            link = &store->cs_head;
+        if (now >= (*link)->rrs_ttl_x || !(*link)->rrs_cache_ref)
+            break;
+        (*link)->rrs_cache_ref = 0;
+        link = &(*link)->rrs_next;
+    }
+    store->cs_hand = link;
+    return link;
+}
+
+/*
+ * Evictions are taken from whichever cache holds more
+ */
+static struct cache_store *
+cache_victim_store(void)
+{
+    return (unchecked_answers.cs_bytes >= unchecked_hints.cs_bytes) ?
+        &unchecked_answers : &unchecked_hints;
+}
+
+/*
+ * Decide if new_rr may enter the cache.  Both caches must be locked.
+ */
+static int
+cache_admit(struct rrset_rec *new_rr, long now)
+{
+    struct rrset_rec **link;
+    int new_freq, old_freq;
+
+    if (cache_max_bytes == 0 ||
+        CACHE_BYTES() + new_rr->rrs_cache_bytes <= cache_max_bytes)
+        return 1;
+    if (new_rr->rrs_cache_bytes > cache_max_bytes)
+        return 0;
+    if (NULL == (link = cache_clock_victim(cache_victim_store(), now)) ||
+        now >= (*link)->rrs_ttl_x)
+        return 1;
+
+    FREQ_LOCK();
+    new_freq = cache_sketch_estimate(cache_key(new_rr->rrs_name_n,
+                                               new_rr->rrs_type_h));
+    old_freq = cache_sketch_estimate(cache_key((*link)->rrs_name_n,
+                                               (*link)->rrs_type_h));
+    FREQ_UNLOCK();
+
+    return new_freq > old_freq;
+}
+
+/*
+ * Evict rrsets until the caches fit in max-cache-size again.
+ * Both caches must be locked.
+ */
+static void
+cache_trim(long now)
+{
+    struct cache_store *store;
+    struct rrset_rec **link;
+    int evicted = 0;
+
+    while (cache_max_bytes != 0 && CACHE_BYTES() > cache_max_bytes) {
+        store = cache_victim_store();
+        if (NULL == (link = cache_clock_victim(store, now)))
+            break;
+        cache_unlink(store, link);
+        evicted++;
+    }
+    if (evicted) {
+        res_stats_add(RES_STAT_CACHE_EVICTIONS, evicted);
+        VAL_LOG(NULL, LOG_DEBUG,
+                "cache_trim(): Evicted %d rrsets, %lu bytes cached",
+                evicted, (unsigned long) CACHE_BYTES());
+    }
+}
+
+/*
+ * Drop expired rrsets from both caches
+ */
+static void
+cache_reap(void)
+{
+    struct cache_store *stores[2];
+    struct rrset_rec **link;
+    struct timeval  tv;
+    int i, reaped = 0;
+
+    stores[0] = &unchecked_hints;
+    stores[1] = &unchecked_answers;
+
+    CACHE_LOCK_STORES();
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < 2; i++) {
+        link = &stores[i]->cs_head;
+        while (*link) {
+            if (tv.tv_sec >= (*link)->rrs_ttl_x) {
+                cache_unlink(stores[i], link);
+                reaped++;
+            } else
+                link = &(*link)->rrs_next;
+        }
+    }
+    cache_trim(tv.tv_sec);
+    CACHE_UNLOCK_STORES();
+
+    if (reaped) {
+        res_stats_add(RES_STAT_CACHE_EXPIRED, reaped);
+        VAL_LOG(NULL, LOG_INFO,
+                "cache_reap(): Dropped %d expired rrsets", reaped);
+    }
+}
+
+#ifndef VAL_NO_THREADS
+static pthread_mutex_t reaper_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reaper_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t reaper_tid;
+static int reaper_started = 0;
+static int reaper_stopping = 0;
+static int reaper_atfork_set = 0;
+
+static void *
+cache_reaper(void *arg)
+{
+    struct timespec ts;
+    struct timeval  tv;
+
+    pthread_mutex_lock(&reaper_lock);
+    while (!reaper_stopping) {
+        gettimeofday(&tv, NULL);
+        ts.tv_sec = tv.tv_sec + CACHE_REAP_INTERVAL;
+        ts.tv_nsec = tv.tv_usec * 1000;
+        pthread_cond_timedwait(&reaper_cond, &reaper_lock, &ts);
+        if (reaper_stopping)
+            break;
+        pthread_mutex_unlock(&reaper_lock);
+        cache_reap();
+        pthread_mutex_lock(&reaper_lock);
+    }
+    pthread_mutex_unlock(&reaper_lock);
+    return NULL;
+}
+
+/*
+ * The reaper thread does not survive fork(); hold reaper_lock across
+ * it so that the child gets a consistent copy, and let the child start
+ * its own reaper the next time its cache is used.
+ */
+static void
+cache_reaper_prefork(void)
+{
+    pthread_mutex_lock(&reaper_lock);
+}
+
+static void
+cache_reaper_postfork_parent(void)
+{
+    pthread_mutex_unlock(&reaper_lock);
+}
+
+static void
+cache_reaper_postfork_child(void)
+{
+    pthread_mutex_init(&reaper_lock, NULL);
+    pthread_cond_init(&reaper_cond, NULL);
+    reaper_started = 0;
+    reaper_stopping = 0;
+}
+
+/*
+ * Stop the reaper thread, if one is running, and wait for it to exit.
+ * NOTE: This assumes that the caller does not hold the cache store locks.
+ */
+static void
+cache_reaper_stop(void)
+{
+    pthread_t       tid;
+
+    pthread_mutex_lock(&reaper_lock);
+    if (!reaper_started) {
+        pthread_mutex_unlock(&reaper_lock);
+        return;
+    }
+    reaper_stopping = 1;
+    tid = reaper_tid;
+    pthread_cond_signal(&reaper_cond);
+    pthread_mutex_unlock(&reaper_lock);
+
+    pthread_join(tid, NULL);
+
+    pthread_mutex_lock(&reaper_lock);
+    reaper_started = 0;
+    reaper_stopping = 0;
+    pthread_mutex_unlock(&reaper_lock);
+}
+#endif
+
+/*
+ * Make sure expired rrsets get reaped: by a background thread,
+ * started along with the cache, or without threads, from here once
+ * the reap interval has passed.
+ */
+static void
+cache_reap_due(void)
+{
+#ifndef VAL_NO_THREADS
+    pthread_mutex_lock(&reaper_lock);
+    if (!reaper_atfork_set) {
+        if (0 == pthread_atfork(cache_reaper_prefork,
+                                cache_reaper_postfork_parent,
+                                cache_reaper_postfork_child))
+            reaper_atfork_set = 1;
+    }
+    if (!reaper_started && !reaper_stopping &&
+        0 == pthread_create(&reaper_tid, NULL, cache_reaper, NULL)) {
+        reaper_started = 1;
+    }
+    pthread_mutex_unlock(&reaper_lock);
+#else
+    static long next_reap = 0;
+    struct timeval  tv;
+
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec < next_reap)
+        return;
+    if (next_reap != 0)
+        cache_reap();
+    next_reap = tv.tv_sec + CACHE_REAP_INTERVAL;
+#endif
+}
+
+/*
+ * Set the limit on the memory held by the rrset cache; 0 removes it
+ */
+void
+set_cache_max_size(long bytes)
+{
+    struct timeval  tv;
+
+    CACHE_LOCK_STORES();
+    cache_max_bytes = (bytes > 0) ? (size_t) bytes : 0;
+    gettimeofday(&tv, NULL);
+    cache_trim(tv.tv_sec);
+    CACHE_UNLOCK_STORES();
+}
+
+/*
+ * Drop the cache's references to all rrsets in a cache
+ */
+static void
+release_cached_rrsets(struct cache_store *store)
+{
+    while (store->cs_head)
+        cache_unlink(store, &store->cs_head);
+}
+
 /*
  * Common routine to store data to a specific cache
- * NOTE: This assumes a read lock is alread held by the caller.
+ * NOTE: This assumes both caches are locked by the caller.
  */
 static int
-stow_info(struct rrset_rec **unchecked_info, struct rrset_rec **new_info, struct val_query_chain *matched_q)
+stow_info(struct cache_store *store, struct rrset_rec **new_info,
+          struct val_query_chain *matched_q, int share)
 {
     struct rrset_rec *new_rr;
-    struct rrset_rec *old, *prev;
+    struct rrset_rec *old, *prev, *replaced;
     char name_p[NS_MAXDNAME];
-    const char *cachename;
+    struct timeval  tv;
     int delete_newrr = 0;
 
-    if (new_info == NULL || unchecked_info == NULL)
+    if (new_info == NULL || store == NULL)
         return VAL_NO_ERROR;
 
+    gettimeofday(&tv, NULL);
+
     prev = NULL;
     while (*new_info) {
         new_rr = *new_info;
         delete_newrr = 0;
+        replaced = NULL;
         if (!IN_BAILIWICK(new_rr->rrs_name_n, matched_q) ||
             /* 
              * no need to save any negative response
@@ -114,7 +974,7 @@ stow_info(struct rrset_rec **unchecked_info, struct rrset_rec **new_info, struct
             new_rr->rrs_type_h == ns_t_nsec) {
             delete_newrr = 1;
         } else {
-          old = *unchecked_info;
+          old = store->cs_head;
           prev = NULL;
           while (old) {
             if (
@@ -125,27 +985,14 @@ stow_info(struct rrset_rec **unchecked_info, struct rrset_rec **new_info, struct
 
                 /*
                  * old and new are competitors 
+                 * Lookups may still be holding views of old, so it
+                 * is never refreshed in place; new takes its slot
+                 * and old goes away with its last view.
                  */
-                if (old->rrs_cred >= new_rr->rrs_cred) {
-                    /*
-                     * exchange the two -
-                     * copy from new to old: cred, status, section, ans_kind
-                     * exchange: data, sig
-                     */
-                    struct rrset_rr  *rr_exchange;
-
-                    old->rrs_cred = new_rr->rrs_cred;
-                    old->rrs_section = new_rr->rrs_section;
-                    old->rrs_ans_kind = new_rr->rrs_ans_kind;
-                    rr_exchange = old->rrs_data;
-                    old->rrs_data = new_rr->rrs_data;
-                    new_rr->rrs_data = rr_exchange;
-                    rr_exchange = old->rrs_sig;
-                    old->rrs_sig = new_rr->rrs_sig;
-                    new_rr->rrs_sig = rr_exchange;
-                }
-
-                delete_newrr = 1;
+                if (old->rrs_cred >= new_rr->rrs_cred)
+                    replaced = old;
+                else
+                    delete_newrr = 1;
                 break;
             } 
 
@@ -158,24 +1005,62 @@ stow_info(struct rrset_rec **unchecked_info, struct rrset_rec **new_info, struct
         *new_info = new_rr->rrs_next;
         new_rr->rrs_next = NULL;
 
-        if (-1 == ns_name_ntop(new_rr->rrs_name_n, name_p, sizeof(name_p)))
+        if (VAL_LOG_ENABLED(LOG_INFO) &&
+            -1 == ns_name_ntop(new_rr->rrs_name_n, name_p, sizeof(name_p)))
             snprintf(name_p, sizeof(name_p), "unknown/error");
-        cachename = (*unchecked_info == unchecked_hints)?  "Hints" : "Answer";
+
+        /* other processes may want it even if there is no room here */
+        if (share && !delete_newrr)
+            shm_cache_store(new_rr);
+
+        new_rr->rrs_cache_bytes = cache_rrset_bytes(new_rr);
+        if (!delete_newrr && !replaced && !cache_admit(new_rr, tv.tv_sec)) {
+            VAL_LOG(NULL, LOG_INFO, "stow_info(): Not admitting {%s, %d, %d} to full %s cache",
+                   name_p, new_rr->rrs_class_h, new_rr->rrs_type_h, store->cs_name);
+            res_sq_free_rrset_recs(&new_rr);
+            continue;
+        }
 
         if (delete_newrr) {
-            val_log(NULL, LOG_INFO, "stow_info(): Refreshing {%s, %d, %d} in %s cache",
-                   name_p, new_rr->rrs_class_h, new_rr->rrs_type_h, cachename);
+            VAL_LOG(NULL, LOG_INFO, "stow_info(): Keeping {%s, %d, %d} in %s cache",
+                   name_p, new_rr->rrs_class_h, new_rr->rrs_type_h, store->cs_name);
             res_sq_free_rrset_recs(&new_rr);
-        } else {
-            /* add new data to the end of our cache */
-            val_log(NULL, LOG_INFO, "stow_info(): Storing new {%s, %d, %d} in %s cache",
-                   name_p, new_rr->rrs_class_h, new_rr->rrs_type_h, cachename);
+            continue;
+        }
+
+        new_rr->rrs_refcount = 1;
+        new_rr->rrs_cache_ref = 1;
+        if (replaced) {
+            VAL_LOG(NULL, LOG_INFO, "stow_info(): Refreshing {%s, %d, %d} in %s cache",
+                   name_p, new_rr->rrs_class_h, new_rr->rrs_type_h, store->cs_name);
+            new_rr->rrs_next = replaced->rrs_next;
             if (prev) {
                 prev->rrs_next = new_rr;
             } else {
-                *unchecked_info = new_rr;
+                store->cs_head = new_rr;
             }
+            if (store->cs_tail == &replaced->rrs_next)
+                store->cs_tail = &new_rr->rrs_next;
+            if (store->cs_hand == &replaced->rrs_next)
+                store->cs_hand = &new_rr->rrs_next;
+            if (store == &unchecked_hints)
+                hint_index_replace(replaced, new_rr);
+            store->cs_bytes -= replaced->rrs_cache_bytes;
+            store->cs_bytes += new_rr->rrs_cache_bytes;
+            replaced->rrs_next = NULL;
+            release_rrset_rec(replaced);
+        } else {
+            /* add new data to the end of our cache */
+            VAL_LOG(NULL, LOG_INFO, "stow_info(): Storing new {%s, %d, %d} in %s cache",
+                   name_p, new_rr->rrs_class_h, new_rr->rrs_type_h, store->cs_name);
+            *store->cs_tail = new_rr;
+            store->cs_tail = &new_rr->rrs_next;
+            store->cs_bytes += new_rr->rrs_cache_bytes;
+            store->cs_count++;
+            if (store == &unchecked_hints)
+                hint_index_add(new_rr);
         }
+        cache_trim(tv.tv_sec);
     }
     return VAL_NO_ERROR;
 }
@@ -228,11 +1113,9 @@ lookup_store(u_char *name_n, u_int16_t class_h, u_int16_t type_h,
                 if((ns_options == 0 || 
                     ns_options == next_answer->rrs_ns_options) &&
                    (next_answer->rrs_data != NULL)) {
-                    *new_answer = copy_rrset_rec(next_answer);
-                    if (*new_answer) {
-                        /* Adjust the TTL */
-                        (*new_answer)->rrs_ttl_h = next_answer->rrs_ttl_x - tv.tv_sec; 
-                    }
+                    /* share the cached rrset, adjusting only the TTL */
+                    *new_answer = view_rrset_rec(next_answer,
+                                        next_answer->rrs_ttl_x - tv.tv_sec);
                     break;
                 }
             } 
@@ -252,6 +1135,7 @@ get_cached_rrset(struct val_query_chain *matched_q,
                  struct domain_info **response)
 {
     struct rrset_rec *new_answer;
+    struct rrset_rec *shared;
 
     u_char *name_n;
     u_int16_t class_h;
@@ -276,10 +1160,12 @@ get_cached_rrset(struct val_query_chain *matched_q,
     VAL_CACHE_LOCK_SH(&ans_rwlock);
 
     if (VAL_NO_ERROR != (retval = lookup_store(name_n, class_h, type_h,
-                            unchecked_answers, &new_answer, ns_options))) {
+                            unchecked_answers.cs_head, &new_answer, ns_options))) {
         VAL_CACHE_UNLOCK(&ans_rwlock);
         return retval;
     }
+    if (new_answer)
+        cache_touch(name_n, type_h, new_answer->rrs_shared);
 
     VAL_CACHE_UNLOCK(&ans_rwlock);
    
@@ -294,18 +1180,61 @@ get_cached_rrset(struct val_query_chain *matched_q,
         VAL_CACHE_LOCK_SH(&ns_rwlock);
 
         if (VAL_NO_ERROR != (retval = lookup_store(name_n, class_h, type_h,
-                            unchecked_hints, &new_answer, 0))) {
+                            unchecked_hints.cs_head, &new_answer, 0))) {
             VAL_CACHE_UNLOCK(&ns_rwlock);
             return retval;
         }
+        if (new_answer)
+            cache_touch(name_n, type_h, new_answer->rrs_shared);
 
         VAL_CACHE_UNLOCK(&ns_rwlock);
     }
 
+    /* a miss counts towards admitting the answer when it arrives */
+    if (!new_answer)
+        cache_touch(name_n, type_h, NULL);
+    else {
+        res_stats_inc(RES_STAT_CACHE_HITS);
+        VAL_PROBE3(cache_hit, name_n, type_h, 0);
+    }
+
+    /* 
+     * Another process may have cached it.  Keep a copy here, so that
+     * later lookups need not go to the shared cache.
+     */
+    if (!new_answer &&
+        NULL != (shared = shm_cache_lookup(name_n, class_h, type_h,
+                                           ns_options))) {
+        CACHE_LOCK_STORES();
+        stow_info(&unchecked_answers, &shared, matched_q, 0);
+        lookup_store(name_n, class_h, type_h, unchecked_answers.cs_head,
+                     &new_answer, ns_options);
+        CACHE_UNLOCK_STORES();
+
+        /* not admitted to the local cache */
+        if (!new_answer)
+            new_answer = shm_cache_lookup(name_n, class_h, type_h,
+                                          ns_options);
+        if (new_answer) {
+            res_stats_inc(RES_STAT_CACHE_SHARED_HITS);
+            VAL_PROBE3(cache_hit, name_n, type_h, 1);
+        }
+    }
+    if (!new_answer) {
+        res_stats_inc(RES_STAT_CACHE_MISSES);
+        VAL_PROBE2(cache_miss, name_n, type_h);
+    }
+
     /* Construct the response */
     if (new_answer) {
+        char buf[NS_MAXDNAME];
         char *name_p;
-        name_p = (char *) MALLOC (NS_MAXDNAME * sizeof(char));
+
+        if (ns_name_ntop(name_n, buf, sizeof(buf)) == -1) {
+            res_sq_free_rrset_recs(&new_answer);
+            return VAL_NO_ERROR;
+        }
+        name_p = (char *) arena_malloc (strlen(buf) + 1);
         if (name_p == NULL) {
             res_sq_free_rrset_recs(&new_answer);
             return VAL_OUT_OF_MEMORY;
@@ -314,13 +1243,14 @@ get_cached_rrset(struct val_query_chain *matched_q,
         /*
          * Construct a response 
          */
-        *response = (struct domain_info *) MALLOC(sizeof(struct domain_info));
+        *response = (struct domain_info *) arena_malloc(sizeof(struct domain_info));
         if (*response == NULL) {
-            FREE(name_p);
+            arena_free(name_p);
             res_sq_free_rrset_recs(&new_answer);
             return VAL_OUT_OF_MEMORY;
         }
 
+        strcpy(name_p, buf);
         (*response)->di_requested_name_h = name_p;
         (*response)->di_answers = new_answer;
         (*response)->di_proofs = NULL;
@@ -328,19 +1258,17 @@ get_cached_rrset(struct val_query_chain *matched_q,
             (struct qname_chain *) MALLOC(sizeof(struct qname_chain));
         if ((*response)->di_qnames == NULL) {
             free_domain_info_ptrs(*response);
-            FREE(*response);
+            arena_free(*response);
             *response = NULL;
             return VAL_OUT_OF_MEMORY;
         }
-        memcpy((*response)->di_qnames->qnc_name_n, name_n,
-               wire_name_length(name_n));
+        (*response)->di_qnames->qnc_name_n = name_intern(name_n);
         (*response)->di_qnames->qnc_next = NULL;
-
-        if (ns_name_ntop(name_n, name_p, NS_MAXCDNAME) == -1) {
+        if ((*response)->di_qnames->qnc_name_n == NULL) {
             free_domain_info_ptrs(*response);
-            FREE(*response);
+            arena_free(*response);
             *response = NULL;
-            return VAL_NO_ERROR;
+            return VAL_OUT_OF_MEMORY;
         }
 
         (*response)->di_requested_type_h = type_h;
@@ -358,7 +1286,7 @@ get_cached_rrset(struct val_query_chain *matched_q,
 
         if (retval != VAL_NO_ERROR) {
             free_domain_info_ptrs(*response);
-            FREE(*response);
+            arena_free(*response);
             *response = NULL;
         }
 
@@ -399,10 +1327,10 @@ stow_zone_info(struct rrset_rec **new_info, struct val_query_chain *matched_q)
         return VAL_NO_ERROR;
     }
     
-    VAL_CACHE_LOCK_INIT(&ns_rwlock, ns_rwlock_init);
-    VAL_CACHE_LOCK_EX(&ns_rwlock);
-    rc = stow_info(&unchecked_hints, new_info, matched_q);
-    VAL_CACHE_UNLOCK(&ns_rwlock);
+    cache_reap_due();
+    CACHE_LOCK_STORES();
+    rc = stow_info(&unchecked_hints, new_info, matched_q, 0);
+    CACHE_UNLOCK_STORES();
 
     return rc;
 }
@@ -415,10 +1343,10 @@ stow_answers(struct rrset_rec **new_info, struct val_query_chain *matched_q)
 {
     int             rc;
 
-    VAL_CACHE_LOCK_INIT(&ans_rwlock, ans_rwlock_init);
-    VAL_CACHE_LOCK_EX(&ans_rwlock);
-    rc = stow_info(&unchecked_answers, new_info, matched_q);
-    VAL_CACHE_UNLOCK(&ans_rwlock);
+    cache_reap_due();
+    CACHE_LOCK_STORES();
+    rc = stow_info(&unchecked_answers, new_info, matched_q, 1);
+    CACHE_UNLOCK_STORES();
 
     return rc;
 }
@@ -439,13 +1367,15 @@ get_nslist_from_cache(val_context_t *ctx,
     /*
      * find closest matching name zone_n 
      */
-    struct rrset_rec *nsrrset;
+    struct rrset_rec *nsrrset, *zone_ns = NULL;
+    struct rrset_rec *learned;
+    struct hint_node *node, *zone_node = NULL;
+    struct hint_ref *ref;
+    const u_char *labels[NS_MAXCDNAME / 2];
     u_char       *name_n = NULL;
-    u_char       *tname_n = NULL;
-    u_char       *p;
     u_int16_t     qtype;
     u_char       *qname_n;
-    u_char       *tmp_zonecut_n = NULL;
+    int           n;
     struct timeval  tv;
 
     if (matched_qfq == NULL || queries == NULL || ref_ns_list == NULL || ns_cred == NULL)
@@ -461,58 +1391,62 @@ get_nslist_from_cache(val_context_t *ctx,
     *zonecut_n = NULL;
     gettimeofday(&tv, NULL);
     
-    tmp_zonecut_n = NULL;
-
+    if (-1 == (n = hint_split_labels(qname_n, labels)))
+        return VAL_NO_ERROR;
 
     /* Check in the NS store */
 
     VAL_CACHE_LOCK_INIT(&ns_rwlock, ns_rwlock_init);
     VAL_CACHE_LOCK_SH(&ns_rwlock);
 
-    nsrrset = unchecked_hints;
-    while (nsrrset) {
-
-        if (tv.tv_sec < nsrrset->rrs_ttl_x &&
-            nsrrset->rrs_type_h == ns_t_ns) {
-
-            tname_n = nsrrset->rrs_name_n;
+    /*
+     * Walk down from the root along the query name, looking
+     * for the closest name with the best credibility
+     */
+    node = &hint_root;
+    while (node) {
+        /*
+         * If type is DS, you don't want an exact match
+         * since that will lead you to the child zone
+         */
+        if (n == 0 && qtype == ns_t_ds)
+            break;
 
-            /*
-             * Find the closest name with the best credibility
-             */
-            if ((*ns_cred == SR_CRED_UNSET || nsrrset->rrs_cred <= *ns_cred) &&
-                    NULL != (p = namename(qname_n, tname_n))) {
-
-                if (!name_n ||
-                    nsrrset->rrs_cred < *ns_cred ||
-                    (wire_name_length(tname_n) > wire_name_length(name_n))) {
-
-                    /*
-                     * If type is DS, you don't want an exact match
-                     * since that will lead you to the child zone
-                     */
-                    if ((qtype != ns_t_ds) || (p != qname_n)) {
-                        /*
-                         * New name is longer than old name 
-                         */
-                        name_n = tname_n;
-                        *ns_cred = nsrrset->rrs_cred;
-                        tmp_zonecut_n = nsrrset->rrs_name_n;
-                    }
-                }
+        for (ref = node->hn_rrsets; ref; ref = ref->hr_next) {
+            nsrrset = ref->hr_rrset;
+            if (tv.tv_sec >= nsrrset->rrs_ttl_x ||
+                nsrrset->rrs_type_h != ns_t_ns)
+                continue;
+            if (*ns_cred != SR_CRED_UNSET && nsrrset->rrs_cred > *ns_cred)
+                continue;
+            if (!name_n ||
+                nsrrset->rrs_cred < *ns_cred ||
+                (wire_name_length(nsrrset->rrs_name_n) >
+                 wire_name_length(name_n))) {
+                name_n = nsrrset->rrs_name_n;
+                *ns_cred = nsrrset->rrs_cred;
+                zone_node = node;
+                zone_ns = nsrrset;
             }
         }
-        nsrrset = nsrrset->rrs_next;
-    }
 
+        if (n == 0)
+            break;
+        node = hint_child(node, labels[--n]);
+    }
 
-    if (name_n && tmp_zonecut_n) {
+    if (name_n) {
 
-        bootstrap_referral(ctx, name_n, unchecked_hints, matched_qfq, queries,
-                           ref_ns_list);
+        cache_touch(name_n, ns_t_ns, zone_ns);
+        learned = hint_collect_zone(zone_node);
+        bootstrap_referral(ctx, name_n,
+                           learned ? learned : unchecked_hints.cs_head,
+                           matched_qfq, queries, ref_ns_list);
+        if (learned)
+            FREE(learned);
 
         if (*ref_ns_list) {
-            *zonecut_n = (u_char *) MALLOC (wire_name_length(tmp_zonecut_n) *
+            *zonecut_n = (u_char *) MALLOC (wire_name_length(name_n) *
                     sizeof (u_char));
             if (*zonecut_n == NULL) {
                 VAL_CACHE_UNLOCK(&ns_rwlock);
@@ -520,7 +1454,7 @@ get_nslist_from_cache(val_context_t *ctx,
                 *ref_ns_list = NULL;
                 return VAL_OUT_OF_MEMORY;
             } 
-            memcpy(*zonecut_n, tmp_zonecut_n, wire_name_length(tmp_zonecut_n));
+            memcpy(*zonecut_n, name_n, wire_name_length(name_n));
         }
     }
     
@@ -529,20 +1463,398 @@ get_nslist_from_cache(val_context_t *ctx,
     return VAL_NO_ERROR;
 }
 
+static size_t
+server_addr_len(const struct sockaddr_storage *addr)
+{
+    if (addr->ss_family == AF_INET)
+        return sizeof(struct sockaddr_in);
+#ifdef VAL_IPV6
+    if (addr->ss_family == AF_INET6)
+        return sizeof(struct sockaddr_in6);
+#endif
+    return 0;
+}
+
+static int
+server_addr_cmp(const struct sockaddr_storage *a,
+                const struct sockaddr_storage *b)
+{
+    if (a->ss_family != b->ss_family)
+        return 1;
+
+    if (a->ss_family == AF_INET) {
+        const struct sockaddr_in *a4 = (const struct sockaddr_in *) a;
+        const struct sockaddr_in *b4 = (const struct sockaddr_in *) b;
+        return (a4->sin_port != b4->sin_port) ||
+            memcmp(&a4->sin_addr, &b4->sin_addr, sizeof(a4->sin_addr));
+    }
+#ifdef VAL_IPV6
+    if (a->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *) a;
+        const struct sockaddr_in6 *b6 = (const struct sockaddr_in6 *) b;
+        return (a6->sin6_port != b6->sin6_port) ||
+            memcmp(&a6->sin6_addr, &b6->sin6_addr, sizeof(a6->sin6_addr));
+    }
+#endif
+    return 1;
+}
+
+static unsigned int
+server_addr_hash(const struct sockaddr_storage *addr)
+{
+    const u_char   *p = NULL;
+    size_t          len = 0, i;
+    unsigned int    h = addr->ss_family;
+
+    if (addr->ss_family == AF_INET) {
+        p = (const u_char *) &((const struct sockaddr_in *) addr)->sin_addr;
+        len = sizeof(struct in_addr);
+    }
+#ifdef VAL_IPV6
+    else if (addr->ss_family == AF_INET6) {
+        p = (const u_char *) &((const struct sockaddr_in6 *) addr)->sin6_addr;
+        len = sizeof(struct in6_addr);
+    }
+#endif
+    for (i = 0; i < len; i++)
+        h = h * 31 + p[i];
+
+    return h % SERVER_CAP_BUCKETS;
+}
+
+/*
+ * NOTE: This assumes that the caller holds the cap_rwlock.
+ */
+static struct server_capability *
+find_server_capability(const struct sockaddr_storage *addr)
+{
+    struct server_capability *sc;
+
+    for (sc = server_caps[server_addr_hash(addr)]; sc; sc = sc->sc_next) {
+        if (!server_addr_cmp(&sc->sc_addr, addr))
+            return sc;
+    }
+    return NULL;
+}
+
+/*
+ * NOTE: This assumes that the caller holds the cap_rwlock.
+ */
+static int
+server_is_lame(struct server_capability *sc, const u_char *zone_n,
+               u_int32_t now)
+{
+    struct server_lameness *sl;
+
+    if (zone_n == NULL)
+        return 0;
+    for (sl = sc->sc_lame; sl; sl = sl->sl_next) {
+        if (now < sl->sl_ttl_x && !namecmp(sl->sl_zone_n, zone_n))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * NOTE: This assumes that the caller holds the cap_rwlock.
+ */
+static struct server_capability *
+add_server_capability(struct sockaddr_storage *addr)
+{
+    struct server_capability *sc;
+    unsigned int    h;
+
+    sc = find_server_capability(addr);
+    if (sc != NULL)
+        return sc;
+
+    sc = (struct server_capability *)
+        MALLOC(sizeof(struct server_capability));
+    if (sc == NULL)
+        return NULL;
+    memset(sc, 0, sizeof(struct server_capability));
+    memcpy(&sc->sc_addr, addr, server_addr_len(addr));
+    sc->sc_edns0_size = -1;
+    h = server_addr_hash(addr);
+    sc->sc_next = server_caps[h];
+    server_caps[h] = sc;
+    return sc;
+}
+
+/*
+ * Record something we have learned about a server.
+ * edns0_size is the largest edns0 size known to work, or -1 if
+ * nothing was learned about edns0. cap_flags are SERVER_CAP_... flags 
+ * to set on the server.
+ *
+ * The expiry time for a piece of information is only set when it is
+ * first learned, so that the server is probed again for its full
+ * capabilities once that time has elapsed.
+ */
+void
+stow_server_capability(struct sockaddr_storage *addr, int edns0_size,
+                       u_int32_t cap_flags)
+{
+    struct server_capability *sc;
+    struct timeval  tv;
+
+    if (addr == NULL || server_addr_len(addr) == 0)
+        return;
+
+    gettimeofday(&tv, NULL);
+
+    VAL_CACHE_LOCK_INIT(&cap_rwlock, cap_rwlock_init);
+    VAL_CACHE_LOCK_EX(&cap_rwlock);
+
+    sc = add_server_capability(addr);
+    if (sc == NULL) {
+        VAL_CACHE_UNLOCK(&cap_rwlock);
+        return;
+    }
+
+    /* forget stale information */
+    if (tv.tv_sec >= sc->sc_cap_ttl_x) {
+        sc->sc_edns0_size = -1;
+        sc->sc_flags &= ~(SERVER_CAP_NO_EDNS0 | SERVER_CAP_TCP_ONLY);
+    }
+    if (tv.tv_sec >= sc->sc_bad_ttl_x)
+        sc->sc_flags &= ~SERVER_CAP_UNREACHABLE;
+
+    if ((edns0_size >= 0 &&
+         (sc->sc_edns0_size < 0 || edns0_size < sc->sc_edns0_size)) ||
+        ((cap_flags & ~sc->sc_flags) &
+         (SERVER_CAP_NO_EDNS0 | SERVER_CAP_TCP_ONLY))) {
+        sc->sc_cap_ttl_x = tv.tv_sec + SERVER_CAP_CACHE_TTL;
+    }
+    if (edns0_size >= 0 &&
+        (sc->sc_edns0_size < 0 || edns0_size < sc->sc_edns0_size))
+        sc->sc_edns0_size = edns0_size;
+
+    if ((cap_flags & ~sc->sc_flags) & SERVER_CAP_UNREACHABLE)
+        sc->sc_bad_ttl_x = tv.tv_sec + SERVER_BAD_CACHE_TTL;
+    sc->sc_flags |= cap_flags;
+
+    VAL_CACHE_UNLOCK(&cap_rwlock);
+}
+
+/*
+ * Record that a server gave a lame answer for the zone zone_n.
+ * Expired entries for the server are dropped along the way.
+ */
+void
+stow_server_lameness(struct sockaddr_storage *addr, const u_char *zone_n)
+{
+    struct server_capability *sc;
+    struct server_lameness *sl, **slp;
+    struct timeval  tv;
+    size_t          len;
+
+    if (addr == NULL || server_addr_len(addr) == 0 || zone_n == NULL)
+        return;
+
+    gettimeofday(&tv, NULL);
+
+    VAL_CACHE_LOCK_INIT(&cap_rwlock, cap_rwlock_init);
+    VAL_CACHE_LOCK_EX(&cap_rwlock);
+
+    sc = add_server_capability(addr);
+    if (sc == NULL) {
+        VAL_CACHE_UNLOCK(&cap_rwlock);
+        return;
+    }
+
+    for (slp = &sc->sc_lame; (sl = *slp) != NULL;) {
+        if (!namecmp(sl->sl_zone_n, zone_n)) {
+            /* keep the original expiry so that the server is retried */
+            VAL_CACHE_UNLOCK(&cap_rwlock);
+            return;
+        }
+        if (tv.tv_sec >= sl->sl_ttl_x) {
+            *slp = sl->sl_next;
+            FREE(sl->sl_zone_n);
+            FREE(sl);
+        } else
+            slp = &sl->sl_next;
+    }
+
+    sl = (struct server_lameness *) MALLOC(sizeof(struct server_lameness));
+    if (sl == NULL) {
+        VAL_CACHE_UNLOCK(&cap_rwlock);
+        return;
+    }
+    len = wire_name_length(zone_n);
+    sl->sl_zone_n = (u_char *) MALLOC(len * sizeof(u_char));
+    if (sl->sl_zone_n == NULL) {
+        FREE(sl);
+        VAL_CACHE_UNLOCK(&cap_rwlock);
+        return;
+    }
+    memcpy(sl->sl_zone_n, zone_n, len);
+    sl->sl_ttl_x = tv.tv_sec + SERVER_BAD_CACHE_TTL;
+    sl->sl_next = sc->sc_lame;
+    sc->sc_lame = sl;
+
+    VAL_CACHE_UNLOCK(&cap_rwlock);
+}
+
+static void
+free_server_lameness(struct server_capability *sc)
+{
+    struct server_lameness *sl;
+
+    while ((sl = sc->sc_lame) != NULL) {
+        sc->sc_lame = sl->sl_next;
+        FREE(sl->sl_zone_n);
+        FREE(sl);
+    }
+}
+
+/*
+ * Record what a successful response tells us about the server
+ * that sent it: it is reachable, and the edns0 and transport settings
+ * in effect for the query that produced the response are known to work.
+ */
+void
+stow_server_response(struct name_server *respondent, int validating)
+{
+    struct server_capability *sc;
+    u_int32_t       flags = 0;
+    int             edns0_size = -1;
+
+    if (respondent == NULL || respondent->ns_number_of_addresses <= 0)
+        return;
+
+    /* server answered; it is no longer considered unreachable */
+    VAL_CACHE_LOCK_INIT(&cap_rwlock, cap_rwlock_init);
+    VAL_CACHE_LOCK_EX(&cap_rwlock);
+    sc = find_server_capability(respondent->ns_address[0]);
+    if (sc)
+        sc->sc_flags &= ~SERVER_CAP_UNREACHABLE;
+    VAL_CACHE_UNLOCK(&cap_rwlock);
+
+    if (validating) {
+        if (!(respondent->ns_options & SR_QUERY_VALIDATING_STUB_FLAGS)) {
+            flags |= SERVER_CAP_NO_EDNS0;
+            edns0_size = 0;
+        } else
+            edns0_size = respondent->ns_edns0_size;
+    }
+
+    /* 
+     * A response over tcp only means that udp can't be used at all if
+     * we had already fallen back to the smallest udp payload size.
+     */
+    if ((respondent->ns_options & SR_QUERY_USE_TCP) &&
+        (edns0_size >= 0 && edns0_size <= 512))
+        flags |= SERVER_CAP_TCP_ONLY;
+
+    if (edns0_size >= 0 || flags)
+        stow_server_capability(respondent->ns_address[0], edns0_size, flags);
+}
+
+/*
+ * Adjust a list of name servers according to what we know about
+ * each server, before a query is sent to them: reduce the edns0 size
+ * (or disable edns0) if allow_fallback is set, start with tcp for
+ * servers that need it, and move servers that are unreachable, or lame
+ * for the zone zonecut_n, to the end of the list.
+ */
+void
+apply_server_capabilities(val_context_t *ctx, struct name_server **ns_list,
+                          const u_char *zonecut_n, int allow_fallback)
+{
+    struct name_server *ns, *next;
+    struct name_server *good = NULL, **good_tail = &good;
+    struct name_server *bad = NULL, **bad_tail = &bad;
+    struct server_capability *sc;
+    struct timeval  tv;
+    int             i, num_bad;
+
+    if (ns_list == NULL || *ns_list == NULL)
+        return;
+
+    gettimeofday(&tv, NULL);
+
+    VAL_CACHE_LOCK_INIT(&cap_rwlock, cap_rwlock_init);
+    VAL_CACHE_LOCK_SH(&cap_rwlock);
+
+    for (ns = *ns_list; ns; ns = next) {
+        next = ns->ns_next;
+        ns->ns_next = NULL;
+        num_bad = 0;
+
+        for (i = 0; i < ns->ns_number_of_addresses; i++) {
+            sc = find_server_capability(ns->ns_address[i]);
+            if (sc == NULL)
+                continue;
+            if (((sc->sc_flags & SERVER_CAP_UNREACHABLE) &&
+                 tv.tv_sec < sc->sc_bad_ttl_x) ||
+                server_is_lame(sc, zonecut_n, tv.tv_sec))
+                ++num_bad;
+            if (i != 0 || tv.tv_sec >= sc->sc_cap_ttl_x)
+                continue;
+
+            if (allow_fallback &&
+                (ns->ns_options & SR_QUERY_VALIDATING_STUB_FLAGS)) {
+                if (sc->sc_flags & SERVER_CAP_NO_EDNS0) {
+                    ns->ns_options &= ~SR_QUERY_VALIDATING_STUB_FLAGS;
+                    ns->ns_edns0_size = 0;
+                } else if (sc->sc_edns0_size > 0 &&
+                           sc->sc_edns0_size < ns->ns_edns0_size) {
+                    ns->ns_edns0_size = sc->sc_edns0_size;
+                }
+            }
+            if (sc->sc_flags & SERVER_CAP_TCP_ONLY)
+                ns->ns_options |= SR_QUERY_USE_TCP;
+        }
+
+        if (num_bad > 0 && num_bad == ns->ns_number_of_addresses) {
+            *bad_tail = ns;
+            bad_tail = &ns->ns_next;
+        } else {
+            *good_tail = ns;
+            good_tail = &ns->ns_next;
+        }
+    }
+
+    VAL_CACHE_UNLOCK(&cap_rwlock);
+
+    if (bad != NULL && good != NULL)
+        VAL_LOG(ctx, LOG_DEBUG,
+                "apply_server_capabilities(): trying lame/unreachable servers last");
+    *good_tail = bad;
+    *ns_list = good;
+}
+
 int
 free_validator_cache(void)
 {
-    VAL_CACHE_LOCK_INIT(&ns_rwlock, ns_rwlock_init);
-    VAL_CACHE_LOCK_EX(&ns_rwlock);
-    res_sq_free_rrset_recs(&unchecked_hints);
-    unchecked_hints = NULL;
-    VAL_CACHE_UNLOCK(&ns_rwlock);
-    
-    VAL_CACHE_LOCK_INIT(&ans_rwlock, ans_rwlock_init);
-    VAL_CACHE_LOCK_EX(&ans_rwlock);
-    res_sq_free_rrset_recs(&unchecked_answers);
-    unchecked_answers = NULL;
-    VAL_CACHE_UNLOCK(&ans_rwlock);
+    int             i;
+    struct server_capability *sc;
+
+#ifndef VAL_NO_THREADS
+    cache_reaper_stop();
+#endif
+
+    CACHE_LOCK_STORES();
+    release_cached_rrsets(&unchecked_hints);
+    hint_free_node(&hint_root);
+    release_cached_rrsets(&unchecked_answers);
+    CACHE_UNLOCK_STORES();
+
+    VAL_CACHE_LOCK_INIT(&cap_rwlock, cap_rwlock_init);
+    VAL_CACHE_LOCK_EX(&cap_rwlock);
+    for (i = 0; i < SERVER_CAP_BUCKETS; i++) {
+        while (server_caps[i]) {
+            sc = server_caps[i];
+            server_caps[i] = sc->sc_next;
+            free_server_lameness(sc);
+            FREE(sc);
+        }
+    }
+    VAL_CACHE_UNLOCK(&cap_rwlock);
+
+    shm_cache_close();
     
     return VAL_NO_ERROR;
 }
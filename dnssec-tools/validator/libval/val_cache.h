@@ -12,6 +12,7 @@ int             stow_ds_info(struct rrset_rec **new_info, struct val_query_chain
 int             stow_answers(struct rrset_rec **new_info, struct val_query_chain *matched_q);
 int             get_cached_rrset(struct val_query_chain *matched_q, struct domain_info **response);
 int             free_validator_cache(void);
+void            set_cache_max_size(long bytes);
 int             get_nslist_from_cache(val_context_t *ctx,
                                       struct queries_for_query *matched_qfq,
                                       struct queries_for_query **queries,
@@ -19,4 +20,23 @@ int             get_nslist_from_cache(val_context_t *ctx,
                                       u_char **zonecut_n,
                                       u_char *ns_cred);
 
+/*
+ * Server capability flags 
+ */
+#define SERVER_CAP_NO_EDNS0         0x00000001
+#define SERVER_CAP_TCP_ONLY         0x00000002
+#define SERVER_CAP_UNREACHABLE      0x00000004
+
+void            stow_server_capability(struct sockaddr_storage *addr,
+                                       int edns0_size,
+                                       u_int32_t cap_flags);
+void            stow_server_lameness(struct sockaddr_storage *addr,
+                                     const u_char *zone_n);
+void            stow_server_response(struct name_server *respondent,
+                                     int validating);
+void            apply_server_capabilities(val_context_t *ctx,
+                                          struct name_server **ns_list,
+                                          const u_char *zonecut_n,
+                                          int allow_fallback);
+
 #endif
@@ -25,16 +25,19 @@
 #include "val_cache.h"
 #include "val_assertion.h"
 #include "val_context.h"
+#include "val_mirror.h"
+#include "val_names.h"
+#include "val_runtime.h"
 
 #define GET_LATEST_TIMESTAMP(ctx, file, cur_ts, new_ts) do { \
     memset(&new_ts, 0, sizeof(struct stat));\
     if (!file) {\
         if (cur_ts != 0) {\
-            val_log(ctx, LOG_WARNING, "val_resolve_and_check(): %s missing; trying to operate without it.", file);\
+            VAL_LOG(ctx, LOG_WARNING, "val_resolve_and_check(): %s missing; trying to operate without it.", file);\
         }\
     } else {\
         if(0 != stat(file, &new_ts)) {\
-            val_log(ctx, LOG_WARNING, "val_resolve_and_check(): %s missing; trying to operate without it.", file);\
+            VAL_LOG(ctx, LOG_WARNING, "val_resolve_and_check(): %s missing; trying to operate without it.", file);\
         }\
     }\
 }while (0)
@@ -97,7 +100,7 @@ _have_addrs(int *have4, int *have6) {
         return;
     }
 
-    val_log(NULL, LOG_INFO, "_have_addrs(): checking for A/AAAA addrs");
+    VAL_LOG(NULL, LOG_INFO, "_have_addrs(): checking for A/AAAA addrs");
 
     if (have4)
         *have4 = 0;
@@ -105,7 +108,7 @@ _have_addrs(int *have4, int *have6) {
         *have6 = 0;
 
     if (getifaddrs(&ifaddr) == -1) {
-        val_log(NULL, LOG_ERR, "getifaddrs failed");
+        VAL_LOG(NULL, LOG_ERR, "getifaddrs failed");
         return;
     }
 
@@ -127,7 +130,7 @@ _have_addrs(int *have4, int *have6) {
                 && !(ifa->ifa_flags & IFF_LOOPBACK)
                 && addr != INADDR_LOOPBACK) {
                 ++*have4;
-                val_log(NULL, LOG_INFO, "have v4 addr!");
+                VAL_LOG(NULL, LOG_INFO, "have v4 addr!");
             }
         }
 #ifdef VAL_IPV6
@@ -142,7 +145,7 @@ _have_addrs(int *have4, int *have6) {
                 && !IN6_IS_ADDR_LINKLOCAL(&addr6)
                 ) {
                 ++*have6;
-                val_log(NULL, LOG_INFO, "have v6 addr!");
+                VAL_LOG(NULL, LOG_INFO, "have v6 addr!");
             }
         }
 #endif
@@ -173,7 +176,7 @@ val_refresh_resolver_policy(val_context_t * context)
 
     if (read_res_config_file(context) != VAL_NO_ERROR) {
         context->r_timestamp = -1;
-        val_log(context, LOG_WARNING, 
+        VAL_LOG(context, LOG_WARNING, 
                 "val_refresh_resolver_policy(): Resolver configuration could not be read; using older values");
     }
     return VAL_NO_ERROR; 
@@ -194,7 +197,7 @@ val_refresh_validator_policy(val_context_t * context)
     if (read_val_config_file(context, context->label) != VAL_NO_ERROR) {
         for(dnsval_l = context->dnsval_l; dnsval_l; dnsval_l=dnsval_l->next)
             dnsval_l->v_timestamp = -1;
-        val_log(context, LOG_WARNING, 
+        VAL_LOG(context, LOG_WARNING, 
                 "val_refresh_validator_policy(): Validator configuration could not be read; using older values");
     }
 
@@ -212,7 +215,7 @@ val_refresh_root_hints(val_context_t * context)
 
     if (read_root_hints_file(context) != VAL_NO_ERROR) {
         context->h_timestamp = -1;
-        val_log(context, LOG_WARNING, 
+        VAL_LOG(context, LOG_WARNING, 
                 "val_refresh_root_hints(): Root Hints could not be read; using older values");
     }
 
@@ -274,6 +277,9 @@ val_refresh_context(val_context_t *context)
         }
     }
 
+    /* pick up new or changed zone mirror files */
+    read_zone_mirrors(context);
+
     retval = VAL_NO_ERROR;
 
 err:
@@ -480,7 +486,7 @@ val_create_context_internal( const char *label,
         CTX_UNLOCK_REFCNT(*newcontext);
 #endif
 
-        val_log(*newcontext, LOG_INFO, "reusing default context");
+        VAL_LOG(*newcontext, LOG_INFO, "reusing default context");
         return retval;
     }
     UNLOCK_DEFAULT_CONTEXT();
@@ -561,7 +567,15 @@ val_create_context_internal( const char *label,
    
     (*newcontext)->val_log_targets = NULL;
     (*newcontext)->q_list = NULL;
+    memset((*newcontext)->stale_table, 0,
+           sizeof((*newcontext)->stale_table));
+    (*newcontext)->zone_mirrors = NULL;
     (*newcontext)->as_list = NULL;
+    (*newcontext)->as_queued = 0;
+    (*newcontext)->as_active = 0;
+    (*newcontext)->as_queue_head = NULL;
+    (*newcontext)->as_queue_tail = NULL;
+    (*newcontext)->as_runtime = NULL;
     (*newcontext)->def_cflags = 0; 
     (*newcontext)->def_uflags = flags & VAL_QFLAGS_USERMASK; 
 
@@ -582,6 +596,14 @@ val_create_context_internal( const char *label,
         goto err;
     }
 
+    /*
+     * Load any local zone copies; a root zone copy can stand in
+     * for missing root hints 
+     */
+    if ((retval = read_zone_mirrors(*newcontext)) != VAL_NO_ERROR) {
+        goto err;
+    }
+
     /*
      * Read the Resolver configuration file 
      */
@@ -593,7 +615,7 @@ val_create_context_internal( const char *label,
         (*newcontext)->def_cflags |= VAL_QUERY_AC_DETAIL;
     }
 
-    val_log(*newcontext, LOG_DEBUG, 
+    VAL_LOG(*newcontext, LOG_DEBUG, 
             "val_create_context_with_conf(): Context created with %s %s %s", 
             (*newcontext)->base_dnsval_conf,
             (*newcontext)->resolv_conf,
@@ -728,10 +750,26 @@ val_free_context(val_context_t * context)
 {
     struct val_query_chain *q;
     int has_refs = 0;
+#if !defined(VAL_NO_ASYNC) && !defined(VAL_NO_THREADS)
+    struct val_async_runtime *rt;
+#endif
 
     if (context == NULL)
         return;
     
+#if !defined(VAL_NO_ASYNC) && !defined(VAL_NO_THREADS)
+    /* from a runtime callback, the runtime thread frees it afterwards */
+    if (val_runtime_defer_free(context))
+        return;
+    /* keep the runtime thread off the context's locks while we look */
+    rt = val_runtime_pause(context);
+#endif
+
+#ifndef VAL_NO_THREADS
+    /* a running background refresh would look like another user */
+    val_prefetch_hold(context);
+#endif
+
     /*
      * never free context that has multiple users
      */
@@ -754,8 +792,28 @@ val_free_context(val_context_t * context)
     CTX_UNLOCK_REFCNT(context);
 #endif
 
-    if (has_refs)
+    if (has_refs) {
+#ifndef VAL_NO_THREADS
+        val_prefetch_release(context);
+#endif
+#if !defined(VAL_NO_ASYNC) && !defined(VAL_NO_THREADS)
+        val_runtime_resume(context, rt);
+#endif
         return;
+    }
+
+#ifndef VAL_NO_THREADS
+    /* background refreshes must not outlive the context */
+    val_prefetch_forget(context);
+#endif
+
+#if !defined(VAL_NO_ASYNC) && !defined(VAL_NO_THREADS)
+    /* the context is ours; its runtime thread may not outlive it */
+    if (rt) {
+        val_async_runtime_stop(context);
+        val_runtime_resume(context, rt);
+    }
+#endif
 
     /* 
      * we have an exclusive policy lock here, but we don't bother
@@ -812,6 +870,8 @@ val_free_context(val_context_t * context)
         free_query_chain_structure(q);
         q = NULL;
     }
+    free_stale_answers(context);
+    free_zone_mirrors(&context->zone_mirrors);
     if (context->base_dnsval_conf)
         FREE(context->base_dnsval_conf);
     
@@ -830,6 +890,9 @@ val_free_validator_state()
 {
     val_context_t * saved_ctx = NULL;
 
+#ifndef VAL_NO_THREADS
+    val_prefetch_stop();
+#endif
     free_validator_cache();
 
     LOCK_DEFAULT_CONTEXT();
@@ -846,6 +909,8 @@ val_free_validator_state()
     if (saved_ctx)
         val_free_context(saved_ctx);
 
+    res_io_cancel_all();
+
 #ifdef WIN32
     WSACleanup();
 #endif
@@ -882,12 +947,12 @@ val_context_setqflags(val_context_t *context,
 
     if (action == VAL_CTX_FLAG_SET) {
         ctx->def_uflags |= flags;
-        val_log(ctx, LOG_DEBUG, 
+        VAL_LOG(ctx, LOG_DEBUG, 
                 "val_context_setqflags(): default user query flags after SET %x", 
                 ctx->def_uflags);
     } else if (action == VAL_CTX_FLAG_RESET) {
         ctx->def_uflags ^= (ctx->def_uflags & flags);
-        val_log(ctx, LOG_DEBUG, 
+        VAL_LOG(ctx, LOG_DEBUG, 
                 "val_context_setqflags(): default user query flags after RESET %x", 
                 ctx->def_uflags);
     }
@@ -951,9 +1016,13 @@ _val_store_ns_in_map(u_char * zonecut_n, struct name_server *ns,
         if (map_e == NULL) {
             return VAL_OUT_OF_MEMORY;
         }
+        map_e->zone_n = name_intern(zonecut_n);
+        if (map_e->zone_n == NULL) {
+            FREE(map_e);
+            return VAL_OUT_OF_MEMORY;
+        }
 
         clone_ns_list(&map_e->nslist, ns);
-        memcpy(map_e->zone_n, zonecut_n, wire_name_length(zonecut_n));
         map_e->next = NULL;
 
         if (*zone_ns_map != NULL)
@@ -1025,6 +1094,7 @@ _val_free_zone_nslist(struct zone_ns_map_t *zone_ns_map)
 
         if (map_e->nslist)
             free_name_servers(&map_e->nslist);
+        name_release(map_e->zone_n);
         FREE(map_e);
     }
 
@@ -143,10 +143,10 @@ dsasha1_sigverify(val_context_t * ctx,
     u_char   sha1_hash[SHA_DIGEST_LENGTH];
     u_char   sig_asn1[2+2*(3+SHA_DIGEST_LENGTH)];
 
-    val_log(ctx, LOG_DEBUG,
+    VAL_LOG(ctx, LOG_DEBUG,
             "dsasha1_sigverify(): parsing the public key...");
     if ((dsa = DSA_new()) == NULL) {
-        val_log(ctx, LOG_INFO,
+        VAL_LOG(ctx, LOG_INFO,
                 "dsasha1_sigverify(): could not allocate dsa structure.");
         *key_status = VAL_AC_INVALID_KEY;
         return;
@@ -155,7 +155,7 @@ dsasha1_sigverify(val_context_t * ctx,
     if (dsasha1_parse_public_key
         (dnskey->public_key, dnskey->public_key_len,
          dsa) != VAL_NO_ERROR) {
-        val_log(ctx, LOG_INFO,
+        VAL_LOG(ctx, LOG_INFO,
                 "dsasha1_sigverify(): Error in parsing public key.");
         DSA_free(dsa);
         *key_status = VAL_AC_INVALID_KEY;
@@ -163,10 +163,10 @@ dsasha1_sigverify(val_context_t * ctx,
     }
 
     gen_evp_hash(VAL_EVP_DGST_SHA1, data, data_len, sha1_hash, SHA_DIGEST_LENGTH); 
-    val_log(ctx, LOG_DEBUG, "dsasha1_sigverify(): SHA-1 hash = %s",
+    VAL_LOG(ctx, LOG_DEBUG, "dsasha1_sigverify(): SHA-1 hash = %s",
             get_hex_string(sha1_hash, SHA_DIGEST_LENGTH, buf, buflen));
 
-    val_log(ctx, LOG_DEBUG,
+    VAL_LOG(ctx, LOG_DEBUG,
             "dsasha1_sigverify(): verifying DSA signature...");
 
     /*
@@ -180,7 +180,7 @@ dsasha1_sigverify(val_context_t * ctx,
      */
     if (rrsig->signature_len < (1 + 2*SHA_DIGEST_LENGTH)) {
         /* dont have enough data */
-        val_log(ctx, LOG_INFO,
+        VAL_LOG(ctx, LOG_INFO,
                 "dsasha1_sigverify(): Error parsing DSA rrsig.");
         DSA_free(dsa);
         *sig_status = VAL_AC_INVALID_RRSIG;
@@ -195,11 +195,11 @@ dsasha1_sigverify(val_context_t * ctx,
     if (DSA_verify
         (NID_sha1, (u_char *) sha1_hash, SHA_DIGEST_LENGTH,
          sig_asn1, sizeof(sig_asn1), dsa)  == 1) {
-        val_log(ctx, LOG_INFO, "dsasha1_sigverify(): returned SUCCESS");
+        VAL_LOG(ctx, LOG_INFO, "dsasha1_sigverify(): returned SUCCESS");
         DSA_free(dsa);
         *sig_status = VAL_AC_RRSIG_VERIFIED;
     } else {
-        val_log(ctx, LOG_INFO, "dsasha1_sigverify(): returned FAILURE");
+        VAL_LOG(ctx, LOG_INFO, "dsasha1_sigverify(): returned FAILURE");
         DSA_free(dsa);
         *sig_status = VAL_AC_RRSIG_VERIFY_FAILED;
     }
@@ -316,10 +316,10 @@ rsamd5_sigverify(val_context_t * ctx,
     RSA            *rsa = NULL;
     u_char   md5_hash[MD5_DIGEST_LENGTH];
 
-    val_log(ctx, LOG_DEBUG,
+    VAL_LOG(ctx, LOG_DEBUG,
             "rsamd5_sigverify(): parsing the public key...");
     if ((rsa = RSA_new()) == NULL) {
-        val_log(ctx, LOG_INFO,
+        VAL_LOG(ctx, LOG_INFO,
                 "rsamd5_sigverify(): could not allocate rsa structure.");
         *key_status = VAL_AC_INVALID_KEY;
         return;
@@ -327,7 +327,7 @@ rsamd5_sigverify(val_context_t * ctx,
 
     if (rsamd5_parse_public_key(dnskey->public_key, dnskey->public_key_len,
                                 rsa) != VAL_NO_ERROR) {
-        val_log(ctx, LOG_INFO,
+        VAL_LOG(ctx, LOG_INFO,
                 "rsamd5_sigverify(): Error in parsing public key.");
         RSA_free(rsa);
         *key_status = VAL_AC_INVALID_KEY;
@@ -336,19 +336,19 @@ rsamd5_sigverify(val_context_t * ctx,
 
     memset(md5_hash, 0, MD5_DIGEST_LENGTH);
     MD5(data, data_len, (u_char *) md5_hash);
-    val_log(ctx, LOG_DEBUG, "rsamd5_sigverify(): MD5 hash = %s",
+    VAL_LOG(ctx, LOG_DEBUG, "rsamd5_sigverify(): MD5 hash = %s",
             get_hex_string(md5_hash, MD5_DIGEST_LENGTH, buf, buflen));
 
-    val_log(ctx, LOG_DEBUG,
+    VAL_LOG(ctx, LOG_DEBUG,
             "rsamd5_sigverify(): verifying RSA signature...");
 
     if (RSA_verify(NID_md5, (u_char *) md5_hash, MD5_DIGEST_LENGTH,
                    rrsig->signature, rrsig->signature_len, rsa) == 1) {
-        val_log(ctx, LOG_INFO, "rsamd5_sigverify(): returned SUCCESS");
+        VAL_LOG(ctx, LOG_INFO, "rsamd5_sigverify(): returned SUCCESS");
         RSA_free(rsa);
         *sig_status = VAL_AC_RRSIG_VERIFIED;
     } else {
-        val_log(ctx, LOG_INFO, "rsamd5_sigverify(): returned FAILURE");
+        VAL_LOG(ctx, LOG_INFO, "rsamd5_sigverify(): returned FAILURE");
         RSA_free(rsa);
         *sig_status = VAL_AC_RRSIG_VERIFY_FAILED;
     }
@@ -423,10 +423,10 @@ rsasha_sigverify(val_context_t * ctx,
     size_t   hashlen = 0;
     int nid = 0;
 
-    val_log(ctx, LOG_DEBUG,
+    VAL_LOG(ctx, LOG_DEBUG,
             "rsasha_sigverify(): parsing the public key...");
     if ((rsa = RSA_new()) == NULL) {
-        val_log(ctx, LOG_INFO,
+        VAL_LOG(ctx, LOG_INFO,
                 "rsasha_sigverify(): could not allocate rsa structure.");
         *key_status = VAL_AC_INVALID_KEY;
         return;
@@ -435,7 +435,7 @@ rsasha_sigverify(val_context_t * ctx,
     if (rsa_parse_public_key
         (dnskey->public_key, (size_t)dnskey->public_key_len,
          rsa) != VAL_NO_ERROR) {
-        val_log(ctx, LOG_INFO,
+        VAL_LOG(ctx, LOG_INFO,
                 "rsasha_sigverify(): Error in parsing public key.");
         RSA_free(rsa);
         *key_status = VAL_AC_INVALID_KEY;
@@ -460,26 +460,26 @@ rsasha_sigverify(val_context_t * ctx,
         gen_evp_hash(VAL_EVP_DGST_SHA512, data, data_len, sha_hash, hashlen); 
         nid = NID_sha512; 
     } else {
-        val_log(ctx, LOG_INFO,
+        VAL_LOG(ctx, LOG_INFO,
                 "rsasha_sigverify(): Unkown algorithm.");
         RSA_free(rsa);
         *key_status = VAL_AC_INVALID_KEY;
         return;
     } 
 
-    val_log(ctx, LOG_DEBUG, "rsasha_sigverify(): SHA hash = %s",
+    VAL_LOG(ctx, LOG_DEBUG, "rsasha_sigverify(): SHA hash = %s",
             get_hex_string(sha_hash, hashlen, buf, buflen));
-    val_log(ctx, LOG_DEBUG,
+    VAL_LOG(ctx, LOG_DEBUG,
             "rsasha_sigverify(): verifying RSA signature...");
 
     if (RSA_verify
         (nid, sha_hash, hashlen,
          rrsig->signature, rrsig->signature_len, rsa) == 1) {
-        val_log(ctx, LOG_INFO, "rsasha_sigverify(): returned SUCCESS");
+        VAL_LOG(ctx, LOG_INFO, "rsasha_sigverify(): returned SUCCESS");
         RSA_free(rsa);
         *sig_status = VAL_AC_RRSIG_VERIFIED;
     } else {
-        val_log(ctx, LOG_INFO, "rsasha_sigverify(): returned FAILURE");
+        VAL_LOG(ctx, LOG_INFO, "rsasha_sigverify(): returned FAILURE");
         RSA_free(rsa);
         *sig_status = VAL_AC_RRSIG_VERIFY_FAILED;
     }
@@ -507,7 +507,7 @@ ecdsa_sigverify(val_context_t * ctx,
     ecdsa_sig = ECDSA_SIG_new();
     memset(sha_hash, 0, sizeof(sha_hash));
 
-    val_log(ctx, LOG_DEBUG,
+    VAL_LOG(ctx, LOG_DEBUG,
             "ecdsa_sigverify(): parsing the public key...");
 
     if (rrsig->algorithm == ALG_ECDSAP256SHA256) {
@@ -521,7 +521,7 @@ ecdsa_sigverify(val_context_t * ctx,
     } 
 
     if (eckey == NULL) {
-        val_log(ctx, LOG_INFO,
+        VAL_LOG(ctx, LOG_INFO,
                 "ecdsa_sigverify(): could not create key for ECDSA group.");
         *key_status = VAL_AC_INVALID_KEY;
         goto err;
@@ -532,7 +532,7 @@ ecdsa_sigverify(val_context_t * ctx,
      * dnskey->public_key, dnskey->public_key_len
      */
     if (dnskey->public_key_len != 2*hashlen) {
-        val_log(ctx, LOG_INFO,
+        VAL_LOG(ctx, LOG_INFO,
                 "ecdsa_sigverify(): dnskey length does not match expected size.");
         *key_status = VAL_AC_INVALID_KEY;
         goto err;
@@ -540,16 +540,16 @@ ecdsa_sigverify(val_context_t * ctx,
     bn_x = BN_bin2bn(dnskey->public_key, hashlen, NULL);
     bn_y = BN_bin2bn(&dnskey->public_key[hashlen], hashlen, NULL);
     if (1 != EC_KEY_set_public_key_affine_coordinates(eckey, bn_x, bn_y)) {
-        val_log(ctx, LOG_INFO,
+        VAL_LOG(ctx, LOG_INFO,
                 "ecdsa_sigverify(): Error associating ECSA structure with key.");
         *key_status = VAL_AC_INVALID_KEY;
         goto err;
     }
 
 
-    val_log(ctx, LOG_DEBUG, "ecdsa_sigverify(): SHA hash = %s",
+    VAL_LOG(ctx, LOG_DEBUG, "ecdsa_sigverify(): SHA hash = %s",
             get_hex_string(sha_hash, hashlen, buf, buflen));
-    val_log(ctx, LOG_DEBUG,
+    VAL_LOG(ctx, LOG_DEBUG,
             "ecdsa_sigverify(): verifying ECDSA signature...");
 
     /* 
@@ -557,7 +557,7 @@ ecdsa_sigverify(val_context_t * ctx,
      * rrsig->signature, rrsig->signature_len
      */
     if (rrsig->signature_len != 2*hashlen) {
-        val_log(ctx, LOG_INFO,
+        VAL_LOG(ctx, LOG_INFO,
                 "ecdsa_sigverify(): Signature length does not match expected size.");
         *sig_status = VAL_AC_RRSIG_VERIFY_FAILED;
         goto err;
@@ -567,10 +567,10 @@ ecdsa_sigverify(val_context_t * ctx,
                    BN_bin2bn(&rrsig->signature[hashlen], hashlen, NULL));
 
     if (ECDSA_do_verify(sha_hash, hashlen, ecdsa_sig, eckey) == 1) {
-        val_log(ctx, LOG_INFO, "ecdsa_sigverify(): returned SUCCESS");
+        VAL_LOG(ctx, LOG_INFO, "ecdsa_sigverify(): returned SUCCESS");
         *sig_status = VAL_AC_RRSIG_VERIFIED;
     } else {
-        val_log(ctx, LOG_INFO, "ecdsa_sigverify(): returned FAILURE");
+        VAL_LOG(ctx, LOG_INFO, "ecdsa_sigverify(): returned FAILURE");
         *sig_status = VAL_AC_RRSIG_VERIFY_FAILED;
     }
 
@@ -148,7 +148,7 @@ get_dane_from_result(val_context_t *ctx,
         /* 
          * and neither does provably insecure conditions 
          */
-        if (res->val_rc_status == VAL_PINSECURE)
+        if (VAL_BASE_STATUS(res->val_rc_status) == VAL_PINSECURE)
             return VAL_DANE_IGNORE_TLSA;
 
         /* 
@@ -278,10 +278,10 @@ _dane_async_callback(val_async_status *as, int event,
     dstat = (_val_dane_async_status_t *) cb_data;
 
     if (NULL == cbp || NULL == as) {
-        val_log(ctx, LOG_DEBUG, "_dane_async_callback no callback data!");
+        VAL_LOG(ctx, LOG_DEBUG, "_dane_async_callback no callback data!");
         return VAL_NO_ERROR;
     }
-    val_log(ctx, LOG_DEBUG,
+    VAL_LOG(ctx, LOG_DEBUG,
             "_dane_async_callback for %p, %s %s(%d)", 
             as, cbp->name, p_type(cbp->type_h), cbp->type_h);
 
@@ -421,7 +421,7 @@ int val_dane_submit(val_context_t *context,
     /*
      * Begin our internal async lookup for DANE related records
      */
-    val_log(ctx, LOG_DEBUG,
+    VAL_LOG(ctx, LOG_DEBUG,
             "val_dane_submit(): checking for TLSA records");
 
     rc = val_async_submit(ctx, dane_name, ns_c_in, ns_t_tlsa, 0,
@@ -475,7 +475,7 @@ int val_getdaneinfo(val_context_t *context,
     if ((rc = val_resolve_and_check(ctx, dane_name, ns_c_in, ns_t_tlsa,
                                     0, &results))
             != VAL_NO_ERROR) {
-        val_log(ctx, LOG_INFO,
+        VAL_LOG(ctx, LOG_INFO,
                 "val_getdaneinfo(): val_resolve_and_check failed - %s",
                 p_val_err(rc));
         CTX_UNLOCK_POL(ctx);
@@ -490,7 +490,7 @@ int val_getdaneinfo(val_context_t *context,
                                    params,
                                    results, 
                                    dres);
-    val_log(ctx, LOG_DEBUG,
+    VAL_LOG(ctx, LOG_DEBUG,
             "val_getdaneinfo(): returning %s(%d)", 
             p_dane_error(dane_rc), dane_rc);
 
@@ -660,13 +660,13 @@ val_dane_match_internal(val_context_t *context,
     if (ctx == NULL)
         return VAL_DANE_INTERNAL_ERROR;
 
-    val_log(ctx, LOG_DEBUG,
+    VAL_LOG(ctx, LOG_DEBUG,
             "val_dane_match(): checking for DANE cert match - sel:%d type:%d", 
             dane_cur->selector, dane_cur->type);
 
     if ((dane_cur->selector != DANE_SEL_FULLCERT) &&
         (dane_cur->selector != DANE_SEL_PUBKEY)) {
-        val_log(ctx, LOG_NOTICE,
+        VAL_LOG(ctx, LOG_NOTICE,
             "val_dane_match(): Unknown DANE selector:%d",
             dane_cur->selector);
         CTX_UNLOCK_POL(ctx);
@@ -691,12 +691,12 @@ val_dane_match_internal(val_context_t *context,
             if (len == dane_cur->datalen &&
                     !memcmp(data, dane_cur->data, len)) {
 
-                val_log(ctx, LOG_INFO, "val_dane_match(): DANE_SEL_FULLCERT/DANE_MATCH_EXACT success");
+                VAL_LOG(ctx, LOG_INFO, "val_dane_match(): DANE_SEL_FULLCERT/DANE_MATCH_EXACT success");
                 CTX_UNLOCK_POL(ctx);
                 return VAL_DANE_NOERROR;
             }
 
-            val_log(ctx, LOG_NOTICE, "val_dane_match(): DANE_SEL_FULLCERT/DANE_MATCH_EXACT failed");
+            VAL_LOG(ctx, LOG_NOTICE, "val_dane_match(): DANE_SEL_FULLCERT/DANE_MATCH_EXACT failed");
             CTX_UNLOCK_POL(ctx);
             return VAL_DANE_CHECK_FAILED;
 
@@ -712,12 +712,12 @@ val_dane_match_internal(val_context_t *context,
             if (pkeyLen == dane_cur->datalen &&
                 0 == memcmp(pkeybuf, dane_cur->data, pkeyLen)) {
 
-                val_log(ctx, LOG_INFO, "val_dane_match(): DANE_SEL_PUBKEY/DANE_MATCH_EXACT success");
+                VAL_LOG(ctx, LOG_INFO, "val_dane_match(): DANE_SEL_PUBKEY/DANE_MATCH_EXACT success");
                 FREE(pkeybuf);
                 CTX_UNLOCK_POL(ctx);
                 return VAL_DANE_NOERROR;
             }
-            val_log(ctx, LOG_NOTICE, "val_dane_match(): DANE_SEL_PUBKEY/DANE_MATCH_EXACT failed");
+            VAL_LOG(ctx, LOG_NOTICE, "val_dane_match(): DANE_SEL_PUBKEY/DANE_MATCH_EXACT failed");
             FREE(pkeybuf);
             CTX_UNLOCK_POL(ctx);
             return VAL_DANE_CHECK_FAILED;
@@ -766,11 +766,11 @@ val_dane_match_internal(val_context_t *context,
 
         if (dane_cur->datalen == SHA256_DIGEST_LENGTH && 
             0 == memcmp(cert_sha, dane_cur->data, SHA256_DIGEST_LENGTH)) {
-            val_log(ctx, LOG_INFO, "val_dane_match(): DANE_MATCH_SHA256 success");
+            VAL_LOG(ctx, LOG_INFO, "val_dane_match(): DANE_MATCH_SHA256 success");
             CTX_UNLOCK_POL(ctx);
             return VAL_DANE_NOERROR;
         }
-        val_log(ctx, LOG_NOTICE, 
+        VAL_LOG(ctx, LOG_NOTICE, 
                 "val_dane_match(): DANE SHA256 does NOT match (len = %d)", 
                 dane_cur->datalen);
         CTX_UNLOCK_POL(ctx);
@@ -809,17 +809,17 @@ val_dane_match_internal(val_context_t *context,
 
         if (dane_cur->datalen == SHA512_DIGEST_LENGTH &&
             0 == memcmp(cert_sha, dane_cur->data, SHA512_DIGEST_LENGTH)) {
-            val_log(ctx, LOG_INFO, "val_dane_match(): DANE_MATCH_SHA512 success");
+            VAL_LOG(ctx, LOG_INFO, "val_dane_match(): DANE_MATCH_SHA512 success");
             CTX_UNLOCK_POL(ctx);
             return VAL_DANE_NOERROR;
         }
-        val_log(ctx, LOG_NOTICE, "val_dane_match(): DANE_MATCH_SHA512 failed");
+        VAL_LOG(ctx, LOG_NOTICE, "val_dane_match(): DANE_MATCH_SHA512 failed");
         CTX_UNLOCK_POL(ctx);
         return VAL_DANE_CHECK_FAILED;
 
     } 
 
-    val_log(ctx, LOG_NOTICE,
+    VAL_LOG(ctx, LOG_NOTICE,
             "val_dane_match(): Error - Unknown DANE type:%d", dane_cur->type);
     CTX_UNLOCK_POL(ctx);
     return VAL_DANE_CHECK_FAILED;
@@ -913,7 +913,7 @@ val_X509_peer_cert_verify_cb(X509_STORE_CTX *x509ctx, void *arg)
                 err != X509_V_ERR_DEPTH_ZERO_SELF_SIGNED_CERT &&
                 err != X509_V_ERR_SELF_SIGNED_CERT_IN_CHAIN ) {
 
-                val_log(context,
+                VAL_LOG(context,
                         LOG_INFO, "DANE: cert PKIX verification failed = %s", buf);
                 return 0;
             }
@@ -948,7 +948,7 @@ val_X509_peer_cert_verify_cb(X509_STORE_CTX *x509ctx, void *arg)
                  * type 2 till we come up with an alternative approach
                  * for supporting TA assertion.
                  */
-                val_log(context,
+                VAL_LOG(context,
                         LOG_WARNING, "DANE: BADSTATE X509 error depth different from cert length = %s", buf);
                 return 0;
             }
@@ -968,7 +968,7 @@ val_X509_peer_cert_verify_cb(X509_STORE_CTX *x509ctx, void *arg)
      * Do certificate name checks
      */
     if (!do_cert_namechk(context, ssl_dane_data->qname, cert)) {
-        val_log(context,
+        VAL_LOG(context,
                 LOG_WARNING, "DANE: Cert namecheck failed for %s", buf);
         return 0;
     }
@@ -989,7 +989,7 @@ val_X509_peer_cert_verify_cb(X509_STORE_CTX *x509ctx, void *arg)
      * Keep looking for a good TLSA match
      */
     while(dane_cur)  {
-        val_log(context, LOG_INFO, 
+        VAL_LOG(context, LOG_INFO, 
                "Checking DANE {sel=%d, type=%d, usage=%d}",
                dane_cur->selector,
                dane_cur->type,
@@ -999,7 +999,7 @@ val_X509_peer_cert_verify_cb(X509_STORE_CTX *x509ctx, void *arg)
             case DANE_USE_SVC_CONSTRAINT: /*1*/ 
                 /* PKIX checks must pass */
                 if (!pkix_succeeded) {
-                    val_log(context,
+                    VAL_LOG(context,
                             LOG_INFO, "DANE: cert PKIX verification failed = %s", buf);
                    break; 
                 }
@@ -1007,7 +1007,7 @@ val_X509_peer_cert_verify_cb(X509_STORE_CTX *x509ctx, void *arg)
             case DANE_USE_DOMAIN_ISSUED: /*3*/
                 if (val_dane_match_internal(context,
                         dane_cur, cert_data, cert_datalen, cert) == 0) {
-                    val_log(context, LOG_INFO, 
+                    VAL_LOG(context, LOG_INFO, 
                             "DANE: passed EE certificate checks = %s", buf);
                     rv = VAL_DANE_NOERROR;
                     goto done;
@@ -1017,7 +1017,7 @@ val_X509_peer_cert_verify_cb(X509_STORE_CTX *x509ctx, void *arg)
             case DANE_USE_CA_CONSTRAINT: /*0*/ 
                 /* PKIX checks must pass */
                 if (!pkix_succeeded) {
-                    val_log(context,
+                    VAL_LOG(context,
                             LOG_INFO, "DANE: cert PKIX verification failed = %s", buf);
                    break; 
                 }
@@ -1032,7 +1032,7 @@ val_X509_peer_cert_verify_cb(X509_STORE_CTX *x509ctx, void *arg)
                     if (val_dane_match_internal(context,
                             dane_cur, cert_data, cert_datalen, cert) == 0) {
                         /* reset err status */
-                        val_log(context, 
+                        VAL_LOG(context, 
                                 LOG_INFO, "DANE: skipping TA PKIX validation = %s", buf);
                         rv = VAL_DANE_NOERROR;
                         goto done;
@@ -1044,7 +1044,7 @@ val_X509_peer_cert_verify_cb(X509_STORE_CTX *x509ctx, void *arg)
                 break;
         }
 
-        val_log(context, LOG_INFO, 
+        VAL_LOG(context, LOG_INFO, 
                 "DANE: check for usage %d failed", dane_cur->usage);
 
         dane_cur = dane_cur->next;
@@ -1056,12 +1056,12 @@ done:
         OPENSSL_free(cert_data);
 
     if (rv == VAL_DANE_NOERROR) {
-        val_log(context, LOG_NOTICE, "DANE check successful");
+        VAL_LOG(context, LOG_NOTICE, "DANE check successful");
         X509_STORE_CTX_set_error(x509ctx, X509_V_OK);
         return 1;
     }
 
-    val_log(context, LOG_NOTICE, "DANE check failed");
+    VAL_LOG(context, LOG_NOTICE, "DANE check failed");
     return 0;
 }
 
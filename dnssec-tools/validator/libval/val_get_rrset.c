@@ -137,7 +137,7 @@ val_get_answer_from_result(val_context_t *context, const char *name, int class_h
          * was validated (implied), use the lower bounds of trust 
          */
             if (val_does_not_exist(res->val_rc_status)) {
-                if (res->val_rc_status == VAL_NONEXISTENT_NAME)
+                if (VAL_BASE_STATUS(res->val_rc_status) == VAL_NONEXISTENT_NAME)
                    ans->val_ans_status = VAL_NONEXISTENT_NAME_NOCHAIN; 
                 else 
                    ans->val_ans_status = VAL_NONEXISTENT_TYPE_NOCHAIN; 
@@ -147,6 +147,8 @@ val_get_answer_from_result(val_context_t *context, const char *name, int class_h
         } else {
             ans->val_ans_status = VAL_UNTRUSTED_ANSWER;        
         }
+        /* a stale answer stays marked as such whatever status it gets */
+        ans->val_ans_status |= (res->val_rc_status & VAL_FLAG_STALE);
 
         /* 
          * reset the below values so that we are able to handle different 
@@ -191,7 +193,7 @@ val_get_rrset(val_context_t *context,
     if ((retval = val_resolve_and_check(ctx, name, class_h, type_h, 
                                        flags,
                                        &results)) != VAL_NO_ERROR) {
-        val_log(ctx, LOG_INFO,
+        VAL_LOG(ctx, LOG_INFO,
                 "get_addrinfo_from_dns(): val_resolve_and_check failed - %s",
                 p_val_err(retval));
         goto err; 
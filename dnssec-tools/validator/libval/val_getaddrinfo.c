@@ -373,7 +373,7 @@ get_addrinfo_from_etc_hosts(val_context_t * ctx,
     if (res == NULL) 
         return 0;
 
-    val_log(ctx, LOG_DEBUG, "get_addrinfo_from_etc_hosts(): Parsing "
+    VAL_LOG(ctx, LOG_DEBUG, "get_addrinfo_from_etc_hosts(): Parsing "
             ETC_HOSTS);
 
     /*
@@ -461,7 +461,7 @@ get_addrinfo_from_etc_hosts(val_context_t * ctx,
         } 
 #endif
         else {
-            val_log(ctx, LOG_WARNING, 
+            VAL_LOG(ctx, LOG_WARNING, 
                     "get_addrinfo_from_etc_hosts(): Unkown address type");
             val_freeaddrinfo(ainfo);
             continue;
@@ -471,7 +471,7 @@ get_addrinfo_from_etc_hosts(val_context_t * ctx,
          * Expand the results based on servname and hints 
          */
         if ((ret = process_service_and_hints(servname, hints, &ainfo)) != 0) {
-            val_log(ctx, LOG_INFO, 
+            VAL_LOG(ctx, LOG_INFO, 
                     "get_addrinfo_from_etc_hosts(): Failed in process_service_and_hints()");
             goto err;
         }
@@ -486,7 +486,7 @@ get_addrinfo_from_etc_hosts(val_context_t * ctx,
         FREE_HOSTS(h_prev);
     }
 
-    val_log(ctx, LOG_DEBUG, "get_addrinfo_from_etc_hosts(): Parsing "
+    VAL_LOG(ctx, LOG_DEBUG, "get_addrinfo_from_etc_hosts(): Parsing "
             ETC_HOSTS " OK");
 
     *res = retval;
@@ -607,7 +607,7 @@ get_addrinfo_from_result(const val_context_t * ctx,
                         val_freeaddrinfo(ainfo);
                         return EAI_MEMORY;
                     }
-                    val_log(ctx, LOG_DEBUG, "get_addrinfo_from_result(): rrset of type A found");
+                    VAL_LOG(ctx, LOG_DEBUG, "get_addrinfo_from_result(): rrset of type A found");
                     memset(saddr4, 0, sizeof(struct sockaddr_in));
                     saddr4->sin_family = AF_INET;
                     ainfo->ai_family = AF_INET;
@@ -627,7 +627,7 @@ get_addrinfo_from_result(const val_context_t * ctx,
                         val_freeaddrinfo(ainfo);
                         return EAI_MEMORY;
                     }
-                    val_log(ctx, LOG_DEBUG, "get_addrinfo_from_result(): rrset of type AAAA found");
+                    VAL_LOG(ctx, LOG_DEBUG, "get_addrinfo_from_result(): rrset of type AAAA found");
                     memset(saddr6, 0, sizeof(struct sockaddr_in6));
                     saddr6->sin6_family = AF_INET6;
                     ainfo->ai_family = AF_INET6;
@@ -656,7 +656,7 @@ get_addrinfo_from_result(const val_context_t * ctx,
                 if ((retval = process_service_and_hints(servname, hints, &ainfo))
                     != 0) {
                     val_freeaddrinfo(ainfo);
-                    val_log(ctx, LOG_INFO, 
+                    VAL_LOG(ctx, LOG_INFO, 
                         "get_addrinfo_from_result(): Failed in process_service_and_hints()");
                     return retval;
                 }
@@ -737,7 +737,7 @@ get_addrinfo_from_dns(val_context_t * ctx,
     struct addrinfo default_hints;
     int    ret = EAI_FAIL, have4 = 1, have6 = 1;
 
-    val_log(ctx, LOG_DEBUG, "get_addrinfo_from_dns() called");
+    VAL_LOG(ctx, LOG_DEBUG, "get_addrinfo_from_dns() called");
 
     *val_status = VAL_VALIDATED_ANSWER;
 
@@ -779,7 +779,7 @@ get_addrinfo_from_dns(val_context_t * ctx,
         && (have4 != 0)
 #endif
         ) {
-        val_log(ctx, LOG_DEBUG,
+        VAL_LOG(ctx, LOG_DEBUG,
                 "get_addrinfo_from_dns(): checking for A records");
 
         if ((VAL_NO_ERROR == 
@@ -789,7 +789,7 @@ get_addrinfo_from_dns(val_context_t * ctx,
             ret = get_addrinfo_from_result(ctx, results, servname,
                                          hints, &ainfo, val_status);
 
-            val_log(ctx, LOG_DEBUG, "get_addrinfo_from_dns(): "
+            VAL_LOG(ctx, LOG_DEBUG, "get_addrinfo_from_dns(): "
                     "get_addrinfo_from_result() returned=%d with val_status=%d",
                     ret, *val_status);
 
@@ -808,7 +808,7 @@ get_addrinfo_from_dns(val_context_t * ctx,
 #endif
         ) {
 
-        val_log(ctx, LOG_DEBUG,
+        VAL_LOG(ctx, LOG_DEBUG,
                 "get_addrinfo_from_dns(): checking for AAAA records");
         
         if ((VAL_NO_ERROR == 
@@ -817,7 +817,7 @@ get_addrinfo_from_dns(val_context_t * ctx,
             ret = get_addrinfo_from_result(ctx, results, servname,
                                          hints, &ainfo, val_status);
 
-            val_log(ctx, LOG_DEBUG, "get_addrinfo_from_dns(): "
+            VAL_LOG(ctx, LOG_DEBUG, "get_addrinfo_from_dns(): "
                     "get_addrinfo_from_result() returned=%d with val_status=%d",
                     ret, *val_status);
 
@@ -867,7 +867,7 @@ _getaddrinfo_local(val_context_t * ctx, const char *nodename,
     val_status_t local_ans_status = VAL_OOB_ANSWER;
     int trusted = 0;
     
-    val_log(ctx, LOG_DEBUG,
+    VAL_LOG(ctx, LOG_DEBUG,
             "val_getaddrinfo called with nodename = %s, servname = %s",
             nodename == NULL ? "(null)" : nodename,
             servname == NULL ? "(null)" : servname);
@@ -953,7 +953,7 @@ _getaddrinfo_local(val_context_t * ctx, const char *nodename,
         if ((retval = process_service_and_hints(servname, cur_hints, &ainfo4))
             != 0) {
             val_freeaddrinfo(ainfo4);
-            val_log(ctx, LOG_INFO, 
+            VAL_LOG(ctx, LOG_INFO, 
                     "val_getaddrinfo(): Failed in process_service_and_hints()");
             goto done;
         }
@@ -1007,7 +1007,7 @@ _getaddrinfo_local(val_context_t * ctx, const char *nodename,
         if ((retval = process_service_and_hints(servname, cur_hints, &ainfo6))
             != 0) {
             val_freeaddrinfo(ainfo6);
-            val_log(ctx, LOG_INFO, 
+            VAL_LOG(ctx, LOG_INFO, 
                     "val_getaddrinfo(): Failed in process_service_and_hints()");
             goto done;
         }
@@ -1166,7 +1166,7 @@ address_to_reverse_domain(const u_char *saddr, int family,
                  (*(saddr + 1) & 0x0F), (*(saddr + 1) >> 4),
                  (*(saddr) & 0x0F), (*(saddr) >> 4));
     } else {
-        val_log((val_context_t *) NULL, LOG_INFO,
+        VAL_LOG((val_context_t *) NULL, LOG_INFO,
                 "address_to_reverse_domain(): Error - unsupported family : \'%d\'",
                 family);
         return (EAI_FAMILY);
@@ -1176,7 +1176,7 @@ address_to_reverse_domain(const u_char *saddr, int family,
      * ns_name_pton(dadd, wadd, wlen); 
      */
 
-    val_log((val_context_t *) NULL, LOG_DEBUG,
+    VAL_LOG((val_context_t *) NULL, LOG_DEBUG,
             "address_to_reverse_domain(): reverse domain address \'%s\'",
             dadd);
 
@@ -1235,13 +1235,13 @@ address_to_string(const u_char *saddr, int family, char *nadd, int nlen)
             memmove(&nadd[1],&nadd[shorten-1], strlen(nadd)-shorten+2);
         }
     } else {
-        val_log((val_context_t *) NULL, LOG_INFO,
+        VAL_LOG((val_context_t *) NULL, LOG_INFO,
                 "address_to_string(): Error - unsupported family : \'%d\'",
                 family);
         return (EAI_FAMILY);
     }
 
-    val_log((val_context_t *) NULL, LOG_DEBUG,
+    VAL_LOG((val_context_t *) NULL, LOG_DEBUG,
             "address_to_string(): numeric address \'%s\'", nadd);
 
     return (0);
@@ -1271,7 +1271,7 @@ val_getnameinfo(val_context_t * context,
     if (ctx == NULL)
         return EAI_FAIL;;
 
-    val_log(ctx, LOG_DEBUG, "val_getnameinfo(): called");
+    VAL_LOG(ctx, LOG_DEBUG, "val_getnameinfo(): called");
 
     /*
      * check misc parameters, there should be at least one of host or
@@ -1304,12 +1304,12 @@ val_getnameinfo(val_context_t * context,
         } 
 #endif
         else {
-            val_log(ctx, LOG_DEBUG, "val_getnameinfo(): Address family %d not known.", sa->sa_family);
+            VAL_LOG(ctx, LOG_DEBUG, "val_getnameinfo(): Address family %d not known.", sa->sa_family);
             retval = EAI_FAMILY;
             goto done;
         }
 
-        val_log(ctx, LOG_DEBUG, 
+        VAL_LOG(ctx, LOG_DEBUG, 
             "val_getnameinfo(): get service for port(%d)",ntohs(port));
         if (flags & NI_DGRAM)
             sent = getservbyport(port, "udp");
@@ -1318,12 +1318,12 @@ val_getnameinfo(val_context_t * context,
 
         if (sent) {
             if (flags & NI_NUMERICSERV) {
-                val_log(ctx, LOG_DEBUG, "val_getnameinfo(): NI_NUMERICSERV");
+                VAL_LOG(ctx, LOG_DEBUG, "val_getnameinfo(): NI_NUMERICSERV");
                 snprintf(serv, servlen, "%d", ntohs(sent->s_port));
             } else {
                 strncpy(serv, sent->s_name, servlen);
             }
-            val_log(ctx, LOG_DEBUG, "val_getnameinfo(): service is %s : %s ",
+            VAL_LOG(ctx, LOG_DEBUG, "val_getnameinfo(): service is %s : %s ",
                 serv, sent->s_proto);
         } else {
             strncpy(serv, "", servlen);
@@ -1358,7 +1358,7 @@ val_getnameinfo(val_context_t * context,
         if (!(flags & NI_NUMERICHOST) &&
             (0 == memcmp(&((const struct sockaddr_in6 *) sa)->sin6_addr,
                          _ipv6_wrapped_ipv4, sizeof(_ipv6_wrapped_ipv4)))) {
-            val_log(ctx, LOG_DEBUG, "val_getnameinfo(): ipv4 wrapped addr");
+            VAL_LOG(ctx, LOG_DEBUG, "val_getnameinfo(): ipv4 wrapped addr");
             theAddress += sizeof(_ipv6_wrapped_ipv4);
             theAddressFamily = AF_INET;
         }
@@ -1368,7 +1368,7 @@ val_getnameinfo(val_context_t * context,
     } 
 #endif
     else {
-        val_log(ctx, LOG_DEBUG, "val_getnameinfo(): Address family %d not known or length %d too small.", sa->sa_family, salen);
+        VAL_LOG(ctx, LOG_DEBUG, "val_getnameinfo(): Address family %d not known or length %d too small.", sa->sa_family, salen);
         retval = EAI_FAMILY;
         goto done;
     }
@@ -1396,16 +1396,16 @@ val_getnameinfo(val_context_t * context,
      */
     strncpy(host, number_string, hostlen);
 
-    val_log(ctx, LOG_DEBUG, "val_getnameinfo(): pre-val flags(%d)", flags);
+    VAL_LOG(ctx, LOG_DEBUG, "val_getnameinfo(): pre-val flags(%d)", flags);
 
     if ((flags & NI_NUMERICHOST) && !(flags & NI_NAMEREQD)) {
         *val_status = VAL_TRUSTED_ANSWER;
-        val_log(ctx, LOG_DEBUG, "val_getnameinfo(): returning host (%s)", host);
+        VAL_LOG(ctx, LOG_DEBUG, "val_getnameinfo(): returning host (%s)", host);
         retval = 0;
         goto done;
     }
 
-    val_log(ctx, LOG_DEBUG, "val_getnameinfo(): val_get_rrset host flags(%d)", flags);
+    VAL_LOG(ctx, LOG_DEBUG, "val_getnameinfo(): val_get_rrset host flags(%d)", flags);
     if (VAL_NO_ERROR != 
               (retval = val_get_rrset(ctx,       /*val_context_t*  */
                                       domain_string, /*u_char *wire_domain_name */
@@ -1413,7 +1413,7 @@ val_getnameinfo(val_context_t * context,
                                       ns_t_ptr,  /*const u_int16_t type */
                                       0, /*const u_int32_t flags */
                                       &val_res))) { /* struct val_answer_chain **results */
-        val_log(ctx, LOG_ERR, 
+        VAL_LOG(ctx, LOG_ERR, 
                 "val_getnameinfo(): val_get_rrset failed - %s", 
                 p_val_err(retval));
         *val_status = VAL_UNTRUSTED_ANSWER;
@@ -1422,7 +1422,7 @@ val_getnameinfo(val_context_t * context,
     }
 
     if (!val_res) {
-        val_log(ctx, LOG_ERR, "val_getnameinfo(): EAI_MEMORY");
+        VAL_LOG(ctx, LOG_ERR, "val_getnameinfo(): EAI_MEMORY");
         *val_status = VAL_UNTRUSTED_ANSWER;
         retval = EAI_MEMORY;
         goto done;
@@ -1447,8 +1447,10 @@ val_getnameinfo(val_context_t * context,
                 *val_status = VAL_UNTRUSTED_ANSWER;
             break;
         } else if (val_does_not_exist(res->val_ans_status)) {
-            if ((res->val_ans_status == VAL_NONEXISTENT_TYPE) ||
-                    (res->val_ans_status == VAL_NONEXISTENT_TYPE_NOCHAIN)) {
+            if ((VAL_BASE_STATUS(res->val_ans_status) ==
+                        VAL_NONEXISTENT_TYPE) ||
+                    (VAL_BASE_STATUS(res->val_ans_status) ==
+                        VAL_NONEXISTENT_TYPE_NOCHAIN)) {
                 retval = EAI_NODATA;
             } else { 
                 retval = EAI_NONAME;
@@ -1458,7 +1460,7 @@ val_getnameinfo(val_context_t * context,
     }
     val_free_answer_chain(val_res);
 
-    val_log(ctx, LOG_DEBUG,
+    VAL_LOG(ctx, LOG_DEBUG,
           "val_getnameinfo(): val_get_rrset for host %s, returned %s with lookup status %d and validator status %d : %s",
           domain_string, host,
           retval, 
@@ -1580,12 +1582,12 @@ _vgai_async_callback(val_async_status *as, int event,
 
     vgai = (val_gai_status *)cb_data;
     if (NULL == vgai) {
-        val_log(ctx, LOG_DEBUG, "val_getaddrinfo no callback data!");
+        VAL_LOG(ctx, LOG_DEBUG, "val_getaddrinfo no callback data!");
         return VAL_NO_ERROR;
     }
     gai_rc = EAI_FAIL;
 
-    val_log(ctx, LOG_DEBUG,
+    VAL_LOG(ctx, LOG_DEBUG,
             "val_getaddrinfo async callback for %p, %s %s(%d)", as,
             vgai->nodename, p_type(cbp->type_h), cbp->type_h);
 
@@ -1600,7 +1602,7 @@ _vgai_async_callback(val_async_status *as, int event,
                                     cbp->type_h, &cbp->results, &cbp->answers,
                                     0);
     if (VAL_NO_ERROR != rc) {
-        val_log(ctx, LOG_DEBUG,
+        VAL_LOG(ctx, LOG_DEBUG,
                 "val_gai_callback: val_get_answer_from_result() returned=%d", rc);
     }
     else {
@@ -1610,7 +1612,7 @@ _vgai_async_callback(val_async_status *as, int event,
         gai_rc = get_addrinfo_from_result(ctx, cbp->answers, vgai->servname,
                                           vgai->hints, &vgai->res,
                                           &vgai->val_status);
-        val_log(ctx, LOG_DEBUG,
+        VAL_LOG(ctx, LOG_DEBUG,
                 "val_gai_callback get_addrinfo_from_result() returned=%d with val_status=%d",
                 gai_rc, vgai->val_status);
     }
@@ -1648,7 +1650,7 @@ _vgai_async_callback(val_async_status *as, int event,
         return VAL_NO_ERROR;
 
     if (NULL == vgai->callback) {
-        val_log(ctx, LOG_DEBUG, "val_getaddrinfo async NULL callback!");
+        VAL_LOG(ctx, LOG_DEBUG, "val_getaddrinfo async NULL callback!");
     } else {
         if (VAL_AS_EVENT_CANCELED == event)
             gai_rc = VAL_AS_EVENT_CANCELED;
@@ -1767,7 +1769,7 @@ val_getaddrinfo_submit(val_context_t * context, const char *nodename,
 #endif
         ) {
 
-        val_log(ctx, LOG_DEBUG,
+        VAL_LOG(ctx, LOG_DEBUG,
                 "val_getaddrinfo_submit(): checking for A records");
 
         rc = val_async_submit(ctx, nodename, ns_c_in, ns_t_a, 0,
@@ -1789,7 +1791,7 @@ val_getaddrinfo_submit(val_context_t * context, const char *nodename,
 #endif
         ) {
 
-        val_log(ctx, LOG_DEBUG,
+        VAL_LOG(ctx, LOG_DEBUG,
                 "val_getaddrinfo_submit(): checking for AAAA records");
 
         rc = val_async_submit(ctx, nodename, ns_c_in, ns_t_aaaa, 0,
@@ -138,8 +138,8 @@ get_hostent_from_etc_hosts(val_context_t * ctx,
         if ((af == AF_INET)
             && (INET_PTON(AF_INET, hs->address, ((struct sockaddr *)&sa), &addrlen4) > 0)) {
             INET_NTOP(AF_INET, (&sa), sizeof(sa), addr_buf, buflen, addr);
-            val_log(ctx, LOG_DEBUG, "get_hostent_from_etc_hosts(): type of address is IPv4");
-            val_log(ctx, LOG_DEBUG, "get_hostent_from_etc_hosts(): Address is: %s",
+            VAL_LOG(ctx, LOG_DEBUG, "get_hostent_from_etc_hosts(): type of address is IPv4");
+            VAL_LOG(ctx, LOG_DEBUG, "get_hostent_from_etc_hosts(): Address is: %s",
                     addr
 		);
         } 
@@ -148,8 +148,8 @@ get_hostent_from_etc_hosts(val_context_t * ctx,
                    && (INET_PTON(AF_INET6, hs->address, ((struct sockaddr *)&sa6), &addrlen6) > 0)) {
 	    
             INET_NTOP(AF_INET6, (&sa6), sizeof(sa6), addr_buf, buflen, addr);
-            val_log(ctx, LOG_DEBUG, "get_hostent_from_etc_hosts(): type of address is IPv6");
-            val_log(ctx, LOG_DEBUG, "get_hostent_from_etc_hosts(): Address is: %s",
+            VAL_LOG(ctx, LOG_DEBUG, "get_hostent_from_etc_hosts(): type of address is IPv6");
+            VAL_LOG(ctx, LOG_DEBUG, "get_hostent_from_etc_hosts(): Address is: %s",
                     addr
                   );
         } 
@@ -158,7 +158,7 @@ get_hostent_from_etc_hosts(val_context_t * ctx,
             /*
              * not a valid address ... skip this line 
              */
-            val_log(ctx, LOG_WARNING,
+            VAL_LOG(ctx, LOG_WARNING,
                     "get_hostent_from_etc_hosts(): error in address format: %s",
                     hs->address);
             h_prev = hs;
@@ -337,7 +337,7 @@ get_hostent_from_response(val_context_t * ctx, int af, struct hostent *ret,
         rrset = res->val_rc_rrset;
 
         if (res->val_rc_alias && rrset) {
-            val_log(ctx, LOG_DEBUG,
+            VAL_LOG(ctx, LOG_DEBUG,
                     "get_hostent_from_response(): type of record = CNAME");
             alias_count++;
             continue;
@@ -351,12 +351,12 @@ get_hostent_from_response(val_context_t * ctx, int af, struct hostent *ret,
 
                 if ((af == AF_INET)
                            && (rrset->val_rrset_type == ns_t_a)) {
-                    val_log(ctx, LOG_DEBUG,
+                    VAL_LOG(ctx, LOG_DEBUG,
                             "get_hostent_from_response(): type of record = A");
                     addr_count++;
                 } else if ((af == AF_INET6)
                            && (rrset->val_rrset_type == ns_t_aaaa)) {
-                    val_log(ctx, LOG_DEBUG,
+                    VAL_LOG(ctx, LOG_DEBUG,
                             "get_hostent_from_response(): type of record = AAAA");
                     addr_count++;
                 }
@@ -405,8 +405,9 @@ get_hostent_from_response(val_context_t * ctx, int af, struct hostent *ret,
         /* save the non-existence state */
         if (val_does_not_exist(res->val_rc_status)) {
             *val_status = res->val_rc_status;
-            if (res->val_rc_status == VAL_NONEXISTENT_NAME ||
-                res->val_rc_status == VAL_NONEXISTENT_NAME_NOCHAIN) {
+            if (VAL_BASE_STATUS(res->val_rc_status) == VAL_NONEXISTENT_NAME ||
+                VAL_BASE_STATUS(res->val_rc_status) ==
+                    VAL_NONEXISTENT_NAME_NOCHAIN) {
 
                 *h_errnop = HOST_NOT_FOUND;
             } else { 
@@ -713,7 +714,7 @@ val_gethostbyname2_r(val_context_t * context,
                                           h_errnop, buf, buflen, &offset, val_status);
 
         } else {
-            val_log(ctx, LOG_ERR, 
+            VAL_LOG(ctx, LOG_ERR, 
                     "val_gethostbyname2_r(): val_resolve_and_check failed - %s", p_val_err(retval));
         }
 
@@ -726,7 +727,7 @@ val_gethostbyname2_r(val_context_t * context,
         }
 
     }
-    val_log(ctx, LOG_DEBUG, "val_gethostbyname2_r returned success, herrno = %d, val_status = %s", 
+    VAL_LOG(ctx, LOG_DEBUG, "val_gethostbyname2_r returned success, herrno = %d, val_status = %s", 
                 *h_errnop, val_status? p_val_status(*val_status) : NULL); 
     CTX_UNLOCK_POL(ctx);
     return 0;
@@ -739,7 +740,7 @@ err:
         *h_errnop = NO_RECOVERY;
 
     if (ctx) {
-        val_log(ctx, LOG_DEBUG, "val_gethostbyname2_r returned failure, herrno = %d, val_status = %s", 
+        VAL_LOG(ctx, LOG_DEBUG, "val_gethostbyname2_r returned failure, herrno = %d, val_status = %s", 
                 *h_errnop, val_status? p_val_status(*val_status) : NULL); 
         CTX_UNLOCK_POL(ctx);
     }
@@ -958,7 +959,7 @@ val_gethostbyaddr_r(val_context_t * context,
                                                 ns_t_ptr,  /* const u_int16_t type */
                                                 0,
                                                 &val_res))) { /* struct val_answer_chain **results */
-        val_log(ctx, LOG_ERR, 
+        VAL_LOG(ctx, LOG_ERR, 
                 "val_gethostbyaddr_r(): val_get_rrset failed - %s", p_val_err(retval));
         CTX_UNLOCK_POL(ctx);
         *h_errnop = NO_RECOVERY;
@@ -1050,11 +1051,15 @@ val_gethostbyaddr_r(val_context_t * context,
 
         } else if  (val_does_not_exist(res->val_ans_status)) {
                     
-            if ((res->val_ans_status == VAL_NONEXISTENT_TYPE) ||
-                (res->val_ans_status == VAL_NONEXISTENT_TYPE_NOCHAIN)) {
+            if ((VAL_BASE_STATUS(res->val_ans_status) ==
+                    VAL_NONEXISTENT_TYPE) ||
+                (VAL_BASE_STATUS(res->val_ans_status) ==
+                    VAL_NONEXISTENT_TYPE_NOCHAIN)) {
                     *h_errnop = NO_DATA;
-            } else if ((res->val_ans_status == VAL_NONEXISTENT_NAME) ||
-                       (res->val_ans_status == VAL_NONEXISTENT_NAME_NOCHAIN)) {
+            } else if ((VAL_BASE_STATUS(res->val_ans_status) ==
+                            VAL_NONEXISTENT_NAME) ||
+                       (VAL_BASE_STATUS(res->val_ans_status) ==
+                            VAL_NONEXISTENT_NAME_NOCHAIN)) {
                     *h_errnop = HOST_NOT_FOUND;
             }
 
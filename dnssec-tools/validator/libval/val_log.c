@@ -16,6 +16,7 @@
 
 static int      debug_level = LOG_INFO;
 static val_log_t *default_log_head = NULL;
+int             val_log_max_level = -1;
 
 int
 val_log_debug_level(void)
@@ -94,10 +95,10 @@ val_log_val_rrset_pfx(const val_context_t * ctx, int level,
 {
     char            buf1[2049], buf2[2049];
 
-    if (!val_rrset_rec)
+    if (!val_rrset_rec || !VAL_LOG_ENABLED(level))
         return;
 
-    val_log(ctx, level, "%srrs->val_rrset_name=%s rrs->val_rrset_type=%s "
+    VAL_LOG(ctx, level, "%srrs->val_rrset_name=%s rrs->val_rrset_type=%s "
             "rrs->val_rrset_class=%s rrs->val_rrset_ttl=%d "
             "rrs->val_rrset_section=%s\nrrs->val_rrset_data=%s\n"
             "rrs->val_rrset_sig=%s", pfx ? pfx : "", 
@@ -156,7 +157,7 @@ val_log_rrsig_rdata(const val_context_t * ctx, int level,
     char            buf[1028];
     struct timeval  tv_sig1, tv_sig2;
 
-    if (rdata) {
+    if (rdata && VAL_LOG_ENABLED(level)) {
         if (!prefix)
             prefix = "";
 
@@ -168,7 +169,7 @@ val_log_rrsig_rdata(const val_context_t * ctx, int level,
         GET_TIME_BUF((const time_t *)(&tv_sig1.tv_sec), ctime_buf1);
         GET_TIME_BUF((const time_t *)(&tv_sig2.tv_sec), ctime_buf2);
 
-        val_log(ctx, level, "%s Type=%d Algo=%d[%s] Labels=%d OrgTTL=%d "
+        VAL_LOG(ctx, level, "%s Type=%d Algo=%d[%s] Labels=%d OrgTTL=%d "
                 "SigExp=%s SigIncp=%s KeyTag=%d[0x %04x] Signer=%s Sig=%s",
                 prefix, rdata->algorithm,
                 get_algorithm_string(rdata->algorithm), rdata->labels,
@@ -185,10 +186,10 @@ val_log_dnskey_rdata(val_context_t * ctx, int level, const char *prefix,
                      val_dnskey_rdata_t * rdata)
 {
     char            buf[1028];
-    if (rdata) {
+    if (rdata && VAL_LOG_ENABLED(level)) {
         if (!prefix)
             prefix = "";
-        val_log(ctx, level,
+        VAL_LOG(ctx, level,
                 "%s Flags=%d Prot=%d Algo=%d[%s] KeyTag=%d[0x %04x] PK=%s",
                 prefix, rdata->flags, rdata->protocol, rdata->algorithm,
                 get_algorithm_string(rdata->algorithm), rdata->key_tag,
@@ -251,7 +252,7 @@ val_log_assertion_pfx(const val_context_t * ctx, int level,
 #endif
 
 
-    if (next_as == NULL)
+    if (next_as == NULL || !VAL_LOG_ENABLED(level))
         return;
 
     class_h = next_as->val_ac_rrset->val_rrset_class;
@@ -284,7 +285,7 @@ val_log_assertion_pfx(const val_context_t * ctx, int level,
                 val_dnskey_rdata_t dnskey;
                 if (VAL_NO_ERROR != val_parse_dnskey_rdata(curkey->rr_rdata,
                                        curkey->rr_rdata_length, &dnskey)) {
-                    val_log(ctx, LOG_INFO, "val_log_assertion_pfx(): Cannot parse DNSKEY data");
+                    VAL_LOG(ctx, LOG_INFO, "val_log_assertion_pfx(): Cannot parse DNSKEY data");
                 } else {
                     tag = dnskey.key_tag;
                     if (dnskey.public_key)
@@ -296,12 +297,12 @@ val_log_assertion_pfx(const val_context_t * ctx, int level,
     }
 
     if (tag != 0) {
-        val_log(ctx, level,
+        VAL_LOG(ctx, level,
                 "%sname=%s class=%s type=%s[tag=%d] from-server=%s "
                 "status=%s:%d", prefix, name_pr, p_class(class_h),
                 p_type(type_h), tag, serv_pr, p_ac_status(status), status);
     } else {
-        val_log(ctx, level,
+        VAL_LOG(ctx, level,
                 "%sname=%s class=%s type=%s from-server=%s status=%s:%d",
                 prefix, name_pr, p_class(class_h), p_type(type_h), serv_pr,
                 p_ac_status(status), status);
@@ -323,7 +324,7 @@ val_log_assertion_pfx(const val_context_t * ctx, int level,
         tv_sig.tv_sec = rrsig.sig_expr;
         GET_TIME_BUF((const time_t *)(&tv_sig.tv_sec), exprTime);
 
-        val_log(ctx, level,
+        VAL_LOG(ctx, level,
                 "%s    ->tag=%d status=%s sig-incep=%s sig-expr=%s",
                 prefix, rrsig.key_tag,
                 p_ac_status(cursig->rr_status),
@@ -335,11 +336,11 @@ val_log_assertion_pfx(const val_context_t * ctx, int level,
     struct val_rr_rec  *rr;
     struct val_rr_rec  *sig = next_as->val_ac_rrset->val_rrset_sig;
     for (rr = data; rr; rr = rr->rr_next) {
-        val_log(ctx, level, "    data_status=%s:%d",
+        VAL_LOG(ctx, level, "    data_status=%s:%d",
                 p_ac_status(rr->rr_status), rr->rr_status);
     }
     for (rr = sig; rr; rr = rr->rr_next) {
-        val_log(ctx, level, "    sig_status=%s:%d",
+        VAL_LOG(ctx, level, "    sig_status=%s:%d",
                 p_ac_status(rr->rr_status), rr->rr_status);
     }
 #endif
@@ -363,7 +364,7 @@ val_log_authentication_chain(const val_context_t * ctx, int level,
     int real_type_h;
     int real_class_h;
 
-    if (results == NULL) { 
+    if (results == NULL || !VAL_LOG_ENABLED(level)) { 
         return;
     } 
     
@@ -382,19 +383,19 @@ val_log_authentication_chain(const val_context_t * ctx, int level,
         }
 
         if (val_isvalidated(next_result->val_rc_status)) {
-            val_log(ctx, level, "Validation result for {%s, %s(%d), %s(%d)}: %s:%d (Validated)",
+            VAL_LOG(ctx, level, "Validation result for {%s, %s(%d), %s(%d)}: %s:%d (Validated)",
                     name_p, p_class(real_class_h), real_class_h,
                     p_type(real_type_h), real_type_h,
                     p_val_status(next_result->val_rc_status),
                     next_result->val_rc_status);
         } else if (val_istrusted(next_result->val_rc_status)) {
-            val_log(ctx, level, "Validation result for {%s, %s(%d), %s(%d)}: %s:%d (Trusted but not Validated)",
+            VAL_LOG(ctx, level, "Validation result for {%s, %s(%d), %s(%d)}: %s:%d (Trusted but not Validated)",
                     name_p, p_class(real_class_h), real_class_h,
                     p_type(real_type_h), real_type_h,
                     p_val_status(next_result->val_rc_status),
                     next_result->val_rc_status);
         } else {
-            val_log(ctx, level, "Validation result for {%s, %s(%d), %s(%d)}: %s:%d (Untrusted)",
+            VAL_LOG(ctx, level, "Validation result for {%s, %s(%d), %s(%d)}: %s:%d (Untrusted)",
                     name_p, p_class(real_class_h), real_class_h,
                     p_type(real_type_h), real_type_h,
                     p_val_status(next_result->val_rc_status),
@@ -405,7 +406,7 @@ val_log_authentication_chain(const val_context_t * ctx, int level,
              next_as = next_as->val_ac_trust) {
 
             if (next_as->val_ac_rrset == NULL) {
-                val_log(ctx, level, "    Assertion status = %s:%d",
+                VAL_LOG(ctx, level, "    Assertion status = %s:%d",
                         p_ac_status(next_as->val_ac_status),
                         next_as->val_ac_status);
             } else {
@@ -422,12 +423,12 @@ val_log_authentication_chain(const val_context_t * ctx, int level,
         }
 
         for (i = 0; i < next_result->val_rc_proof_count; i++) {
-            val_log(ctx, level, "    Proof of non-existence [%d of %d]", 
+            VAL_LOG(ctx, level, "    Proof of non-existence [%d of %d]", 
                     i+1, next_result->val_rc_proof_count);
             for (next_as = next_result->val_rc_proofs[i]; next_as;
                  next_as = next_as->val_ac_trust) {
                 if (next_as->val_ac_rrset == NULL) {
-                    val_log(ctx, level, "      Assertion status = %s:%d",
+                    VAL_LOG(ctx, level, "      Assertion status = %s:%d",
                             p_ac_status(next_as->val_ac_status),
                             next_as->val_ac_status);
                 } else {
@@ -594,7 +595,7 @@ p_ac_status(val_astatus_t err)
 const char     *
 p_val_status(val_status_t err)
 {
-    switch (err) {
+    switch (err & ~VAL_FLAG_STALE) {
 
     case VAL_BOGUS:
         return "VAL_BOGUS";
@@ -721,6 +722,9 @@ val_log_insert(val_log_t **log_head, val_log_t * logp)
     if (log_head == NULL)
         log_head = &default_log_head;
 
+    if (logp->level > val_log_max_level)
+        val_log_max_level = logp->level;
+
     for (tmp_log = *log_head; tmp_log && tmp_log->next;
          tmp_log = tmp_log->next);
 
@@ -944,6 +948,475 @@ val_log_add_syslog(val_log_t **log_head, int level, int facility)
 }
 #endif
 
+#if !defined(VAL_NO_THREADS) && defined(__ATOMIC_ACQUIRE)
+#define VAL_LOG_HAVE_ASYNC 1
+#endif
+
+#ifdef VAL_LOG_HAVE_ASYNC
+
+/*
+ * Asynchronous log targets.  Callers format their message into a slot
+ * of a bounded ring and return; a single writer thread shared by all
+ * rings passes the messages on to the real target.  Slots are claimed
+ * without locks: each carries a sequence number that tells producers
+ * and the writer whose turn it is (see Vyukov's bounded MPMC queue).
+ */
+struct val_log_slot {
+    u_int32_t       ls_seq;
+    int             ls_level;
+    /** Needs to be at least two characters larger than message size */
+    char            ls_buf[1028];
+};
+
+struct val_log_ring {
+    char           *lr_spec;        /* target string, for reuse */
+    val_log_t      *lr_target;      /* where the writer sends messages */
+    int             lr_block;       /* wait for room instead of dropping */
+    u_int32_t       lr_mask;
+    u_int32_t       lr_tail;        /* next slot to claim */
+    u_int32_t       lr_head;        /* next slot to write, writer only */
+    u_int32_t       lr_dropped;
+    u_int32_t       lr_reported;    /* drops already written out */
+    struct val_log_slot *lr_slots;
+    struct val_log_ring *lr_next;
+};
+
+static pthread_mutex_t async_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t async_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t async_room_cond = PTHREAD_COND_INITIALIZER;
+/* serializes the writer thread and the flush at exit */
+static pthread_mutex_t async_write_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* serializes looking up and creating rings */
+static pthread_mutex_t async_create_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct val_log_ring *async_rings = NULL;
+static int async_sleeping = 0;
+static int async_waiters = 0;
+static int async_thread_started = 0;
+static int async_atfork_set = 0;
+
+static int
+_async_ready(struct val_log_ring *ring)
+{
+    return __atomic_load_n(&ring->lr_slots[ring->lr_head &
+                                           ring->lr_mask].ls_seq,
+                           __ATOMIC_SEQ_CST) == ring->lr_head + 1;
+}
+
+static int
+_async_pending(void)
+{
+    struct val_log_ring *ring;
+
+    for (ring = async_rings; ring; ring = ring->lr_next)
+        if (_async_ready(ring))
+            return 1;
+    return 0;
+}
+
+static void
+_async_forward(val_log_t *target, int level, const char *format, ...)
+{
+    va_list         ap;
+
+    va_start(ap, format);
+    (*target->logf) (target, NULL, level, format, ap);
+    va_end(ap);
+}
+
+/*
+ * Hand one message, already timestamped, to the real target.  Files
+ * are flushed by the caller once per batch.
+ */
+static void
+_async_write(val_log_t *target, int level, char *buf)
+{
+    if (target->logf == val_log_filep) {
+        if (NULL == target->opt.file.fp) {
+            target->opt.file.fp = fopen(target->opt.file.name, "a");
+            if (NULL == target->opt.file.fp)
+                return;
+        }
+        fprintf(target->opt.file.fp, "%s\n", buf);
+    } else if (target->logf == val_log_udp) {
+        strcat(buf, "\n");
+        sendto(target->opt.udp.sock, buf, strlen(buf), 0,
+               (struct sockaddr *) &target->opt.udp.server,
+               sizeof(struct sockaddr_in));
+    } else if (target->logf == val_log_callback) {
+        (*(target->opt.cb.func)) (target, level, buf);
+    } else {
+        /* syslog adds its own timestamp */
+        _async_forward(target, level, "%s", &buf[19]);
+    }
+}
+
+/*
+ * Write out everything queued in one ring.  Called with
+ * async_write_mutex held.
+ */
+static void
+_async_drain(struct val_log_ring *ring)
+{
+    struct val_log_slot *slot;
+    u_int32_t       dropped;
+    char            buf[1028];
+    int             n = 0;
+
+    while (_async_ready(ring)) {
+        slot = &ring->lr_slots[ring->lr_head & ring->lr_mask];
+        _async_write(ring->lr_target, slot->ls_level, slot->ls_buf);
+        __atomic_store_n(&slot->ls_seq, ring->lr_head + ring->lr_mask + 1,
+                         __ATOMIC_RELEASE);
+        ring->lr_head++;
+        n++;
+    }
+
+    dropped = __atomic_load_n(&ring->lr_dropped, __ATOMIC_RELAXED);
+    if (dropped != ring->lr_reported) {
+        res_gettimeofday_buf(buf, sizeof(buf) - 2);
+        snprintf(&buf[19], sizeof(buf) - 21,
+                 "val_log: %u messages dropped, log target too slow",
+                 dropped - ring->lr_reported);
+        _async_write(ring->lr_target, LOG_WARNING, buf);
+        ring->lr_reported = dropped;
+        n++;
+    }
+
+    if (n > 0 && ring->lr_target->logf == val_log_filep &&
+        ring->lr_target->opt.file.fp)
+        fflush(ring->lr_target->opt.file.fp);
+}
+
+static void
+_async_drain_all(void)
+{
+    struct val_log_ring *ring;
+
+    pthread_mutex_lock(&async_write_mutex);
+    for (ring = async_rings; ring; ring = ring->lr_next)
+        _async_drain(ring);
+    pthread_mutex_unlock(&async_write_mutex);
+}
+
+static void *
+_async_thread(void *arg)
+{
+    pthread_mutex_lock(&async_mutex);
+    for (;;) {
+        for (;;) {
+            if (async_waiters)
+                pthread_cond_broadcast(&async_room_cond);
+            /*
+             * Producers check the flag after publishing a message;
+             * with both sides sequentially consistent, either they see
+             * it or the check below sees their message
+             */
+            __atomic_store_n(&async_sleeping, 1, __ATOMIC_SEQ_CST);
+            if (_async_pending())
+                break;
+            pthread_cond_wait(&async_cond, &async_mutex);
+        }
+        __atomic_store_n(&async_sleeping, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&async_mutex);
+
+        _async_drain_all();
+
+        pthread_mutex_lock(&async_mutex);
+    }
+
+    return NULL;
+}
+
+/* Messages still queued when the process exits are written out */
+static void
+_async_flush_at_exit(void)
+{
+    _async_drain_all();
+}
+
+/*
+ * The writer thread does not survive fork(); hold the async locks
+ * across it so that the child gets consistent rings.  Messages queued
+ * before the fork are the parent's to write, so the child empties its
+ * rings (a slot claimed but not yet filled by another thread of the
+ * parent would otherwise hold up the ring for good) and starts its own
+ * writer with the next message.
+ */
+static void
+_async_prefork(void)
+{
+    pthread_mutex_lock(&async_create_mutex);
+    pthread_mutex_lock(&async_mutex);
+    pthread_mutex_lock(&async_write_mutex);
+}
+
+static void
+_async_postfork_parent(void)
+{
+    pthread_mutex_unlock(&async_write_mutex);
+    pthread_mutex_unlock(&async_mutex);
+    pthread_mutex_unlock(&async_create_mutex);
+}
+
+static void
+_async_postfork_child(void)
+{
+    struct val_log_ring *ring;
+    u_int32_t       i;
+
+    pthread_mutex_init(&async_create_mutex, NULL);
+    pthread_mutex_init(&async_mutex, NULL);
+    pthread_mutex_init(&async_write_mutex, NULL);
+    pthread_cond_init(&async_cond, NULL);
+    pthread_cond_init(&async_room_cond, NULL);
+
+    for (ring = async_rings; ring; ring = ring->lr_next) {
+        for (i = 0; i <= ring->lr_mask; i++)
+            ring->lr_slots[i].ls_seq = i;
+        ring->lr_tail = 0;
+        ring->lr_head = 0;
+        ring->lr_dropped = 0;
+        ring->lr_reported = 0;
+    }
+    async_waiters = 0;
+    async_thread_started = 0;
+    /* so that the next message goes through _async_wake_writer() */
+    async_sleeping = 1;
+}
+
+/*
+ * Start the writer thread if it is not running.  Caller must hold
+ * async_mutex.
+ */
+static int
+_async_start_writer(void)
+{
+    pthread_t       tid;
+
+    if (async_thread_started)
+        return 0;
+    if (!async_atfork_set) {
+        if (0 != pthread_atfork(_async_prefork, _async_postfork_parent,
+                                _async_postfork_child))
+            return -1;
+        atexit(_async_flush_at_exit);
+        async_atfork_set = 1;
+    }
+    if (0 != pthread_create(&tid, NULL, _async_thread, NULL))
+        return -1;
+    pthread_detach(tid);
+    async_thread_started = 1;
+    return 0;
+}
+
+static void
+_async_wake_writer(void)
+{
+    pthread_mutex_lock(&async_mutex);
+    _async_start_writer();
+    pthread_cond_signal(&async_cond);
+    pthread_mutex_unlock(&async_mutex);
+}
+
+void
+val_log_async(val_log_t * logp, const val_context_t * ctx, int level,
+              const char *template, va_list ap)
+{
+    struct val_log_ring *ring;
+    struct val_log_slot *slot;
+    u_int32_t       pos;
+    int32_t         diff;
+
+    if (NULL == logp || NULL == (ring = logp->opt.async.ring))
+        return;
+
+    pos = __atomic_load_n(&ring->lr_tail, __ATOMIC_RELAXED);
+    for (;;) {
+        slot = &ring->lr_slots[pos & ring->lr_mask];
+        diff = (int32_t) (__atomic_load_n(&slot->ls_seq, __ATOMIC_ACQUIRE) -
+                          pos);
+        if (diff == 0) {
+            /* on failure pos is reloaded */
+            if (__atomic_compare_exchange_n(&ring->lr_tail, &pos, pos + 1,
+                                            0, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+            continue;
+        } else if (diff < 0) {
+            /* full */
+            if (!ring->lr_block) {
+                __atomic_fetch_add(&ring->lr_dropped, 1, __ATOMIC_RELAXED);
+                return;
+            }
+            pthread_mutex_lock(&async_mutex);
+            if (0 != _async_start_writer()) {
+                /* no one would ever make room */
+                pthread_mutex_unlock(&async_mutex);
+                __atomic_fetch_add(&ring->lr_dropped, 1, __ATOMIC_RELAXED);
+                return;
+            }
+            async_waiters++;
+            pthread_cond_signal(&async_cond);
+            pthread_cond_wait(&async_room_cond, &async_mutex);
+            async_waiters--;
+            pthread_mutex_unlock(&async_mutex);
+        }
+        pos = __atomic_load_n(&ring->lr_tail, __ATOMIC_RELAXED);
+    }
+
+    res_gettimeofday_buf(slot->ls_buf, sizeof(slot->ls_buf) - 2);
+    vsnprintf(&slot->ls_buf[19], sizeof(slot->ls_buf) - 21, template, ap);
+    slot->ls_level = level;
+    __atomic_store_n(&slot->ls_seq, pos + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&async_sleeping, __ATOMIC_SEQ_CST))
+        _async_wake_writer();
+}
+
+/*
+ * Queue messages for the target described by spec (the part of a log
+ * target string after the level), returning the ring to use.  Rings
+ * and their writer live for the rest of the process, so a policy
+ * reload that names the same target reuses its ring.
+ */
+static struct val_log_ring *
+_async_ring_get(const char *spec, int level, int slots, int block,
+                int use_stderr)
+{
+    struct val_log_ring *ring;
+    val_log_t      *target = NULL;
+    char           *target_spec;
+    u_int32_t       i;
+
+    pthread_mutex_lock(&async_create_mutex);
+    for (ring = async_rings; ring; ring = ring->lr_next) {
+        if (ring->lr_block == block && ring->lr_mask + 1 == (u_int32_t) slots &&
+            !strcmp(ring->lr_spec, spec)) {
+            pthread_mutex_unlock(&async_create_mutex);
+            return ring;
+        }
+    }
+
+    /*
+     * The real target is kept on a private list and only the writer
+     * thread, which does no filtering, writes to it; the async target
+     * filters.  It is given the async target's level so that setting
+     * it up does not raise val_log_max_level beyond what the async
+     * target itself needs.
+     */
+    target_spec = (char *) MALLOC(strlen(spec) + 12);
+    if (NULL == target_spec) {
+        pthread_mutex_unlock(&async_create_mutex);
+        return NULL;
+    }
+    snprintf(target_spec, strlen(spec) + 12, "%d:%s", level, spec);
+    val_log_add_optarg_to_list(&target, target_spec, use_stderr);
+    FREE(target_spec);
+    if (NULL == target || NULL == target->logf)
+        goto err;
+
+    ring = (struct val_log_ring *) MALLOC(sizeof(struct val_log_ring));
+    if (NULL == ring)
+        goto err;
+    memset(ring, 0, sizeof(struct val_log_ring));
+    ring->lr_spec = strdup(spec);
+    ring->lr_slots = (struct val_log_slot *)
+        MALLOC(slots * sizeof(struct val_log_slot));
+    if (NULL == ring->lr_spec || NULL == ring->lr_slots) {
+        if (ring->lr_spec)
+            free(ring->lr_spec);
+        if (ring->lr_slots)
+            FREE(ring->lr_slots);
+        FREE(ring);
+        goto err;
+    }
+    for (i = 0; i < (u_int32_t) slots; i++)
+        ring->lr_slots[i].ls_seq = i;
+    ring->lr_mask = slots - 1;
+    ring->lr_block = block;
+    ring->lr_target = target;
+
+    pthread_mutex_lock(&async_mutex);
+    if (0 != _async_start_writer()) {
+        pthread_mutex_unlock(&async_mutex);
+        free(ring->lr_spec);
+        FREE(ring->lr_slots);
+        FREE(ring);
+        goto err;
+    }
+    pthread_mutex_lock(&async_write_mutex);
+    ring->lr_next = async_rings;
+    async_rings = ring;
+    pthread_mutex_unlock(&async_write_mutex);
+    pthread_mutex_unlock(&async_mutex);
+    pthread_mutex_unlock(&async_create_mutex);
+
+    return ring;
+
+  err:
+    pthread_mutex_unlock(&async_create_mutex);
+    if (target) {
+        if (target->logf == val_log_filep && target->opt.file.fp &&
+            target->opt.file.fp != stderr && target->opt.file.fp != stdout)
+            fclose(target->opt.file.fp);
+        FREE(target);
+    }
+    return NULL;
+}
+
+#endif /* VAL_LOG_HAVE_ASYNC */
+
+/*
+ * Add a target that queues messages for a writer thread instead of
+ * writing them on the caller's thread.  spec is a log target string
+ * without the level, e.g. "file:/var/log/libval.log".  When the queue
+ * holds slots messages, new ones are dropped, or with block set the
+ * caller waits for room.  Without thread support the target is added
+ * as a plain one.
+ */
+static val_log_t *
+val_log_add_async(val_log_t **log_head, int level, const char *spec,
+                  int slots, int block, int use_stderr)
+{
+    val_log_t      *logp;
+#ifdef VAL_LOG_HAVE_ASYNC
+    struct val_log_ring *ring;
+
+    ring = _async_ring_get(spec, level, slots, block, use_stderr);
+    if (NULL == ring)
+        return NULL;
+
+    logp = val_log_create_logp(level);
+    if (NULL == logp)
+        return NULL;
+    logp->opt.async.ring = ring;
+    logp->logf = val_log_async;
+    val_log_insert(log_head, logp);
+#else
+    char            buf[1028];
+
+    snprintf(buf, sizeof(buf), "%d:%s", level, spec);
+    logp = val_log_add_optarg_to_list(log_head, buf, use_stderr);
+#endif
+
+    return logp;
+}
+
+/*
+ * Number of messages an async target has dropped because its queue
+ * was full
+ */
+unsigned long
+val_log_async_dropped(val_log_t *logp)
+{
+#ifdef VAL_LOG_HAVE_ASYNC
+    if (logp && logp->logf == val_log_async && logp->opt.async.ring)
+        return __atomic_load_n(&logp->opt.async.ring->lr_dropped,
+                               __ATOMIC_RELAXED);
+#endif
+    return 0;
+}
+
 /* Add log target to system list */
 val_log_t      *
 val_log_add_optarg(const char *str_in, int use_stderr)
@@ -1037,6 +1510,42 @@ val_log_add_optarg_to_list(val_log_t **log_head, const char *str_in, int use_std
         }
         break;
 
+    case 'a':                  /* async[:drop|:block][:<slots>]:<target> */
+        {
+            int             block = 0;
+            int             slots = VAL_LOG_ASYNC_SLOTS;
+
+            if (0 != strncmp(str, "async:", 6) || 0 == str[6]) {
+                if (use_stderr)
+                    fprintf(stderr, "async requires a log target\n");
+                goto err;
+            }
+            str += 6;
+            if (0 == strncmp(str, "drop:", 5)) {
+                str += 5;
+            } else if (0 == strncmp(str, "block:", 6)) {
+                block = 1;
+                str += 6;
+            }
+            if (isdigit((u_char) *str)) {
+                slots = (int)strtol(str, &l, 10);
+                if (':' != *l || slots < 2 ||
+                    slots > VAL_LOG_ASYNC_MAX_SLOTS ||
+                    (slots & (slots - 1))) {
+                    if (use_stderr)
+                        fprintf(stderr,
+                                "async queue size must be a power of two"
+                                " between 2 and %d\n",
+                                VAL_LOG_ASYNC_MAX_SLOTS);
+                    goto err;
+                }
+                str = l + 1;
+            }
+            logp = val_log_add_async(log_head, level, str, slots, block,
+                                     use_stderr);
+        }
+        break;
+
     default:
         fprintf(stderr, "unknown output format type\n");
         break;
@@ -1059,6 +1568,9 @@ val_log_ap(const val_context_t * ctx, int level, const char *log_template,
     if (NULL == log_template)
         return;
 
+    if (!VAL_LOG_ENABLED(level))
+        return;
+
     for (; NULL != logp; logp = logp->next) {
 
         /** check individual level */
@@ -1095,6 +1607,9 @@ val_log(const val_context_t * ctx, int level, const char *format, ...)
     if (NULL == format)
         return;
 
+    if (!VAL_LOG_ENABLED(level))
+        return;
+
     for (; NULL != logp; logp = logp->next) {
 
         /** check individual level */
@@ -0,0 +1,960 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * Local, read-only copies of zones (RFC 8806) loaded from zone files
+ * listed in the zone-mirror policy.  Queries that fall within a
+ * mirrored zone are answered from memory with the same (signed)
+ * data that the zone's servers would have returned; the answers then
+ * go through the normal validation path.
+ */
+#include "validator-internal.h"
+
+#include "val_support.h"
+#include "val_resquery.h"
+#include "val_policy.h"
+#include "val_crypto.h"
+#include "val_mirror.h"
+#include "val_zonefile.h"
+
+#define MIRROR_MIN_BUCKETS   1024
+#define MIRROR_MSG_MAX       65535
+
+/*
+ * One owner name in a mirrored zone.  Names that only exist as
+ * ancestors of other names (empty non-terminals) have no rrsets.
+ */
+struct mirror_node {
+    u_char             *mn_name_n;
+    struct rrset_rec   *mn_rrsets;
+    struct mirror_node *mn_next;        /* hash bucket chain */
+};
+
+struct zone_mirror {
+    u_char              zm_zone_n[NS_MAXCDNAME];
+    char               *zm_file;
+    time_t              zm_mtime;
+    u_int16_t           zm_class_h;
+    u_int32_t           zm_serial;
+    u_int32_t           zm_expire;      /* when the SOA signatures expire */
+    int                 zm_signed;
+    struct mirror_node **zm_table;
+    size_t              zm_table_size;
+    size_t              zm_nodes;
+    struct mirror_node **zm_nsec;       /* NSEC owners in canonical order */
+    size_t              zm_nsec_count;
+    struct zone_mirror *zm_next;
+};
+
+/*
+ * A response being put together
+ */
+struct mirror_msg {
+    u_char         *buf;
+    size_t          len;
+    size_t          size;
+    u_int16_t       count;
+};
+
+#define MIRROR_SEC_ANSWER       0
+#define MIRROR_SEC_AUTHORITY    1
+#define MIRROR_SEC_ADDITIONAL   2
+
+/*
+ ***************************************************************
+ * Name index
+ ***************************************************************
+ */
+
+static size_t
+mirror_name_hash(const u_char *name_n)
+{
+    return res_name_hash(name_n, wire_name_length(name_n), 0);
+}
+
+static int
+mirror_name_eq(const u_char *a, const u_char *b)
+{
+    size_t          len = wire_name_length(a);
+
+    return len == wire_name_length(b) && res_name_caseeq(a, b, len);
+}
+
+static struct mirror_node *
+mirror_find(struct zone_mirror *zm, const u_char *name_n)
+{
+    struct mirror_node *node;
+
+    node = zm->zm_table[mirror_name_hash(name_n) & (zm->zm_table_size - 1)];
+    for (; node; node = node->mn_next) {
+        if (mirror_name_eq(node->mn_name_n, name_n))
+            return node;
+    }
+    return NULL;
+}
+
+static int
+mirror_grow(struct zone_mirror *zm)
+{
+    struct mirror_node **table;
+    struct mirror_node *node, *next;
+    size_t          size = zm->zm_table_size * 2;
+    size_t          i, b;
+
+    table = (struct mirror_node **) MALLOC(size * sizeof(struct mirror_node *));
+    if (table == NULL)
+        return VAL_OUT_OF_MEMORY;
+    memset(table, 0, size * sizeof(struct mirror_node *));
+
+    for (i = 0; i < zm->zm_table_size; i++) {
+        for (node = zm->zm_table[i]; node; node = next) {
+            next = node->mn_next;
+            b = mirror_name_hash(node->mn_name_n) & (size - 1);
+            node->mn_next = table[b];
+            table[b] = node;
+        }
+    }
+    FREE(zm->zm_table);
+    zm->zm_table = table;
+    zm->zm_table_size = size;
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Find the node for name_n, creating it and any missing ancestors
+ * up to the apex of the zone.
+ */
+static struct mirror_node *
+mirror_add_node(struct zone_mirror *zm, const u_char *name_n)
+{
+    struct mirror_node *node;
+    size_t          len, b;
+
+    if (NULL != (node = mirror_find(zm, name_n)))
+        return node;
+
+    if (namecmp(name_n, zm->zm_zone_n) != 0 &&
+        NULL == mirror_add_node(zm, name_n + name_n[0] + 1))
+        return NULL;
+
+    if (zm->zm_nodes >= zm->zm_table_size &&
+        VAL_NO_ERROR != mirror_grow(zm))
+        return NULL;
+
+    node = (struct mirror_node *) MALLOC(sizeof(struct mirror_node));
+    if (node == NULL)
+        return NULL;
+    len = wire_name_length(name_n);
+    node->mn_name_n = (u_char *) MALLOC(len * sizeof(u_char));
+    if (node->mn_name_n == NULL) {
+        FREE(node);
+        return NULL;
+    }
+    memcpy(node->mn_name_n, name_n, len);
+    node->mn_rrsets = NULL;
+
+    b = mirror_name_hash(name_n) & (zm->zm_table_size - 1);
+    node->mn_next = zm->zm_table[b];
+    zm->zm_table[b] = node;
+    zm->zm_nodes++;
+    return node;
+}
+
+static struct rrset_rec *
+mirror_rrset(struct mirror_node *node, u_int16_t type_h)
+{
+    struct rrset_rec *rrset;
+
+    if (node == NULL)
+        return NULL;
+    for (rrset = node->mn_rrsets; rrset; rrset = rrset->rrs_next) {
+        if (rrset->rrs_type_h == type_h)
+            return rrset;
+    }
+    return NULL;
+}
+
+static int
+mirror_add_rdata(struct rrset_rr **list, const u_char *rdata, size_t rdata_len)
+{
+    struct rrset_rr *rr;
+
+    /* ignore duplicates */
+    for (rr = *list; rr; rr = rr->rr_next) {
+        if (rr->rr_rdata_length == rdata_len &&
+            !memcmp(rr->rr_rdata, rdata, rdata_len))
+            return VAL_NO_ERROR;
+    }
+
+    rr = (struct rrset_rr *) MALLOC(sizeof(struct rrset_rr));
+    if (rr == NULL)
+        return VAL_OUT_OF_MEMORY;
+    rr->rr_rdata = (u_char *) MALLOC(rdata_len * sizeof(u_char));
+    if (rr->rr_rdata == NULL) {
+        FREE(rr);
+        return VAL_OUT_OF_MEMORY;
+    }
+    memcpy(rr->rr_rdata, rdata, rdata_len);
+    rr->rr_rdata_length = rdata_len;
+    rr->rr_status = VAL_AC_UNSET;
+    rr->rr_next = *list;
+    *list = rr;
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Add one record to the zone; signatures are kept with the rrset
+ * that they cover
+ */
+static int
+mirror_add_rr(struct zone_mirror *zm, const u_char *owner_n,
+              u_int16_t type_h, u_int16_t class_h, u_int32_t ttl_h,
+              const u_char *rdata, size_t rdata_len)
+{
+    struct mirror_node *node;
+    struct rrset_rec *rrset;
+    u_int16_t       set_type_h = type_h;
+    size_t          len;
+
+    if (type_h == ns_t_rrsig) {
+        if (rdata_len < SIGNBY)
+            return VAL_CONF_PARSE_ERROR;
+        set_type_h = (rdata[0] << 8) | rdata[1];
+    }
+
+    if (NULL == (node = mirror_add_node(zm, owner_n)))
+        return VAL_OUT_OF_MEMORY;
+
+    if (NULL == (rrset = mirror_rrset(node, set_type_h))) {
+        rrset = (struct rrset_rec *) MALLOC(sizeof(struct rrset_rec));
+        if (rrset == NULL)
+            return VAL_OUT_OF_MEMORY;
+        memset(rrset, 0, sizeof(struct rrset_rec));
+        len = wire_name_length(owner_n);
+        rrset->rrs_name_n = (u_char *) MALLOC(len * sizeof(u_char));
+        if (rrset->rrs_name_n == NULL) {
+            FREE(rrset);
+            return VAL_OUT_OF_MEMORY;
+        }
+        memcpy(rrset->rrs_name_n, owner_n, len);
+        rrset->rrs_type_h = set_type_h;
+        rrset->rrs_class_h = class_h;
+        rrset->rrs_ttl_h = ttl_h;
+        rrset->rrs_section = VAL_FROM_UNSET;
+        rrset->rrs_cred = SR_CRED_UNSET;
+        rrset->rrs_ans_kind = SR_ANS_UNSET;
+        rrset->rrs_next = node->mn_rrsets;
+        node->mn_rrsets = rrset;
+    }
+
+    if (type_h == ns_t_rrsig)
+        return mirror_add_rdata(&rrset->rrs_sig, rdata, rdata_len);
+
+    /* all records in an rrset share the lowest ttl */
+    if (rrset->rrs_data == NULL || ttl_h < rrset->rrs_ttl_h)
+        rrset->rrs_ttl_h = ttl_h;
+    return mirror_add_rdata(&rrset->rrs_data, rdata, rdata_len);
+}
+
+static void
+mirror_free(struct zone_mirror *zm)
+{
+    struct mirror_node *node, *next;
+    size_t          i;
+
+    if (zm == NULL)
+        return;
+    if (zm->zm_table) {
+        for (i = 0; i < zm->zm_table_size; i++) {
+            for (node = zm->zm_table[i]; node; node = next) {
+                next = node->mn_next;
+                res_sq_free_rrset_recs(&node->mn_rrsets);
+                FREE(node->mn_name_n);
+                FREE(node);
+            }
+        }
+        FREE(zm->zm_table);
+    }
+    if (zm->zm_nsec)
+        FREE(zm->zm_nsec);
+    if (zm->zm_file)
+        FREE(zm->zm_file);
+    FREE(zm);
+}
+
+void
+free_zone_mirrors(struct zone_mirror **zm)
+{
+    struct zone_mirror *next;
+
+    if (zm == NULL)
+        return;
+    while (*zm) {
+        next = (*zm)->zm_next;
+        mirror_free(*zm);
+        *zm = next;
+    }
+}
+
+static int
+mirror_nsec_cmp(const void *a, const void *b)
+{
+    return namecmp((*(struct mirror_node * const *) a)->mn_name_n,
+                   (*(struct mirror_node * const *) b)->mn_name_n);
+}
+
+/*
+ * Check that the data make up a usable zone and build the
+ * NSEC index
+ */
+static int
+mirror_finish(val_context_t *ctx, struct zone_mirror *zm, const char *zone_p)
+{
+    struct mirror_node *apex, *node;
+    struct rrset_rec *soa;
+    struct rrset_rr *sig;
+    struct timeval  now;
+    size_t          i, n;
+
+    apex = mirror_find(zm, zm->zm_zone_n);
+    if (NULL == (soa = mirror_rrset(apex, ns_t_soa)) ||
+        NULL == mirror_rrset(apex, ns_t_ns) ||
+        soa->rrs_data->rr_rdata_length < 20) {
+        VAL_LOG(ctx, LOG_WARNING,
+                "mirror_finish(): No SOA or NS records at the apex of %s", zone_p);
+        return VAL_CONF_PARSE_ERROR;
+    }
+    i = soa->rrs_data->rr_rdata_length - 20;
+    zm->zm_serial = (soa->rrs_data->rr_rdata[i] << 24) |
+                    (soa->rrs_data->rr_rdata[i + 1] << 16) |
+                    (soa->rrs_data->rr_rdata[i + 2] << 8) |
+                    soa->rrs_data->rr_rdata[i + 3];
+
+    zm->zm_signed = (NULL != mirror_rrset(apex, ns_t_dnskey));
+
+    /* don't serve a copy whose signatures have run out */
+    zm->zm_expire = 0;
+    for (sig = soa->rrs_sig; sig; sig = sig->rr_next) {
+        u_int32_t exp;
+        if (sig->rr_rdata_length < SIGNBY)
+            continue;
+        exp = (sig->rr_rdata[8] << 24) | (sig->rr_rdata[9] << 16) |
+              (sig->rr_rdata[10] << 8) | sig->rr_rdata[11];
+        if (exp > zm->zm_expire)
+            zm->zm_expire = exp;
+    }
+    gettimeofday(&now, NULL);
+    if (zm->zm_signed && zm->zm_expire <= now.tv_sec) {
+        VAL_LOG(ctx, LOG_WARNING,
+                "mirror_finish(): Signatures in the copy of %s (serial %u) have expired",
+                zone_p, zm->zm_serial);
+        return VAL_CONF_PARSE_ERROR;
+    }
+
+    n = 0;
+    for (i = 0; i < zm->zm_table_size; i++) {
+        for (node = zm->zm_table[i]; node; node = node->mn_next) {
+            if (mirror_rrset(node, ns_t_nsec))
+                n++;
+        }
+    }
+    if (n > 0) {
+        zm->zm_nsec = (struct mirror_node **)
+                MALLOC(n * sizeof(struct mirror_node *));
+        if (zm->zm_nsec == NULL)
+            return VAL_OUT_OF_MEMORY;
+        n = 0;
+        for (i = 0; i < zm->zm_table_size; i++) {
+            for (node = zm->zm_table[i]; node; node = node->mn_next) {
+                if (mirror_rrset(node, ns_t_nsec))
+                    zm->zm_nsec[n++] = node;
+            }
+        }
+        qsort(zm->zm_nsec, n, sizeof(struct mirror_node *), mirror_nsec_cmp);
+    }
+    zm->zm_nsec_count = n;
+    return VAL_NO_ERROR;
+}
+
+struct mirror_load_state {
+    struct zone_mirror *zm;
+    int                 skipped;
+};
+
+/*
+ * Add a record read from the zone file to the mirror, if it is
+ * part of the zone
+ */
+static int
+mirror_load_rr(void *cb_data, const u_char *owner_n, u_int16_t type_h,
+               u_int16_t class_h, u_int32_t ttl_h, const u_char *rdata,
+               size_t rdata_len)
+{
+    struct mirror_load_state *ls = (struct mirror_load_state *) cb_data;
+    struct zone_mirror *zm = ls->zm;
+
+    if (class_h != zm->zm_class_h ||
+        NULL == namename((u_char *) owner_n, zm->zm_zone_n)) {
+        /* not our data */
+        ls->skipped++;
+        return VAL_NO_ERROR;
+    }
+
+    return mirror_add_rr(zm, owner_n, type_h, class_h, ttl_h,
+                         rdata, rdata_len);
+}
+
+/*
+ * Read the zone file for zone_n into a new mirror
+ */
+static int
+mirror_load(val_context_t *ctx, u_char *zone_n, const char *file,
+            time_t mtime, struct zone_mirror **zm_out)
+{
+    struct zone_mirror *zm = NULL;
+    struct mirror_load_state ls;
+    char            zone_p[NS_MAXDNAME];
+    int             unknown = 0;
+    int             retval = VAL_NO_ERROR;
+
+    *zm_out = NULL;
+    if (-1 == ns_name_ntop(zone_n, zone_p, sizeof(zone_p)))
+        snprintf(zone_p, sizeof(zone_p), "unknown/error");
+
+    zm = (struct zone_mirror *) MALLOC(sizeof(struct zone_mirror));
+    if (zm == NULL)
+        return VAL_OUT_OF_MEMORY;
+    memset(zm, 0, sizeof(struct zone_mirror));
+
+    memcpy(zm->zm_zone_n, zone_n, wire_name_length(zone_n));
+    zm->zm_class_h = ns_c_in;
+    zm->zm_mtime = mtime;
+    zm->zm_file = (char *) MALLOC(strlen(file) + 1);
+    zm->zm_table = (struct mirror_node **)
+            MALLOC(MIRROR_MIN_BUCKETS * sizeof(struct mirror_node *));
+    if (zm->zm_file == NULL || zm->zm_table == NULL) {
+        retval = VAL_OUT_OF_MEMORY;
+        goto err;
+    }
+    strcpy(zm->zm_file, file);
+    memset(zm->zm_table, 0, MIRROR_MIN_BUCKETS * sizeof(struct mirror_node *));
+    zm->zm_table_size = MIRROR_MIN_BUCKETS;
+
+    ls.zm = zm;
+    ls.skipped = 0;
+    if (VAL_NO_ERROR != (retval = read_zone_file(ctx, file, zone_n,
+                                                 mirror_load_rr, &ls,
+                                                 &unknown, NULL))) {
+        VAL_LOG(ctx, LOG_WARNING,
+                "mirror_load(): Could not load %s from %s", zone_p, file);
+        goto err;
+    }
+
+    if (VAL_NO_ERROR != (retval = mirror_finish(ctx, zm, zone_p)))
+        goto err;
+
+    VAL_LOG(ctx, LOG_NOTICE,
+            "mirror_load(): Loaded %s (serial %u, %lu names%s) from %s",
+            zone_p, zm->zm_serial, (u_long) zm->zm_nodes,
+            zm->zm_signed ? ", signed" : "", file);
+    if (ls.skipped + unknown)
+        VAL_LOG(ctx, LOG_INFO,
+                "mirror_load(): Ignored %d records of unknown type or outside %s",
+                ls.skipped + unknown, zone_p);
+
+    *zm_out = zm;
+    return VAL_NO_ERROR;
+
+  err:
+    mirror_free(zm);
+    return retval;
+}
+
+/*
+ * If we have no root hints, take the root servers from a mirror
+ * of the root zone
+ */
+static void
+mirror_prime_root(val_context_t *ctx, struct zone_mirror *zm)
+{
+    struct mirror_node *apex, *node;
+    struct rrset_rec *ns, *addr, *list;
+    struct rrset_rr *rr;
+    struct name_server *ns_list = NULL;
+    struct name_server *pending_glue = NULL;
+    size_t          count = 1, i = 0;
+
+    if (ctx->root_ns != NULL || zm->zm_zone_n[0] != '\0')
+        return;
+
+    apex = mirror_find(zm, zm->zm_zone_n);
+    ns = mirror_rrset(apex, ns_t_ns);
+    for (rr = ns->rrs_data; rr; rr = rr->rr_next)
+        count += 2;
+
+    /* shallow copies, linked together for res_zi_unverified_ns_list() */
+    list = (struct rrset_rec *) MALLOC(count * sizeof(struct rrset_rec));
+    if (list == NULL)
+        return;
+    memcpy(&list[i++], ns, sizeof(struct rrset_rec));
+    for (rr = ns->rrs_data; rr; rr = rr->rr_next) {
+        node = mirror_find(zm, rr->rr_rdata);
+        if (NULL != (addr = mirror_rrset(node, ns_t_a)))
+            memcpy(&list[i++], addr, sizeof(struct rrset_rec));
+        if (NULL != (addr = mirror_rrset(node, ns_t_aaaa)))
+            memcpy(&list[i++], addr, sizeof(struct rrset_rec));
+    }
+    for (count = 0; count < i; count++)
+        list[count].rrs_next = (count + 1 < i) ? &list[count + 1] : NULL;
+
+    if (VAL_NO_ERROR == res_zi_unverified_ns_list(ctx, &ns_list,
+                                zm->zm_zone_n, list, &pending_glue)) {
+        ctx->root_ns = ns_list;
+        VAL_LOG(ctx, LOG_INFO,
+                "mirror_prime_root(): Using root servers from the root zone mirror");
+    }
+    free_name_servers(&pending_glue);
+    FREE(list);
+}
+
+/*
+ * (Re)load the zones listed in the zone-mirror policy.  Copies whose
+ * zone file has not changed are kept as they are.  A zone that cannot
+ * be loaded is simply not mirrored; its queries go to the network.
+ * NOTE: Must be called with an exclusive lock on the context policy.
+ */
+int
+read_zone_mirrors(val_context_t *ctx)
+{
+    policy_entry_t *pol, *cur;
+    struct zone_mirror *new_list = NULL;
+    struct zone_mirror *zm, **prev;
+    struct zone_mirror_policy *zm_pol;
+    struct stat     sb;
+
+    if (ctx == NULL)
+        return VAL_BAD_ARGUMENT;
+
+    RETRIEVE_POLICY(ctx, P_ZONE_MIRROR, pol);
+    for (cur = pol; cur; cur = cur->next) {
+        zm_pol = (struct zone_mirror_policy *) cur->pol;
+        if (zm_pol == NULL || zm_pol->file == NULL)
+            continue;
+        if (0 != stat(zm_pol->file, &sb)) {
+            VAL_LOG(ctx, LOG_WARNING,
+                    "read_zone_mirrors(): Cannot find zone file %s", zm_pol->file);
+            continue;
+        }
+
+        /* reuse an unchanged copy */
+        for (prev = &ctx->zone_mirrors; *prev; prev = &(*prev)->zm_next) {
+            if (!namecmp((*prev)->zm_zone_n, cur->zone_n) &&
+                !strcmp((*prev)->zm_file, zm_pol->file) &&
+                (*prev)->zm_mtime == sb.st_mtime)
+                break;
+        }
+        if (*prev) {
+            zm = *prev;
+            *prev = zm->zm_next;
+        } else if (VAL_NO_ERROR != mirror_load(ctx, cur->zone_n, zm_pol->file,
+                                               sb.st_mtime, &zm)) {
+            continue;
+        }
+        zm->zm_next = new_list;
+        new_list = zm;
+    }
+
+    free_zone_mirrors(&ctx->zone_mirrors);
+    ctx->zone_mirrors = new_list;
+
+    for (zm = ctx->zone_mirrors; zm; zm = zm->zm_next)
+        mirror_prime_root(ctx, zm);
+
+    return VAL_NO_ERROR;
+}
+
+/*
+ ***************************************************************
+ * Answering queries
+ ***************************************************************
+ */
+
+static int
+msg_put(struct mirror_msg *m, const void *data, size_t len)
+{
+    if (m->len + len > MIRROR_MSG_MAX)
+        return VAL_BAD_ARGUMENT;
+    if (m->len + len > m->size) {
+        size_t size = m->size ? m->size : 512;
+        u_char *buf;
+        while (size < m->len + len)
+            size *= 2;
+        buf = (u_char *) MALLOC(size * sizeof(u_char));
+        if (buf == NULL)
+            return VAL_OUT_OF_MEMORY;
+        if (m->buf) {
+            memcpy(buf, m->buf, m->len);
+            FREE(m->buf);
+        }
+        m->buf = buf;
+        m->size = size;
+    }
+    memcpy(m->buf + m->len, data, len);
+    m->len += len;
+    return VAL_NO_ERROR;
+}
+
+static int
+msg_add_rr(struct mirror_msg *m, const u_char *owner_n,
+           u_int16_t type_h, u_int16_t class_h, u_int32_t ttl_h,
+           const u_char *rdata, size_t rdata_len)
+{
+    u_char          fixed[10];
+    int             retval;
+
+    fixed[0] = (u_char) (type_h >> 8);
+    fixed[1] = (u_char) type_h;
+    fixed[2] = (u_char) (class_h >> 8);
+    fixed[3] = (u_char) class_h;
+    fixed[4] = (u_char) (ttl_h >> 24);
+    fixed[5] = (u_char) (ttl_h >> 16);
+    fixed[6] = (u_char) (ttl_h >> 8);
+    fixed[7] = (u_char) ttl_h;
+    fixed[8] = (u_char) (rdata_len >> 8);
+    fixed[9] = (u_char) rdata_len;
+
+    if (VAL_NO_ERROR != (retval = msg_put(m, owner_n, wire_name_length(owner_n))) ||
+        VAL_NO_ERROR != (retval = msg_put(m, fixed, sizeof(fixed))) ||
+        VAL_NO_ERROR != (retval = msg_put(m, rdata, rdata_len)))
+        return retval;
+    m->count++;
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Add an rrset and its signatures
+ */
+static int
+msg_add_rrset(struct mirror_msg *m, struct rrset_rec *rrset, u_int32_t ttl_h)
+{
+    struct rrset_rr *rr;
+    int             retval;
+
+    if (rrset == NULL)
+        return VAL_NO_ERROR;
+    for (rr = rrset->rrs_data; rr; rr = rr->rr_next) {
+        if (VAL_NO_ERROR != (retval =
+                msg_add_rr(m, rrset->rrs_name_n, rrset->rrs_type_h,
+                           rrset->rrs_class_h, ttl_h,
+                           rr->rr_rdata, rr->rr_rdata_length)))
+            return retval;
+    }
+    for (rr = rrset->rrs_sig; rr; rr = rr->rr_next) {
+        if (VAL_NO_ERROR != (retval =
+                msg_add_rr(m, rrset->rrs_name_n, ns_t_rrsig,
+                           rrset->rrs_class_h, ttl_h,
+                           rr->rr_rdata, rr->rr_rdata_length)))
+            return retval;
+    }
+    return VAL_NO_ERROR;
+}
+
+/*
+ * The NSEC whose owner is the closest one before (or at) name_n
+ */
+static struct rrset_rec *
+mirror_covering_nsec(struct zone_mirror *zm, const u_char *name_n)
+{
+    size_t          lo = 0, hi = zm->zm_nsec_count, mid;
+
+    if (zm->zm_nsec_count == 0)
+        return NULL;
+    while (hi - lo > 1) {
+        mid = (lo + hi) / 2;
+        if (namecmp(zm->zm_nsec[mid]->mn_name_n, (u_char *) name_n) <= 0)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return mirror_rrset(zm->zm_nsec[lo], ns_t_nsec);
+}
+
+/*
+ * Apex SOA for a negative answer, with the negative caching ttl
+ */
+static int
+mirror_add_soa(struct mirror_msg *m, struct zone_mirror *zm)
+{
+    struct rrset_rec *soa;
+    u_int32_t       ttl_h, min_h;
+    u_char         *rd;
+
+    soa = mirror_rrset(mirror_find(zm, zm->zm_zone_n), ns_t_soa);
+    rd = soa->rrs_data->rr_rdata + soa->rrs_data->rr_rdata_length - 4;
+    min_h = (rd[0] << 24) | (rd[1] << 16) | (rd[2] << 8) | rd[3];
+    ttl_h = (soa->rrs_ttl_h < min_h) ? soa->rrs_ttl_h : min_h;
+    return msg_add_rrset(m, soa, ttl_h);
+}
+
+/*
+ * Build a referral to the zone delegated at node
+ */
+static int
+mirror_referral(struct mirror_msg *sec, struct zone_mirror *zm,
+                struct mirror_node *node)
+{
+    struct rrset_rec *ns = mirror_rrset(node, ns_t_ns);
+    struct rrset_rec *ds;
+    struct mirror_node *target;
+    struct rrset_rr *rr;
+    int             retval;
+
+    if (VAL_NO_ERROR != (retval =
+            msg_add_rrset(&sec[MIRROR_SEC_AUTHORITY], ns, ns->rrs_ttl_h)))
+        return retval;
+
+    /* the DS set, or the proof that the child is not signed */
+    if (NULL == (ds = mirror_rrset(node, ns_t_ds)))
+        ds = mirror_rrset(node, ns_t_nsec);
+    if (ds && VAL_NO_ERROR != (retval =
+            msg_add_rrset(&sec[MIRROR_SEC_AUTHORITY], ds, ds->rrs_ttl_h)))
+        return retval;
+
+    for (rr = ns->rrs_data; rr; rr = rr->rr_next) {
+        if (NULL == namename(rr->rr_rdata, zm->zm_zone_n) ||
+            NULL == (target = mirror_find(zm, rr->rr_rdata)))
+            continue;
+        if (VAL_NO_ERROR != (retval =
+                msg_add_rrset(&sec[MIRROR_SEC_ADDITIONAL],
+                              mirror_rrset(target, ns_t_a), ns->rrs_ttl_h)) ||
+            VAL_NO_ERROR != (retval =
+                msg_add_rrset(&sec[MIRROR_SEC_ADDITIONAL],
+                              mirror_rrset(target, ns_t_aaaa), ns->rrs_ttl_h)))
+            return retval;
+    }
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Denial of existence for qname, whose closest existing ancestor is ce_n
+ */
+static int
+mirror_nxdomain(struct mirror_msg *sec, struct zone_mirror *zm,
+                const u_char *qname_n, const u_char *ce_n)
+{
+    u_char          wc_n[NS_MAXCDNAME];
+    struct rrset_rec *nsec, *wc_nsec;
+    size_t          len = wire_name_length(ce_n);
+    int             retval;
+
+    if (len + 2 > NS_MAXCDNAME)
+        return VAL_BAD_ARGUMENT;
+    wc_n[0] = 1;
+    wc_n[1] = '*';
+    memcpy(&wc_n[2], ce_n, len);
+
+    /* leave wildcard synthesis to the zone's servers */
+    if (mirror_find(zm, wc_n))
+        return VAL_BAD_ARGUMENT;
+
+    if (VAL_NO_ERROR != (retval = mirror_add_soa(&sec[MIRROR_SEC_AUTHORITY], zm)))
+        return retval;
+    if (zm->zm_nsec_count == 0)
+        return zm->zm_signed ? VAL_BAD_ARGUMENT : VAL_NO_ERROR;
+
+    nsec = mirror_covering_nsec(zm, qname_n);
+    wc_nsec = mirror_covering_nsec(zm, wc_n);
+    if (VAL_NO_ERROR != (retval =
+            msg_add_rrset(&sec[MIRROR_SEC_AUTHORITY], nsec, nsec->rrs_ttl_h)))
+        return retval;
+    if (wc_nsec != nsec)
+        retval = msg_add_rrset(&sec[MIRROR_SEC_AUTHORITY], wc_nsec,
+                               wc_nsec->rrs_ttl_h);
+    return retval;
+}
+
+/*
+ * Positive answer or no-data response for a name that exists
+ */
+static int
+mirror_node_answer(struct mirror_msg *sec, struct zone_mirror *zm,
+                   struct mirror_node *node, const u_char *qname_n,
+                   u_int16_t qtype_h)
+{
+    struct rrset_rec *rrset;
+    int             retval;
+
+    if (NULL != (rrset = mirror_rrset(node, qtype_h)) ||
+        NULL != (rrset = mirror_rrset(node, ns_t_cname)))
+        return msg_add_rrset(&sec[MIRROR_SEC_ANSWER], rrset, rrset->rrs_ttl_h);
+
+    if (VAL_NO_ERROR != (retval = mirror_add_soa(&sec[MIRROR_SEC_AUTHORITY], zm)))
+        return retval;
+    if (zm->zm_nsec_count == 0)
+        return zm->zm_signed ? VAL_BAD_ARGUMENT : VAL_NO_ERROR;
+
+    /* an empty non-terminal is covered by the NSEC before it */
+    if (NULL == (rrset = mirror_rrset(node, ns_t_nsec)))
+        rrset = mirror_covering_nsec(zm, qname_n);
+    return msg_add_rrset(&sec[MIRROR_SEC_AUTHORITY], rrset, rrset->rrs_ttl_h);
+}
+
+/*
+ * Look for a mirror that can answer q.  When iterating, the mirror
+ * must not lie above the zone that we already know about.
+ */
+static struct zone_mirror *
+mirror_select(val_context_t *ctx, struct val_query_chain *q, int iterating)
+{
+    struct zone_mirror *zm, *best = NULL;
+    u_char         *p;
+    struct timeval  now;
+
+    gettimeofday(&now, NULL);
+    for (zm = ctx->zone_mirrors; zm; zm = zm->zm_next) {
+        if (zm->zm_class_h != q->qc_class_h ||
+            NULL == (p = namename(q->qc_name_n, zm->zm_zone_n)))
+            continue;
+        /* the DS set lives in the parent */
+        if (q->qc_type_h == ns_t_ds && p == q->qc_name_n)
+            continue;
+        if (iterating && q->qc_zonecut_n &&
+            NULL == namename(zm->zm_zone_n, q->qc_zonecut_n))
+            continue;
+        if (zm->zm_signed && zm->zm_expire <= now.tv_sec)
+            continue;
+        if (best == NULL ||
+            wire_name_length(zm->zm_zone_n) > wire_name_length(best->zm_zone_n))
+            best = zm;
+    }
+    return best;
+}
+
+/*
+ * Build a response to q from a local zone mirror.  On success,
+ * *response holds the message (which the caller must free) and
+ * zone_n the apex of the zone it came from.  *response is left NULL
+ * if q must go to the network: no mirror covers the name, the
+ * mirror is out of date, or the answer would need a wildcard,
+ * DNAME or NSEC3 proof.  Referrals are only returned when iterating.
+ * NOTE: Must be called with a shared lock on the context policy.
+ */
+int
+zone_mirror_answer(val_context_t *ctx, struct val_query_chain *q,
+                   int iterating, u_char *zone_n,
+                   u_char **response, size_t *response_len)
+{
+    struct zone_mirror *zm;
+    struct mirror_node *node;
+    struct mirror_msg sec[3];
+    struct mirror_msg msg;
+    const u_char   *suffix[NS_MAXCDNAME / 2 + 1];
+    const u_char   *ce_n;
+    u_char          hdr[12];
+    u_char          qfixed[4];
+    int             nlabels = 0, i, j;
+    int             rcode = ns_r_noerror;
+    int             aa = 1;
+    int             retval = VAL_NO_ERROR;
+    int             done = 0;
+
+    if (ctx == NULL || q == NULL || zone_n == NULL ||
+        response == NULL || response_len == NULL)
+        return VAL_BAD_ARGUMENT;
+
+    *response = NULL;
+    *response_len = 0;
+
+    if (ctx->zone_mirrors == NULL ||
+        q->qc_type_h == ns_t_any || q->qc_type_h == ns_t_rrsig ||
+        NULL == (zm = mirror_select(ctx, q, iterating)))
+        return VAL_NO_ERROR;
+
+    memset(sec, 0, sizeof(sec));
+    memset(&msg, 0, sizeof(msg));
+
+    /* the names between the apex and qname */
+    for (ce_n = q->qc_name_n; namecmp(ce_n, zm->zm_zone_n);
+         ce_n += ce_n[0] + 1)
+        suffix[nlabels++] = ce_n;
+
+    /* a DNAME at the apex rewrites everything below it */
+    if (nlabels > 0 &&
+        mirror_rrset(mirror_find(zm, zm->zm_zone_n), ns_t_dname))
+        goto done;
+
+    ce_n = zm->zm_zone_n;
+    for (i = nlabels - 1; i >= 0 && !done; i--) {
+        node = mirror_find(zm, suffix[i]);
+        if (node == NULL) {
+            rcode = ns_r_nxdomain;
+            retval = mirror_nxdomain(sec, zm, q->qc_name_n, ce_n);
+            done = 1;
+            break;
+        }
+        if (mirror_rrset(node, ns_t_ns)) {
+            if (i == 0 && q->qc_type_h == ns_t_ds) {
+                /* the parent side of the cut is authoritative for DS */
+                retval = mirror_node_answer(sec, zm, node, q->qc_name_n,
+                                            ns_t_ds);
+            } else if (iterating) {
+                aa = 0;
+                retval = mirror_referral(sec, zm, node);
+            } else {
+                goto done;
+            }
+            done = 1;
+            break;
+        }
+        if (i > 0 && mirror_rrset(node, ns_t_dname))
+            goto done;
+        ce_n = suffix[i];
+    }
+    if (!done) {
+        node = mirror_find(zm, q->qc_name_n);
+        retval = mirror_node_answer(sec, zm, node, q->qc_name_n, q->qc_type_h);
+    }
+    if (retval != VAL_NO_ERROR)
+        goto done;
+
+    memset(hdr, 0, sizeof(hdr));
+    hdr[2] = 0x80 | (aa ? 0x04 : 0);
+    hdr[3] = 0x80 | rcode;
+    hdr[5] = 1;
+    for (j = 0; j < 3; j++) {
+        hdr[6 + 2 * j] = (u_char) (sec[j].count >> 8);
+        hdr[7 + 2 * j] = (u_char) sec[j].count;
+    }
+    qfixed[0] = (u_char) (q->qc_type_h >> 8);
+    qfixed[1] = (u_char) q->qc_type_h;
+    qfixed[2] = (u_char) (q->qc_class_h >> 8);
+    qfixed[3] = (u_char) q->qc_class_h;
+
+    if (VAL_NO_ERROR != (retval = msg_put(&msg, hdr, sizeof(hdr))) ||
+        VAL_NO_ERROR != (retval = msg_put(&msg, q->qc_name_n,
+                                          wire_name_length(q->qc_name_n))) ||
+        VAL_NO_ERROR != (retval = msg_put(&msg, qfixed, sizeof(qfixed))))
+        goto done;
+    for (j = 0; j < 3; j++) {
+        if (sec[j].len &&
+            VAL_NO_ERROR != (retval = msg_put(&msg, sec[j].buf, sec[j].len)))
+            goto done;
+    }
+    memcpy(zone_n, zm->zm_zone_n, wire_name_length(zm->zm_zone_n));
+
+    *response = msg.buf;
+    *response_len = msg.len;
+    msg.buf = NULL;
+
+  done:
+    for (j = 0; j < 3; j++) {
+        if (sec[j].buf)
+            FREE(sec[j].buf);
+    }
+    if (msg.buf)
+        FREE(msg.buf);
+    /* anything we couldn't build locally goes to the network */
+    return (retval == VAL_OUT_OF_MEMORY) ? retval : VAL_NO_ERROR;
+}
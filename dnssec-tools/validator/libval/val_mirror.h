@@ -0,0 +1,16 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+#ifndef VAL_MIRROR_H
+#define VAL_MIRROR_H
+
+int             read_zone_mirrors(val_context_t *ctx);
+void            free_zone_mirrors(struct zone_mirror **zm);
+int             zone_mirror_answer(val_context_t *ctx,
+                                   struct val_query_chain *q,
+                                   int iterating, u_char *zone_n,
+                                   u_char **response,
+                                   size_t *response_len);
+
+#endif
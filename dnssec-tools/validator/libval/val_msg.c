@@ -0,0 +1,385 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * Single-pass index over the resource records of a received message.
+ *
+ * msg_index() walks the message once, validating every owner name and
+ * RR envelope, and records each RR as a set of offsets into the
+ * receive buffer.  RRs that would land in the same rrset (same owner,
+ * class and type covered) are grouped through a small hash table
+ * keyed on the compressed owner name, so the group is known without
+ * expanding any name.
+ *
+ * Owner names are unpacked only when a caller asks for one, and only
+ * when it differs from the owner it was handed last.  RDATA that
+ * carries no compressed names is returned in place; only the types
+ * with embedded names go through decompress().
+ */
+#include "validator-internal.h"
+
+#include "val_arena.h"
+#include "val_support.h"
+#include "val_msg.h"
+
+#define MSG_MAX_HOPS    (NS_MAXCDNAME / 2)
+
+#define MSG_HASH(h, c)  (((h) ^ (u_int32_t) (c)) * 16777619U)
+
+/*
+ * Walk the possibly compressed name at msg + off.  On success the
+ * case-insensitive hash of the expanded name is stored in *hash and
+ * the number of bytes the name occupies at off is returned; -1 is
+ * returned for malformed names.
+ */
+static int
+_msg_name_scan(const u_char *msg, const u_char *end, size_t off,
+               u_int32_t *hash)
+{
+    const u_char   *p = msg + off;
+    u_int32_t       h = 0;
+    size_t          expanded = 0;
+    int             skip = -1;
+    int             hops = 0;
+    int             n;
+
+    while (1) {
+        if (p >= end)
+            return -1;
+        n = *p;
+        if ((n & NS_CMPRSFLGS) == NS_CMPRSFLGS) {
+            if (p + 1 >= end || ++hops > MSG_MAX_HOPS)
+                return -1;
+            if (skip < 0)
+                skip = (int) (p + 2 - (msg + off));
+            p = msg + (((n & ~NS_CMPRSFLGS) << 8) | p[1]);
+            continue;
+        }
+        if (n & NS_CMPRSFLGS)
+            return -1;          /* extended label types */
+        expanded += n + 1;
+        if (expanded > NS_MAXCDNAME || p + 1 + n > end)
+            return -1;
+        h = res_name_hash(p, n + 1, h);
+        if (n == 0)
+            break;
+        p += n + 1;
+    }
+    if (skip < 0)
+        skip = (int) (p + 1 - (msg + off));
+
+    *hash = h;
+    return skip;
+}
+
+/*
+ * Case-insensitive comparison of two names already checked by
+ * _msg_name_scan()
+ */
+static int
+_msg_name_eq(const u_char *msg, size_t a, size_t b)
+{
+    const u_char   *p = msg + a;
+    const u_char   *q = msg + b;
+    int             n;
+
+    while (1) {
+        while ((*p & NS_CMPRSFLGS) == NS_CMPRSFLGS)
+            p = msg + (((*p & ~NS_CMPRSFLGS) << 8) | p[1]);
+        while ((*q & NS_CMPRSFLGS) == NS_CMPRSFLGS)
+            q = msg + (((*q & ~NS_CMPRSFLGS) << 8) | q[1]);
+        if (p == q)
+            return 1;
+        n = *p;
+        if (n != *q)
+            return 0;
+        if (n == 0)
+            return 1;
+        if (!res_name_caseeq(p + 1, q + 1, n))
+            return 0;
+        p += n + 1;
+        q += n + 1;
+    }
+}
+
+/*
+ * Return 1 if [p, end) starts with a complete name that contains no
+ * compression pointers
+ */
+static int
+_msg_name_flat(const u_char *p, const u_char *end)
+{
+    size_t          len = 0;
+    int             n;
+
+    while (p < end) {
+        n = *p;
+        if (n & NS_CMPRSFLGS)
+            return 0;
+        len += n + 1;
+        if (len > NS_MAXCDNAME)
+            return 0;
+        if (n == 0)
+            return 1;
+        p += n + 1;
+    }
+    return 0;
+}
+
+/*
+ * Index count RRs starting at offset in msg.  Returns VAL_BAD_ARGUMENT
+ * if any of them is malformed or runs past the end of the message.
+ */
+int
+msg_index(struct msg_index *mi, u_char *msg, size_t len, size_t offset,
+          int count)
+{
+    struct msg_rr  *rr;
+    int            *table = NULL;
+    size_t          buckets, j;
+    u_int16_t       net_short;
+    u_int32_t       net_int;
+    u_int32_t       h;
+    int             i, k, skip;
+
+    if (mi == NULL || msg == NULL || count < 0)
+        return VAL_BAD_ARGUMENT;
+
+    memset(mi, 0, sizeof(struct msg_index));
+    mi->mi_msg = msg;
+    mi->mi_end = msg + len;
+    mi->mi_owner_group = -1;
+    if (count == 0)
+        return VAL_NO_ERROR;
+
+    mi->mi_rrs = (struct msg_rr *) arena_malloc(count * sizeof(struct msg_rr));
+    for (buckets = 16; buckets < 2 * (size_t) count; buckets <<= 1);
+    table = (int *) arena_malloc(buckets * sizeof(int));
+    if (mi->mi_rrs == NULL || table == NULL) {
+        arena_free(table);
+        msg_index_free(mi);
+        return VAL_OUT_OF_MEMORY;
+    }
+    memset(table, 0, buckets * sizeof(int));
+
+    for (i = 0; i < count; i++) {
+        rr = &mi->mi_rrs[i];
+
+        if ((skip = _msg_name_scan(msg, mi->mi_end, offset, &h)) < 0)
+            goto err;
+        rr->mr_owner = (u_int32_t) offset;
+        offset += skip;
+
+        /* type, class, ttl and rdata length */
+        if (offset + 3 * sizeof(u_int16_t) + sizeof(u_int32_t) > len)
+            goto err;
+        memcpy(&net_short, &msg[offset], sizeof(u_int16_t));
+        rr->mr_type_h = ntohs(net_short);
+        offset += sizeof(u_int16_t);
+        memcpy(&net_short, &msg[offset], sizeof(u_int16_t));
+        rr->mr_class_h = ntohs(net_short);
+        offset += sizeof(u_int16_t);
+        memcpy(&net_int, &msg[offset], sizeof(u_int32_t));
+        rr->mr_ttl_h = ntohl(net_int);
+        offset += sizeof(u_int32_t);
+        memcpy(&net_short, &msg[offset], sizeof(u_int16_t));
+        rr->mr_rdata_len = ntohs(net_short);
+        offset += sizeof(u_int16_t);
+
+        rr->mr_rdata = (u_int32_t) offset;
+        if (offset + rr->mr_rdata_len > len)
+            goto err;
+        offset += rr->mr_rdata_len;
+
+        if (rr->mr_type_h == ns_t_rrsig) {
+            if (rr->mr_rdata_len < sizeof(u_int16_t))
+                goto err;
+            memcpy(&net_short, &msg[rr->mr_rdata], sizeof(u_int16_t));
+            rr->mr_set_type_h = ntohs(net_short);
+        } else
+            rr->mr_set_type_h = rr->mr_type_h;
+
+        /* the next name is read in place when NSECs are paired with sigs */
+        if (rr->mr_type_h == ns_t_nsec &&
+            !_msg_name_flat(&msg[rr->mr_rdata],
+                            &msg[rr->mr_rdata] + rr->mr_rdata_len))
+            goto err;
+
+        h = MSG_HASH(MSG_HASH(h, rr->mr_set_type_h), rr->mr_class_h);
+        rr->mr_hash = h;
+        rr->mr_set = NULL;
+        rr->mr_list = NULL;
+
+        /* find the group, or start one */
+        rr->mr_group = i;
+        for (j = h & (buckets - 1); table[j]; j = (j + 1) & (buckets - 1)) {
+            k = table[j] - 1;
+            if (mi->mi_rrs[k].mr_hash == h &&
+                mi->mi_rrs[k].mr_set_type_h == rr->mr_set_type_h &&
+                mi->mi_rrs[k].mr_class_h == rr->mr_class_h &&
+                _msg_name_eq(msg, mi->mi_rrs[k].mr_owner, rr->mr_owner)) {
+                rr->mr_group = k;
+                break;
+            }
+        }
+        if (rr->mr_group == i)
+            table[j] = i + 1;
+    }
+
+    arena_free(table);
+    mi->mi_count = count;
+    return VAL_NO_ERROR;
+
+  err:
+    arena_free(table);
+    msg_index_free(mi);
+    return VAL_BAD_ARGUMENT;
+}
+
+void
+msg_index_free(struct msg_index *mi)
+{
+    if (mi == NULL)
+        return;
+    arena_free(mi->mi_rrs);
+    mi->mi_rrs = NULL;
+    mi->mi_count = 0;
+    mi->mi_owner_group = -1;
+}
+
+/*
+ * Unpack the owner name of RR i into name_n.  All RRs of a group share
+ * the owner of the group's first RR, and nothing is done if name_n
+ * already holds it; callers must pass the same buffer every time and
+ * leave its contents alone.
+ */
+int
+msg_owner(struct msg_index *mi, int i, u_char *name_n)
+{
+    int             group;
+
+    if (mi == NULL || name_n == NULL || i < 0 || i >= mi->mi_count)
+        return VAL_BAD_ARGUMENT;
+
+    group = mi->mi_rrs[i].mr_group;
+    if (group == mi->mi_owner_group)
+        return VAL_NO_ERROR;
+
+    if (ns_name_unpack(mi->mi_msg, mi->mi_end,
+                       mi->mi_msg + mi->mi_rrs[group].mr_owner,
+                       name_n, NS_MAXCDNAME) < 0) {
+        mi->mi_owner_group = -1;
+        return VAL_BAD_ARGUMENT;
+    }
+    mi->mi_owner_group = group;
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Return the RDATA of RR i with any compressed names expanded.  When
+ * there is nothing to expand *rdata points into the message itself and
+ * *copied is 0; otherwise *copied is 1 and the caller must FREE()
+ * *rdata, even if an error is returned.
+ */
+int
+msg_rdata(struct msg_index *mi, int i, u_char **rdata,
+          size_t *rdata_len_h, int *copied)
+{
+    struct msg_rr  *rr;
+    u_char         *p;
+
+    if (mi == NULL || rdata == NULL || rdata_len_h == NULL ||
+        copied == NULL || i < 0 || i >= mi->mi_count)
+        return VAL_BAD_ARGUMENT;
+
+    rr = &mi->mi_rrs[i];
+    p = mi->mi_msg + rr->mr_rdata;
+    *rdata = NULL;
+    *rdata_len_h = rr->mr_rdata_len;
+    *copied = 0;
+
+    switch (rr->mr_type_h) {
+    case ns_t_soa:
+    case ns_t_minfo:
+    case ns_t_rp:
+    case ns_t_ns:
+    case ns_t_cname:
+    case ns_t_dname:
+    case ns_t_mb:
+    case ns_t_mg:
+    case ns_t_mr:
+    case ns_t_md:
+    case ns_t_mf:
+    case ns_t_ptr:
+    case ns_t_srv:
+    case ns_t_rt:
+    case ns_t_mx:
+    case ns_t_afsdb:
+    case ns_t_kx:
+    case ns_t_px:
+        *copied = 1;
+        return decompress(rdata, mi->mi_msg, rr->mr_rdata, mi->mi_end,
+                          rr->mr_type_h, rdata_len_h);
+
+    case ns_t_rrsig:
+        /* the signer name must not be compressed, but check anyway */
+        if (rr->mr_rdata_len <= SIGNBY ||
+            !_msg_name_flat(p + SIGNBY, p + rr->mr_rdata_len)) {
+            *copied = 1;
+            return decompress(rdata, mi->mi_msg, rr->mr_rdata, mi->mi_end,
+                              rr->mr_type_h, rdata_len_h);
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    if (rr->mr_rdata_len > 0)
+        *rdata = p;
+    return VAL_NO_ERROR;
+}
+
+/*
+ * find_rr_set() for RR i of an indexed message.  The rrset found for
+ * the first RR of a group is remembered, so the remaining RRs of the
+ * group skip the search.  NSEC records and their signatures are matched
+ * on the signer as well as the owner, so they always take the search.
+ */
+struct rrset_rec *
+msg_find_rr_set(struct msg_index *mi, int i,
+                struct name_server *respondent_server,
+                struct rrset_rec **the_list,
+                u_char *name_n, u_char *hptr, u_char *rdata_n,
+                int from_section, int authoritive_answer,
+                int iterative_answer, u_char *zonecut_n)
+{
+    struct msg_rr  *rr;
+    struct msg_rr  *lead;
+    struct rrset_rec *rr_set;
+
+    if (mi == NULL || i < 0 || i >= mi->mi_count)
+        return NULL;
+
+    rr = &mi->mi_rrs[i];
+    lead = &mi->mi_rrs[rr->mr_group];
+
+    if (rr->mr_set_type_h != ns_t_nsec &&
+        lead->mr_set != NULL && lead->mr_list == the_list) {
+        if (lead->mr_set->rrs_ttl_h > rr->mr_ttl_h)
+            lead->mr_set->rrs_ttl_h = rr->mr_ttl_h;
+        return lead->mr_set;
+    }
+
+    rr_set = find_rr_set(respondent_server, the_list, name_n,
+                         rr->mr_type_h, rr->mr_set_type_h, rr->mr_class_h,
+                         rr->mr_ttl_h, hptr, rdata_n, from_section,
+                         authoritive_answer, iterative_answer, zonecut_n);
+    if (rr->mr_set_type_h != ns_t_nsec) {
+        lead->mr_set = rr_set;
+        lead->mr_list = the_list;
+    }
+    return rr_set;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+#ifndef VAL_MSG_H
+#define VAL_MSG_H
+
+/*
+ * One resource record of a received message.  Names and RDATA are
+ * not copied; they are located by their offsets in the message.
+ */
+struct msg_rr {
+    u_int32_t       mr_owner;       /* offset of the (compressed) owner */
+    u_int32_t       mr_rdata;       /* offset of the RDATA */
+    u_int16_t       mr_rdata_len;
+    u_int16_t       mr_type_h;
+    u_int16_t       mr_set_type_h;  /* type covered for RRSIGs */
+    u_int16_t       mr_class_h;
+    u_int32_t       mr_ttl_h;
+    u_int32_t       mr_hash;        /* owner, set type and class */
+    int             mr_group;       /* first RR with the same hash key */
+    /*
+     * Only used in the first RR of a group: the rrset last built
+     * from the group, and the list holding it
+     */
+    struct rrset_rec *mr_set;
+    struct rrset_rec **mr_list;
+};
+
+struct msg_index {
+    u_char         *mi_msg;
+    u_char         *mi_end;
+    int             mi_count;
+    int             mi_owner_group; /* group whose owner was last unpacked */
+    struct msg_rr  *mi_rrs;
+};
+
+int             msg_index(struct msg_index *mi, u_char *msg, size_t len,
+                          size_t offset, int count);
+void            msg_index_free(struct msg_index *mi);
+int             msg_owner(struct msg_index *mi, int i, u_char *name_n);
+int             msg_rdata(struct msg_index *mi, int i, u_char **rdata,
+                          size_t *rdata_len_h, int *copied);
+struct rrset_rec *msg_find_rr_set(struct msg_index *mi, int i,
+                                  struct name_server *respondent_server,
+                                  struct rrset_rec **the_list,
+                                  u_char *name_n, u_char *hptr,
+                                  u_char *rdata_n, int from_section,
+                                  int authoritive_answer,
+                                  int iterative_answer, u_char *zonecut_n);
+
+#endif
@@ -0,0 +1,251 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * Interned domain names.  Each distinct (case-insensitive) wire-format
+ * name is stored once, lower-cased, together with its length, label
+ * offsets and hash.  Structures that used to carry NS_MAXCDNAME sized
+ * arrays hold a reference to the interned copy instead, and two
+ * interned names are equal exactly when the pointers are equal.
+ *
+ * A handle is a pointer to the wire-format bytes, so it can be passed
+ * to any function that takes a u_char * name.  Handles are reference
+ * counted; every name_intern() or name_ref() must be matched by a
+ * name_release().
+ */
+#include "validator-internal.h"
+
+#include "val_names.h"
+
+#define NAME_MIN_BUCKETS    1024
+
+struct val_name {
+    struct val_name *vn_next;       /* hash bucket chain */
+    u_int32_t        vn_hash;
+    u_int32_t        vn_refcount;
+    u_char           vn_len;        /* wire length, including root label */
+    u_char           vn_labels;     /* labels, not counting the root */
+    u_char           vn_data[1];    /* name, then one offset per label */
+};
+
+#define NAME_ENTRY(n) \
+    ((struct val_name *) ((u_char *) (n) - offsetof(struct val_name, vn_data)))
+
+static struct val_name **name_table = NULL;
+static size_t   name_buckets = 0;
+static size_t   name_count = 0;
+static size_t   name_bytes = 0;
+
+#ifndef VAL_NO_THREADS
+static pthread_mutex_t name_lock = PTHREAD_MUTEX_INITIALIZER;
+#define NAME_LOCK()     pthread_mutex_lock(&name_lock)
+#define NAME_UNLOCK()   pthread_mutex_unlock(&name_lock)
+#else
+#define NAME_LOCK()
+#define NAME_UNLOCK()
+#endif
+
+static int
+_name_equal(const struct val_name *vn, const u_char *name_n, size_t len)
+{
+    return vn->vn_len == len && res_name_caseeq(vn->vn_data, name_n, len);
+}
+
+/*
+ * Double the number of buckets.  Failure to grow is not an error,
+ * lookups just get slower.  Caller must hold name_lock.
+ */
+static void
+_name_table_grow(void)
+{
+    struct val_name **table, *vn, *next;
+    size_t          buckets, i;
+
+    buckets = name_buckets ? name_buckets * 2 : NAME_MIN_BUCKETS;
+    table = (struct val_name **) MALLOC(buckets * sizeof(struct val_name *));
+    if (table == NULL)
+        return;
+    memset(table, 0, buckets * sizeof(struct val_name *));
+
+    for (i = 0; i < name_buckets; i++) {
+        for (vn = name_table[i]; vn; vn = next) {
+            next = vn->vn_next;
+            vn->vn_next = table[vn->vn_hash & (buckets - 1)];
+            table[vn->vn_hash & (buckets - 1)] = vn;
+        }
+    }
+    if (name_table)
+        FREE(name_table);
+    name_table = table;
+    name_buckets = buckets;
+}
+
+/*
+ * Return a reference to the interned copy of name_n, adding it to the
+ * table if needed.  Returns NULL if name_n is not a valid wire-format
+ * name or on memory allocation failure.
+ */
+u_char *
+name_intern(const u_char *name_n)
+{
+    struct val_name *vn;
+    size_t          len, off, labels;
+    u_int32_t       hash;
+
+    if (name_n == NULL || 0 == (len = wire_name_length(name_n)))
+        return NULL;
+
+    hash = res_name_hash(name_n, len, 0);
+
+    NAME_LOCK();
+
+    if (name_count >= name_buckets)
+        _name_table_grow();
+    if (name_table == NULL) {
+        NAME_UNLOCK();
+        return NULL;
+    }
+
+    for (vn = name_table[hash & (name_buckets - 1)]; vn; vn = vn->vn_next) {
+        if (vn->vn_hash == hash && _name_equal(vn, name_n, len)) {
+            vn->vn_refcount++;
+            NAME_UNLOCK();
+            return vn->vn_data;
+        }
+    }
+
+    for (labels = 0, off = 0; name_n[off]; off += name_n[off] + 1)
+        labels++;
+
+    /* room for the name and its label offsets */
+    vn = (struct val_name *) MALLOC(sizeof(struct val_name) + len + labels);
+    if (vn == NULL) {
+        NAME_UNLOCK();
+        return NULL;
+    }
+    vn->vn_hash = hash;
+    vn->vn_refcount = 1;
+    vn->vn_len = (u_char) len;
+    vn->vn_labels = (u_char) labels;
+    res_name_lower(vn->vn_data, name_n, len);
+    for (labels = 0, off = 0; name_n[off]; off += name_n[off] + 1)
+        vn->vn_data[len + labels++] = (u_char) off;
+
+    vn->vn_next = name_table[hash & (name_buckets - 1)];
+    name_table[hash & (name_buckets - 1)] = vn;
+    name_count++;
+    name_bytes += sizeof(struct val_name) + len + vn->vn_labels;
+
+    NAME_UNLOCK();
+    return vn->vn_data;
+}
+
+/*
+ * Take another reference to an interned name
+ */
+u_char *
+name_ref(u_char *name)
+{
+    if (name == NULL)
+        return NULL;
+
+    NAME_LOCK();
+    NAME_ENTRY(name)->vn_refcount++;
+    NAME_UNLOCK();
+    return name;
+}
+
+/*
+ * Drop a reference to an interned name, freeing it with the last one
+ */
+void
+name_release(u_char *name)
+{
+    struct val_name *vn, **prev;
+
+    if (name == NULL)
+        return;
+
+    vn = NAME_ENTRY(name);
+
+    NAME_LOCK();
+    if (--vn->vn_refcount > 0) {
+        NAME_UNLOCK();
+        return;
+    }
+    for (prev = &name_table[vn->vn_hash & (name_buckets - 1)]; *prev;
+         prev = &(*prev)->vn_next) {
+        if (*prev == vn) {
+            *prev = vn->vn_next;
+            break;
+        }
+    }
+    name_count--;
+    name_bytes -= sizeof(struct val_name) + vn->vn_len + vn->vn_labels;
+    NAME_UNLOCK();
+
+    FREE(vn);
+}
+
+/*
+ * Replace the name held in *slot with a reference to name_n.  The old
+ * reference is released only if the new one could be taken.
+ */
+int
+name_assign(u_char **slot, const u_char *name_n)
+{
+    u_char         *name;
+
+    if (slot == NULL)
+        return VAL_BAD_ARGUMENT;
+    if (NULL == (name = name_intern(name_n)))
+        return (name_n == NULL) ? VAL_BAD_ARGUMENT : VAL_OUT_OF_MEMORY;
+    name_release(*slot);
+    *slot = name;
+    return VAL_NO_ERROR;
+}
+
+size_t
+name_len(const u_char *name)
+{
+    return name ? NAME_ENTRY(name)->vn_len : 0;
+}
+
+u_int32_t
+name_hash(const u_char *name)
+{
+    return name ? NAME_ENTRY(name)->vn_hash : 0;
+}
+
+/*
+ * Number of labels in an interned name, not counting the root; if
+ * offsets is not NULL it is set to the offset of each label.
+ */
+int
+name_labels(const u_char *name, const u_char **offsets)
+{
+    struct val_name *vn;
+
+    if (name == NULL)
+        return 0;
+    vn = NAME_ENTRY(name);
+    if (offsets)
+        *offsets = vn->vn_data + vn->vn_len;
+    return vn->vn_labels;
+}
+
+/*
+ * Number of distinct names and the memory they use
+ */
+void
+name_table_stats(size_t *count, size_t *bytes)
+{
+    NAME_LOCK();
+    if (count)
+        *count = name_count;
+    if (bytes)
+        *bytes = name_bytes + name_buckets * sizeof(struct val_name *);
+    NAME_UNLOCK();
+}
@@ -0,0 +1,17 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+#ifndef VAL_NAMES_H
+#define VAL_NAMES_H
+
+u_char         *name_intern(const u_char *name_n);
+u_char         *name_ref(u_char *name);
+void            name_release(u_char *name);
+int             name_assign(u_char **slot, const u_char *name_n);
+size_t          name_len(const u_char *name);
+u_int32_t       name_hash(const u_char *name);
+int             name_labels(const u_char *name, const u_char **offsets);
+void            name_table_stats(size_t *count, size_t *bytes);
+
+#endif
@@ -13,6 +13,8 @@
 #include "val_policy.h"
 #include "val_support.h"
 #include "val_cache.h"
+#include "val_shmcache.h"
+#include "val_trace.h"
 #include "val_resquery.h"
 #include "val_context.h"
 #include "val_assertion.h"
@@ -247,6 +249,16 @@ set_global_opt_defaults(val_global_opt_t *gopt)
     gopt->proto = VAL_POL_GOPT_PROTO_ANY;
     gopt->timeout = RES_TIMEOUT;
     gopt->retry = RES_RETRY;
+    gopt->prefetch = 0;
+    gopt->prefetch_hits = VAL_POL_GOPT_PREFETCH_HITS;
+    gopt->serve_stale = 0;
+    gopt->serve_stale_timeout = VAL_POL_GOPT_STALE_TIMEOUT;
+    gopt->async_window = VAL_POL_GOPT_ASYNC_WINDOW;
+    gopt->max_cache_size = 0;
+    gopt->shared_cache = NULL;
+    gopt->shared_cache_size = VAL_POL_GOPT_SHARED_CACHE_SIZE;
+    gopt->trace = NULL;
+    gopt->dns_port = DNS_PORT;
 }
 
 int 
@@ -263,7 +275,7 @@ update_dynamic_gopt(val_global_opt_t **g_new, val_global_opt_t *g)
         set_global_opt_defaults(*g_new);
     }
 
-    /* NOTE: We must not update log_target */
+    /* NOTE: We must not update log_target, shared_cache or trace */
 
     if (g->local_is_trusted != VAL_POL_GOPT_UNSET)
         (*g_new)->local_is_trusted = g->local_is_trusted;        
@@ -285,6 +297,22 @@ update_dynamic_gopt(val_global_opt_t **g_new, val_global_opt_t *g)
         (*g_new)->timeout = g->timeout;        
     if (g->retry != VAL_POL_GOPT_UNSET)
         (*g_new)->retry = g->retry;        
+    if (g->prefetch != VAL_POL_GOPT_UNSET)
+        (*g_new)->prefetch = g->prefetch;        
+    if (g->prefetch_hits != VAL_POL_GOPT_UNSET)
+        (*g_new)->prefetch_hits = g->prefetch_hits;        
+    if (g->serve_stale != VAL_POL_GOPT_UNSET)
+        (*g_new)->serve_stale = g->serve_stale;        
+    if (g->serve_stale_timeout != VAL_POL_GOPT_UNSET)
+        (*g_new)->serve_stale_timeout = g->serve_stale_timeout;        
+    if (g->async_window != VAL_POL_GOPT_UNSET)
+        (*g_new)->async_window = g->async_window;        
+    if (g->max_cache_size != VAL_POL_GOPT_UNSET)
+        (*g_new)->max_cache_size = g->max_cache_size;        
+    if (g->shared_cache_size != VAL_POL_GOPT_UNSET)
+        (*g_new)->shared_cache_size = g->shared_cache_size;        
+    if (g->dns_port != VAL_POL_GOPT_UNSET)
+        (*g_new)->dns_port = g->dns_port;        
 
     return VAL_NO_ERROR;
 }
@@ -295,6 +323,10 @@ free_global_options(val_global_opt_t *g)
     if (g) {
         if (g->log_target)
             FREE(g->log_target);
+        if (g->shared_cache)
+            FREE(g->shared_cache);
+        if (g->trace)
+            FREE(g->trace);
     }
 }
 
@@ -312,6 +344,7 @@ const struct policy_conf_element conf_elem_array[MAX_POL_TOKEN] = {
      free_prov_insecure_status},
     {POL_ZONE_SE_STR, parse_zone_security_expectation,
      free_zone_security_expectation},
+    {POL_ZONE_MIRROR_STR, parse_zone_mirror, free_zone_mirror},
 #ifdef LIBVAL_NSEC3
     {POL_NSEC3_MAX_ITER_STR, parse_nsec3_max_iter, free_nsec3_max_iter},
 #endif
@@ -549,6 +582,53 @@ free_zone_security_expectation(policy_entry_t * pol_entry)
     return VAL_NO_ERROR;
 }
 
+/*
+ * parse additional data (zone file name) for the zone mirror policy 
+ */
+int
+parse_zone_mirror(char **buf_ptr, char *end_ptr, policy_entry_t * pol_entry, 
+                  int *line_number, int *endst)
+{
+    char            file_token[TOKEN_MAX];
+    struct zone_mirror_policy *zm_pol;
+    int             retval;
+
+    if ((buf_ptr == NULL) || (*buf_ptr == NULL) || (end_ptr == NULL) || 
+        (pol_entry == NULL) || (line_number == NULL) || (endst == NULL))
+        return VAL_BAD_ARGUMENT;
+
+    READ_POL_FOR_ZONE(buf_ptr, end_ptr, line_number, endst, retval, err, file_token);
+
+    zm_pol = (struct zone_mirror_policy *)
+            MALLOC(sizeof(struct zone_mirror_policy));
+    if (zm_pol == NULL) {
+        return VAL_OUT_OF_MEMORY;
+    }
+    zm_pol->file = (char *) MALLOC(strlen(file_token) + 1);
+    if (zm_pol->file == NULL) {
+        FREE(zm_pol);
+        return VAL_OUT_OF_MEMORY;
+    }
+    strcpy(zm_pol->file, file_token);
+
+    pol_entry->pol = zm_pol;
+
+    return VAL_NO_ERROR;
+}
+
+int
+free_zone_mirror(policy_entry_t * pol_entry)
+{
+    struct zone_mirror_policy *zm_pol;
+
+    if (pol_entry && pol_entry->pol) {
+        zm_pol = (struct zone_mirror_policy *) pol_entry->pol;
+        if (zm_pol->file)
+            FREE(zm_pol->file);
+        FREE(zm_pol);
+    }
+    return VAL_NO_ERROR;
+}
 
 #ifdef LIBVAL_NSEC3
 /*
@@ -1165,6 +1245,316 @@ parse_retry(char **buf_ptr, char *end_ptr, int *line_number,
     return VAL_NO_ERROR;
 }
 
+static int
+parse_prefetch(char **buf_ptr, char *end_ptr, int *line_number,
+               int *endst, val_global_opt_t *g_opt)
+{
+    char            token[TOKEN_MAX];
+    int retval;
+
+    if ((buf_ptr == NULL) || (*buf_ptr == NULL) || (end_ptr == NULL) || 
+        (g_opt == NULL) || (endst == NULL) || (line_number == NULL))
+        return VAL_BAD_ARGUMENT;
+
+    /* read the next token */
+    if (VAL_NO_ERROR != (retval = 
+        val_get_token(buf_ptr, end_ptr, line_number, 
+                      token, sizeof(token), endst,
+                      CONF_COMMENT, CONF_END_STMT, 0))) {
+        return retval;
+    }
+    if ((endst && (strlen(token) == 0)) ||
+        (*buf_ptr >= end_ptr)) { 
+        return VAL_CONF_PARSE_ERROR;
+    }
+
+    /* percentage of the TTL after which a refresh is attempted */
+    g_opt->prefetch = strtol(token, (char **)NULL, 10);
+    if (g_opt->prefetch < 0 || g_opt->prefetch >= 100)
+        return VAL_CONF_PARSE_ERROR;
+
+    return VAL_NO_ERROR;
+}
+
+static int
+parse_prefetch_hits(char **buf_ptr, char *end_ptr, int *line_number,
+                    int *endst, val_global_opt_t *g_opt)
+{
+    char            token[TOKEN_MAX];
+    int retval;
+
+    if ((buf_ptr == NULL) || (*buf_ptr == NULL) || (end_ptr == NULL) || 
+        (g_opt == NULL) || (endst == NULL) || (line_number == NULL))
+        return VAL_BAD_ARGUMENT;
+
+    /* read the next token */
+    if (VAL_NO_ERROR != (retval = 
+        val_get_token(buf_ptr, end_ptr, line_number, 
+                      token, sizeof(token), endst,
+                      CONF_COMMENT, CONF_END_STMT, 0))) {
+        return retval;
+    }
+    if ((endst && (strlen(token) == 0)) ||
+        (*buf_ptr >= end_ptr)) { 
+        return VAL_CONF_PARSE_ERROR;
+    }
+
+    g_opt->prefetch_hits = strtol(token, (char **)NULL, 10);
+    if (g_opt->prefetch_hits < 1)
+        return VAL_CONF_PARSE_ERROR;
+
+    return VAL_NO_ERROR;
+}
+
+static int
+parse_async_window(char **buf_ptr, char *end_ptr, int *line_number,
+                   int *endst, val_global_opt_t *g_opt)
+{
+    char            token[TOKEN_MAX];
+    int retval;
+
+    if ((buf_ptr == NULL) || (*buf_ptr == NULL) || (end_ptr == NULL) || 
+        (g_opt == NULL) || (endst == NULL) || (line_number == NULL))
+        return VAL_BAD_ARGUMENT;
+
+    /* read the next token */
+    if (VAL_NO_ERROR != (retval = 
+        val_get_token(buf_ptr, end_ptr, line_number, 
+                      token, sizeof(token), endst,
+                      CONF_COMMENT, CONF_END_STMT, 0))) {
+        return retval;
+    }
+    if ((endst && (strlen(token) == 0)) ||
+        (*buf_ptr >= end_ptr)) { 
+        return VAL_CONF_PARSE_ERROR;
+    }
+
+    g_opt->async_window = strtol(token, (char **)NULL, 10);
+    if (g_opt->async_window < 0)
+        return VAL_CONF_PARSE_ERROR;
+
+    return VAL_NO_ERROR;
+}
+
+static int
+parse_max_cache_size(char **buf_ptr, char *end_ptr, int *line_number,
+                     int *endst, val_global_opt_t *g_opt)
+{
+    char            token[TOKEN_MAX];
+    int retval;
+
+    if ((buf_ptr == NULL) || (*buf_ptr == NULL) || (end_ptr == NULL) || 
+        (g_opt == NULL) || (endst == NULL) || (line_number == NULL))
+        return VAL_BAD_ARGUMENT;
+
+    /* read the next token */
+    if (VAL_NO_ERROR != (retval = 
+        val_get_token(buf_ptr, end_ptr, line_number, 
+                      token, sizeof(token), endst,
+                      CONF_COMMENT, CONF_END_STMT, 0))) {
+        return retval;
+    }
+    if ((endst && (strlen(token) == 0)) ||
+        (*buf_ptr >= end_ptr)) { 
+        return VAL_CONF_PARSE_ERROR;
+    }
+
+    /* bytes held by the rrset cache, 0 for no limit */
+    g_opt->max_cache_size = strtol(token, (char **)NULL, 10);
+    if (g_opt->max_cache_size < 0)
+        return VAL_CONF_PARSE_ERROR;
+
+    return VAL_NO_ERROR;
+}
+
+static int
+parse_dns_port(char **buf_ptr, char *end_ptr, int *line_number,
+               int *endst, val_global_opt_t *g_opt)
+{
+    char            token[TOKEN_MAX];
+    int retval;
+
+    if ((buf_ptr == NULL) || (*buf_ptr == NULL) || (end_ptr == NULL) || 
+        (g_opt == NULL) || (endst == NULL) || (line_number == NULL))
+        return VAL_BAD_ARGUMENT;
+
+    /* read the next token */
+    if (VAL_NO_ERROR != (retval = 
+        val_get_token(buf_ptr, end_ptr, line_number, 
+                      token, sizeof(token), endst,
+                      CONF_COMMENT, CONF_END_STMT, 0))) {
+        return retval;
+    }
+    if ((endst && (strlen(token) == 0)) ||
+        (*buf_ptr >= end_ptr)) { 
+        return VAL_CONF_PARSE_ERROR;
+    }
+
+    /* port of the name servers learned from root hints and referrals */
+    g_opt->dns_port = strtol(token, (char **)NULL, 10);
+    if (g_opt->dns_port < 1 || g_opt->dns_port > 65535)
+        return VAL_CONF_PARSE_ERROR;
+
+    return VAL_NO_ERROR;
+}
+
+static int
+parse_shared_cache(char **buf_ptr, char *end_ptr, int *line_number,
+                   int *endst, val_global_opt_t *g_opt)
+{
+    char            token[TOKEN_MAX];
+    int retval;
+
+    if ((buf_ptr == NULL) || (*buf_ptr == NULL) || (end_ptr == NULL) || 
+        (g_opt == NULL) || (endst == NULL) || (line_number == NULL))
+        return VAL_BAD_ARGUMENT;
+
+    /* read the next token */
+    if (VAL_NO_ERROR != (retval = 
+        val_get_token(buf_ptr, end_ptr, line_number, 
+                      token, sizeof(token), endst,
+                      CONF_COMMENT, CONF_END_STMT, 0))) {
+        return retval;
+    }
+    if ((endst && (strlen(token) == 0)) ||
+        (*buf_ptr >= end_ptr)) { 
+        return VAL_CONF_PARSE_ERROR;
+    }
+
+    if (g_opt->shared_cache)
+        FREE(g_opt->shared_cache);
+    g_opt->shared_cache = (char *) MALLOC (strlen(token) + 1);
+    if (g_opt->shared_cache == NULL)
+        return VAL_OUT_OF_MEMORY;
+    strcpy(g_opt->shared_cache, token);
+    return VAL_NO_ERROR;
+}
+
+static int
+parse_trace(char **buf_ptr, char *end_ptr, int *line_number,
+            int *endst, val_global_opt_t *g_opt)
+{
+    char            token[TOKEN_MAX];
+    int retval;
+
+    if ((buf_ptr == NULL) || (*buf_ptr == NULL) || (end_ptr == NULL) || 
+        (g_opt == NULL) || (endst == NULL) || (line_number == NULL))
+        return VAL_BAD_ARGUMENT;
+
+    /* read the next token */
+    if (VAL_NO_ERROR != (retval = 
+        val_get_token(buf_ptr, end_ptr, line_number, 
+                      token, sizeof(token), endst,
+                      CONF_COMMENT, CONF_END_STMT, 0))) {
+        return retval;
+    }
+    if ((endst && (strlen(token) == 0)) ||
+        (*buf_ptr >= end_ptr)) { 
+        return VAL_CONF_PARSE_ERROR;
+    }
+
+    if (g_opt->trace)
+        FREE(g_opt->trace);
+    g_opt->trace = (char *) MALLOC (strlen(token) + 1);
+    if (g_opt->trace == NULL)
+        return VAL_OUT_OF_MEMORY;
+    strcpy(g_opt->trace, token);
+    return VAL_NO_ERROR;
+}
+
+static int
+parse_shared_cache_size(char **buf_ptr, char *end_ptr, int *line_number,
+                        int *endst, val_global_opt_t *g_opt)
+{
+    char            token[TOKEN_MAX];
+    int retval;
+
+    if ((buf_ptr == NULL) || (*buf_ptr == NULL) || (end_ptr == NULL) || 
+        (g_opt == NULL) || (endst == NULL) || (line_number == NULL))
+        return VAL_BAD_ARGUMENT;
+
+    /* read the next token */
+    if (VAL_NO_ERROR != (retval = 
+        val_get_token(buf_ptr, end_ptr, line_number, 
+                      token, sizeof(token), endst,
+                      CONF_COMMENT, CONF_END_STMT, 0))) {
+        return retval;
+    }
+    if ((endst && (strlen(token) == 0)) ||
+        (*buf_ptr >= end_ptr)) { 
+        return VAL_CONF_PARSE_ERROR;
+    }
+
+    /* size of a newly created shared cache file, in bytes */
+    g_opt->shared_cache_size = strtol(token, (char **)NULL, 10);
+    if (g_opt->shared_cache_size <= 0)
+        return VAL_CONF_PARSE_ERROR;
+
+    return VAL_NO_ERROR;
+}
+
+static int
+parse_serve_stale(char **buf_ptr, char *end_ptr, int *line_number,
+                  int *endst, val_global_opt_t *g_opt)
+{
+    char            token[TOKEN_MAX];
+    int retval;
+
+    if ((buf_ptr == NULL) || (*buf_ptr == NULL) || (end_ptr == NULL) || 
+        (g_opt == NULL) || (endst == NULL) || (line_number == NULL))
+        return VAL_BAD_ARGUMENT;
+
+    /* read the next token */
+    if (VAL_NO_ERROR != (retval = 
+        val_get_token(buf_ptr, end_ptr, line_number, 
+                      token, sizeof(token), endst,
+                      CONF_COMMENT, CONF_END_STMT, 0))) {
+        return retval;
+    }
+    if ((endst && (strlen(token) == 0)) ||
+        (*buf_ptr >= end_ptr)) { 
+        return VAL_CONF_PARSE_ERROR;
+    }
+
+    /* maximum age, in seconds, of a stale answer */
+    g_opt->serve_stale = strtol(token, (char **)NULL, 10);
+    if (g_opt->serve_stale < 0)
+        return VAL_CONF_PARSE_ERROR;
+
+    return VAL_NO_ERROR;
+}
+
+static int
+parse_serve_stale_timeout(char **buf_ptr, char *end_ptr, int *line_number,
+                          int *endst, val_global_opt_t *g_opt)
+{
+    char            token[TOKEN_MAX];
+    int retval;
+
+    if ((buf_ptr == NULL) || (*buf_ptr == NULL) || (end_ptr == NULL) || 
+        (g_opt == NULL) || (endst == NULL) || (line_number == NULL))
+        return VAL_BAD_ARGUMENT;
+
+    /* read the next token */
+    if (VAL_NO_ERROR != (retval = 
+        val_get_token(buf_ptr, end_ptr, line_number, 
+                      token, sizeof(token), endst,
+                      CONF_COMMENT, CONF_END_STMT, 0))) {
+        return retval;
+    }
+    if ((endst && (strlen(token) == 0)) ||
+        (*buf_ptr >= end_ptr)) { 
+        return VAL_CONF_PARSE_ERROR;
+    }
+
+    /* milliseconds to wait before falling back to a stale answer */
+    g_opt->serve_stale_timeout = strtol(token, (char **)NULL, 10);
+    if (g_opt->serve_stale_timeout < 0)
+        return VAL_CONF_PARSE_ERROR;
+
+    return VAL_NO_ERROR;
+}
+
 static int
 get_global_options(char **buf_ptr, char *end_ptr, 
                    int *line_number, val_global_opt_t **g_opt) 
@@ -1273,6 +1663,76 @@ get_global_options(char **buf_ptr, char *end_ptr,
                 goto err;
             }
 
+        } else if (!strcmp(token, GOPT_PREFETCH)) {
+            if (VAL_NO_ERROR != 
+                    (retval = parse_prefetch(buf_ptr, end_ptr,
+                                             line_number, &endst, *g_opt))) {
+                goto err;
+            }
+
+        } else if (!strcmp(token, GOPT_PREFETCH_HITS)) {
+            if (VAL_NO_ERROR != 
+                    (retval = parse_prefetch_hits(buf_ptr, end_ptr,
+                                                  line_number, &endst, *g_opt))) {
+                goto err;
+            }
+
+        } else if (!strcmp(token, GOPT_SERVE_STALE)) {
+            if (VAL_NO_ERROR != 
+                    (retval = parse_serve_stale(buf_ptr, end_ptr,
+                                                line_number, &endst, *g_opt))) {
+                goto err;
+            }
+
+        } else if (!strcmp(token, GOPT_SERVE_STALE_TIMEOUT)) {
+            if (VAL_NO_ERROR != 
+                    (retval = parse_serve_stale_timeout(buf_ptr, end_ptr,
+                                                        line_number, &endst, *g_opt))) {
+                goto err;
+            }
+
+        } else if (!strcmp(token, GOPT_ASYNC_WINDOW)) {
+            if (VAL_NO_ERROR != 
+                    (retval = parse_async_window(buf_ptr, end_ptr,
+                                                 line_number, &endst, *g_opt))) {
+                goto err;
+            }
+
+        } else if (!strcmp(token, GOPT_MAX_CACHE_SIZE)) {
+            if (VAL_NO_ERROR != 
+                    (retval = parse_max_cache_size(buf_ptr, end_ptr,
+                                                   line_number, &endst, *g_opt))) {
+                goto err;
+            }
+
+        } else if (!strcmp(token, GOPT_DNS_PORT)) {
+            if (VAL_NO_ERROR != 
+                    (retval = parse_dns_port(buf_ptr, end_ptr,
+                                             line_number, &endst, *g_opt))) {
+                goto err;
+            }
+
+        } else if (!strcmp(token, GOPT_SHARED_CACHE)) {
+            if (VAL_NO_ERROR != 
+                    (retval = parse_shared_cache(buf_ptr, end_ptr,
+                                                 line_number, &endst, *g_opt))) {
+                goto err;
+            }
+
+        } else if (!strcmp(token, GOPT_SHARED_CACHE_SIZE)) {
+            if (VAL_NO_ERROR != 
+                    (retval = parse_shared_cache_size(buf_ptr, end_ptr,
+                                                      line_number, &endst, *g_opt))) {
+                goto err;
+            }
+
+        } else if (!strcmp(token, GOPT_TRACE)) {
+            if (VAL_NO_ERROR != 
+                    (retval = parse_trace(buf_ptr, end_ptr,
+                                          line_number, &endst, *g_opt))) {
+                goto err;
+            }
+
         } else {
             retval = VAL_CONF_PARSE_ERROR;
             goto err;
@@ -1679,7 +2139,7 @@ read_next_val_config_file(val_context_t *ctx,
     fd = open(dnsval_c->dnsval_conf, O_RDONLY);
 
     if (fd < 0) {
-        val_log(ctx, LOG_ERR, 
+        VAL_LOG(ctx, LOG_ERR, 
                 "read_next_val_config_file(): Could not open validator conf file for reading: %s",
                 dnsval_c->dnsval_conf);
 
@@ -1693,7 +2153,7 @@ read_next_val_config_file(val_context_t *ctx,
             retval = VAL_CONF_NOT_FOUND;
             goto err;
         }
-        val_log(ctx, LOG_INFO, 
+        VAL_LOG(ctx, LOG_INFO, 
                 "read_next_val_config_file(): Using inline validator configuration data");
         buf = (char *) MALLOC (bufsize * sizeof(char));
         if (buf == NULL) {
@@ -1706,14 +2166,14 @@ read_next_val_config_file(val_context_t *ctx,
         memset(&fl, 0, sizeof(fl));
         fl.l_type = F_RDLCK;
         if (-1 == fcntl(fd, F_SETLK, &fl)) {
-            val_log(ctx, LOG_WARNING, 
+            VAL_LOG(ctx, LOG_WARNING, 
                 "read_next_val_config_file(): Could not acquire shared lock on conf file: %s", 
                 dnsval_c->dnsval_conf);
             goto err; 
         }
 #endif
         if (0 != fstat(fd, &sb)) {
-            val_log(ctx, LOG_ERR, 
+            VAL_LOG(ctx, LOG_ERR, 
                 "read_next_val_config_file(): Could not stat validator conf file: %s",
                 dnsval_c->dnsval_conf);
             retval = VAL_CONF_NOT_FOUND;
@@ -1729,7 +2189,7 @@ read_next_val_config_file(val_context_t *ctx,
         }
 
         if (-1 == read(fd, buf, bufsize)) {
-            val_log(ctx, LOG_ERR, "read_next_val_config_file(): Could not read validator conf file: %s",
+            VAL_LOG(ctx, LOG_ERR, "read_next_val_config_file(): Could not read validator conf file: %s",
                     dnsval_c->dnsval_conf);
             retval = VAL_CONF_NOT_FOUND;
             goto err;
@@ -1742,9 +2202,9 @@ read_next_val_config_file(val_context_t *ctx,
         fd = -1;
     }
 
-    val_log(ctx, LOG_NOTICE, "read_next_val_config_file(): Reading validator policy from %s",
+    VAL_LOG(ctx, LOG_NOTICE, "read_next_val_config_file(): Reading validator policy from %s",
             dnsval_c->dnsval_conf);
-    val_log(ctx, LOG_DEBUG, "read_next_val_config_file(): Reading next policy fragment");
+    VAL_LOG(ctx, LOG_DEBUG, "read_next_val_config_file(): Reading next policy fragment");
 
     while (!done) {
 
@@ -1780,7 +2240,7 @@ read_next_val_config_file(val_context_t *ctx,
                 if (VAL_NO_ERROR != (retval =
                         get_global_options(&buf_ptr, end_ptr, 
                                           &line_number, &gt_opt))) {
-                    val_log(ctx, LOG_ERR, 
+                    VAL_LOG(ctx, LOG_ERR, 
                             "read_next_val_config_file(): Error in line %d of %s ",
                             line_number, dnsval_c->dnsval_conf);
                     goto err;
@@ -1791,7 +2251,7 @@ read_next_val_config_file(val_context_t *ctx,
                      * re-definition of global options 
                      * or global options was not in the first file
                      */
-                    val_log(ctx, LOG_WARNING, 
+                    VAL_LOG(ctx, LOG_WARNING, 
                             "read_next_val_config_file(): Ignoring global options from line %d of %s",
                             line_number, dnsval_c->dnsval_conf);
                     free_global_options(gt_opt);
@@ -1799,7 +2259,7 @@ read_next_val_config_file(val_context_t *ctx,
                     gt_opt = NULL;
                 } else {
                     *g_opt = gt_opt;
-                    val_log(ctx, LOG_DEBUG, 
+                    VAL_LOG(ctx, LOG_DEBUG, 
                             "read_next_val_config_file(): Using global options from line %d of %s",
                             line_number, dnsval_c->dnsval_conf);
                     
@@ -1807,7 +2267,7 @@ read_next_val_config_file(val_context_t *ctx,
                             (*label == NULL && gt_opt->env_policy == VAL_POL_GOPT_ENABLE)) {
                         next_label = getenv(VAL_CONTEXT_LABEL);
                         if (next_label != NULL) {
-                            val_log(ctx, LOG_NOTICE, 
+                            VAL_LOG(ctx, LOG_NOTICE, 
                                     "read_next_val_config_file(): Using policy label from environment: %s",
                                     next_label);
                             done = 0;
@@ -1821,7 +2281,7 @@ read_next_val_config_file(val_context_t *ctx,
                             (*label == NULL && gt_opt->app_policy == VAL_POL_GOPT_ENABLE)) {
                         const char *c_next_label = getprogname();
                         if (c_next_label != NULL) {
-                            val_log(ctx, LOG_NOTICE, 
+                            VAL_LOG(ctx, LOG_NOTICE, 
                                     "read_next_val_config_file(): Using policy label from app name: %s",
                                     c_next_label);
                             done = 0;
@@ -1842,13 +2302,13 @@ read_next_val_config_file(val_context_t *ctx,
                         val_get_token(&buf_ptr, end_ptr, &line_number, 
                                       token, sizeof(token), &endst,
                                       CONF_COMMENT, CONF_END_STMT, 0))) {
-                    val_log(ctx, LOG_ERR, 
+                    VAL_LOG(ctx, LOG_ERR, 
                             "read_next_val_config_file(): Error in line %d of %s ",
                             line_number, dnsval_c->dnsval_conf);
                     goto err;
                 }
                 if ((endst && (strlen(token) == 0)) || (buf_ptr >= end_ptr)) { 
-                    val_log(ctx, LOG_ERR, 
+                    VAL_LOG(ctx, LOG_ERR, 
                             "read_next_val_config_file(): Error in line %d of %s ",
                             line_number, dnsval_c->dnsval_conf);
                     retval = VAL_CONF_PARSE_ERROR;
@@ -1879,7 +2339,7 @@ read_next_val_config_file(val_context_t *ctx,
                         (strlen(token) + strlen(cp1) - strlen(env_token) 
                             >= TOKEN_MAX)) {
 
-                        val_log(ctx, LOG_ERR, 
+                        VAL_LOG(ctx, LOG_ERR, 
                             "read_next_val_config_file(): Unknown environment"
                             "variable in line %d of %s ", 
                             line_number, dnsval_c->dnsval_conf);
@@ -1923,7 +2383,7 @@ read_next_val_config_file(val_context_t *ctx,
                 /* check if filename already exists in the list */
                 for (dnsval_temp=dlist; dnsval_temp; dnsval_temp=dnsval_temp->next) {
                     if (!strcmp(dnsval_temp->dnsval_conf, token)) {
-                        val_log(ctx, LOG_ERR, 
+                        VAL_LOG(ctx, LOG_ERR, 
                                 "read_next_val_config_file(): File already included, possible loop in line %d of %s ",
                                 line_number, dnsval_c->dnsval_conf);
                         retval = VAL_CONF_PARSE_ERROR;
@@ -1967,7 +2427,7 @@ read_next_val_config_file(val_context_t *ctx,
     }
 
     if (retval != VAL_NO_ERROR) {
-        val_log(ctx, LOG_ERR, "read_next_val_config_file(): Error in line %d of %s", line_number,
+        VAL_LOG(ctx, LOG_ERR, "read_next_val_config_file(): Error in line %d of %s", line_number,
                 dnsval_c->dnsval_conf);
         goto err;
     } 
@@ -2169,6 +2629,14 @@ skipfileread:
             goto err;
     }
 
+    /* the rrset cache is shared, so the latest configuration sizes it */
+    set_cache_max_size(ctx->g_opt->max_cache_size);
+    if (ctx->g_opt->shared_cache)
+        shm_cache_open(ctx->g_opt->shared_cache,
+                       ctx->g_opt->shared_cache_size);
+    if (ctx->g_opt->trace)
+        val_trace_open(ctx->g_opt->trace);
+
     /* 
      * Free the query cache 
      */
@@ -2180,7 +2648,7 @@ skipfileread:
 
     ctx->dnsval_l = dlist;
 
-    val_log(ctx, LOG_DEBUG, "read_val_config_file(): Done reading validator configuration");
+    VAL_LOG(ctx, LOG_DEBUG, "read_val_config_file(): Done reading validator configuration");
 
     return VAL_NO_ERROR;
 
@@ -2257,7 +2725,7 @@ read_res_config_file(val_context_t * ctx)
 
         ns = parse_name_server(property_buffer, NULL, ns_options);
         if (ns == NULL) {
-            val_log(ctx, LOG_WARNING,
+            VAL_LOG(ctx, LOG_WARNING,
                     "read_res_config_file(): error parsing android resource!");
             return VAL_CONF_PARSE_ERROR;
         }
@@ -2276,7 +2744,7 @@ read_res_config_file(val_context_t * ctx)
      */
     if (ns_head == NULL) {
         if (!ctx->root_ns) {
-            val_log(ctx, LOG_WARNING, 
+            VAL_LOG(ctx, LOG_WARNING, 
                     "read_res_config_file(): Resolver configuration empty or missing, but root-hints was not found");
             return VAL_CONF_NOT_FOUND;
         }
@@ -2286,7 +2754,7 @@ read_res_config_file(val_context_t * ctx)
     ctx->nslist = ns_head;
     ctx->r_timestamp = 0; /* XXX: set to what?  there is no file stat */
 
-    val_log(ctx, LOG_DEBUG, 
+    VAL_LOG(ctx, LOG_DEBUG, 
             "read_res_config_file(): Done reading resolver configuration");
     return VAL_NO_ERROR;
 }
@@ -2344,7 +2812,7 @@ read_res_config_file(val_context_t * ctx)
     if (resolv_config) {
         fd = open(resolv_config, O_RDONLY);
         if (fd == -1) {
-            val_log(ctx, LOG_ERR, "read_res_config_file(): Could not open resolver conf file for reading: %s",
+            VAL_LOG(ctx, LOG_ERR, "read_res_config_file(): Could not open resolver conf file for reading: %s",
                 resolv_config);
     
             /* Use default resolv.conf file */
@@ -2364,7 +2832,7 @@ read_res_config_file(val_context_t * ctx)
         memset(&fl, 0, sizeof(fl));
         fl.l_type = F_RDLCK;
         if (-1 == fcntl(fd, F_SETLK, &fl)) {
-            val_log(ctx, LOG_WARNING, 
+            VAL_LOG(ctx, LOG_WARNING, 
                 "read_next_val_config_file(): Could not acquire shared lock on conf file: %s", 
                 resolv_config);
             goto err;
@@ -2386,7 +2854,7 @@ read_res_config_file(val_context_t * ctx)
             goto err;
         }
         if (-1 == read(fd, buf, bufsize)) {
-            val_log(ctx, LOG_ERR, "read_res_config_file(): Could not read resolver conf file: %s",
+            VAL_LOG(ctx, LOG_ERR, "read_res_config_file(): Could not read resolver conf file: %s",
                     resolv_config);
             retval = VAL_CONF_NOT_FOUND;
             goto err;
@@ -2398,11 +2866,11 @@ read_res_config_file(val_context_t * ctx)
         close(fd);
         fd = -1;
 
-        val_log(ctx, LOG_NOTICE, "read_res_config_file(): Reading resolver policy from %s", resolv_config);
+        VAL_LOG(ctx, LOG_NOTICE, "read_res_config_file(): Reading resolver policy from %s", resolv_config);
 
     } else {
         if (resolv_config)
-            val_log(ctx, LOG_ERR, "read_res_config_file(): Could not open resolver conf file for reading: %s",
+            VAL_LOG(ctx, LOG_ERR, "read_res_config_file(): Could not open resolver conf file for reading: %s",
                     resolv_config);
 
         /* Try to read any inline resolv.conf information */
@@ -2411,7 +2879,7 @@ read_res_config_file(val_context_t * ctx)
         if (!strncmp(resolv_conf_inline_buf, "", sizeof(""))) {
             goto done;
         }
-        val_log(ctx, LOG_INFO, 
+        VAL_LOG(ctx, LOG_INFO, 
                 "read_res_config_file(): Using inline resolv.conf data");
         buf = (char *) MALLOC (bufsize * sizeof(char));
         if (buf == NULL) {
@@ -2449,12 +2917,12 @@ read_res_config_file(val_context_t * ctx)
                 (retval =
                 val_get_token(&buf_ptr, end_ptr, &line_number, token, sizeof(token), &endst,
                            ALL_COMMENTS, ZONE_END_STMT, 0))) {
-                val_log(ctx, LOG_WARNING,
+                VAL_LOG(ctx, LOG_WARNING,
 			"read_res_config_file(): error getting nameserver token!");
                 goto err;
             }
             if ((ns = parse_name_server(token, DEFAULT_ZONE, ns_options|SR_QUERY_RECURSE)) == NULL) {
-                val_log(ctx, LOG_WARNING,
+                VAL_LOG(ctx, LOG_WARNING,
                         "read_res_config_file(): Invalid nameserver addresses '%s'.",
                         token);
                 goto err;
@@ -2478,7 +2946,7 @@ read_res_config_file(val_context_t * ctx)
             }
             if ((ns = parse_name_server(token, DEFAULT_ZONE,
                             ns_options)) == NULL) {
-                val_log(ctx, LOG_WARNING,
+                VAL_LOG(ctx, LOG_WARNING,
                         "read_res_config_file(): Invalid nameserver addresses '%s.",
                         token);
                 goto err;
@@ -2533,7 +3001,7 @@ read_res_config_file(val_context_t * ctx)
      */
     if (ns_head == NULL) {
         if (!ctx->root_ns) {
-            val_log(ctx, LOG_WARNING, 
+            VAL_LOG(ctx, LOG_WARNING, 
                     "read_res_config_file(): Resolver configuration empty or missing, but root-hints was not found");
             return VAL_CONF_NOT_FOUND;
         }
@@ -2543,13 +3011,13 @@ read_res_config_file(val_context_t * ctx)
     ctx->nslist = ns_head;
     ctx->r_timestamp = mtime;
 
-    val_log(ctx, LOG_DEBUG, 
+    VAL_LOG(ctx, LOG_DEBUG, 
             "read_res_config_file(): Done reading resolver configuration");
 
     return VAL_NO_ERROR;
 
   err:
-    val_log(ctx, LOG_ERR, 
+    VAL_LOG(ctx, LOG_ERR, 
             "read_res_config_file(): Error encountered while reading file %s", resolv_config);
     free_name_servers(&ns_head);
 
@@ -2626,7 +3094,7 @@ read_root_hints_file(val_context_t * ctx)
         memset(&fl, 0, sizeof(fl));
         fl.l_type = F_RDLCK;
         if (-1 == fcntl(fd, F_SETLK, &fl)) {
-            val_log(ctx, LOG_WARNING, 
+            VAL_LOG(ctx, LOG_WARNING, 
                     "read_next_val_config_file(): Could not acquire shared lock on conf file: %s", 
                     root_hints);
             goto err;
@@ -2644,7 +3112,7 @@ read_root_hints_file(val_context_t * ctx)
             goto err;
         }
         if (-1 == read(fd, buf, bufsize)) {
-            val_log(ctx, LOG_ERR, "read_root_hints_file(): Could not read root hints file: %s",
+            VAL_LOG(ctx, LOG_ERR, "read_root_hints_file(): Could not read root hints file: %s",
                     root_hints);
             retval = VAL_CONF_NOT_FOUND;
             goto err;
@@ -2656,7 +3124,7 @@ read_root_hints_file(val_context_t * ctx)
         close(fd);
         fd = -1;
 
-        val_log(ctx, LOG_NOTICE, "read_root_hints_file(): Reading root hints from %s",
+        VAL_LOG(ctx, LOG_NOTICE, "read_root_hints_file(): Reading root hints from %s",
                 root_hints);
 
     } else {
@@ -2665,17 +3133,17 @@ read_root_hints_file(val_context_t * ctx)
         bufsize = sizeof(root_hints_inline_buf);
         if (!strncmp(root_hints_inline_buf, "", sizeof(""))) {
             if (root_hints)
-                val_log(ctx, LOG_INFO, "read_root_hints_file(): Could not open root hints file for reading: %s",
+                VAL_LOG(ctx, LOG_INFO, "read_root_hints_file(): Could not open root hints file for reading: %s",
                     root_hints);
             else
-                val_log(ctx, LOG_INFO, "read_root_hints_file(): No root.hints file configured"); 
+                VAL_LOG(ctx, LOG_INFO, "read_root_hints_file(): No root.hints file configured"); 
             /* 
              * Root hints are not necessary. Only needed if our resolv.conf is empty. 
              * Flag the error at that time
              */
             return VAL_NO_ERROR;
         }
-        val_log(ctx, LOG_INFO, 
+        VAL_LOG(ctx, LOG_INFO, 
                 "read_root_hints_file(): Using inline root.hints data");
         buf = (char *) MALLOC (bufsize * sizeof(char));
         if (buf == NULL) {
@@ -2803,7 +3271,7 @@ read_root_hints_file(val_context_t * ctx)
             memset(&sa6, 0, sizeof(sa6));
             if ((addrlen6 == addrlen6) && /* this is to remove unused variable warning */
                 (INET_PTON(AF_INET6, token, ((struct sockaddr *)&sa6), &addrlen6) != 1)) {
-                val_log(ctx, LOG_INFO, 
+                VAL_LOG(ctx, LOG_INFO, 
                         "read_root_hints_file(): Cannot parse IPv6 address, skipping.");
                 continue;
             }
@@ -2874,7 +3342,7 @@ read_root_hints_file(val_context_t * ctx)
 
     res_sq_free_rrset_recs(&root_info);
 
-    val_log(ctx, LOG_DEBUG, "read_root_hints_file(): Done reading root hints");
+    VAL_LOG(ctx, LOG_DEBUG, "read_root_hints_file(): Done reading root hints");
     FREE(buf);
 
 
@@ -2892,7 +3360,7 @@ read_root_hints_file(val_context_t * ctx)
         close(fd);
     }
     res_sq_free_rrset_recs(&root_info);
-    val_log(ctx, LOG_ERR, "read_root_hints_file(): Error encountered around line %d while reading file %s - %s",
+    VAL_LOG(ctx, LOG_ERR, "read_root_hints_file(): Error encountered around line %d while reading file %s - %s",
             line_number, root_hints, p_val_err(retval));
     return retval;
 }
@@ -23,7 +23,8 @@
 #define P_CLOCK_SKEW                1
 #define P_PROV_INSECURE             2
 #define P_ZONE_SECURITY_EXPECTATION 3 
-#define P_BASE_LAST                 P_ZONE_SECURITY_EXPECTATION
+#define P_ZONE_MIRROR               4
+#define P_BASE_LAST                 P_ZONE_MIRROR
 
 #ifdef LIBVAL_NSEC3
 #define P_NSEC3_MAX_ITER            (P_BASE_LAST+1)
@@ -97,6 +98,8 @@ int             parse_prov_insecure_status(char **, char *, policy_entry_t *, in
 int             free_prov_insecure_status(policy_entry_t *);
 int             parse_zone_security_expectation(char **, char *, policy_entry_t *, int *, int *);
 int             free_zone_security_expectation(policy_entry_t *);
+int             parse_zone_mirror(char **, char *, policy_entry_t *, int *, int *);
+int             free_zone_mirror(policy_entry_t *);
 #ifdef LIBVAL_NSEC3
 int             parse_nsec3_max_iter(char **, char *, policy_entry_t * pol_entry, int *line_number, int *);
 int             free_nsec3_max_iter(policy_entry_t * pol_entry);
@@ -162,6 +165,10 @@ struct zone_se_policy {
     int             trusted;
 };
 
+struct zone_mirror_policy {
+    char           *file;
+};
+
 
 #ifdef LIBVAL_NSEC3
 struct nsec3_max_iter_policy {
@@ -29,6 +29,11 @@
 #include "val_cache.h"
 #include "val_assertion.h"
 #include "val_context.h"
+#include "val_mirror.h"
+#include "val_names.h"
+#include "val_arena.h"
+#include "val_msg.h"
+#include "val_trace.h"
 
 #define MERGE_RR(old_rr, new_rr) do{ \
 	if (old_rr == NULL) \
@@ -52,19 +57,25 @@ static int _process_rcvd_response(val_context_t * context,
                                   u_char *response_data, size_t response_length);
 
 /*
- * create a name_server struct from the given address rdata
+ * create a name_server struct from the given address rdata.  The
+ * servers listen on the dns-port of the context.
  */
 static int
-extract_glue_from_rdata(struct rrset_rr *addr_rr, struct name_server *ns)
+extract_glue_from_rdata(val_context_t *context, struct rrset_rr *addr_rr,
+                        struct name_server *ns)
 {
     struct sockaddr_in *sock_in;
 #ifdef VAL_IPV6
     struct sockaddr_in6 *sock_in6;
 #endif
+    u_int16_t       port = DNS_PORT;
 
     if (ns == NULL) 
         return VAL_BAD_ARGUMENT;
 
+    if (context && context->g_opt && context->g_opt->dns_port > 0)
+        port = (u_int16_t) context->g_opt->dns_port;
+
     while (addr_rr) {
         int             i;
         struct sockaddr_storage **new_addr = NULL;
@@ -74,7 +85,7 @@ extract_glue_from_rdata(struct rrset_rr *addr_rr, struct name_server *ns)
             && addr_rr->rr_rdata_length != sizeof(struct in6_addr)
 #endif
             ) {
-            val_log(NULL, LOG_DEBUG, "extract_glue_from_rdata(): Skipping address with bad len=%d.",
+            VAL_LOG(NULL, LOG_DEBUG, "extract_glue_from_rdata(): Skipping address with bad len=%d.",
                     addr_rr->rr_rdata_length);
             addr_rr = addr_rr->rr_next;
             continue;
@@ -98,7 +109,7 @@ extract_glue_from_rdata(struct rrset_rr *addr_rr, struct name_server *ns)
                 ns->ns_address[ns->ns_number_of_addresses];
             memset(sock_in, 0, sizeof(struct sockaddr_in));
             sock_in->sin_family = AF_INET;
-            sock_in->sin_port = htons(DNS_PORT);
+            sock_in->sin_port = htons(port);
             memcpy(&(sock_in->sin_addr), addr_rr->rr_rdata, 
                     sizeof(struct in_addr));
         }
@@ -108,7 +119,7 @@ extract_glue_from_rdata(struct rrset_rr *addr_rr, struct name_server *ns)
                 ns->ns_address[ns->ns_number_of_addresses];
             memset(sock_in6, 0, sizeof(struct sockaddr_in6));
             sock_in6->sin6_family = AF_INET6;
-            sock_in6->sin6_port = htons(DNS_PORT);
+            sock_in6->sin6_port = htons(port);
             memcpy(&(sock_in6->sin6_addr), addr_rr->rr_rdata,
                    sizeof(struct in6_addr));
         }
@@ -155,8 +166,9 @@ find_matching_glue(val_context_t *context,
         pc->qc_referral && pc->qc_referral->cur_pending_glue_ns) {
 
         pending_ns = pc->qc_referral->cur_pending_glue_ns;
-        if (ns_name_ntop(pending_ns->ns_name_n, name_p,
-                     sizeof(name_p)) < 0) {
+        if (VAL_LOG_ENABLED(LOG_DEBUG) &&
+            ns_name_ntop(pending_ns->ns_name_n, name_p,
+                         sizeof(name_p)) < 0) {
             strncpy(name_p, "unknown/error", sizeof(name_p)-1); 
         }
 
@@ -189,7 +201,8 @@ find_matching_glue(val_context_t *context,
             }
         }
         if (gcb == NULL) {
-            gcb = (struct glue_fetch_bucket *) MALLOC (sizeof (struct glue_fetch_bucket));
+            gcb = (struct glue_fetch_bucket *)
+                arena_malloc(sizeof(struct glue_fetch_bucket));
             if (gcb == NULL)
                 return VAL_OUT_OF_MEMORY;
             gcb->qfq = glue_qfq;
@@ -200,7 +213,8 @@ find_matching_glue(val_context_t *context,
         }
 
         if (pcb == NULL) {
-            pcb = (struct glue_fetch_bucket *) MALLOC (sizeof (struct glue_fetch_bucket));
+            pcb = (struct glue_fetch_bucket *)
+                arena_malloc(sizeof(struct glue_fetch_bucket));
             if (pcb == NULL)
                 return VAL_OUT_OF_MEMORY;
             pcb->qfq = qfq_pc;
@@ -216,7 +230,7 @@ find_matching_glue(val_context_t *context,
             for (i = 0; i < glue_loop_count; i++) {
                 if (qfq[i] == pcb->qfq) {
                     /* loop detected */
-                    val_log(context, LOG_DEBUG, 
+                    VAL_LOG(context, LOG_DEBUG, 
                         "find_matching_glue(): Loop detected while fetching glue (%s) for %s",
                         p_type(glue_type), name_p);
                     glueptr->qc_state = Q_REFERRAL_ERROR;
@@ -241,13 +255,14 @@ find_matching_glue(val_context_t *context,
        
             if (as && glueptr->qc_state == Q_ANSWERED &&
                (VAL_NO_ERROR == (retval =
-                        extract_glue_from_rdata(as->val_ac_rrset.ac_data->rrs_data,
+                        extract_glue_from_rdata(context,
+                                            as->val_ac_rrset.ac_data->rrs_data,
                                             pending_ns)))) {
-                    val_log(context, LOG_DEBUG,
+                    VAL_LOG(context, LOG_DEBUG,
                             "find_matching_glue(): successfully fetched glue (%s) for %s", 
                             p_type(glue_type), name_p);
             } else {
-                val_log(context, LOG_DEBUG, 
+                VAL_LOG(context, LOG_DEBUG, 
                         "find_matching_glue(): Could not fetch glue (%s) for %s", 
                         p_type(glue_type), name_p);
                 glueptr->qc_state = Q_REFERRAL_ERROR;
@@ -316,15 +331,16 @@ merge_glue_in_referral(val_context_t *context,
          * If we reach here we've processed both A and AAAA glue.
          * check if we have at least some data to work with 
          */
-        if (ns_name_ntop(pending_ns->ns_name_n, name_p,
-                     sizeof(name_p)) < 0) {
+        if (VAL_LOG_ENABLED(LOG_DEBUG) &&
+            ns_name_ntop(pending_ns->ns_name_n, name_p,
+                         sizeof(name_p)) < 0) {
             strncpy(name_p, "unknown/error", sizeof(name_p)-1); 
         }
 
         if (pending_ns->ns_number_of_addresses > 0) {
 
             /* continue referral using the fetched glue records */
-            val_log(context, LOG_DEBUG,
+            VAL_LOG(context, LOG_DEBUG,
                     "merge_glue_in_referral(): continuing referral using glue fetched for %s", 
                     name_p);
             
@@ -444,7 +460,8 @@ fix_glue(val_context_t * context,
         if ((next_q->qfq_query->qc_state & Q_WAIT_FOR_GLUE) ||
             next_q->qfq_query->qc_state >= Q_ERROR_BASE) {
 
-            if (-1 == ns_name_ntop(next_q->qfq_query->qc_name_n, name_p, sizeof(name_p)))
+            if (VAL_LOG_ENABLED(LOG_DEBUG) &&
+                -1 == ns_name_ntop(next_q->qfq_query->qc_name_n, name_p, sizeof(name_p)))
                 snprintf(name_p, sizeof(name_p), "unknown/error");
 
             /* 
@@ -459,7 +476,7 @@ fix_glue(val_context_t * context,
                 goto err;
             }
             if (next_q->qfq_query->qc_state >= Q_ERROR_BASE) {
-                val_log(context, LOG_DEBUG,
+                VAL_LOG(context, LOG_DEBUG,
                         "fix_glue(): Error fetching {%s %s(%d) %s(%d)} and no pending glue (state: %d flags :%x)", name_p,
                         p_class(next_q->qfq_query->qc_class_h),
                         next_q->qfq_query->qc_class_h,
@@ -479,7 +496,7 @@ err:
     while(depn_bucket) {
         struct glue_fetch_bucket *temp = depn_bucket;
         depn_bucket = depn_bucket->next_bucket;
-        FREE(temp);
+        arena_free(temp);
     }
 
     return retval;
@@ -617,7 +634,7 @@ res_zi_unverified_ns_list(val_context_t *context,
                      */
                     if (VAL_NO_ERROR !=
                         (retval =
-                         extract_glue_from_rdata(unchecked_set->
+                         extract_glue_from_rdata(context, unchecked_set->
                                                  rrs_data, ns)))
                         return retval;
                     break;
@@ -741,7 +758,7 @@ find_nslist_for_query(val_context_t * context,
 
         if (ref_ns_list != NULL) {
             next_q->qc_ns_list = ref_ns_list;
-            val_log(context, LOG_DEBUG, 
+            VAL_LOG(context, LOG_DEBUG, 
                     "find_nslist_for_query(): Found mapped ns for query");
             goto done;
         }
@@ -768,7 +785,7 @@ find_nslist_for_query(val_context_t * context,
     }
     if (ref_ns_list != NULL) {
         next_q->qc_ns_list = ref_ns_list;
-        val_log(context, LOG_DEBUG, 
+        VAL_LOG(context, LOG_DEBUG, 
                 "find_nslist_for_query(): Found cached ns_list with cred = %d.", ns_cred);
         /* 
          * If our answer was from an authoritative server, we
@@ -788,7 +805,7 @@ find_nslist_for_query(val_context_t * context,
         /*
          * No root hints; should not happen here 
          */
-        val_log(context, LOG_WARNING, 
+        VAL_LOG(context, LOG_WARNING, 
                 "find_nslist_for_query(): Trying to answer query recursively, but no root hints file found.");
         return VAL_CONF_NOT_FOUND;
     }
@@ -810,7 +827,7 @@ done:
     }
     edns0_size = (context && context->g_opt)?
                     context->g_opt->edns0_size : RES_EDNS0_DEFAULT;
-    val_log(context, LOG_DEBUG,
+    VAL_LOG(context, LOG_DEBUG,
             "find_nslist_for_query(): Enabling DNSSEC for query (EDNS0 = %ld).", edns0_size);
     timeout = (context && context->g_opt)?
                     context->g_opt->timeout : RES_TIMEOUT;
@@ -860,7 +877,7 @@ bootstrap_referral(val_context_t *context,
             /*
              * No root hints; should not happen here 
              */
-            val_log(context, LOG_WARNING, 
+            VAL_LOG(context, LOG_WARNING, 
                     "bootstrap_referral(): referral to root, but no root hints file found.");
             matched_q->qc_state = Q_REFERRAL_ERROR;
             return VAL_NO_ERROR;
@@ -884,7 +901,7 @@ bootstrap_referral(val_context_t *context,
          */
         if ((matched_q->qc_state & Q_WAIT_FOR_GLUE) && *ref_ns_list == NULL) {
             free_name_servers(&pending_glue);
-            val_log(context, LOG_DEBUG, 
+            VAL_LOG(context, LOG_DEBUG, 
                     "bootstrap_referral(): Already fetching glue; not fetching again");
             matched_q->qc_state = Q_REFERRAL_ERROR;
             return VAL_NO_ERROR;
@@ -1063,6 +1080,10 @@ follow_referral_or_alias_link(val_context_t * context,
     matched_q = matched_qfq->qfq_query; /* Can never be NULL if matched_qfq is not NULL */
 
     if (matched_q->qc_respondent_server) {
+        /* the server answered; note that before letting go of it */
+        if (matched_q->qc_state != Q_REFERRAL_ERROR)
+            stow_server_response(matched_q->qc_respondent_server,
+                    !(matched_q->qc_flags & VAL_QUERY_DONT_VALIDATE));
         free_name_server(&matched_q->qc_respondent_server);
         matched_q->qc_respondent_server = NULL;
         matched_q->qc_respondent_server_options = 0;
@@ -1124,7 +1145,7 @@ follow_referral_or_alias_link(val_context_t * context,
     res_sq_free_rrset_recs(proofs);
     *proofs = NULL;
 
-    if (referral_zone_n) {
+    if (referral_zone_n && VAL_LOG_ENABLED(LOG_DEBUG)) {
         char            debug_name1[NS_MAXDNAME];
         char            debug_name2[NS_MAXDNAME];
         memset(debug_name1, 0, 1024);
@@ -1138,7 +1159,7 @@ follow_referral_or_alias_link(val_context_t * context,
             strncpy(debug_name2, "unknown/error", sizeof(debug_name2)-1);
         }
             
-        val_log(context, LOG_DEBUG, 
+        VAL_LOG(context, LOG_DEBUG, 
                 "follow_referral_or_alias_link(): Processing referral to %s for query {%s %s(%d) %s(%d)})", 
                 debug_name2, debug_name1, p_class(matched_q->qc_class_h),
                 matched_q->qc_class_h, p_type(matched_q->qc_type_h),
@@ -1153,7 +1174,7 @@ follow_referral_or_alias_link(val_context_t * context,
         /*
          * If this request has already been made then Referral Error
          */
-        val_log(context, LOG_DEBUG, "follow_referral_or_alias_link(): Referral loop encountered");
+        VAL_LOG(context, LOG_DEBUG, "follow_referral_or_alias_link(): Referral loop encountered");
         matched_q->qc_state = Q_REFERRAL_ERROR;
         return VAL_NO_ERROR;
     }
@@ -1180,7 +1201,7 @@ follow_referral_or_alias_link(val_context_t * context,
         /*
          * nowhere to look 
          */
-        val_log(context, LOG_DEBUG, "follow_referral_or_alias_link(): Missing glue");
+        VAL_LOG(context, LOG_DEBUG, "follow_referral_or_alias_link(): Missing glue");
         matched_q->qc_state = Q_MISSING_GLUE;
         return VAL_NO_ERROR;
     }
@@ -1230,7 +1251,7 @@ follow_referral_or_alias_link(val_context_t * context,
         }
 
         if (tp) {
-            FREE(tp);
+            arena_free(tp);
         } 
     }
     /*
@@ -1254,18 +1275,20 @@ follow_referral_or_alias_link(val_context_t * context,
 }
 
 
+/*
+ * Add RR i of the indexed message mi to the matching rrset in listtype
+ */
 #define SAVE_RR_TO_LIST(respondent_server, listtype, name_n, type_h,    \
-                        set_type_h, class_h, ttl_h, hptr, rdata,        \
+                        hptr, rdata,                                    \
                         rdata_len_h, from_section, authoritive, iterative, \
                         zonecut_n)                                      \
     do {                                                                \
         struct rrset_rec *rr_set;                                       \
         int ret_val;                                                    \
         u_char *r;                                                      \
-        rr_set = find_rr_set (respondent_server, listtype, name_n,  \
-                              type_h, set_type_h, class_h, ttl_h, hptr, \
-                              rdata, from_section, authoritive,         \
-                              iterative, zonecut_n);                    \
+        rr_set = msg_find_rr_set(&mi, i, respondent_server, listtype,   \
+                                 name_n, hptr, rdata, from_section,     \
+                                 authoritive, iterative, zonecut_n);    \
         if (rr_set==NULL) {                                             \
             ret_val = VAL_OUT_OF_MEMORY;                                \
         }                                                               \
@@ -1292,7 +1315,9 @@ follow_referral_or_alias_link(val_context_t * context,
         }                                                               \
         if (ret_val != VAL_NO_ERROR) {                                  \
             res_sq_free_rrset_recs(&learned_zones);                     \
-            FREE(rdata);                                                \
+            if (rdata_copied)                                           \
+                FREE(rdata);                                            \
+            msg_index_free(&mi);                                        \
             return ret_val;                                             \
         }                                                               \
     } while (0)
@@ -1468,6 +1493,10 @@ prepare_empty_nonexistence(struct rrset_rec **answers,
         return VAL_OUT_OF_MEMORY;
 
     (*answers)->rrs_zonecut_n = NULL;
+    (*answers)->rrs_refcount = 0;
+    (*answers)->rrs_shared = NULL;
+    (*answers)->rrs_cache_bytes = 0;
+    (*answers)->rrs_cache_ref = 0;
     (*answers)->rrs_name_n = (u_char *) MALLOC(length * sizeof(u_char));
 
     if ((*answers)->rrs_name_n == NULL) {
@@ -1583,13 +1612,12 @@ digest_response(val_context_t * context,
     u_char          name_n[NS_MAXCDNAME];
     u_int16_t       type_h;
     u_int16_t       set_type_h;
-    u_int16_t       class_h;
-    u_int32_t       ttl_h;
     size_t          rdata_len_h;
-    size_t          rdata_index;
     int             authoritive = 0;
     int             iterative = 0;
     u_char         *rdata;
+    int             rdata_copied = 0;
+    struct msg_index mi;
     u_char         *hptr;
     int             ret_val;
     int             nothing_other_than_alias;
@@ -1608,7 +1636,6 @@ digest_response(val_context_t * context,
     int             proof_seen = 0;
     int             soa_seen = 0;
     HEADER         *header;
-    u_char         *end;
     size_t         qnamelen, tot;
     size_t len;
     struct qname_chain **qnames;
@@ -1625,10 +1652,10 @@ digest_response(val_context_t * context,
         return VAL_BAD_ARGUMENT;
 
     matched_q = matched_qfq->qfq_query; /* Can never be NULL if matched_qfq is not NULL */
+    memset(&mi, 0, sizeof(mi));
     
     qnames = &(di_response->di_qnames);
     header = (HEADER *) response_data;
-    end = response_data + response_length;
 
     query_name_n = matched_q->qc_name_n;
     query_type_h = matched_q->qc_type_h;
@@ -1645,7 +1672,12 @@ digest_response(val_context_t * context,
 
     resp_ns = matched_q->qc_respondent_server;
 
-    val_log(context, LOG_DEBUG, "digest_response(): server options set to: %u", 
+    if (val_trace_enabled)
+        val_trace_response(matched_q->qc_trace_id, query_name_n,
+                           query_type_h, query_class_h, resp_ns,
+                           response_data, response_length);
+
+    VAL_LOG(context, LOG_DEBUG, "digest_response(): server options set to: %u", 
                                 resp_ns->ns_options);
 
     if (answer == 0) 
@@ -1660,6 +1692,11 @@ digest_response(val_context_t * context,
     if ((ret_val =
          add_to_qname_chain(qnames, query_name_n)) != VAL_NO_ERROR)
         return ret_val;
+    /*
+     * Extract zone cut from the query chain element if it exists 
+     */
+    rrs_zonecut_n = matched_q->qc_zonecut_n;
+
     strcpy(query_name_p, "");
     if (query_name_n && 
             ns_name_ntop(query_name_n, query_name_p, sizeof(query_name_p)) == -1) {
@@ -1667,10 +1704,6 @@ digest_response(val_context_t * context,
        goto done;
     }
 
-    /*
-     * Extract zone cut from the query chain element if it exists 
-     */
-    rrs_zonecut_n = matched_q->qc_zonecut_n;
     strcpy(rrs_zonecut_p, "");
     if (rrs_zonecut_n && 
             ns_name_ntop(rrs_zonecut_n, rrs_zonecut_p, sizeof(rrs_zonecut_p)) == -1) {
@@ -1678,17 +1711,20 @@ digest_response(val_context_t * context,
        goto done;
     }
 
-    strcpy(name_buf, "");
-    if (resp_ns && resp_ns->ns_number_of_addresses > 0) {
-        val_get_ns_string((struct sockaddr *)resp_ns->ns_address[0],
-                          name_buf, sizeof(name_buf));
-    }
+    /* the server's address is only used in the log message */
+    if (VAL_LOG_ENABLED(LOG_DEBUG)) {
+        strcpy(name_buf, "");
+        if (resp_ns && resp_ns->ns_number_of_addresses > 0) {
+            val_get_ns_string((struct sockaddr *)resp_ns->ns_address[0],
+                              name_buf, sizeof(name_buf));
+        }
 
-    val_log(context, LOG_DEBUG, 
-            "digest_response(): Processing response for {%s %s(%d) %s(%d)}"
-            "from zonecut: %s (%s)",
-            query_name_p, p_class(query_class_h), query_class_h,
-            p_type(query_type_h), query_type_h, rrs_zonecut_p, name_buf); 
+        val_log(context, LOG_DEBUG, 
+                "digest_response(): Processing response for {%s %s(%d) %s(%d)}"
+                "from zonecut: %s (%s)",
+                query_name_p, p_class(query_class_h), query_class_h,
+                p_type(query_type_h), query_type_h, rrs_zonecut_p, name_buf); 
+    }
 
     /*
      *  Skip question section 
@@ -1733,12 +1769,26 @@ digest_response(val_context_t * context,
         goto done; 
     }
 
+    /*
+     * Locate every RR in the response and group them into rrsets
+     */
+    if (VAL_NO_ERROR != (ret_val = msg_index(&mi, response_data,
+                                             response_length, response_index,
+                                             rrs_to_go))) {
+        if (ret_val == VAL_BAD_ARGUMENT) {
+            matched_q->qc_state = Q_RESPONSE_ERROR;
+            ret_val = VAL_NO_ERROR;
+        }
+        goto done;
+    }
+
     /*
      * Now start processing each RRSet in the response
      */
     for (i = 0; i < rrs_to_go; i++) {
 
         rdata = NULL;
+        rdata_copied = 0;
 
         /*
          * Determine what part of the response I'm reading 
@@ -1751,29 +1801,17 @@ digest_response(val_context_t * context,
             from_section = VAL_FROM_ADDITIONAL;
 
         /*
-         * Response_index points to the beginning of an RR 
-         * Grab the uncompressed name, type, class, ttl, rdata_len 
-         * If the type is a signature, get the type_covered 
-         * Leave a pointer to the rdata 
-         * Advance the response_index 
+         * The type comes straight from the index; for signatures the
+         * set type is the type covered.  The owner is
+         * only unpacked when it changes, and the RDATA is only copied
+         * if it has compressed names to expand.
          */
-        if ((ret_val =
-             extract_from_rr(response_data, &response_index, end, name_n,
-                             &type_h, &set_type_h, &class_h, &ttl_h,
-                             &rdata_len_h, &rdata_index)) != VAL_NO_ERROR) {
-            matched_q->qc_state = Q_RESPONSE_ERROR;
-            ret_val = VAL_NO_ERROR;
-            goto done;
-        }
+        type_h = mi.mi_rrs[i].mr_type_h;
+        set_type_h = mi.mi_rrs[i].mr_set_type_h;
 
-        /*
-         * response[rdata_index] is the first byte of the RDATA of the
-         * record.  The data may contain domain names in compressed format,
-         * so they need to be expanded.  This is type-dependent...
-         */
-        if ((ret_val =
-             decompress(&rdata, response_data, rdata_index, end, type_h,
-                        &rdata_len_h)) != VAL_NO_ERROR) {
+        if ((ret_val = msg_owner(&mi, i, name_n)) != VAL_NO_ERROR ||
+            (ret_val = msg_rdata(&mi, i, &rdata, &rdata_len_h,
+                                 &rdata_copied)) != VAL_NO_ERROR) {
             matched_q->qc_state = Q_RESPONSE_ERROR;
             ret_val = VAL_NO_ERROR;
             goto done;
@@ -1827,7 +1865,7 @@ digest_response(val_context_t * context,
                                                   &referral_error))) || 
                             (referral_error)) {
                         if (referral_error) 
-                            val_log(context, LOG_DEBUG, "digest_response(): CNAME/DNAME error or loop encountered");
+                            VAL_LOG(context, LOG_DEBUG, "digest_response(): CNAME/DNAME error or loop encountered");
                         goto done;
                     }
                     /* forget the current zonecut */
@@ -1861,7 +1899,7 @@ digest_response(val_context_t * context,
                                                   &referral_error))) || 
                             (referral_error)) {
                         if (referral_error) 
-                            val_log(context, LOG_DEBUG, "digest_response(): CNAME/DNAME error or loop encountered");
+                            VAL_LOG(context, LOG_DEBUG, "digest_response(): CNAME/DNAME error or loop encountered");
                         goto done;
                     }
                     /* forget the current zonecut */
@@ -1877,7 +1915,7 @@ digest_response(val_context_t * context,
             }
             SAVE_RR_TO_LIST(resp_ns, 
                             &learned_answers, name_n, type_h,
-                            set_type_h, class_h, ttl_h, hptr, rdata,
+                            hptr, rdata,
                             rdata_len_h, from_section, authoritive,
                             iterative, rrs_zonecut_n);
         } else if (from_section == VAL_FROM_AUTHORITY) {
@@ -1889,7 +1927,7 @@ digest_response(val_context_t * context,
                 proof_seen = 1;
                 SAVE_RR_TO_LIST(resp_ns, 
                                 &learned_proofs, name_n, type_h,
-                                set_type_h, class_h, ttl_h, hptr, rdata,
+                                hptr, rdata,
                                 rdata_len_h, from_section, authoritive,
                                 iterative, rrs_zonecut_n);
 
@@ -1899,7 +1937,7 @@ digest_response(val_context_t * context,
                 soa_seen = 1;
                 SAVE_RR_TO_LIST(resp_ns, 
                                 &learned_proofs, name_n, type_h,
-                                set_type_h, class_h, ttl_h, hptr, rdata,
+                                hptr, rdata,
                                 rdata_len_h, from_section, authoritive,
                                 iterative, name_n);
             } else if (set_type_h == ns_t_ns) {
@@ -1909,13 +1947,13 @@ digest_response(val_context_t * context,
                  */
                 SAVE_RR_TO_LIST(resp_ns, 
                                 &learned_zones, name_n,
-                                type_h, set_type_h, class_h, ttl_h, hptr,
+                                type_h, hptr,
                                 rdata, rdata_len_h, from_section,
                                 authoritive, iterative, name_n);
             } else if (set_type_h == ns_t_ds) {
                 SAVE_RR_TO_LIST(resp_ns,
                                 &learned_ds, name_n,
-                                type_h, set_type_h, class_h, ttl_h, hptr,
+                                type_h, hptr,
                                 rdata, rdata_len_h, from_section,
                                 authoritive, iterative, rrs_zonecut_n);
             }
@@ -1923,14 +1961,14 @@ digest_response(val_context_t * context,
             if (set_type_h == ns_t_dnskey) {
                 SAVE_RR_TO_LIST(resp_ns,
                                 &learned_answers, name_n,
-                                type_h, set_type_h, class_h, ttl_h, hptr,
+                                type_h, hptr,
                                 rdata, rdata_len_h, from_section,
                                 authoritive, iterative, rrs_zonecut_n);
             } else if ((_val_context_ip4(context) && set_type_h == ns_t_a) || 
                        (_val_context_ip6(context) && set_type_h == ns_t_aaaa)) {
                 SAVE_RR_TO_LIST(resp_ns,
                                 &learned_zones, name_n,
-                                type_h, set_type_h, class_h, ttl_h, hptr,
+                                type_h, hptr,
                                 rdata, rdata_len_h, from_section,
                                 authoritive, iterative, name_n);
             }
@@ -1943,7 +1981,7 @@ digest_response(val_context_t * context,
         if ( query_type_h == ns_t_ds &&
              set_type_h == ns_t_soa &&
              !namecmp(name_n, query_name_n)) {
-            val_log(context, LOG_DEBUG, "digest_response(): bad response for DS record. NS probably not DNSSEC-capable.");
+            VAL_LOG(context, LOG_DEBUG, "digest_response(): bad response for DS record. NS probably not DNSSEC-capable.");
             matched_q->qc_state = Q_WRONG_ANSWER;
             ret_val = VAL_NO_ERROR;
             goto done;
@@ -1954,7 +1992,7 @@ digest_response(val_context_t * context,
          */
         if ((set_type_h == ns_t_cname || set_type_h == ns_t_dname) &&
              !ALIAS_MATCH_TYPE(query_type_h)) {
-            val_log(context, LOG_DEBUG, 
+            VAL_LOG(context, LOG_DEBUG, 
                     "digest_response(): Won't follow alias for type %d.", 
                     query_type_h);
             matched_q->qc_state = Q_WRONG_ANSWER;
@@ -1989,9 +2027,12 @@ digest_response(val_context_t * context,
                 /* old zonecut is closer more specific than the new zonecut */
                 (namename(rrs_zonecut_n, name_n) != NULL)) { 
 
-                val_log(context, LOG_DEBUG, "digest_response(): {%s %s(%d) %s(%d)} appears to lead to a lame server",
+                VAL_LOG(context, LOG_DEBUG, "digest_response(): {%s %s(%d) %s(%d)} appears to lead to a lame server",
                         query_name_p, p_class(query_class_h), query_class_h,
                         p_type(query_type_h), query_type_h);
+                if (resp_ns && resp_ns->ns_number_of_addresses > 0)
+                    stow_server_lameness(resp_ns->ns_address[0],
+                                         rrs_zonecut_n);
                 matched_q->qc_state = Q_REFERRAL_ERROR;
                 ret_val = VAL_NO_ERROR;
                 goto done;
@@ -2006,7 +2047,7 @@ digest_response(val_context_t * context,
                  */
                 if (query_type_h == ns_t_ds &&
                     NULL != namename (name_n, query_name_n)) {
-                    val_log(context, LOG_DEBUG, "digest_response(): bad response for DS record. NS probably not DNSSEC-capable.");
+                    VAL_LOG(context, LOG_DEBUG, "digest_response(): bad response for DS record. NS probably not DNSSEC-capable.");
                     matched_q->qc_state = Q_WRONG_ANSWER;
                     ret_val = VAL_NO_ERROR;
                     goto done;
@@ -2031,7 +2072,7 @@ digest_response(val_context_t * context,
                         goto done;
                     }
 
-                    val_log(context, LOG_DEBUG, 
+                    VAL_LOG(context, LOG_DEBUG, 
                             "digest_response(): Setting zonecut for {%s %s(%d) %s(%d)} query responses to %s",
                             query_name_p, p_class(query_class_h), query_class_h,
                             p_type(query_type_h), query_type_h, rrs_zonecut_p);
@@ -2061,7 +2102,7 @@ digest_response(val_context_t * context,
                  */
                 if (query_type_h == ns_t_ds &&
                     !namecmp(name_n, query_name_n)) {
-                    val_log(context, LOG_DEBUG, "digest_response(): bad referral for DS record. NS probably not DNSSEC-capable.");
+                    VAL_LOG(context, LOG_DEBUG, "digest_response(): bad referral for DS record. NS probably not DNSSEC-capable.");
                     matched_q->qc_state = Q_WRONG_ANSWER;
                     ret_val = VAL_NO_ERROR;
                     goto done;
@@ -2074,26 +2115,30 @@ digest_response(val_context_t * context,
                 /*
                  * Multiple NS records; Malformed referral notice 
                  */
-                val_log(context, LOG_DEBUG, "digest_response(): Ambiguous referral zonecut");
+                VAL_LOG(context, LOG_DEBUG, "digest_response(): Ambiguous referral zonecut");
                 matched_q->qc_state = Q_REFERRAL_ERROR;
                 ret_val = VAL_NO_ERROR;
                 goto done;
             }
         }
 
-        FREE(rdata);
+        if (rdata_copied)
+            FREE(rdata);
         rdata = NULL;
+        rdata_copied = 0;
 
     } 
 
+    msg_index_free(&mi);
+
     if (*qnames) {
 
-        if (namecmp(matched_q->qc_name_n, (*qnames)->qnc_name_n)) {
+        if (matched_q->qc_name_n != (*qnames)->qnc_name_n) {
             /*
              * Keep the current query name as the last name in the chain 
              */
-            memcpy(matched_q->qc_name_n, (*qnames)->qnc_name_n,
-                   wire_name_length((*qnames)->qnc_name_n));
+            name_release(matched_q->qc_name_n);
+            matched_q->qc_name_n = name_ref((*qnames)->qnc_name_n);
         }
 
     }
@@ -2209,8 +2254,9 @@ digest_response(val_context_t * context,
     return ret_val;
 
   done:
-    if (rdata)
+    if (rdata && rdata_copied)
         FREE(rdata);
+    msg_index_free(&mi);
     res_sq_free_rrset_recs(&learned_answers);
     res_sq_free_rrset_recs(&learned_proofs);
     res_sq_free_rrset_recs(&learned_zones);
@@ -2235,7 +2281,7 @@ val_resquery_send(val_context_t * context,
     struct name_server *nslist;
     struct timeval now;
 
-    val_log(NULL, LOG_DEBUG, __FUNCTION__);
+    VAL_LOG(NULL, LOG_DEBUG, __FUNCTION__);
     /*
      * Get a (set of) answer(s) from the default NS's.
      * If nslist is NULL, read the cached zones and name servers
@@ -2250,24 +2296,28 @@ val_resquery_send(val_context_t * context,
         return VAL_BAD_ARGUMENT;
     }
     matched_q = matched_qfq->qfq_query; /* Can never be NULL if matched_qfq is not NULL */
+    apply_server_capabilities(context, &matched_q->qc_ns_list,
+            matched_q->qc_zonecut_n,
+            !(matched_q->qc_flags & VAL_QUERY_NO_EDNS0_FALLBACK));
     nslist = matched_q->qc_ns_list;
 
     if (ns_name_ntop(matched_q->qc_name_n, name_p, sizeof(name_p)) == -1) {
         return VAL_BAD_ARGUMENT;
     }
-    if (matched_q->qc_zonecut_n == NULL || 
-        ns_name_ntop(matched_q->qc_zonecut_n, zone_p, sizeof(zone_p)) == -1) {
+    if (VAL_LOG_ENABLED(LOG_DEBUG) &&
+        (matched_q->qc_zonecut_n == NULL || 
+         ns_name_ntop(matched_q->qc_zonecut_n, zone_p, sizeof(zone_p)) == -1)) {
         strncpy(zone_p, "", sizeof(zone_p)-1); 
     }
 
-    val_log(context, LOG_DEBUG, "val_resquery_send(): Sending query for {%s %s(%d) %s(%d)} to: %s", 
+    VAL_LOG(context, LOG_DEBUG, "val_resquery_send(): Sending query for {%s %s(%d) %s(%d)} to: %s", 
             name_p, p_class(matched_q->qc_class_h), matched_q->qc_class_h,
             p_type(matched_q->qc_type_h), matched_q->qc_type_h, zone_p);
     for (tempns = nslist; tempns; tempns = tempns->ns_next) {
         int i, addr_count;
         addr_count = tempns->ns_number_of_addresses;
         for (i=0; i < addr_count; i++) {
-            val_log(context, LOG_DEBUG, "    %s",
+            VAL_LOG(context, LOG_DEBUG, "    %s",
                 val_get_ns_string((struct sockaddr *)tempns->ns_address[i],
                                   name_buf, sizeof(name_buf)));
         }
@@ -2279,6 +2329,10 @@ val_resquery_send(val_context_t * context,
     gettimeofday(&now, NULL);
     matched_q->qc_last_sent = now.tv_sec;
 
+    if (val_trace_enabled)
+        val_trace_query(matched_q->qc_trace_id, matched_q->qc_name_n,
+                        matched_q->qc_type_h, matched_q->qc_class_h, nslist);
+
     if ((ret_val =
          query_send(name_p, matched_q->qc_type_h, matched_q->qc_class_h,
                     nslist, &(matched_q->qc_trans_id))) == SR_UNSET)
@@ -2310,7 +2364,7 @@ val_resquery_rcv(val_context_t * context,
 
     int             ret_val;
 
-    val_log(NULL, LOG_DEBUG, __FUNCTION__);
+    VAL_LOG(NULL, LOG_DEBUG, __FUNCTION__);
 
     if ((matched_qfq == NULL) || (response == NULL) || (queries == NULL) ||
         (pending_desc == NULL)
@@ -2356,7 +2410,7 @@ val_resquery_rcv(val_context_t * context,
 void
 val_res_cancel(struct val_query_chain *matched_q)
 {
-    val_log(NULL, LOG_DEBUG, __FUNCTION__);
+    VAL_LOG(NULL, LOG_DEBUG, __FUNCTION__);
 
 #ifndef VAL_NO_ASYNC
     if (matched_q->qc_ea) {
@@ -2369,6 +2423,23 @@ val_res_cancel(struct val_query_chain *matched_q)
         res_cancel(&(matched_q->qc_trans_id));
 }
 
+/*
+ * None of the servers for this query responded. Remember this so that
+ * other queries try them last.
+ */
+static void
+_mark_servers_unreachable(struct val_query_chain *matched_q)
+{
+    struct name_server *ns;
+    int i;
+
+    for (ns = matched_q->qc_ns_list; ns; ns = ns->ns_next) {
+        for (i = 0; i < ns->ns_number_of_addresses; i++)
+            stow_server_capability(ns->ns_address[i], -1,
+                                   SERVER_CAP_UNREACHABLE);
+    }
+}
+
 void
 val_res_nsfallback(val_context_t *context, struct val_query_chain *matched_q,
                    struct name_server *server, 
@@ -2376,13 +2447,15 @@ val_res_nsfallback(val_context_t *context, struct val_query_chain *matched_q,
 {
     int ret_val;
 
-    val_log(NULL, LOG_DEBUG, __FUNCTION__);
+    VAL_LOG(NULL, LOG_DEBUG, __FUNCTION__);
 
 
     /*
      * If we don't want to fallback just return the error
      */
     if (matched_q->qc_flags & VAL_QUERY_NO_EDNS0_FALLBACK) {
+        if (server == NULL)
+            _mark_servers_unreachable(matched_q);
         matched_q->qc_state = Q_RESPONSE_ERROR;
         val_res_cancel(matched_q);
         return;
@@ -2395,15 +2468,17 @@ val_res_nsfallback(val_context_t *context, struct val_query_chain *matched_q,
 #endif
         ret_val = res_nsfallback(matched_q->qc_trans_id, closest_event, server);
     if (ret_val < 0) {
+        if (server == NULL)
+            _mark_servers_unreachable(matched_q);
         matched_q->qc_state = Q_RESPONSE_ERROR;
         val_res_cancel(matched_q);
     }
     else if (1 == ret_val) {
-        val_log(context, LOG_DEBUG,
+        VAL_LOG(context, LOG_DEBUG,
                 "val_res_nsfallback(): Doing EDNS0 fallback"); 
     }
     else {
-        val_log(context, LOG_DEBUG,
+        VAL_LOG(context, LOG_DEBUG,
                 "val_res_nsfallback(): Moving to next address"); 
     }
 }
@@ -2421,11 +2496,11 @@ _process_rcvd_response(val_context_t * context,
     struct val_query_chain *matched_q = matched_qfq->qfq_query;
     int ret_val;
 
-    val_log(NULL, LOG_DEBUG, __FUNCTION__);
+    VAL_LOG(NULL, LOG_DEBUG, __FUNCTION__);
 
     matched_q->qc_respondent_server = server;
 
-    *response = (struct domain_info *) MALLOC(sizeof(struct domain_info));
+    *response = (struct domain_info *) arena_malloc(sizeof(struct domain_info));
     if (*response == NULL) {
         if (response_data)
             FREE(response_data);
@@ -2443,19 +2518,23 @@ _process_rcvd_response(val_context_t * context,
     (*response)->di_requested_type_h = matched_q->qc_type_h;
     (*response)->di_requested_class_h = matched_q->qc_class_h;
 
-    if (((*response)->di_requested_name_h = STRDUP(name_p)) == NULL) {
-        FREE(*response);
+    (*response)->di_requested_name_h =
+        (char *) arena_malloc(strlen(name_p) + 1);
+    if ((*response)->di_requested_name_h == NULL) {
+        arena_free(*response);
         *response = NULL;
         if (response_data)
             FREE(response_data);
         return VAL_OUT_OF_MEMORY;
     }
 
+    strcpy((*response)->di_requested_name_h, name_p);
+
     if ((ret_val = digest_response(context, matched_qfq,
                                    queries, response_data, response_length,
                                    *response) != VAL_NO_ERROR)) {
         free_domain_info_ptrs(*response);
-        FREE(*response);
+        arena_free(*response);
         *response = NULL;
         FREE(response_data);
         return ret_val;
@@ -2464,13 +2543,20 @@ _process_rcvd_response(val_context_t * context,
     if (matched_q->qc_state == Q_RESPONSE_ERROR) {
         /* try a different NS if possible */
         free_domain_info_ptrs(*response);
-        FREE(*response);
+        arena_free(*response);
         *response = NULL;
         val_res_nsfallback(context, matched_q, server, closest_event);
         if (matched_q->qc_state != Q_RESPONSE_ERROR)
             matched_q->qc_state = Q_SENT;
     }
     else {
+        /*
+         * a lame server has already been recorded as such; a server
+         * that gave a referral has been recorded and released
+         */
+        if (matched_q->qc_state != Q_REFERRAL_ERROR)
+            stow_server_response(matched_q->qc_respondent_server,
+                    !(matched_q->qc_flags & VAL_QUERY_DONT_VALIDATE));
         /* we're good to go, cancel pending query transactions */
         val_res_cancel(matched_q);
         (*response)->di_res_error = SR_UNSET;
@@ -2486,6 +2572,92 @@ _process_rcvd_response(val_context_t * context,
     return VAL_NO_ERROR;
 }
 
+/*
+ * Answer a query from a local zone mirror, if one covers it.  The
+ * response is processed exactly as if it had come from the zone's
+ * servers.  *answered is left as 0 if the query has to go out to
+ * the network.
+ */
+int
+val_resquery_mirror(val_context_t * context,
+                    struct queries_for_query *matched_qfq,
+                    struct domain_info **response,
+                    struct queries_for_query **queries,
+                    int *answered)
+{
+    struct val_query_chain *matched_q;
+    struct name_server *server;
+    struct timeval  closest_event;
+    u_char          zone_n[NS_MAXCDNAME];
+    u_char         *response_data = NULL;
+    size_t          response_length = 0;
+    char            name_p[NS_MAXDNAME];
+    size_t          len;
+    int             ret_val;
+
+    if ((context == NULL) || (matched_qfq == NULL) || (response == NULL) ||
+        (queries == NULL) || (answered == NULL))
+        return VAL_BAD_ARGUMENT;
+
+    matched_q = matched_qfq->qfq_query;
+    *response = NULL;
+    *answered = 0;
+
+    if (context->zone_mirrors == NULL)
+        return VAL_NO_ERROR;
+
+    if (VAL_NO_ERROR != (ret_val = zone_mirror_answer(context, matched_q,
+                    (matched_q->qc_flags & VAL_QUERY_IS_ITERATING) != 0,
+                    zone_n, &response_data, &response_length)) ||
+        response_data == NULL)
+        return ret_val;
+
+    if (ns_name_ntop(matched_q->qc_name_n, name_p, sizeof(name_p)) == -1) {
+        FREE(response_data);
+        return VAL_NO_ERROR;
+    }
+
+    VAL_LOG(context, LOG_INFO,
+            "val_resquery_mirror(): Answering {%s %s(%d) %s(%d)} from local zone copy",
+            name_p, p_class(matched_q->qc_class_h), matched_q->qc_class_h,
+            p_type(matched_q->qc_type_h), matched_q->qc_type_h);
+
+    /* the response is from the mirrored zone */
+    if (matched_q->qc_zonecut_n != NULL)
+        FREE(matched_q->qc_zonecut_n);
+    len = wire_name_length(zone_n);
+    matched_q->qc_zonecut_n = (u_char *) MALLOC(len * sizeof(u_char));
+    if (matched_q->qc_zonecut_n == NULL) {
+        FREE(response_data);
+        return VAL_OUT_OF_MEMORY;
+    }
+    memcpy(matched_q->qc_zonecut_n, zone_n, len);
+
+    if (NULL == (server = create_name_server())) {
+        FREE(response_data);
+        return VAL_OUT_OF_MEMORY;
+    }
+    memcpy(server->ns_name_n, zone_n, len);
+    if (matched_q->qc_respondent_server)
+        free_name_server(&matched_q->qc_respondent_server);
+
+    memset(&closest_event, 0, sizeof(closest_event));
+    ret_val = _process_rcvd_response(context, matched_qfq, response, queries,
+                                     &closest_event, name_p, server,
+                                     response_data, response_length);
+    if (ret_val != VAL_NO_ERROR)
+        return ret_val;
+
+    if (matched_q->qc_state == Q_RESPONSE_ERROR) {
+        /* couldn't use it after all; ask the servers instead */
+        matched_q->qc_state = Q_INIT;
+        return VAL_NO_ERROR;
+    }
+
+    *answered = 1;
+    return VAL_NO_ERROR;
+}
+
 /*****************************************************************************
  *
  *
@@ -2512,7 +2684,7 @@ val_resquery_async_send(val_context_t * context,
     if ((matched_qfq == NULL) || (matched_qfq->qfq_query->qc_ns_list == NULL))
         return VAL_BAD_ARGUMENT;
 
-    val_log(NULL, LOG_DEBUG, __FUNCTION__);
+    VAL_LOG(NULL, LOG_DEBUG, __FUNCTION__);
 
     /** Can never be NULL if matched_qfq is not NULL */
     matched_q = matched_qfq->qfq_query;
@@ -2520,16 +2692,20 @@ val_resquery_async_send(val_context_t * context,
     if (ns_name_ntop(matched_q->qc_name_n, name_p, sizeof(name_p)) == -1)
         return VAL_BAD_ARGUMENT;
 
-    if (val_log_debug_level() >= LOG_DEBUG ) {
+    apply_server_capabilities(context, &matched_q->qc_ns_list,
+            matched_q->qc_zonecut_n,
+            !(matched_q->qc_flags & VAL_QUERY_NO_EDNS0_FALLBACK));
+
+    if (VAL_LOG_ENABLED(LOG_DEBUG)) {
         struct name_server *tempns;
         struct name_server *nslist = matched_q->qc_ns_list;
 
-        val_log(context, LOG_DEBUG,
+        VAL_LOG(context, LOG_DEBUG,
                 "val_resquery_async_send(): Sending query for {%s %s(%d) %s(%d)} to:", 
                 name_p, p_class(matched_q->qc_class_h), matched_q->qc_class_h,
                 p_type(matched_q->qc_type_h), matched_q->qc_type_h);
         for (tempns = nslist; tempns; tempns = tempns->ns_next) {
-            val_log(context, LOG_DEBUG, "    %s",
+            VAL_LOG(context, LOG_DEBUG, "    %s",
                     val_get_ns_string((struct sockaddr *)tempns->ns_address[0],
                                       name_buf, sizeof(name_buf)));
         }
@@ -2541,6 +2717,11 @@ val_resquery_async_send(val_context_t * context,
     gettimeofday(&now, NULL);
     matched_q->qc_last_sent = now.tv_sec;
 
+    if (val_trace_enabled)
+        val_trace_query(matched_q->qc_trace_id, matched_q->qc_name_n,
+                        matched_q->qc_type_h, matched_q->qc_class_h,
+                        matched_q->qc_ns_list);
+
     matched_q->qc_ea = res_async_query_send(name_p, matched_q->qc_type_h,
                                             matched_q->qc_class_h, 
                                             matched_q->qc_ns_list);
@@ -2572,7 +2753,7 @@ val_resquery_async_rcv(val_context_t * context,
         (pending_desc == NULL))
         return VAL_BAD_ARGUMENT;
 
-    val_log(NULL, LOG_DEBUG, __FUNCTION__);
+    VAL_LOG(NULL, LOG_DEBUG, __FUNCTION__);
 
     matched_q = matched_qfq->qfq_query; /* ! NULL if matched_qfq ! NULL */
     *response = NULL;
@@ -2637,7 +2818,7 @@ val_async_select_info(val_context_t *ctx, fd_set *activefds,
     if (NULL == context)
         return VAL_BAD_ARGUMENT;
 
-    val_log(NULL, LOG_DEBUG, __FUNCTION__);
+    VAL_LOG(NULL, LOG_DEBUG, __FUNCTION__);
     gettimeofday(&now, NULL);
 
     /** need to adjust relative timeout to absolute time used by libval */
@@ -2675,10 +2856,11 @@ val_async_select_info(val_context_t *ctx, fd_set *activefds,
         for (qfq = as->val_as_queries; qfq; qfq = qfq->qfq_next) {
 
             char         name_p[NS_MAXDNAME];
-            if (-1 == ns_name_ntop(qfq->qfq_query->qc_name_n, name_p, sizeof(name_p)))
+            if (VAL_LOG_ENABLED(LOG_DEBUG) &&
+                -1 == ns_name_ntop(qfq->qfq_query->qc_name_n, name_p, sizeof(name_p)))
                 snprintf(name_p, sizeof(name_p), "unknown/error");
             if (!qfq->qfq_query->qc_ea || (qfq->qfq_query->qc_flags & VAL_QUERY_SKIP_RESOLVER)) {
-                val_log(NULL, LOG_DEBUG+1, " as %p query %p {%s %s(%d) %s(%d)} ea %p", as, qfq,
+                VAL_LOG(NULL, LOG_DEBUG+1, " as %p query %p {%s %s(%d) %s(%d)} ea %p", as, qfq,
                         name_p, p_class(qfq->qfq_query->qc_class_h),
                         qfq->qfq_query->qc_class_h,
                         p_type(qfq->qfq_query->qc_type_h),
@@ -2686,7 +2868,7 @@ val_async_select_info(val_context_t *ctx, fd_set *activefds,
                 continue;
             }
             cache_only = 0;
-            val_log(NULL, LOG_DEBUG, " as %p query %p {%s %s(%d) %s(%d)} ea %p", as, qfq,
+            VAL_LOG(NULL, LOG_DEBUG, " as %p query %p {%s %s(%d) %s(%d)} ea %p", as, qfq,
                     name_p, p_class(qfq->qfq_query->qc_class_h),
                     qfq->qfq_query->qc_class_h,
                     p_type(qfq->qfq_query->qc_type_h),
@@ -2712,7 +2894,7 @@ val_async_select_info(val_context_t *ctx, fd_set *activefds,
             timeout->tv_usec = 0;
         } else if (timeout->tv_usec < 0)
             timeout->tv_usec = 0;
-        val_log(context, LOG_DEBUG,
+        VAL_LOG(context, LOG_DEBUG,
                 "val_async_select_info: next event at %ld.%ld (%ld.%ld)",
                 closest.tv_sec, closest.tv_usec,
                 timeout->tv_sec, timeout->tv_usec);
@@ -0,0 +1,611 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * Optional runtime for the asynchronous API.  Once started for a
+ * context, an internal thread owns the sockets and timers of every
+ * pending request in that context: it waits for them, processes
+ * responses and retries, and starts queued batch requests.  The
+ * application only submits requests and receives callbacks.
+ *
+ * Callbacks for completed requests are delivered in one of three ways:
+ *  - on the runtime thread itself (the default);
+ *  - through an application supplied executor, which is handed one
+ *    task per completed request and may run it on any thread;
+ *  - with VAL_RT_NOTIFY, queued until the application calls
+ *    val_async_runtime_dispatch().  The descriptor returned by
+ *    val_async_runtime_fd() becomes readable whenever callbacks are
+ *    waiting, so it can be added to an existing event loop.
+ */
+#include "validator-internal.h"
+
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+#include "val_assertion.h"
+#include "val_context.h"
+#include "val_runtime.h"
+
+#if !defined(VAL_NO_ASYNC) && !defined(VAL_NO_THREADS)
+
+/* upper bound on one wait when nothing is pending */
+#define RT_IDLE_WAIT    60
+
+/*
+ * A wakeup channel: an eventfd where available, else a pipe.  The
+ * read side is non-blocking so that draining never stalls.
+ */
+struct rt_channel {
+    int             fd_r;
+    int             fd_w;
+};
+
+struct val_async_runtime {
+    val_context_t          *rt_ctx;
+    pthread_t               rt_tid;
+    unsigned int            rt_flags;
+    u_int32_t               rt_saved_ctx_flags;
+    val_async_executor_fn   rt_executor;
+    void                   *rt_exec_data;
+    struct rt_channel       rt_wake;    /* wakes the runtime thread */
+    struct rt_channel       rt_notify;  /* VAL_RT_NOTIFY: callbacks waiting */
+    pthread_mutex_t         rt_lock;    /* protects rt_ready, rt_pause.. */
+    pthread_cond_t          rt_cond;    /* rt_pause, rt_parked, rt_exited */
+    val_async_status       *rt_ready;   /* VAL_RT_NOTIFY: completed requests */
+    val_async_status      **rt_ready_tail;
+    int                     rt_refs;    /* under CTX_LOCK_ACACHE */
+    int                     rt_pause;   /* see val_runtime_pause() */
+    int                     rt_parked;
+    int                     rt_exited;
+    int                     rt_free_context;    /* see val_runtime_defer_free() */
+    volatile int            rt_stop;
+};
+
+static int
+_channel_open(struct rt_channel *ch)
+{
+    int             fds[2];
+
+#ifdef HAVE_SYS_EVENTFD_H
+    ch->fd_r = ch->fd_w = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ch->fd_r != -1)
+        return VAL_NO_ERROR;
+#endif
+    if (pipe(fds) == -1)
+        return VAL_RESOURCE_UNAVAILABLE;
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    ch->fd_r = fds[0];
+    ch->fd_w = fds[1];
+    return VAL_NO_ERROR;
+}
+
+static void
+_channel_close(struct rt_channel *ch)
+{
+    if (ch->fd_r != -1)
+        close(ch->fd_r);
+    if (ch->fd_w != -1 && ch->fd_w != ch->fd_r)
+        close(ch->fd_w);
+    ch->fd_r = ch->fd_w = -1;
+}
+
+static void
+_channel_signal(struct rt_channel *ch)
+{
+    u_int64_t       one = 1;
+
+    /*
+     * a full pipe or a saturated eventfd is already readable, so a
+     * failed write loses nothing
+     */
+    if (ch->fd_w == ch->fd_r) {
+        if (write(ch->fd_w, &one, sizeof(one)) < 0)
+            return;
+    } else if (write(ch->fd_w, "", 1) < 0)
+        return;
+}
+
+static void
+_channel_drain(struct rt_channel *ch)
+{
+    char            buf[64];
+
+    while (read(ch->fd_r, buf, sizeof(buf)) > 0)
+        ;
+}
+
+/*
+ * Wake the runtime thread so that it picks up newly submitted requests.
+ * Caller must hold CTX_LOCK_ACACHE.
+ */
+void
+val_runtime_kick(struct val_async_runtime *rt)
+{
+    _channel_signal(&rt->rt_wake);
+}
+
+static void
+_runtime_free(struct val_async_runtime *rt)
+{
+    _channel_close(&rt->rt_wake);
+    _channel_close(&rt->rt_notify);
+    pthread_cond_destroy(&rt->rt_cond);
+    pthread_mutex_destroy(&rt->rt_lock);
+    FREE(rt);
+}
+
+/*
+ * Keep the runtime from being freed by val_async_runtime_stop() while
+ * it is used without CTX_LOCK_ACACHE.  The context holds one reference
+ * for as long as the runtime is running.
+ * Caller must hold CTX_LOCK_ACACHE.
+ */
+void
+val_runtime_hold(struct val_async_runtime *rt)
+{
+    ++rt->rt_refs;
+}
+
+/*
+ * Drop a reference taken with val_runtime_hold(); the last one frees
+ * the runtime.  Caller must not hold CTX_LOCK_ACACHE.
+ */
+void
+val_runtime_release(val_context_t *context, struct val_async_runtime *rt)
+{
+    int             last;
+
+    CTX_LOCK_ACACHE(context);
+    last = (--rt->rt_refs == 0);
+    CTX_UNLOCK_ACACHE(context);
+    if (last)
+        _runtime_free(rt);
+}
+
+static void
+_runtime_task(void *task_data)
+{
+    val_async_deliver((val_async_status *) task_data);
+}
+
+/*
+ * Hand a completed request to the configured executor, or queue it for
+ * val_async_runtime_dispatch().  Returns 1 if the runtime took the
+ * request, 0 if the caller should deliver it, as it must once the
+ * runtime is being stopped.
+ */
+int
+val_runtime_deliver(struct val_async_runtime *rt, val_async_status *as)
+{
+    int             was_empty;
+
+    if (rt->rt_stop)
+        return 0;
+
+    if (rt->rt_executor) {
+        (*rt->rt_executor)(_runtime_task, as, rt->rt_exec_data);
+        return 1;
+    }
+
+    if (!(rt->rt_flags & VAL_RT_NOTIFY))
+        return 0;
+
+    pthread_mutex_lock(&rt->rt_lock);
+    /* val_async_runtime_stop() may have taken the list already */
+    if (rt->rt_stop) {
+        pthread_mutex_unlock(&rt->rt_lock);
+        return 0;
+    }
+    was_empty = (rt->rt_ready == NULL);
+    *rt->rt_ready_tail = as;
+    rt->rt_ready_tail = &as->val_as_next;
+    pthread_mutex_unlock(&rt->rt_lock);
+
+    if (was_empty)
+        _channel_signal(&rt->rt_notify);
+    return 1;
+}
+
+/*
+ * Take a runtime whose thread has exited off its context, deliver the
+ * callbacks it still holds and drop the context's reference.
+ */
+static void
+_runtime_detach(val_context_t *context, struct val_async_runtime *rt)
+{
+    val_async_status *as, *ready;
+
+    CTX_LOCK_ACACHE(context);
+    context->as_runtime = NULL;
+    context->ctx_flags = rt->rt_saved_ctx_flags;
+    CTX_UNLOCK_ACACHE(context);
+
+    /* a concurrent val_async_runtime_dispatch() may be emptying it too */
+    pthread_mutex_lock(&rt->rt_lock);
+    ready = rt->rt_ready;
+    rt->rt_ready = NULL;
+    rt->rt_ready_tail = &rt->rt_ready;
+    pthread_mutex_unlock(&rt->rt_lock);
+
+    while (NULL != (as = ready)) {
+        ready = as->val_as_next;
+        as->val_as_next = NULL;
+        val_async_deliver(as);
+    }
+
+    val_runtime_release(context, rt);
+}
+
+static void *
+_runtime_thread(void *arg)
+{
+    struct val_async_runtime *rt = (struct val_async_runtime *) arg;
+    val_context_t  *context = rt->rt_ctx;
+    struct timeval  tv;
+    fd_set          fds;
+    int             nfds;
+
+    VAL_LOG(context, LOG_INFO, "async runtime: started");
+
+    while (!rt->rt_stop) {
+        /* stay out of the context while val_free_context() looks at it */
+        pthread_mutex_lock(&rt->rt_lock);
+        if (rt->rt_pause) {
+            rt->rt_parked = 1;
+            pthread_cond_broadcast(&rt->rt_cond);
+            while (rt->rt_pause && !rt->rt_stop)
+                pthread_cond_wait(&rt->rt_cond, &rt->rt_lock);
+            rt->rt_parked = 0;
+            pthread_mutex_unlock(&rt->rt_lock);
+            continue;
+        }
+        pthread_mutex_unlock(&rt->rt_lock);
+
+        FD_ZERO(&fds);
+        nfds = 0;
+        tv.tv_sec = RT_IDLE_WAIT;
+        tv.tv_usec = 0;
+        if (VAL_NO_ERROR != val_async_select_info(context, &fds, &nfds, &tv)) {
+            tv.tv_sec = 1;
+            tv.tv_usec = 0;
+        }
+
+        FD_SET(rt->rt_wake.fd_r, &fds);
+        if (rt->rt_wake.fd_r >= nfds)
+            nfds = rt->rt_wake.fd_r + 1;
+
+        if (select(nfds, &fds, NULL, NULL, &tv) < 0) {
+            /* a request may have been cancelled and its socket closed */
+            if (errno != EINTR)
+                VAL_LOG(context, LOG_DEBUG, "async runtime: select: %s",
+                        strerror(errno));
+            FD_ZERO(&fds);
+        }
+
+        if (FD_ISSET(rt->rt_wake.fd_r, &fds)) {
+            _channel_drain(&rt->rt_wake);
+            FD_CLR(rt->rt_wake.fd_r, &fds);
+        }
+        if (rt->rt_stop)
+            break;
+
+        val_async_check_wait(context, &fds, &nfds, NULL, 0);
+    }
+
+    VAL_LOG(context, LOG_INFO, "async runtime: stopped");
+
+    pthread_mutex_lock(&rt->rt_lock);
+    rt->rt_exited = 1;
+    pthread_cond_broadcast(&rt->rt_cond);
+    pthread_mutex_unlock(&rt->rt_lock);
+
+    if (rt->rt_free_context) {
+        /*
+         * val_free_context() was called from one of our callbacks;
+         * nobody will join us, so finish the job here.
+         */
+        pthread_detach(rt->rt_tid);
+        _runtime_detach(context, rt);
+        val_free_context(context);
+    }
+    return NULL;
+}
+
+/*
+ * Function: val_async_runtime_start
+ *
+ * Purpose: start an internal thread that drives all async requests in
+ *          the context
+ *
+ * Parameters: context -- context whose requests the runtime handles
+ *             flags -- VAL_RT_NOTIFY to queue callbacks for
+ *                      val_async_runtime_dispatch()
+ *             executor -- if not NULL, called once per completed request
+ *                         with a task that runs its callback
+ *             exec_data -- passed to executor
+ *
+ * Returns: VAL_NO_ERROR, or a VAL_* error.
+ */
+int
+val_async_runtime_start(val_context_t *context, unsigned int flags,
+                        val_async_executor_fn executor, void *exec_data)
+{
+    struct val_async_runtime *rt;
+    int             retval;
+
+    if (context == NULL)
+        return VAL_BAD_ARGUMENT;
+
+    rt = (struct val_async_runtime *)
+        MALLOC(sizeof(struct val_async_runtime));
+    if (rt == NULL)
+        return VAL_OUT_OF_MEMORY;
+    memset(rt, 0, sizeof(*rt));
+    rt->rt_ctx = context;
+    rt->rt_flags = flags;
+    rt->rt_executor = executor;
+    rt->rt_exec_data = exec_data;
+    rt->rt_ready_tail = &rt->rt_ready;
+    rt->rt_refs = 1;
+    rt->rt_wake.fd_r = rt->rt_wake.fd_w = -1;
+    rt->rt_notify.fd_r = rt->rt_notify.fd_w = -1;
+
+    if (VAL_NO_ERROR != (retval = _channel_open(&rt->rt_wake)) ||
+        ((flags & VAL_RT_NOTIFY) &&
+         VAL_NO_ERROR != (retval = _channel_open(&rt->rt_notify)))) {
+        _channel_close(&rt->rt_wake);
+        FREE(rt);
+        return retval;
+    }
+    pthread_mutex_init(&rt->rt_lock, NULL);
+    pthread_cond_init(&rt->rt_cond, NULL);
+
+    CTX_LOCK_ACACHE(context);
+    if (context->as_runtime != NULL) {
+        CTX_UNLOCK_ACACHE(context);
+        retval = VAL_BAD_ARGUMENT;
+        goto err;
+    }
+    /* the runtime thread processes requests from every thread */
+    rt->rt_saved_ctx_flags = context->ctx_flags;
+    context->ctx_flags |= CTX_PROCESS_ALL_THREADS;
+    context->as_runtime = rt;
+    CTX_UNLOCK_ACACHE(context);
+
+    if (0 != pthread_create(&rt->rt_tid, NULL, _runtime_thread, rt)) {
+        CTX_LOCK_ACACHE(context);
+        context->as_runtime = NULL;
+        context->ctx_flags = rt->rt_saved_ctx_flags;
+        CTX_UNLOCK_ACACHE(context);
+        retval = VAL_RESOURCE_UNAVAILABLE;
+        goto err;
+    }
+    return VAL_NO_ERROR;
+
+  err:
+    _runtime_free(rt);
+    return retval;
+}
+
+/*
+ * Function: val_async_runtime_stop
+ *
+ * Purpose: stop the runtime thread for a context.  Callbacks still
+ *          waiting for val_async_runtime_dispatch() are delivered on the
+ *          calling thread; requests that have not completed stay pending
+ *          and may be driven with val_async_check_wait() again.  The
+ *          runtime is freed once no val_async_runtime_dispatch() call
+ *          is using it.
+ *
+ * Returns: VAL_NO_ERROR, or VAL_BAD_ARGUMENT if no runtime is running.
+ */
+int
+val_async_runtime_stop(val_context_t *context)
+{
+    struct val_async_runtime *rt;
+
+    if (context == NULL)
+        return VAL_BAD_ARGUMENT;
+
+    CTX_LOCK_ACACHE(context);
+    rt = context->as_runtime;
+    if (rt && (pthread_equal(pthread_self(), rt->rt_tid) ||
+               rt->rt_free_context)) {
+        /*
+         * cannot wait for ourselves from inside a callback, and a
+         * runtime that is freeing its context stops by itself
+         */
+        CTX_UNLOCK_ACACHE(context);
+        return VAL_BAD_ARGUMENT;
+    }
+    if (rt) {
+        rt->rt_stop = 1;
+        val_runtime_kick(rt);
+    }
+    CTX_UNLOCK_ACACHE(context);
+    if (rt == NULL)
+        return VAL_BAD_ARGUMENT;
+
+    /* the thread may be parked by val_runtime_pause() */
+    pthread_mutex_lock(&rt->rt_lock);
+    pthread_cond_broadcast(&rt->rt_cond);
+    pthread_mutex_unlock(&rt->rt_lock);
+
+    pthread_join(rt->rt_tid, NULL);
+    _runtime_detach(context, rt);
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Park the runtime thread of a context, if it has one, so that it holds
+ * no context locks until val_runtime_resume() is called or the runtime
+ * is stopped.  Returns the runtime, which must be passed to
+ * val_runtime_resume(), or NULL.  Must not be called on the runtime
+ * thread.
+ */
+struct val_async_runtime *
+val_runtime_pause(val_context_t *context)
+{
+    struct val_async_runtime *rt;
+
+    CTX_LOCK_ACACHE(context);
+    if (NULL != (rt = context->as_runtime))
+        val_runtime_hold(rt);
+    CTX_UNLOCK_ACACHE(context);
+    if (rt == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&rt->rt_lock);
+    ++rt->rt_pause;
+    val_runtime_kick(rt);
+    while (!rt->rt_parked && !rt->rt_exited)
+        pthread_cond_wait(&rt->rt_cond, &rt->rt_lock);
+    pthread_mutex_unlock(&rt->rt_lock);
+    return rt;
+}
+
+void
+val_runtime_resume(val_context_t *context, struct val_async_runtime *rt)
+{
+    if (rt == NULL)
+        return;
+
+    pthread_mutex_lock(&rt->rt_lock);
+    if (--rt->rt_pause == 0)
+        pthread_cond_broadcast(&rt->rt_cond);
+    pthread_mutex_unlock(&rt->rt_lock);
+    val_runtime_release(context, rt);
+}
+
+/*
+ * val_free_context() cannot stop the runtime from inside one of its
+ * callbacks.  Instead, tell the runtime thread to stop and free the
+ * context itself once the callback has returned.
+ *
+ * Returns 1 if the context will be freed by the runtime thread.
+ */
+int
+val_runtime_defer_free(val_context_t *context)
+{
+    struct val_async_runtime *rt;
+    int             deferred = 0;
+
+    CTX_LOCK_ACACHE(context);
+    rt = context->as_runtime;
+    if (rt && pthread_equal(pthread_self(), rt->rt_tid)) {
+        rt->rt_free_context = 1;
+        rt->rt_stop = 1;
+        deferred = 1;
+    }
+    CTX_UNLOCK_ACACHE(context);
+    return deferred;
+}
+
+/*
+ * Function: val_async_runtime_fd
+ *
+ * Purpose: get the descriptor that becomes readable when callbacks are
+ *          waiting for val_async_runtime_dispatch()
+ *
+ * Returns: a file descriptor, or -1 if the runtime was not started with
+ *          VAL_RT_NOTIFY.
+ */
+int
+val_async_runtime_fd(val_context_t *context)
+{
+    int             fd = -1;
+
+    if (context == NULL)
+        return -1;
+
+    CTX_LOCK_ACACHE(context);
+    if (context->as_runtime)
+        fd = context->as_runtime->rt_notify.fd_r;
+    CTX_UNLOCK_ACACHE(context);
+    return fd;
+}
+
+/*
+ * Function: val_async_runtime_dispatch
+ *
+ * Purpose: call the callbacks for requests that the runtime has
+ *          completed, on the calling thread
+ *
+ * Returns: the number of requests delivered, or a VAL_* error.
+ */
+int
+val_async_runtime_dispatch(val_context_t *context)
+{
+    struct val_async_runtime *rt;
+    val_async_status *as, *ready;
+    int             count = 0;
+
+    if (context == NULL)
+        return VAL_BAD_ARGUMENT;
+
+    CTX_LOCK_ACACHE(context);
+    rt = context->as_runtime;
+    if (rt == NULL || !(rt->rt_flags & VAL_RT_NOTIFY)) {
+        CTX_UNLOCK_ACACHE(context);
+        return VAL_BAD_ARGUMENT;
+    }
+    /* val_async_runtime_stop() must not free it under us */
+    val_runtime_hold(rt);
+    CTX_UNLOCK_ACACHE(context);
+
+    /* drain first, so a completion after this point signals again */
+    _channel_drain(&rt->rt_notify);
+
+    pthread_mutex_lock(&rt->rt_lock);
+    ready = rt->rt_ready;
+    rt->rt_ready = NULL;
+    rt->rt_ready_tail = &rt->rt_ready;
+    pthread_mutex_unlock(&rt->rt_lock);
+
+    while (NULL != (as = ready)) {
+        ready = as->val_as_next;
+        as->val_as_next = NULL;
+        val_async_deliver(as);
+        ++count;
+    }
+
+    val_runtime_release(context, rt);
+    return count;
+}
+
+#else /* VAL_NO_ASYNC || VAL_NO_THREADS */
+
+#ifndef VAL_NO_ASYNC
+int
+val_async_runtime_start(val_context_t *context, unsigned int flags,
+                        val_async_executor_fn executor, void *exec_data)
+{
+    return VAL_NOT_IMPLEMENTED;
+}
+
+int
+val_async_runtime_stop(val_context_t *context)
+{
+    return VAL_BAD_ARGUMENT;
+}
+
+int
+val_async_runtime_fd(val_context_t *context)
+{
+    return -1;
+}
+
+int
+val_async_runtime_dispatch(val_context_t *context)
+{
+    return VAL_BAD_ARGUMENT;
+}
+#endif
+
+#endif /* VAL_NO_ASYNC || VAL_NO_THREADS */
@@ -0,0 +1,21 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+#ifndef VAL_RUNTIME_H
+#define VAL_RUNTIME_H
+
+#if !defined(VAL_NO_ASYNC) && !defined(VAL_NO_THREADS)
+void            val_runtime_kick(struct val_async_runtime *rt);
+void            val_runtime_hold(struct val_async_runtime *rt);
+void            val_runtime_release(val_context_t *context,
+                                    struct val_async_runtime *rt);
+struct val_async_runtime *val_runtime_pause(val_context_t *context);
+void            val_runtime_resume(val_context_t *context,
+                                   struct val_async_runtime *rt);
+int             val_runtime_defer_free(val_context_t *context);
+int             val_runtime_deliver(struct val_async_runtime *rt,
+                                    val_async_status *as);
+#endif
+
+#endif
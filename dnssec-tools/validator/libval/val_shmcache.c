@@ -0,0 +1,921 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * An rrset cache shared by all processes on a host, kept in a file
+ * that every process maps into memory (the shared-cache option in
+ * dnsval.conf).  It sits behind the answer cache in val_cache.c:
+ * answers stored there are published here too, and answers missing
+ * from it are looked for here before a query goes out.  Like any
+ * other cached data, rrsets read from here are validated before they
+ * are used, but that only protects answers from signed zones: anything
+ * that can write to the file can plant answers for unsigned zones or
+ * for names that are not validated.  The file is therefore only used
+ * if it belongs to the effective user and no one else can write to it,
+ * which makes the cache shared by the processes of one user.
+ *
+ * The file holds a header, an array of hash buckets and a log of
+ * variable-size records.  Processes map the file at different
+ * addresses, so records refer to each other by their offset from the
+ * start of the file.  New records are written at the head of the log
+ * and overwrite the oldest ones, so the file never grows.
+ *
+ * The file is updated under a robust, process-shared mutex where the
+ * platform has one, and otherwise under an fcntl() lock.  A writer
+ * sets sh_dirty for as long as the file may be inconsistent, so if it
+ * dies half way, the next process to take the lock empties the cache.
+ * Offsets and lengths read from the file are checked before they are
+ * used; anything out of bounds also gets the cache emptied.
+ */
+#include "validator-internal.h"
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include "val_support.h"
+#include "val_resquery.h"
+#include "val_shmcache.h"
+
+#if defined(HAVE_SYS_MMAN_H) && \
+    (defined(HAVE_FLOCK) || \
+     (!defined(VAL_NO_THREADS) && defined(HAVE_PTHREAD_MUTEXATTR_SETROBUST)))
+
+#define SHM_CACHE_MAGIC     0x64767363  /* "dvsc" */
+#define SHM_CACHE_VERSION   2
+#define SHM_CACHE_MIN_SIZE  (64 * 1024)
+#define SHM_CACHE_MAX_SIZE  (1024 * 1024 * 1024)
+#define SHM_CACHE_ALIGN(n)  (((n) + 7) & ~((size_t) 7))
+#define SHM_CACHE_MAX_CHAIN 1024        /* longest bucket chain followed */
+
+#define SHM_LOCK_MUTEX      1
+#define SHM_LOCK_FCNTL      2
+
+#if !defined(VAL_NO_THREADS) && defined(HAVE_PTHREAD_MUTEXATTR_SETROBUST)
+#define SHM_LOCK_KIND       SHM_LOCK_MUTEX
+#else
+#define SHM_LOCK_KIND       SHM_LOCK_FCNTL
+#endif
+
+struct shm_cache_hdr {
+    u_int32_t       sh_magic;
+    u_int32_t       sh_version;
+    u_int32_t       sh_lock_kind;   /* SHM_LOCK_... */
+    u_int32_t       sh_dirty;       /* an update is in progress */
+    u_int32_t       sh_size;        /* size of the file */
+    u_int32_t       sh_nbuckets;
+    u_int32_t       sh_buckets;     /* offset of the bucket array */
+    u_int32_t       sh_log;         /* offset of the record log */
+    u_int32_t       sh_log_size;
+    u_int32_t       sh_resets;
+    u_int64_t       sh_head;        /* log position of the next record */
+    u_int64_t       sh_tail;        /* log position of the oldest record */
+    union {
+#if SHM_LOCK_KIND == SHM_LOCK_MUTEX
+        pthread_mutex_t sl_mutex;
+#endif
+        u_char          sl_pad[128];
+    } sh_lock;
+};
+
+/*
+ * A record holds one rrset.  The header is followed by the owner
+ * name, the zone cut, the respondent's address and then the data and
+ * signature records, each as a 16-bit length, a 16-bit status and
+ * the rdata.  Pad records fill the end of the log when the next
+ * record does not fit there; only their first two fields are used.
+ */
+struct shm_cache_rec {
+    u_int32_t       sr_size;        /* bytes, including this header */
+    u_int32_t       sr_flags;       /* SHM_REC_... */
+    u_int32_t       sr_hash;
+    u_int32_t       sr_next;        /* next record in the bucket */
+    u_int32_t       sr_ttl_h;
+    u_int32_t       sr_ttl_x;
+    u_int32_t       sr_ns_options;
+    int32_t         sr_rcode;
+    u_int16_t       sr_class_h;
+    u_int16_t       sr_type_h;
+    u_int16_t       sr_name_len;
+    u_int16_t       sr_zonecut_len;
+    u_int16_t       sr_server_len;
+    u_int16_t       sr_data_count;
+    u_int16_t       sr_sig_count;
+    u_char          sr_section;
+    u_char          sr_cred;
+    u_char          sr_ans_kind;
+    u_char          sr_unused[7];
+};
+
+#define SHM_REC_LIVE        0x01        /* linked into a bucket */
+#define SHM_REC_PAD         0x02
+
+#define SHM_PTR(hdr, off)   ((u_char *) (hdr) + (off))
+#define SHM_REC(hdr, off)   ((struct shm_cache_rec *) SHM_PTR(hdr, off))
+#define SHM_BUCKETS(hdr)    ((u_int32_t *) SHM_PTR(hdr, (hdr)->sh_buckets))
+
+/* this process's mapping of the cache */
+static char    *shm_cache_path = NULL;
+static int      shm_cache_fd = -1;
+static struct shm_cache_hdr *shm_cache_hdr = NULL;
+static size_t   shm_cache_mapped = 0;
+
+#ifndef VAL_NO_THREADS
+/*
+ * The mapping is only replaced with the map lock held exclusively.
+ * Under an fcntl() lock, which is held by the process rather than a
+ * thread, threads must also take turns among themselves.
+ */
+static pthread_rwlock_t shm_map_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+#define SHM_MAP_LOCK_SH()   pthread_rwlock_rdlock(&shm_map_rwlock)
+#define SHM_MAP_LOCK_EX()   pthread_rwlock_wrlock(&shm_map_rwlock)
+#define SHM_MAP_UNLOCK()    pthread_rwlock_unlock(&shm_map_rwlock)
+#if SHM_LOCK_KIND == SHM_LOCK_FCNTL
+static pthread_mutex_t shm_local_lock = PTHREAD_MUTEX_INITIALIZER;
+#define SHM_LOCAL_LOCK()    pthread_mutex_lock(&shm_local_lock)
+#define SHM_LOCAL_UNLOCK()  pthread_mutex_unlock(&shm_local_lock)
+#endif
+#else
+#define SHM_MAP_LOCK_SH()
+#define SHM_MAP_LOCK_EX()
+#define SHM_MAP_UNLOCK()
+#define SHM_LOCAL_LOCK()
+#define SHM_LOCAL_UNLOCK()
+#endif
+
+static u_int32_t
+shm_cache_key(const u_char *name_n, u_int16_t class_h, u_int16_t type_h)
+{
+    return res_name_hash(name_n, wire_name_length(name_n),
+                         ((u_int32_t) class_h << 16) | type_h);
+}
+
+/*
+ * Work out where the buckets and the log go in a file of the given size
+ */
+static void
+shm_cache_layout(struct shm_cache_hdr *hdr, u_int32_t size)
+{
+    hdr->sh_size = size;
+    /* about one bucket per 256 bytes of log */
+    hdr->sh_nbuckets = (size / 256) | 1;
+    hdr->sh_buckets = SHM_CACHE_ALIGN(sizeof(struct shm_cache_hdr));
+    hdr->sh_log = SHM_CACHE_ALIGN(hdr->sh_buckets +
+                                  hdr->sh_nbuckets * sizeof(u_int32_t));
+    hdr->sh_log_size = (size - hdr->sh_log) & ~((u_int32_t) 7);
+}
+
+static int
+shm_cache_layout_ok(struct shm_cache_hdr *hdr)
+{
+    struct shm_cache_hdr expect;
+
+    shm_cache_layout(&expect, shm_cache_mapped);
+    return (hdr->sh_size == expect.sh_size &&
+            hdr->sh_nbuckets == expect.sh_nbuckets &&
+            hdr->sh_buckets == expect.sh_buckets &&
+            hdr->sh_log == expect.sh_log &&
+            hdr->sh_log_size == expect.sh_log_size &&
+            hdr->sh_head >= hdr->sh_tail &&
+            hdr->sh_head - hdr->sh_tail <= hdr->sh_log_size);
+}
+
+/*
+ * Empty the cache.  The caller holds the lock.
+ */
+static void
+shm_cache_reset(struct shm_cache_hdr *hdr)
+{
+    shm_cache_layout(hdr, shm_cache_mapped);
+    memset(SHM_BUCKETS(hdr), 0, hdr->sh_nbuckets * sizeof(u_int32_t));
+    hdr->sh_head = 0;
+    hdr->sh_tail = 0;
+    hdr->sh_resets++;
+    hdr->sh_dirty = 0;
+}
+
+static int
+shm_cache_lock(struct shm_cache_hdr *hdr)
+{
+#if SHM_LOCK_KIND == SHM_LOCK_MUTEX
+    int             rc;
+
+    rc = pthread_mutex_lock(&hdr->sh_lock.sl_mutex);
+    if (rc == EOWNERDEAD) {
+        /* a writer that died leaves sh_dirty set, handled below */
+        pthread_mutex_consistent(&hdr->sh_lock.sl_mutex);
+    } else if (rc != 0) {
+        return -1;
+    }
+#else
+    struct flock    fl;
+
+    SHM_LOCAL_LOCK();
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = 0;
+    fl.l_len = 1;
+    while (-1 == fcntl(shm_cache_fd, F_SETLKW, &fl)) {
+        if (errno != EINTR) {
+            SHM_LOCAL_UNLOCK();
+            return -1;
+        }
+    }
+#endif
+
+    if (hdr->sh_dirty || !shm_cache_layout_ok(hdr)) {
+        VAL_LOG(NULL, LOG_WARNING,
+                "shm_cache_lock(): Shared cache %s was left inconsistent, emptying it",
+                shm_cache_path);
+        shm_cache_reset(hdr);
+    }
+    return 0;
+}
+
+static void
+shm_cache_unlock(struct shm_cache_hdr *hdr)
+{
+#if SHM_LOCK_KIND == SHM_LOCK_MUTEX
+    pthread_mutex_unlock(&hdr->sh_lock.sl_mutex);
+#else
+    struct flock    fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_UNLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = 0;
+    fl.l_len = 1;
+    fcntl(shm_cache_fd, F_SETLK, &fl);
+    SHM_LOCAL_UNLOCK();
+#endif
+}
+
+/*
+ * Check that a record at the given offset lies within the log
+ */
+static int
+shm_cache_rec_ok(struct shm_cache_hdr *hdr, u_int32_t off)
+{
+    struct shm_cache_rec *rec;
+
+    if (off < hdr->sh_log || (off & 7) ||
+        off - hdr->sh_log > hdr->sh_log_size - 8)
+        return 0;
+    rec = SHM_REC(hdr, off);
+    if (rec->sr_size < 8 || (rec->sr_size & 7) ||
+        rec->sr_size > hdr->sh_log + hdr->sh_log_size - off)
+        return 0;
+    if (!(rec->sr_flags & SHM_REC_PAD) &&
+        (rec->sr_size < sizeof(struct shm_cache_rec) ||
+         rec->sr_size < sizeof(struct shm_cache_rec) + rec->sr_name_len))
+        return 0;
+    return 1;
+}
+
+/*
+ * Check that a name stored in a record is a well-formed wire name
+ */
+static int
+shm_cache_name_ok(const u_char *name_n, size_t len)
+{
+    size_t          i = 0;
+
+    while (i < len && name_n[i] != 0) {
+        if (name_n[i] > 63)
+            return 0;
+        i += name_n[i] + 1;
+    }
+    return (i < len);
+}
+
+/*
+ * Find the live record for an rrset.  With exact set, ns_options must
+ * match; otherwise, as for lookups in the answer cache, an ns_options
+ * of 0 matches any record.  Expired records are skipped if now is set.
+ * Returns 0 if there is no such record, and -1, after marking the
+ * cache for emptying, if the bucket chain is damaged.
+ */
+static long
+shm_cache_find(struct shm_cache_hdr *hdr, u_int32_t hash,
+               const u_char *name_n, u_int16_t class_h, u_int16_t type_h,
+               unsigned long ns_options, int exact, long now)
+{
+    struct shm_cache_rec *rec;
+    u_int32_t       off;
+    int             steps = 0;
+
+    for (off = SHM_BUCKETS(hdr)[hash % hdr->sh_nbuckets]; off != 0;
+         off = rec->sr_next) {
+        if (++steps > SHM_CACHE_MAX_CHAIN || !shm_cache_rec_ok(hdr, off) ||
+            !shm_cache_name_ok((u_char *) (SHM_REC(hdr, off) + 1),
+                               SHM_REC(hdr, off)->sr_name_len)) {
+            hdr->sh_dirty = 1;
+            return -1;
+        }
+        rec = SHM_REC(hdr, off);
+        if (rec->sr_hash != hash ||
+            rec->sr_class_h != class_h || rec->sr_type_h != type_h)
+            continue;
+        if (exact ? rec->sr_ns_options != ns_options :
+            (ns_options != 0 && rec->sr_ns_options != ns_options))
+            continue;
+        if (now && now >= rec->sr_ttl_x)
+            continue;
+        if (namecmp((u_char *) (rec + 1), name_n) == 0)
+            return off;
+    }
+    return 0;
+}
+
+static int
+shm_cache_unlink(struct shm_cache_hdr *hdr, u_int32_t off)
+{
+    struct shm_cache_rec *rec = SHM_REC(hdr, off);
+    u_int32_t      *link;
+    int             steps = 0;
+
+    link = &SHM_BUCKETS(hdr)[rec->sr_hash % hdr->sh_nbuckets];
+    while (*link != off) {
+        if (*link == 0 || ++steps > SHM_CACHE_MAX_CHAIN ||
+            !shm_cache_rec_ok(hdr, *link))
+            return -1;
+        link = &SHM_REC(hdr, *link)->sr_next;
+    }
+    *link = rec->sr_next;
+    rec->sr_flags &= ~SHM_REC_LIVE;
+    return 0;
+}
+
+/*
+ * Make room for a record of len bytes at the head of the log,
+ * dropping the oldest records as needed.  Returns the record's
+ * offset, or 0 if the log turns out to be damaged.
+ */
+static u_int32_t
+shm_cache_alloc(struct shm_cache_hdr *hdr, u_int32_t len)
+{
+    struct shm_cache_rec *rec;
+    u_int32_t       pos, pad, off;
+
+    pos = hdr->sh_head % hdr->sh_log_size;
+    pad = (pos + len > hdr->sh_log_size) ? hdr->sh_log_size - pos : 0;
+
+    while (hdr->sh_head + pad + len - hdr->sh_tail > hdr->sh_log_size) {
+        off = hdr->sh_log + hdr->sh_tail % hdr->sh_log_size;
+        if (!shm_cache_rec_ok(hdr, off))
+            return 0;
+        rec = SHM_REC(hdr, off);
+        if ((rec->sr_flags & SHM_REC_LIVE) &&
+            0 != shm_cache_unlink(hdr, off))
+            return 0;
+        hdr->sh_tail += rec->sr_size;
+    }
+
+    if (pad) {
+        rec = SHM_REC(hdr, hdr->sh_log + pos);
+        rec->sr_size = pad;
+        rec->sr_flags = SHM_REC_PAD;
+        hdr->sh_head += pad;
+        pos = 0;
+    }
+    hdr->sh_head += len;
+    return hdr->sh_log + pos;
+}
+
+static size_t
+shm_cache_server_len(struct sockaddr *server)
+{
+    if (server == NULL)
+        return 0;
+#ifdef VAL_IPV6
+    if (server->sa_family == AF_INET6)
+        return sizeof(struct sockaddr_in6);
+#endif
+    return sizeof(struct sockaddr_in);
+}
+
+/*
+ * Bytes needed to store an rrset, or 0 if it cannot be stored
+ */
+static u_int32_t
+shm_cache_rec_size(struct rrset_rec *rrset)
+{
+    struct rrset_rr *rr;
+    size_t          size;
+    int             count;
+
+    size = sizeof(struct shm_cache_rec) +
+        wire_name_length(rrset->rrs_name_n) +
+        shm_cache_server_len(rrset->rrs_server);
+    if (rrset->rrs_zonecut_n)
+        size += wire_name_length(rrset->rrs_zonecut_n);
+    for (rr = rrset->rrs_data, count = 0; rr; rr = rr->rr_next, count++) {
+        if (rr->rr_rdata_length > 0xffff || count == 0xffff)
+            return 0;
+        size += 4 + rr->rr_rdata_length;
+    }
+    for (rr = rrset->rrs_sig, count = 0; rr; rr = rr->rr_next, count++) {
+        if (rr->rr_rdata_length > 0xffff || count == 0xffff)
+            return 0;
+        size += 4 + rr->rr_rdata_length;
+    }
+    return SHM_CACHE_ALIGN(size);
+}
+
+static u_char *
+shm_cache_put_rrs(u_char *p, struct rrset_rr *rr, u_int16_t *count)
+{
+    u_int16_t       len, status;
+
+    for (*count = 0; rr; rr = rr->rr_next, (*count)++) {
+        len = (u_int16_t) rr->rr_rdata_length;
+        status = (u_int16_t) rr->rr_status;
+        memcpy(p, &len, 2);
+        memcpy(p + 2, &status, 2);
+        memcpy(p + 4, rr->rr_rdata, len);
+        p += 4 + len;
+    }
+    return p;
+}
+
+static void
+shm_cache_put_rec(struct shm_cache_rec *rec, u_int32_t size,
+                  u_int32_t hash, struct rrset_rec *rrset)
+{
+    u_char         *p = (u_char *) (rec + 1);
+
+    memset(rec, 0, sizeof(struct shm_cache_rec));
+    rec->sr_size = size;
+    rec->sr_hash = hash;
+    rec->sr_ttl_h = rrset->rrs_ttl_h;
+    rec->sr_ttl_x = rrset->rrs_ttl_x;
+    rec->sr_ns_options = (u_int32_t) rrset->rrs_ns_options;
+    rec->sr_rcode = rrset->rrs_rcode;
+    rec->sr_class_h = rrset->rrs_class_h;
+    rec->sr_type_h = rrset->rrs_type_h;
+    rec->sr_section = rrset->rrs_section;
+    rec->sr_cred = rrset->rrs_cred;
+    rec->sr_ans_kind = rrset->rrs_ans_kind;
+
+    rec->sr_name_len = wire_name_length(rrset->rrs_name_n);
+    memcpy(p, rrset->rrs_name_n, rec->sr_name_len);
+    p += rec->sr_name_len;
+    if (rrset->rrs_zonecut_n) {
+        rec->sr_zonecut_len = wire_name_length(rrset->rrs_zonecut_n);
+        memcpy(p, rrset->rrs_zonecut_n, rec->sr_zonecut_len);
+        p += rec->sr_zonecut_len;
+    }
+    rec->sr_server_len = shm_cache_server_len(rrset->rrs_server);
+    if (rec->sr_server_len) {
+        memcpy(p, rrset->rrs_server, rec->sr_server_len);
+        p += rec->sr_server_len;
+    }
+    p = shm_cache_put_rrs(p, rrset->rrs_data, &rec->sr_data_count);
+    shm_cache_put_rrs(p, rrset->rrs_sig, &rec->sr_sig_count);
+}
+
+static int
+shm_cache_get_rrs(u_char **p, u_char *end, u_int16_t count,
+                  struct rrset_rr **rrs)
+{
+    struct rrset_rr *rr, **tail = rrs;
+    u_int16_t       len, status;
+
+    while (count--) {
+        if (end - *p < 4)
+            return VAL_INTERNAL_ERROR;
+        memcpy(&len, *p, 2);
+        memcpy(&status, *p + 2, 2);
+        *p += 4;
+        if (len == 0 || end - *p < len)
+            return VAL_INTERNAL_ERROR;
+
+        rr = (struct rrset_rr *) MALLOC(sizeof(struct rrset_rr));
+        if (rr == NULL)
+            return VAL_OUT_OF_MEMORY;
+        rr->rr_rdata = (u_char *) MALLOC(len);
+        if (rr->rr_rdata == NULL) {
+            FREE(rr);
+            return VAL_OUT_OF_MEMORY;
+        }
+        memcpy(rr->rr_rdata, *p, len);
+        rr->rr_rdata_length = len;
+        rr->rr_status = status;
+        rr->rr_next = NULL;
+        *tail = rr;
+        tail = &rr->rr_next;
+        *p += len;
+    }
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Copy a record out of the file into a private rrset
+ */
+static int
+shm_cache_get_rec(struct shm_cache_rec *rec, long now,
+                  struct rrset_rec **rrset)
+{
+    u_char         *p = (u_char *) (rec + 1);
+    u_char         *end = (u_char *) rec + rec->sr_size;
+    struct rrset_rec *r;
+    int             retval;
+
+    *rrset = NULL;
+    r = (struct rrset_rec *) MALLOC(sizeof(struct rrset_rec));
+    if (r == NULL)
+        return VAL_OUT_OF_MEMORY;
+    memset(r, 0, sizeof(struct rrset_rec));
+
+    r->rrs_rcode = rec->sr_rcode;
+    r->rrs_class_h = rec->sr_class_h;
+    r->rrs_type_h = rec->sr_type_h;
+    r->rrs_ttl_h = rec->sr_ttl_x - now;
+    r->rrs_ttl_x = rec->sr_ttl_x;
+    r->rrs_section = rec->sr_section;
+    r->rrs_ns_options = rec->sr_ns_options;
+    r->rrs_cred = rec->sr_cred;
+    r->rrs_ans_kind = rec->sr_ans_kind;
+
+    retval = VAL_INTERNAL_ERROR;
+    if (end - p < rec->sr_name_len + rec->sr_zonecut_len +
+        rec->sr_server_len ||
+        rec->sr_server_len > sizeof(struct sockaddr_storage))
+        goto err;
+
+    r->rrs_name_n = (u_char *) MALLOC(rec->sr_name_len);
+    if (r->rrs_name_n == NULL)
+        goto oom;
+    memcpy(r->rrs_name_n, p, rec->sr_name_len);
+    p += rec->sr_name_len;
+
+    if (rec->sr_zonecut_len) {
+        if (!shm_cache_name_ok(p, rec->sr_zonecut_len))
+            goto err;
+        r->rrs_zonecut_n = (u_char *) MALLOC(rec->sr_zonecut_len);
+        if (r->rrs_zonecut_n == NULL)
+            goto oom;
+        memcpy(r->rrs_zonecut_n, p, rec->sr_zonecut_len);
+        p += rec->sr_zonecut_len;
+    }
+
+    if (rec->sr_server_len) {
+        r->rrs_server = (struct sockaddr *)
+            MALLOC(sizeof(struct sockaddr_storage));
+        if (r->rrs_server == NULL)
+            goto oom;
+        memset(r->rrs_server, 0, sizeof(struct sockaddr_storage));
+        memcpy(r->rrs_server, p, rec->sr_server_len);
+        p += rec->sr_server_len;
+    }
+
+    if (VAL_NO_ERROR !=
+        (retval = shm_cache_get_rrs(&p, end, rec->sr_data_count,
+                                    &r->rrs_data)) ||
+        VAL_NO_ERROR !=
+        (retval = shm_cache_get_rrs(&p, end, rec->sr_sig_count,
+                                    &r->rrs_sig)))
+        goto err;
+    if (r->rrs_data == NULL) {
+        retval = VAL_INTERNAL_ERROR;
+        goto err;
+    }
+
+    *rrset = r;
+    return VAL_NO_ERROR;
+
+  oom:
+    retval = VAL_OUT_OF_MEMORY;
+  err:
+    res_sq_free_rrset_recs(&r);
+    return retval;
+}
+
+static void
+shm_cache_unmap(void)
+{
+    if (shm_cache_hdr) {
+        munmap(shm_cache_hdr, shm_cache_mapped);
+        shm_cache_hdr = NULL;
+        shm_cache_mapped = 0;
+    }
+    if (shm_cache_fd != -1) {
+        close(shm_cache_fd);
+        shm_cache_fd = -1;
+    }
+    if (shm_cache_path) {
+        FREE(shm_cache_path);
+        shm_cache_path = NULL;
+    }
+}
+
+/*
+ * Set up the header of a new (or unusable) cache file
+ */
+static int
+shm_cache_format(struct shm_cache_hdr *hdr)
+{
+#if SHM_LOCK_KIND == SHM_LOCK_MUTEX
+    pthread_mutexattr_t attr;
+    int             rc;
+#endif
+
+    memset(hdr, 0, sizeof(struct shm_cache_hdr));
+    hdr->sh_lock_kind = SHM_LOCK_KIND;
+#if SHM_LOCK_KIND == SHM_LOCK_MUTEX
+    if (0 != pthread_mutexattr_init(&attr))
+        return VAL_INTERNAL_ERROR;
+    rc = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    if (rc == 0)
+        rc = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    if (rc == 0)
+        rc = pthread_mutex_init(&hdr->sh_lock.sl_mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (rc != 0)
+        return VAL_INTERNAL_ERROR;
+#endif
+    shm_cache_reset(hdr);
+    hdr->sh_resets = 0;
+    hdr->sh_version = SHM_CACHE_VERSION;
+    /* the file is usable once the magic number is in place */
+    hdr->sh_magic = SHM_CACHE_MAGIC;
+    return VAL_NO_ERROR;
+}
+
+static int
+shm_cache_map(const char *path, long size)
+{
+    struct shm_cache_hdr hdr;
+    struct flock    fl;
+    struct stat     sb;
+    void           *map;
+    int             valid = 0;
+    int             retval = VAL_INTERNAL_ERROR;
+
+    if (size < SHM_CACHE_MIN_SIZE)
+        size = SHM_CACHE_MIN_SIZE;
+    if (size > SHM_CACHE_MAX_SIZE)
+        size = SHM_CACHE_MAX_SIZE;
+
+    shm_cache_path = (char *) MALLOC(strlen(path) + 1);
+    if (shm_cache_path == NULL)
+        return VAL_OUT_OF_MEMORY;
+    strcpy(shm_cache_path, path);
+
+    shm_cache_fd = open(path, O_RDWR | O_CREAT
+#ifdef O_NOFOLLOW
+                        | O_NOFOLLOW
+#endif
+                        , 0600);
+    if (shm_cache_fd == -1) {
+        VAL_LOG(NULL, LOG_ERR,
+                "shm_cache_map(): Could not open shared cache %s: %s",
+                path, strerror(errno));
+        retval = VAL_NO_PERMISSION;
+        goto err;
+    }
+    if (0 != fstat(shm_cache_fd, &sb) || !S_ISREG(sb.st_mode) ||
+        sb.st_uid != geteuid() || (sb.st_mode & (S_IWGRP | S_IWOTH))) {
+        VAL_LOG(NULL, LOG_ERR,
+                "shm_cache_map(): Shared cache %s must be a regular file owned by this user and writable by no one else",
+                path);
+        retval = VAL_NO_PERMISSION;
+        goto err;
+    }
+#ifdef FD_CLOEXEC
+    fcntl(shm_cache_fd, F_SETFD, FD_CLOEXEC);
+#endif
+
+    /* keep processes that open the file together from both formatting it */
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    while (-1 == fcntl(shm_cache_fd, F_SETLKW, &fl)) {
+        if (errno != EINTR) {
+            VAL_LOG(NULL, LOG_ERR,
+                    "shm_cache_map(): Could not lock shared cache %s: %s",
+                    path, strerror(errno));
+            goto err;
+        }
+    }
+
+    if (0 != fstat(shm_cache_fd, &sb))
+        goto err_unlock;
+    if (sb.st_size >= (off_t) sizeof(hdr) &&
+        sizeof(hdr) == pread(shm_cache_fd, &hdr, sizeof(hdr), 0) &&
+        hdr.sh_magic == SHM_CACHE_MAGIC &&
+        hdr.sh_version == SHM_CACHE_VERSION &&
+        hdr.sh_size == sb.st_size) {
+        if (hdr.sh_lock_kind != SHM_LOCK_KIND) {
+            VAL_LOG(NULL, LOG_ERR,
+                    "shm_cache_map(): Shared cache %s is locked differently by another build of libval",
+                    path);
+            goto err_unlock;
+        }
+        /* an existing cache keeps its size */
+        valid = 1;
+        size = sb.st_size;
+    } else {
+        /* never shrink the file under another process's mapping */
+        if (sb.st_size > size && sb.st_size <= SHM_CACHE_MAX_SIZE)
+            size = sb.st_size & ~((off_t) 7);
+        if (0 != ftruncate(shm_cache_fd, size)) {
+            VAL_LOG(NULL, LOG_ERR,
+                    "shm_cache_map(): Could not size shared cache %s: %s",
+                    path, strerror(errno));
+            goto err_unlock;
+        }
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+               shm_cache_fd, 0);
+    if (map == MAP_FAILED) {
+        VAL_LOG(NULL, LOG_ERR,
+                "shm_cache_map(): Could not map shared cache %s: %s",
+                path, strerror(errno));
+        goto err_unlock;
+    }
+    shm_cache_hdr = (struct shm_cache_hdr *) map;
+    shm_cache_mapped = size;
+
+    if (!valid && VAL_NO_ERROR != (retval = shm_cache_format(shm_cache_hdr)))
+        goto err_unlock;
+
+    fl.l_type = F_UNLCK;
+    fcntl(shm_cache_fd, F_SETLK, &fl);
+
+    VAL_LOG(NULL, LOG_INFO,
+            "shm_cache_map(): Using %s shared cache %s of %ld bytes",
+            valid ? "existing" : "new", path, size);
+    return VAL_NO_ERROR;
+
+  err_unlock:
+    fl.l_type = F_UNLCK;
+    fcntl(shm_cache_fd, F_SETLK, &fl);
+  err:
+    shm_cache_unmap();
+    return retval;
+}
+
+/*
+ * Start using the shared cache in the named file, creating it with the
+ * given size if needed.  The cache is shared by every context in the
+ * process; opening a different file replaces it.
+ */
+int
+shm_cache_open(const char *path, long size)
+{
+    int             retval = VAL_NO_ERROR;
+
+    if (path == NULL)
+        return VAL_BAD_ARGUMENT;
+
+    SHM_MAP_LOCK_EX();
+    if (shm_cache_path == NULL || strcmp(shm_cache_path, path) != 0) {
+        shm_cache_unmap();
+        retval = shm_cache_map(path, size);
+    }
+    SHM_MAP_UNLOCK();
+    return retval;
+}
+
+void
+shm_cache_close(void)
+{
+    SHM_MAP_LOCK_EX();
+    shm_cache_unmap();
+    SHM_MAP_UNLOCK();
+}
+
+/*
+ * Publish an rrset to the other processes.  As in the answer cache,
+ * a live record from a more credible source is not replaced.
+ */
+void
+shm_cache_store(struct rrset_rec *rrset)
+{
+    struct shm_cache_hdr *hdr;
+    struct shm_cache_rec *old;
+    struct timeval  tv;
+    u_int32_t       hash, size, off;
+    long            found;
+
+    if (rrset == NULL || rrset->rrs_name_n == NULL ||
+        rrset->rrs_data == NULL)
+        return;
+
+    SHM_MAP_LOCK_SH();
+    if (NULL == (hdr = shm_cache_hdr) ||
+        0 == (size = shm_cache_rec_size(rrset)) ||
+        0 != shm_cache_lock(hdr)) {
+        SHM_MAP_UNLOCK();
+        return;
+    }
+
+    /* keep a single rrset from taking over the log */
+    if (size > hdr->sh_log_size / 8)
+        goto done;
+
+    gettimeofday(&tv, NULL);
+    hash = shm_cache_key(rrset->rrs_name_n, rrset->rrs_class_h,
+                         rrset->rrs_type_h);
+    hdr->sh_dirty = 1;
+    found = shm_cache_find(hdr, hash, rrset->rrs_name_n, rrset->rrs_class_h,
+                           rrset->rrs_type_h, rrset->rrs_ns_options, 1, 0);
+    if (found < 0)
+        goto done;
+    if (found > 0) {
+        old = SHM_REC(hdr, found);
+        if (tv.tv_sec < old->sr_ttl_x && old->sr_cred < rrset->rrs_cred) {
+            hdr->sh_dirty = 0;
+            goto done;
+        }
+        if (0 != shm_cache_unlink(hdr, found))
+            goto done;
+    }
+
+    if (0 == (off = shm_cache_alloc(hdr, size)))
+        goto done;
+    shm_cache_put_rec(SHM_REC(hdr, off), size, hash, rrset);
+    SHM_REC(hdr, off)->sr_next = SHM_BUCKETS(hdr)[hash % hdr->sh_nbuckets];
+    SHM_REC(hdr, off)->sr_flags = SHM_REC_LIVE;
+    SHM_BUCKETS(hdr)[hash % hdr->sh_nbuckets] = off;
+    hdr->sh_dirty = 0;
+
+  done:
+    /* a damaged file is left dirty, and emptied by the next locker */
+    shm_cache_unlock(hdr);
+    SHM_MAP_UNLOCK();
+}
+
+/*
+ * Return a private copy of a live rrset from the shared cache, or of
+ * a CNAME at the same name for types that follow aliases.
+ */
+struct rrset_rec *
+shm_cache_lookup(const u_char *name_n, u_int16_t class_h, u_int16_t type_h,
+                 unsigned long ns_options)
+{
+    struct shm_cache_hdr *hdr;
+    struct rrset_rec *rrset = NULL;
+    struct timeval  tv;
+    long            found;
+
+    if (name_n == NULL)
+        return NULL;
+
+    SHM_MAP_LOCK_SH();
+    if (NULL == (hdr = shm_cache_hdr) || 0 != shm_cache_lock(hdr)) {
+        SHM_MAP_UNLOCK();
+        return NULL;
+    }
+
+    gettimeofday(&tv, NULL);
+    found = shm_cache_find(hdr, shm_cache_key(name_n, class_h, type_h),
+                           name_n, class_h, type_h, ns_options, 0, tv.tv_sec);
+    if (found == 0 && type_h != ns_t_cname && ALIAS_MATCH_TYPE(type_h))
+        found = shm_cache_find(hdr, shm_cache_key(name_n, class_h, ns_t_cname),
+                               name_n, class_h, ns_t_cname, ns_options, 0,
+                               tv.tv_sec);
+    if (found > 0 &&
+        VAL_INTERNAL_ERROR == shm_cache_get_rec(SHM_REC(hdr, found),
+                                                tv.tv_sec, &rrset))
+        hdr->sh_dirty = 1;
+
+    shm_cache_unlock(hdr);
+    SHM_MAP_UNLOCK();
+    return rrset;
+}
+
+#else /* shared cache not supported */
+
+int
+shm_cache_open(const char *path, long size)
+{
+    VAL_LOG(NULL, LOG_WARNING,
+            "shm_cache_open(): Shared cache %s is not supported on this platform",
+            path ? path : "");
+    return VAL_NOT_IMPLEMENTED;
+}
+
+void
+shm_cache_close(void)
+{
+}
+
+void
+shm_cache_store(struct rrset_rec *rrset)
+{
+}
+
+struct rrset_rec *
+shm_cache_lookup(const u_char *name_n, u_int16_t class_h, u_int16_t type_h,
+                 unsigned long ns_options)
+{
+    return NULL;
+}
+
+#endif
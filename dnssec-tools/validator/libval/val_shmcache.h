@@ -0,0 +1,15 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+#ifndef VAL_SHMCACHE_H
+#define VAL_SHMCACHE_H
+
+int             shm_cache_open(const char *path, long size);
+void            shm_cache_close(void);
+void            shm_cache_store(struct rrset_rec *rrset);
+struct rrset_rec *shm_cache_lookup(const u_char *name_n, u_int16_t class_h,
+                                   u_int16_t type_h,
+                                   unsigned long ns_options);
+
+#endif
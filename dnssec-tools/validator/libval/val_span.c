@@ -0,0 +1,433 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * Per-request latency spans.  When a context has a span callback
+ * (val_context_set_span_cb()), each request made with it gets a span
+ * that adds up the time spent in each phase of resolution and
+ * validation, and notes when each query made on its behalf was sent
+ * and answered.  The span is handed to the callback when the request
+ * completes and freed when the callback returns.
+ *
+ * Like the arenas in val_arena.c, each thread has a current span,
+ * set with val_span_enter() while it works on a request, so that code
+ * deep inside validation can charge time to the request without the
+ * span being passed down to it.
+ */
+#include "validator-internal.h"
+
+#include "val_context.h"
+#include "val_support.h"
+#include "val_span.h"
+
+int             val_span_enabled = 0;
+
+struct span_query {
+    struct val_span_query sp_query;     /* must be first */
+    struct val_query_chain *sp_qc;
+};
+
+struct span_req {
+    struct val_span sr_span;            /* must be first */
+    val_context_t  *sr_ctx;
+    val_span_cb     sr_cb;
+    void           *sr_cb_data;
+    struct span_query *sr_last;
+    struct val_span_query **sr_tail;
+};
+
+#ifndef VAL_NO_THREADS
+static pthread_key_t span_key;
+static pthread_once_t span_once = PTHREAD_ONCE_INIT;
+static int      span_key_ok = 0;
+
+static void
+_span_key_init(void)
+{
+    span_key_ok = (0 == pthread_key_create(&span_key, NULL));
+}
+
+static struct span_req *
+_span_current(void)
+{
+    pthread_once(&span_once, _span_key_init);
+    return span_key_ok ?
+        (struct span_req *) pthread_getspecific(span_key) : NULL;
+}
+
+static void
+_span_set_current(struct span_req *req)
+{
+    pthread_once(&span_once, _span_key_init);
+    if (span_key_ok)
+        pthread_setspecific(span_key, req);
+}
+#else
+static struct span_req *span_current = NULL;
+
+#define _span_current()             (span_current)
+#define _span_set_current(req)      (span_current = (req))
+#endif
+
+static unsigned long long
+_usec(struct timeval *tv)
+{
+    return (unsigned long long) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/*
+ * Start a span for a request, if the context has a span callback.
+ * NOTE: caller must hold the context async cache lock
+ */
+struct val_span *
+val_span_new(val_context_t *ctx, const char *name, int class_h,
+             int type_h, struct timeval *start)
+{
+    struct span_req *req;
+
+    if (ctx == NULL || ctx->span_cb == NULL || name == NULL)
+        return NULL;
+
+    req = (struct span_req *) MALLOC(sizeof(struct span_req));
+    if (req == NULL)
+        return NULL;
+    memset(req, 0, sizeof(struct span_req));
+    req->sr_span.vs_name = strdup(name);
+    if (req->sr_span.vs_name == NULL) {
+        FREE(req);
+        return NULL;
+    }
+    req->sr_span.vs_class_h = class_h;
+    req->sr_span.vs_type_h = type_h;
+    if (start)
+        req->sr_span.vs_start = _usec(start);
+    req->sr_ctx = ctx;
+    req->sr_cb = ctx->span_cb;
+    req->sr_cb_data = ctx->span_cb_data;
+    req->sr_tail = &req->sr_span.vs_queries;
+    return &req->sr_span;
+}
+
+void
+val_span_free(struct val_span *span)
+{
+    struct val_span_query *sq;
+
+    if (span == NULL)
+        return;
+    while ((sq = span->vs_queries) != NULL) {
+        span->vs_queries = sq->sq_next;
+        FREE(sq->sq_name_n);
+        FREE(sq);
+    }
+    FREE(span->vs_name);
+    FREE(span);
+}
+
+/*
+ * Finish a span and hand it to the callback, then free it
+ */
+void
+val_span_done(struct val_span *span, int retval,
+              struct val_result_chain *results)
+{
+    struct span_req *req = (struct span_req *) span;
+    struct val_result_chain *res;
+    struct timeval  now;
+
+    if (span == NULL)
+        return;
+
+    gettimeofday(&now, NULL);
+    span->vs_end = _usec(&now);
+    span->vs_retval = retval;
+    if (results)
+        span->vs_status = results->val_rc_status;
+    for (res = results; res; res = res->val_rc_next)
+        span->vs_results++;
+
+    (*req->sr_cb) (req->sr_ctx, span, req->sr_cb_data);
+    val_span_free(span);
+}
+
+/*
+ * Make span (which may be NULL) the current span of this thread;
+ * returns the span that was current before, which must be passed to
+ * val_span_leave()
+ */
+struct val_span *
+val_span_enter(struct val_span *span)
+{
+    struct span_req *prev;
+
+    /* no thread can have a span yet */
+    if (!val_span_enabled && span == NULL)
+        return NULL;
+    prev = _span_current();
+    _span_set_current((struct span_req *) span);
+    return (struct val_span *) prev;
+}
+
+void
+val_span_leave(struct val_span *prev)
+{
+    if (!val_span_enabled && prev == NULL)
+        return;
+    _span_set_current((struct span_req *) prev);
+}
+
+/*
+ * Charge the time since start to a phase of the current request
+ */
+void
+val_span_end(int phase, struct timeval *start)
+{
+    struct span_req *req;
+    struct timeval  now;
+    long long       usec;
+
+    if (phase < 0 || phase >= VAL_SPAN_PHASES || start == NULL ||
+        NULL == (req = _span_current()))
+        return;
+
+    gettimeofday(&now, NULL);
+    usec = (long long) (now.tv_sec - start->tv_sec) * 1000000 +
+        (now.tv_usec - start->tv_usec);
+    req->sr_span.vs_phase_count[phase]++;
+    if (usec > 0)
+        req->sr_span.vs_phase_usec[phase] += usec;
+}
+
+/*
+ * Note that a query made for the current request was sent, answered
+ * or found in the cache
+ */
+void
+val_span_query(struct val_query_chain *qc, int event)
+{
+    struct span_req *req;
+    struct span_query *sp;
+    struct timeval  now;
+    size_t          len;
+
+    if (qc == NULL || NULL == (req = _span_current()))
+        return;
+
+    /* the most recent query is the usual one */
+    if (req->sr_last && req->sr_last->sp_qc == qc)
+        sp = req->sr_last;
+    else {
+        for (sp = (struct span_query *) req->sr_span.vs_queries; sp;
+             sp = (struct span_query *) sp->sp_query.sq_next) {
+            if (sp->sp_qc == qc)
+                break;
+        }
+    }
+
+    if (sp == NULL) {
+        sp = (struct span_query *) MALLOC(sizeof(struct span_query));
+        if (sp == NULL)
+            return;
+        memset(sp, 0, sizeof(struct span_query));
+        len = wire_name_length(qc->qc_name_n);
+        sp->sp_query.sq_name_n = (u_char *) MALLOC(len);
+        if (sp->sp_query.sq_name_n == NULL) {
+            FREE(sp);
+            return;
+        }
+        memcpy(sp->sp_query.sq_name_n, qc->qc_name_n, len);
+        sp->sp_query.sq_type_h = qc->qc_type_h;
+        sp->sp_query.sq_class_h = qc->qc_class_h;
+        sp->sp_qc = qc;
+
+        /* keep the queries in the order they were first made */
+        *req->sr_tail = &sp->sp_query;
+        req->sr_tail = &sp->sp_query.sq_next;
+    }
+    req->sr_last = sp;
+
+    gettimeofday(&now, NULL);
+    switch (event) {
+    case VAL_SPAN_QUERY_SENT:
+        if (sp->sp_query.sq_sends++ == 0)
+            sp->sp_query.sq_sent = _usec(&now);
+        break;
+    case VAL_SPAN_QUERY_CACHED:
+    case VAL_SPAN_QUERY_DONE:
+        /*
+         * A query can be looked up again once it has been answered;
+         * only the first answer counts
+         */
+        if (sp->sp_query.sq_done)
+            break;
+        if (event == VAL_SPAN_QUERY_CACHED && sp->sp_query.sq_sends == 0)
+            sp->sp_query.sq_flags |= VAL_SPAN_Q_CACHED;
+        sp->sp_query.sq_done = _usec(&now);
+        sp->sp_query.sq_flags |= (qc->qc_state == Q_ANSWERED) ?
+            VAL_SPAN_Q_ANSWERED : VAL_SPAN_Q_ERROR;
+        break;
+    }
+}
+
+int
+val_context_set_span_cb(val_context_t *context, val_span_cb cb,
+                        void *cb_data)
+{
+    val_context_t  *ctx;
+
+    ctx = val_create_or_refresh_context(context); /* does CTX_LOCK_POL_SH */
+    if (ctx == NULL)
+        return VAL_INTERNAL_ERROR;
+
+    CTX_LOCK_ACACHE(ctx);
+    ctx->span_cb = cb;
+    ctx->span_cb_data = cb_data;
+    if (cb)
+        val_span_enabled = 1;
+    CTX_UNLOCK_ACACHE(ctx);
+
+    CTX_UNLOCK_POL(ctx);
+    return VAL_NO_ERROR;
+}
+
+const char     *
+p_span_phase(int phase)
+{
+    switch (phase) {
+    case VAL_SPAN_ASK_CACHE:
+        return "ask_cache";
+    case VAL_SPAN_ASK_RESOLVER:
+        return "ask_resolver";
+    case VAL_SPAN_FIX_GLUE:
+        return "fix_glue";
+    case VAL_SPAN_WAIT:
+        return "wait_for_res_data";
+    case VAL_SPAN_CHAIN:
+        return "construct_authentication_chain";
+    case VAL_SPAN_VERIFY:
+        return "verify_next_assertion";
+    case VAL_SPAN_PROVE_NONEXISTENCE:
+        return "prove_nonexistence";
+    case VAL_SPAN_RRSIG:
+        return "rrsig_verify";
+    case VAL_SPAN_NSEC3_HASH:
+        return "nsec3_hash";
+    default:
+        return "unknown";
+    }
+}
+
+static void
+_append(char *buf, size_t buflen, size_t *off, const char *fmt, ...)
+{
+    va_list         ap;
+    int             n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(*off < buflen ? buf + *off : NULL,
+                  *off < buflen ? buflen - *off : 0, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        *off += n;
+}
+
+static void
+_append_string(char *buf, size_t buflen, size_t *off, const char *s)
+{
+    _append(buf, buflen, off, "\"");
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            _append(buf, buflen, off, "\\%c", *s);
+        else if ((unsigned char) *s < 0x20)
+            _append(buf, buflen, off, "\\u%04x", (unsigned char) *s);
+        else
+            _append(buf, buflen, off, "%c", *s);
+    }
+    _append(buf, buflen, off, "\"");
+}
+
+/*
+ * The mnemonic for a class.  The resolver's p_class() is deprecated
+ * and returns a static buffer for unknown classes.
+ */
+static const char *
+_class_name(int class_h, char *buf, size_t buflen)
+{
+    switch (class_h) {
+    case ns_c_in:
+        return "IN";
+    case ns_c_chaos:
+        return "CH";
+    case ns_c_hs:
+        return "HS";
+    case ns_c_none:
+        return "NONE";
+    case ns_c_any:
+        return "ANY";
+    default:
+        snprintf(buf, buflen, "CLASS%d", class_h);
+        return buf;
+    }
+}
+
+/*
+ * Write a span to buf as one line of JSON, loosely following the
+ * OpenTelemetry span layout.  Like snprintf(), returns the length of
+ * the whole text; if that is not less than buflen, the text was cut
+ * short.
+ */
+size_t
+val_span_json(const struct val_span *span, char *buf, size_t buflen)
+{
+    struct val_span_query *sq;
+    char            name_p[NS_MAXDNAME];
+    char            class_p[16];
+    size_t          off = 0;
+    int             i;
+
+    if (span == NULL)
+        return 0;
+
+    _append(buf, buflen, &off, "{\"traceId\":\"%08x\",\"name\":",
+            span->vs_trace_id);
+    _append_string(buf, buflen, &off, span->vs_name ? span->vs_name : "");
+    _append(buf, buflen, &off, ",\"class\":\"%s\",\"type\":\"%s\","
+            "\"retval\":%d,\"results\":%d,",
+            _class_name(span->vs_class_h, class_p, sizeof(class_p)),
+            p_type(span->vs_type_h),
+            span->vs_retval, span->vs_results);
+    if (span->vs_results)
+        _append(buf, buflen, &off, "\"status\":\"%s\",",
+                p_val_status(span->vs_status));
+    _append(buf, buflen, &off, "\"startTimeUnixNano\":%llu,"
+            "\"endTimeUnixNano\":%llu,\"phases\":{",
+            span->vs_start * 1000, span->vs_end * 1000);
+    for (i = 0; i < VAL_SPAN_PHASES; i++) {
+        _append(buf, buflen, &off, "%s\"%s\":{\"count\":%u,\"usec\":%llu}",
+                i ? "," : "", p_span_phase(i), span->vs_phase_count[i],
+                span->vs_phase_usec[i]);
+    }
+    _append(buf, buflen, &off, "},\"queries\":[");
+    for (sq = span->vs_queries; sq; sq = sq->sq_next) {
+        if (ns_name_ntop(sq->sq_name_n, name_p, sizeof(name_p)) == -1)
+            strcpy(name_p, "unknown/error");
+        _append(buf, buflen, &off, "%s{\"name\":",
+                sq == span->vs_queries ? "" : ",");
+        _append_string(buf, buflen, &off, name_p);
+        _append(buf, buflen, &off, ",\"class\":\"%s\",\"type\":\"%s\","
+                "\"cached\":%s,\"answered\":%s,\"sends\":%u,"
+                "\"startTimeUnixNano\":%llu,\"endTimeUnixNano\":%llu}",
+                _class_name(sq->sq_class_h, class_p, sizeof(class_p)),
+                p_type(sq->sq_type_h),
+                (sq->sq_flags & VAL_SPAN_Q_CACHED) ? "true" : "false",
+                (sq->sq_flags & VAL_SPAN_Q_ANSWERED) ? "true" : "false",
+                sq->sq_sends, sq->sq_sent * 1000, sq->sq_done * 1000);
+    }
+    _append(buf, buflen, &off, "]}");
+
+    if (buflen > 0 && off >= buflen)
+        buf[buflen - 1] = '\0';
+    return off;
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+#ifndef VAL_SPAN_H
+#define VAL_SPAN_H
+
+/* set once any context has a span callback, and never cleared */
+extern int      val_span_enabled;
+
+/* events for val_span_query() */
+#define VAL_SPAN_QUERY_SENT     1
+#define VAL_SPAN_QUERY_DONE     2
+#define VAL_SPAN_QUERY_CACHED   3
+
+struct val_span *val_span_new(val_context_t *ctx, const char *name,
+                              int class_h, int type_h,
+                              struct timeval *start);
+void            val_span_done(struct val_span *span, int retval,
+                              struct val_result_chain *results);
+void            val_span_free(struct val_span *span);
+struct val_span *val_span_enter(struct val_span *span);
+void            val_span_leave(struct val_span *prev);
+void            val_span_end(int phase, struct timeval *start);
+void            val_span_query(struct val_query_chain *qc, int event);
+
+/*
+ * Time a phase of the current request; start is only read if the
+ * request has a span, and spans only exist once val_span_enabled is set
+ */
+#define SPAN_BEGIN(start) do { \
+    if (val_span_enabled) \
+        gettimeofday((start), NULL); \
+} while (0)
+
+#define SPAN_END(phase, start) do { \
+    if (val_span_enabled) \
+        val_span_end((phase), (start)); \
+} while (0)
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * The public side of the runtime statistics kept by libsres and
+ * libval (see res_stats.c): snapshots, and a dump in the Prometheus
+ * text exposition format.
+ */
+#include "validator-internal.h"
+
+static const char *stat_names[RES_STAT_COUNTERS][2] = {
+    {"dnsval_udp_queries_total", "Queries sent over UDP."},
+    {"dnsval_tcp_queries_total", "Queries sent over TCP."},
+    {"dnsval_retransmits_total",
+     "Queries sent again to the same server address."},
+    {"dnsval_tcp_fallbacks_total",
+     "Truncated UDP responses retried over TCP."},
+    {"dnsval_timeouts_total", "Server addresses that did not answer in time."},
+    {"dnsval_send_errors_total", "Queries that could not be sent."},
+    {"dnsval_responses_total", "Responses received."},
+    {"dnsval_mismatched_responses_total",
+     "Responses dropped because the id or question did not match."},
+    {"dnsval_cache_hits_total", "Answers found in the rrset cache."},
+    {"dnsval_shared_cache_hits_total", "Answers found in the shared cache."},
+    {"dnsval_cache_misses_total", "Answers not found in any cache."},
+    {"dnsval_cache_evictions_total",
+     "Rrsets evicted to stay within max-cache-size."},
+    {"dnsval_cache_expired_total", "Expired rrsets dropped from the cache."},
+    {"dnsval_rrsig_verified_total", "RRSIGs that verified."},
+    {"dnsval_rrsig_failed_total", "RRSIGs that did not verify."},
+    {"dnsval_ds_digests_total", "DNSKEYs compared with a DS digest."},
+    {"dnsval_requests_total", "Validation requests."},
+    {"dnsval_results_validated_total", "Results that were validated."},
+    {"dnsval_results_trusted_total",
+     "Results that were trusted but not validated."},
+    {"dnsval_results_untrusted_total",
+     "Results that were bogus or could not be trusted."},
+    {"dnsval_requests_cached_total",
+     "Validation requests answered without sending a query."},
+};
+
+static const char *hist_names[RES_HIST_COUNT][2] = {
+    {"dnsval_response_seconds", "Name server response times."},
+    {"dnsval_rrsig_verify_seconds", "RRSIG verification times."},
+    {"dnsval_request_seconds", "Validation request times."},
+};
+
+/*
+ * A snapshot of the statistics of all threads in the process
+ */
+int
+val_get_stats(struct res_stats *stats)
+{
+    if (stats == NULL)
+        return VAL_BAD_ARGUMENT;
+    res_stats_get(stats);
+    return VAL_NO_ERROR;
+}
+
+static void
+_append(char *buf, size_t buflen, size_t *off, const char *fmt, ...)
+{
+    va_list         ap;
+    int             n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(*off < buflen ? buf + *off : NULL,
+                  *off < buflen ? buflen - *off : 0, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        *off += n;
+}
+
+/*
+ * Write the statistics to buf in the Prometheus text format.  Like
+ * snprintf(), returns the length of the whole text; if that is not
+ * less than buflen, the text was cut short.
+ */
+size_t
+val_stats_prometheus(char *buf, size_t buflen)
+{
+    struct res_stats stats;
+    u_int64_t       count;
+    size_t          off = 0;
+    int             i, b;
+
+    res_stats_get(&stats);
+
+    for (i = 0; i < RES_STAT_COUNTERS; i++) {
+        _append(buf, buflen, &off, "# HELP %s %s\n# TYPE %s counter\n"
+                "%s %llu\n", stat_names[i][0], stat_names[i][1],
+                stat_names[i][0], stat_names[i][0],
+                (unsigned long long) stats.rs_counter[i]);
+    }
+
+    for (i = 0; i < RES_HIST_COUNT; i++) {
+        _append(buf, buflen, &off, "# HELP %s %s\n# TYPE %s histogram\n",
+                hist_names[i][0], hist_names[i][1], hist_names[i][0]);
+        count = 0;
+        for (b = 0; b < RES_HIST_BUCKETS; b++) {
+            count += stats.rs_hist[i][b];
+            if (b < RES_HIST_BUCKETS - 1)
+                _append(buf, buflen, &off, "%s_bucket{le=\"%g\"} %llu\n",
+                        hist_names[i][0], (double) (1L << b) / 1000000.0,
+                        (unsigned long long) count);
+            else
+                _append(buf, buflen, &off, "%s_bucket{le=\"+Inf\"} %llu\n",
+                        hist_names[i][0], (unsigned long long) count);
+        }
+        _append(buf, buflen, &off, "%s_sum %g\n%s_count %llu\n",
+                hist_names[i][0],
+                (double) stats.rs_hist_sum[i] / 1000000.0,
+                hist_names[i][0], (unsigned long long) count);
+    }
+
+    if (buflen > 0 && off >= buflen)
+        buf[buflen - 1] = '\0';
+    return off;
+}
@@ -22,11 +22,14 @@
 #include "validator-internal.h"
 
 #include "val_support.h"
+#include "val_names.h"
+#include "val_arena.h"
 
 u_char * 
 namename(u_char * big_name, u_char * little_name)
 {
     u_char *p = big_name;
+    size_t big_len, little_len;
     
     if (!big_name || !little_name)
         return NULL;
@@ -38,16 +41,19 @@ namename(u_char * big_name, u_char * little_name)
             return p+d-1;
         return NULL;
     }
-    
-    while (*p != '\0') {
-        int d = namecmp(p, little_name);
-        if (d == 0) {
-            return p;
-        }
-        else if (d < 0)
-            break; 
+
+    /* 
+     * the only candidate is the suffix of big_name that is as long as
+     * little_name, if it starts on a label boundary
+     */
+    big_len = wire_name_length(big_name);
+    little_len = wire_name_length(little_name);
+    while (*p != '\0' && (size_t) (big_name + big_len - p) > little_len)
         p = p + p[0] + 1;
-    }
+
+    if ((size_t) (big_name + big_len - p) == little_len &&
+        res_name_caseeq(p, little_name, little_len))
+        return p;
 
     return NULL;
 }
@@ -192,6 +198,21 @@ res_sq_free_rr_recs(struct rrset_rr **rr)
 }
 
 
+static void
+free_rrset_members(struct rrset_rec *set)
+{
+    if (set->rrs_zonecut_n)
+        FREE(set->rrs_zonecut_n);
+    if (set->rrs_name_n)
+        FREE(set->rrs_name_n);
+    if (set->rrs_server)
+        FREE(set->rrs_server);
+    if (set->rrs_data)
+        res_sq_free_rr_recs(&set->rrs_data);
+    if (set->rrs_sig)
+        res_sq_free_rr_recs(&set->rrs_sig);
+}
+
 void
 res_sq_free_rrset_recs(struct rrset_rec **set)
 {
@@ -199,23 +220,156 @@ res_sq_free_rrset_recs(struct rrset_rec **set)
         return;
 
     if (*set) {
-        if ((*set)->rrs_zonecut_n)
-            FREE((*set)->rrs_zonecut_n);
-        if ((*set)->rrs_name_n)
-            FREE((*set)->rrs_name_n);
-        if ((*set)->rrs_server)
-            FREE((*set)->rrs_server);
-        if ((*set)->rrs_data)
-            res_sq_free_rr_recs(&((*set)->rrs_data));
-        if ((*set)->rrs_sig)
-            res_sq_free_rr_recs(&((*set)->rrs_sig));
         if ((*set)->rrs_next)
             res_sq_free_rrset_recs(&((*set)->rrs_next));
-        FREE(*set);
+        if ((*set)->rrs_shared) {
+            /* a view owns nothing but itself */
+            release_rrset_rec((*set)->rrs_shared);
+            arena_free(*set);
+        } else {
+            free_rrset_members(*set);
+            FREE(*set);
+        }
         *set = NULL;
     }
 }
 
+/*
+ * Cached rrsets are immutable once stored and are shared between
+ * the cache and any number of views handed out by cache lookups.
+ * rrs_refcount counts the cache's own reference plus one per view.
+ */
+#ifndef VAL_NO_THREADS
+static pthread_mutex_t rrset_ref_lock = PTHREAD_MUTEX_INITIALIZER;
+#define RRSET_REF_LOCK()    pthread_mutex_lock(&rrset_ref_lock)
+#define RRSET_REF_UNLOCK()  pthread_mutex_unlock(&rrset_ref_lock)
+#else
+#define RRSET_REF_LOCK()
+#define RRSET_REF_UNLOCK()
+#endif
+
+/*
+ * Drop a reference to a cached rrset.  The rrset is freed once
+ * the cache has let go of it and no view borrows from it any more.
+ * The caller must already have unlinked it from the cache.
+ */
+void
+release_rrset_rec(struct rrset_rec *rr_set)
+{
+    int refs;
+
+    if (rr_set == NULL)
+        return;
+
+    RRSET_REF_LOCK();
+    refs = --rr_set->rrs_refcount;
+    RRSET_REF_UNLOCK();
+
+    if (refs > 0)
+        return;
+
+    free_rrset_members(rr_set);
+    FREE(rr_set);
+}
+
+/*
+ * Return a read-only view of a cached rrset with its own TTL.
+ * The view shares the owner name, zone cut, server and records of
+ * the cached rrset, so it costs no allocation other than its header,
+ * which comes from the current arena.  Like a copy, the view has no
+ * credibility of its own.  Anything that needs to modify or keep
+ * the rrset must take a copy with copy_rrset_rec().
+ */
+struct rrset_rec *
+view_rrset_rec(struct rrset_rec *rr_set, u_int32_t ttl_h)
+{
+    struct rrset_rec *view;
+
+    if (rr_set == NULL)
+        return NULL;
+
+    view = (struct rrset_rec *) arena_malloc(sizeof(struct rrset_rec));
+    if (view == NULL)
+        return NULL;
+    memcpy(view, rr_set, sizeof(struct rrset_rec));
+    view->rrs_ttl_h = ttl_h;
+    view->rrs_cred = SR_CRED_UNSET;
+    view->rrs_ans_kind = SR_ANS_UNSET;
+    view->rrs_refcount = 0;
+    view->rrs_shared = rr_set;
+    view->rrs_next = NULL;
+
+    RRSET_REF_LOCK();
+    rr_set->rrs_refcount++;
+    RRSET_REF_UNLOCK();
+
+    return view;
+}
+
+/*
+ * If *set is a view, replace it in its list with a private copy
+ */
+static int
+unshare_rrset_rec(struct rrset_rec **set)
+{
+    struct rrset_rec *copy;
+
+    if ((*set)->rrs_shared == NULL)
+        return VAL_NO_ERROR;
+    if (NULL == (copy = copy_rrset_rec(*set)))
+        return VAL_OUT_OF_MEMORY;
+    copy->rrs_next = (*set)->rrs_next;
+    (*set)->rrs_next = NULL;
+    res_sq_free_rrset_recs(set);
+    *set = copy;
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Replace every view in the list with a private copy
+ */
+int
+unshare_rrset_recs(struct rrset_rec **set)
+{
+    int retval;
+
+    if (set == NULL)
+        return VAL_BAD_ARGUMENT;
+
+    for (; *set; set = &(*set)->rrs_next) {
+        if (VAL_NO_ERROR != (retval = unshare_rrset_rec(set)))
+            return retval;
+    }
+    return VAL_NO_ERROR;
+}
+
+/*
+ * An assertion can look at a cached rrset through a view until
+ * something is about to be written into its records, such as the
+ * status of each RRSIG.  Give it a private copy then, keeping what has
+ * already been worked out about the rrset.
+ */
+int
+unshare_assertion(struct val_digested_auth_chain *as)
+{
+    struct rrset_rec *set;
+    u_char          cred, kind;
+    int             retval;
+
+    if (as == NULL || NULL == (set = as->val_ac_rrset.ac_data) ||
+        set->rrs_shared == NULL)
+        return VAL_NO_ERROR;
+
+    cred = set->rrs_cred;
+    kind = set->rrs_ans_kind;
+    if (VAL_NO_ERROR !=
+        (retval = unshare_rrset_recs(&as->val_ac_rrset.ac_data)))
+        return retval;
+    as->val_ac_rrset.ac_data->rrs_cred = cred;
+    as->val_ac_rrset.ac_data->rrs_ans_kind = kind;
+    return VAL_NO_ERROR;
+}
+
 
 int
 add_to_qname_chain(struct qname_chain **qnames, const u_char * name_n)
@@ -230,7 +384,11 @@ add_to_qname_chain(struct qname_chain **qnames, const u_char * name_n)
     if (temp == NULL)
         return VAL_OUT_OF_MEMORY;
 
-    memcpy(temp->qnc_name_n, name_n, wire_name_length(name_n));
+    temp->qnc_name_n = name_intern(name_n);
+    if (temp->qnc_name_n == NULL) {
+        FREE(temp);
+        return VAL_OUT_OF_MEMORY;
+    }
 
     temp->qnc_next = *qnames;
     *qnames = temp;
@@ -264,6 +422,7 @@ free_qname_chain(struct qname_chain **qnames)
     if ((*qnames)->qnc_next)
         free_qname_chain(&((*qnames)->qnc_next));
 
+    name_release((*qnames)->qnc_name_n);
     FREE(*qnames);
     (*qnames) = NULL;
 }
@@ -275,7 +434,7 @@ free_domain_info_ptrs(struct domain_info *di)
         return;
 
     if (di->di_requested_name_h) {
-        FREE(di->di_requested_name_h);
+        arena_free(di->di_requested_name_h);
         di->di_requested_name_h = NULL;
     }
 
@@ -295,6 +454,7 @@ is_tail(u_char * full, u_char * tail)
 {
     size_t             f_len = wire_name_length(full);
     size_t             t_len = wire_name_length(tail);
+    size_t             index;
 
     if (f_len == t_len) {
         if (f_len)
@@ -306,15 +466,13 @@ is_tail(u_char * full, u_char * tail)
     if (t_len > f_len)
         return FALSE;
 
-    if (namecmp(&full[f_len - t_len], tail) == 0) {
-        size_t        index = 0;
+    /* the tail must start on a label boundary of full */
+    index = 0;
+    while (index < (f_len - t_len))
+        index += (full[index]) + (u_char) 1;
 
-        while (index < (f_len - t_len)) {
-            index += (full[index]) + (u_char) 1;
-            if (index == f_len - t_len)
-                return TRUE;
-        }
-    }
+    if (index == f_len - t_len && namecmp(&full[index], tail) == 0)
+        return TRUE;
 
     return FALSE;
 }
@@ -722,6 +880,8 @@ decompress(u_char ** rdata,
             return VAL_BAD_ARGUMENT;
 
         working_index += working_increment;
+        if (working_index - rdata_index > *rdata_len_h)
+            return VAL_BAD_ARGUMENT;
         other_name_length = wire_name_length(other_expanded_name);
         expansion += other_name_length - working_increment;
 
@@ -746,6 +906,8 @@ decompress(u_char ** rdata,
             return VAL_BAD_ARGUMENT;
 
         working_index += working_increment;
+        if (working_index - rdata_index > *rdata_len_h)
+            return VAL_BAD_ARGUMENT;
         name_length = wire_name_length(expanded_name);
         expansion += name_length - working_increment;
 
@@ -835,6 +997,8 @@ decompress(u_char ** rdata,
             other_name_length = wire_name_length(other_expanded_name);
             expansion += other_name_length - working_increment;
         }
+        if (working_index - rdata_index > *rdata_len_h)
+            return VAL_BAD_ARGUMENT;
 
         /*
          * Make the new data area 
@@ -880,6 +1044,8 @@ decompress(u_char ** rdata,
         if (working_increment < 0)
             return VAL_BAD_ARGUMENT;
 
+        if (SIGNBY + working_increment > *rdata_len_h)
+            return VAL_BAD_ARGUMENT;
         name_length = wire_name_length(expanded_name);
         expansion += name_length - working_increment;
 
@@ -1023,10 +1189,8 @@ lower_name(u_char rdata[], size_t * index)
 
     length = wire_name_length(&rdata[(*index)]);
 
-    while (length-- > 0) {
-        rdata[(*index)] = tolower(rdata[(*index)]);
-        (*index)++;
-    }
+    res_name_lower(&rdata[(*index)], &rdata[(*index)], length);
+    (*index) += length;
 }
 
 void
@@ -1450,6 +1614,28 @@ copy_rrset_rec_list_in_zonecut(struct rrset_rec *rr_set, u_char *qname_n)
 }
 #endif
 
+static struct query_list *
+_new_query_list(u_char * name_n, u_int16_t type_h, u_char * zone_n)
+{
+    struct query_list *ql;
+
+    ql = (struct query_list *) MALLOC(sizeof(struct query_list));
+    if (ql == NULL)
+        return NULL;
+    ql->ql_name_n = name_intern(name_n);
+    /* no zone is recorded as the root, as it always has been */
+    ql->ql_zone_n = name_intern(zone_n ? zone_n : (u_char *) "");
+    if (ql->ql_name_n == NULL || ql->ql_zone_n == NULL) {
+        name_release(ql->ql_name_n);
+        name_release(ql->ql_zone_n);
+        FREE(ql);
+        return NULL;
+    }
+    ql->ql_type_h = type_h;
+    ql->ql_next = NULL;
+    return ql;
+}
+
 /*
  *
  * returns
@@ -1465,17 +1651,10 @@ register_query(struct query_list **q, u_char * name_n, u_int16_t type_h,
         return IT_WONT;
 
     if (*q == NULL) {
-        *q = (struct query_list *) MALLOC(sizeof(struct query_list));
+        *q = _new_query_list(name_n, type_h, zone_n);
         if (*q == NULL) {
             return IT_WONT;     /* Out of memory */
         }
-        memcpy((*q)->ql_name_n, name_n, wire_name_length(name_n));
-        if (zone_n)
-            memcpy((*q)->ql_zone_n, zone_n, wire_name_length(zone_n));
-        else
-            memset((*q)->ql_zone_n, 0, sizeof((*q)->ql_zone_n));
-        (*q)->ql_type_h = type_h;
-        (*q)->ql_next = NULL;
     } else {
         struct query_list *cur_q = (*q);
         int             count = 0;
@@ -1490,19 +1669,10 @@ register_query(struct query_list **q, u_char * name_n, u_int16_t type_h,
         if ((!zone_n || namecmp(cur_q->ql_zone_n, zone_n) == 0)
             && namecmp(cur_q->ql_name_n, name_n) == 0)
             return ITS_BEEN_DONE;
-        cur_q->ql_next =
-            (struct query_list *) MALLOC(sizeof(struct query_list));
+        cur_q->ql_next = _new_query_list(name_n, type_h, zone_n);
         if (cur_q->ql_next == NULL) {
             return IT_WONT;     /* Out of memory */
         }
-        cur_q = cur_q->ql_next;
-        memcpy(cur_q->ql_name_n, name_n, wire_name_length(name_n));
-        if (zone_n)
-            memcpy(cur_q->ql_zone_n, zone_n, wire_name_length(zone_n));
-        else
-            memset(cur_q->ql_zone_n, 0, sizeof((*q)->ql_zone_n));
-        cur_q->ql_type_h = type_h;
-        cur_q->ql_next = NULL;
     }
     return IT_HASNT;
 }
@@ -1518,6 +1688,8 @@ deregister_queries(struct query_list **q)
     while (*q) {
         p = *q;
         *q = (*q)->ql_next;
+        name_release(p->ql_name_n);
+        name_release(p->ql_zone_n);
         FREE(p);
     }
 }
@@ -1558,7 +1730,11 @@ merge_rrset_recs(struct rrset_rec **dest, struct rrset_rec *new_info)
                 if (!(old->rrs_cred < new_rr->rrs_cred ||
                       (old->rrs_cred == new_rr->rrs_cred &&
                        old->rrs_section <=
-                       new_rr->rrs_section))) {
+                       new_rr->rrs_section)) &&
+                    /* a cache view cannot give its records away */
+                    VAL_NO_ERROR == unshare_rrset_rec(trail_new ?
+                                        &trail_new->rrs_next : &new_info)) {
+                    new_rr = trail_new ? trail_new->rrs_next : new_info;
                     /*
                      * exchange the two -
                      * copy from new to old: cred, status, section, ans_kind
@@ -69,6 +69,10 @@ size_t          wire_name_length(const u_char * field);
 
 void            res_sq_free_rr_recs(struct rrset_rr **rr);
 void            res_sq_free_rrset_recs(struct rrset_rec **set);
+void            release_rrset_rec(struct rrset_rec *rr_set);
+struct rrset_rec *view_rrset_rec(struct rrset_rec *rr_set, u_int32_t ttl_h);
+int             unshare_rrset_recs(struct rrset_rec **set);
+int             unshare_assertion(struct val_digested_auth_chain *as);
 int             add_to_qname_chain(struct qname_chain **qnames,
                                    const u_char * name_n);
 int             name_in_qname_chain(struct qname_chain *qnames,
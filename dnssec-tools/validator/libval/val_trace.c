@@ -0,0 +1,759 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * A binary trace of what the validator did, for offline analysis (the
+ * trace option in dnsval.conf): queries sent, responses received,
+ * RRSIGs checked, chain of trust links checked and the final result
+ * of each request.  Events are appended to a file or written to a
+ * unix stream socket in the format described in validator/val_trace.h;
+ * the reader at the end of this file turns them back into structs.
+ *
+ * Events are collected in a buffer that is written out when it fills
+ * up, at the end of a request if TRACE_FLUSH_USEC has passed since the
+ * last write, and at exit.  A socket is written without blocking: if
+ * the reader falls behind, whatever could not be sent stays buffered
+ * and new events are dropped (whole, so the stream stays readable)
+ * until there is room again.  If a write fails the trace is turned off
+ * rather than slowing down or failing validation.
+ */
+#include "validator-internal.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <sys/un.h>
+#endif
+
+#include "validator/val_trace.h"
+#include "val_trace.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define TRACE_HDR_LEN       8
+#define TRACE_EVENT_HDR_LEN 22  /* everything before the event extras */
+#define TRACE_BUF_SIZE      (64 * 1024)
+#define TRACE_FLUSH_USEC    200000
+
+int             val_trace_enabled = 0;
+
+static int      trace_fd = -1;
+static int      trace_is_socket = 0;
+static char    *trace_spec = NULL;
+static int      trace_atexit = 0;
+static u_char   trace_buf[TRACE_BUF_SIZE];
+static size_t   trace_used = 0;
+static long long trace_now = 0;         /* usec, time of the last event */
+static long long trace_flushed = 0;     /* usec, time of the last write */
+static unsigned long trace_dropped = 0;
+static u_int32_t trace_id = 0;
+
+#ifndef VAL_NO_THREADS
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define TRACE_LOCK()    pthread_mutex_lock(&trace_mutex)
+#define TRACE_UNLOCK()  pthread_mutex_unlock(&trace_mutex)
+#else
+#define TRACE_LOCK()
+#define TRACE_UNLOCK()
+#endif
+
+static void
+_put16(u_char **cp, u_int16_t v)
+{
+    (*cp)[0] = (u_char) (v >> 8);
+    (*cp)[1] = (u_char) v;
+    *cp += 2;
+}
+
+static void
+_put32(u_char **cp, u_int32_t v)
+{
+    (*cp)[0] = (u_char) (v >> 24);
+    (*cp)[1] = (u_char) (v >> 16);
+    (*cp)[2] = (u_char) (v >> 8);
+    (*cp)[3] = (u_char) v;
+    *cp += 4;
+}
+
+static u_int16_t
+_get16(const u_char *cp)
+{
+    return (u_int16_t) ((cp[0] << 8) | cp[1]);
+}
+
+static u_int32_t
+_get32(const u_char *cp)
+{
+    return ((u_int32_t) cp[0] << 24) | ((u_int32_t) cp[1] << 16) |
+        ((u_int32_t) cp[2] << 8) | (u_int32_t) cp[3];
+}
+
+/*
+ * Write out as much as possible; returns the number of bytes written,
+ * which is less than len only if the socket would block, or -1 if the
+ * trace should be given up on
+ */
+static ssize_t
+_trace_write(const u_char *buf, size_t len)
+{
+    size_t          done = 0;
+    ssize_t         n;
+
+    while (done < len) {
+#ifndef WIN32
+        if (trace_is_socket)
+            n = send(trace_fd, buf + done, len - done, MSG_NOSIGNAL);
+        else
+#endif
+            n = write(trace_fd, buf + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+    return (ssize_t) done;
+}
+
+static void
+_trace_set_blocking(int blocking)
+{
+#ifndef WIN32
+    int             flags;
+
+    if (trace_fd == -1 || !trace_is_socket ||
+        (flags = fcntl(trace_fd, F_GETFL)) == -1)
+        return;
+    fcntl(trace_fd, F_SETFL,
+          blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+#endif
+}
+
+static void
+_trace_close_locked(void)
+{
+    val_trace_enabled = 0;
+    if (trace_fd != -1)
+        close(trace_fd);
+    trace_fd = -1;
+    trace_used = 0;
+    trace_dropped = 0;
+    if (trace_spec)
+        FREE(trace_spec);
+    trace_spec = NULL;
+}
+
+static void
+_trace_flush_locked(void)
+{
+    ssize_t         n;
+
+    trace_flushed = trace_now;
+    if (trace_fd == -1 || trace_used == 0)
+        return;
+    if ((n = _trace_write(trace_buf, trace_used)) < 0) {
+        VAL_LOG(NULL, LOG_WARNING,
+                "val_trace: could not write to %s, trace disabled",
+                trace_spec);
+        _trace_close_locked();
+        return;
+    }
+    if ((size_t) n < trace_used)
+        memmove(trace_buf, trace_buf + n, trace_used - n);
+    trace_used -= n;
+    if (trace_used == 0 && trace_dropped) {
+        VAL_LOG(NULL, LOG_WARNING,
+                "val_trace: %s fell behind, %lu events dropped",
+                trace_spec, trace_dropped);
+        trace_dropped = 0;
+    }
+}
+
+/*
+ * Write out whatever is left, waiting for the reader if need be
+ */
+static void
+_trace_drain_locked(void)
+{
+    _trace_set_blocking(1);
+    _trace_flush_locked();
+}
+
+static void
+_trace_flush_at_exit(void)
+{
+    TRACE_LOCK();
+    _trace_drain_locked();
+    TRACE_UNLOCK();
+}
+
+/*
+ * Start writing the trace to spec: "file:<path>", "unix:<path>" or a
+ * plain file name.  The trace is shared by all contexts in the
+ * process; asking for the target already in use does nothing.
+ */
+int
+val_trace_open(const char *spec)
+{
+    u_char          hdr[TRACE_HDR_LEN], *cp;
+    struct stat     sb;
+    const char     *path;
+    int             fd, is_socket = 0;
+
+    if (spec == NULL)
+        return VAL_BAD_ARGUMENT;
+
+    TRACE_LOCK();
+    if (trace_spec && !strcmp(trace_spec, spec)) {
+        TRACE_UNLOCK();
+        return VAL_NO_ERROR;
+    }
+    _trace_drain_locked();
+    _trace_close_locked();
+
+    path = spec;
+    if (!strncmp(spec, "file:", 5)) {
+        path = spec + 5;
+    } else if (!strncmp(spec, "unix:", 5)) {
+        path = spec + 5;
+        is_socket = 1;
+    }
+
+    if (is_socket) {
+#ifndef WIN32
+        struct sockaddr_un sun;
+
+        if (strlen(path) >= sizeof(sun.sun_path))
+            goto err;
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strcpy(sun.sun_path, path);
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+            goto err;
+        if (connect(fd, (struct sockaddr *) &sun, sizeof(sun)) == -1) {
+            close(fd);
+            goto err;
+        }
+#else
+        goto err;
+#endif
+    } else {
+        if ((fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) == -1)
+            goto err;
+    }
+
+    trace_fd = fd;
+    trace_is_socket = is_socket;
+    trace_spec = (char *) MALLOC(strlen(spec) + 1);
+    if (trace_spec == NULL) {
+        _trace_close_locked();
+        TRACE_UNLOCK();
+        return VAL_OUT_OF_MEMORY;
+    }
+    strcpy(trace_spec, spec);
+
+    /*
+     * A stream, or a new file, starts with the header
+     */
+    if (is_socket || (fstat(fd, &sb) == 0 && sb.st_size == 0)) {
+        cp = hdr;
+        memcpy(cp, VAL_TRACE_MAGIC, 4);
+        cp += 4;
+        _put16(&cp, VAL_TRACE_VERSION);
+        _put16(&cp, TRACE_HDR_LEN);
+        if (_trace_write(hdr, sizeof(hdr)) != sizeof(hdr)) {
+            _trace_close_locked();
+            goto err;
+        }
+    }
+    _trace_set_blocking(0);
+
+    if (!trace_atexit) {
+        atexit(_trace_flush_at_exit);
+        trace_atexit = 1;
+    }
+    val_trace_enabled = 1;
+    TRACE_UNLOCK();
+
+    VAL_LOG(NULL, LOG_INFO, "val_trace: writing trace to %s", spec);
+    return VAL_NO_ERROR;
+
+  err:
+    TRACE_UNLOCK();
+    VAL_LOG(NULL, LOG_WARNING, "val_trace: could not open %s: %s",
+            spec, strerror(errno));
+    return VAL_CONF_NOT_FOUND;
+}
+
+void
+val_trace_close(void)
+{
+    TRACE_LOCK();
+    _trace_drain_locked();
+    _trace_close_locked();
+    TRACE_UNLOCK();
+}
+
+/*
+ * A new query id; ids are only handed out while tracing
+ */
+u_int32_t
+val_trace_next_id(void)
+{
+    if (!val_trace_enabled)
+        return 0;
+#if !defined(VAL_NO_THREADS) && defined(__ATOMIC_RELAXED)
+    return __atomic_add_fetch(&trace_id, 1, __ATOMIC_RELAXED);
+#else
+    {
+        u_int32_t       id;
+
+        TRACE_LOCK();
+        id = ++trace_id;
+        TRACE_UNLOCK();
+        return id;
+    }
+#endif
+}
+
+static size_t
+_addr_len(struct name_server *ns)
+{
+    struct sockaddr_storage *ss;
+
+    if (ns == NULL || ns->ns_number_of_addresses <= 0)
+        return 1;
+    ss = ns->ns_address[0];
+    if (ss->ss_family == AF_INET)
+        return 3 + 4;
+#ifdef VAL_IPV6
+    if (ss->ss_family == AF_INET6)
+        return 3 + 16;
+#endif
+    return 1;
+}
+
+static void
+_put_addr(u_char **cp, struct name_server *ns)
+{
+    struct sockaddr_storage *ss;
+
+    if (_addr_len(ns) == 1) {
+        *(*cp)++ = 0;
+        return;
+    }
+    ss = ns->ns_address[0];
+    if (ss->ss_family == AF_INET) {
+        struct sockaddr_in *sin = (struct sockaddr_in *) ss;
+        *(*cp)++ = 4;
+        _put16(cp, ntohs(sin->sin_port));
+        memcpy(*cp, &sin->sin_addr, 4);
+        *cp += 4;
+    }
+#ifdef VAL_IPV6
+    else {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) ss;
+        *(*cp)++ = 6;
+        _put16(cp, ntohs(sin6->sin6_port));
+        memcpy(*cp, &sin6->sin6_addr, 16);
+        *cp += 16;
+    }
+#endif
+}
+
+/*
+ * Reserve room in the buffer for an event with extra_len bytes of
+ * event-specific data and fill in the common part.  Returns with the
+ * lock held and a pointer to where the extras go, or NULL (unlocked)
+ * if the trace is off.
+ */
+static u_char  *
+_trace_begin(int event, u_int32_t id, const u_char *name_n,
+             u_int16_t type_h, u_int16_t class_h, u_int16_t status,
+             size_t extra_len, u_char **name_p)
+{
+    struct timeval  now;
+    size_t          name_len, len;
+    u_char         *cp;
+
+    name_len = name_n ? wire_name_length(name_n) : 1;
+    len = TRACE_EVENT_HDR_LEN + extra_len + name_len;
+    gettimeofday(&now, NULL);
+
+    TRACE_LOCK();
+    if (!val_trace_enabled) {
+        TRACE_UNLOCK();
+        return NULL;
+    }
+    trace_now = (long long) now.tv_sec * 1000000 + now.tv_usec;
+    if (trace_used + len > sizeof(trace_buf))
+        _trace_flush_locked();
+    if (!val_trace_enabled) {
+        TRACE_UNLOCK();
+        return NULL;
+    }
+    if (trace_used + len > sizeof(trace_buf)) {
+        /*
+         * The reader is not keeping up
+         */
+        trace_dropped++;
+        TRACE_UNLOCK();
+        return NULL;
+    }
+
+    cp = trace_buf + trace_used;
+    trace_used += len;
+    _put16(&cp, (u_int16_t) (len - 2));
+    *cp++ = (u_char) event;
+    *cp++ = 0;
+    _put32(&cp, (u_int32_t) now.tv_sec);
+    _put32(&cp, (u_int32_t) now.tv_usec);
+    _put32(&cp, id);
+    _put16(&cp, type_h);
+    _put16(&cp, class_h);
+    _put16(&cp, status);
+
+    *name_p = cp + extra_len;
+    if (name_n)
+        memcpy(*name_p, name_n, name_len);
+    else
+        **name_p = 0;
+    return cp;
+}
+
+void
+val_trace_query(u_int32_t id, const u_char *name_n, u_int16_t type_h,
+                u_int16_t class_h, struct name_server *ns)
+{
+    u_char         *cp, *name_p;
+
+    cp = _trace_begin(VAL_TRACE_QUERY, id, name_n, type_h, class_h, 0,
+                      _addr_len(ns), &name_p);
+    if (cp == NULL)
+        return;
+    _put_addr(&cp, ns);
+    TRACE_UNLOCK();
+}
+
+void
+val_trace_response(u_int32_t id, const u_char *name_n, u_int16_t type_h,
+                   u_int16_t class_h, struct name_server *ns,
+                   const u_char *response, size_t response_length)
+{
+    u_char         *cp, *name_p;
+
+    cp = _trace_begin(VAL_TRACE_RESPONSE, id, name_n, type_h, class_h, 0,
+                      4 + _addr_len(ns), &name_p);
+    if (cp == NULL)
+        return;
+    *cp++ = (response && response_length > 3) ? (response[3] & 0x0f) : 0;
+    *cp++ = 0;
+    _put16(&cp, response_length > 0xffff ?
+           0xffff : (u_int16_t) response_length);
+    _put_addr(&cp, ns);
+    TRACE_UNLOCK();
+}
+
+void
+val_trace_rrsig(u_int32_t id, const u_char *name_n, u_int16_t type_h,
+                u_int16_t class_h, val_astatus_t status,
+                u_int8_t algorithm, u_int16_t keytag)
+{
+    u_char         *cp, *name_p;
+
+    cp = _trace_begin(VAL_TRACE_RRSIG, id, name_n, type_h, class_h,
+                      (u_int16_t) status, 4, &name_p);
+    if (cp == NULL)
+        return;
+    *cp++ = algorithm;
+    *cp++ = 0;
+    _put16(&cp, keytag);
+    TRACE_UNLOCK();
+}
+
+void
+val_trace_link(u_int32_t id, const u_char *name_n, u_int16_t type_h,
+               u_int16_t class_h, val_astatus_t status)
+{
+    u_char         *name_p;
+
+    if (_trace_begin(VAL_TRACE_LINK, id, name_n, type_h, class_h,
+                     (u_int16_t) status, 0, &name_p) == NULL)
+        return;
+    TRACE_UNLOCK();
+}
+
+/*
+ * The end of a request: also pushes out the buffered events if they
+ * have been sitting there for a while, so that a reader sees whole
+ * requests without much delay
+ */
+void
+val_trace_result(u_int32_t id, const u_char *name_n, u_int16_t type_h,
+                 u_int16_t class_h, val_status_t status)
+{
+    u_char         *name_p;
+
+    if (_trace_begin(VAL_TRACE_RESULT, id, name_n, type_h, class_h,
+                     (u_int16_t) status, 0, &name_p) == NULL)
+        return;
+    if (trace_now - trace_flushed >= TRACE_FLUSH_USEC)
+        _trace_flush_locked();
+    TRACE_UNLOCK();
+}
+
+/*
+ * The reader
+ */
+
+struct val_trace_reader {
+    int             tr_fd;
+    int             tr_own_fd;
+    int             tr_header_seen;
+    size_t          tr_off;
+    size_t          tr_len;
+    u_char          tr_buf[4 * (2 + VAL_TRACE_MAX_EVENT)];
+};
+
+val_trace_reader_t *
+val_trace_reader_fdopen(int fd)
+{
+    val_trace_reader_t *r;
+
+    if (fd < 0)
+        return NULL;
+    r = (val_trace_reader_t *) MALLOC(sizeof(val_trace_reader_t));
+    if (r == NULL)
+        return NULL;
+    memset(r, 0, sizeof(*r));
+    r->tr_fd = fd;
+    return r;
+}
+
+val_trace_reader_t *
+val_trace_reader_open(const char *path)
+{
+    val_trace_reader_t *r;
+    int             fd;
+
+    if (path == NULL || (fd = open(path, O_RDONLY)) == -1)
+        return NULL;
+    if ((r = val_trace_reader_fdopen(fd)) == NULL) {
+        close(fd);
+        return NULL;
+    }
+    r->tr_own_fd = 1;
+    return r;
+}
+
+void
+val_trace_reader_close(val_trace_reader_t *r)
+{
+    if (r == NULL)
+        return;
+    if (r->tr_own_fd)
+        close(r->tr_fd);
+    FREE(r);
+}
+
+/*
+ * Make sure n bytes are buffered.  Returns 1 if they are, 0 at the
+ * end of the input with nothing buffered and -1 on errors and
+ * truncated input.
+ */
+static int
+_reader_fill(val_trace_reader_t *r, size_t n)
+{
+    ssize_t         got;
+
+    if (r->tr_len - r->tr_off >= n)
+        return 1;
+    if (r->tr_off > 0) {
+        memmove(r->tr_buf, r->tr_buf + r->tr_off, r->tr_len - r->tr_off);
+        r->tr_len -= r->tr_off;
+        r->tr_off = 0;
+    }
+    while (r->tr_len < n) {
+        got = read(r->tr_fd, r->tr_buf + r->tr_len,
+                   sizeof(r->tr_buf) - r->tr_len);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0)
+            return -1;
+        if (got == 0)
+            return r->tr_len == 0 ? 0 : -1;
+        r->tr_len += got;
+    }
+    return 1;
+}
+
+static int
+_reader_addr(const u_char **cp, const u_char *end,
+             struct sockaddr_storage *ss)
+{
+    int             family;
+
+    memset(ss, 0, sizeof(*ss));
+    if (*cp >= end)
+        return -1;
+    family = *(*cp)++;
+    if (family == 0)
+        return 0;
+    if (family == 4) {
+        struct sockaddr_in *sin = (struct sockaddr_in *) ss;
+        if (end - *cp < 2 + 4)
+            return -1;
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(_get16(*cp));
+        memcpy(&sin->sin_addr, *cp + 2, 4);
+        *cp += 2 + 4;
+        return 0;
+    }
+#ifdef VAL_IPV6
+    if (family == 6) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) ss;
+        if (end - *cp < 2 + 16)
+            return -1;
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(_get16(*cp));
+        memcpy(&sin6->sin6_addr, *cp + 2, 16);
+        *cp += 2 + 16;
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+/*
+ * Copy the wire-format name at cp, which must end exactly at end
+ */
+static int
+_reader_name(const u_char *cp, const u_char *end, u_char *name_n)
+{
+    size_t          len = 0;
+
+    while (cp + len < end) {
+        if (cp[len] == 0) {
+            if (cp + len + 1 != end)
+                return -1;
+            memcpy(name_n, cp, len + 1);
+            return 0;
+        }
+        if (cp[len] & 0xc0)
+            return -1;
+        len += cp[len] + 1;
+        if (len >= NS_MAXCDNAME)
+            return -1;
+    }
+    return -1;
+}
+
+/*
+ * Read the next event into ev.  Returns 1 for an event, 0 at the end
+ * of the trace and -1 if the trace is damaged or cannot be read.
+ * Events of unknown types are skipped.
+ */
+int
+val_trace_read(val_trace_reader_t *r, struct val_trace_event *ev)
+{
+    const u_char   *cp, *end;
+    size_t          len;
+    int             ret;
+
+    if (r == NULL || ev == NULL)
+        return -1;
+
+    if (!r->tr_header_seen) {
+        if ((ret = _reader_fill(r, TRACE_HDR_LEN)) <= 0)
+            return ret;
+        cp = r->tr_buf + r->tr_off;
+        if (memcmp(cp, VAL_TRACE_MAGIC, 4) ||
+            _get16(cp + 4) != VAL_TRACE_VERSION ||
+            _get16(cp + 6) < TRACE_HDR_LEN ||
+            _get16(cp + 6) > sizeof(r->tr_buf))
+            return -1;
+        len = _get16(cp + 6);
+        if (_reader_fill(r, len) <= 0)
+            return -1;
+        r->tr_off += len;
+        r->tr_header_seen = 1;
+    }
+
+    for (;;) {
+        if ((ret = _reader_fill(r, 2)) <= 0)
+            return ret;
+        len = _get16(r->tr_buf + r->tr_off);
+        if (len < TRACE_EVENT_HDR_LEN - 2 + 1 || len > VAL_TRACE_MAX_EVENT)
+            return -1;
+        if (_reader_fill(r, 2 + len) <= 0)
+            return -1;
+        cp = r->tr_buf + r->tr_off + 2;
+        end = cp + len;
+        r->tr_off += 2 + len;
+
+        memset(ev, 0, sizeof(*ev));
+        ev->te_event = cp[0];
+        if (ev->te_event < VAL_TRACE_QUERY || ev->te_event > VAL_TRACE_RESULT)
+            continue;
+        ev->te_time.tv_sec = _get32(cp + 2);
+        ev->te_time.tv_usec = _get32(cp + 6);
+        ev->te_id = _get32(cp + 10);
+        ev->te_type = _get16(cp + 14);
+        ev->te_class = _get16(cp + 16);
+        ev->te_status = _get16(cp + 18);
+        cp += TRACE_EVENT_HDR_LEN - 2;
+
+        switch (ev->te_event) {
+        case VAL_TRACE_QUERY:
+            if (_reader_addr(&cp, end, &ev->te_server) != 0)
+                return -1;
+            break;
+        case VAL_TRACE_RESPONSE:
+            if (end - cp < 4)
+                return -1;
+            ev->te_rcode = cp[0];
+            ev->te_msglen = _get16(cp + 2);
+            cp += 4;
+            if (_reader_addr(&cp, end, &ev->te_server) != 0)
+                return -1;
+            break;
+        case VAL_TRACE_RRSIG:
+            if (end - cp < 4)
+                return -1;
+            ev->te_algorithm = cp[0];
+            ev->te_keytag = _get16(cp + 2);
+            cp += 4;
+            break;
+        default:
+            break;
+        }
+        if (_reader_name(cp, end, ev->te_name_n) != 0)
+            return -1;
+        return 1;
+    }
+}
+
+const char     *
+p_trace_event(int event)
+{
+    switch (event) {
+    case VAL_TRACE_QUERY:
+        return "QUERY";
+    case VAL_TRACE_RESPONSE:
+        return "RESPONSE";
+    case VAL_TRACE_RRSIG:
+        return "RRSIG";
+    case VAL_TRACE_LINK:
+        return "LINK";
+    case VAL_TRACE_RESULT:
+        return "RESULT";
+    default:
+        return "UNKNOWN";
+    }
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+#ifndef VAL_TRACE_INTERNAL_H
+#define VAL_TRACE_INTERNAL_H
+
+/* events are only built when this is set */
+extern int      val_trace_enabled;
+
+int             val_trace_open(const char *spec);
+void            val_trace_close(void);
+u_int32_t       val_trace_next_id(void);
+void            val_trace_query(u_int32_t id, const u_char *name_n,
+                                u_int16_t type_h, u_int16_t class_h,
+                                struct name_server *ns);
+void            val_trace_response(u_int32_t id, const u_char *name_n,
+                                   u_int16_t type_h, u_int16_t class_h,
+                                   struct name_server *ns,
+                                   const u_char *response,
+                                   size_t response_length);
+void            val_trace_rrsig(u_int32_t id, const u_char *name_n,
+                                u_int16_t type_h, u_int16_t class_h,
+                                val_astatus_t status, u_int8_t algorithm,
+                                u_int16_t keytag);
+void            val_trace_link(u_int32_t id, const u_char *name_n,
+                               u_int16_t type_h, u_int16_t class_h,
+                               val_astatus_t status);
+void            val_trace_result(u_int32_t id, const u_char *name_n,
+                                 u_int16_t type_h, u_int16_t class_h,
+                                 val_status_t status);
+
+#endif
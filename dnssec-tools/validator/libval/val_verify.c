@@ -14,6 +14,9 @@
 #include "val_crypto.h"
 #include "val_policy.h"
 #include "val_parse.h"
+#include "val_arena.h"
+#include "val_trace.h"
+#include "val_span.h"
 
 
 #define ZONE_KEY_FLAG 0x0100    /* Zone Key Flag, RFC 4034 */
@@ -33,7 +36,7 @@ get_clock_skew(val_context_t *ctx,
     size_t       name_len;
 
     if (ctx == NULL || name_n == NULL || skew == NULL || ttl_x == NULL) {
-        val_log(ctx, LOG_DEBUG, "get_clock_skew(): Cannot check for clock skew policy, bad args"); 
+        VAL_LOG(ctx, LOG_DEBUG, "get_clock_skew(): Cannot check for clock skew policy, bad args"); 
         return; 
     }
     
@@ -67,7 +70,7 @@ get_clock_skew(val_context_t *ctx,
                 }
             }
             if (root_zone || (!namecmp(p, cs_cur->zone_n))) {
-                val_log(ctx, LOG_DEBUG, "get_clock_skew(): Found clock skew policy"); 
+                VAL_LOG(ctx, LOG_DEBUG, "get_clock_skew(): Found clock skew policy"); 
                 if (cs_cur->pol) {
                     *skew = ((struct clock_skew_policy *)(cs_cur->pol))->clock_skew;
                     if (cs_cur->exp_ttl > 0)
@@ -77,7 +80,7 @@ get_clock_skew(val_context_t *ctx,
             }
         }
     }
-    val_log(ctx, LOG_DEBUG, "get_clock_skew(): No clock skew policy found"); 
+    VAL_LOG(ctx, LOG_DEBUG, "get_clock_skew(): No clock skew policy found"); 
     *skew = 0;
 }
 
@@ -96,6 +99,7 @@ val_sigverify(val_context_t * ctx,
 {
     struct timeval  tv;
     struct timeval  tv_sig;
+    struct timeval  verify_start;
 
     /** Inputs to this function have already been NULL-checked **/
 
@@ -103,7 +107,7 @@ val_sigverify(val_context_t * ctx,
      * Check if the dnskey is a zone key 
      */
     if ((dnskey->flags & ZONE_KEY_FLAG) == 0) {
-        val_log(ctx, LOG_INFO, "val_sigverify(): DNSKEY with tag=%d is not a zone key", dnskey->key_tag);
+        VAL_LOG(ctx, LOG_INFO, "val_sigverify(): DNSKEY with tag=%d is not a zone key", dnskey->key_tag);
         *dnskey_status = VAL_AC_INVALID_KEY;
         return 0;
     }
@@ -112,7 +116,7 @@ val_sigverify(val_context_t * ctx,
      * Check dnskey protocol value 
      */
     if (dnskey->protocol != 3) {
-        val_log(ctx, LOG_INFO,
+        VAL_LOG(ctx, LOG_INFO,
                 "val_sigverify(): Invalid protocol field in DNSKEY with tag=%d: %d",
                 dnskey->protocol, dnskey->key_tag);
         *dnskey_status = VAL_AC_UNKNOWN_DNSKEY_PROTOCOL;
@@ -123,7 +127,7 @@ val_sigverify(val_context_t * ctx,
      * Match dnskey and rrsig algorithms 
      */
     if (dnskey->algorithm != rrsig->algorithm) {
-        val_log(ctx, LOG_INFO,
+        VAL_LOG(ctx, LOG_INFO,
                 "val_sigverify(): Algorithm mismatch between DNSKEY (%d) and RRSIG (%d) records.",
                 dnskey->algorithm, rrsig->algorithm);
         *sig_status = VAL_AC_RRSIG_ALGORITHM_MISMATCH;
@@ -148,13 +152,13 @@ val_sigverify(val_context_t * ctx,
                 GET_TIME_BUF((const time_t *)(&tv.tv_sec), currTime);
                 GET_TIME_BUF((const time_t *)(&tv_sig.tv_sec), incpTime);
 
-                val_log(ctx, LOG_INFO,
+                VAL_LOG(ctx, LOG_INFO,
                         "val_sigverify(): Signature not yet valid. Current time (%s) is less than signature inception time (%s).",
                         currTime, incpTime);
                 *sig_status = VAL_AC_RRSIG_NOTYETACTIVE;
                 return 0;
             } else {
-                val_log(ctx, LOG_DEBUG,
+                VAL_LOG(ctx, LOG_DEBUG,
                         "val_sigverify(): Signature not yet valid, but within acceptable skew.");
             }
     
@@ -173,21 +177,23 @@ val_sigverify(val_context_t * ctx,
                 GET_TIME_BUF((const time_t *)(&tv.tv_sec), currTime);
                 GET_TIME_BUF((const time_t *)(&tv_sig.tv_sec), exprTime);
 
-                val_log(ctx, LOG_INFO,
+                VAL_LOG(ctx, LOG_INFO,
                         "val_sigverify(): Signature expired. Current time (%s) is greater than signature expiration time (%s).",
                         currTime, exprTime);
                 *sig_status = VAL_AC_RRSIG_EXPIRED;
                 return 0;
             } else {
-                val_log(ctx, LOG_DEBUG,
+                VAL_LOG(ctx, LOG_DEBUG,
                         "val_sigverify(): Signature expired, but within acceptable skew.");
             }
         }
     } else {
-        val_log(ctx, LOG_DEBUG,
+        VAL_LOG(ctx, LOG_DEBUG,
                 "val_sigverify(): Not checking inception and expiration times on signatures.");
     }
 
+    gettimeofday(&verify_start, NULL);
+
     switch (rrsig->algorithm) {
 
     case ALG_RSAMD5:
@@ -224,16 +230,23 @@ val_sigverify(val_context_t * ctx,
 #endif
 
     default:
-        val_log(ctx, LOG_INFO, "val_sigverify(): Unsupported algorithm %d.",
+        VAL_LOG(ctx, LOG_INFO, "val_sigverify(): Unsupported algorithm %d.",
                 rrsig->algorithm);
         *sig_status = VAL_AC_ALGORITHM_NOT_SUPPORTED;
         *dnskey_status = VAL_AC_ALGORITHM_NOT_SUPPORTED;
         break;
     }
 
+    if (*sig_status != VAL_AC_ALGORITHM_NOT_SUPPORTED) {
+        SPAN_END(VAL_SPAN_RRSIG, &verify_start);
+        res_stats_time(RES_HIST_VERIFY, &verify_start);
+        res_stats_inc(*sig_status == VAL_AC_RRSIG_VERIFIED ?
+                      RES_STAT_SIG_VERIFIED : RES_STAT_SIG_FAILED);
+    }
+
     if (*sig_status == VAL_AC_RRSIG_VERIFIED) {
         if (is_a_wildcard) {
-            val_log(ctx, LOG_DEBUG, "val_sigverify(): Verified RRSIG is for a wildcard");
+            VAL_LOG(ctx, LOG_DEBUG, "val_sigverify(): Verified RRSIG is for a wildcard");
             if (clock_skew > 0)
                 *sig_status = VAL_AC_WCARD_VERIFIED_SKEW;
             else
@@ -312,7 +325,7 @@ make_sigfield(u_char ** field,
         VAL_NO_ERROR)
         return retval;
 
-    *field = (u_char *) MALLOC(*field_length * sizeof(u_char));
+    *field = (u_char *) arena_malloc(*field_length * sizeof(u_char));
 
     if (*field == NULL)
         return VAL_OUT_OF_MEMORY;
@@ -425,7 +438,7 @@ make_sigfield(u_char ** field,
     return VAL_NO_ERROR;
 
   err:
-    FREE(*field);
+    arena_free(*field);
     *field = NULL;
     *field_length = 0;
     return VAL_BAD_ARGUMENT;
@@ -478,15 +491,19 @@ do_verify(val_context_t * ctx,
     int clock_skew = 0;
     u_int32_t ttl_x = 0;
 
+    VAL_PROBE3(verify_start, the_key->algorithm,
+               the_key->public_key_len * 8, the_key->key_tag);
+
     /*
      * Wildcard expansions for DNSKEYs and DSs are not permitted
      */
     if (is_a_wildcard &&
         ((the_set->rrs_type_h == ns_t_ds) ||
          (the_set->rrs_type_h == ns_t_dnskey))) {
-        val_log(ctx, LOG_INFO, "do_verify(): Invalid DNSKEY or DS record - cannot be wildcard expanded");
+        VAL_LOG(ctx, LOG_INFO, "do_verify(): Invalid DNSKEY or DS record - cannot be wildcard expanded");
         *dnskey_status = VAL_AC_INVALID_KEY;
-        return 0;
+        ret_val = 0;
+        goto done;
     }
 
     if ((ret_val = make_sigfield(&ver_field, &ver_length, the_set, the_sig,
@@ -494,13 +511,14 @@ do_verify(val_context_t * ctx,
         ver_field == NULL || 
         ver_length == 0) {
 
-        val_log(ctx, LOG_INFO, 
+        VAL_LOG(ctx, LOG_INFO, 
                 "do_verify(): Could not construct signature field for verification: %s", 
                 p_val_err(ret_val));
         if (ver_field)
-            FREE(ver_field);
+            arena_free(ver_field);
         *sig_status = VAL_AC_INVALID_RRSIG;
-        return 0;
+        ret_val = 0;
+        goto done;
     }
 
     /*
@@ -511,18 +529,19 @@ do_verify(val_context_t * ctx,
                                    the_sig->rr_rdata_length,
                                    &rrsig_rdata)) {
         if (ver_field)
-            FREE(ver_field);
-        val_log(ctx, LOG_INFO, 
+            arena_free(ver_field);
+        VAL_LOG(ctx, LOG_INFO, 
                 "do_verify(): Could not parse signature field");
         *sig_status = VAL_AC_INVALID_RRSIG;
-        return 0;
+        ret_val = 0;
+        goto done;
     }
 
     rrsig_rdata.next = NULL;
 
     if (flags & VAL_QUERY_IGNORE_SKEW) {
         clock_skew = -1;
-        val_log(ctx, LOG_DEBUG, "do_verify(): Ignoring clock skew"); 
+        VAL_LOG(ctx, LOG_DEBUG, "do_verify(): Ignoring clock skew"); 
     } else {
         get_clock_skew(ctx, zone_n, &clock_skew, &ttl_x);
         /* the state is valid for only as long as the policy validity period */
@@ -540,7 +559,11 @@ do_verify(val_context_t * ctx,
         rrsig_rdata.signature = NULL;
     }
 
-    FREE(ver_field);
+    arena_free(ver_field);
+
+  done:
+    VAL_PROBE4(verify_done, the_key->algorithm,
+               the_key->public_key_len * 8, ret_val, *sig_status);
     return ret_val;
 }
 
@@ -554,10 +577,12 @@ ds_hash_is_equal(val_context_t *ctx,
                  struct rrset_rr *dnskey, val_astatus_t * ds_status)
 {
     if ((dnskey == NULL) || (ds_hash == NULL) || (name_n == NULL)) {
-        val_log(ctx, LOG_INFO, "ds_hash_is_equal(): Cannot compare DS data - invalid content");
+        VAL_LOG(ctx, LOG_INFO, "ds_hash_is_equal(): Cannot compare DS data - invalid content");
         return 0;
     }
 
+    res_stats_inc(RES_STAT_DS_DIGESTS);
+
     /*
      * Only SHA-1 is understood 
      */
@@ -584,7 +609,7 @@ ds_hash_is_equal(val_context_t *ctx,
     /* else */
 
     *ds_status = VAL_AC_ALGORITHM_NOT_SUPPORTED;
-    val_log(ctx, LOG_INFO, "ds_hash_is_equal(): Unsupported DS hash algorithm");
+    VAL_LOG(ctx, LOG_INFO, "ds_hash_is_equal(): Unsupported DS hash algorithm");
     return 0;
 }
 
@@ -609,6 +634,27 @@ check_label_count(struct rrset_rec *the_set,
     return 1;
 }
 
+/*
+ * Record the outcome for one RRSIG in the validation trace
+ */
+static void
+trace_rrsig(struct val_digested_auth_chain *as, struct rrset_rec *the_set,
+            struct rrset_rr *the_sig)
+{
+    u_int8_t        algorithm = 0;
+    u_int16_t       keytag = 0;
+
+    if (the_sig->rr_rdata_length >= SIGNBY) {
+        algorithm = the_sig->rr_rdata[RRSIGALGO];
+        keytag = (the_sig->rr_rdata[SIGNBY - 2] << 8) |
+            the_sig->rr_rdata[SIGNBY - 1];
+    }
+    val_trace_rrsig(as->val_ac_query ? as->val_ac_query->qc_trace_id : 0,
+                    the_set->rrs_name_n, the_set->rrs_type_h,
+                    the_set->rrs_class_h, the_sig->rr_status,
+                    algorithm, keytag);
+}
+
 /*
  * State returned in as->val_ac_status is one of:
  * VAL_AC_VERIFIED : at least one sig passed
@@ -665,7 +711,17 @@ verify_next_assertion(val_context_t * ctx,
     int success = 0;
 
     if ((as == NULL) || (as->val_ac_rrset.ac_data == NULL) || (the_trust == NULL)) {
-        val_log(ctx, LOG_INFO, "verify_next_assertion(): Cannot verify assertion - no data");
+        VAL_LOG(ctx, LOG_INFO, "verify_next_assertion(): Cannot verify assertion - no data");
+        return;
+    }
+
+    /*
+     * The status of each RRSIG, key and DS is recorded in the records
+     */
+    if (VAL_NO_ERROR != unshare_assertion(as) ||
+        VAL_NO_ERROR != unshare_assertion(the_trust)) {
+        VAL_LOG(ctx, LOG_INFO, "verify_next_assertion(): Cannot copy cached data");
+        as->val_ac_status = VAL_AC_NOT_VERIFIED;
         return;
     }
 
@@ -673,11 +729,12 @@ verify_next_assertion(val_context_t * ctx,
     dnskey.public_key = NULL;
 
 
-    if (-1 == ns_name_ntop(the_set->rrs_name_n, name_p, sizeof(name_p)))
+    if (VAL_LOG_ENABLED(LOG_INFO) &&
+        -1 == ns_name_ntop(the_set->rrs_name_n, name_p, sizeof(name_p)))
         snprintf(name_p, sizeof(name_p), "unknown/error");
 
     if (the_set->rrs_sig == NULL) {
-        val_log(ctx, LOG_INFO, "verify_next_assertion(): RRSIG is missing");
+        VAL_LOG(ctx, LOG_INFO, "verify_next_assertion(): RRSIG is missing");
         as->val_ac_status = VAL_AC_RRSIG_MISSING;
         return;
     }
@@ -687,7 +744,7 @@ verify_next_assertion(val_context_t * ctx,
          * trust path contains the key 
          */
         if (the_trust->val_ac_rrset.ac_data == NULL) {
-            val_log(ctx, LOG_INFO, "verify_next_assertion(): Key is empty");
+            VAL_LOG(ctx, LOG_INFO, "verify_next_assertion(): Key is empty");
             as->val_ac_status = VAL_AC_DNSKEY_MISSING;
             return;
         }
@@ -697,7 +754,7 @@ verify_next_assertion(val_context_t * ctx,
          * data itself contains the key 
          */
         if (the_set->rrs_data == NULL) {
-            val_log(ctx, LOG_INFO, "verify_next_assertion(): Key is empty");
+            VAL_LOG(ctx, LOG_INFO, "verify_next_assertion(): Key is empty");
             as->val_ac_status = VAL_AC_DNSKEY_MISSING;
             return;
         }
@@ -713,7 +770,9 @@ verify_next_assertion(val_context_t * ctx,
         if (!check_label_count(the_set, the_sig, &is_a_wildcard)) {
             SET_STATUS(as->val_ac_status, the_sig,
                        VAL_AC_WRONG_LABEL_COUNT);
-            val_log(ctx, LOG_INFO, "verify_next_assertion(): Incorrect RRSIG label count");
+            VAL_LOG(ctx, LOG_INFO, "verify_next_assertion(): Incorrect RRSIG label count");
+            if (val_trace_enabled)
+                trace_rrsig(as, the_set, the_sig);
             continue;
         }
 
@@ -724,7 +783,9 @@ verify_next_assertion(val_context_t * ctx,
                               &signby_footprint_n)) {
             SET_STATUS(as->val_ac_status, the_sig,
                        VAL_AC_INVALID_RRSIG);
-            val_log(ctx, LOG_INFO, "verify_next_assertion(): Cannot extract key footprint from RRSIG");
+            VAL_LOG(ctx, LOG_INFO, "verify_next_assertion(): Cannot extract key footprint from RRSIG");
+            if (val_trace_enabled)
+                trace_rrsig(as, the_set, the_sig);
             continue;
         }
 
@@ -734,7 +795,7 @@ verify_next_assertion(val_context_t * ctx,
             if (VAL_NO_ERROR != val_parse_dnskey_rdata(nextrr->rr_rdata,
                                              nextrr->rr_rdata_length,
                                              &dnskey)) {
-                val_log(ctx, LOG_INFO, "verify_next_assertion(): Cannot parse DNSKEY data");
+                VAL_LOG(ctx, LOG_INFO, "verify_next_assertion(): Cannot parse DNSKEY data");
                 nextrr->rr_status = VAL_AC_INVALID_KEY;
                 continue;
             }
@@ -748,7 +809,7 @@ verify_next_assertion(val_context_t * ctx,
                 continue;
             }
 
-            val_log(ctx, LOG_DEBUG, "verify_next_assertion(): Found potential matching DNSKEY for RRSIG");
+            VAL_LOG(ctx, LOG_DEBUG, "verify_next_assertion(): Found potential matching DNSKEY for RRSIG");
 
             /*
              * check the signature 
@@ -769,7 +830,7 @@ verify_next_assertion(val_context_t * ctx,
 
             if (is_verified) {
 
-                val_log(ctx, LOG_INFO, "verify_next_assertion(): Verified a RRSIG for %s (%s) using a DNSKEY (%d)",
+                VAL_LOG(ctx, LOG_INFO, "verify_next_assertion(): Verified a RRSIG for %s (%s) using a DNSKEY (%d)",
                         name_p, p_type(the_set->rrs_type_h),
                         dnskey.key_tag);
 
@@ -777,7 +838,7 @@ verify_next_assertion(val_context_t * ctx,
                     nextrr->rr_status == VAL_AC_TRUST_POINT) {
                     /* we've verified a trust anchor */
                     as->val_ac_status = VAL_AC_TRUST; 
-                    val_log(ctx, LOG_INFO, "verify_next_assertion(): verification traces back to trust anchor");
+                    VAL_LOG(ctx, LOG_INFO, "verify_next_assertion(): verification traces back to trust anchor");
                     if (dnskey.public_key != NULL) {
                         FREE(dnskey.public_key);
                         dnskey.public_key = NULL;
@@ -807,15 +868,15 @@ verify_next_assertion(val_context_t * ctx,
                         retval = val_parse_ds_rdata(dsrec->rr_rdata,
                                        dsrec->rr_rdata_length, &ds);
                         if(retval == VAL_NOT_IMPLEMENTED) {
-                            val_log(ctx, LOG_INFO, "verify_next_assertion(): DS hash not supported");
+                            VAL_LOG(ctx, LOG_INFO, "verify_next_assertion(): DS hash not supported");
                             dsrec->rr_status = VAL_AC_ALGORITHM_NOT_SUPPORTED;
                         } else if (retval != VAL_NO_ERROR) {
-                            val_log(ctx, LOG_INFO, "verify_next_assertion(): DS parse error");
+                            VAL_LOG(ctx, LOG_INFO, "verify_next_assertion(): DS parse error");
                             dsrec->rr_status = VAL_AC_INVALID_DS;
                         } else if (DNSKEY_MATCHES_DS(ctx, &dnskey, &ds, 
                                     the_set->rrs_name_n, nextrr, 
                                     &dsrec->rr_status)) {
-                            val_log(ctx, LOG_DEBUG, 
+                            VAL_LOG(ctx, LOG_DEBUG, 
                                     "verify_next_assertion(): DNSKEY tag (%d) matches DS tag (%d)",
                                     (&dnskey)->key_tag,                                         
                                     (&ds)->d_keytag);
@@ -830,7 +891,7 @@ verify_next_assertion(val_context_t * ctx,
                                 FREE(dnskey.public_key);
                                 dnskey.public_key = NULL;
                             }
-                            val_log(ctx, LOG_INFO, "verify_next_assertion(): Key links upward");
+                            VAL_LOG(ctx, LOG_INFO, "verify_next_assertion(): Key links upward");
                             success = 1;
                             break;
                         } else {
@@ -858,9 +919,11 @@ verify_next_assertion(val_context_t * ctx,
         }
 
         if (the_sig->rr_status == VAL_AC_UNSET) {
-            val_log(ctx, LOG_INFO, "verify_next_assertion(): Could not link this RRSIG to a DNSKEY");
+            VAL_LOG(ctx, LOG_INFO, "verify_next_assertion(): Could not link this RRSIG to a DNSKEY");
             SET_STATUS(as->val_ac_status, the_sig, VAL_AC_DNSKEY_NOMATCH);
         }
+        if (val_trace_enabled)
+            trace_rrsig(as, the_set, the_sig);
 
         /* Continue checking only if we want to verify all signatures */
         if (success && !(flags & VAL_QUERY_CHECK_ALL_RRSIGS)) {
@@ -409,7 +409,7 @@ compose_answer(const char * name,
         hp->nscount = htons(nscount);
         hp->arcount = htons(arcount);
 
-        switch (res->val_rc_status) {
+        switch (VAL_BASE_STATUS(res->val_rc_status)) {
             case VAL_NONEXISTENT_TYPE:
             case VAL_NONEXISTENT_TYPE_NOCHAIN: 
                 hp->rcode = ns_r_noerror;
@@ -530,7 +530,7 @@ val_res_query(val_context_t * context,
     if (ctx == NULL)
         goto err;
     
-    val_log(ctx, LOG_DEBUG,
+    VAL_LOG(ctx, LOG_DEBUG,
             "val_res_query(): called with dname=%s, class=%s, type=%s",
             dname, p_class(class_h), p_type(type));
 
@@ -572,7 +572,7 @@ val_res_query(val_context_t * context,
     return totalbytes;
 
 err:
-    val_log(ctx, LOG_ERR, "val_res_query(%s, %d, %d): Error - %s", 
+    VAL_LOG(ctx, LOG_ERR, "val_res_query(%s, %d, %d): Error - %s", 
             dname, p_class(class_h), p_type(type), p_val_err(retval));
     //SET_LAST_ERR(NETDB_INTERNAL);
     SET_LAST_ERR(NO_RECOVERY);
@@ -602,12 +602,12 @@ val_res_search(val_context_t * context, const char *dname, int class_h,
         return -1;
     }
 
-    val_log(ctx, LOG_DEBUG,
+    VAL_LOG(ctx, LOG_DEBUG,
             "val_res_query(): called with dname=%s, class=%s, type=%s",
             dname, p_class(class_h), p_type(type));
 
     if ((dname == NULL) || (val_status == NULL) || (answer == NULL)) {
-        val_log(ctx, LOG_ERR, "val_res_search(%s, %d, %d): Error - %s", 
+        VAL_LOG(ctx, LOG_ERR, "val_res_search(%s, %d, %d): Error - %s", 
             dname, p_class(class_h), p_type(type), p_val_err(VAL_BAD_ARGUMENT));
         errno = EINVAL;
         retval = -1;
@@ -0,0 +1,866 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * Reader for zone files in master file format (RFC 1035, section 5).
+ * Records are encoded to wire format and handed to a callback one at
+ * a time; what to keep is up to the caller.  Used for the zone-mirror
+ * policy (see val_mirror.c), and by the replay benchmark to load the
+ * zones it serves.
+ */
+#include "validator-internal.h"
+
+#include "val_support.h"
+#include "val_crypto.h"
+#include "val_zonefile.h"
+
+#define ZONEFILE_MAX_TOKENS  1024
+#define ZONEFILE_MAX_RDATA   65535
+
+#define ZONEFILE_LOWER(c) (((c) >= 'A' && (c) <= 'Z') ? ((c) + 'a' - 'A') : (c))
+
+/*
+ * State while reading a zone file
+ */
+struct zonefile_parser {
+    char           *cur;
+    char           *end;
+    char           *tokbuf;
+    int             line;
+    u_char          origin_n[NS_MAXCDNAME];
+    u_char          owner_n[NS_MAXCDNAME];
+    int             have_owner;
+    u_int16_t       last_class;
+    u_int32_t       default_ttl;
+    int             have_default_ttl;
+    u_int32_t       last_ttl;
+    int             have_last_ttl;
+};
+
+/*
+ * Types that the resolver's symbol table does not know about
+ */
+static const struct {
+    const char     *name;
+    u_int16_t       type;
+} zonefile_extra_types[] = {
+    {"NSEC3PARAM", 51},
+    {"CDS", 59},
+    {"CDNSKEY", 60},
+    {"CSYNC", 62},
+    {"ZONEMD", 63},
+    {NULL, 0}
+};
+
+/*
+ * Read the tokens of the next logical line (parentheses can make
+ * one span several physical lines).  Returns 1 if a line was read,
+ * 0 at end of file and -1 on a syntax error.
+ */
+static int
+zonefile_read_line(struct zonefile_parser *p, char **tok, int *ntok,
+                   int *blank_owner)
+{
+    char           *out = p->tokbuf;
+    int             paren = 0;
+    int             line_start = 1;
+
+    *ntok = 0;
+    *blank_owner = 0;
+
+    while (p->cur < p->end) {
+        char c = *p->cur;
+
+        if (c == '\n') {
+            p->line++;
+            p->cur++;
+            line_start = 1;
+            if (paren == 0) {
+                if (*ntok > 0)
+                    return 1;
+                *blank_owner = 0;
+            }
+            continue;
+        }
+        if (c == ' ' || c == '\t' || c == '\r') {
+            if (line_start && paren == 0 && *ntok == 0)
+                *blank_owner = 1;
+            line_start = 0;
+            p->cur++;
+            continue;
+        }
+        line_start = 0;
+        if (c == ';') {
+            while (p->cur < p->end && *p->cur != '\n')
+                p->cur++;
+            continue;
+        }
+        if (c == '(') {
+            paren++;
+            p->cur++;
+            continue;
+        }
+        if (c == ')') {
+            if (paren == 0)
+                return -1;
+            paren--;
+            p->cur++;
+            continue;
+        }
+        if (*ntok == ZONEFILE_MAX_TOKENS)
+            return -1;
+        tok[(*ntok)++] = out;
+        if (c == '"') {
+            /* keep the quotes so that empty strings survive */
+            *out++ = *p->cur++;
+            while (p->cur < p->end && *p->cur != '"') {
+                if (*p->cur == '\n')
+                    return -1;
+                if (*p->cur == '\\' && p->cur + 1 < p->end)
+                    *out++ = *p->cur++;
+                *out++ = *p->cur++;
+            }
+            if (p->cur >= p->end)
+                return -1;
+            *out++ = *p->cur++;
+        } else {
+            while (p->cur < p->end && !isspace((u_char) *p->cur) &&
+                   *p->cur != ';' && *p->cur != '(' &&
+                   *p->cur != ')' && *p->cur != '"') {
+                if (*p->cur == '\\' && p->cur + 1 < p->end)
+                    *out++ = *p->cur++;
+                *out++ = *p->cur++;
+            }
+        }
+        *out++ = '\0';
+    }
+    if (paren)
+        return -1;
+    return (*ntok > 0) ? 1 : 0;
+}
+
+/*
+ * Convert a (possibly relative) name in presentation format
+ */
+static int
+zonefile_name_pton(struct zonefile_parser *p, const char *tok, u_char *name_n)
+{
+    char            abs_p[NS_MAXDNAME * 2];
+    char            origin_p[NS_MAXDNAME];
+    size_t          len = strlen(tok);
+
+    if (!strcmp(tok, "@")) {
+        memcpy(name_n, p->origin_n, wire_name_length(p->origin_n));
+        return VAL_NO_ERROR;
+    }
+    if (len > 0 && tok[len - 1] == '.' &&
+        (len < 2 || tok[len - 2] != '\\')) {
+        if (ns_name_pton(tok, name_n, NS_MAXCDNAME) == -1)
+            return VAL_CONF_PARSE_ERROR;
+        return VAL_NO_ERROR;
+    }
+    if (-1 == ns_name_ntop(p->origin_n, origin_p, sizeof(origin_p)))
+        return VAL_CONF_PARSE_ERROR;
+    if (!strcmp(origin_p, "."))
+        snprintf(abs_p, sizeof(abs_p), "%s.", tok);
+    else
+        snprintf(abs_p, sizeof(abs_p), "%s.%s", tok, origin_p);
+    if (ns_name_pton(abs_p, name_n, NS_MAXCDNAME) == -1)
+        return VAL_CONF_PARSE_ERROR;
+    return VAL_NO_ERROR;
+}
+
+static int
+zonefile_nametotype(const char *tok, u_int16_t *type_h)
+{
+    int             success = 0;
+    int             i;
+
+    *type_h = res_nametotype(tok, &success);
+    if (success)
+        return 1;
+    for (i = 0; zonefile_extra_types[i].name; i++) {
+        if (!strcasecmp(tok, zonefile_extra_types[i].name)) {
+            *type_h = zonefile_extra_types[i].type;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int
+zonefile_is_class(const char *tok, u_int16_t *class_h)
+{
+    int             success = 0;
+
+    if (!isalpha((u_char) tok[0]))
+        return 0;
+    *class_h = res_nametoclass(tok, &success);
+    return success;
+}
+
+/*
+ * Parse a TTL: a number of seconds, or numbers with W, D, H, M or S
+ * units as in "1h30m".  A number without a unit may not follow ones
+ * with units.
+ */
+static int
+zonefile_parse_ttl(const char *tok, u_int32_t *ttl)
+{
+    unsigned long   total = 0, num, unit;
+    int             units = 0;
+    const char     *cp = tok;
+
+    if (*cp == '\0')
+        return -1;
+    while (*cp) {
+        if (!isdigit((u_char) *cp))
+            return -1;
+        for (num = 0; isdigit((u_char) *cp); cp++) {
+            num = num * 10 + (*cp - '0');
+            if (num > 0xffffffffUL)
+                return -1;
+        }
+        switch (*cp) {
+        case 'w': case 'W':
+            unit = 7 * 24 * 3600;
+            break;
+        case 'd': case 'D':
+            unit = 24 * 3600;
+            break;
+        case 'h': case 'H':
+            unit = 3600;
+            break;
+        case 'm': case 'M':
+            unit = 60;
+            break;
+        case 's': case 'S':
+            unit = 1;
+            break;
+        case '\0':
+            if (units)
+                return -1;
+            unit = 1;
+            break;
+        default:
+            return -1;
+        }
+        if (*cp) {
+            cp++;
+            units++;
+        }
+        if (num > (0xffffffffUL - total) / unit)
+            return -1;
+        total += num * unit;
+    }
+    *ttl = (u_int32_t) total;
+    return 0;
+}
+
+/*
+ * Convert YYYYMMDDHHmmSS (or a plain number of seconds) to a time
+ */
+static int
+zonefile_parse_time(const char *tok, u_int32_t *t)
+{
+    int             v[6], i;
+    long            y, m, d, era, yoe, doy, doe, days;
+    const int       len[6] = { 4, 2, 2, 2, 2, 2 };
+    const char     *cp = tok;
+
+    if (strlen(tok) != 14) {
+        char *ep;
+        unsigned long val = strtoul(tok, &ep, 10);
+        if (*tok == '\0' || *ep != '\0')
+            return -1;
+        *t = (u_int32_t) val;
+        return 0;
+    }
+    for (i = 0; i < 6; i++) {
+        int j;
+        v[i] = 0;
+        for (j = 0; j < len[i]; j++, cp++) {
+            if (!isdigit((u_char) *cp))
+                return -1;
+            v[i] = v[i] * 10 + (*cp - '0');
+        }
+    }
+    /* days since the epoch, proleptic Gregorian calendar */
+    y = v[0];
+    m = v[1];
+    d = v[2];
+    y -= (m <= 2);
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = y - era * 400;
+    doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    days = era * 146097 + doe - 719468;
+
+    *t = (u_int32_t) (days * 86400 + v[3] * 3600 + v[4] * 60 + v[5]);
+    return 0;
+}
+
+static int
+zonefile_put8(u_char *rdata, size_t *len, unsigned long v)
+{
+    if (*len + 1 > ZONEFILE_MAX_RDATA || v > 0xff)
+        return VAL_CONF_PARSE_ERROR;
+    rdata[(*len)++] = (u_char) v;
+    return VAL_NO_ERROR;
+}
+
+static int
+zonefile_put16(u_char *rdata, size_t *len, unsigned long v)
+{
+    if (*len + 2 > ZONEFILE_MAX_RDATA || v > 0xffff)
+        return VAL_CONF_PARSE_ERROR;
+    rdata[(*len)++] = (u_char) (v >> 8);
+    rdata[(*len)++] = (u_char) v;
+    return VAL_NO_ERROR;
+}
+
+static int
+zonefile_put32(u_char *rdata, size_t *len, unsigned long v)
+{
+    if (*len + 4 > ZONEFILE_MAX_RDATA)
+        return VAL_CONF_PARSE_ERROR;
+    rdata[(*len)++] = (u_char) (v >> 24);
+    rdata[(*len)++] = (u_char) (v >> 16);
+    rdata[(*len)++] = (u_char) (v >> 8);
+    rdata[(*len)++] = (u_char) v;
+    return VAL_NO_ERROR;
+}
+
+static int
+zonefile_put_num(u_char *rdata, size_t *len, const char *tok, int width)
+{
+    char           *ep;
+    unsigned long   v;
+
+    v = strtoul(tok, &ep, 10);
+    if (*tok == '\0' || *ep != '\0')
+        return VAL_CONF_PARSE_ERROR;
+    if (width == 1)
+        return zonefile_put8(rdata, len, v);
+    if (width == 2)
+        return zonefile_put16(rdata, len, v);
+    return zonefile_put32(rdata, len, v);
+}
+
+static int
+zonefile_put_name(struct zonefile_parser *p, u_char *rdata, size_t *len,
+                  const char *tok)
+{
+    u_char          name_n[NS_MAXCDNAME];
+    size_t          n;
+
+    if (VAL_NO_ERROR != zonefile_name_pton(p, tok, name_n))
+        return VAL_CONF_PARSE_ERROR;
+    n = wire_name_length(name_n);
+    if (*len + n > ZONEFILE_MAX_RDATA)
+        return VAL_CONF_PARSE_ERROR;
+    memcpy(&rdata[*len], name_n, n);
+    *len += n;
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Hex data, possibly split across several tokens
+ */
+static int
+zonefile_put_hex(u_char *rdata, size_t *len, char **tok, int ntok)
+{
+    int             i, half = 0;
+    u_char          byte = 0;
+    const char     *cp;
+
+    for (i = 0; i < ntok; i++) {
+        for (cp = tok[i]; *cp; cp++) {
+            int v;
+            if (!isxdigit((u_char) *cp))
+                return VAL_CONF_PARSE_ERROR;
+            v = isdigit((u_char) *cp) ? *cp - '0' :
+                    (ZONEFILE_LOWER(*cp) - 'a' + 10);
+            byte = (byte << 4) | v;
+            if (half) {
+                if (VAL_NO_ERROR != zonefile_put8(rdata, len, byte))
+                    return VAL_CONF_PARSE_ERROR;
+                byte = 0;
+            }
+            half = !half;
+        }
+    }
+    return half ? VAL_CONF_PARSE_ERROR : VAL_NO_ERROR;
+}
+
+/*
+ * Base64 data, possibly split across several tokens
+ */
+static int
+zonefile_put_base64(u_char *rdata, size_t *len, char **tok, int ntok)
+{
+    char           *b64;
+    size_t          b64_len = 0;
+    int             i, n;
+
+    for (i = 0; i < ntok; i++)
+        b64_len += strlen(tok[i]);
+    if (b64_len == 0)
+        return VAL_CONF_PARSE_ERROR;
+    b64 = (char *) MALLOC(b64_len + 1);
+    if (b64 == NULL)
+        return VAL_OUT_OF_MEMORY;
+    b64[0] = '\0';
+    for (i = 0; i < ntok; i++)
+        strcat(b64, tok[i]);
+
+    if (*len + (b64_len * 3) / 4 > ZONEFILE_MAX_RDATA) {
+        FREE(b64);
+        return VAL_CONF_PARSE_ERROR;
+    }
+    n = decode_base64_key(b64, &rdata[*len], ZONEFILE_MAX_RDATA - *len);
+    FREE(b64);
+    if (n <= 0)
+        return VAL_CONF_PARSE_ERROR;
+    *len += n;
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Base32hex data without padding (RFC 4648), for NSEC3 hashes
+ */
+static int
+zonefile_put_b32hex(u_char *rdata, size_t *len, const char *tok)
+{
+    u_int32_t       acc = 0;
+    int             bits = 0, v;
+    const char     *cp;
+
+    if (*tok == '\0')
+        return VAL_CONF_PARSE_ERROR;
+    for (cp = tok; *cp; cp++) {
+        if (isdigit((u_char) *cp))
+            v = *cp - '0';
+        else if (ZONEFILE_LOWER(*cp) >= 'a' && ZONEFILE_LOWER(*cp) <= 'v')
+            v = ZONEFILE_LOWER(*cp) - 'a' + 10;
+        else
+            return VAL_CONF_PARSE_ERROR;
+        acc = (acc << 5) | v;
+        bits += 5;
+        if (bits >= 8) {
+            bits -= 8;
+            if (VAL_NO_ERROR != zonefile_put8(rdata, len, (acc >> bits) & 0xff))
+                return VAL_CONF_PARSE_ERROR;
+        }
+    }
+    return VAL_NO_ERROR;
+}
+
+/*
+ * NSEC style type bitmap
+ */
+static int
+zonefile_put_types(u_char *rdata, size_t *len, char **tok, int ntok)
+{
+    u_char          bitmap[256][32];
+    int             window_len[256];
+    u_int16_t       type_h;
+    int             i, w;
+
+    memset(window_len, 0, sizeof(window_len));
+    memset(bitmap, 0, sizeof(bitmap));
+    for (i = 0; i < ntok; i++) {
+        if (!zonefile_nametotype(tok[i], &type_h))
+            return VAL_CONF_PARSE_ERROR;
+        w = type_h >> 8;
+        bitmap[w][(type_h & 0xff) / 8] |= 0x80 >> (type_h % 8);
+        if ((type_h & 0xff) / 8 + 1 > window_len[w])
+            window_len[w] = (type_h & 0xff) / 8 + 1;
+    }
+    for (w = 0; w < 256; w++) {
+        if (window_len[w] == 0)
+            continue;
+        if (VAL_NO_ERROR != zonefile_put8(rdata, len, w) ||
+            VAL_NO_ERROR != zonefile_put8(rdata, len, window_len[w]) ||
+            *len + window_len[w] > ZONEFILE_MAX_RDATA)
+            return VAL_CONF_PARSE_ERROR;
+        memcpy(&rdata[*len], bitmap[w], window_len[w]);
+        *len += window_len[w];
+    }
+    return VAL_NO_ERROR;
+}
+
+static int
+zonefile_put_string(u_char *rdata, size_t *len, const char *tok)
+{
+    size_t          start = *len;
+    const char     *cp = tok;
+    const char     *ep = tok + strlen(tok);
+
+    if (*cp == '"') {
+        cp++;
+        ep--;
+    }
+    (*len)++;
+    while (cp < ep) {
+        u_char c = *cp++;
+        if (c == '\\' && cp < ep) {
+            if (isdigit((u_char) cp[0]) && cp + 2 < ep + 1 &&
+                isdigit((u_char) cp[1]) && isdigit((u_char) cp[2])) {
+                c = (cp[0] - '0') * 100 + (cp[1] - '0') * 10 + (cp[2] - '0');
+                cp += 3;
+            } else {
+                c = *cp++;
+            }
+        }
+        if (*len - start > 255 || *len >= ZONEFILE_MAX_RDATA)
+            return VAL_CONF_PARSE_ERROR;
+        rdata[(*len)++] = c;
+    }
+    rdata[start] = (u_char) (*len - start - 1);
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Encode the rdata for one record.  *skip is set for types that
+ * we don't know how to encode.
+ */
+static int
+zonefile_put_rdata(struct zonefile_parser *p, u_int16_t type_h, char **tok,
+                   int ntok, u_char *rdata, size_t *len, int *skip)
+{
+    u_int16_t       covered_h;
+    u_int32_t       t;
+    int             i;
+
+    *len = 0;
+    *skip = 0;
+
+    /* RFC 3597 generic encoding */
+    if (ntok >= 2 && !strcmp(tok[0], "\\#")) {
+        if (VAL_NO_ERROR != zonefile_put_hex(rdata, len, &tok[2], ntok - 2) ||
+            *len != strtoul(tok[1], NULL, 10))
+            return VAL_CONF_PARSE_ERROR;
+        return VAL_NO_ERROR;
+    }
+
+#define NEED_TOKENS(n) do { if (ntok < (n)) return VAL_CONF_PARSE_ERROR; } while (0)
+#define PUT(expr) do { if (VAL_NO_ERROR != (expr)) return VAL_CONF_PARSE_ERROR; } while (0)
+
+    switch (type_h) {
+    case ns_t_a:
+        NEED_TOKENS(1);
+        if (inet_pton(AF_INET, tok[0], rdata) != 1)
+            return VAL_CONF_PARSE_ERROR;
+        *len = sizeof(struct in_addr);
+        break;
+
+#ifdef VAL_IPV6
+    case ns_t_aaaa:
+        NEED_TOKENS(1);
+        if (inet_pton(AF_INET6, tok[0], rdata) != 1)
+            return VAL_CONF_PARSE_ERROR;
+        *len = sizeof(struct in6_addr);
+        break;
+#endif
+
+    case ns_t_ns:
+    case ns_t_cname:
+    case ns_t_dname:
+    case ns_t_ptr:
+        NEED_TOKENS(1);
+        PUT(zonefile_put_name(p, rdata, len, tok[0]));
+        break;
+
+    case ns_t_mx:
+        NEED_TOKENS(2);
+        PUT(zonefile_put_num(rdata, len, tok[0], 2));
+        PUT(zonefile_put_name(p, rdata, len, tok[1]));
+        break;
+
+    case ns_t_srv:
+        NEED_TOKENS(4);
+        for (i = 0; i < 3; i++)
+            PUT(zonefile_put_num(rdata, len, tok[i], 2));
+        PUT(zonefile_put_name(p, rdata, len, tok[3]));
+        break;
+
+    case ns_t_soa:
+        NEED_TOKENS(7);
+        PUT(zonefile_put_name(p, rdata, len, tok[0]));
+        PUT(zonefile_put_name(p, rdata, len, tok[1]));
+        PUT(zonefile_put_num(rdata, len, tok[2], 4));
+        for (i = 3; i < 7; i++) {
+            u_int32_t ttl;
+            if (-1 == zonefile_parse_ttl(tok[i], &ttl))
+                return VAL_CONF_PARSE_ERROR;
+            PUT(zonefile_put32(rdata, len, ttl));
+        }
+        break;
+
+    case ns_t_txt:
+        NEED_TOKENS(1);
+        for (i = 0; i < ntok; i++)
+            PUT(zonefile_put_string(rdata, len, tok[i]));
+        break;
+
+    case ns_t_ds:
+    case 59:    /* CDS */
+        NEED_TOKENS(4);
+        PUT(zonefile_put_num(rdata, len, tok[0], 2));
+        PUT(zonefile_put_num(rdata, len, tok[1], 1));
+        PUT(zonefile_put_num(rdata, len, tok[2], 1));
+        PUT(zonefile_put_hex(rdata, len, &tok[3], ntok - 3));
+        break;
+
+    case ns_t_dnskey:
+    case 60:    /* CDNSKEY */
+        NEED_TOKENS(4);
+        PUT(zonefile_put_num(rdata, len, tok[0], 2));
+        PUT(zonefile_put_num(rdata, len, tok[1], 1));
+        PUT(zonefile_put_num(rdata, len, tok[2], 1));
+        PUT(zonefile_put_base64(rdata, len, &tok[3], ntok - 3));
+        break;
+
+    case ns_t_rrsig:
+        NEED_TOKENS(9);
+        if (!zonefile_nametotype(tok[0], &covered_h))
+            return VAL_CONF_PARSE_ERROR;
+        PUT(zonefile_put16(rdata, len, covered_h));
+        PUT(zonefile_put_num(rdata, len, tok[1], 1));
+        PUT(zonefile_put_num(rdata, len, tok[2], 1));
+        PUT(zonefile_put_num(rdata, len, tok[3], 4));
+        if (zonefile_parse_time(tok[4], &t))
+            return VAL_CONF_PARSE_ERROR;
+        PUT(zonefile_put32(rdata, len, t));
+        if (zonefile_parse_time(tok[5], &t))
+            return VAL_CONF_PARSE_ERROR;
+        PUT(zonefile_put32(rdata, len, t));
+        PUT(zonefile_put_num(rdata, len, tok[6], 2));
+        PUT(zonefile_put_name(p, rdata, len, tok[7]));
+        PUT(zonefile_put_base64(rdata, len, &tok[8], ntok - 8));
+        break;
+
+    case ns_t_nsec:
+        NEED_TOKENS(1);
+        PUT(zonefile_put_name(p, rdata, len, tok[0]));
+        PUT(zonefile_put_types(rdata, len, &tok[1], ntok - 1));
+        break;
+
+    case ns_t_nsec3:
+    case 51:    /* NSEC3PARAM */
+        NEED_TOKENS(type_h == ns_t_nsec3 ? 5 : 4);
+        PUT(zonefile_put_num(rdata, len, tok[0], 1));
+        PUT(zonefile_put_num(rdata, len, tok[1], 1));
+        PUT(zonefile_put_num(rdata, len, tok[2], 2));
+        if (!strcmp(tok[3], "-")) {
+            PUT(zonefile_put8(rdata, len, 0));
+        } else {
+            size_t salt = *len;
+            PUT(zonefile_put8(rdata, len, 0));
+            PUT(zonefile_put_hex(rdata, len, &tok[3], 1));
+            rdata[salt] = (u_char) (*len - salt - 1);
+        }
+        if (type_h == ns_t_nsec3) {
+            size_t hash = *len;
+            PUT(zonefile_put8(rdata, len, 0));
+            PUT(zonefile_put_b32hex(rdata, len, tok[4]));
+            rdata[hash] = (u_char) (*len - hash - 1);
+            PUT(zonefile_put_types(rdata, len, &tok[5], ntok - 5));
+        }
+        break;
+
+    case 63:    /* ZONEMD */
+        NEED_TOKENS(4);
+        PUT(zonefile_put_num(rdata, len, tok[0], 4));
+        PUT(zonefile_put_num(rdata, len, tok[1], 1));
+        PUT(zonefile_put_num(rdata, len, tok[2], 1));
+        PUT(zonefile_put_hex(rdata, len, &tok[3], ntok - 3));
+        break;
+
+    default:
+        *skip = 1;
+        break;
+    }
+
+#undef PUT
+#undef NEED_TOKENS
+
+    return VAL_NO_ERROR;
+}
+
+
+/*
+ * Parse one logical line of the zone file and pass its record on
+ */
+static int
+zonefile_parse_line(val_context_t *ctx, struct zonefile_parser *p,
+                    char **tok, int ntok, int blank_owner, u_char *rdata,
+                    zone_file_rr_cb cb, void *cb_data, int *skipped)
+{
+    u_int16_t       class_h = p->last_class;
+    u_int16_t       type_h;
+    u_int32_t       ttl_h = 0;
+    int             have_ttl = 0;
+    size_t          rdata_len;
+    int             i = 0, n, skip;
+    u_int32_t       ttl;
+
+    if (!blank_owner && tok[0][0] == '$') {
+        if (!strcasecmp(tok[0], "$ORIGIN") && ntok >= 2) {
+            u_char origin_n[NS_MAXCDNAME];
+            if (VAL_NO_ERROR != zonefile_name_pton(p, tok[1], origin_n))
+                return VAL_CONF_PARSE_ERROR;
+            memcpy(p->origin_n, origin_n, wire_name_length(origin_n));
+            return VAL_NO_ERROR;
+        }
+        if (!strcasecmp(tok[0], "$TTL") && ntok >= 2) {
+            if (-1 == zonefile_parse_ttl(tok[1], &ttl))
+                return VAL_CONF_PARSE_ERROR;
+            p->default_ttl = ttl;
+            p->have_default_ttl = 1;
+            return VAL_NO_ERROR;
+        }
+        VAL_LOG(ctx, LOG_WARNING,
+                "zonefile_parse_line(): Unsupported directive %s", tok[0]);
+        return VAL_CONF_PARSE_ERROR;
+    }
+
+    if (!blank_owner) {
+        if (VAL_NO_ERROR != zonefile_name_pton(p, tok[i++], p->owner_n))
+            return VAL_CONF_PARSE_ERROR;
+        p->have_owner = 1;
+    } else if (!p->have_owner) {
+        return VAL_CONF_PARSE_ERROR;
+    }
+
+    /* TTL and class can come in either order */
+    for (n = 0; n < 2 && i < ntok; n++) {
+        if (zonefile_is_class(tok[i], &class_h)) {
+            i++;
+        } else if (isdigit((u_char) tok[i][0]) &&
+                   -1 != zonefile_parse_ttl(tok[i], &ttl)) {
+            ttl_h = ttl;
+            have_ttl = 1;
+            i++;
+        }
+    }
+    p->last_class = class_h;
+
+    if (i >= ntok || !zonefile_nametotype(tok[i], &type_h))
+        return VAL_CONF_PARSE_ERROR;
+    i++;
+
+    if (VAL_NO_ERROR != zonefile_put_rdata(p, type_h, &tok[i], ntok - i,
+                                           rdata, &rdata_len, &skip))
+        return VAL_CONF_PARSE_ERROR;
+    if (skip) {
+        (*skipped)++;
+        return VAL_NO_ERROR;
+    }
+
+    if (!have_ttl) {
+        if (p->have_default_ttl)
+            ttl_h = p->default_ttl;
+        else if (p->have_last_ttl)
+            ttl_h = p->last_ttl;
+        else if (type_h == ns_t_soa)
+            ttl_h = (rdata[rdata_len - 4] << 24) | (rdata[rdata_len - 3] << 16) |
+                    (rdata[rdata_len - 2] << 8) | rdata[rdata_len - 1];
+        else
+            return VAL_CONF_PARSE_ERROR;
+    }
+    p->last_ttl = ttl_h;
+    p->have_last_ttl = 1;
+
+    return (*cb) (cb_data, p->owner_n, type_h, class_h, ttl_h,
+                  rdata, rdata_len);
+}
+
+/*
+ * Read a zone file and call cb for each of its records.  Relative
+ * names are relative to origin_n until the file sets its own $ORIGIN.
+ * Records of types that can't be encoded are counted in *skipped, and
+ * on a parse error, *err_line (if given) is set to where it happened.
+ */
+int
+read_zone_file(val_context_t *ctx, const char *file, const u_char *origin_n,
+               zone_file_rr_cb cb, void *cb_data, int *skipped, int *err_line)
+{
+    struct zonefile_parser p;
+    char           *buf = NULL;
+    char          **tok = NULL;
+    u_char         *rdata = NULL;
+    struct stat     sb;
+    int             fd = -1;
+    int             ntok, blank, rc;
+    int             retval = VAL_NO_ERROR;
+
+    if (file == NULL || origin_n == NULL || cb == NULL || skipped == NULL)
+        return VAL_BAD_ARGUMENT;
+
+    *skipped = 0;
+    memset(&p, 0, sizeof(p));
+
+    if ((fd = open(file, O_RDONLY)) < 0 || 0 != fstat(fd, &sb)) {
+        VAL_LOG(ctx, LOG_WARNING,
+                "read_zone_file(): Could not open zone file %s", file);
+        retval = VAL_CONF_NOT_FOUND;
+        goto done;
+    }
+    buf = (char *) MALLOC(sb.st_size + 1);
+    p.tokbuf = (char *) MALLOC(sb.st_size + 1);
+    tok = (char **) MALLOC(ZONEFILE_MAX_TOKENS * sizeof(char *));
+    rdata = (u_char *) MALLOC(ZONEFILE_MAX_RDATA * sizeof(u_char));
+    if (buf == NULL || p.tokbuf == NULL || tok == NULL || rdata == NULL) {
+        retval = VAL_OUT_OF_MEMORY;
+        goto done;
+    }
+    if (sb.st_size != read(fd, buf, sb.st_size)) {
+        VAL_LOG(ctx, LOG_WARNING,
+                "read_zone_file(): Could not read zone file %s", file);
+        retval = VAL_CONF_NOT_FOUND;
+        goto done;
+    }
+    close(fd);
+    fd = -1;
+
+    p.cur = buf;
+    p.end = buf + sb.st_size;
+    p.line = 1;
+    p.last_class = ns_c_in;
+    memcpy(p.origin_n, origin_n, wire_name_length(origin_n));
+
+    while (0 != (rc = zonefile_read_line(&p, tok, &ntok, &blank))) {
+        if (rc < 0 ||
+            VAL_NO_ERROR != (retval = zonefile_parse_line(ctx, &p, tok, ntok,
+                                                          blank, rdata, cb,
+                                                          cb_data, skipped))) {
+            if (rc < 0 || retval == VAL_CONF_PARSE_ERROR) {
+                VAL_LOG(ctx, LOG_WARNING,
+                        "read_zone_file(): Parse error around line %d of %s",
+                        p.line, file);
+                if (err_line)
+                    *err_line = p.line;
+            }
+            if (rc < 0)
+                retval = VAL_CONF_PARSE_ERROR;
+            goto done;
+        }
+    }
+
+  done:
+    if (fd >= 0)
+        close(fd);
+    if (buf)
+        FREE(buf);
+    if (p.tokbuf)
+        FREE(p.tokbuf);
+    if (tok)
+        FREE(tok);
+    if (rdata)
+        FREE(rdata);
+    return retval;
+}
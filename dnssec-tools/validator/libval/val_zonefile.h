@@ -0,0 +1,21 @@
+/*
+ * Copyright 2005-2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+#ifndef VAL_ZONEFILE_H
+#define VAL_ZONEFILE_H
+
+/*
+ * Called by read_zone_file() with each record, in wire format.
+ * Anything but VAL_NO_ERROR stops the read and is returned from it.
+ */
+typedef int     (*zone_file_rr_cb) (void *cb_data, const u_char *owner_n,
+                                    u_int16_t type_h, u_int16_t class_h,
+                                    u_int32_t ttl_h, const u_char *rdata,
+                                    size_t rdata_len);
+
+int             read_zone_file(val_context_t *ctx, const char *file,
+                               const u_char *origin_n, zone_file_rr_cb cb,
+                               void *cb_data, int *skipped, int *err_line);
+
+#endif